@@ -11,6 +11,10 @@ SRC=( optics
       poller
       backend_stdout
       backend_carbon
+      backend_statsd
+      backend_file
+      backend_jsonl
+      backend_push
       backend_rest
       utils/utils
       utils/crest/crest )
@@ -19,28 +23,60 @@ declare -a TEST
 TEST=( timer
        htable
        buffer
+       fmt
+       uring
+       slab
+       region
+       arena
+       numa
        key
        lens
        lens_counter
        lens_dist
        lens_gauge
        lens_histo
+       lens_histo2d
+       lens_hdr
+       lens_sketch
        lens_quantile
+       lens_quantiles
+       lens_meter
+       lens_topk
+       lens_hll
+       lens_updown
+       lens_family
+       lens_static
        poller
        poller_lens
        backend_carbon
+       backend_statsd
+       backend_file
+       backend_jsonl
+       backend_push
        backend_rest
        crest )
 
 declare -a BENCH
 BENCH=( timer
         htable
+        fmt
         lens
         lens_counter
         lens_dist
         lens_gauge
         lens_histo
-        lens_quantile )
+        lens_histo2d
+        lens_hdr
+        lens_sketch
+        lens_quantile
+        lens_quantiles
+        lens_meter
+        lens_topk
+        lens_hll
+        lens_updown
+        lens_family
+        lens_churn
+        poller )
 
 PKG_CONFIGS=( optics optics_static )
 
@@ -64,7 +100,7 @@ CFLAGS="$CFLAGS -fno-strict-aliasing"
 CFLAGS="$CFLAGS -Wno-implicit-fallthrough"
 
 LIB="liboptics.a"
-DEPS="-lbsd -lmicrohttpd"
+DEPS="-lbsd -lmicrohttpd -lz -lm"
 
 export CMOCKA_TEST_ABORT=1
 
@@ -90,6 +126,8 @@ BENCH_DEPS="bench.o test.o $LIB $DEPS -lcmocka"
 
 "$CC" -c -o example "${PREFIX}/test/example.c" $DEPS $CFLAGS
 
+"$CC" -o optics_file "${PREFIX}/tools/optics_file.c" $CFLAGS $LIB $DEPS
+
 
 version() {
     git --git-dir "${PREFIX}" describe --tags --exact-match 2> /dev/null \
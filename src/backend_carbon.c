@@ -7,102 +7,465 @@
 #include "utils/errors.h"
 #include "utils/socket.h"
 #include "utils/buffer.h"
+#include "utils/time.h"
 
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 
 // -----------------------------------------------------------------------------
-// carbon
+// config
 // -----------------------------------------------------------------------------
 
+enum
+{
+    // Largest amount of data handed to a single send call.
+    carbon_send_chunk = 64 * 1024,
+
+    // Delay between two connection attempts.
+    carbon_retry_ms = 100,
+
+    // Delay before sending again when the drain rate has been exhausted.
+    carbon_refill_ms = 10,
+
+    carbon_spill_default = 16,
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The poll thread only formats the lines of a poll and queues them. Everything
+// related to the socket is handled by an io thread driven by epoll which means
+// that the poll thread never blocks on a connect or a send. The queue holds the
+// last spill_len polls to ride out an outage of the carbon relay.
+
+struct carbon_chunk
+{
+    struct carbon_chunk *next;
+    size_t len;
+    char data[];
+};
+
+enum carbon_state
+{
+    carbon_disconnected,
+    carbon_connecting,
+    carbon_connected,
+};
+
 struct carbon
 {
+    struct optics_poller *poller;
     const char *host;
     const char *port;
+    size_t spill_len;
+    size_t rate;
+
+    // poll thread
+    struct buffer buffer;
+
+    // Synchronizes the queue between the poll and the io thread.
+    pthread_mutex_t lock;
+    struct carbon_chunk *head, *tail;
+    size_t queued;
+    size_t dropped;
+    bool stop;
+
+    // io thread
+    pthread_t thread;
+    int epoll_fd;
+    int event_fd;
 
     int fd;
-    uint64_t last_attempt;
+    enum carbon_state state;
+    uint64_t retry_at;
+    bool connected;
+
+    struct carbon_chunk *current;
+    size_t sent;
+
+    double tokens;
+    uint64_t refill_at;
 };
 
-static bool carbon_connect(struct carbon *carbon)
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static uint64_t carbon_now()
 {
-    optics_assert(carbon->fd <= 0,
-            "attempting to connect to carbon while already connected");
+    struct timespec ts;
+    clock_monotonic(&ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / (1000 * 1000);
+}
 
-    carbon->fd = socket_stream_connect(carbon->host, carbon->port);
-    if (carbon->fd > 0) return true;
+static void carbon_wake(struct carbon *carbon)
+{
+    uint64_t value = 1;
+    if (write(carbon->event_fd, &value, sizeof(value)) != sizeof(value))
+        optics_warn_errno("unable to wake carbon io thread");
+}
 
-    optics_perror(&optics_errno);
-    return false;
+static void carbon_watch(struct carbon *carbon, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data = { .fd = carbon->fd } };
+    if (epoll_ctl(carbon->epoll_fd, EPOLL_CTL_MOD, carbon->fd, &ev) == -1)
+        optics_warn_errno("unable to modify carbon epoll");
+}
+
+
+// -----------------------------------------------------------------------------
+// connection
+// -----------------------------------------------------------------------------
+
+static void carbon_disconnect(struct carbon *carbon)
+{
+    if (carbon->fd >= 0) {
+        epoll_ctl(carbon->epoll_fd, EPOLL_CTL_DEL, carbon->fd, NULL);
+        close(carbon->fd);
+    }
+
+    carbon->fd = -1;
+    carbon->state = carbon_disconnected;
+    carbon->retry_at = carbon_now() + carbon_retry_ms;
+
+    // The chunk is resent from the start on reconnection. Carbon keeps the
+    // last value written for a given key and timestamp so the duplicated lines
+    // are harmless.
+    carbon->sent = 0;
 }
 
-static void carbon_send(
-        struct carbon *carbon, const char *data, size_t len, optics_ts_t ts)
+static void carbon_connect(struct carbon *carbon)
 {
-    if (carbon->fd <= 0) {
-        if (carbon->last_attempt == ts) return;
-        carbon->last_attempt = ts;
-        if (!carbon_connect(carbon)) return;
+    carbon->fd = socket_stream_connect_nonblock(carbon->host, carbon->port);
+    if (carbon->fd < 0) {
+        optics_perror(&optics_errno);
+        optics_poller_self_inc(carbon->poller, "carbon.connect_failures", 1);
+        carbon_disconnect(carbon);
+        return;
     }
 
-    ssize_t ret = send(carbon->fd, data, len, MSG_NOSIGNAL);
-    if (ret > 0 && (size_t) ret == len) return;
-    if (ret >= 0) {
-        optics_warn("unexpected partial message send: %lu '%s'", len, data);
+    struct epoll_event ev = { .events = EPOLLOUT, .data = { .fd = carbon->fd } };
+    if (epoll_ctl(carbon->epoll_fd, EPOLL_CTL_ADD, carbon->fd, &ev) == -1) {
+        optics_warn_errno("unable to add carbon socket to epoll");
+        carbon_disconnect(carbon);
         return;
     }
 
-    optics_warn_errno("unable to send to carbon host '%s:%s'",
-            carbon->host, carbon->port);
-    close(carbon->fd);
-    carbon->fd = -1;
+    carbon->state = carbon_connecting;
+}
+
+static void carbon_connect_done(struct carbon *carbon)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(carbon->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) err = errno;
+
+    if (err) {
+        optics_warn("unable to connect to carbon host '%s:%s': %s",
+                carbon->host, carbon->port, strerror(err));
+        optics_poller_self_inc(carbon->poller, "carbon.connect_failures", 1);
+        carbon_disconnect(carbon);
+        return;
+    }
+
+    if (carbon->connected) optics_poller_self_inc(carbon->poller, "carbon.reconnects", 1);
+    carbon->connected = true;
+
+    carbon->state = carbon_connected;
+    carbon_watch(carbon, 0);
 }
 
 
 // -----------------------------------------------------------------------------
-// callbacks
+// drain
 // -----------------------------------------------------------------------------
 
-struct dump_ctx
+static struct carbon_chunk *carbon_next(struct carbon *carbon)
 {
-    struct carbon *carbon;
-    const struct optics_poll *poll;
-};
+    if (carbon->current) return carbon->current;
 
-static bool carbon_dump_normalized(
-        void *ctx_, optics_ts_t ts, const char *key, double value)
+    pthread_mutex_lock(&carbon->lock);
+
+    struct carbon_chunk *chunk = carbon->head;
+    if (chunk) {
+        carbon->head = chunk->next;
+        if (!carbon->head) carbon->tail = NULL;
+        carbon->queued--;
+    }
+
+    pthread_mutex_unlock(&carbon->lock);
+
+    carbon->current = chunk;
+    carbon->sent = 0;
+    return chunk;
+}
+
+// Returns the number of bytes that can be sent according to the drain rate.
+static size_t carbon_budget(struct carbon *carbon)
+{
+    if (!carbon->rate) return SIZE_MAX;
+
+    uint64_t now = carbon_now();
+    carbon->tokens += (double) (now - carbon->refill_at) * carbon->rate / 1000;
+    if (carbon->tokens > carbon->rate) carbon->tokens = carbon->rate;
+    carbon->refill_at = now;
+
+    return carbon->tokens;
+}
+
+// Returns the delay in ms before the next attempt to drain the queue or -1 if
+// we should wait for an event.
+static int carbon_drain(struct carbon *carbon)
 {
-    struct dump_ctx *ctx = ctx_;
-    struct buffer buffer = {0};
+    struct carbon_chunk *chunk;
+    while ((chunk = carbon_next(carbon))) {
+        size_t budget = carbon_budget(carbon);
+        if (!budget) return carbon_refill_ms;
+
+        size_t len = chunk->len - carbon->sent;
+        if (len > carbon_send_chunk) len = carbon_send_chunk;
+        if (len > budget) len = budget;
+
+        ssize_t ret = send(carbon->fd, chunk->data + carbon->sent, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                carbon_watch(carbon, EPOLLOUT);
+                return -1;
+            }
 
-    buffer_printf(&buffer, "%s.%s", ctx->poll->prefix, ctx->poll->host);
-    buffer_printf(&buffer, ".%s %g %lu\n", key, value, ts);
+            optics_warn_errno("unable to send to carbon host '%s:%s'",
+                    carbon->host, carbon->port);
+            optics_poller_self_inc(carbon->poller, "carbon.send_failures", 1);
+            carbon_disconnect(carbon);
+            return carbon_retry_ms;
+        }
 
-    carbon_send(ctx->carbon, buffer.data, buffer.len, ts);
-    buffer_reset(&buffer);
+        if (carbon->rate) carbon->tokens -= ret;
+
+        carbon->sent += ret;
+        if (carbon->sent < chunk->len) continue;
+
+        free(chunk);
+        carbon->current = NULL;
+        carbon->sent = 0;
+    }
+
+    carbon_watch(carbon, 0);
+    return -1;
+}
+
+
+// -----------------------------------------------------------------------------
+// io
+// -----------------------------------------------------------------------------
+
+static void * carbon_run(void *ctx)
+{
+    struct carbon *carbon = ctx;
+    int timeout = 0;
+
+    while (true) {
+        struct epoll_event events[2];
+        int n = epoll_wait(carbon->epoll_fd, events, 2, timeout);
+        if (n < 0 && errno != EINTR) {
+            optics_warn_errno("unable to wait on carbon epoll");
+            break;
+        }
+
+        bool writable = false, hangup = false;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd != carbon->event_fd) {
+                writable = true;
+                hangup = events[i].events & (EPOLLERR | EPOLLHUP);
+                continue;
+            }
+
+            uint64_t value;
+            if (read(carbon->event_fd, &value, sizeof(value)) < 0)
+                optics_warn_errno("unable to read carbon eventfd");
+        }
+
+        pthread_mutex_lock(&carbon->lock);
+        bool stop = carbon->stop;
+        pthread_mutex_unlock(&carbon->lock);
+        if (stop) break;
+
+        timeout = -1;
+        switch (carbon->state) {
+
+        case carbon_disconnected: {
+            uint64_t now = carbon_now();
+            if (now < carbon->retry_at) {
+                timeout = carbon->retry_at - now;
+                break;
+            }
+
+            carbon_connect(carbon);
+            if (carbon->state == carbon_disconnected) timeout = carbon_retry_ms;
+            break;
+        }
+
+        case carbon_connecting:
+            if (!writable) break;
+            carbon_connect_done(carbon);
+            if (carbon->state == carbon_connected) timeout = carbon_drain(carbon);
+            else timeout = carbon_retry_ms;
+            break;
+
+        case carbon_connected:
+            if (!hangup) { timeout = carbon_drain(carbon); break; }
+
+            optics_warn("lost connection to carbon host '%s:%s'", carbon->host, carbon->port);
+            optics_poller_self_inc(carbon->poller, "carbon.send_failures", 1);
+            carbon_disconnect(carbon);
+            timeout = carbon_retry_ms;
+            break;
+
+        default:
+            optics_fail("unknown carbon state '%d'", carbon->state);
+            optics_abort();
+        }
+    }
+
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// queue
+// -----------------------------------------------------------------------------
+
+// Drops the oldest polls to make room for the new one which keeps the most
+// recent data around when the relay comes back.
+static void carbon_queue(struct carbon *carbon)
+{
+    if (!carbon->buffer.len) return;
+
+    struct carbon_chunk *chunk = malloc(sizeof(*chunk) + carbon->buffer.len);
+    optics_assert_alloc(chunk);
+    chunk->next = NULL;
+    chunk->len = carbon->buffer.len;
+    memcpy(chunk->data, carbon->buffer.data, carbon->buffer.len);
+    carbon->buffer.len = 0;
+
+    size_t dropped = 0;
+    {
+        pthread_mutex_lock(&carbon->lock);
+
+        if (carbon->tail) carbon->tail->next = chunk;
+        else carbon->head = chunk;
+        carbon->tail = chunk;
+        carbon->queued++;
+
+        while (carbon->queued > carbon->spill_len) {
+            struct carbon_chunk *head = carbon->head;
+            carbon->head = head->next;
+            carbon->queued--;
+            free(head);
+            dropped++;
+        }
+        carbon->dropped += dropped;
+
+        pthread_mutex_unlock(&carbon->lock);
+    }
+
+    if (dropped) optics_warn("carbon spill queue full: dropped '%zu' polls", dropped);
+    carbon_wake(carbon);
+}
+
+
+// -----------------------------------------------------------------------------
+// callbacks
+// -----------------------------------------------------------------------------
+
+// Keys are qualified by the normalizer and are usually cached by the poller
+// which leaves only the value to be formatted.
+static bool carbon_dump_normalized(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    struct carbon *carbon = ctx;
+
+    buffer_write(&carbon->buffer, key, key_len);
+    buffer_put(&carbon->buffer, ' ');
+    buffer_put_double(&carbon->buffer, value);
+    buffer_put(&carbon->buffer, ' ');
+    buffer_put_u64(&carbon->buffer, ts);
+    buffer_put(&carbon->buffer, '\n');
 
     return true;
 }
 
+// Lines are accumulated for the whole poll and queued when the poll is done
+// which amortizes the cost of the syscalls over all the lenses.
 static void carbon_dump(
         void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
 {
-    if (type != optics_poll_metric) return;
+    struct carbon *carbon = ctx_;
 
-    struct dump_ctx ctx = { .carbon = ctx_, .poll = poll };
-    (void) optics_poll_normalize(poll, carbon_dump_normalized, &ctx);
+    switch (type) {
+
+    case optics_poll_begin:
+        carbon->buffer.len = 0;
+        break;
+
+    // Carbon only has second resolution which only applies to the timestamps
+    // of the lines while rates are still rescaled by the precise elapsed time.
+    case optics_poll_metric:
+        (void) optics_poll_normalize_qualified(poll, carbon_dump_normalized, carbon);
+        break;
+
+    case optics_poll_done:
+        carbon_queue(carbon);
+        break;
+
+    default:
+        optics_fail("unknown poll type '%d'", type);
+        break;
+    }
 }
 
 static void carbon_free(void *ctx)
 {
     struct carbon *carbon = ctx;
-    close(carbon->fd);
+
+    {
+        pthread_mutex_lock(&carbon->lock);
+        carbon->stop = true;
+        pthread_mutex_unlock(&carbon->lock);
+    }
+
+    carbon_wake(carbon);
+
+    int err = pthread_join(carbon->thread, NULL);
+    if (err) optics_fail_ierrno(err, "unable to join carbon io thread");
+
+    struct carbon_chunk *chunk = carbon->head;
+    while (chunk) {
+        struct carbon_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(carbon->current);
+
+    if (carbon->fd >= 0) close(carbon->fd);
+    close(carbon->event_fd);
+    close(carbon->epoll_fd);
+    pthread_mutex_destroy(&carbon->lock);
+
+    buffer_reset(&carbon->buffer);
     free((void *) carbon->host);
     free((void *) carbon->port);
     free(carbon);
@@ -113,13 +476,75 @@ static void carbon_free(void *ctx)
 // register
 // -----------------------------------------------------------------------------
 
-
-void optics_dump_carbon(struct optics_poller *poller, const char *host, const char *port)
+bool optics_dump_carbon_spill(
+        struct optics_poller *poller, const char *host, const char *port,
+        size_t spill_len, size_t rate)
 {
+    if (!spill_len) {
+        optics_fail("invalid nil carbon spill length");
+        return false;
+    }
+
     struct carbon *carbon = calloc(1, sizeof(*carbon));
     optics_assert_alloc(carbon);
+    carbon->poller = poller;
     carbon->host = strdup(host);
     carbon->port = strdup(port);
+    carbon->spill_len = spill_len;
+    carbon->rate = rate;
+    carbon->tokens = rate;
+    carbon->refill_at = carbon_now();
+    carbon->fd = -1;
+    pthread_mutex_init(&carbon->lock, NULL);
+
+    carbon->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (carbon->event_fd == -1) {
+        optics_fail_errno("unable to create carbon eventfd");
+        goto fail_event;
+    }
+
+    carbon->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (carbon->epoll_fd == -1) {
+        optics_fail_errno("unable to create carbon epoll");
+        goto fail_epoll;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data = { .fd = carbon->event_fd } };
+    if (epoll_ctl(carbon->epoll_fd, EPOLL_CTL_ADD, carbon->event_fd, &ev) == -1) {
+        optics_fail_errno("unable to add carbon eventfd to epoll");
+        goto fail_ctl;
+    }
 
-    optics_poller_backend(poller, carbon, &carbon_dump, &carbon_free);
+    // The io thread connects eagerly so that the connection is usually ready
+    // by the time the first poll is done.
+    int err = pthread_create(&carbon->thread, NULL, carbon_run, carbon);
+    if (err) {
+        optics_fail_ierrno(err, "unable to create carbon io thread");
+        goto fail_thread;
+    }
+
+    if (!optics_poller_backend(poller, carbon, &carbon_dump, &carbon_free)) {
+        carbon_free(carbon);
+        return false;
+    }
+
+    return true;
+
+  fail_thread:
+  fail_ctl:
+    close(carbon->epoll_fd);
+  fail_epoll:
+    close(carbon->event_fd);
+  fail_event:
+    pthread_mutex_destroy(&carbon->lock);
+    free((void *) carbon->host);
+    free((void *) carbon->port);
+    free(carbon);
+    return false;
+}
+
+void optics_dump_carbon(struct optics_poller *poller, const char *host, const char *port)
+{
+    if (!optics_dump_carbon_spill(poller, host, port, carbon_spill_default, 0))
+        optics_perror(&optics_errno);
 }
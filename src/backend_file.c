@@ -0,0 +1,738 @@
+/* backend_file.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Append-only binary columnar file of every poll meant for offline analysis.
+   The file is a sequence of blocks each prefixed by a fixed-size header:
+
+   - dict blocks assign consecutive ids to the normalized keys the first time
+     they're seen. Each entry is a varint length followed by the nil-terminated
+     key.
+
+   - poll blocks hold the values of a single poll encoded as two columns: the
+     key ids as zigzag varints of the delta with the previous id plus one and
+     the values XOR-ed with the previous value of the same key using the
+     Gorilla bit encoding. Keyframe blocks reset the previous values to zero.
+
+   Since the normalizer emits keys in the same order on every poll, an id
+   usually takes a single byte and an unchanged value a single bit. A block
+   whose checksum doesn't match (eg. a torn write) ends the file.
+*/
+
+#include "optics.h"
+#include "utils/errors.h"
+#include "utils/buffer.h"
+#include "utils/htable.h"
+#include "utils/bits.h"
+#include "utils/type_pun.h"
+#include "utils/compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// format
+// -----------------------------------------------------------------------------
+
+enum
+{
+    file_magic = 0x4254504f, // "OPTB"
+
+    // Version 1 blocks have their timestamp in seconds and version 2 blocks
+    // in nanos. Both are read back.
+    file_version_secs = 1,
+    file_version = 2,
+
+    // Number of polls between two keyframes which bounds how far back a
+    // reader must go to decode a poll.
+    file_keyframe_polls = 64,
+};
+
+enum file_block_type
+{
+    file_block_dict = 1,
+    file_block_poll = 2,
+};
+
+enum file_block_flags
+{
+    file_flag_keyframe = 1 << 0,
+};
+
+struct optics_packed file_block
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+
+    // Number of payload bytes following the header.
+    uint32_t len;
+
+    // Number of keys or values in the block.
+    uint32_t count;
+
+    // Id of the first key of a dict block.
+    uint32_t base;
+    uint32_t checksum;
+
+    uint64_t ts;
+};
+
+static_assert(sizeof(struct file_block) == 32, "file block header must be 32 bytes");
+
+// FNV-1a which only needs to catch torn writes.
+static uint32_t file_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < len; ++i) hash = (hash ^ data[i]) * 0x01000193;
+    return hash;
+}
+
+
+// -----------------------------------------------------------------------------
+// varint
+// -----------------------------------------------------------------------------
+
+static void file_varint_write(struct buffer *buffer, uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer_put(buffer, (char) (value | 0x80));
+        value >>= 7;
+    }
+    buffer_put(buffer, (char) value);
+}
+
+static bool file_varint_read(
+        const uint8_t **it, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (size_t shift = 0; *it < end && shift < 64; shift += 7) {
+        uint8_t byte = *((*it)++);
+        *value |= ((uint64_t) (byte & 0x7F)) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t file_zigzag(int64_t value)
+{
+    return (((uint64_t) value) << 1) ^ ((uint64_t) (value >> 63));
+}
+
+static int64_t file_unzigzag(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -((int64_t) (value & 1));
+}
+
+
+// -----------------------------------------------------------------------------
+// bits
+// -----------------------------------------------------------------------------
+// Bits are written most significant first.
+
+struct file_bits
+{
+    struct buffer *buffer;
+    uint8_t byte;
+    size_t used;
+};
+
+static void file_bits_write(struct file_bits *bits, uint64_t value, size_t len)
+{
+    while (len) {
+        size_t n = 8 - bits->used;
+        if (n > len) n = len;
+
+        uint8_t chunk = (value >> (len - n)) & ((1U << n) - 1);
+        bits->byte |= chunk << (8 - bits->used - n);
+        bits->used += n;
+        len -= n;
+
+        if (bits->used == 8) {
+            buffer_put(bits->buffer, (char) bits->byte);
+            bits->byte = 0;
+            bits->used = 0;
+        }
+    }
+}
+
+static void file_bits_flush(struct file_bits *bits)
+{
+    if (bits->used) buffer_put(bits->buffer, (char) bits->byte);
+    bits->byte = 0;
+    bits->used = 0;
+}
+
+struct file_bits_reader
+{
+    const uint8_t *it;
+    const uint8_t *end;
+    size_t used;
+};
+
+static bool file_bits_read(struct file_bits_reader *bits, size_t len, uint64_t *value)
+{
+    *value = 0;
+
+    while (len) {
+        if (bits->it == bits->end) return false;
+
+        size_t n = 8 - bits->used;
+        if (n > len) n = len;
+
+        uint8_t chunk = (*bits->it >> (8 - bits->used - n)) & ((1U << n) - 1);
+        *value = (*value << n) | chunk;
+        bits->used += n;
+        len -= n;
+
+        if (bits->used == 8) {
+            bits->it++;
+            bits->used = 0;
+        }
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// series
+// -----------------------------------------------------------------------------
+// Gorilla XOR encoding: an unchanged value is a single 0 bit. Otherwise the
+// meaningful bits of the XOR are written either within the window of the
+// previous XOR (control 10) or with a new window (control 11) made of 5 bits of
+// leading zeros and 6 bits of length.
+
+struct file_series
+{
+    uint64_t value;
+    uint8_t lead;
+    uint8_t trail;
+};
+
+static const struct file_series file_series_reset = { .lead = UINT8_MAX };
+
+static void file_series_write(
+        struct file_bits *bits, struct file_series *series, uint64_t value)
+{
+    uint64_t xor = value ^ series->value;
+    series->value = value;
+
+    if (!xor) {
+        file_bits_write(bits, 0, 1);
+        return;
+    }
+
+    size_t lead = clz(xor);
+    size_t trail = ctz(xor);
+    if (lead > 31) lead = 31;
+
+    if (series->lead != UINT8_MAX && lead >= series->lead && trail >= series->trail) {
+        file_bits_write(bits, 2, 2);
+        file_bits_write(bits, xor >> series->trail, 64 - series->lead - series->trail);
+        return;
+    }
+
+    size_t len = 64 - lead - trail;
+    file_bits_write(bits, 3, 2);
+    file_bits_write(bits, lead, 5);
+    file_bits_write(bits, len - 1, 6);
+    file_bits_write(bits, xor >> trail, len);
+
+    series->lead = lead;
+    series->trail = trail;
+}
+
+static bool file_series_read(
+        struct file_bits_reader *bits, struct file_series *series, uint64_t *value)
+{
+    uint64_t control;
+    if (!file_bits_read(bits, 1, &control)) return false;
+    if (!control) { *value = series->value; return true; }
+
+    if (!file_bits_read(bits, 1, &control)) return false;
+
+    if (control) {
+        uint64_t lead, len;
+        if (!file_bits_read(bits, 5, &lead)) return false;
+        if (!file_bits_read(bits, 6, &len)) return false;
+        len++;
+
+        if (lead + len > 64) return false;
+        series->lead = lead;
+        series->trail = 64 - lead - len;
+    }
+    else if (series->lead == UINT8_MAX) return false;
+
+    uint64_t xor;
+    size_t len = 64 - series->lead - series->trail;
+    if (!file_bits_read(bits, len, &xor)) return false;
+
+    series->value ^= xor << series->trail;
+    *value = series->value;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// writer
+// -----------------------------------------------------------------------------
+
+struct file_value
+{
+    uint32_t id;
+    uint64_t value;
+};
+
+struct file
+{
+    int fd;
+    char *path;
+
+    size_t polls;
+    uint64_t ts; // nanos
+
+    struct htable ids;
+    size_t series_len;
+    size_t series_cap;
+    struct file_series *series;
+
+    // Keys first seen during the current poll.
+    size_t dict_base;
+    size_t dict_len;
+    struct buffer dict;
+
+    size_t values_len;
+    size_t values_cap;
+    struct file_value *values;
+
+    struct buffer buffer;
+};
+
+static uint32_t file_key_id(struct file *file, const char *key, size_t key_len)
+{
+    struct htable_ret ret = htable_get(&file->ids, key);
+    if (ret.ok) return ret.value;
+
+    uint32_t id = file->series_len++;
+    htable_put(&file->ids, key, id);
+
+    if (file->series_len > file->series_cap) {
+        file->series_cap = file->series_cap ? file->series_cap * 2 : 64;
+        file->series = realloc(file->series, file->series_cap * sizeof(file->series[0]));
+        optics_assert_alloc(file->series);
+    }
+    file->series[id] = file_series_reset;
+
+    if (!file->dict_len) file->dict_base = id;
+    file->dict_len++;
+    file_varint_write(&file->dict, key_len + 1);
+    buffer_write(&file->dict, key, key_len + 1);
+
+    return id;
+}
+
+static bool file_dump_normalized(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) ts;
+    struct file *file = ctx;
+
+    if (file->values_len == file->values_cap) {
+        file->values_cap = file->values_cap ? file->values_cap * 2 : 128;
+        file->values = realloc(file->values, file->values_cap * sizeof(file->values[0]));
+        optics_assert_alloc(file->values);
+    }
+
+    file->values[file->values_len++] = (struct file_value) {
+        .id = file_key_id(file, key, key_len),
+        .value = pun_dtoi(value),
+    };
+
+    return true;
+}
+
+static void file_block_write(
+        struct buffer *buffer, enum file_block_type type, uint16_t flags,
+        uint32_t count, uint32_t base, uint64_t ts, const struct buffer *payload)
+{
+    struct file_block block = {
+        .magic = file_magic,
+        .version = file_version,
+        .type = type,
+        .flags = flags,
+        .len = payload->len,
+        .count = count,
+        .base = base,
+        .checksum = file_checksum((const uint8_t *) payload->data, payload->len),
+        .ts = ts,
+    };
+
+    buffer_write(buffer, &block, sizeof(block));
+    buffer_write(buffer, payload->data, payload->len);
+}
+
+static void file_flush(struct file *file)
+{
+    if (!file->values_len) return;
+
+    uint64_t ts = file->ts;
+    file->buffer.len = 0;
+
+    if (file->dict_len) {
+        file_block_write(&file->buffer, file_block_dict, 0,
+                file->dict_len, file->dict_base, ts, &file->dict);
+        file->dict_len = 0;
+        file->dict.len = 0;
+    }
+
+    uint16_t flags = 0;
+    if (!(file->polls % file_keyframe_polls)) {
+        flags |= file_flag_keyframe;
+        for (size_t i = 0; i < file->series_len; ++i)
+            file->series[i] = file_series_reset;
+    }
+    file->polls++;
+
+    struct buffer payload = {0};
+
+    int64_t prev = -1;
+    for (size_t i = 0; i < file->values_len; ++i) {
+        int64_t id = file->values[i].id;
+        file_varint_write(&payload, file_zigzag(id - prev - 1));
+        prev = id;
+    }
+
+    struct file_bits bits = { .buffer = &payload };
+    for (size_t i = 0; i < file->values_len; ++i) {
+        struct file_value *value = &file->values[i];
+        file_series_write(&bits, &file->series[value->id], value->value);
+    }
+    file_bits_flush(&bits);
+
+    file_block_write(&file->buffer, file_block_poll, flags,
+            file->values_len, 0, ts, &payload);
+    buffer_reset(&payload);
+
+    const char *it = file->buffer.data;
+    size_t left = file->buffer.len;
+    while (left) {
+        ssize_t ret = write(file->fd, it, left);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) {
+            optics_warn_errno("unable to write to file '%s'", file->path);
+            return;
+        }
+
+        it += ret;
+        left -= ret;
+    }
+}
+
+static void file_dump(
+        void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct file *file = ctx;
+
+    switch (type) {
+
+    case optics_poll_begin:
+        file->values_len = 0;
+        break;
+
+    case optics_poll_metric:
+        file->ts = poll->ts_nanos;
+        (void) optics_poll_normalize_qualified(poll, file_dump_normalized, file);
+        break;
+
+    case optics_poll_done:
+        file_flush(file);
+        break;
+
+    default:
+        optics_fail("unknown poll type '%d'", type);
+        break;
+    }
+}
+
+static void file_free(void *ctx)
+{
+    struct file *file = ctx;
+
+    close(file->fd);
+    free(file->path);
+    htable_reset(&file->ids);
+    free(file->series);
+    buffer_reset(&file->dict);
+    free(file->values);
+    buffer_reset(&file->buffer);
+    free(file);
+}
+
+
+// -----------------------------------------------------------------------------
+// reader
+// -----------------------------------------------------------------------------
+
+struct optics_file
+{
+    const uint8_t *data;
+    size_t len;
+
+    size_t keys_len;
+    size_t keys_cap;
+    const char **keys;
+    struct file_series *series;
+
+    size_t ids_cap;
+    uint32_t *ids;
+
+    // Whether the callback wants the timestamps in nanos or in seconds.
+    bool nanos;
+};
+
+static bool file_read_dict(
+        struct optics_file *file, const struct file_block *block, const uint8_t *it)
+{
+    if (block->base != file->keys_len || block->count > block->len) return false;
+
+    size_t len = file->keys_len + block->count;
+    if (len > file->keys_cap) {
+        while (file->keys_cap < len) file->keys_cap = file->keys_cap ? file->keys_cap * 2 : 64;
+
+        file->keys = realloc(file->keys, file->keys_cap * sizeof(file->keys[0]));
+        optics_assert_alloc(file->keys);
+
+        file->series = realloc(file->series, file->keys_cap * sizeof(file->series[0]));
+        optics_assert_alloc(file->series);
+    }
+
+    const uint8_t *end = it + block->len;
+    for (size_t i = 0; i < block->count; ++i) {
+        uint64_t key_len;
+        if (!file_varint_read(&it, end, &key_len)) return false;
+        if (!key_len || key_len > (size_t) (end - it) || it[key_len - 1]) return false;
+
+        file->keys[file->keys_len + i] = (const char *) it;
+        file->series[file->keys_len + i] = file_series_reset;
+        it += key_len;
+    }
+
+    file->keys_len = len;
+    return true;
+}
+
+static bool file_read_poll(
+        struct optics_file *file, const struct file_block *block, const uint8_t *it,
+        optics_file_cb_t cb, void *ctx, bool *stop)
+{
+    if (block->flags & file_flag_keyframe) {
+        for (size_t i = 0; i < file->keys_len; ++i)
+            file->series[i] = file_series_reset;
+    }
+
+    // Every id takes at least a byte.
+    if (block->count > block->len) return false;
+
+    if (block->count > file->ids_cap) {
+        file->ids_cap = block->count;
+        file->ids = realloc(file->ids, file->ids_cap * sizeof(file->ids[0]));
+        optics_assert_alloc(file->ids);
+    }
+
+    const uint8_t *end = it + block->len;
+
+    int64_t prev = -1;
+    for (size_t i = 0; i < block->count; ++i) {
+        uint64_t delta;
+        if (!file_varint_read(&it, end, &delta)) return false;
+
+        int64_t id = prev + 1 + file_unzigzag(delta);
+        if (id < 0 || (size_t) id >= file->keys_len) return false;
+
+        file->ids[i] = id;
+        prev = id;
+    }
+
+    uint64_t ts = block->ts;
+    if (block->version == file_version_secs) ts *= 1000000000UL;
+    if (!file->nanos) ts /= 1000000000UL;
+
+    struct file_bits_reader bits = { .it = it, .end = end };
+    for (size_t i = 0; i < block->count; ++i) {
+        uint32_t id = file->ids[i];
+
+        uint64_t value;
+        if (!file_series_read(&bits, &file->series[id], &value)) return false;
+
+        if (*stop) continue;
+        if (!cb(ctx, ts, file->keys[id], pun_itod(value))) *stop = true;
+    }
+
+    return true;
+}
+
+// Returns the offset of the first invalid block which is the end of the file if
+// every block is valid. Poll blocks are only decoded if a callback is provided.
+static size_t file_read(
+        struct optics_file *file, optics_file_cb_t cb, void *ctx, bool *stop)
+{
+    size_t pos = 0;
+
+    while (file->len - pos >= sizeof(struct file_block)) {
+        struct file_block block;
+        memcpy(&block, file->data + pos, sizeof(block));
+
+        if (block.magic != file_magic) break;
+        if (block.version != file_version && block.version != file_version_secs) break;
+        if (block.len > file->len - pos - sizeof(block)) break;
+
+        const uint8_t *payload = file->data + pos + sizeof(block);
+        if (block.checksum != file_checksum(payload, block.len)) break;
+
+        bool ok = false;
+        switch ((enum file_block_type) block.type) {
+        case file_block_dict: ok = file_read_dict(file, &block, payload); break;
+        case file_block_poll:
+            ok = !cb || file_read_poll(file, &block, payload, cb, ctx, stop);
+            break;
+        default: break;
+        }
+        if (!ok) break;
+
+        pos += sizeof(block) + block.len;
+        if (stop && *stop) break;
+    }
+
+    return pos;
+}
+
+struct optics_file * optics_file_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        optics_fail_errno("unable to open file '%s'", path);
+        return NULL;
+    }
+
+    struct stat stat = {0};
+    if (fstat(fd, &stat) == -1) {
+        optics_fail_errno("unable to stat file '%s'", path);
+        goto fail_stat;
+    }
+
+    struct optics_file *file = calloc(1, sizeof(*file));
+    optics_assert_alloc(file);
+    file->len = stat.st_size;
+
+    if (file->len) {
+        void *data = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            optics_fail_errno("unable to mmap file '%s'", path);
+            goto fail_mmap;
+        }
+        file->data = data;
+    }
+
+    close(fd);
+    return file;
+
+  fail_mmap:
+    free(file);
+  fail_stat:
+    close(fd);
+    return NULL;
+}
+
+void optics_file_close(struct optics_file *file)
+{
+    if (file->data) munmap((void *) file->data, file->len);
+    free(file->keys);
+    free(file->series);
+    free(file->ids);
+    free(file);
+}
+
+bool optics_file_read(struct optics_file *file, optics_file_cb_t cb, void *ctx)
+{
+    file->keys_len = 0;
+    file->nanos = false;
+
+    bool stop = false;
+    (void) file_read(file, cb, ctx, &stop);
+    return !stop;
+}
+
+bool optics_file_read_nanos(struct optics_file *file, optics_file_cb_t cb, void *ctx)
+{
+    file->keys_len = 0;
+    file->nanos = true;
+
+    bool stop = false;
+    (void) file_read(file, cb, ctx, &stop);
+    return !stop;
+}
+
+
+// -----------------------------------------------------------------------------
+// register
+// -----------------------------------------------------------------------------
+
+// Appending to an existing file requires its dictionary. Anything after the
+// last valid block is a leftover from a torn write and is truncated.
+static bool file_recover(struct file *file)
+{
+    struct optics_file *existing = optics_file_open(file->path);
+    if (!existing) return false;
+
+    size_t end = file_read(existing, NULL, NULL, NULL);
+
+    for (size_t i = 0; i < existing->keys_len; ++i) {
+        const char *key = existing->keys[i];
+        (void) file_key_id(file, key, strlen(key));
+    }
+    file->dict_len = 0;
+    file->dict.len = 0;
+
+    bool ok = true;
+    if (end != existing->len && ftruncate(file->fd, end) == -1) {
+        optics_fail_errno("unable to truncate file '%s'", file->path);
+        ok = false;
+    }
+
+    optics_file_close(existing);
+    return ok;
+}
+
+bool optics_dump_file(struct optics_poller *poller, const char *path)
+{
+    struct file *file = calloc(1, sizeof(*file));
+    optics_assert_alloc(file);
+    file->path = strdup(path);
+
+    file->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (file->fd == -1) {
+        optics_fail_errno("unable to open file '%s'", path);
+        free(file->path);
+        free(file);
+        return false;
+    }
+
+    if (!file_recover(file)) goto fail;
+    if (!optics_poller_backend(poller, file, &file_dump, &file_free)) goto fail;
+
+    return true;
+
+  fail:
+    file_free(file);
+    return false;
+}
@@ -0,0 +1,396 @@
+/* backend_jsonl.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Text capture of every normalized metric as JSON lines meant for debugging.
+   The poll thread only formats the lines of a poll into a buffer which is
+   handed to a writer thread that takes care of the write and fdatasync calls
+   along with the rotation of the file. Polls are dropped if the writer falls
+   too far behind which means that the poll thread never waits on the disk.
+*/
+
+#include "optics.h"
+#include "utils/errors.h"
+#include "utils/buffer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    // Number of buffers shared by the poll and writer threads. One of them is
+    // always being filled by the poll thread.
+    jsonl_buffers_len = 8,
+
+    // Longest suffix added to the path of a rotated file.
+    jsonl_suffix_len = 24,
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The buffers form a ring where the poll thread fills the buffer at tail and
+// the writer writes the buffers within [head, tail). Buffers are only ever
+// grown so a steady state capture doesn't allocate.
+
+struct jsonl
+{
+    char *path;
+    size_t rotate_len;
+    size_t rotate_keep;
+
+    // poll thread
+    struct buffer line;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t head, tail;
+    size_t dropped;
+    bool stop;
+
+    struct buffer buffers[jsonl_buffers_len];
+
+    // writer thread
+    pthread_t thread;
+    int fd;
+    size_t file_len;
+};
+
+
+// -----------------------------------------------------------------------------
+// file
+// -----------------------------------------------------------------------------
+
+static void jsonl_open(struct jsonl *jsonl)
+{
+    jsonl->fd = open(jsonl->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (jsonl->fd == -1) {
+        optics_warn_errno("unable to open file '%s'", jsonl->path);
+        return;
+    }
+
+    struct stat stat = {0};
+    if (fstat(jsonl->fd, &stat) == -1) {
+        optics_warn_errno("unable to stat file '%s'", jsonl->path);
+        stat.st_size = 0;
+    }
+    jsonl->file_len = stat.st_size;
+}
+
+static void jsonl_rotated_path(struct jsonl *jsonl, char *dst, size_t len, size_t index)
+{
+    (void) snprintf(dst, len, "%s.%zu", jsonl->path, index);
+}
+
+// Rotated files are shifted such that path.1 is always the most recent one and
+// the oldest is deleted once there are rotate_keep of them.
+static void jsonl_rotate(struct jsonl *jsonl)
+{
+    close(jsonl->fd);
+    jsonl->fd = -1;
+
+    size_t len = strlen(jsonl->path) + jsonl_suffix_len;
+    char src[len], dst[len];
+
+    if (!jsonl->rotate_keep) {
+        if (unlink(jsonl->path) == -1 && errno != ENOENT)
+            optics_warn_errno("unable to unlink file '%s'", jsonl->path);
+    }
+
+    for (size_t i = jsonl->rotate_keep; i > 0; --i) {
+        jsonl_rotated_path(jsonl, dst, len, i);
+        if (i > 1) jsonl_rotated_path(jsonl, src, len, i - 1);
+        else strcpy(src, jsonl->path);
+
+        if (rename(src, dst) == -1 && errno != ENOENT)
+            optics_warn_errno("unable to rotate file '%s' to '%s'", src, dst);
+    }
+
+    jsonl_open(jsonl);
+}
+
+// A poll that's larger than rotate_len ends up in a file of its own.
+static void jsonl_write(struct jsonl *jsonl, const struct buffer *buffer)
+{
+    if (!buffer->len) return;
+
+    size_t end = jsonl->file_len + buffer->len;
+    if (jsonl->rotate_len && jsonl->file_len && end > jsonl->rotate_len)
+        jsonl_rotate(jsonl);
+
+    if (jsonl->fd == -1) jsonl_open(jsonl);
+    if (jsonl->fd == -1) return;
+
+    const char *it = buffer->data;
+    size_t left = buffer->len;
+    while (left) {
+        ssize_t ret = write(jsonl->fd, it, left);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) {
+            optics_warn_errno("unable to write to file '%s'", jsonl->path);
+            return;
+        }
+
+        it += ret;
+        left -= ret;
+        jsonl->file_len += ret;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// writer
+// -----------------------------------------------------------------------------
+
+// The buffers are written without holding the lock since the poll thread never
+// touches the buffers within [head, tail). The queue is always drained before
+// stopping.
+static void * jsonl_run(void *ctx)
+{
+    struct jsonl *jsonl = ctx;
+
+    pthread_mutex_lock(&jsonl->lock);
+
+    while (true) {
+        while (jsonl->head == jsonl->tail && !jsonl->stop)
+            pthread_cond_wait(&jsonl->cond, &jsonl->lock);
+
+        size_t head = jsonl->head, tail = jsonl->tail;
+        if (head == tail) break;
+
+        pthread_mutex_unlock(&jsonl->lock);
+
+        for (size_t i = head; i != tail; ++i)
+            jsonl_write(jsonl, &jsonl->buffers[i % jsonl_buffers_len]);
+
+        if (jsonl->fd != -1 && fdatasync(jsonl->fd) == -1)
+            optics_warn_errno("unable to sync file '%s'", jsonl->path);
+
+        pthread_mutex_lock(&jsonl->lock);
+        jsonl->head = tail;
+    }
+
+    pthread_mutex_unlock(&jsonl->lock);
+    return NULL;
+}
+
+// The poll is dropped if the next buffer is still waiting to be written in
+// which case the current buffer is refilled by the next poll.
+static void jsonl_queue(struct jsonl *jsonl)
+{
+    size_t dropped = 0;
+    {
+        pthread_mutex_lock(&jsonl->lock);
+
+        if (jsonl->tail + 1 - jsonl->head < jsonl_buffers_len) {
+            jsonl->tail++;
+            pthread_cond_signal(&jsonl->cond);
+        }
+        else dropped = ++jsonl->dropped;
+
+        pthread_mutex_unlock(&jsonl->lock);
+    }
+
+    if (dropped) optics_warn("jsonl writer is behind: dropped '%zu' polls", dropped);
+}
+
+static struct buffer *jsonl_buffer(struct jsonl *jsonl)
+{
+    // Only the poll thread writes to tail.
+    return &jsonl->buffers[jsonl->tail % jsonl_buffers_len];
+}
+
+
+// -----------------------------------------------------------------------------
+// format
+// -----------------------------------------------------------------------------
+
+static void jsonl_escape(struct buffer *buffer, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (const char *it = str; *it; ++it) {
+        unsigned char c = *it;
+
+        if (c == '"' || c == '\\') {
+            buffer_put(buffer, '\\');
+            buffer_put(buffer, c);
+        }
+        else if (c < 0x20) {
+            char escape[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+            buffer_write(buffer, escape, sizeof(escape));
+        }
+        else buffer_put(buffer, c);
+    }
+}
+
+// Everything up to the key is the same for all the values of a lens so it's
+// only formatted once per lens. Timestamps are in seconds with millisecond
+// precision when needed and the unqualified key is prefixed by the prefix like
+// the other backends that tag the host separately.
+static void jsonl_line_head(struct buffer *line, const struct optics_poll *poll)
+{
+    line->len = 0;
+
+    buffer_puts(line, "{\"ts\":");
+    buffer_put_u64(line, poll->ts_nanos / 1000000000);
+
+    uint64_t millis = (poll->ts_nanos / 1000000) % 1000;
+    if (millis) {
+        char str[4] = { '.', '0' + millis / 100, '0' + millis / 10 % 10, '0' + millis % 10 };
+        buffer_write(line, str, sizeof(str));
+    }
+
+    buffer_puts(line, ",\"host\":\"");
+    if (poll->host) jsonl_escape(line, poll->host);
+
+    buffer_puts(line, "\",\"key\":\"");
+    if (poll->prefix && poll->prefix[0]) {
+        jsonl_escape(line, poll->prefix);
+        buffer_put(line, '.');
+    }
+}
+
+// JSON has no representation for non-finite values.
+static bool jsonl_dump_normalized(
+        void *ctx, optics_ts_t ts, const char *key, double value)
+{
+    (void) ts;
+    struct jsonl *jsonl = ctx;
+    struct buffer *buffer = jsonl_buffer(jsonl);
+
+    buffer_write(buffer, jsonl->line.data, jsonl->line.len);
+    jsonl_escape(buffer, key);
+
+    buffer_puts(buffer, "\",\"value\":");
+    if (isfinite(value)) buffer_put_double(buffer, value);
+    else buffer_write(buffer, "null", 4);
+    buffer_write(buffer, "}\n", 2);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// callbacks
+// -----------------------------------------------------------------------------
+
+static void jsonl_dump(
+        void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct jsonl *jsonl = ctx;
+
+    switch (type) {
+
+    case optics_poll_begin:
+        jsonl_buffer(jsonl)->len = 0;
+        break;
+
+    case optics_poll_metric:
+        jsonl_line_head(&jsonl->line, poll);
+        (void) optics_poll_normalize(poll, jsonl_dump_normalized, jsonl);
+        break;
+
+    case optics_poll_done:
+        jsonl_queue(jsonl);
+        break;
+
+    default:
+        optics_fail("unknown poll type '%d'", type);
+        break;
+    }
+}
+
+static void jsonl_free(void *ctx)
+{
+    struct jsonl *jsonl = ctx;
+
+    {
+        pthread_mutex_lock(&jsonl->lock);
+        jsonl->stop = true;
+        pthread_cond_signal(&jsonl->cond);
+        pthread_mutex_unlock(&jsonl->lock);
+    }
+
+    int err = pthread_join(jsonl->thread, NULL);
+    if (err) optics_fail_ierrno(err, "unable to join jsonl writer thread");
+
+    if (jsonl->fd != -1) close(jsonl->fd);
+    pthread_cond_destroy(&jsonl->cond);
+    pthread_mutex_destroy(&jsonl->lock);
+
+    for (size_t i = 0; i < jsonl_buffers_len; ++i) buffer_reset(&jsonl->buffers[i]);
+    buffer_reset(&jsonl->line);
+    free(jsonl->path);
+    free(jsonl);
+}
+
+
+// -----------------------------------------------------------------------------
+// register
+// -----------------------------------------------------------------------------
+
+// The file is opened eagerly so that a bad path is reported to the caller
+// instead of showing up as warnings in the writer thread.
+bool optics_dump_jsonl(
+        struct optics_poller *poller, const char *path, size_t rotate_len, size_t rotate_keep)
+{
+    struct jsonl *jsonl = calloc(1, sizeof(*jsonl));
+    optics_assert_alloc(jsonl);
+    jsonl->path = strdup(path);
+    jsonl->rotate_len = rotate_len;
+    jsonl->rotate_keep = rotate_keep;
+
+    jsonl->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (jsonl->fd == -1) {
+        optics_fail_errno("unable to open file '%s'", path);
+        goto fail_open;
+    }
+
+    struct stat stat = {0};
+    if (fstat(jsonl->fd, &stat) == -1) {
+        optics_fail_errno("unable to stat file '%s'", path);
+        goto fail_stat;
+    }
+    jsonl->file_len = stat.st_size;
+
+    pthread_mutex_init(&jsonl->lock, NULL);
+    pthread_cond_init(&jsonl->cond, NULL);
+
+    int err = pthread_create(&jsonl->thread, NULL, jsonl_run, jsonl);
+    if (err) {
+        optics_fail_ierrno(err, "unable to create jsonl writer thread");
+        goto fail_thread;
+    }
+
+    if (!optics_poller_backend(poller, jsonl, &jsonl_dump, &jsonl_free)) {
+        jsonl_free(jsonl);
+        return false;
+    }
+
+    return true;
+
+  fail_thread:
+    pthread_cond_destroy(&jsonl->cond);
+    pthread_mutex_destroy(&jsonl->lock);
+  fail_stat:
+    close(jsonl->fd);
+  fail_open:
+    free(jsonl->path);
+    free(jsonl);
+    return false;
+}
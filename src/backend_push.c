@@ -0,0 +1,549 @@
+/* backend_push.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "optics.h"
+#include "utils/errors.h"
+#include "utils/socket.h"
+#include "utils/buffer.h"
+#include "utils/htable.h"
+#include "utils/type_pun.h"
+#include "utils/uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <bsd/string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The values of a poll are gathered as they're normalized and the frames are
+// only built and sent once the poll is done. The socket is non-blocking and any
+// failure to send a frame closes the connection which is reopened on the next
+// poll with a full resync. This keeps the receiver's state consistent without
+// ever having to wait on it.
+//
+// When io_uring is available, the frames of a poll are instead accumulated in
+// the frame buffer and queued on the ring as linked sends once the poll is
+// done. Linking the sends guarantees that the frames are sent in order and that
+// a frame is never sent after one that failed. The completions are reaped at
+// the start of the next poll where a failure closes the connection.
+
+enum { push_ring_len = 64 };
+
+struct push_frame
+{
+    size_t start;
+    size_t len;
+};
+
+struct push_key
+{
+    uint32_t id;
+    uint32_t type;
+    uint64_t value;
+    size_t stamp;
+
+    size_t len;
+    char data[];
+};
+
+struct push_value
+{
+    struct push_key *key;
+    uint64_t value;
+    bool changed;
+};
+
+struct push
+{
+    char *path;
+    int fd;
+
+    // Prefix and host sent in the last hello frame.
+    char prefix[optics_name_max_len];
+    char host[optics_name_max_len];
+
+    struct htable keys;
+    uint32_t next_id;
+    size_t stamp;
+
+    // Set from the polls as they're normalized. The prefix and host are copied
+    // since async backends recycle the poll before the done event.
+    enum optics_lens_type type;
+    optics_ts_t ts;
+    bool polled;
+    char poll_prefix[optics_name_max_len];
+    char poll_host[optics_name_max_len];
+
+    size_t values_len;
+    size_t values_cap;
+    struct push_value *values;
+
+    size_t fresh_len;
+    size_t fresh_cap;
+    struct push_key **fresh;
+
+    size_t drops_len;
+    size_t drops_cap;
+    uint32_t *drops;
+
+    struct buffer frame;
+    size_t frame_start;
+    size_t frame_count;
+    enum optics_push_type frame_type;
+
+    bool ring_enabled;
+    struct uring ring;
+
+    size_t frames_len;
+    size_t frames_cap;
+    struct push_frame *frames;
+};
+
+static void *push_grow(void *data, size_t *cap, size_t len, size_t item)
+{
+    if (len < *cap) return data;
+
+    *cap = *cap ? *cap * 2 : 64;
+    data = realloc(data, *cap * item);
+    optics_assert_alloc(data);
+    return data;
+}
+
+
+// -----------------------------------------------------------------------------
+// frames
+// -----------------------------------------------------------------------------
+
+static void push_disconnect(struct push *push)
+{
+    if (push->fd < 0) return;
+
+    close(push->fd);
+    push->fd = -1;
+}
+
+static void push_frame_send(struct push *push)
+{
+    size_t len = push->frame.len - push->frame_start;
+
+    struct optics_push_header header = {
+        .magic = optics_push_magic,
+        .version = optics_push_version,
+        .type = push->frame_type,
+        .count = push->frame_count,
+        .len = len - sizeof(header),
+        .ts = push->ts,
+    };
+    memcpy(push->frame.data + push->frame_start, &header, sizeof(header));
+
+    if (push->fd < 0) return;
+
+    // The buffer can still be reallocated by the frames that follow so only
+    // the offsets are kept until the poll is done.
+    if (push->ring_enabled) {
+        push->frames = push_grow(
+                push->frames, &push->frames_cap, push->frames_len, sizeof(*push->frames));
+        push->frames[push->frames_len++] = (struct push_frame) {
+            .start = push->frame_start,
+            .len = len,
+        };
+        return;
+    }
+
+    ssize_t ret = send(push->fd,
+            push->frame.data, push->frame.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret == (ssize_t) push->frame.len) return;
+
+    if (ret < 0) optics_warn_errno("unable to push frame to '%s'", push->path);
+    else optics_warn("partial push frame to '%s': %ld != %lu",
+            push->path, ret, push->frame.len);
+
+    push_disconnect(push);
+}
+
+static void push_frame_begin(struct push *push, enum optics_push_type type)
+{
+    push->frame_type = type;
+    push->frame_count = 0;
+    if (!push->ring_enabled) push->frame.len = 0;
+    push->frame_start = push->frame.len;
+
+    struct optics_push_header header = {0};
+    buffer_write(&push->frame, &header, sizeof(header));
+}
+
+// Entries that would make the frame overflow continue in a new frame of the
+// same type.
+static void push_frame_entry(struct push *push, const void *data, size_t len, size_t pad)
+{
+    size_t frame_len = push->frame.len - push->frame_start;
+    if (push->frame_count && frame_len + len + pad > optics_push_frame_max) {
+        push_frame_send(push);
+        push_frame_begin(push, push->frame_type);
+    }
+
+    buffer_write(&push->frame, data, len);
+    for (size_t i = 0; i < pad; ++i) buffer_put(&push->frame, 0);
+    push->frame_count++;
+}
+
+// Empty frames are only sent for the frames that are always expected.
+static void push_frame_end(struct push *push)
+{
+    bool always = push->frame_type == optics_push_hello || push->frame_type == optics_push_done;
+    if (push->frame_count || always) push_frame_send(push);
+}
+
+
+// -----------------------------------------------------------------------------
+// ring
+// -----------------------------------------------------------------------------
+
+// Sends cancelled because of an earlier failure in the chain were never
+// attempted and are therefore not reported.
+static void push_ring_complete(void *ctx, uint64_t user, int32_t res)
+{
+    struct push *push = ctx;
+    if (res == -ECANCELED) return;
+
+    const struct push_frame *frame = &push->frames[user];
+    if (res == (ssize_t) frame->len) return;
+
+    if (res < 0) {
+        errno = -res;
+        optics_warn_errno("unable to push frame to '%s'", push->path);
+    }
+    else optics_warn("partial push frame to '%s': %d != %lu", push->path, res, frame->len);
+
+    push_disconnect(push);
+}
+
+static void push_ring_reap(struct push *push)
+{
+    (void) uring_reap(&push->ring, true, push_ring_complete, push);
+}
+
+// Chains can't span multiple submissions without losing their ordering
+// guarantees so a full ring waits for the queued chain to complete before
+// starting the next one.
+static void push_ring_send(struct push *push)
+{
+    struct uring *ring = &push->ring;
+
+    size_t i = 0;
+    while (i < push->frames_len && push->fd >= 0) {
+        const struct push_frame *frame = &push->frames[i];
+        const void *data = push->frame.data + frame->start;
+        bool link = i + 1 < push->frames_len;
+
+        if (uring_send(ring, push->fd, data, frame->len, i, link)) { i++; continue; }
+
+        if (!uring_submit(ring)) goto fail;
+        push_ring_reap(push);
+    }
+
+    if (uring_submit(ring)) return;
+
+  fail:
+    // A ring that fails to submit is unlikely to recover so it's abandoned in
+    // favour of regular sends after a resync on the next poll.
+    optics_warn_errno("unable to submit push frames to '%s'", push->path);
+    uring_close(ring);
+    push->ring_enabled = false;
+    push_disconnect(push);
+}
+
+
+// -----------------------------------------------------------------------------
+// poll
+// -----------------------------------------------------------------------------
+
+static void push_hello(struct push *push)
+{
+    size_t prefix_len = strlen(push->prefix);
+    size_t host_len = strlen(push->host);
+
+    push_frame_begin(push, optics_push_hello);
+
+    struct optics_push_hello hello = {
+        .pid = getpid(),
+        .prefix_len = prefix_len,
+        .host_len = host_len,
+    };
+    buffer_write(&push->frame, &hello, sizeof(hello));
+    buffer_write(&push->frame, push->prefix, prefix_len);
+    buffer_write(&push->frame, push->host, host_len);
+    push->frame_count = 1;
+
+    push_frame_end(push);
+}
+
+static void push_dict_entry(struct push *push, const struct push_key *key)
+{
+    struct {
+        struct optics_push_key header;
+        char data[optics_name_max_len];
+    } entry = {
+        .header = { .id = key->id, .type = key->type, .len = key->len },
+    };
+    memcpy(entry.data, key->data, key->len);
+
+    size_t len = sizeof(entry.header) + key->len;
+    push_frame_entry(push, &entry, len, (4 - (len % 4)) % 4);
+}
+
+static void push_dict(struct push *push, bool resync)
+{
+    push_frame_begin(push, optics_push_dict);
+
+    if (!resync) {
+        for (size_t i = 0; i < push->fresh_len; ++i)
+            push_dict_entry(push, push->fresh[i]);
+    }
+    else {
+        struct htable_bucket *it = htable_next(&push->keys, NULL);
+        for (; it; it = htable_next(&push->keys, it))
+            push_dict_entry(push, pun_itop(it->value));
+    }
+
+    push_frame_end(push);
+}
+
+static size_t push_values(struct push *push, bool resync)
+{
+    size_t sent = 0;
+    push_frame_begin(push, optics_push_values);
+
+    for (size_t i = 0; i < push->values_len; ++i) {
+        struct push_value *value = &push->values[i];
+        if (!resync && !value->changed) continue;
+
+        struct optics_push_value entry = {
+            .id = value->key->id,
+            .type = value->key->type,
+            .value = pun_itod(value->value),
+        };
+        push_frame_entry(push, &entry, sizeof(entry), 0);
+        sent++;
+    }
+
+    push_frame_end(push);
+    return sent;
+}
+
+static void push_drops(struct push *push)
+{
+    push_frame_begin(push, optics_push_drop);
+
+    for (size_t i = 0; i < push->drops_len; ++i)
+        push_frame_entry(push, &push->drops[i], sizeof(push->drops[i]), 0);
+
+    push_frame_end(push);
+}
+
+static void push_mark(struct push *push)
+{
+    for (size_t i = 0; i < push->values_len; ++i) {
+        struct push_value *value = &push->values[i];
+        struct push_key *key = value->key;
+
+        value->changed = !key->stamp || key->value != value->value;
+        key->value = value->value;
+        key->stamp = push->stamp;
+    }
+}
+
+// Keys that weren't part of the poll belong to closed lenses.
+static void push_sweep(struct push *push)
+{
+    push->drops_len = 0;
+
+    struct htable_bucket *it = NULL;
+    while ((it = htable_next(&push->keys, it))) {
+        struct push_key *key = pun_itop(it->value);
+        if (key->stamp == push->stamp) continue;
+
+        push->drops = push_grow(
+                push->drops, &push->drops_cap, push->drops_len, sizeof(*push->drops));
+        push->drops[push->drops_len++] = key->id;
+
+        free(key);
+        htable_del(&push->keys, it->key);
+    }
+}
+
+// A new connection or a change of prefix or host requires a hello frame which
+// resets the state of the receiver and is therefore followed by everything.
+static bool push_resync(struct push *push)
+{
+    bool resync = false;
+
+    if (push->fd < 0) {
+        push->fd = socket_seqpacket_connect_unix(push->path);
+        if (push->fd < 0) return false;
+        resync = true;
+    }
+
+    if (strcmp(push->prefix, push->poll_prefix) || strcmp(push->host, push->poll_host)) {
+        strlcpy(push->prefix, push->poll_prefix, sizeof(push->prefix));
+        strlcpy(push->host, push->poll_host, sizeof(push->host));
+        resync = true;
+    }
+
+    return resync;
+}
+
+static void push_done(struct push *push)
+{
+    push->stamp++;
+    push_mark(push);
+    push_sweep(push);
+
+    bool resync = push_resync(push);
+
+    push->frame.len = 0;
+    push->frames_len = 0;
+
+    if (push->fd >= 0) {
+        if (resync) push_hello(push);
+        push_dict(push, resync);
+        size_t sent = push_values(push, resync);
+        if (!resync) push_drops(push);
+
+        push_frame_begin(push, optics_push_done);
+        push->frame_count = sent;
+        push_frame_end(push);
+
+        if (push->ring_enabled) push_ring_send(push);
+    }
+
+    push->values_len = 0;
+    push->fresh_len = 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// callbacks
+// -----------------------------------------------------------------------------
+
+static struct push_key *push_key(struct push *push, const char *data)
+{
+    struct htable_ret ret = htable_get(&push->keys, data);
+    if (ret.ok) return pun_itop(ret.value);
+
+    size_t len = strnlen(data, optics_name_max_len - 1);
+    struct push_key *key = calloc(1, sizeof(*key) + len + 1);
+    optics_assert_alloc(key);
+
+    key->id = push->next_id++;
+    key->type = push->type;
+    key->len = len;
+    memcpy(key->data, data, len);
+
+    htable_put(&push->keys, key->data, pun_ptoi(key));
+
+    push->fresh = push_grow(push->fresh, &push->fresh_cap, push->fresh_len, sizeof(*push->fresh));
+    push->fresh[push->fresh_len++] = key;
+
+    return key;
+}
+
+static bool push_dump_normalized(void *ctx, optics_ts_t ts, const char *key, double value)
+{
+    struct push *push = ctx;
+    push->ts = ts;
+
+    push->values = push_grow(push->values, &push->values_cap, push->values_len, sizeof(*push->values));
+    push->values[push->values_len++] = (struct push_value) {
+        .key = push_key(push, key),
+        .value = pun_dtoi(value),
+    };
+
+    return true;
+}
+
+static void push_dump(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct push *push = ctx;
+
+    switch (type) {
+
+    case optics_poll_begin:
+        if (push->ring_enabled) push_ring_reap(push);
+        push->values_len = 0;
+        push->fresh_len = 0;
+        break;
+
+    case optics_poll_metric:
+        push->type = poll->type;
+        push->polled = true;
+        strlcpy(push->poll_prefix, poll->prefix, sizeof(push->poll_prefix));
+        strlcpy(push->poll_host, poll->host, sizeof(push->poll_host));
+        (void) optics_poll_normalize(poll, push_dump_normalized, push);
+        break;
+
+    case optics_poll_done:
+        if (push->polled) push_done(push);
+        break;
+
+    default:
+        optics_fail("unknown poll type '%d'", type);
+        break;
+    }
+}
+
+static void push_free(void *ctx)
+{
+    struct push *push = ctx;
+
+    if (push->ring_enabled) {
+        push_ring_reap(push);
+        uring_close(&push->ring);
+    }
+
+    push_disconnect(push);
+
+    struct htable_bucket *it = htable_next(&push->keys, NULL);
+    for (; it; it = htable_next(&push->keys, it)) free(pun_itop(it->value));
+    htable_reset(&push->keys);
+
+    free(push->values);
+    free(push->fresh);
+    free(push->drops);
+    free(push->frames);
+    buffer_reset(&push->frame);
+    free(push->path);
+    free(push);
+}
+
+
+// -----------------------------------------------------------------------------
+// register
+// -----------------------------------------------------------------------------
+
+// The receiver doesn't need to be up when the backend is registered as the
+// connection is attempted on every poll until it succeeds.
+bool optics_dump_push(struct optics_poller *poller, const char *path)
+{
+    struct push *push = calloc(1, sizeof(*push));
+    optics_assert_alloc(push);
+    push->path = strdup(path);
+    push->fd = -1;
+    push->ring_enabled = uring_init(&push->ring, push_ring_len);
+
+    if (!optics_poller_backend(poller, push, &push_dump, &push_free)) {
+        push_free(push);
+        return false;
+    }
+
+    return true;
+}
@@ -4,210 +4,1624 @@
 */
 
 #include "optics.h"
+#include "utils/log.h"
 #include "utils/errors.h"
 #include "utils/lock.h"
+#include "utils/time.h"
 #include "utils/buffer.h"
+#include "utils/arena.h"
+#include "utils/htable.h"
 #include "utils/crest/crest.h"
 
+#include <zlib.h>
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <bsd/string.h>
 
 
 // -----------------------------------------------------------------------------
 // metrics
 // -----------------------------------------------------------------------------
 
+// Compact copies of the poll values which leave out the inline arrays that are
+// not needed by the renderers. Arrays that are needed point into the arena.
+union metric_value
+{
+    // The rate and total are only set if the poller tracks the counter totals.
+    struct metric_counter
+    {
+        int64_t value;
+        double rate;
+        struct optics_counter_total total;
+    } counter;
+
+    double gauge;
+
+    struct metric_dist
+    {
+        size_t n;
+        double p50;
+        double p90;
+        double p99;
+        double max;
+    } dist;
+
+    struct metric_histo
+    {
+        size_t buckets_len;
+        const uint64_t *buckets;
+        size_t below, above;
+        const size_t *counts;
+    } histo;
+
+    struct optics_quantile quantile;
+
+    struct metric_quantiles
+    {
+        size_t len;
+        const double *quantiles;
+        const double *samples;
+        size_t count;
+    } quantiles;
+
+    struct optics_hdr hdr;
+    struct optics_sketch sketch;
+    struct optics_meter meter;
+    struct optics_topk topk;
+    struct optics_hll hll;
+    struct optics_updown updown;
+    struct optics_histo2d histo2d;
+};
+
 struct metric
 {
-    char *key;
+    const char *key;
+
+    // Position of the host within the key.
+    uint16_t host_pos;
+    uint16_t host_len;
+
     enum optics_lens_type type;
-    union optics_poll_value value;
+    union metric_value value;
 };
 
+// Published snapshots are refcounted so that requests can read a slice of the
+// snapshot without holding the lock. Keys and arrays live in the arena and the
+// last release hands the snapshot back to its owner to be recycled by the next
+// poll which means that a steady state poll doesn't allocate.
 struct metrics
 {
+    atomic_size_t refs;
+    struct metrics * _Atomic *spare;
+
+    struct arena arena;
+
     size_t len;
     size_t cap;
-    struct metric data[];
+    struct metric *data;
 };
 
 enum { metrics_init_cap = 128 };
 
-static void metrics_free(struct metrics *metrics)
+static void metrics_free(struct metrics *metrics)
+{
+    if (!metrics) return;
+
+    arena_reset(&metrics->arena);
+    free(metrics->data);
+    free(metrics);
+}
+
+static struct metrics *metrics_alloc(struct metrics * _Atomic *spare)
+{
+    struct metrics *metrics = atomic_exchange_explicit(spare, NULL, memory_order_acquire);
+
+    if (metrics) arena_clear(&metrics->arena);
+    else {
+        metrics = calloc(1, sizeof(*metrics));
+        optics_assert_alloc(metrics);
+        metrics->spare = spare;
+    }
+
+    atomic_init(&metrics->refs, 1);
+    metrics->len = 0;
+    return metrics;
+}
+
+static struct metrics *metrics_acquire(struct metrics *metrics)
+{
+    if (metrics) atomic_fetch_add_explicit(&metrics->refs, 1, memory_order_relaxed);
+    return metrics;
+}
+
+static void metrics_release(struct metrics *metrics)
+{
+    if (!metrics) return;
+    if (atomic_fetch_sub_explicit(&metrics->refs, 1, memory_order_acq_rel) != 1) return;
+
+    metrics_free(atomic_exchange_explicit(metrics->spare, metrics, memory_order_acq_rel));
+}
+
+static void metrics_append(struct metrics *metrics, const struct optics_poll *poll)
+{
+    if (metrics->len == metrics->cap) {
+        metrics->cap = metrics->cap ? metrics->cap * 2 : metrics_init_cap;
+        metrics->data = realloc(metrics->data, metrics->cap * sizeof(metrics->data[0]));
+        optics_assert_alloc(metrics->data);
+    }
+
+    struct arena *arena = &metrics->arena;
+    struct metric *metric = &metrics->data[metrics->len++];
+
+    struct optics_key key = {0};
+    optics_key_push(&key, poll->prefix);
+    size_t host_pos = key.len ? key.len + 1 : 0;
+    optics_key_push(&key, poll->host);
+    size_t host_end = key.len;
+    optics_key_push(&key, poll->key);
+
+    metric->key = arena_dup(arena, key.data, key.len + 1);
+    metric->host_pos = host_pos;
+    metric->host_len = host_end > host_pos ? host_end - host_pos : 0;
+    metric->type = poll->type;
+
+    const union optics_poll_value *src = &poll->value;
+    union metric_value *dst = &metric->value;
+
+    switch (poll->type) {
+
+    case optics_counter:
+        dst->counter.value = src->counter;
+        dst->counter.total = poll->total;
+        if (poll->total.tracked) dst->counter.rate = (double) src->counter / poll->elapsed_secs;
+        break;
+
+    case optics_gauge: dst->gauge = src->gauge; break;
+    case optics_updown: dst->updown = src->updown; break;
+
+    case optics_dist:
+        dst->dist.n = src->dist.n;
+        dst->dist.p50 = src->dist.p50;
+        dst->dist.p90 = src->dist.p90;
+        dst->dist.p99 = src->dist.p99;
+        dst->dist.max = src->dist.max;
+        break;
+
+    case optics_histo:
+        dst->histo.buckets_len = src->histo.buckets_len;
+        dst->histo.buckets = arena_dup(arena,
+                src->histo.buckets, src->histo.buckets_len * sizeof(src->histo.buckets[0]));
+        dst->histo.below = src->histo.below;
+        dst->histo.above = src->histo.above;
+        dst->histo.counts = arena_dup(arena,
+                src->histo.counts, src->histo.buckets_len * sizeof(src->histo.counts[0]));
+        break;
+
+    case optics_quantile: dst->quantile = src->quantile; break;
+    case optics_meter: dst->meter = src->meter; break;
+
+    case optics_quantiles:
+        dst->quantiles.len = src->quantiles.len;
+        dst->quantiles.quantiles = arena_dup(arena,
+                src->quantiles.quantiles, src->quantiles.len * sizeof(double));
+        dst->quantiles.samples = arena_dup(arena,
+                src->quantiles.samples, src->quantiles.len * sizeof(double));
+        dst->quantiles.count = src->quantiles.count;
+        break;
+
+    // hdr, sketch and histo2d counts, topk entries and hll registers are owned
+    // by the lens and are only valid for this poll.
+    case optics_hdr:
+        dst->hdr = src->hdr;
+        dst->hdr.counts = arena_dup(arena,
+                src->hdr.counts, src->hdr.buckets_len * sizeof(src->hdr.counts[0]));
+        break;
+
+    case optics_histo2d:
+        dst->histo2d = src->histo2d;
+        dst->histo2d.counts = arena_dup(arena, src->histo2d.counts,
+                (src->histo2d.rows_len - 1) * (src->histo2d.cols_len - 1)
+                * sizeof(src->histo2d.counts[0]));
+        break;
+
+    case optics_sketch:
+        dst->sketch = src->sketch;
+        dst->sketch.counts = arena_dup(arena,
+                src->sketch.counts, src->sketch.buckets_len * sizeof(src->sketch.counts[0]));
+        break;
+
+    case optics_topk:
+        dst->topk = src->topk;
+        dst->topk.entries = arena_dup(arena,
+                src->topk.entries, src->topk.len * sizeof(src->topk.entries[0]));
+        break;
+
+    case optics_hll:
+        dst->hll = src->hll;
+        dst->hll.registers = arena_dup(arena, src->hll.registers, src->hll.registers_len);
+        break;
+
+    case optics_family:
+    default:
+        optics_fail("unknown lens type '%d'", poll->type);
+        metrics->len--;
+        break;
+    }
+}
+
+static int metrics_cmp(const void *a, const void *b)
+{
+    const struct metric *lhs = a;
+    const struct metric *rhs = b;
+    return strncmp(lhs->key, rhs->key, optics_name_max_len);
+}
+
+static void metrics_sort(struct metrics *metrics)
+{
+    qsort(metrics->data, metrics->len, sizeof(*metrics->data), metrics_cmp);
+}
+
+// Returns the index of the first key that is greater or equal to prefix which,
+// given that the keys are sorted, is where the keys starting with prefix begin.
+static size_t metrics_lower_bound(const struct metrics *metrics, const char *prefix)
+{
+    size_t lo = 0, hi = metrics->len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(metrics->data[mid].key, prefix, optics_name_max_len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+
+// -----------------------------------------------------------------------------
+// blob
+// -----------------------------------------------------------------------------
+// Rendered body of a poll which is immutable once published. Requests hold a
+// reference on the blob until microhttpd is done sending it which means that the
+// body is never copied. The gzip version of the body is created by the first
+// request that accepts it and is owned by the blob.
+
+struct blob
+{
+    atomic_size_t refs;
+    char etag[24];
+
+    struct blob * _Atomic gzip;
+
+    size_t len;
+    char data[];
+};
+
+static struct blob *blob_new(size_t cap)
+{
+    struct blob *blob = malloc(sizeof(*blob) + cap);
+    optics_assert_alloc(blob);
+
+    atomic_init(&blob->refs, 1);
+    atomic_init(&blob->gzip, NULL);
+    blob->len = cap;
+
+    return blob;
+}
+
+static struct blob *blob_alloc(const struct buffer *buffer)
+{
+    struct blob *blob = blob_new(buffer->len);
+    memcpy(blob->data, buffer->data, buffer->len);
+
+    // FNV-1a hash of the body which means that polls that yield the same values
+    // also yield the same etag.
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < buffer->len; ++i)
+        hash = (hash ^ (uint8_t) buffer->data[i]) * 0x100000001b3;
+    snprintf(blob->etag, sizeof(blob->etag), "\"%016" PRIx64 "\"", hash);
+
+    return blob;
+}
+
+static struct blob *blob_acquire(struct blob *blob)
+{
+    if (blob) atomic_fetch_add_explicit(&blob->refs, 1, memory_order_relaxed);
+    return blob;
+}
+
+static void blob_release(struct blob *blob)
+{
+    if (!blob) return;
+    if (atomic_fetch_sub_explicit(&blob->refs, 1, memory_order_acq_rel) != 1) return;
+
+    blob_release(atomic_load_explicit(&blob->gzip, memory_order_acquire));
+    free(blob);
+}
+
+static void blob_release_data(void *data)
+{
+    blob_release((struct blob *) ((char *) data - offsetof(struct blob, data)));
+}
+
+static struct blob *blob_compress(const struct blob *blob)
+{
+    z_stream stream = {0};
+    int err = deflateInit2(&stream,
+            Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        optics_fail("unable to init gzip stream: %d", err);
+        return NULL;
+    }
+
+    struct blob *gzip = blob_new(deflateBound(&stream, blob->len));
+
+    stream.next_in = (Bytef *) blob->data;
+    stream.avail_in = blob->len;
+    stream.next_out = (Bytef *) gzip->data;
+    stream.avail_out = gzip->len;
+
+    err = deflate(&stream, Z_FINISH);
+    if (err != Z_STREAM_END) {
+        optics_fail("unable to gzip body: %d", err);
+        deflateEnd(&stream);
+        free(gzip);
+        return NULL;
+    }
+
+    gzip->len = stream.total_out;
+    deflateEnd(&stream);
+
+    // The etag must differ from the uncompressed body.
+    snprintf(gzip->etag, sizeof(gzip->etag), "\"%.16s-gz\"", blob->etag + 1);
+
+    return gzip;
+}
+
+// Returns a new reference on the gzip version of the blob. Concurrent requests
+// may race to compress the body in which case the loser discards its copy.
+static struct blob *blob_gzip(struct blob *blob)
+{
+    struct blob *gzip = atomic_load_explicit(&blob->gzip, memory_order_acquire);
+    if (gzip) return blob_acquire(gzip);
+
+    if (!(gzip = blob_compress(blob))) return NULL;
+
+    struct blob *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&blob->gzip, &expected, gzip,
+                    memory_order_acq_rel, memory_order_acquire)) {
+        free(gzip);
+        gzip = expected;
+    }
+
+    return blob_acquire(gzip);
+}
+
+
+// -----------------------------------------------------------------------------
+// history
+// -----------------------------------------------------------------------------
+// Ring of the normalized values of the last polls stored column-wise where each
+// key is interned once into a column that holds its values for every slot of
+// the ring. The ring has one more slot than what's readable which is the slot
+// written by the poll in progress. That slot is never read by requests so only
+// the publication of the poll and the changes to the columns need the lock.
+// Columns that haven't been written for longer than the ring are dropped.
+
+enum { history_default_len = 300 };
+
+struct history_column
+{
+    char key[optics_name_max_len];
+
+    // Index of the last poll that wrote to the column.
+    size_t last;
+    double values[];
+};
+
+struct history
+{
+    struct slock lock;
+
+    // Readable polls and number of polls published. Timestamps are in nanos
+    // and recorded is the timestamp of the poll being recorded.
+    size_t cap;
+    size_t len;
+    uint64_t *ts;
+    uint64_t recorded;
+
+    // Maps keys to their index in columns.
+    struct htable index;
+
+    size_t columns_len;
+    size_t columns_cap;
+    struct history_column **columns;
+};
+
+static size_t history_slot(const struct history *history, size_t poll)
+{
+    return poll % (history->cap + 1);
+}
+
+static void history_init(struct history *history, size_t cap)
+{
+    history->cap = cap;
+    history->ts = calloc(cap + 1, sizeof(*history->ts));
+    optics_assert_alloc(history->ts);
+}
+
+static void history_reset(struct history *history)
+{
+    for (size_t i = 0; i < history->columns_len; ++i)
+        free(history->columns[i]);
+    free(history->columns);
+    free(history->ts);
+    htable_reset(&history->index);
+}
+
+// Should be called while holding the lock.
+static void history_remove(struct history *history, size_t index)
+{
+    struct history_column *column = history->columns[index];
+    (void) htable_del(&history->index, column->key);
+
+    struct history_column *last = history->columns[--history->columns_len];
+    if (last != column) {
+        history->columns[index] = last;
+        (void) htable_xchg(&history->index, last->key, index);
+    }
+
+    free(column);
+}
+
+static void history_begin(struct history *history)
+{
+    size_t slot = history_slot(history, history->len);
+
+    slock_lock(&history->lock);
+
+    for (size_t i = 0; i < history->columns_len;) {
+        struct history_column *column = history->columns[i];
+        if (history->len - column->last > history->cap) {
+            history_remove(history, i);
+            continue;
+        }
+
+        column->values[slot] = NAN;
+        i++;
+    }
+
+    slock_unlock(&history->lock);
+
+    history->ts[slot] = 0;
+}
+
+static struct history_column *history_column(struct history *history, const char *key)
+{
+    struct htable_ret ret = htable_get(&history->index, key);
+    if (ret.ok) return history->columns[ret.value];
+
+    size_t len = history->cap + 1;
+    struct history_column *column = malloc(sizeof(*column) + len * sizeof(column->values[0]));
+    optics_assert_alloc(column);
+
+    strlcpy(column->key, key, sizeof(column->key));
+    for (size_t i = 0; i < len; ++i) column->values[i] = NAN;
+
+    slock_lock(&history->lock);
+
+    if (history->columns_len == history->columns_cap) {
+        history->columns_cap = history->columns_cap ? history->columns_cap * 2 : metrics_init_cap;
+        history->columns = realloc(history->columns,
+                history->columns_cap * sizeof(history->columns[0]));
+        optics_assert_alloc(history->columns);
+    }
+
+    ret = htable_put(&history->index, column->key, history->columns_len);
+    optics_assert(ret.ok, "duplicate history key '%s'", column->key);
+    history->columns[history->columns_len++] = column;
+
+    slock_unlock(&history->lock);
+
+    return column;
+}
+
+static bool history_record_value(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) ts;
+    struct history *history = ctx;
+
+    char buffer[optics_name_max_len];
+    if (key_len >= sizeof(buffer)) key_len = sizeof(buffer) - 1;
+    memcpy(buffer, key, key_len);
+    buffer[key_len] = '\0';
+
+    size_t slot = history_slot(history, history->len);
+    struct history_column *column = history_column(history, buffer);
+    column->values[slot] = value;
+    column->last = history->len;
+
+    history->ts[slot] = history->recorded;
+    return true;
+}
+
+static void history_record(struct history *history, const struct optics_poll *poll)
+{
+    history->recorded = poll->ts_nanos;
+    (void) optics_poll_normalize_qualified(poll, history_record_value, history);
+}
+
+static void history_publish(struct history *history)
+{
+    slock_lock(&history->lock);
+    history->len++;
+    slock_unlock(&history->lock);
+}
+
+static bool history_exists(struct history *history, const char *key)
+{
+    slock_lock(&history->lock);
+    bool ret = htable_get(&history->index, key).ok;
+    slock_unlock(&history->lock);
+    return ret;
+}
+
+// Writes the last n values of the key from oldest to newest where missing
+// values are written as null.
+static void history_write(
+        struct history *history, struct buffer *buffer, const char *key, size_t n)
+{
+    slock_lock(&history->lock);
+
+    size_t len = history->len < history->cap ? history->len : history->cap;
+    if (n > len) n = len;
+
+    struct history_column *column = NULL;
+    struct htable_ret ret = htable_get(&history->index, key);
+    if (ret.ok) column = history->columns[ret.value];
+    else n = 0;
+
+    size_t first = history->len - n;
+
+    // Timestamps are in seconds with millisecond precision when needed.
+    buffer_write(buffer, "{\"ts\":[", 7);
+    for (size_t i = 0; i < n; ++i) {
+        if (i) buffer_put(buffer, ',');
+
+        uint64_t ts = history->ts[history_slot(history, first + i)];
+        uint64_t millis = (ts / 1000000) % 1000;
+        buffer_put_u64(buffer, ts / 1000000000);
+        if (millis) {
+            char str[4] = { '.', '0' + millis / 100, '0' + millis / 10 % 10, '0' + millis % 10 };
+            buffer_write(buffer, str, sizeof(str));
+        }
+    }
+
+    buffer_write(buffer, "],\"values\":[", 12);
+    for (size_t i = 0; i < n; ++i) {
+        if (i) buffer_put(buffer, ',');
+
+        double value = column->values[history_slot(history, first + i)];
+        if (isnan(value)) buffer_write(buffer, "null", 4);
+        else buffer_put_double(buffer, value);
+    }
+
+    buffer_write(buffer, "]}", 2);
+
+    slock_unlock(&history->lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// rest
+// -----------------------------------------------------------------------------
+
+// Prometheus wants every sample of a family to be contiguous which the key order
+// doesn't guarantee given that the host sits in the middle of the key.
+struct prom_entry
+{
+    const char *family;
+    const struct metric *metric;
+};
+
+struct prom_order
+{
+    struct arena families;
+    size_t cap;
+    struct prom_entry *data;
+};
+
+struct rest
+{
+    struct optics_poller *poller;
+
+    struct slock lock;
+    struct metrics *current;
+    struct blob *json;
+    struct blob *prometheus;
+
+    struct metrics *build;
+    struct metrics * _Atomic spare;
+    struct buffer render;
+    struct prom_order prom_order;
+
+    // Disabled when the capacity is 0.
+    struct history history;
+};
+
+static struct blob *render_json(struct rest *rest);
+static struct blob *render_prometheus(struct rest *rest);
+
+// Rendering happens before taking the lock so requests are never blocked by the
+// poll thread for longer then a pointer swap.
+static void swap_tables(struct rest *rest)
+{
+    struct metrics *to_delete;
+    struct blob *json_release, *prometheus_release;
+
+    struct timespec start, stop;
+    clock_monotonic(&start);
+
+    if (rest->build) metrics_sort(rest->build);
+    struct blob *json = render_json(rest);
+    struct blob *prometheus = render_prometheus(rest);
+
+    clock_monotonic(&stop);
+    optics_poller_self_record(rest->poller, "rest.render_ns",
+            (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec));
+    optics_poller_self_inc(rest->poller, "rest.render_bytes", json->len + prometheus->len);
+
+    {
+        slock_lock(&rest->lock);
+
+        to_delete = rest->current;
+        rest->current = rest->build;
+
+        json_release = rest->json;
+        rest->json = json;
+
+        prometheus_release = rest->prometheus;
+        rest->prometheus = prometheus;
+
+        slock_unlock(&rest->lock);
+    }
+
+    metrics_release(to_delete);
+    blob_release(json_release);
+    blob_release(prometheus_release);
+    rest->build = NULL;
+}
+
+// The prefix is written as is before the value and carries the punctuation and
+// field name that precedes it.
+static void json_double(struct buffer *buffer, const char *prefix, double value)
+{
+    buffer_puts(buffer, prefix);
+    buffer_put_double(buffer, value);
+}
+
+static void json_u64(struct buffer *buffer, const char *prefix, uint64_t value)
+{
+    buffer_puts(buffer, prefix);
+    buffer_put_u64(buffer, value);
+}
+
+static void json_i64(struct buffer *buffer, const char *prefix, int64_t value)
+{
+    buffer_puts(buffer, prefix);
+    buffer_put_i64(buffer, value);
+}
+
+static void json_key(struct buffer *buffer, const char *key)
+{
+    buffer_put(buffer, '"');
+    buffer_puts(buffer, key);
+    buffer_write(buffer, "\":", 2);
+}
+
+static void write_counter(struct buffer *buffer, const struct metric *metric)
+{
+    json_key(buffer, metric->key);
+
+    switch (metric->type) {
+
+    case optics_counter: {
+        const struct metric_counter *counter = &metric->value.counter;
+
+        if (!counter->total.tracked) {
+            buffer_put_u64(buffer, counter->value);
+            break;
+        }
+
+        json_double(buffer, "{\"rate\":", counter->rate);
+        json_i64(buffer, ",\"total\":", counter->total.value);
+        json_u64(buffer, ",\"created\":", counter->total.created);
+        buffer_put(buffer, '}');
+        break;
+    }
+
+    case optics_gauge:
+        buffer_put_double(buffer, metric->value.gauge);
+        break;
+
+    case optics_updown:
+        json_i64(buffer, "{\"value\":", metric->value.updown.value);
+        json_i64(buffer, ",\"min\":", metric->value.updown.min);
+        json_i64(buffer, ",\"max\":", metric->value.updown.max);
+        buffer_put(buffer, '}');
+        break;
+
+    case optics_dist:
+        json_double(buffer, "{\"p50\":", metric->value.dist.p50);
+        json_double(buffer, ",\"p90\":", metric->value.dist.p90);
+        json_double(buffer, ",\"p99\":", metric->value.dist.p99);
+        json_double(buffer, ",\"max\":", metric->value.dist.max);
+        json_u64(buffer, ",\"count\":", metric->value.dist.n);
+        buffer_put(buffer, '}');
+        break;
+
+    case optics_meter:
+        json_double(buffer, "{\"m1\":", metric->value.meter.m1);
+        json_double(buffer, ",\"m5\":", metric->value.meter.m5);
+        json_double(buffer, ",\"m15\":", metric->value.meter.m15);
+        json_i64(buffer, ",\"count\":", metric->value.meter.count);
+        buffer_put(buffer, '}');
+        break;
+
+    case optics_topk:
+    {
+        const struct optics_topk *topk = &metric->value.topk;
+
+        json_u64(buffer, "{\"count\":", topk->count);
+        buffer_puts(buffer, ",\"top\":{");
+        for (size_t i = 0; i < topk->len; ++i) {
+            if (i) buffer_put(buffer, ',');
+            json_key(buffer, topk->entries[i].key);
+            buffer_put_u64(buffer, topk->entries[i].count);
+        }
+        buffer_write(buffer, "}}", 2);
+        break;
+    }
+
+    case optics_histo:
+    {
+        const struct metric_histo *histo = &metric->value.histo;
+
+        json_u64(buffer, "{\"below\":", histo->above);
+        json_u64(buffer, ",\"above\":", histo->below);
+
+        for (size_t i = 0; i < histo->buckets_len - 1; ++i) {
+            json_u64(buffer, ",\"bucket_", histo->buckets[i]);
+            json_u64(buffer, "-", histo->buckets[i+1]);
+            json_u64(buffer, "\":", histo->counts[i]);
+        }
+
+        buffer_put(buffer, '}');
+        break;
+    }
+
+    // Counts are nested arrays in row-major order with one array per row.
+    case optics_histo2d:
+    {
+        const struct optics_histo2d *histo = &metric->value.histo2d;
+
+        json_u64(buffer, "{\"count\":", histo->count);
+        json_u64(buffer, ",\"outside\":", histo->outside);
+
+        for (size_t i = 0; i < histo->rows_len; ++i)
+            json_u64(buffer, i ? "," : ",\"rows\":[", histo->rows[i]);
+        for (size_t i = 0; i < histo->cols_len; ++i)
+            json_u64(buffer, i ? "," : "],\"cols\":[", histo->cols[i]);
+
+        buffer_puts(buffer, "],\"counts\":[");
+
+        size_t cols = histo->cols_len - 1;
+        for (size_t row = 0; row < histo->rows_len - 1; ++row) {
+            buffer_puts(buffer, row ? ",[" : "[");
+            for (size_t col = 0; col < cols; ++col) {
+                if (col) buffer_put(buffer, ',');
+                buffer_put_u64(buffer, histo->counts[row * cols + col]);
+            }
+            buffer_put(buffer, ']');
+        }
+
+        buffer_write(buffer, "]}", 2);
+        break;
+    }
+
+    case optics_quantile:
+    {
+        const struct optics_quantile *quantile = &metric->value.quantile;
+
+        json_double(buffer, "{\"value\":", quantile->sample);
+        json_u64(buffer, ",\"count\":", quantile->count);
+        buffer_put(buffer, '}');
+        break;
+    }
+
+    case optics_quantiles:
+    {
+        const struct metric_quantiles *quantiles = &metric->value.quantiles;
+
+        json_u64(buffer, "{\"count\":", quantiles->count);
+        buffer_puts(buffer, ",\"quantiles\":{");
+
+        for (size_t i = 0; i < quantiles->len; ++i) {
+            json_double(buffer, i ? ",\"" : "\"", quantiles->quantiles[i]);
+            json_double(buffer, "\":", quantiles->samples[i]);
+        }
+
+        buffer_write(buffer, "}}", 2);
+        break;
+    }
+
+    case optics_hdr:
+    {
+        const struct optics_hdr *hdr = &metric->value.hdr;
+
+        json_double(buffer, "{\"p50\":", hdr->p50);
+        json_double(buffer, ",\"p90\":", hdr->p90);
+        json_double(buffer, ",\"p99\":", hdr->p99);
+        json_double(buffer, ",\"p999\":", hdr->p999);
+        json_double(buffer, ",\"max\":", hdr->max);
+        json_u64(buffer, ",\"count\":", hdr->count);
+        buffer_puts(buffer, ",\"buckets\":{");
+
+        bool first = true;
+        for (size_t i = 0; i < hdr->buckets_len; ++i) {
+            if (!hdr->counts[i]) continue;
+
+            json_double(buffer, first ? "\"" : ",\"", optics_hdr_bucket(hdr, i));
+            json_u64(buffer, "\":", hdr->counts[i]);
+            first = false;
+        }
+
+        buffer_write(buffer, "}}", 2);
+        break;
+    }
+
+    // The shortest representation of gamma parses back to the exact same value
+    // which collectors need to merge the buckets across hosts.
+    case optics_sketch:
+    {
+        const struct optics_sketch *sketch = &metric->value.sketch;
+
+        json_double(buffer, "{\"p50\":", sketch->p50);
+        json_double(buffer, ",\"p90\":", sketch->p90);
+        json_double(buffer, ",\"p99\":", sketch->p99);
+        json_double(buffer, ",\"max\":", sketch->max);
+        json_u64(buffer, ",\"count\":", sketch->count);
+        json_double(buffer, ",\"gamma\":", sketch->gamma);
+        json_u64(buffer, ",\"zero\":", sketch->zero);
+        buffer_puts(buffer, ",\"buckets\":{");
+
+        bool first = true;
+        for (size_t i = 0; i < sketch->buckets_len; ++i) {
+            if (!sketch->counts[i]) continue;
+
+            json_i64(buffer, first ? "\"" : ",\"", sketch->offset + (int64_t) i);
+            json_u64(buffer, "\":", sketch->counts[i]);
+            first = false;
+        }
+
+        buffer_write(buffer, "}}", 2);
+        break;
+    }
+
+    // Registers are what collectors need to merge the estimates across hosts.
+    // Only the non-empty ones are written since they're mostly empty for low
+    // cardinalities.
+    case optics_hll:
+    {
+        const struct optics_hll *hll = &metric->value.hll;
+
+        json_double(buffer, "{\"estimate\":", hll->estimate);
+        json_u64(buffer, ",\"precision\":", hll->precision);
+        buffer_puts(buffer, ",\"registers\":{");
+
+        bool first = true;
+        for (size_t i = 0; i < hll->registers_len; ++i) {
+            if (!hll->registers[i]) continue;
+
+            json_u64(buffer, first ? "\"" : ",\"", i);
+            json_u64(buffer, "\":", hll->registers[i]);
+            first = false;
+        }
+
+        buffer_write(buffer, "}}", 2);
+        break;
+    }
+
+    case optics_family:
+    default:
+        optics_fail("unknown lens type '%d'", metric->type);
+        break;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// json
+// -----------------------------------------------------------------------------
+
+static struct blob *render_json(struct rest *rest)
+{
+    struct buffer *buffer = &rest->render;
+    buffer->len = 0;
+
+    buffer_put(buffer, '{');
+
+    if (rest->build) {
+        for (size_t i = 0; i < rest->build->len; ++i) {
+            if (i > 0) buffer_put(buffer, ',');
+            write_counter(buffer, &rest->build->data[i]);
+        }
+    }
+
+    buffer_put(buffer, '}');
+
+    return blob_alloc(buffer);
+}
+
+
+// -----------------------------------------------------------------------------
+// prometheus
+// -----------------------------------------------------------------------------
+// Text exposition format where the host becomes a label and the rest of the key
+// becomes the metric name. Optics counters are reset on every poll so only the
+// counters whose totals are tracked by the poller are typed as counters. The
+// per poll counts of everything else are exposed as gauges.
+
+struct prom_name
 {
-    if (!metrics) return;
-
-    for (size_t i = 0; i < metrics->len; ++i)
-        free(metrics->data[i].key);
+    char name[optics_name_max_len + 1];
+    char host[optics_name_max_len * 2];
+};
 
-    free(metrics);
+static void prom_sanitize(char *dst, size_t *pos, const char *src, size_t len)
+{
+    for (size_t i = 0; i < len && *pos < optics_name_max_len; ++i) {
+        char c = src[i];
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            c == '_' || c == ':' || (*pos && c >= '0' && c <= '9');
+        dst[(*pos)++] = valid ? c : '_';
+    }
+    dst[*pos] = '\0';
 }
 
-static struct metrics *metrics_append(struct metrics *metrics, const struct optics_poll *poll)
+static void prom_name(struct prom_name *name, const struct metric *metric)
 {
-    if (!metrics) {
-        metrics = malloc(sizeof(struct metrics) + sizeof(struct metric) * metrics_init_cap);
-        optics_assert_alloc(metrics);
-        metrics->len = 0;
-        metrics->cap = metrics_init_cap;
-    }
+    const char *key = metric->key;
+    size_t key_len = strnlen(key, optics_name_max_len);
 
-    if (metrics->len == metrics->cap) {
-        metrics->cap *= 2;
-        metrics = realloc(metrics, sizeof(struct metrics) + sizeof(struct metric) * metrics->cap);
-        optics_assert_alloc(metrics);
+    size_t pos = 0;
+    if (metric->host_pos) prom_sanitize(name->name, &pos, key, metric->host_pos - 1);
+
+    size_t tail = metric->host_pos + metric->host_len;
+    if (tail < key_len) {
+        if (pos) name->name[pos++] = '_';
+        prom_sanitize(name->name, &pos, key + tail + 1, key_len - tail - 1);
     }
 
-    struct optics_key key = {0};
-    optics_key_push(&key, poll->prefix);
-    optics_key_push(&key, poll->host);
-    optics_key_push(&key, poll->key);
+    pos = 0;
+    const char *host = key + metric->host_pos;
+    for (size_t i = 0; i < metric->host_len; ++i) {
+        if (host[i] == '\\' || host[i] == '"') name->host[pos++] = '\\';
+        name->host[pos++] = host[i];
+    }
+    name->host[pos] = '\0';
+}
 
-    metrics->data[metrics->len] = (struct metric) {
-        .key = strndup(key.data, optics_name_max_len),
-        .type = poll->type,
-        .value = poll->value,
-    };
-    metrics->len++;
+// Keys that only differ by their host or by the characters replaced when
+// sanitized end up in the same family that must only be typed once for the page
+// to be accepted by strict scrapers. types holds the families written so far.
+static void prom_type(
+        struct buffer *buffer, struct htable *types,
+        const struct prom_name *name, const char *suffix, const char *type)
+{
+    char family[sizeof(name->name) + 16];
+    (void) snprintf(family, sizeof(family), "%s%s", name->name, suffix);
+    if (!htable_put(types, family, 0).ok) return;
 
-    return metrics;
+    buffer_puts(buffer, "# TYPE ");
+    buffer_puts(buffer, name->name);
+    buffer_puts(buffer, suffix);
+    buffer_put(buffer, ' ');
+    buffer_puts(buffer, type);
+    buffer_put(buffer, '\n');
 }
 
-static int metrics_cmp(const void *a, const void *b)
+// Leaves the label set open for additional labels which are closed off along
+// with the value by the prom_value functions.
+static void prom_labels(struct buffer *buffer, const struct prom_name *name, const char *suffix)
 {
-    const struct metric *lhs = a;
-    const struct metric *rhs = b;
-    return strncmp(lhs->key, rhs->key, optics_name_max_len);
+    buffer_puts(buffer, name->name);
+    buffer_puts(buffer, suffix);
+    buffer_puts(buffer, "{host=\"");
+    buffer_puts(buffer, name->host);
+    buffer_put(buffer, '"');
 }
 
-static void metrics_sort(struct metrics *metrics)
+static void prom_value_double(struct buffer *buffer, double value)
 {
-    qsort(metrics->data, metrics->len, sizeof(*metrics->data), metrics_cmp);
+    buffer_write(buffer, "} ", 2);
+    buffer_put_double(buffer, value);
+    buffer_put(buffer, '\n');
 }
 
-
-// -----------------------------------------------------------------------------
-// rest
-// -----------------------------------------------------------------------------
-
-struct rest
+static void prom_value_u64(struct buffer *buffer, uint64_t value)
 {
-    struct optics_poller *poller;
-
-    struct slock lock;
-    struct metrics *current;
-
-    struct metrics *build;
-};
+    buffer_write(buffer, "} ", 2);
+    buffer_put_u64(buffer, value);
+    buffer_put(buffer, '\n');
+}
 
-static void swap_tables(struct rest *rest)
+static void prom_value_i64(struct buffer *buffer, int64_t value)
 {
-    struct metrics *to_delete;
-    if (rest->build) metrics_sort(rest->build);
-
-    {
-        slock_lock(&rest->lock);
+    buffer_write(buffer, "} ", 2);
+    buffer_put_i64(buffer, value);
+    buffer_put(buffer, '\n');
+}
 
-        to_delete = rest->current;
-        rest->current = rest->build;
+static void prom_summary(
+        struct buffer *buffer, struct htable *types, const struct prom_name *name,
+        const double *quantiles, const double *values, size_t len, size_t count)
+{
+    prom_type(buffer, types, name, "", "summary");
 
-        slock_unlock(&rest->lock);
+    for (size_t i = 0; i < len; ++i) {
+        prom_labels(buffer, name, "");
+        buffer_puts(buffer, ",quantile=\"");
+        buffer_put_double(buffer, quantiles[i]);
+        buffer_put(buffer, '"');
+        prom_value_double(buffer, values[i]);
     }
 
-    metrics_free(to_delete);
-    rest->build = NULL;
+    prom_labels(buffer, name, "_count");
+    prom_value_u64(buffer, count);
 }
 
-static void write_counter(struct buffer *buffer, const struct metric *metric)
+static void prom_max(
+        struct buffer *buffer, struct htable *types, const struct prom_name *name, double max)
+{
+    prom_type(buffer, types, name, "_max", "gauge");
+    prom_labels(buffer, name, "_max");
+    prom_value_double(buffer, max);
+}
+
+static void write_prometheus(
+        struct buffer *buffer, struct htable *types, const struct metric *metric)
 {
+    struct prom_name name;
+    prom_name(&name, metric);
+
     switch (metric->type) {
 
-    case optics_counter:
-        buffer_printf(buffer, "\"%s\":%" PRIu64, metric->key, metric->value.counter);
+    // Totals are reported along with the time the total started from which
+    // is how the consumers detect resets.
+    case optics_counter: {
+        const struct metric_counter *counter = &metric->value.counter;
+
+        if (!counter->total.tracked) {
+            prom_type(buffer, types, &name, "", "gauge");
+            prom_labels(buffer, &name, "");
+            prom_value_i64(buffer, counter->value);
+            break;
+        }
+
+        prom_type(buffer, types, &name, "_total", "counter");
+        prom_labels(buffer, &name, "_total");
+        prom_value_i64(buffer, counter->total.value);
+        prom_labels(buffer, &name, "_created");
+        prom_value_u64(buffer, counter->total.created);
         break;
+    }
 
     case optics_gauge:
-        buffer_printf(buffer, "\"%s\":%g", metric->key, metric->value.gauge);
+        prom_type(buffer, types, &name, "", "gauge");
+        prom_labels(buffer, &name, "");
+        prom_value_double(buffer, metric->value.gauge);
         break;
 
+    case optics_updown:
+    {
+        const struct optics_updown *updown = &metric->value.updown;
+        prom_type(buffer, types, &name, "", "gauge");
+        prom_labels(buffer, &name, "");
+        prom_value_i64(buffer, updown->value);
+        prom_type(buffer, types, &name, "_min", "gauge");
+        prom_labels(buffer, &name, "_min");
+        prom_value_i64(buffer, updown->min);
+        prom_type(buffer, types, &name, "_max", "gauge");
+        prom_labels(buffer, &name, "_max");
+        prom_value_i64(buffer, updown->max);
+        break;
+    }
+
     case optics_dist:
-        buffer_printf(buffer,
-                "\"%s\":{\"p50\":%g,\"p90\":%g,\"p99\":%g,\"max\":%g,\"count\":%zu}",
-                metric->key,
-                metric->value.dist.p50,
-                metric->value.dist.p90,
-                metric->value.dist.p99,
-                metric->value.dist.max,
-                metric->value.dist.n);
+    {
+        const struct metric_dist *dist = &metric->value.dist;
+        const double quantiles[] = { 0.5, 0.9, 0.99 };
+        const double values[] = { dist->p50, dist->p90, dist->p99 };
+        prom_summary(buffer, types, &name, quantiles, values, 3, dist->n);
+        prom_max(buffer, types, &name, dist->max);
+        break;
+    }
+
+    case optics_meter:
+    {
+        const struct optics_meter *meter = &metric->value.meter;
+        prom_type(buffer, types, &name, "_count", "gauge");
+        prom_labels(buffer, &name, "_count");
+        prom_value_i64(buffer, meter->count);
+
+        const char *windows[] = { "1m", "5m", "15m" };
+        const double rates[] = { meter->m1, meter->m5, meter->m15 };
+
+        prom_type(buffer, types, &name, "_rate", "gauge");
+        for (size_t i = 0; i < 3; ++i) {
+            prom_labels(buffer, &name, "_rate");
+            buffer_puts(buffer, ",window=\"");
+            buffer_puts(buffer, windows[i]);
+            buffer_put(buffer, '"');
+            prom_value_double(buffer, rates[i]);
+        }
+        break;
+    }
+
+    case optics_topk:
+    {
+        const struct optics_topk *topk = &metric->value.topk;
+        prom_type(buffer, types, &name, "_count", "gauge");
+        prom_labels(buffer, &name, "_count");
+        prom_value_u64(buffer, topk->count);
+
+        prom_type(buffer, types, &name, "_top", "gauge");
+        for (size_t i = 0; i < topk->len; ++i) {
+            prom_labels(buffer, &name, "_top");
+            buffer_puts(buffer, ",key=\"");
+            buffer_puts(buffer, topk->entries[i].key);
+            buffer_put(buffer, '"');
+            prom_value_u64(buffer, topk->entries[i].count);
+        }
+        break;
+    }
+
+    case optics_hll:
+        prom_type(buffer, types, &name, "", "gauge");
+        prom_labels(buffer, &name, "");
+        prom_value_double(buffer, metric->value.hll.estimate);
         break;
 
+    // Histo buckets are half-open on the right, so the upper bound of each bucket
+    // is used as the le label. Counts are cumulative and the values below the
+    // first bucket go in the first le. Histos don't keep the sum of their values
+    // so _sum is approximated from the midpoints of the buckets where the values
+    // below and above the edges are taken to be on the first and last edge.
+    // Histos are reset on every poll so the series are typed as gauges.
     case optics_histo:
     {
-        const struct optics_histo *histo = &metric->value.histo;
+        const struct metric_histo *histo = &metric->value.histo;
+        size_t last = histo->buckets_len - 1;
 
-        buffer_printf(buffer, "\"%s\":{\"below\":%zu,\"above\":%zu",
-                metric->key, histo->above, histo->below);
+        prom_type(buffer, types, &name, "_bucket", "gauge");
 
-        for (size_t i = 0; i < histo->buckets_len - 1; ++i) {
-            buffer_printf(buffer, ",\"bucket_%lu-%lu\":%zu",
-                    histo->buckets[i], histo->buckets[i+1], histo->counts[i]);
+        size_t total = histo->below;
+        double sum = (double) histo->below * histo->buckets[0];
+        for (size_t i = 0; i < histo->buckets_len; ++i) {
+            if (i) {
+                total += histo->counts[i - 1];
+                sum += histo->counts[i - 1] *
+                    ((double) histo->buckets[i - 1] + histo->buckets[i]) / 2;
+            }
+
+            prom_labels(buffer, &name, "_bucket");
+            buffer_puts(buffer, ",le=\"");
+            buffer_put_u64(buffer, histo->buckets[i]);
+            buffer_put(buffer, '"');
+            prom_value_u64(buffer, total);
         }
 
-        buffer_put(buffer, '}');
+        total += histo->above;
+        sum += (double) histo->above * histo->buckets[last];
+        prom_labels(buffer, &name, "_bucket");
+        buffer_puts(buffer, ",le=\"+Inf\"");
+        prom_value_u64(buffer, total);
+
+        prom_type(buffer, types, &name, "_sum", "gauge");
+        prom_labels(buffer, &name, "_sum");
+        prom_value_double(buffer, sum);
+
+        prom_type(buffer, types, &name, "_count", "gauge");
+        prom_labels(buffer, &name, "_count");
+        prom_value_u64(buffer, total);
+        break;
+    }
+
+    // Prometheus has no two-dimensional histograms so each cell is a gauge
+    // labeled by the bounds of its row and column.
+    case optics_histo2d:
+    {
+        const struct optics_histo2d *histo = &metric->value.histo2d;
+
+        prom_type(buffer, types, &name, "_bucket", "gauge");
+
+        size_t cols = histo->cols_len - 1;
+        for (size_t row = 0; row < histo->rows_len - 1; ++row) {
+            for (size_t col = 0; col < cols; ++col) {
+                prom_labels(buffer, &name, "_bucket");
+                buffer_puts(buffer, ",row=\"");
+                buffer_put_u64(buffer, histo->rows[row]);
+                buffer_put(buffer, '_');
+                buffer_put_u64(buffer, histo->rows[row + 1]);
+                buffer_puts(buffer, "\",col=\"");
+                buffer_put_u64(buffer, histo->cols[col]);
+                buffer_put(buffer, '_');
+                buffer_put_u64(buffer, histo->cols[col + 1]);
+                buffer_put(buffer, '"');
+                prom_value_u64(buffer, histo->counts[row * cols + col]);
+            }
+        }
+
+        prom_type(buffer, types, &name, "_outside", "gauge");
+        prom_labels(buffer, &name, "_outside");
+        prom_value_u64(buffer, histo->outside);
+
+        prom_type(buffer, types, &name, "_count", "gauge");
+        prom_labels(buffer, &name, "_count");
+        prom_value_u64(buffer, histo->count);
         break;
     }
 
     case optics_quantile:
     {
         const struct optics_quantile *quantile = &metric->value.quantile;
+        prom_summary(buffer, types, &name,
+                &quantile->quantile, &quantile->sample, 1, quantile->count);
+        break;
+    }
+
+    case optics_quantiles:
+    {
+        const struct metric_quantiles *quantiles = &metric->value.quantiles;
+        prom_summary(buffer, types, &name,
+                quantiles->quantiles, quantiles->samples, quantiles->len, quantiles->count);
+        break;
+    }
+
+    case optics_hdr:
+    {
+        const struct optics_hdr *hdr = &metric->value.hdr;
+        const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        const double values[] = { hdr->p50, hdr->p90, hdr->p99, hdr->p999 };
+        prom_summary(buffer, types, &name, quantiles, values, 4, hdr->count);
+        prom_max(buffer, types, &name, hdr->max);
+        break;
+    }
 
-        buffer_printf(buffer, "\"%s\":{\"value\":%g,\"count\":%zu}",
-                metric->key,
-                quantile->sample,
-                quantile->count);
+    case optics_sketch:
+    {
+        const struct optics_sketch *sketch = &metric->value.sketch;
+        const double quantiles[] = { 0.5, 0.9, 0.99 };
+        const double values[] = { sketch->p50, sketch->p90, sketch->p99 };
+        prom_summary(buffer, types, &name, quantiles, values, 3, sketch->count);
+        prom_max(buffer, types, &name, sketch->max);
         break;
     }
 
+    case optics_family:
     default:
         optics_fail("unknown lens type '%d'", metric->type);
         break;
     }
 }
 
+static int prom_entry_cmp(const void *a, const void *b)
+{
+    const struct prom_entry *lhs = a;
+    const struct prom_entry *rhs = b;
+
+    int cmp = strcmp(lhs->family, rhs->family);
+    if (cmp) return cmp;
+
+    const struct metric *l = lhs->metric;
+    const struct metric *r = rhs->metric;
+    size_t len = l->host_len < r->host_len ? l->host_len : r->host_len;
+
+    cmp = memcmp(l->key + l->host_pos, r->key + r->host_pos, len);
+    if (cmp) return cmp;
+    if (l->host_len != r->host_len) return l->host_len < r->host_len ? -1 : 1;
+
+    // Keys that sanitize to the same family are ordered by their key to keep the
+    // output deterministic.
+    return strncmp(l->key, r->key, optics_name_max_len);
+}
+
+// Sorts the metrics by family and then by host.
+static void prom_order_sort(struct prom_order *order, const struct metrics *metrics)
+{
+    arena_clear(&order->families);
+
+    if (metrics->len > order->cap) {
+        order->cap = metrics->len;
+        order->data = realloc(order->data, order->cap * sizeof(order->data[0]));
+        optics_assert_alloc(order->data);
+    }
+
+    struct prom_name name;
+    for (size_t i = 0; i < metrics->len; ++i) {
+        prom_name(&name, &metrics->data[i]);
+        order->data[i] = (struct prom_entry) {
+            .family = arena_strndup(&order->families, name.name, sizeof(name.name)),
+            .metric = &metrics->data[i],
+        };
+    }
+
+    qsort(order->data, metrics->len, sizeof(order->data[0]), prom_entry_cmp);
+}
+
+static struct blob *render_prometheus(struct rest *rest)
+{
+    struct buffer *buffer = &rest->render;
+    buffer->len = 0;
+
+    struct htable types = {0};
+    if (rest->build) {
+        struct prom_order *order = &rest->prom_order;
+        prom_order_sort(order, rest->build);
+
+        for (size_t i = 0; i < rest->build->len; ++i)
+            write_prometheus(buffer, &types, order->data[i].metric);
+    }
+    htable_reset(&types);
+
+    return blob_alloc(buffer);
+}
+
 
 // -----------------------------------------------------------------------------
 // callbacks
 // -----------------------------------------------------------------------------
 
+static bool rest_accepts_gzip(struct crest_req *req)
+{
+    const char *encoding = crest_req_get_header(req, "accept-encoding");
+    return encoding && strstr(encoding, "gzip");
+}
+
+static enum crest_result rest_send(
+        struct blob *blob, struct crest_req *req, struct crest_resp *resp)
+{
+    crest_resp_add_header(resp, "vary", "accept-encoding");
+
+    if (rest_accepts_gzip(req)) {
+        struct blob *gzip = blob_gzip(blob);
+        if (gzip) {
+            blob_release(blob);
+            blob = gzip;
+            crest_resp_add_header(resp, "content-encoding", "gzip");
+        }
+    }
+
+    crest_resp_add_header(resp, "etag", blob->etag);
+
+    // The header can contain a list of etags which all have the same length.
+    const char *match = crest_req_get_header(req, "if-none-match");
+    if (match && (!strcmp(match, "*") || strstr(match, blob->etag))) {
+        blob_release(blob);
+        return crest_not_modified;
+    }
+
+    crest_resp_write_ref(resp, blob->data, blob->len, blob_release_data);
+    return crest_ok;
+}
+
+// Only the slice of the snapshot matching the prefix is rendered so the cost
+// scales with the number of matching keys and not the size of the snapshot. The
+// body is streamed in chunks serialized straight from the snapshot which is
+// held until the response is done with it. Each metric is serialized into a
+// small pending buffer from which the chunks are filled.
+struct rest_stream
+{
+    struct metrics *metrics;
+    char prefix[optics_name_max_len];
+    size_t prefix_len;
+
+    size_t first;
+    size_t index;
+    bool opened;
+    bool closed;
+
+    struct buffer pending;
+    size_t pending_pos;
+};
+
+// Returns false once the whole body was serialized.
+static bool rest_stream_next(struct rest_stream *stream)
+{
+    struct buffer *buffer = &stream->pending;
+    buffer->len = 0;
+    stream->pending_pos = 0;
+
+    if (stream->closed) return false;
+
+    if (!stream->opened) {
+        stream->opened = true;
+        buffer_put(buffer, '{');
+        return true;
+    }
+
+    struct metrics *metrics = stream->metrics;
+    if (metrics && stream->index < metrics->len) {
+        const struct metric *metric = &metrics->data[stream->index];
+
+        if (!strncmp(metric->key, stream->prefix, stream->prefix_len)) {
+            if (stream->index != stream->first) buffer_put(buffer, ',');
+            write_counter(buffer, metric);
+            stream->index++;
+            return true;
+        }
+    }
+
+    stream->closed = true;
+    buffer_put(buffer, '}');
+    return true;
+}
+
+static size_t rest_stream_read(void *ctx, char *dst, size_t len)
+{
+    struct rest_stream *stream = ctx;
+    struct buffer *pending = &stream->pending;
+
+    size_t written = 0;
+    while (written < len) {
+        if (stream->pending_pos == pending->len && !rest_stream_next(stream)) break;
+
+        size_t n = pending->len - stream->pending_pos;
+        if (n > len - written) n = len - written;
+
+        memcpy(dst + written, pending->data + stream->pending_pos, n);
+        stream->pending_pos += n;
+        written += n;
+    }
+
+    return written;
+}
+
+static void rest_stream_free(void *ctx)
+{
+    struct rest_stream *stream = ctx;
+    metrics_release(stream->metrics);
+    buffer_reset(&stream->pending);
+    free(stream);
+}
+
+static enum crest_result rest_get_filtered(
+        struct rest *rest, const char *prefix, struct crest_resp *resp)
+{
+    struct rest_stream *stream = calloc(1, sizeof(*stream));
+    optics_assert_alloc(stream);
+
+    strlcpy(stream->prefix, prefix, sizeof(stream->prefix));
+    stream->prefix_len = strnlen(stream->prefix, sizeof(stream->prefix));
+
+    {
+        slock_lock(&rest->lock);
+        stream->metrics = metrics_acquire(rest->current);
+        slock_unlock(&rest->lock);
+    }
+
+    if (stream->metrics) {
+        stream->first = metrics_lower_bound(stream->metrics, stream->prefix);
+        stream->index = stream->first;
+    }
+
+    crest_resp_add_header(resp, "content-type", "text/plain");
+    crest_resp_write_stream(resp, rest_stream_read, stream, rest_stream_free);
+    return crest_ok;
+}
+
+static enum crest_result
+rest_get_prefix(void *ctx, struct crest_req *req, struct crest_resp *resp)
+{
+    return rest_get_filtered(ctx, crest_req_get_path_token(req, 2), resp);
+}
 
 static enum crest_result
 rest_get(void *ctx, struct crest_req *req, struct crest_resp *resp)
 {
-    (void) req;
     struct rest *rest = ctx;
 
-    struct buffer buffer = {0};
-    buffer_put(&buffer, '{');
+    const char *prefix = crest_req_get_query(req, "prefix");
+    if (prefix) return rest_get_filtered(rest, prefix, resp);
 
+    struct blob *blob;
     {
         slock_lock(&rest->lock);
+        blob = blob_acquire(rest->json);
+        slock_unlock(&rest->lock);
+    }
 
-        if (rest->current) {
-            for (size_t i = 0; i < rest->current->len; ++i) {
-                if (i > 0) buffer_put(&buffer, ',');
-                write_counter(&buffer, &rest->current->data[i]);
-            }
-        }
+    crest_resp_add_header(resp, "content-type", "text/plain");
+
+    if (!blob) {
+        crest_resp_write(resp, "{}", 2);
+        return crest_ok;
+    }
+
+    return rest_send(blob, req, resp);
+}
+
+static bool rest_history_exists(void *ctx, struct crest_req *req)
+{
+    struct rest *rest = ctx;
+
+    const char *key = crest_req_get_query(req, "key");
+    return key && history_exists(&rest->history, key);
+}
+
+// A missing or invalid n selects every poll kept in the history.
+static enum crest_result
+rest_get_history(void *ctx, struct crest_req *req, struct crest_resp *resp)
+{
+    struct rest *rest = ctx;
+
+    const char *key = crest_req_get_query(req, "key");
+    if (!key) return crest_err;
+
+    size_t n = rest->history.cap;
+    const char *n_str = crest_req_get_query(req, "n");
+    if (n_str) {
+        char *end = NULL;
+        unsigned long value = strtoul(n_str, &end, 10);
+        if (end != n_str && !*end) n = value;
+    }
+
+    crest_resp_add_header(resp, "content-type", "text/plain");
+
+    struct buffer buffer = {0};
+    history_write(&rest->history, &buffer, key, n);
+
+    crest_resp_write_ref(resp, buffer.data, buffer.len, free);
+    return crest_ok;
+}
+
+static enum crest_result
+rest_get_prometheus(void *ctx, struct crest_req *req, struct crest_resp *resp)
+{
+    struct rest *rest = ctx;
 
+    struct blob *blob;
+    {
+        slock_lock(&rest->lock);
+        blob = blob_acquire(rest->prometheus);
         slock_unlock(&rest->lock);
     }
 
-    buffer_put(&buffer, '}');
+    crest_resp_add_header(resp, "content-type", "text/plain; version=0.0.4");
+
+    if (!blob) return crest_ok;
+    return rest_send(blob, req, resp);
+}
+
+// Drains the log rings which makes it possible to leave the ring log on in a
+// loaded process and only pay for the formatting when looking at it.
+static enum crest_result
+rest_get_log(void *ctx, struct crest_req *req, struct crest_resp *resp)
+{
+    (void) ctx, (void) req;
 
     crest_resp_add_header(resp, "content-type", "text/plain");
-    crest_resp_write(resp, buffer.data, buffer.len);
 
-    buffer_reset(&buffer);
+    struct buffer buffer = {0};
+    optics_log_write(&buffer);
+
+    crest_resp_write_ref(resp, buffer.data, buffer.len, free);
     return crest_ok;
 }
 
@@ -217,9 +1631,23 @@ static void rest_dump(
     struct rest *rest = ctx;
 
     switch (type) {
-    case optics_poll_begin: metrics_free(rest->build); rest->build = NULL; break;
-    case optics_poll_done: swap_tables(rest); break;
-    case optics_poll_metric: rest->build = metrics_append(rest->build, poll); break;
+    case optics_poll_begin:
+        metrics_release(rest->build);
+        rest->build = metrics_alloc(&rest->spare);
+        if (rest->history.cap) history_begin(&rest->history);
+        break;
+
+    case optics_poll_done:
+        swap_tables(rest);
+        if (rest->history.cap) history_publish(&rest->history);
+        break;
+
+    case optics_poll_metric:
+        if (!rest->build) rest->build = metrics_alloc(&rest->spare);
+        metrics_append(rest->build, poll);
+        if (rest->history.cap) history_record(&rest->history, poll);
+        break;
+
     default:
         optics_warn("unknown poll type '%d'", type);
         break;
@@ -235,8 +1663,15 @@ static void rest_free(void *ctx)
         optics_abort();
     }
 
-    metrics_free(rest->current);
+    metrics_release(rest->current);
     metrics_free(rest->build);
+    metrics_free(atomic_load(&rest->spare));
+    blob_release(rest->json);
+    blob_release(rest->prometheus);
+    buffer_reset(&rest->render);
+    arena_reset(&rest->prom_order.families);
+    free(rest->prom_order.data);
+    history_reset(&rest->history);
     free(rest);
 }
 
@@ -246,9 +1681,27 @@ static void rest_free(void *ctx)
 // -----------------------------------------------------------------------------
 
 void optics_dump_rest(struct optics_poller *poller, struct crest *crest)
+{
+    optics_dump_rest_history(poller, crest, history_default_len);
+}
+
+void optics_dump_rest_history(
+        struct optics_poller *poller, struct crest *crest, size_t history_len)
 {
     struct rest *rest = calloc(1, sizeof(*rest));
     optics_assert_alloc(rest);
+    rest->poller = poller;
+
+    if (history_len) {
+        history_init(&rest->history, history_len);
+
+        crest_add(crest, (struct crest_res) {
+                    .path = "/metrics/history",
+                    .context = rest,
+                    .exists = rest_history_exists,
+                    .get = rest_get_history
+                });
+    }
 
     crest_add(crest, (struct crest_res) {
                 .path = "/metrics/json",
@@ -256,5 +1709,24 @@ void optics_dump_rest(struct optics_poller *poller, struct crest *crest)
                 .get = rest_get
             });
 
+    crest_add(crest, (struct crest_res) {
+                .path = "/metrics/json/:prefix",
+                .context = rest,
+                .get = rest_get_prefix
+            });
+
+    crest_add(crest, (struct crest_res) {
+                .path = "/metrics",
+                .context = rest,
+                .get = rest_get_prometheus
+            });
+
+    if (OPTICS_LOG_RING) {
+        crest_add(crest, (struct crest_res) {
+                    .path = "/debug/log",
+                    .get = rest_get_log
+                });
+    }
+
     optics_poller_backend(poller, rest, &rest_dump, &rest_free);
 }
@@ -0,0 +1,362 @@
+/* backend_statsd.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "optics.h"
+#include "utils/errors.h"
+#include "utils/socket.h"
+#include "utils/buffer.h"
+#include "utils/uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    // Recommended datagram sizes for a DogStatsD agent which keep UDP packets
+    // under the usual ethernet MTU.
+    statsd_mtu_udp = 1432,
+    statsd_mtu_unix = 8192,
+
+    statsd_mtu_min = 512,
+    statsd_mtu_max = 64 * 1024 - 1,
+
+    // Largest number of datagrams handed to a single sendmmsg call.
+    statsd_batch_len = 64,
+
+    // Datagrams queued on the ring before having to wait on the kernel.
+    statsd_ring_len = 256,
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The lines of a poll are packed into datagrams as they're formatted and all
+// the datagrams are sent when the poll is done. The socket is non-blocking so
+// datagrams that don't fit in the socket buffer are dropped instead of stalling
+// the poll thread.
+//
+// When io_uring is available, the datagrams are queued on the ring and
+// submitted together. Their completions are only reaped at the start of the
+// next poll, before the buffer is reused, which is also when the drops of the
+// previous poll are reported.
+
+struct statsd_packet
+{
+    size_t start;
+    size_t len;
+};
+
+struct statsd
+{
+    int fd;
+    size_t mtu;
+
+    const struct optics_poll *poll;
+
+    struct buffer buffer;
+    size_t packet_start;
+
+    size_t packets_len;
+    size_t packets_cap;
+    struct statsd_packet *packets;
+
+    bool ring_enabled;
+    struct uring ring;
+    size_t ring_dropped;
+    int ring_errno;
+};
+
+
+// -----------------------------------------------------------------------------
+// packets
+// -----------------------------------------------------------------------------
+
+static void statsd_packet_push(struct statsd *statsd, size_t end)
+{
+    if (end <= statsd->packet_start) return;
+
+    if (statsd->packets_len == statsd->packets_cap) {
+        statsd->packets_cap = statsd->packets_cap ? statsd->packets_cap * 2 : 16;
+        statsd->packets = realloc(statsd->packets,
+                statsd->packets_cap * sizeof(statsd->packets[0]));
+        optics_assert_alloc(statsd->packets);
+    }
+
+    statsd->packets[statsd->packets_len++] = (struct statsd_packet) {
+        .start = statsd->packet_start,
+        .len = end - statsd->packet_start,
+    };
+}
+
+// Lines are separated by newlines within a datagram. A line that would make the
+// datagram overflow the mtu closes it and starts the next one. A single line
+// larger than the mtu is sent on its own.
+static void statsd_line(struct statsd *statsd, size_t sep, size_t start)
+{
+    if (statsd->buffer.len - statsd->packet_start <= statsd->mtu) return;
+    if (start == statsd->packet_start) return;
+
+    statsd_packet_push(statsd, sep);
+    statsd->packet_start = start;
+}
+
+static int statsd_send_batch(
+        struct statsd *statsd, const struct statsd_packet *packets, size_t len)
+{
+    struct iovec iovecs[statsd_batch_len];
+    struct mmsghdr msgs[statsd_batch_len];
+    memset(msgs, 0, len * sizeof(msgs[0]));
+
+    for (size_t i = 0; i < len; ++i) {
+        iovecs[i] = (struct iovec) {
+            .iov_base = statsd->buffer.data + packets[i].start,
+            .iov_len = packets[i].len,
+        };
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return sendmmsg(statsd->fd, msgs, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// A refused datagram only reports the error of an earlier datagram (ICMP port
+// unreachable) so it's skipped and the rest of the poll is still sent. Any
+// other error, including a full socket buffer, drops the rest of the poll.
+static void statsd_send(struct statsd *statsd)
+{
+    size_t dropped = 0;
+
+    size_t i = 0;
+    while (i < statsd->packets_len) {
+        size_t len = statsd->packets_len - i;
+        if (len > statsd_batch_len) len = statsd_batch_len;
+
+        int ret = statsd_send_batch(statsd, statsd->packets + i, len);
+        if (ret > 0) { i += ret; continue; }
+
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && errno == ECONNREFUSED) { i++; dropped++; continue; }
+
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            optics_warn_errno("unable to send statsd packets");
+
+        dropped += statsd->packets_len - i;
+        break;
+    }
+
+    if (dropped) {
+        optics_warn("dropped %lu of %lu statsd packets",
+                dropped, statsd->packets_len);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// ring
+// -----------------------------------------------------------------------------
+
+// Follows the same error handling as statsd_send except that every datagram is
+// attempted so a full socket buffer only drops the datagrams that didn't fit.
+static void statsd_ring_complete(void *ctx, uint64_t user, int32_t res)
+{
+    (void) user;
+    struct statsd *statsd = ctx;
+    if (res >= 0) return;
+
+    statsd->ring_dropped++;
+    if (res != -ECONNREFUSED && res != -EAGAIN && res != -EWOULDBLOCK)
+        statsd->ring_errno = -res;
+}
+
+static void statsd_ring_reap(struct statsd *statsd)
+{
+    (void) uring_reap(&statsd->ring, true, statsd_ring_complete, statsd);
+
+    if (statsd->ring_errno) {
+        errno = statsd->ring_errno;
+        optics_warn_errno("unable to send statsd packets");
+    }
+
+    if (statsd->ring_dropped) {
+        optics_warn("dropped %lu of %lu statsd packets",
+                statsd->ring_dropped, statsd->packets_len);
+    }
+
+    statsd->ring_dropped = 0;
+    statsd->ring_errno = 0;
+}
+
+// A ring that fails to submit is unlikely to recover so it's abandoned in
+// favour of sendmmsg for the following polls.
+static void statsd_ring_disable(struct statsd *statsd, size_t dropped)
+{
+    optics_warn_errno("unable to submit statsd packets");
+    optics_warn("dropped %lu of %lu statsd packets", dropped, statsd->packets_len);
+
+    uring_close(&statsd->ring);
+    statsd->ring_enabled = false;
+}
+
+static void statsd_ring_send(struct statsd *statsd)
+{
+    struct uring *ring = &statsd->ring;
+
+    size_t i = 0;
+    while (i < statsd->packets_len) {
+        const struct statsd_packet *packet = &statsd->packets[i];
+        const void *data = statsd->buffer.data + packet->start;
+
+        if (uring_send(ring, statsd->fd, data, packet->len, i, false)) { i++; continue; }
+
+        size_t queued = ring->queued;
+        if (!uring_submit(ring)) {
+            statsd_ring_disable(statsd, statsd->packets_len - i + queued);
+            return;
+        }
+
+        (void) uring_reap(ring, true, statsd_ring_complete, statsd);
+    }
+
+    size_t queued = ring->queued;
+    if (!uring_submit(ring)) statsd_ring_disable(statsd, queued);
+}
+
+
+// -----------------------------------------------------------------------------
+// callbacks
+// -----------------------------------------------------------------------------
+
+// The cached keys are used whenever available so only the prefix, the value
+// and the tag are formatted here.
+static bool statsd_dump_normalized(
+        void *ctx, optics_ts_t ts, const char *key, double value)
+{
+    (void) ts;
+    struct statsd *statsd = ctx;
+    struct buffer *buffer = &statsd->buffer;
+    const struct optics_poll *poll = statsd->poll;
+
+    size_t sep = buffer->len;
+    if (sep > statsd->packet_start) buffer_put(buffer, '\n');
+    size_t start = buffer->len;
+
+    if (poll->prefix && poll->prefix[0]) {
+        buffer_write(buffer, poll->prefix, strlen(poll->prefix));
+        buffer_put(buffer, '.');
+    }
+    buffer_write(buffer, key, strlen(key));
+    buffer_put(buffer, ':');
+    buffer_put_double(buffer, value);
+    buffer_puts(buffer, "|g|#host:");
+    buffer_puts(buffer, poll->host);
+
+    statsd_line(statsd, sep, start);
+    return true;
+}
+
+static void statsd_dump(
+        void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct statsd *statsd = ctx;
+
+    switch (type) {
+
+    case optics_poll_begin:
+        if (statsd->ring_enabled) statsd_ring_reap(statsd);
+        statsd->buffer.len = 0;
+        statsd->packet_start = 0;
+        statsd->packets_len = 0;
+        break;
+
+    case optics_poll_metric:
+        statsd->poll = poll;
+        (void) optics_poll_normalize(poll, statsd_dump_normalized, statsd);
+        statsd->poll = NULL;
+        break;
+
+    case optics_poll_done:
+        statsd_packet_push(statsd, statsd->buffer.len);
+        if (statsd->ring_enabled) statsd_ring_send(statsd);
+        else statsd_send(statsd);
+        break;
+
+    default:
+        optics_fail("unknown poll type '%d'", type);
+        break;
+    }
+}
+
+static void statsd_free(void *ctx)
+{
+    struct statsd *statsd = ctx;
+
+    if (statsd->ring_enabled) {
+        statsd_ring_reap(statsd);
+        uring_close(&statsd->ring);
+    }
+
+    close(statsd->fd);
+    buffer_reset(&statsd->buffer);
+    free(statsd->packets);
+    free(statsd);
+}
+
+
+// -----------------------------------------------------------------------------
+// register
+// -----------------------------------------------------------------------------
+
+static bool statsd_register(struct optics_poller *poller, int fd, size_t mtu)
+{
+    if (mtu < statsd_mtu_min || mtu > statsd_mtu_max) {
+        optics_fail("invalid statsd mtu '%lu' not within [%d, %d]",
+                mtu, statsd_mtu_min, statsd_mtu_max);
+        close(fd);
+        return false;
+    }
+
+    struct statsd *statsd = calloc(1, sizeof(*statsd));
+    optics_assert_alloc(statsd);
+    statsd->fd = fd;
+    statsd->mtu = mtu;
+    statsd->ring_enabled = uring_init(&statsd->ring, statsd_ring_len);
+
+    if (!optics_poller_backend(poller, statsd, &statsd_dump, &statsd_free)) {
+        statsd_free(statsd);
+        return false;
+    }
+
+    return true;
+}
+
+bool optics_dump_statsd(
+        struct optics_poller *poller, const char *host, const char *port, size_t mtu)
+{
+    int fd = socket_dgram_connect(host, port);
+    if (fd < 0) return false;
+
+    return statsd_register(poller, fd, mtu ? mtu : statsd_mtu_udp);
+}
+
+bool optics_dump_statsd_unix(
+        struct optics_poller *poller, const char *path, size_t mtu)
+{
+    int fd = socket_dgram_connect_unix(path);
+    if (fd < 0) return false;
+
+    return statsd_register(poller, fd, mtu ? mtu : statsd_mtu_unix);
+}
@@ -4,6 +4,7 @@
 */
 
 #include "optics.h"
+#include "utils/fmt.h"
 
 #include <stdio.h>
 
@@ -17,8 +18,11 @@ static bool stdout_dump_normalized(
 {
     const struct optics_poll *poll = ctx;
 
-    printf("[%lu] %s.%s{host='%s'} = %g\n",
-            ts, poll->prefix, key, poll->host, value);
+    char str[fmt_double_len];
+    size_t len = fmt_double(str, value);
+
+    printf("[%lu] %s.%s{host='%s'} = %.*s\n",
+            ts, poll->prefix, key, poll->host, (int) len, str);
 
     return true;
 }
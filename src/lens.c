@@ -22,10 +22,25 @@ struct optics_lens
     // (not that x86 cares all that much... I blame my OCD).
     enum optics_lens_type type;
 
+    // Only one in sample_rate calls is recorded by lenses that support
+    // sampling. The rate is adjusted on every read when a target is set.
+    _Atomic uint32_t sample_rate;
+    uint32_t sample_target;
+
+    // Index of the lens in the optics lens table.
+    uint32_t slot;
+
+    // Number of idle polls after which the poller closes the lens. 0 disables
+    // the expiry.
+    _Atomic uint32_t ttl;
+
+    // Shared lens standing in for the lenses rejected by the lens caps.
+    bool overflow;
+
     // Allign to a cache line to avoid alignment issues in the lens itself.
     // This can have a big impact as some lenses would otherwise do atomic
     // operations across cache lines which is atrociously slow.
-    uint8_t padding[cache_line_len - 44];
+    uint8_t padding[cache_line_len - 61];
 };
 
 static_assert(sizeof(struct optics_lens) % 64 == 0,
@@ -42,6 +57,36 @@ static char * lens_name_ptr(struct optics_lens *lens)
     return (char *) (((uint8_t *) lens) + off);
 }
 
+static size_t lens_alloc_len(struct optics_lens *lens)
+{
+    return sizeof(struct optics_lens) + lens->name_len + lens->lens_len;
+}
+
+static const char *lens_type_name(enum optics_lens_type type)
+{
+    switch (type) {
+    case optics_counter: return "counter";
+    case optics_gauge: return "gauge";
+    case optics_dist: return "dist";
+    case optics_histo: return "histo";
+    case optics_quantile: return "quantile";
+    case optics_hdr: return "hdr";
+    case optics_sketch: return "sketch";
+    case optics_quantiles: return "quantiles";
+    case optics_family: return "family";
+    case optics_meter: return "meter";
+    case optics_topk: return "topk";
+    case optics_hll: return "hll";
+    case optics_updown: return "updown";
+    case optics_histo2d: return "histo2d";
+    default: return "unknown";
+    }
+}
+
+// Lenses rejected by the lens caps are allocated under the name of the overflow
+// lens of their type such that opening them returns the shared overflow lens
+// through the regular lookup. The configuration of the overflow lens is the one
+// of the first lens it stood in for.
 static struct optics_lens *
 lens_alloc(
         struct optics *optics,
@@ -52,11 +97,27 @@ lens_alloc(
     size_t name_len = strnlen(name, optics_name_max_len) + 1;
     if (name_len == optics_name_max_len) return NULL;
 
-    struct optics_lens *lens = calloc(1, sizeof(struct optics_lens) + name_len + lens_len);
+    char overflow_name[optics_name_max_len];
+    bool overflow = optics_lens_capped(optics, name);
+    if (overflow) {
+        name_len = snprintf(overflow_name, sizeof(overflow_name),
+                "overflow.%s", lens_type_name(type)) + 1;
+        name = overflow_name;
+    }
+
+    // Closed lenses are reclaimed lazily which lets services that churn
+    // through lenses reuse the memory right away.
+    optics_reclaim(optics);
+
+    // The slab guarantees a cache-line aligned and zeroed allocation which the
+    // lenses rely on to avoid atomic operations crossing cache lines.
+    struct optics_lens *lens =
+        optics_alloc(optics, sizeof(struct optics_lens) + name_len + lens_len);
     if (!lens) return NULL;
 
     lens->optics = optics;
     lens->type = type;
+    lens->overflow = overflow;
     lens->lens_len = lens_len;
     lens->name_len = name_len;
     memcpy(lens_name_ptr(lens), name, name_len - 1);
@@ -66,12 +127,13 @@ lens_alloc(
 
 static void lens_free(struct optics_lens *lens)
 {
-    free(lens);
+    optics_free(lens->optics, lens, lens_alloc_len(lens));
 }
 
 static bool lens_defer_free(struct optics *optics, struct optics_lens *lens)
 {
-    return optics_defer_free(optics, lens);
+    optics_defer_lens(optics, lens);
+    return true;
 }
 
 static void * lens_sub_ptr(struct optics_lens *lens, enum optics_lens_type type)
@@ -84,9 +146,285 @@ static void * lens_sub_ptr(struct optics_lens *lens, enum optics_lens_type type)
     return ((uint8_t *) lens) + sizeof(struct optics_lens);
 }
 
+// Polls built outside of the poller may only have the elapsed seconds.
 static double lens_rescale(const struct optics_poll *poll, double value)
 {
-    return value / poll->elapsed;
+    if (optics_unlikely(!poll->elapsed_secs)) return value / poll->elapsed;
+    return value / poll->elapsed_secs;
+}
+
+// splitmix64 finalizer which is a bijection that spreads every bit of its input
+// across the whole output. Used to hash numeric keys such that distinct keys
+// never collide.
+static uint64_t lens_hash_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+
+// -----------------------------------------------------------------------------
+// shards
+// -----------------------------------------------------------------------------
+// Sharded lenses keep one shard per cpu. On numa machines the shards are grouped
+// by node and the group of each node starts on its own page which is bound to
+// the memory of that node such that recorders only ever write to memory that is
+// local to their node. Only the reads of the poller cross nodes.
+//
+// The layout is stored in the lens such that every process sharing the region
+// agrees on it. Region chunks are mapped on page boundaries so the page offset
+// of the shards is the same in every process.
+
+struct lens_shards
+{
+    // Total number of shards which is 0 for a regular lens. Shards of cpus that
+    // don't exist are never written and read as empty.
+    size_t len;
+    size_t node_len;
+
+    // Offset in bytes of the first shard and between the first shards of two
+    // consecutive nodes. The stride is 0 when the shards are packed by cpu.
+    size_t off;
+    size_t stride;
+};
+
+// Bytes to reserve after the lens header for the shards.
+static size_t lens_shards_alloc_len(size_t shard_len)
+{
+    size_t nodes = numa_nodes();
+    if (nodes < 2) return cpus() * shard_len;
+
+    size_t page = numa_page_len();
+    return page + nodes * align(numa_node_cpus() * shard_len, page);
+}
+
+static void lens_shards_init(struct lens_shards *shards, void *data, size_t shard_len)
+{
+    size_t nodes = numa_nodes();
+    if (nodes < 2) {
+        *shards = (struct lens_shards) { .len = cpus(), .node_len = cpus() };
+        return;
+    }
+
+    size_t page = numa_page_len();
+    uintptr_t addr = (uintptr_t) data;
+
+    *shards = (struct lens_shards) {
+        .len = nodes * numa_node_cpus(),
+        .node_len = numa_node_cpus(),
+        .off = align(addr, page) - addr,
+        .stride = align(numa_node_cpus() * shard_len, page),
+    };
+
+    // Failing to bind only costs us remote writes; not correctness.
+    for (size_t node = 0; node < nodes; ++node) {
+        uint8_t *group = (uint8_t *) data + shards->off + node * shards->stride;
+        (void) numa_bind(group, shards->stride, node);
+    }
+}
+
+// Offset in bytes of the shard from the start of the shards.
+static size_t lens_shards_off(const struct lens_shards *shards, size_t shard, size_t shard_len)
+{
+    if (!shards->stride) return shard * shard_len;
+
+    size_t node = shard / shards->node_len;
+    size_t index = shard % shards->node_len;
+    return shards->off + node * shards->stride + index * shard_len;
+}
+
+// Shard of the cpu we're running on. sched_getcpu is backed by the vdso (or
+// rseq on recent glibc) so it's cheap enough to call on every record. Getting
+// it wrong because we were migrated in-between only costs us a contended
+// write; not correctness.
+static size_t lens_shards_local(const struct lens_shards *shards)
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0) return tid() % shards->len;
+
+    size_t node, index;
+    if (shards->stride && numa_cpu(cpu, &node, &index))
+        return (node * shards->node_len + index) % shards->len;
+
+    return (size_t) cpu % shards->len;
+}
+
+
+// -----------------------------------------------------------------------------
+// sample
+// -----------------------------------------------------------------------------
+// Each thread keeps a countdown per lens in a small direct-mapped cache which
+// avoids an rng draw on every call. A lens that evicts another starts from a
+// random point of its countdown so that threads don't all sample in lockstep.
+
+enum { lens_sample_slots = 16 };
+
+struct lens_sample_slot
+{
+    const struct optics_lens *lens;
+    uint32_t countdown;
+};
+
+static __thread struct lens_sample_slot lens_sample_cache[lens_sample_slots];
+
+static bool lens_sample(const struct optics_lens *lens)
+{
+    uint32_t rate = atomic_load_explicit(&lens->sample_rate, memory_order_relaxed);
+    if (optics_likely(rate <= 1)) return true;
+
+    size_t index = ((uintptr_t) lens / cache_line_len) % lens_sample_slots;
+    struct lens_sample_slot *slot = &lens_sample_cache[index];
+
+    if (slot->lens != lens) {
+        slot->lens = lens;
+        slot->countdown = rng_gen_range(rng_global(), 0, rate) + 1;
+    }
+
+    if (--slot->countdown) return false;
+
+    slot->countdown = rate;
+    return true;
+}
+
+// Aims for sample_target recorded values per epoch given the number of calls
+// seen in the last epoch.
+static void lens_sample_adapt(struct optics_lens *lens, size_t count)
+{
+    if (!lens->sample_target) return;
+
+    size_t rate = count / lens->sample_target;
+    if (rate < 1) rate = 1;
+    if (rate > UINT32_MAX) rate = UINT32_MAX;
+
+    atomic_store_explicit(&lens->sample_rate, rate, memory_order_relaxed);
+}
+
+static bool lens_sample_supported(const struct optics_lens *lens)
+{
+    switch (lens->type) {
+    case optics_dist:
+    case optics_quantile:
+    case optics_quantiles:
+        return true;
+
+    case optics_counter:
+    case optics_gauge:
+    case optics_histo:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default:
+        optics_fail("sampling is not supported by lens '%s' of type '%d'",
+                lens_name_ptr((struct optics_lens *) lens), lens->type);
+        return false;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// normalize
+// -----------------------------------------------------------------------------
+// Normalizers emit each value at a fixed slot which indexes the keys cached for
+// the lens. Keys are only formatted when missing from the cache and, when
+// capturing, the formatted keys are saved to fill the cache.
+
+enum { lens_normalize_uncached = optics_poll_keys_max };
+
+struct lens_normalize
+{
+    const struct optics_poll *poll;
+    bool qualified;
+
+    optics_normalize_qualified_cb_t cb;
+    void *ctx;
+
+    size_t base;
+    struct optics_key key;
+
+    // Only set when building the keys cached for a lens.
+    struct optics_key *capture;
+};
+
+static void lens_normalize_base(struct lens_normalize *norm)
+{
+    const struct optics_poll *poll = norm->poll;
+
+    if (norm->qualified) {
+        if (poll->prefix) optics_key_push(&norm->key, poll->prefix);
+        if (poll->host) optics_key_push(&norm->key, poll->host);
+    }
+    optics_key_push(&norm->key, poll->key);
+
+    norm->base = norm->key.len;
+}
+
+static bool lens_normalize_cached(struct lens_normalize *norm, size_t slot)
+{
+    const struct optics_poll_keys *keys = norm->poll->keys;
+    return keys && slot < optics_poll_keys_max && slot < keys->len && keys->data[slot];
+}
+
+static bool lens_normalize_emit(
+        struct lens_normalize *norm, size_t slot, const char *suffix, double value)
+{
+    const struct optics_poll *poll = norm->poll;
+
+    if (lens_normalize_cached(norm, slot)) {
+        size_t skip = norm->qualified ? 0 : poll->keys->rel;
+        const char *key = poll->keys->data[slot] + skip;
+        return norm->cb(norm->ctx, poll->ts, key, poll->keys->lens[slot] - skip, value);
+    }
+
+    if (!norm->base) lens_normalize_base(norm);
+
+    size_t old = norm->key.len;
+    if (suffix) optics_key_push(&norm->key, suffix);
+
+    if (norm->capture && slot < optics_poll_keys_max)
+        norm->capture[slot] = norm->key;
+
+    bool ret = norm->cb(norm->ctx, poll->ts, norm->key.data, norm->key.len, value);
+    optics_key_pop(&norm->key, old);
+    return ret;
+}
+
+optics_printf(4, 5)
+static bool lens_normalize_emitf(
+        struct lens_normalize *norm, size_t slot, double value, const char *fmt, ...)
+{
+    if (lens_normalize_cached(norm, slot))
+        return lens_normalize_emit(norm, slot, NULL, value);
+
+    va_list args;
+    va_start(args, fmt);
+
+    char suffix[optics_name_max_len];
+    (void) vsnprintf(suffix, sizeof(suffix), fmt, args);
+
+    va_end(args);
+
+    return lens_normalize_emit(norm, slot, suffix, value);
+}
+
+// Sparse buckets are never cached and can number in the thousands per lens so
+// their suffix is formatted directly instead of going through vsnprintf.
+static bool lens_normalize_emit_bucket(
+        struct lens_normalize *norm, double value, int64_t index)
+{
+    static const char prefix[] = "bucket_";
+    char suffix[sizeof(prefix) + fmt_i64_len];
+
+    memcpy(suffix, prefix, sizeof(prefix) - 1);
+    size_t len = sizeof(prefix) - 1 + fmt_i64(suffix + sizeof(prefix) - 1, index);
+    suffix[len] = '\0';
+
+    return lens_normalize_emit(norm, lens_normalize_uncached, suffix, value);
 }
 
 
@@ -153,4 +491,13 @@ static void lens_kill(struct optics_lens *lens)
 #include "lens_gauge.c"
 #include "lens_dist.c"
 #include "lens_histo.c"
+#include "lens_histo2d.c"
 #include "lens_quantile.c"
+#include "lens_quantiles.c"
+#include "lens_hdr.c"
+#include "lens_sketch.c"
+#include "lens_meter.c"
+#include "lens_topk.c"
+#include "lens_hll.c"
+#include "lens_updown.c"
+#include "lens_family.c"
@@ -8,11 +8,35 @@
 // struct
 // -----------------------------------------------------------------------------
 
+// Each shard lives on its own cache line so that threads running on different
+// cpus never bounce the same line when recording.
+struct lens_counter_shard
+{
+    atomic_int_fast64_t value[2];
+    uint8_t padding[cache_line_len - 2 * sizeof(atomic_int_fast64_t)];
+};
+
+static_assert(sizeof(struct lens_counter_shard) == cache_line_len,
+        "counter shards should be exactly one cache line");
+
 struct lens_counter
 {
     atomic_int_fast64_t value[2];
+
+    // Layout of the shards that follow the header.
+    struct lens_shards layout;
+
+    // Running sum of every value reset by the reads which is only written by
+    // the poller.
+    atomic_int_fast64_t total;
+
+    uint8_t padding[cache_line_len - 3 * sizeof(atomic_int_fast64_t) - sizeof(struct lens_shards)];
+    struct lens_counter_shard shards[];
 };
 
+static_assert(sizeof(struct lens_counter) == cache_line_len,
+        "counter header should be exactly one cache line");
+
 
 // -----------------------------------------------------------------------------
 // impl
@@ -24,13 +48,102 @@ lens_counter_alloc(struct optics *optics, const char *name)
     return lens_alloc(optics, optics_counter, sizeof(struct lens_counter), name);
 }
 
+static struct optics_lens *
+lens_counter_sharded_alloc(struct optics *optics, const char *name)
+{
+    size_t len = sizeof(struct lens_counter)
+        + lens_shards_alloc_len(sizeof(struct lens_counter_shard));
+    struct optics_lens *lens = lens_alloc(optics, optics_counter, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
+    if (!counter) goto fail_sub;
+
+    lens_shards_init(&counter->layout, counter->shards, sizeof(struct lens_counter_shard));
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+    return NULL;
+}
+
+static atomic_int_fast64_t *
+lens_counter_shard(struct lens_counter *counter, size_t shard, optics_epoch_t epoch)
+{
+    size_t off = lens_shards_off(&counter->layout, shard, sizeof(struct lens_counter_shard));
+    struct lens_counter_shard *ptr = (void *) ((uint8_t *) counter->shards + off);
+    return &ptr->value[epoch];
+}
+
+static void
+lens_counter_sub_inc(struct lens_counter *counter, optics_epoch_t epoch, int64_t value)
+{
+    atomic_int_fast64_t *slot = &counter->value[epoch];
+    if (counter->layout.len)
+        slot = lens_counter_shard(counter, lens_shards_local(&counter->layout), epoch);
+
+    atomic_fetch_add_explicit(slot, value, memory_order_relaxed);
+}
+
+static int64_t
+lens_counter_sub_read(struct lens_counter *counter, optics_epoch_t epoch)
+{
+    int64_t value = atomic_exchange_explicit(&counter->value[epoch], 0, memory_order_relaxed);
+
+    for (size_t i = 0; i < counter->layout.len; ++i) {
+        atomic_int_fast64_t *shard = lens_counter_shard(counter, i, epoch);
+        value += atomic_exchange_explicit(shard, 0, memory_order_relaxed);
+    }
+
+    // Published after the exchanges which synchronizes with
+    // lens_counter_sub_peek such that a value is never seen in both the total
+    // and its slot.
+    if (value) atomic_fetch_add_explicit(&counter->total, value, memory_order_release);
+    return value;
+}
+
+// Loading the total first means that a racing read can only hide the values it
+// is moving from the slots to the total until the next peek.
+static int64_t
+lens_counter_sub_peek(struct lens_counter *counter)
+{
+    int64_t value = atomic_load_explicit(&counter->total, memory_order_acquire);
+
+    for (size_t epoch = 0; epoch < 2; ++epoch) {
+        value += atomic_load_explicit(&counter->value[epoch], memory_order_relaxed);
+
+        for (size_t i = 0; i < counter->layout.len; ++i) {
+            atomic_int_fast64_t *shard = lens_counter_shard(counter, i, epoch);
+            value += atomic_load_explicit(shard, memory_order_relaxed);
+        }
+    }
+
+    return value;
+}
+
 static bool
 lens_counter_inc(struct optics_lens *lens, optics_epoch_t epoch, int64_t value)
 {
     struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
     if (!counter) return false;
 
-    atomic_fetch_add_explicit(&counter->value[epoch], value, memory_order_relaxed);
+    lens_counter_sub_inc(counter, epoch, value);
+    return true;
+}
+
+// Values are summed locally such that the batch costs a single atomic.
+static bool
+lens_counter_inc_n(
+        struct optics_lens *lens, optics_epoch_t epoch, const int64_t *values, size_t n)
+{
+    struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
+    if (!counter) return false;
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += values[i];
+
+    if (sum) lens_counter_sub_inc(counter, epoch, sum);
     return true;
 }
 
@@ -40,13 +153,26 @@ lens_counter_read(struct optics_lens *lens, optics_epoch_t epoch, int64_t *value
     struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
     if (!counter) return optics_err;
 
-    *value = atomic_exchange_explicit(&counter->value[epoch], 0, memory_order_relaxed);
+    *value = lens_counter_sub_read(counter, epoch);
+    return optics_ok;
+}
+
+static enum optics_ret
+lens_counter_peek(struct optics_lens *lens, int64_t *value)
+{
+    struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
+    if (!counter) return optics_err;
+
+    *value = lens_counter_sub_peek(counter);
     return optics_ok;
 }
 
 static bool
-lens_counter_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+lens_counter_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
 {
-    return cb(ctx, poll->ts, poll->key, lens_rescale(poll, poll->value.counter));
+    if (!lens_normalize_emit(norm, 0, NULL, lens_rescale(poll, poll->value.counter)))
+        return false;
+
+    if (!poll->total.tracked) return true;
+    return lens_normalize_emit(norm, 1, "total", poll->total.value);
 }
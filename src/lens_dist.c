@@ -6,6 +6,12 @@
 // -----------------------------------------------------------------------------
 // struct
 // -----------------------------------------------------------------------------
+// The reservoir size is picked when the lens is created so the epochs and the
+// shards are laid out one after the other in the variable sized data of the
+// lens. The snapshot is where reads copy the reservoir and select the
+// percentiles which is what the samples of struct optics_dist point to.
+//
+//   [epoch 0][epoch 1][snapshot][shard 0: epoch 0, epoch 1][shard 1]...
 
 struct lens_dist_epoch
 {
@@ -13,24 +19,271 @@ struct lens_dist_epoch
 
     size_t n;
     double max;
-    double samples[optics_dist_samples];
+
+    // Calls that weren't sampled which only count towards n.
+    atomic_size_t skipped;
+
+    double samples[];
+};
+
+// Lock-free variant of the reservoir used by sharded dists. Slots are claimed
+// through an atomic increment of n and samples are stored as the bits of a
+// double so that recorders never have to wait on each-other or on the poller.
+struct lens_dist_shard_epoch
+{
+    atomic_size_t n;
+    atomic_uint_fast64_t max;
+    atomic_size_t skipped;
+
+    atomic_uint_fast64_t samples[];
 };
 
 struct lens_dist
 {
-    struct lens_dist_epoch epochs[2];
+    size_t samples_len;
+
+    // Layout of the shards that follow the snapshot where each shard holds
+    // both of its epochs.
+    struct lens_shards layout;
+
+    // Duration of a tick in the unit of the dist if the dist records the raw
+    // ticks of the timings, 0 otherwise. Raw values are converted when read.
+    double ticks;
+
+    // Running count and max of every value reset by the reads which are only
+    // written by the poller.
+    atomic_size_t total_n;
+    atomic_uint_fast64_t total_max;
+
+    uint8_t data[] optics_align(cache_line_len);
 };
 
 
+// -----------------------------------------------------------------------------
+// layout
+// -----------------------------------------------------------------------------
+
+static size_t lens_dist_epoch_len(size_t samples)
+{
+    return align(sizeof(struct lens_dist_epoch) + samples * sizeof(double), cache_line_len);
+}
+
+static size_t lens_dist_snapshot_len(size_t samples)
+{
+    return align(samples * sizeof(double), cache_line_len);
+}
+
+static size_t lens_dist_shard_epoch_len(size_t samples)
+{
+    size_t len = sizeof(struct lens_dist_shard_epoch) + samples * sizeof(atomic_uint_fast64_t);
+    return align(len, cache_line_len);
+}
+
+static size_t lens_dist_shards_off(size_t samples)
+{
+    return 2 * lens_dist_epoch_len(samples) + lens_dist_snapshot_len(samples);
+}
+
+static size_t lens_dist_len(size_t samples, bool sharded)
+{
+    size_t len = sizeof(struct lens_dist) + lens_dist_shards_off(samples);
+    if (sharded) len += lens_shards_alloc_len(2 * lens_dist_shard_epoch_len(samples));
+    return len;
+}
+
+static struct lens_dist_epoch *lens_dist_epoch(struct lens_dist *dist, optics_epoch_t epoch)
+{
+    return (void *) (dist->data + epoch * lens_dist_epoch_len(dist->samples_len));
+}
+
+static double *lens_dist_snapshot(struct lens_dist *dist)
+{
+    return (void *) (dist->data + 2 * lens_dist_epoch_len(dist->samples_len));
+}
+
+static struct lens_dist_shard_epoch *
+lens_dist_shard_epoch(struct lens_dist *dist, size_t shard, optics_epoch_t epoch)
+{
+    size_t samples = dist->samples_len;
+    size_t len = lens_dist_shard_epoch_len(samples);
+
+    size_t off = lens_dist_shards_off(samples);
+    off += lens_shards_off(&dist->layout, shard, 2 * len) + epoch * len;
+    return (void *) (dist->data + off);
+}
+
+
 // -----------------------------------------------------------------------------
 // impl
 // -----------------------------------------------------------------------------
 
+static bool lens_dist_validate(size_t samples)
+{
+    if (!samples || samples > optics_dist_samples_max) {
+        optics_fail("invalid dist reservoir size '%zu' not in [1, %d]",
+                samples, optics_dist_samples_max);
+        return false;
+    }
+
+    return true;
+}
+
+static void lens_dist_sub_init(struct lens_dist *dist, size_t samples, bool sharded)
+{
+    dist->samples_len = samples;
+    if (!sharded) return;
+
+    lens_shards_init(&dist->layout,
+            dist->data + lens_dist_shards_off(samples),
+            2 * lens_dist_shard_epoch_len(samples));
+}
+
+static struct optics_lens *
+lens_dist_reservoir_alloc(struct optics *optics, const char *name, size_t samples, bool sharded)
+{
+    if (!lens_dist_validate(samples)) goto fail_samples;
+
+    size_t len = lens_dist_len(samples, sharded);
+    struct optics_lens *lens = lens_alloc(optics, optics_dist, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_dist *dist = lens_sub_ptr(lens, optics_dist);
+    if (!dist) goto fail_sub;
+
+    lens_dist_sub_init(dist, samples, sharded);
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_samples:
+    return NULL;
+}
 
 static struct optics_lens *
 lens_dist_alloc(struct optics *optics, const char *name)
 {
-    return lens_alloc(optics, optics_dist, sizeof(struct lens_dist), name);
+    return lens_dist_reservoir_alloc(optics, name, optics_dist_samples, false);
+}
+
+static struct optics_lens *
+lens_dist_sharded_alloc(struct optics *optics, const char *name)
+{
+    return lens_dist_reservoir_alloc(optics, name, optics_dist_samples, true);
+}
+
+static struct lens_dist_shard_epoch *lens_dist_shard(struct lens_dist *dist, optics_epoch_t epoch)
+{
+    return lens_dist_shard_epoch(dist, lens_shards_local(&dist->layout), epoch);
+}
+
+static void
+lens_dist_shard_sample(struct lens_dist_shard_epoch *dist, size_t samples, double value)
+{
+    size_t i = atomic_fetch_add_explicit(&dist->n, 1, memory_order_relaxed);
+    if (i >= samples)
+        i = rng_gen_range(rng_global(), 0, i + 1);
+    if (i < samples)
+        atomic_store_explicit(&dist->samples[i], pun_dtoi(value), memory_order_relaxed);
+}
+
+static void lens_dist_shard_max(struct lens_dist_shard_epoch *dist, double value)
+{
+    uint64_t old = atomic_load_explicit(&dist->max, memory_order_relaxed);
+    while (value > pun_itod(old)) {
+        if (atomic_compare_exchange_weak_explicit(
+                        &dist->max, &old, pun_dtoi(value),
+                        memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+static void lens_dist_total_max(struct lens_dist *dist, double value)
+{
+    uint64_t old = atomic_load_explicit(&dist->total_max, memory_order_relaxed);
+    while (value > pun_itod(old)) {
+        if (atomic_compare_exchange_weak_explicit(
+                        &dist->total_max, &old, pun_dtoi(value),
+                        memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+static void
+lens_dist_record_sharded(struct lens_dist *dist_head, optics_epoch_t epoch, double value)
+{
+    struct lens_dist_shard_epoch *dist = lens_dist_shard(dist_head, epoch);
+    lens_dist_shard_sample(dist, dist_head->samples_len, value);
+    lens_dist_shard_max(dist, value);
+}
+
+// Must be called while holding the epoch's lock.
+static void lens_dist_epoch_sample(struct lens_dist_epoch *dist, size_t samples, double value)
+{
+    size_t i = dist->n;
+    if (i >= samples)
+        i = rng_gen_range(rng_global(), 0, dist->n);
+    if (i < samples)
+        dist->samples[i] = value;
+
+    dist->n++;
+    if (value > dist->max) dist->max = value;
+}
+
+// Values recorded in the unit of the dist are converted to raw ticks if the dist
+// records ticks.
+static double lens_dist_to_raw(const struct lens_dist *dist, double value)
+{
+    return optics_unlikely(dist->ticks != 0) ? value / dist->ticks : value;
+}
+
+static double lens_dist_from_raw(const struct lens_dist *dist, double value)
+{
+    return optics_unlikely(dist->ticks != 0) ? value * dist->ticks : value;
+}
+
+static void
+lens_dist_sub_record_raw(struct lens_dist *dist_head, optics_epoch_t epoch, double value)
+{
+    if (dist_head->layout.len) {
+        lens_dist_record_sharded(dist_head, epoch, value);
+        return;
+    }
+
+    struct lens_dist_epoch *dist = lens_dist_epoch(dist_head, epoch);
+    {
+        slock_lock(&dist->lock);
+        lens_dist_epoch_sample(dist, dist_head->samples_len, value);
+        slock_unlock(&dist->lock);
+    }
+}
+
+static void
+lens_dist_sub_record(struct lens_dist *dist_head, optics_epoch_t epoch, double value)
+{
+    lens_dist_sub_record_raw(dist_head, epoch, lens_dist_to_raw(dist_head, value));
+}
+
+static void lens_dist_skip(struct lens_dist *dist_head, optics_epoch_t epoch)
+{
+    atomic_size_t *skipped = dist_head->layout.len ?
+        &lens_dist_shard(dist_head, epoch)->skipped :
+        &lens_dist_epoch(dist_head, epoch)->skipped;
+
+    atomic_fetch_add_explicit(skipped, 1, memory_order_relaxed);
+}
+
+static size_t lens_dist_skipped(struct lens_dist *dist_head, optics_epoch_t epoch)
+{
+    atomic_size_t *skipped = &lens_dist_epoch(dist_head, epoch)->skipped;
+    size_t n = atomic_exchange_explicit(skipped, 0, memory_order_relaxed);
+
+    for (size_t i = 0; i < dist_head->layout.len; ++i) {
+        skipped = &lens_dist_shard_epoch(dist_head, i, epoch)->skipped;
+        n += atomic_exchange_explicit(skipped, 0, memory_order_relaxed);
+    }
+
+    return n;
 }
 
 static bool
@@ -39,28 +292,96 @@ lens_dist_record(struct optics_lens* lens, optics_epoch_t epoch, double value)
     struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
     if (!dist_head) return false;
 
-    struct lens_dist_epoch *dist = &dist_head->epochs[epoch];
-    {
-        slock_lock(&dist->lock);
+    if (lens_sample(lens)) lens_dist_sub_record(dist_head, epoch, value);
+    else lens_dist_skip(dist_head, epoch);
+    return true;
+}
+
+// The lock of regular dists is taken once for the whole batch while sharded
+// dists only update their max once.
+static bool
+lens_dist_record_n(
+        struct optics_lens* lens, optics_epoch_t epoch, const double *values, size_t n)
+{
+    struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
+    if (!dist_head) return false;
+    if (!n) return true;
+
+    size_t skipped = 0;
+    size_t samples = dist_head->samples_len;
 
-        size_t i = dist->n;
-        if (i >= optics_dist_samples)
-            i = rng_gen_range(rng_global(), 0, dist->n);
-        if (i < optics_dist_samples)
-            dist->samples[i] = value;
+    if (dist_head->layout.len) {
+        struct lens_dist_shard_epoch *dist = lens_dist_shard(dist_head, epoch);
+
+        double max = -INFINITY;
+        for (size_t i = 0; i < n; ++i) {
+            if (!lens_sample(lens)) { skipped++; continue; }
+            double value = lens_dist_to_raw(dist_head, values[i]);
+            lens_dist_shard_sample(dist, samples, value);
+            if (value > max) max = value;
+        }
+
+        lens_dist_shard_max(dist, max);
+        if (skipped) atomic_fetch_add_explicit(&dist->skipped, skipped, memory_order_relaxed);
+    }
 
-        dist->n++;
-        if (value > dist->max) dist->max = value;
+    else {
+        struct lens_dist_epoch *dist = lens_dist_epoch(dist_head, epoch);
 
+        slock_lock(&dist->lock);
+        for (size_t i = 0; i < n; ++i) {
+            if (!lens_sample(lens)) { skipped++; continue; }
+            lens_dist_epoch_sample(dist, samples, lens_dist_to_raw(dist_head, values[i]));
+        }
         slock_unlock(&dist->lock);
+
+        if (skipped) atomic_fetch_add_explicit(&dist->skipped, skipped, memory_order_relaxed);
     }
+
     return true;
 }
 
 
-static int lens_dist_value_cmp(const void *lhs, const void *rhs)
+static inline void lens_dist_swap(double *values, size_t i, size_t j)
 {
-    return *((double *) lhs) - *((double *) rhs);
+    double tmp = values[i];
+    values[i] = values[j];
+    values[j] = tmp;
+}
+
+// Partially orders values[first, last) such that values[k] is the element that
+// would be at k if the range was sorted, every element before k is smaller or
+// equal and every element after k is greater or equal. Quickselect with a
+// median-of-3 pivot which is expected linear on the randomly ordered samples
+// of the reservoir and falls back to an insertion sort for small ranges.
+static void lens_dist_select(double *values, size_t first, size_t last, size_t k)
+{
+    while (last - first > 8) {
+        size_t mid = first + (last - first) / 2;
+        if (values[mid] < values[first]) lens_dist_swap(values, mid, first);
+        if (values[last - 1] < values[first]) lens_dist_swap(values, last - 1, first);
+        if (values[last - 1] < values[mid]) lens_dist_swap(values, last - 1, mid);
+        double pivot = values[mid];
+
+        // Signed since j can move one past first.
+        ptrdiff_t i = first, j = last - 1;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (pivot < values[j]) j--;
+            if (i <= j) lens_dist_swap(values, i++, j--);
+        }
+
+        if ((ptrdiff_t) k <= j) last = j + 1;
+        else if ((ptrdiff_t) k >= i) first = i;
+        else return;
+    }
+
+    for (size_t i = first + 1; i < last; ++i) {
+        double value = values[i];
+        size_t j = i;
+        for (; j > first && value < values[j - 1]; --j) values[j] = values[j - 1];
+        values[j] = value;
+    }
 }
 
 static inline size_t lens_dist_p(size_t percentile, size_t n)
@@ -68,29 +389,137 @@ static inline size_t lens_dist_p(size_t percentile, size_t n)
     return (n * percentile) / 100;
 }
 
-static size_t lens_dist_reservoir_len(size_t len)
+static size_t lens_dist_reservoir_len(struct lens_dist *dist, size_t len)
+{
+    return len > dist->samples_len ? dist->samples_len : len;
+}
+
+// Merges the reservoirs of every shard into a single reservoir where each
+// sample has the same probability of being selected as if it had been recorded
+// into a single reservoir. Each shard contributes a number of samples
+// proportional to the number of values it saw (largest remainder rounding) and
+// these samples are picked at random from the shard's reservoir.
+static size_t
+lens_dist_read_sharded(
+        struct lens_dist *dist_head, optics_epoch_t epoch,
+        struct optics_dist *value, double *out)
+{
+    size_t shards_len = dist_head->layout.len;
+
+    size_t n[shards_len];
+    size_t picks[shards_len];
+    double remainders[shards_len];
+
+    value->n = 0;
+    for (size_t i = 0; i < shards_len; ++i) {
+        struct lens_dist_shard_epoch *dist = lens_dist_shard_epoch(dist_head, i, epoch);
+
+        // Stragglers that record after the exchange will be picked up by the
+        // next read of this epoch.
+        n[i] = atomic_exchange_explicit(&dist->n, 0, memory_order_relaxed);
+        value->n += n[i];
+
+        double max = pun_itod(atomic_exchange_explicit(&dist->max, 0, memory_order_relaxed));
+        max = lens_dist_from_raw(dist_head, max);
+        if (value->max < max) value->max = max;
+    }
+    if (!value->n) return 0;
+
+    size_t total = lens_dist_reservoir_len(dist_head, value->n);
+    size_t picked = 0;
+    for (size_t i = 0; i < shards_len; ++i) {
+        double share = ((double) n[i] * total) / value->n;
+        picks[i] = share;
+        if (picks[i] > lens_dist_reservoir_len(dist_head, n[i]))
+            picks[i] = lens_dist_reservoir_len(dist_head, n[i]);
+        remainders[i] = share - picks[i];
+        picked += picks[i];
+    }
+
+    while (picked < total) {
+        size_t best = shards_len;
+        for (size_t i = 0; i < shards_len; ++i) {
+            if (picks[i] >= lens_dist_reservoir_len(dist_head, n[i])) continue;
+            if (best == shards_len || remainders[i] > remainders[best]) best = i;
+        }
+        if (best == shards_len) break;
+
+        picks[best]++;
+        remainders[best] = -1;
+        picked++;
+    }
+
+    struct rng *rng = rng_global();
+    double *it = out;
+
+    for (size_t i = 0; i < shards_len; ++i) {
+        if (!picks[i]) continue;
+
+        struct lens_dist_shard_epoch *dist = lens_dist_shard_epoch(dist_head, i, epoch);
+        size_t len = lens_dist_reservoir_len(dist_head, n[i]);
+
+        double samples[len];
+        for (size_t j = 0; j < len; ++j)
+            samples[j] = pun_itod(atomic_load_explicit(&dist->samples[j], memory_order_relaxed));
+
+        // partial fisher-yates shuffle to select picks[i] samples without
+        // replacement.
+        for (size_t j = 0; j < picks[i]; ++j) {
+            size_t k = j + rng_gen_range(rng, 0, len - j);
+            double tmp = samples[j];
+            samples[j] = samples[k];
+            samples[k] = tmp;
+            *it++ = lens_dist_from_raw(dist_head, samples[j]);
+        }
+    }
+
+    return it - out;
+}
+
+// Each selection leaves the samples above the percentile to its right so the
+// next one only needs to look at that tail. Note that this leaves the samples
+// partially ordered rather than sorted.
+static void lens_dist_summarize(struct optics_dist *value, double *samples, size_t len)
 {
-    return len > optics_dist_samples ? optics_dist_samples : len;
+    value->samples = samples;
+    value->samples_len = len;
+    if (!len) return;
+
+    size_t p50 = lens_dist_p(50, len);
+    size_t p90 = lens_dist_p(90, len);
+    size_t p99 = lens_dist_p(99, len);
+
+    lens_dist_select(samples, 0, len, p50);
+    lens_dist_select(samples, p50, len, p90);
+    lens_dist_select(samples, p90, len, p99);
+
+    value->p50 = samples[p50];
+    value->p90 = samples[p90];
+    value->p99 = samples[p99];
 }
 
 static enum optics_ret
-lens_dist_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_dist *value)
+lens_dist_sub_read(struct lens_dist *dist_head, optics_epoch_t epoch, struct optics_dist *value)
 {
-    struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
-    if (!dist_head) return optics_err;
+    struct lens_dist_epoch *dist = lens_dist_epoch(dist_head, epoch);
+    double *samples = lens_dist_snapshot(dist_head);
+    size_t len = 0;
 
-    struct lens_dist_epoch *dist = &dist_head->epochs[epoch];
+    if (dist_head->layout.len)
+        len = lens_dist_read_sharded(dist_head, epoch, value, samples);
 
-    {
+    else {
         // Since we're not locking the active epoch, we should only contend
         // with straglers which can be dealt with by the poller.
-        if (slock_is_locked(&dist->lock)) return optics_busy;
+        if (!slock_try_lock(&dist->lock)) return optics_busy;
 
         value->n = dist->n;
-        if (value->max < dist->max) value->max = dist->max;
+        double max = lens_dist_from_raw(dist_head, dist->max);
+        if (value->max < max) value->max = max;
 
-        size_t to_copy = lens_dist_reservoir_len(value->n);
-        memcpy(value->samples, dist->samples, to_copy * sizeof(value->samples[0]));
+        len = lens_dist_reservoir_len(dist_head, value->n);
+        for (size_t i = 0; i < len; ++i)
+            samples[i] = lens_dist_from_raw(dist_head, dist->samples[i]);
 
         dist->max = 0;
         dist->n = 0;
@@ -98,53 +527,66 @@ lens_dist_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_dis
         slock_unlock(&dist->lock);
     }
 
-    if (!value->n) return optics_ok;
+    lens_dist_summarize(value, samples, len);
+    return optics_ok;
+}
+
+static enum optics_ret
+lens_dist_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_dist *value)
+{
+    struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
+    if (!dist_head) return optics_err;
+
+    enum optics_ret ret = lens_dist_sub_read(dist_head, epoch, value);
+    if (ret != optics_ok) return ret;
 
-    size_t len = value->n <= optics_dist_samples ? value->n : optics_dist_samples;
-    qsort(value->samples, len, sizeof(double), lens_dist_value_cmp);
+    // The percentiles are computed from the sampled calls only while the count
+    // includes every call.
+    value->n += lens_dist_skipped(dist_head, epoch);
+    lens_sample_adapt(lens, value->n);
 
-    value->p50 = value->samples[lens_dist_p(50, len)];
-    value->p90 = value->samples[lens_dist_p(90, len)];
-    value->p99 = value->samples[lens_dist_p(99, len)];
+    if (value->n) {
+        atomic_fetch_add_explicit(&dist_head->total_n, value->n, memory_order_relaxed);
+        lens_dist_total_max(dist_head, value->max);
+    }
 
     return optics_ok;
 }
 
-
-static bool
-lens_dist_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+// Must be called before any value is recorded.
+static bool lens_dist_ticks(struct optics_lens *lens, double ticks)
 {
-    bool ret = false;
-    size_t old;
-
-    struct optics_key key = {0};
-    optics_key_push(&key, poll->key);
+    struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
+    if (!dist_head) return false;
 
-    old = optics_key_push(&key, "count");
-    ret = cb(ctx, poll->ts, key.data, lens_rescale(poll, poll->value.dist.n));
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+    dist_head->ticks = ticks;
+    return true;
+}
 
-    old = optics_key_push(&key, "p50");
-    ret = cb(ctx, poll->ts, key.data, poll->value.dist.p50);
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+// Unlike counters and histos, the live epochs are not included since the
+// reservoirs can only be read by resetting them.
+static enum optics_ret
+lens_dist_peek(struct optics_lens *lens, struct optics_dist_total *value)
+{
+    struct lens_dist *dist_head = lens_sub_ptr(lens, optics_dist);
+    if (!dist_head) return optics_err;
 
-    old = optics_key_push(&key, "p90");
-    ret = cb(ctx, poll->ts, key.data, poll->value.dist.p90);
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+    *value = (struct optics_dist_total) {
+        .n = atomic_load_explicit(&dist_head->total_n, memory_order_relaxed),
+        .max = pun_itod(atomic_load_explicit(&dist_head->total_max, memory_order_relaxed)),
+    };
+    return optics_ok;
+}
 
-    old = optics_key_push(&key, "p99");
-    ret = cb(ctx, poll->ts, key.data, poll->value.dist.p99);
-    optics_key_pop(&key, old);
-    if (!ret) return false;
 
-    old = optics_key_push(&key, "max");
-    ret = cb(ctx, poll->ts, key.data, poll->value.dist.max);
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+static bool
+lens_dist_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_dist *dist = &poll->value.dist;
 
-    return true;
+    return lens_normalize_emit(norm, 0, "count", lens_rescale(poll, dist->n))
+        && lens_normalize_emit(norm, 1, "p50", dist->p50)
+        && lens_normalize_emit(norm, 2, "p90", dist->p90)
+        && lens_normalize_emit(norm, 3, "p99", dist->p99)
+        && lens_normalize_emit(norm, 4, "max", dist->max);
 }
@@ -0,0 +1,342 @@
+/* lens_family.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Dense array of child lenses indexed by the combination of the labels of up
+   to optics_family_dims_max dimensions. Children reuse the layout and the
+   record functions of the regular lenses such that recording into a family is
+   only an index computation away from recording into a regular lens. The
+   labels are only used by the poller which expands each child into its own
+   key at poll time.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_family
+{
+    enum optics_lens_type type;
+
+    size_t children_len;
+    size_t child_len;
+
+    size_t dims_len;
+    size_t dims[optics_family_dims_max];
+
+    // Index in the label offsets of the first label of each dimension. The
+    // offsets are relative to the start of the label characters.
+    size_t labels_first[optics_family_dims_max];
+    size_t labels_off;
+    size_t chars_off;
+
+    uint8_t children[] optics_align(cache_line_len);
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static size_t lens_family_child_len(enum optics_lens_type type)
+{
+    switch (type) {
+    case optics_counter: return sizeof(struct lens_counter);
+    case optics_gauge: return sizeof(struct lens_gauge);
+    case optics_dist: return lens_dist_len(optics_dist_samples, false);
+    case optics_histo: return sizeof(struct lens_histo);
+
+    case optics_quantile:
+    case optics_quantiles:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default: return 0;
+    }
+}
+
+static void *lens_family_child_ptr(struct lens_family *family, size_t index)
+{
+    return family->children + index * family->child_len;
+}
+
+static const uint32_t *lens_family_labels(struct lens_family *family)
+{
+    return (const uint32_t *) (((uint8_t *) family) + family->labels_off);
+}
+
+static const char *lens_family_chars(struct lens_family *family)
+{
+    return (const char *) (((uint8_t *) family) + family->chars_off);
+}
+
+static void *
+lens_family_child(struct optics_lens *lens, enum optics_lens_type type, size_t index)
+{
+    struct lens_family *family = lens_sub_ptr(lens, optics_family);
+    if (!family) return NULL;
+
+    if (optics_unlikely(family->type != type)) {
+        optics_fail("invalid family type: %d != %d", family->type, type);
+        return NULL;
+    }
+
+    if (optics_unlikely(index >= family->children_len)) {
+        optics_fail("invalid family index: %zu >= %zu", index, family->children_len);
+        return NULL;
+    }
+
+    return lens_family_child_ptr(family, index);
+}
+
+
+// -----------------------------------------------------------------------------
+// alloc
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_family_alloc(
+        struct optics *optics, const char *name, enum optics_lens_type type,
+        const struct optics_family_dim *dims, size_t dims_len,
+        const uint64_t *buckets, size_t buckets_len)
+{
+    size_t child_len = lens_family_child_len(type);
+    if (!child_len) {
+        optics_fail("invalid family type '%d'", type);
+        goto fail_args;
+    }
+
+    if (type == optics_histo && !lens_histo_validate(buckets, buckets_len))
+        goto fail_args;
+
+    if (!dims_len || dims_len > optics_family_dims_max) {
+        optics_fail("invalid family dimensions '%zu' not in [1, %d]",
+                dims_len, optics_family_dims_max);
+        goto fail_args;
+    }
+
+    size_t children_len = 1;
+    size_t labels_len = 0;
+    size_t chars_len = 0;
+
+    for (size_t i = 0; i < dims_len; ++i) {
+        if (!dims[i].len) {
+            optics_fail("invalid family dimension '%zu' without labels", i);
+            goto fail_args;
+        }
+
+        children_len *= dims[i].len;
+        if (children_len > optics_family_children_max) {
+            optics_fail("invalid family children '%zu' > '%d'",
+                    children_len, optics_family_children_max);
+            goto fail_args;
+        }
+
+        for (size_t j = 0; j < dims[i].len; ++j) {
+            size_t len = dims[i].labels[j] ? strnlen(dims[i].labels[j], optics_name_max_len) : 0;
+            if (!len || len == optics_name_max_len) {
+                optics_fail("invalid family label '%zu:%zu'", i, j);
+                goto fail_args;
+            }
+
+            chars_len += len + 1;
+        }
+
+        labels_len += dims[i].len;
+    }
+
+    size_t labels_off = sizeof(struct lens_family) + children_len * child_len;
+    size_t chars_off = labels_off + labels_len * sizeof(uint32_t);
+
+    struct optics_lens *lens =
+        lens_alloc(optics, optics_family, chars_off + chars_len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_family *family = lens_sub_ptr(lens, optics_family);
+    if (!family) goto fail_sub;
+
+    family->type = type;
+    family->children_len = children_len;
+    family->child_len = child_len;
+    family->dims_len = dims_len;
+    family->labels_off = labels_off;
+    family->chars_off = chars_off;
+
+    uint32_t *labels = (uint32_t *) (((uint8_t *) family) + labels_off);
+    char *chars = ((char *) family) + chars_off;
+
+    size_t label = 0, off = 0;
+    for (size_t i = 0; i < dims_len; ++i) {
+        family->dims[i] = dims[i].len;
+        family->labels_first[i] = label;
+
+        for (size_t j = 0; j < dims[i].len; ++j) {
+            labels[label++] = off;
+            off += strlcpy(chars + off, dims[i].labels[j], chars_len - off) + 1;
+        }
+    }
+
+    if (type == optics_histo) {
+        for (size_t i = 0; i < children_len; ++i)
+            lens_histo_sub_init(lens_family_child_ptr(family, i), buckets, buckets_len);
+    }
+
+    if (type == optics_dist) {
+        for (size_t i = 0; i < children_len; ++i)
+            lens_dist_sub_init(lens_family_child_ptr(family, i), optics_dist_samples, false);
+    }
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_args:
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+
+static bool
+lens_family_counter_inc(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index, int64_t value)
+{
+    struct lens_counter *counter = lens_family_child(lens, optics_counter, index);
+    if (!counter) return false;
+
+    lens_counter_sub_inc(counter, epoch, value);
+    return true;
+}
+
+static bool
+lens_family_gauge_set(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index, double value)
+{
+    (void) epoch;
+
+    struct lens_gauge *gauge = lens_family_child(lens, optics_gauge, index);
+    if (!gauge) return false;
+
+    lens_gauge_sub_set(gauge, value);
+    return true;
+}
+
+static bool
+lens_family_dist_record(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index, double value)
+{
+    struct lens_dist *dist = lens_family_child(lens, optics_dist, index);
+    if (!dist) return false;
+
+    lens_dist_sub_record(dist, epoch, value);
+    return true;
+}
+
+static bool
+lens_family_histo_inc(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index, double value)
+{
+    struct lens_histo *histo = lens_family_child(lens, optics_histo, index);
+    if (!histo) return false;
+
+    lens_histo_sub_inc(histo, epoch, value);
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// read
+// -----------------------------------------------------------------------------
+
+static size_t lens_family_len(struct optics_lens *lens)
+{
+    struct lens_family *family = lens_sub_ptr(lens, optics_family);
+    if (!family) return 0;
+
+    return family->children_len;
+}
+
+// Children are laid out in row-major order which means that the labels are
+// found by peeling off the last dimension first.
+static bool
+lens_family_key(struct optics_lens *lens, size_t index, struct optics_key *key)
+{
+    struct lens_family *family = lens_sub_ptr(lens, optics_family);
+    if (!family) return false;
+
+    if (index >= family->children_len) {
+        optics_fail("invalid family index: %zu >= %zu", index, family->children_len);
+        return false;
+    }
+
+    size_t coords[optics_family_dims_max];
+    for (size_t i = family->dims_len; i > 0; --i) {
+        coords[i - 1] = index % family->dims[i - 1];
+        index /= family->dims[i - 1];
+    }
+
+    const uint32_t *labels = lens_family_labels(family);
+    const char *chars = lens_family_chars(family);
+
+    for (size_t i = 0; i < family->dims_len; ++i)
+        optics_key_push(key, chars + labels[family->labels_first[i] + coords[i]]);
+
+    return true;
+}
+
+static enum optics_ret
+lens_family_read(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index,
+        struct optics_poll *poll)
+{
+    struct lens_family *family = lens_sub_ptr(lens, optics_family);
+    if (!family) return optics_err;
+
+    if (index >= family->children_len) {
+        optics_fail("invalid family index: %zu >= %zu", index, family->children_len);
+        return optics_err;
+    }
+
+    void *child = lens_family_child_ptr(family, index);
+    poll->type = family->type;
+
+    switch (family->type) {
+
+    case optics_counter:
+        poll->value.counter = lens_counter_sub_read(child, epoch);
+        return optics_ok;
+
+    case optics_gauge:
+        poll->value.gauge = lens_gauge_sub_read(child);
+        return optics_ok;
+
+    case optics_dist:
+        return lens_dist_sub_read(child, epoch, &poll->value.dist);
+
+    case optics_histo:
+        lens_histo_sub_read(child, epoch, &poll->value.histo);
+        return optics_ok;
+
+    case optics_quantile:
+    case optics_quantiles:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default:
+        optics_fail("invalid family type '%d'", family->type);
+        return optics_err;
+    }
+}
@@ -2,17 +2,33 @@
    Rémi Attab (remi.attab@gmail.com), 25 Feb 2016
    FreeBSD-style copyright and disclaimer apply
 
-   \todo Doesn't respect epochs because it must retain it's previous value
-   across epoch changes even if no records happen.
+   Regular gauges don't respect epochs because they must retain their previous
+   value across epoch changes even if no records happen. Aggregated gauges
+   instead reduce the values set during each epoch and the sticky option
+   provides the retention when an epoch has no records.
 */
 
 // -----------------------------------------------------------------------------
 // struct
 // -----------------------------------------------------------------------------
 
+struct lens_gauge_epoch
+{
+    atomic_uint_fast64_t value;
+    atomic_uint_fast64_t count;
+};
+
 struct lens_gauge
 {
+    // Holds the value of regular gauges and, for aggregated gauges, the value
+    // last read which is reported by sticky gauges for empty epochs.
     atomic_uint_fast64_t value;
+
+    uint32_t agg;
+    uint32_t sticky;
+
+    // Only present for aggregated gauges.
+    struct lens_gauge_epoch epochs[];
 };
 
 static_assert(sizeof(atomic_uint_fast64_t) == sizeof(double),
@@ -32,36 +48,146 @@ lens_gauge_alloc(struct optics *optics, const char *name)
     return lens_alloc(optics, optics_gauge, sizeof(struct lens_gauge), name);
 }
 
+// The empty value of each epoch is the identity of the reduction such that
+// writers never need to check whether they're the first.
+static uint64_t lens_gauge_agg_identity(enum optics_gauge_agg agg)
+{
+    switch (agg) {
+    case optics_gauge_agg_max: return pun_dtoi(-INFINITY);
+    case optics_gauge_agg_min: return pun_dtoi(INFINITY);
+    case optics_gauge_agg_none:
+    case optics_gauge_agg_last:
+    case optics_gauge_agg_mean:
+    default: return pun_dtoi(0.0);
+    }
+}
+
+static struct optics_lens *
+lens_gauge_agg_alloc(
+        struct optics *optics, const char *name, enum optics_gauge_agg agg, bool sticky)
+{
+    if (agg == optics_gauge_agg_none) return lens_gauge_alloc(optics, name);
+
+    if (agg > optics_gauge_agg_mean) {
+        optics_fail("invalid aggregation '%d' for gauge '%s'", agg, name);
+        return NULL;
+    }
+
+    size_t len = sizeof(struct lens_gauge) + 2 * sizeof(struct lens_gauge_epoch);
+    struct optics_lens *lens = lens_alloc(optics, optics_gauge, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_gauge *gauge = lens_sub_ptr(lens, optics_gauge);
+    if (!gauge) goto fail_sub;
+
+    gauge->agg = agg;
+    gauge->sticky = sticky;
+
+    uint64_t identity = lens_gauge_agg_identity(agg);
+    for (size_t i = 0; i < 2; ++i)
+        atomic_init(&gauge->epochs[i].value, identity);
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+    return NULL;
+}
+
+static void lens_gauge_sub_set(struct lens_gauge *gauge, double value)
+{
+    atomic_store_explicit(&gauge->value, pun_dtoi(value), memory_order_relaxed);
+}
+
+static double lens_gauge_sub_read(struct lens_gauge *gauge)
+{
+    return pun_itod(atomic_load_explicit(&gauge->value, memory_order_relaxed));
+}
+
+static void lens_gauge_agg_set(struct lens_gauge *gauge, optics_epoch_t epoch, double value)
+{
+    struct lens_gauge_epoch *slot = &gauge->epochs[epoch];
+    atomic_fetch_add_explicit(&slot->count, 1, memory_order_relaxed);
+
+    if (gauge->agg == optics_gauge_agg_last) {
+        atomic_store_explicit(&slot->value, pun_dtoi(value), memory_order_relaxed);
+        return;
+    }
+
+    uint64_t old = atomic_load_explicit(&slot->value, memory_order_relaxed);
+    uint64_t new;
+
+    do {
+        double current = pun_itod(old);
+
+        switch (gauge->agg) {
+        case optics_gauge_agg_max:
+            if (value <= current) return;
+            new = pun_dtoi(value);
+            break;
+
+        case optics_gauge_agg_min:
+            if (value >= current) return;
+            new = pun_dtoi(value);
+            break;
+
+        case optics_gauge_agg_mean:
+            new = pun_dtoi(current + value);
+            break;
+
+        case optics_gauge_agg_none:
+        case optics_gauge_agg_last:
+        default:
+            optics_fail("unexpected gauge aggregation '%d'", gauge->agg);
+            return;
+        }
+
+    } while (!atomic_compare_exchange_weak_explicit(
+                    &slot->value, &old, new,
+                    memory_order_relaxed, memory_order_relaxed));
+}
+
+static double lens_gauge_agg_read(struct lens_gauge *gauge, optics_epoch_t epoch)
+{
+    struct lens_gauge_epoch *slot = &gauge->epochs[epoch];
+
+    uint64_t identity = lens_gauge_agg_identity(gauge->agg);
+    double value = pun_itod(atomic_exchange_explicit(&slot->value, identity, memory_order_relaxed));
+    uint64_t count = atomic_exchange_explicit(&slot->count, 0, memory_order_relaxed);
+
+    if (!count) return gauge->sticky ? lens_gauge_sub_read(gauge) : 0.0;
+
+    if (gauge->agg == optics_gauge_agg_mean) value /= count;
+    lens_gauge_sub_set(gauge, value);
+    return value;
+}
+
 static bool
 lens_gauge_set(struct optics_lens *lens, optics_epoch_t epoch, double value)
 {
-    (void) epoch;
-
     struct lens_gauge *gauge = lens_sub_ptr(lens, optics_gauge);
     if (!gauge) return false;
 
-    atomic_store_explicit(&gauge->value, pun_dtoi(value), memory_order_relaxed);
+    if (gauge->agg == optics_gauge_agg_none) lens_gauge_sub_set(gauge, value);
+    else lens_gauge_agg_set(gauge, epoch, value);
     return true;
 }
 
 static enum optics_ret
 lens_gauge_read(struct optics_lens *lens, optics_epoch_t epoch, double *value)
 {
-    (void) epoch;
-
     struct lens_gauge *gauge = lens_sub_ptr(lens, optics_gauge);
     if (!gauge) return optics_err;
 
-    uint64_t result = atomic_load_explicit(&gauge->value, memory_order_relaxed);
-    *value = pun_itod(result);
-
+    if (gauge->agg == optics_gauge_agg_none) *value = lens_gauge_sub_read(gauge);
+    else *value = lens_gauge_agg_read(gauge, epoch);
     return optics_ok;
 }
 
 
 static bool
-lens_gauge_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+lens_gauge_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
 {
-    return cb(ctx, poll->ts, poll->key, poll->value.gauge);
+    return lens_normalize_emit(norm, 0, NULL, poll->value.gauge);
 }
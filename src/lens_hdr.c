@@ -0,0 +1,228 @@
+/* lens_hdr.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Log-linear histogram in the style of HdrHistogram. Buckets are indexed
+   directly from the bits of the recorded double: the exponent selects the
+   power-of-two range and the top mantissa bits select the linear sub-bucket
+   within that range. This gives a constant relative error bounded by the
+   number of mantissa bits kept and an O(1) branchless bucket lookup.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_hdr
+{
+    double lowest;
+    double highest;
+
+    size_t digits;
+    size_t shift;
+    uint64_t base;
+    size_t buckets_len;
+
+    // buckets_len counters per epoch followed by buckets_len snapshot slots
+    // which hold the result of the last read and are handed out through struct
+    // optics_hdr. The snapshot slots are only ever touched by the poller.
+    atomic_size_t counts[];
+};
+
+static const size_t lens_hdr_double_mantissa = 52;
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+// Number of mantissa bits required so that two values with the given number of
+// significant decimal digits fall in distinct buckets: ceil(digits * log2(10)).
+static size_t lens_hdr_bits(size_t digits)
+{
+    static const size_t bits[] = { 0, 4, 7, 10 };
+    return bits[digits];
+}
+
+static size_t lens_hdr_index(const struct lens_hdr *hdr, double value)
+{
+    // Negative values and 0 have the sign bit set or an exponent below our
+    // base which both yield a negative index that gets clamped to 0. Values
+    // above highest get clamped to the last bucket.
+    int64_t i = ((int64_t) pun_dtoi(value) >> hdr->shift) - (int64_t) hdr->base;
+    i = i < 0 ? 0 : i;
+    i = i >= (int64_t) hdr->buckets_len ? (int64_t) hdr->buckets_len - 1 : i;
+    return i;
+}
+
+static double lens_hdr_bucket_lower(uint64_t base, size_t shift, size_t i)
+{
+    return pun_itod((base + i) << shift);
+}
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_hdr_alloc(
+        struct optics *optics, const char *name,
+        double lowest, double highest, size_t digits)
+{
+    if (!(lowest > 0)) {
+        optics_fail("invalid hdr lowest value '%g' <= 0", lowest);
+        goto fail_args;
+    }
+
+    if (!(highest > lowest)) {
+        optics_fail("invalid hdr range '%g' >= '%g'", lowest, highest);
+        goto fail_args;
+    }
+
+    if (!digits || digits > optics_hdr_digits_max) {
+        optics_fail("invalid hdr digits '%lu' not in [1, %d]",
+                digits, optics_hdr_digits_max);
+        goto fail_args;
+    }
+
+    size_t shift = lens_hdr_double_mantissa - lens_hdr_bits(digits);
+    uint64_t base = (pun_dtoi(lowest) >> lens_hdr_double_mantissa) << lens_hdr_bits(digits);
+    uint64_t top = (pun_dtoi(highest) >> lens_hdr_double_mantissa) << lens_hdr_bits(digits);
+    size_t buckets_len = (top - base) + (1UL << lens_hdr_bits(digits));
+
+    if (buckets_len > optics_hdr_buckets_max) {
+        optics_fail("too many hdr buckets for range '%g'-'%g' with '%lu' digits: %lu > %d",
+                lowest, highest, digits, buckets_len, optics_hdr_buckets_max);
+        goto fail_args;
+    }
+
+    size_t len = sizeof(struct lens_hdr) + 3 * buckets_len * sizeof(atomic_size_t);
+    struct optics_lens *lens = lens_alloc(optics, optics_hdr, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_hdr *hdr = lens_sub_ptr(lens, optics_hdr);
+    if (!hdr) goto fail_sub;
+
+    hdr->lowest = lowest;
+    hdr->highest = highest;
+    hdr->digits = digits;
+    hdr->shift = shift;
+    hdr->base = base;
+    hdr->buckets_len = buckets_len;
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_args:
+    return NULL;
+}
+
+static void
+lens_hdr_sub_record(struct lens_hdr *hdr, optics_epoch_t epoch, double value)
+{
+    size_t i = (epoch * hdr->buckets_len) + lens_hdr_index(hdr, value);
+    atomic_fetch_add_explicit(&hdr->counts[i], 1, memory_order_relaxed);
+}
+
+static bool
+lens_hdr_record(struct optics_lens *lens, optics_epoch_t epoch, double value)
+{
+    struct lens_hdr *hdr = lens_sub_ptr(lens, optics_hdr);
+    if (!hdr) return false;
+
+    lens_hdr_sub_record(hdr, epoch, value);
+    return true;
+}
+
+static double lens_hdr_value_at(
+        const struct optics_hdr *value, size_t i)
+{
+    // Report the middle of the bucket which halves the worst-case error.
+    double lower = lens_hdr_bucket_lower(value->base, value->shift, i);
+    double upper = lens_hdr_bucket_lower(value->base, value->shift, i + 1);
+    return lower + (upper - lower) / 2;
+}
+
+// Expects the count to be set.
+static void lens_hdr_summarize(struct optics_hdr *value)
+{
+    value->p50 = value->p90 = value->p99 = value->p999 = value->max = 0;
+    if (!value->count) return;
+
+    const size_t percentiles[] = { 500, 900, 990, 999 };
+    double *results[] = { &value->p50, &value->p90, &value->p99, &value->p999 };
+    enum { percentiles_len = sizeof(percentiles) / sizeof(percentiles[0]) };
+
+    size_t targets[percentiles_len];
+    for (size_t i = 0; i < percentiles_len; ++i)
+        targets[i] = (value->count * percentiles[i]) / 1000;
+
+    size_t sum = 0, p = 0, last = 0;
+    for (size_t i = 0; i < value->buckets_len; ++i) {
+        if (!value->counts[i]) continue;
+
+        sum += value->counts[i];
+        last = i;
+
+        for (; p < percentiles_len && sum > targets[p]; ++p)
+            *results[p] = lens_hdr_value_at(value, i);
+    }
+
+    value->max = lens_hdr_value_at(value, last);
+}
+
+static enum optics_ret
+lens_hdr_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_hdr *value)
+{
+    struct lens_hdr *hdr = lens_sub_ptr(lens, optics_hdr);
+    if (!hdr) return optics_err;
+
+    atomic_size_t *counts = &hdr->counts[epoch * hdr->buckets_len];
+    size_t *snapshot = (size_t *) &hdr->counts[2 * hdr->buckets_len];
+
+    value->count = 0;
+    value->lowest = hdr->lowest;
+    value->highest = hdr->highest;
+    value->base = hdr->base;
+    value->shift = hdr->shift;
+    value->buckets_len = hdr->buckets_len;
+    value->counts = snapshot;
+
+    for (size_t i = 0; i < hdr->buckets_len; ++i) {
+        snapshot[i] = atomic_exchange_explicit(&counts[i], 0, memory_order_relaxed);
+        value->count += snapshot[i];
+    }
+
+    lens_hdr_summarize(value);
+    return optics_ok;
+}
+
+static bool
+lens_hdr_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_hdr *hdr = &poll->value.hdr;
+
+    bool ret = lens_normalize_emit(norm, 0, "count", lens_rescale(poll, hdr->count))
+        && lens_normalize_emit(norm, 1, "p50", hdr->p50)
+        && lens_normalize_emit(norm, 2, "p90", hdr->p90)
+        && lens_normalize_emit(norm, 3, "p99", hdr->p99)
+        && lens_normalize_emit(norm, 4, "p999", hdr->p999)
+        && lens_normalize_emit(norm, 5, "max", hdr->max);
+    if (!ret) return false;
+
+    // Only non-empty buckets are emitted since there can be thousands of them.
+    // Buckets are identified by index which is stable for a given lowest,
+    // highest and digits configuration and can therefore be merged downstream.
+    // Their keys are sparse and therefore never cached.
+    for (size_t i = 0; i < hdr->buckets_len; ++i) {
+        if (!hdr->counts[i]) continue;
+
+        ret = lens_normalize_emit_bucket(norm, lens_rescale(poll, hdr->counts[i]), i);
+        if (!ret) return false;
+    }
+
+    return true;
+}
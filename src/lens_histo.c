@@ -8,18 +8,43 @@
 // struct
 // -----------------------------------------------------------------------------
 
+// counts[0] is the below counter and counts[buckets_len] is the above counter
+// which lets lens_histo_inc index the counters directly from the number of
+// edges that are lower or equal to the recorded value.
 struct lens_histo_epoch
 {
-    atomic_size_t below, above;
-    atomic_size_t counts[optics_histo_buckets_max];
+    atomic_size_t counts[optics_histo_buckets_max + 2];
 };
 
+struct lens_histo_shard
+{
+    struct lens_histo_epoch epochs[2];
+} optics_align(cache_line_len);
+
 struct lens_histo
 {
     struct lens_histo_epoch epochs[2];
 
+    // Bucket edges converted to doubles at alloc time. Unused edges are set to
+    // infinity so that the lookup can always go over the full array.
+    double edges[optics_histo_buckets_max + 1];
+
+    // Duration of a tick in the unit of the buckets if the histo records the
+    // raw ticks of the timings, 0 otherwise. The edges are then expressed in
+    // ticks such that raw values are looked up without any conversion.
+    double ticks;
+
     uint64_t buckets[optics_histo_buckets_max + 1];
     size_t buckets_len;
+
+    // Layout of the shards that follow the header.
+    struct lens_shards layout;
+
+    // Running sums of every count reset by the reads which are only written by
+    // the poller.
+    struct lens_histo_epoch totals;
+
+    struct lens_histo_shard shards[] optics_align(cache_line_len);
 };
 
 
@@ -27,39 +52,80 @@ struct lens_histo
 // impl
 // -----------------------------------------------------------------------------
 
-static struct optics_lens *
-lens_histo_alloc(
-        struct optics *optics, const char *name,
-        const uint64_t *buckets, size_t buckets_len)
+static bool lens_histo_validate(const uint64_t *buckets, size_t buckets_len)
 {
     if (buckets_len < 2) {
         optics_fail("invalid histo bucket length '%lu' < '2'", buckets_len);
-        goto fail_buckets;
+        return false;
     }
 
     if (buckets_len > optics_histo_buckets_max + 1) {
         optics_fail("invalid histo bucket length '%lu' > '%d'",
                 buckets_len, optics_histo_buckets_max + 1);
-        goto fail_buckets;
+        return false;
     }
 
     for (size_t i = 0; i < buckets_len - 1; ++i) {
         if (buckets[i] >= buckets[i + 1]) {
             optics_fail("invalid histo buckets '%lu:%lu' >= '%lu:%lu'",
                     i, buckets[i], i + 1, buckets[i + 1]);
-            goto fail_buckets;
+            return false;
         }
     }
 
+    return true;
+}
+
+static void lens_histo_sub_init(
+        struct lens_histo *histo, const uint64_t *buckets, size_t buckets_len)
+{
+    histo->buckets_len = buckets_len;
+    memcpy(histo->buckets, buckets, buckets_len * sizeof(histo->buckets[0]));
+
+    for (size_t i = 0; i < optics_histo_buckets_max + 1; ++i)
+        histo->edges[i] = i < buckets_len ? buckets[i] : INFINITY;
+}
+
+static struct optics_lens *
+lens_histo_alloc(
+        struct optics *optics, const char *name,
+        const uint64_t *buckets, size_t buckets_len)
+{
+    if (!lens_histo_validate(buckets, buckets_len)) goto fail_buckets;
+
     struct optics_lens *lens = lens_alloc(optics, optics_histo, sizeof(struct lens_histo), name);
     if (!lens) goto fail_alloc;
 
     struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
     if (!histo) goto fail_sub;
 
-    histo->buckets_len = buckets_len;
-    memcpy(histo->buckets, buckets, buckets_len * sizeof(histo->buckets[0]));
+    lens_histo_sub_init(histo, buckets, buckets_len);
+    return lens;
 
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_buckets:
+    return NULL;
+}
+
+static struct optics_lens *
+lens_histo_sharded_alloc(
+        struct optics *optics, const char *name,
+        const uint64_t *buckets, size_t buckets_len)
+{
+    if (!lens_histo_validate(buckets, buckets_len)) goto fail_buckets;
+
+    size_t len = sizeof(struct lens_histo)
+        + lens_shards_alloc_len(sizeof(struct lens_histo_shard));
+    struct optics_lens *lens = lens_alloc(optics, optics_histo, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    if (!histo) goto fail_sub;
+
+    lens_histo_sub_init(histo, buckets, buckets_len);
+    lens_shards_init(&histo->layout, histo->shards, sizeof(struct lens_histo_shard));
     return lens;
 
   fail_sub:
@@ -69,85 +135,215 @@ lens_histo_alloc(
     return NULL;
 }
 
+static struct lens_histo_epoch *
+lens_histo_shard(struct lens_histo *histo, size_t shard, optics_epoch_t epoch)
+{
+    size_t off = lens_shards_off(&histo->layout, shard, sizeof(struct lens_histo_shard));
+    struct lens_histo_shard *ptr = (void *) ((uint8_t *) histo->shards + off);
+    return &ptr->epochs[epoch];
+}
+
+static struct lens_histo_epoch *
+lens_histo_epoch(struct lens_histo *histo, optics_epoch_t epoch)
+{
+    if (!histo->layout.len) return &histo->epochs[epoch];
+    return lens_histo_shard(histo, lens_shards_local(&histo->layout), epoch);
+}
+
+// Values recorded in the unit of the buckets are converted to raw ticks if the
+// histo records ticks.
+static double lens_histo_to_raw(const struct lens_histo *histo, double value)
+{
+    return optics_unlikely(histo->ticks != 0) ? value / histo->ticks : value;
+}
+
+static void
+lens_histo_sub_inc_raw(struct lens_histo *histo, optics_epoch_t epoch, double value)
+{
+    // Branch-free count of the edges lower or equal to value over a fixed size
+    // array which the compiler can unroll and vectorize. NaN fails every
+    // comparison and is therefore counted as below.
+    size_t i = 0;
+    for (size_t j = 0; j < optics_histo_buckets_max + 1; ++j)
+        i += value >= histo->edges[j];
+
+    atomic_size_t *bucket = &lens_histo_epoch(histo, epoch)->counts[i];
+    atomic_fetch_add_explicit(bucket, 1, memory_order_relaxed);
+}
+
+static void
+lens_histo_sub_inc(struct lens_histo *histo, optics_epoch_t epoch, double value)
+{
+    lens_histo_sub_inc_raw(histo, epoch, lens_histo_to_raw(histo, value));
+}
+
+// Counts are accumulated in local buckets such that the batch costs one atomic
+// per bucket that was hit.
+static void
+lens_histo_sub_inc_n(
+        struct lens_histo *histo, optics_epoch_t epoch, const double *values, size_t n)
+{
+    size_t counts[optics_histo_buckets_max + 2] = {0};
+
+    for (size_t k = 0; k < n; ++k) {
+        double value = lens_histo_to_raw(histo, values[k]);
+
+        size_t i = 0;
+        for (size_t j = 0; j < optics_histo_buckets_max + 1; ++j)
+            i += value >= histo->edges[j];
+        counts[i]++;
+    }
+
+    struct lens_histo_epoch *counters = lens_histo_epoch(histo, epoch);
+    for (size_t i = 0; i < optics_histo_buckets_max + 2; ++i) {
+        if (!counts[i]) continue;
+        atomic_size_t *bucket = &counters->counts[i];
+        atomic_fetch_add_explicit(bucket, counts[i], memory_order_relaxed);
+    }
+}
+
+static void
+lens_histo_epoch_read(
+        struct lens_histo_epoch *counters, size_t buckets_len, struct optics_histo *value)
+{
+    value->below += atomic_exchange_explicit(
+            &counters->counts[0], 0, memory_order_relaxed);
+    value->above += atomic_exchange_explicit(
+            &counters->counts[buckets_len], 0, memory_order_relaxed);
+    for (size_t i = 0; i < buckets_len - 1; ++i) {
+        value->counts[i] +=
+            atomic_exchange_explicit(&counters->counts[i + 1], 0, memory_order_relaxed);
+    }
+}
+
+static void
+lens_histo_sub_read(struct lens_histo *histo, optics_epoch_t epoch, struct optics_histo *value)
+{
+    value->buckets_len = histo->buckets_len;
+    memcpy(value->buckets, histo->buckets, histo->buckets_len * sizeof(histo->buckets[0]));
+
+    value->below = value->above = 0;
+    memset(value->counts, 0, sizeof(value->counts));
+
+    lens_histo_epoch_read(&histo->epochs[epoch], histo->buckets_len, value);
+    for (size_t i = 0; i < histo->layout.len; ++i)
+        lens_histo_epoch_read(lens_histo_shard(histo, i, epoch), histo->buckets_len, value);
+
+    // Same ordering as counters where the totals are published after the
+    // exchanges to synchronize with lens_histo_sub_peek.
+    atomic_size_t *totals = histo->totals.counts;
+    size_t above = histo->buckets_len;
+
+    if (value->below)
+        atomic_fetch_add_explicit(&totals[0], value->below, memory_order_release);
+    if (value->above)
+        atomic_fetch_add_explicit(&totals[above], value->above, memory_order_release);
+    for (size_t i = 0; i < histo->buckets_len - 1; ++i) {
+        if (!value->counts[i]) continue;
+        atomic_fetch_add_explicit(&totals[i + 1], value->counts[i], memory_order_release);
+    }
+}
+
+static void
+lens_histo_epoch_peek(
+        struct lens_histo_epoch *counters, size_t buckets_len, struct optics_histo *value)
+{
+    value->below += atomic_load_explicit(&counters->counts[0], memory_order_relaxed);
+    value->above += atomic_load_explicit(&counters->counts[buckets_len], memory_order_relaxed);
+    for (size_t i = 0; i < buckets_len - 1; ++i)
+        value->counts[i] += atomic_load_explicit(&counters->counts[i + 1], memory_order_relaxed);
+}
+
+// The totals are loaded before the epochs which means that a racing read can
+// only ever hide counts, never count them twice.
+static void
+lens_histo_sub_peek(struct lens_histo *histo, struct optics_histo *value)
+{
+    value->buckets_len = histo->buckets_len;
+    memcpy(value->buckets, histo->buckets, histo->buckets_len * sizeof(histo->buckets[0]));
+
+    atomic_size_t *totals = histo->totals.counts;
+    value->below = atomic_load_explicit(&totals[0], memory_order_acquire);
+    value->above = atomic_load_explicit(&totals[histo->buckets_len], memory_order_acquire);
+    memset(value->counts, 0, sizeof(value->counts));
+    for (size_t i = 0; i < histo->buckets_len - 1; ++i)
+        value->counts[i] = atomic_load_explicit(&totals[i + 1], memory_order_acquire);
+
+    for (size_t epoch = 0; epoch < 2; ++epoch) {
+        lens_histo_epoch_peek(&histo->epochs[epoch], histo->buckets_len, value);
+        for (size_t i = 0; i < histo->layout.len; ++i)
+            lens_histo_epoch_peek(lens_histo_shard(histo, i, epoch), histo->buckets_len, value);
+    }
+}
+
 static bool
 lens_histo_inc(struct optics_lens *lens, optics_epoch_t epoch, double value)
 {
-    (void) epoch;
-
     struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
     if (!histo) return false;
 
-    atomic_size_t *bucket = NULL;
-
-    if (value < histo->buckets[0])
-        bucket = &histo->epochs[epoch].below;
+    lens_histo_sub_inc(histo, epoch, value);
+    return true;
+}
 
-    else if (value >= histo->buckets[histo->buckets_len - 1])
-        bucket = &histo->epochs[epoch].above;
+static bool
+lens_histo_inc_n(
+        struct optics_lens *lens, optics_epoch_t epoch, const double *values, size_t n)
+{
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    if (!histo) return false;
 
-    else {
-        for (size_t i = 1; i < histo->buckets_len; ++i) {
-            if (value < histo->buckets[i]) {
-                bucket = &histo->epochs[epoch].counts[i - 1];
-                break;
-            }
-        }
-    }
+    lens_histo_sub_inc_n(histo, epoch, values, n);
+    return true;
+}
 
-    optics_assert(!!bucket, "value outside of all bucket ranges");
+// Must be called before any value is recorded.
+static bool lens_histo_ticks(struct optics_lens *lens, double ticks)
+{
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    if (!histo) return false;
 
-    atomic_fetch_add_explicit(bucket, 1, memory_order_relaxed);
+    histo->ticks = ticks;
+    for (size_t i = 0; i < histo->buckets_len; ++i)
+        histo->edges[i] = histo->buckets[i] / ticks;
     return true;
 }
 
 static enum optics_ret
 lens_histo_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_histo *value)
 {
-    (void) epoch;
-
     struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
     if (!histo) return optics_err;
 
-    value->buckets_len = histo->buckets_len;
-    memcpy(value->buckets, histo->buckets, histo->buckets_len * sizeof(histo->buckets[0]));
+    lens_histo_sub_read(histo, epoch, value);
+    return optics_ok;
+}
 
-    struct lens_histo_epoch *counters = &histo->epochs[epoch];
-    value->below = atomic_exchange_explicit(&counters->below, 0, memory_order_relaxed);
-    value->above = atomic_exchange_explicit(&counters->above, 0, memory_order_relaxed);
-    for (size_t i = 0; i < histo->buckets_len - 1; ++i) {
-        value->counts[i] =
-            atomic_exchange_explicit(&counters->counts[i], 0, memory_order_relaxed);
-    }
+static enum optics_ret
+lens_histo_peek(struct optics_lens *lens, struct optics_histo *value)
+{
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    if (!histo) return optics_err;
 
+    lens_histo_sub_peek(histo, value);
     return optics_ok;
 }
 
 static bool
-lens_histo_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+lens_histo_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
 {
-    size_t old;
-    bool ret = false;
     const struct optics_histo *histo = &poll->value.histo;
 
-    struct optics_key key = {0};
-    optics_key_push(&key, poll->key);
-
-    old = optics_key_push(&key, "below");
-    ret = cb(ctx, poll->ts, key.data, lens_rescale(poll, histo->below));
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+    if (!lens_normalize_emit(norm, 0, "below", lens_rescale(poll, histo->below)))
+        return false;
 
-    old = optics_key_push(&key, "above");
-    ret = cb(ctx, poll->ts, key.data, lens_rescale(poll, histo->above));
-    optics_key_pop(&key, old);
-    if (!ret) return false;
+    if (!lens_normalize_emit(norm, 1, "above", lens_rescale(poll, histo->above)))
+        return false;
 
     for (size_t i = 0; i < histo->buckets_len - 1; ++i) {
-        old = optics_key_pushf(
-                &key, "bucket_%lu_%lu", histo->buckets[i], histo->buckets[i + 1]);
-        ret = cb(ctx, poll->ts, key.data, lens_rescale(poll, histo->counts[i]));
-        optics_key_pop(&key, old);
+        bool ret = lens_normalize_emitf(
+                norm, i + 2, lens_rescale(poll, histo->counts[i]),
+                "bucket_%lu_%lu", histo->buckets[i], histo->buckets[i + 1]);
         if (!ret) return false;
     }
 
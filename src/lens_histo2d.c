@@ -0,0 +1,196 @@
+/* lens_histo2d.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Two-dimensional histogram where the rows are delimited by the edges of the
+   x values and the columns by the edges of the y values. Both dimensions use
+   the same branch-free lookup as histo lenses which gives the row and column
+   of a sample and therefore the index of its cell within a single matrix of
+   counters. Recording a sample is then a single atomic increment.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_histo2d
+{
+    // Bucket edges converted to doubles at alloc time. Unused edges are set to
+    // infinity so that the lookup can always go over the full array.
+    double row_edges[optics_histo2d_buckets_max + 1];
+    double col_edges[optics_histo2d_buckets_max + 1];
+
+    uint64_t rows[optics_histo2d_buckets_max + 1];
+    size_t rows_len;
+
+    uint64_t cols[optics_histo2d_buckets_max + 1];
+    size_t cols_len;
+
+    // Row-major matrix of (rows_len + 1) * (cols_len + 1) counters per epoch
+    // where, like histo lenses, the first and last row and column count the
+    // samples below and above the edges of their dimension. The two matrices
+    // are followed by (rows_len - 1) * (cols_len - 1) snapshot slots which
+    // hold the result of the last read and are handed out through struct
+    // optics_histo2d. The snapshot slots are only ever touched by the poller.
+    size_t cells_len;
+    atomic_size_t counts[];
+};
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static bool lens_histo2d_validate(const char *dim, const uint64_t *buckets, size_t buckets_len)
+{
+    if (buckets_len < 2) {
+        optics_fail("invalid histo2d %s bucket length '%lu' < '2'", dim, buckets_len);
+        return false;
+    }
+
+    if (buckets_len > optics_histo2d_buckets_max + 1) {
+        optics_fail("invalid histo2d %s bucket length '%lu' > '%d'",
+                dim, buckets_len, optics_histo2d_buckets_max + 1);
+        return false;
+    }
+
+    for (size_t i = 0; i < buckets_len - 1; ++i) {
+        if (buckets[i] >= buckets[i + 1]) {
+            optics_fail("invalid histo2d %s buckets '%lu:%lu' >= '%lu:%lu'",
+                    dim, i, buckets[i], i + 1, buckets[i + 1]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void lens_histo2d_edges(
+        double *edges, uint64_t *dst, const uint64_t *buckets, size_t buckets_len)
+{
+    memcpy(dst, buckets, buckets_len * sizeof(buckets[0]));
+
+    for (size_t i = 0; i < optics_histo2d_buckets_max + 1; ++i)
+        edges[i] = i < buckets_len ? buckets[i] : INFINITY;
+}
+
+static struct optics_lens *
+lens_histo2d_alloc(
+        struct optics *optics, const char *name,
+        const uint64_t *rows, size_t rows_len,
+        const uint64_t *cols, size_t cols_len)
+{
+    if (!lens_histo2d_validate("row", rows, rows_len)) goto fail_buckets;
+    if (!lens_histo2d_validate("col", cols, cols_len)) goto fail_buckets;
+
+    size_t cells_len = (rows_len + 1) * (cols_len + 1);
+    size_t snapshot_len = (rows_len - 1) * (cols_len - 1);
+
+    size_t len = sizeof(struct lens_histo2d)
+        + (2 * cells_len + snapshot_len) * sizeof(atomic_size_t);
+    struct optics_lens *lens = lens_alloc(optics, optics_histo2d, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_histo2d *histo = lens_sub_ptr(lens, optics_histo2d);
+    if (!histo) goto fail_sub;
+
+    lens_histo2d_edges(histo->row_edges, histo->rows, rows, rows_len);
+    histo->rows_len = rows_len;
+
+    lens_histo2d_edges(histo->col_edges, histo->cols, cols, cols_len);
+    histo->cols_len = cols_len;
+
+    histo->cells_len = cells_len;
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_buckets:
+    return NULL;
+}
+
+// Branch-free count of the edges lower or equal to value over a fixed size
+// array which the compiler can unroll and vectorize. NaN fails every
+// comparison and is therefore counted as below.
+static size_t lens_histo2d_index(const double *edges, double value)
+{
+    size_t i = 0;
+    for (size_t j = 0; j < optics_histo2d_buckets_max + 1; ++j)
+        i += value >= edges[j];
+    return i;
+}
+
+static bool
+lens_histo2d_inc(struct optics_lens *lens, optics_epoch_t epoch, double x, double y)
+{
+    struct lens_histo2d *histo = lens_sub_ptr(lens, optics_histo2d);
+    if (!histo) return false;
+
+    size_t row = lens_histo2d_index(histo->row_edges, x);
+    size_t col = lens_histo2d_index(histo->col_edges, y);
+    size_t i = epoch * histo->cells_len + row * (histo->cols_len + 1) + col;
+
+    atomic_fetch_add_explicit(&histo->counts[i], 1, memory_order_relaxed);
+    return true;
+}
+
+static enum optics_ret
+lens_histo2d_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_histo2d *value)
+{
+    struct lens_histo2d *histo = lens_sub_ptr(lens, optics_histo2d);
+    if (!histo) return optics_err;
+
+    atomic_size_t *counts = &histo->counts[epoch * histo->cells_len];
+    size_t *snapshot = (size_t *) &histo->counts[2 * histo->cells_len];
+
+    value->rows_len = histo->rows_len;
+    memcpy(value->rows, histo->rows, histo->rows_len * sizeof(histo->rows[0]));
+    value->cols_len = histo->cols_len;
+    memcpy(value->cols, histo->cols, histo->cols_len * sizeof(histo->cols[0]));
+
+    value->count = value->outside = 0;
+    value->counts = snapshot;
+
+    for (size_t row = 0; row < histo->rows_len + 1; ++row) {
+        for (size_t col = 0; col < histo->cols_len + 1; ++col) {
+            size_t i = row * (histo->cols_len + 1) + col;
+            size_t count = atomic_exchange_explicit(&counts[i], 0, memory_order_relaxed);
+
+            bool inside = row && row < histo->rows_len && col && col < histo->cols_len;
+            if (!inside) { value->outside += count; continue; }
+
+            snapshot[(row - 1) * (histo->cols_len - 1) + (col - 1)] = count;
+            value->count += count;
+        }
+    }
+
+    return optics_ok;
+}
+
+// Every cell is emitted, including the empty ones, to keep the series of the
+// matrix continuous. Only the first cells fit in the keys cached by the poller
+// so the others are formatted on every poll.
+static bool
+lens_histo2d_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_histo2d *histo = &poll->value.histo2d;
+
+    if (!lens_normalize_emit(norm, 0, "outside", lens_rescale(poll, histo->outside)))
+        return false;
+
+    size_t cols = histo->cols_len - 1;
+    for (size_t row = 0; row < histo->rows_len - 1; ++row) {
+        for (size_t col = 0; col < cols; ++col) {
+            size_t i = row * cols + col;
+            bool ret = lens_normalize_emitf(
+                    norm, i + 1, lens_rescale(poll, histo->counts[i]),
+                    "row_%lu_%lu.col_%lu_%lu",
+                    histo->rows[row], histo->rows[row + 1],
+                    histo->cols[col], histo->cols[col + 1]);
+            if (!ret) return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,161 @@
+/* lens_hll.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   HyperLogLog estimate of the number of distinct keys recorded during each
+   poll interval. The top precision bits of the hash select a register and the
+   register keeps the largest rank seen, the rank being the position of the
+   first set bit in the remaining bits. Recording is a relaxed load which, for
+   a register that is already large enough (the vast majority of records once
+   the register fills up), is all it costs; otherwise it's a CAS loop on a
+   single byte.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The registers of both epochs are followed by a snapshot of the registers of
+// the last read which is what the registers of struct optics_hll point to. The
+// snapshot is only ever touched by the poller.
+
+struct lens_hll
+{
+    size_t precision;
+    size_t registers_len;
+
+    atomic_uchar registers[] optics_align(cache_line_len);
+};
+
+static_assert(sizeof(atomic_uchar) == sizeof(uint8_t),
+        "hll registers need to be a single byte");
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_hll_alloc(struct optics *optics, const char *name, size_t precision)
+{
+    if (precision < optics_hll_precision_min || precision > optics_hll_precision_max) {
+        optics_fail("invalid hll precision '%zu' not in [%d, %d]",
+                precision, optics_hll_precision_min, optics_hll_precision_max);
+        goto fail_precision;
+    }
+
+    size_t registers = 1UL << precision;
+    size_t len = sizeof(struct lens_hll) + 3 * registers * sizeof(atomic_uchar);
+    struct optics_lens *lens = lens_alloc(optics, optics_hll, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_hll *hll = lens_sub_ptr(lens, optics_hll);
+    if (!hll) goto fail_sub;
+
+    hll->precision = precision;
+    hll->registers_len = registers;
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_precision:
+    return NULL;
+}
+
+static void lens_hll_sub_add(struct lens_hll *hll, optics_epoch_t epoch, uint64_t hash)
+{
+    size_t index = hash >> (64 - hll->precision);
+
+    // The sentinel bit bounds the rank to 64 - precision + 1 when the remaining
+    // bits are all zeroes.
+    uint64_t rest = (hash << hll->precision) | (1UL << (hll->precision - 1));
+    unsigned char rank = clz(rest) + 1;
+
+    atomic_uchar *reg = &hll->registers[epoch * hll->registers_len + index];
+    unsigned char old = atomic_load_explicit(reg, memory_order_relaxed);
+
+    while (old < rank) {
+        bool ok = atomic_compare_exchange_weak_explicit(
+                reg, &old, rank, memory_order_relaxed, memory_order_relaxed);
+        if (ok) break;
+    }
+}
+
+// String hashes are remixed since FNV-1a leaves the high bits of short keys,
+// which select the register, poorly distributed.
+static bool lens_hll_add(struct optics_lens *lens, optics_epoch_t epoch, const char *key)
+{
+    struct lens_hll *hll = lens_sub_ptr(lens, optics_hll);
+    if (!hll) return false;
+
+    lens_hll_sub_add(hll, epoch, lens_hash_mix(htable_hash(key)));
+    return true;
+}
+
+static bool lens_hll_add_id(struct optics_lens *lens, optics_epoch_t epoch, uint64_t id)
+{
+    struct lens_hll *hll = lens_sub_ptr(lens, optics_hll);
+    if (!hll) return false;
+
+    lens_hll_sub_add(hll, epoch, lens_hash_mix(id));
+    return true;
+}
+
+// Flajolet et al. bias correction constant for the given number of registers.
+static double lens_hll_alpha(size_t registers)
+{
+    switch (registers) {
+    case 16: return 0.673;
+    case 32: return 0.697;
+    case 64: return 0.709;
+    default: return 0.7213 / (1.0 + 1.079 / registers);
+    }
+}
+
+static double lens_hll_estimate(const uint8_t *registers, size_t len)
+{
+    double sum = 0;
+    size_t zeroes = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        sum += ldexp(1.0, -(int) registers[i]);
+        if (!registers[i]) zeroes++;
+    }
+
+    double m = len;
+    double estimate = lens_hll_alpha(len) * m * m / sum;
+
+    // Small range correction through linear counting. Large range corrections
+    // aren't needed with a 64-bit hash.
+    if (estimate <= 2.5 * m && zeroes) estimate = m * log(m / zeroes);
+
+    return estimate;
+}
+
+static enum optics_ret
+lens_hll_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_hll *value)
+{
+    struct lens_hll *hll = lens_sub_ptr(lens, optics_hll);
+    if (!hll) return optics_err;
+
+    atomic_uchar *registers = &hll->registers[epoch * hll->registers_len];
+    uint8_t *snapshot = (uint8_t *) &hll->registers[2 * hll->registers_len];
+
+    for (size_t i = 0; i < hll->registers_len; ++i)
+        snapshot[i] = atomic_exchange_explicit(&registers[i], 0, memory_order_relaxed);
+
+    value->precision = hll->precision;
+    value->registers_len = hll->registers_len;
+    value->registers = snapshot;
+    value->estimate = lens_hll_estimate(snapshot, hll->registers_len);
+
+    return optics_ok;
+}
+
+// The estimate is a number of distinct keys over the poll interval so it's
+// not rescaled. The registers are left to the backends that can ship them.
+static bool
+lens_hll_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    return lens_normalize_emit(norm, 0, NULL, poll->value.hll.estimate);
+}
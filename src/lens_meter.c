@@ -0,0 +1,103 @@
+/* lens_meter.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Meters record like counters but also keep 1, 5 and 15 minute exponentially
+   weighted moving averages of the rate which are decayed on every read using
+   the time elapsed since the previous read. The averages are the only state
+   that survives an epoch change and they're only ever touched by the reader.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+enum { lens_meter_rates = 3 };
+
+// Windows of the moving averages in seconds.
+static const double lens_meter_windows[lens_meter_rates] = { 60, 5 * 60, 15 * 60 };
+
+struct lens_meter
+{
+    atomic_int_fast64_t count[2];
+
+    // Serializes the readers such that the averages are decayed once per read.
+    struct slock lock;
+
+    // The first read seeds the averages with its rate instead of decaying from
+    // zero which would take several windows to converge.
+    bool primed;
+    double rates[lens_meter_rates];
+};
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_meter_alloc(struct optics *optics, const char *name)
+{
+    return lens_alloc(optics, optics_meter, sizeof(struct lens_meter), name);
+}
+
+static bool
+lens_meter_mark(struct optics_lens *lens, optics_epoch_t epoch, int64_t value)
+{
+    struct lens_meter *meter = lens_sub_ptr(lens, optics_meter);
+    if (!meter) return false;
+
+    atomic_fetch_add_explicit(&meter->count[epoch], value, memory_order_relaxed);
+    return true;
+}
+
+static void lens_meter_decay(struct lens_meter *meter, int64_t count, optics_ts_t elapsed)
+{
+    if (!elapsed) elapsed = 1;
+    double rate = (double) count / elapsed;
+
+    if (!meter->primed) {
+        for (size_t i = 0; i < lens_meter_rates; ++i) meter->rates[i] = rate;
+        meter->primed = true;
+        return;
+    }
+
+    for (size_t i = 0; i < lens_meter_rates; ++i) {
+        double alpha = 1.0 - exp(-(double) elapsed / lens_meter_windows[i]);
+        meter->rates[i] += alpha * (rate - meter->rates[i]);
+    }
+}
+
+static enum optics_ret
+lens_meter_read(
+        struct optics_lens *lens,
+        optics_epoch_t epoch,
+        optics_ts_t elapsed,
+        struct optics_meter *value)
+{
+    struct lens_meter *meter = lens_sub_ptr(lens, optics_meter);
+    if (!meter) return optics_err;
+
+    if (!slock_try_lock(&meter->lock)) return optics_busy;
+
+    value->count = atomic_exchange_explicit(&meter->count[epoch], 0, memory_order_relaxed);
+    lens_meter_decay(meter, value->count, elapsed);
+
+    value->m1 = meter->rates[0];
+    value->m5 = meter->rates[1];
+    value->m15 = meter->rates[2];
+
+    slock_unlock(&meter->lock);
+    return optics_ok;
+}
+
+static bool
+lens_meter_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_meter *meter = &poll->value.meter;
+
+    return lens_normalize_emit(norm, 0, "rate", lens_rescale(poll, meter->count))
+        && lens_normalize_emit(norm, 1, "m1", meter->m1)
+        && lens_normalize_emit(norm, 2, "m5", meter->m5)
+        && lens_normalize_emit(norm, 3, "m15", meter->m15);
+}
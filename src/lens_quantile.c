@@ -1,6 +1,12 @@
 /* lens_quantile.c
    Marina C., 19 Feb 2018
    FreeBSD-style copyright and disclaimer apply
+
+   Adaptive quantiles follow Frugal-2U where the step, counted in adjustment
+   values, grows by one while the estimate keeps moving in the same direction
+   and shrinks on reversals. The estimate, the step and the last direction are
+   packed in a single word such that they're all updated by the same CAS: the
+   low bits of the estimate's mantissa are given up to hold the other two.
 */
 
 // -----------------------------------------------------------------------------
@@ -14,6 +20,22 @@ struct lens_quantile
      double adjustment_value;
      atomic_int_fast64_t multiplier;
      atomic_int_fast64_t count[2];
+
+     bool adaptive;
+     atomic_uint_fast64_t state;
+};
+
+// Leaves 35 bits of mantissa to the estimate which is far more precise than
+// the estimator itself.
+enum
+{
+    lens_quantile_step_bits = 16,
+    lens_quantile_step_mask = (1 << lens_quantile_step_bits) - 1,
+    lens_quantile_step_max = INT16_MAX,
+    lens_quantile_step_min = INT16_MIN,
+
+    lens_quantile_up = 1 << lens_quantile_step_bits,
+    lens_quantile_state_mask = lens_quantile_up | lens_quantile_step_mask,
 };
 
 // -----------------------------------------------------------------------------
@@ -46,21 +68,78 @@ lens_quantile_alloc(
     return NULL;
 }
 
+static uint64_t lens_quantile_state_pack(double estimate, int step, bool up)
+{
+    uint64_t bits = pun_dtoi(estimate) & ~(uint64_t) lens_quantile_state_mask;
+    if (up) bits |= lens_quantile_up;
+    return bits | (uint16_t) (int16_t) step;
+}
+
+static double lens_quantile_state_estimate(uint64_t state)
+{
+    return pun_itod(state & ~(uint64_t) lens_quantile_state_mask);
+}
+
+static int lens_quantile_state_step(uint64_t state)
+{
+    return (int16_t) (state & lens_quantile_step_mask);
+}
+
+static bool lens_quantile_state_up(uint64_t state)
+{
+    return state & lens_quantile_up;
+}
+
+static struct optics_lens *
+lens_quantile_adaptive_alloc(
+        struct optics *optics,
+        const char *name,
+        double target_quantile,
+        double original_estimate,
+        double adjustment_value)
+{
+    if (!(adjustment_value > 0)) {
+        optics_fail("invalid adjustment value '%g' for adaptive quantile '%s'",
+                adjustment_value, name);
+        return NULL;
+    }
+
+    struct optics_lens *lens = lens_quantile_alloc(
+            optics, name, target_quantile, original_estimate, adjustment_value);
+    if (!lens) goto fail_alloc;
+
+    struct lens_quantile *quantile = lens_sub_ptr(lens, optics_quantile);
+    if (!quantile) goto fail_sub;
+
+    quantile->adaptive = true;
+    atomic_init(&quantile->state, lens_quantile_state_pack(original_estimate, 1, true));
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+    return NULL;
+}
+
 static double calculate_quantile(struct lens_quantile *quantile)
 {
-    size_t adjustment =
+    if (quantile->adaptive) {
+        uint64_t state = atomic_load_explicit(&quantile->state, memory_order_relaxed);
+        return lens_quantile_state_estimate(state);
+    }
+
+    // The multiplier goes negative when the quantile is below the original
+    // estimate so the adjustment must stay signed.
+    double adjustment =
         atomic_load_explicit(&quantile->multiplier, memory_order_relaxed) *
         quantile->adjustment_value;
 
     return quantile->original_estimate + adjustment;
 }
 
-static bool
-lens_quantile_update(struct optics_lens *lens, optics_epoch_t epoch, double value)
+static void lens_quantile_fixed_update(struct lens_quantile *quantile, double value)
 {
-    struct lens_quantile *quantile = lens_sub_ptr(lens, optics_quantile);
-    if (!quantile) return false;
-
     double current_estimate = calculate_quantile(quantile);
     bool probability_check = rng_gen_prob(rng_global(), quantile->target_quantile);
 
@@ -70,7 +149,63 @@ lens_quantile_update(struct optics_lens *lens, optics_epoch_t epoch, double valu
     }
     else {
         if (probability_check)
-             atomic_fetch_add_explicit(&quantile->multiplier, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&quantile->multiplier, 1, memory_order_relaxed);
+    }
+}
+
+// Steps below one still move the estimate by a single adjustment value but
+// need that many moves in the same direction before growing again. The step is
+// also reduced by however much the estimate overshot the value and reversals
+// reset large steps to one.
+static void lens_quantile_adaptive_update(struct lens_quantile *quantile, double value)
+{
+    bool probability_check = rng_gen_prob(rng_global(), quantile->target_quantile);
+    double unit = quantile->adjustment_value;
+
+    uint64_t old = atomic_load_explicit(&quantile->state, memory_order_relaxed);
+    uint64_t new;
+
+    do {
+        double estimate = lens_quantile_state_estimate(old);
+        int step = lens_quantile_state_step(old);
+        bool was_up = lens_quantile_state_up(old);
+
+        bool up;
+        if (value > estimate && probability_check) up = true;
+        else if (value < estimate && !probability_check) up = false;
+        else return;
+
+        step += up == was_up ? 1 : -1;
+        double delta = (step > 0 ? step : 1) * unit;
+        double next = up ? estimate + delta : estimate - delta;
+
+        if (up ? next > value : next < value) {
+            step -= ceil(fabs(next - value) / unit);
+            next = value;
+        }
+
+        if (up != was_up && step > 1) step = 1;
+
+        if (step > lens_quantile_step_max) step = lens_quantile_step_max;
+        if (step < lens_quantile_step_min) step = lens_quantile_step_min;
+
+        new = lens_quantile_state_pack(next, step, up);
+
+    } while (!atomic_compare_exchange_weak_explicit(
+                    &quantile->state, &old, new,
+                    memory_order_relaxed, memory_order_relaxed));
+}
+
+static bool
+lens_quantile_update(struct optics_lens *lens, optics_epoch_t epoch, double value)
+{
+    struct lens_quantile *quantile = lens_sub_ptr(lens, optics_quantile);
+    if (!quantile) return false;
+
+    // Calls that aren't sampled only count towards the count.
+    if (lens_sample(lens)) {
+        if (quantile->adaptive) lens_quantile_adaptive_update(quantile, value);
+        else lens_quantile_fixed_update(quantile, value);
     }
 
     // Since we don't care too much how exact the count is (not used to modify
@@ -91,13 +226,13 @@ lens_quantile_read(
     value->sample = calculate_quantile(quantile);
     value->count =
         atomic_exchange_explicit(&quantile->count[epoch], 0, memory_order_relaxed);
-    
+    lens_sample_adapt(lens, value->count);
+
     return optics_ok;
 }
 
 static bool
-lens_quantile_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+lens_quantile_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
 {
-    return cb(ctx, poll->ts, poll->key, poll->value.quantile.sample);
+    return lens_normalize_emit(norm, 0, NULL, poll->value.quantile.sample);
 }
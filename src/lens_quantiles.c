@@ -0,0 +1,179 @@
+/* lens_quantiles.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Tracks multiple quantiles of the same series using the same stochastic walk
+   as lens_quantile. A single random number is drawn per update and compared
+   against every target which keeps the marginal probability of each walk
+   unchanged while amortizing the rng and the lens lookup across all targets.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_quantiles
+{
+    size_t len;
+    double original_estimate;
+    double adjustment_value;
+
+    double targets[optics_quantiles_max];
+    uint64_t thresholds[optics_quantiles_max];
+
+    atomic_int_fast64_t multipliers[optics_quantiles_max];
+    atomic_size_t count[2];
+};
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_quantiles_alloc(
+        struct optics *optics,
+        const char *name,
+        const double *targets,
+        size_t len,
+        double original_estimate,
+        double adjustment_value)
+{
+    if (!len || len > optics_quantiles_max) {
+        optics_fail("invalid quantiles length '%zu' not in [1, %d]",
+                len, optics_quantiles_max);
+        goto fail_args;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        if (!(targets[i] > 0 && targets[i] < 1)) {
+            optics_fail("invalid quantile '%zu:%g' not in (0, 1)", i, targets[i]);
+            goto fail_args;
+        }
+
+        if (i && targets[i - 1] >= targets[i]) {
+            optics_fail("invalid quantiles '%zu:%g' >= '%zu:%g'",
+                    i - 1, targets[i - 1], i, targets[i]);
+            goto fail_args;
+        }
+    }
+
+    struct optics_lens *lens =
+        lens_alloc(optics, optics_quantiles, sizeof(struct lens_quantiles), name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_quantiles *quantiles = lens_sub_ptr(lens, optics_quantiles);
+    if (!quantiles) goto fail_sub;
+
+    quantiles->len = len;
+    quantiles->original_estimate = original_estimate;
+    quantiles->adjustment_value = adjustment_value;
+
+    for (size_t i = 0; i < len; ++i) {
+        quantiles->targets[i] = targets[i];
+        quantiles->thresholds[i] = (uint64_t) (targets[i] * rng_max());
+    }
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_args:
+    return NULL;
+}
+
+static double lens_quantiles_estimate(struct lens_quantiles *quantiles, size_t i)
+{
+    int64_t multiplier =
+        atomic_load_explicit(&quantiles->multipliers[i], memory_order_relaxed);
+    return quantiles->original_estimate + multiplier * quantiles->adjustment_value;
+}
+
+static bool
+lens_quantiles_update(struct optics_lens *lens, optics_epoch_t epoch, double value)
+{
+    struct lens_quantiles *quantiles = lens_sub_ptr(lens, optics_quantiles);
+    if (!quantiles) return false;
+
+    // Calls that aren't sampled only count towards the count.
+    if (lens_sample(lens)) {
+        // Equivalent to rng_gen_prob for each target but with a single draw.
+        uint64_t prob = rng_gen(rng_global());
+
+        for (size_t i = 0; i < quantiles->len; ++i) {
+            bool probability_check = prob <= quantiles->thresholds[i];
+
+            if (value < lens_quantiles_estimate(quantiles, i)) {
+                if (!probability_check)
+                    atomic_fetch_sub_explicit(&quantiles->multipliers[i], 1, memory_order_relaxed);
+            }
+            else {
+                if (probability_check)
+                    atomic_fetch_add_explicit(&quantiles->multipliers[i], 1, memory_order_relaxed);
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&quantiles->count[epoch], 1, memory_order_relaxed);
+
+    return true;
+}
+
+static enum optics_ret
+lens_quantiles_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_quantiles *value)
+{
+    struct lens_quantiles *quantiles = lens_sub_ptr(lens, optics_quantiles);
+    if (!quantiles) return optics_err;
+
+    value->len = quantiles->len;
+    for (size_t i = 0; i < quantiles->len; ++i) {
+        value->quantiles[i] = quantiles->targets[i];
+        value->samples[i] = lens_quantiles_estimate(quantiles, i);
+    }
+
+    value->count =
+        atomic_exchange_explicit(&quantiles->count[epoch], 0, memory_order_relaxed);
+    lens_sample_adapt(lens, value->count);
+
+    return optics_ok;
+}
+
+// Formats the quantile as the digits following the decimal point padded to
+// two digits such that 0.5 becomes p50 and 0.999 becomes p999. This avoids
+// using dots in keys which are used as separators by carbon.
+static size_t lens_quantiles_key(double quantile, char *dst, size_t len)
+{
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%.6f", quantile);
+    while (n > 2 && buffer[n - 1] == '0') buffer[--n] = '\0';
+
+    const char *digits = buffer + 2;
+    return snprintf(dst, len, "p%s%s", digits, n < 4 ? "0" : "");
+}
+
+static bool
+lens_quantiles_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_quantiles *quantiles = &poll->value.quantiles;
+
+    if (!lens_normalize_emit(norm, 0, "count", lens_rescale(poll, quantiles->count)))
+        return false;
+
+    for (size_t i = 0; i < quantiles->len; ++i) {
+        size_t slot = i + 1;
+        const char *suffix = NULL;
+
+        char name[32];
+        if (!lens_normalize_cached(norm, slot)) {
+            lens_quantiles_key(quantiles->quantiles[i], name, sizeof(name));
+            suffix = name;
+        }
+
+        if (!lens_normalize_emit(norm, slot, suffix, quantiles->samples[i]))
+            return false;
+    }
+
+    return true;
+}
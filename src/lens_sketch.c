@@ -0,0 +1,223 @@
+/* lens_sketch.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   DDSketch style quantile sketch. Positive values are mapped to the bucket
+   ceil(log_gamma(value)) where gamma = (1 + alpha) / (1 - alpha) which
+   guarantees that any quantile is answered with a relative error of at most
+   alpha. Since bucket indexes only depend on alpha, the counts of two sketches
+   with the same alpha can be merged by summing them index by index.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_sketch
+{
+    double alpha;
+    double gamma;
+    double log_gamma;
+
+    int64_t offset;
+    size_t buckets_len;
+
+    // Each epoch and the snapshot hold buckets_len + 1 counters where the first
+    // counter tracks the values that are zero or negative. The snapshot holds
+    // the result of the last read and is only ever touched by the poller.
+    atomic_size_t counts[];
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static int64_t lens_sketch_key(double log_gamma, double value)
+{
+    return ceil(log(value) / log_gamma);
+}
+
+static size_t lens_sketch_index(const struct lens_sketch *sketch, double value)
+{
+    // Also catches NaN which is lumped in with the zero counter.
+    if (!(value > 0)) return 0;
+
+    int64_t i = lens_sketch_key(sketch->log_gamma, value) - sketch->offset;
+    i = i < 0 ? 0 : i;
+    i = i >= (int64_t) sketch->buckets_len ? (int64_t) sketch->buckets_len - 1 : i;
+    return i + 1;
+}
+
+static double lens_sketch_value_at(double gamma, int64_t key)
+{
+    // Value that minimizes the relative error over (gamma^(key-1), gamma^key].
+    return 2 * pow(gamma, key) / (gamma + 1);
+}
+
+static double lens_sketch_quantile(const struct optics_sketch *value, double quantile)
+{
+    if (!value->count) return 0;
+
+    size_t rank = quantile * (value->count - 1);
+
+    size_t sum = value->zero;
+    if (sum > rank) return 0;
+
+    for (size_t i = 0; i < value->buckets_len; ++i) {
+        sum += value->counts[i];
+        if (sum > rank) return lens_sketch_value_at(value->gamma, value->offset + i);
+    }
+
+    optics_fail("sketch rank '%zu' out of bounds '%zu'", rank, value->count);
+    return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_sketch_alloc(
+        struct optics *optics, const char *name,
+        double alpha, double lowest, double highest)
+{
+    if (!(alpha > 0 && alpha < 1)) {
+        optics_fail("invalid sketch alpha '%g' not in (0, 1)", alpha);
+        goto fail_args;
+    }
+
+    if (!(lowest > 0)) {
+        optics_fail("invalid sketch lowest value '%g' <= 0", lowest);
+        goto fail_args;
+    }
+
+    if (!(highest > lowest)) {
+        optics_fail("invalid sketch range '%g' >= '%g'", lowest, highest);
+        goto fail_args;
+    }
+
+    double gamma = (1 + alpha) / (1 - alpha);
+    double log_gamma = log(gamma);
+
+    int64_t offset = lens_sketch_key(log_gamma, lowest);
+    size_t buckets_len = lens_sketch_key(log_gamma, highest) - offset + 1;
+
+    if (buckets_len > optics_sketch_buckets_max) {
+        optics_fail("too many sketch buckets for range '%g'-'%g' with alpha '%g': %zu > %d",
+                lowest, highest, alpha, buckets_len, optics_sketch_buckets_max);
+        goto fail_args;
+    }
+
+    size_t len = sizeof(struct lens_sketch) + 3 * (buckets_len + 1) * sizeof(atomic_size_t);
+    struct optics_lens *lens = lens_alloc(optics, optics_sketch, len, name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_sketch *sketch = lens_sub_ptr(lens, optics_sketch);
+    if (!sketch) goto fail_sub;
+
+    sketch->alpha = alpha;
+    sketch->gamma = gamma;
+    sketch->log_gamma = log_gamma;
+    sketch->offset = offset;
+    sketch->buckets_len = buckets_len;
+
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_args:
+    return NULL;
+}
+
+static void
+lens_sketch_sub_record(struct lens_sketch *sketch, optics_epoch_t epoch, double value)
+{
+    size_t i = epoch * (sketch->buckets_len + 1) + lens_sketch_index(sketch, value);
+    atomic_fetch_add_explicit(&sketch->counts[i], 1, memory_order_relaxed);
+}
+
+static bool
+lens_sketch_record(struct optics_lens *lens, optics_epoch_t epoch, double value)
+{
+    struct lens_sketch *sketch = lens_sub_ptr(lens, optics_sketch);
+    if (!sketch) return false;
+
+    lens_sketch_sub_record(sketch, epoch, value);
+    return true;
+}
+
+// Expects the count to be set.
+static void lens_sketch_summarize(struct optics_sketch *value)
+{
+    value->p50 = lens_sketch_quantile(value, 0.50);
+    value->p90 = lens_sketch_quantile(value, 0.90);
+    value->p99 = lens_sketch_quantile(value, 0.99);
+
+    value->max = 0;
+    for (size_t i = value->buckets_len; i > 0; --i) {
+        if (!value->counts[i - 1]) continue;
+        value->max = lens_sketch_value_at(value->gamma, value->offset + (i - 1));
+        break;
+    }
+}
+
+static enum optics_ret
+lens_sketch_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_sketch *value)
+{
+    struct lens_sketch *sketch = lens_sub_ptr(lens, optics_sketch);
+    if (!sketch) return optics_err;
+
+    size_t len = sketch->buckets_len + 1;
+    atomic_size_t *counts = &sketch->counts[epoch * len];
+    size_t *snapshot = (size_t *) &sketch->counts[2 * len];
+
+    value->count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        snapshot[i] = atomic_exchange_explicit(&counts[i], 0, memory_order_relaxed);
+        value->count += snapshot[i];
+    }
+
+    value->alpha = sketch->alpha;
+    value->gamma = sketch->gamma;
+    value->offset = sketch->offset;
+    value->zero = snapshot[0];
+    value->buckets_len = sketch->buckets_len;
+    value->counts = snapshot + 1;
+
+    lens_sketch_summarize(value);
+    return optics_ok;
+}
+
+static bool
+lens_sketch_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_sketch *sketch = &poll->value.sketch;
+
+    bool ret = lens_normalize_emit(norm, 0, "count", lens_rescale(poll, sketch->count))
+        && lens_normalize_emit(norm, 1, "p50", sketch->p50)
+        && lens_normalize_emit(norm, 2, "p90", sketch->p90)
+        && lens_normalize_emit(norm, 3, "p99", sketch->p99)
+        && lens_normalize_emit(norm, 4, "max", sketch->max);
+    if (!ret) return false;
+
+    if (sketch->zero) {
+        ret = lens_normalize_emit(norm, 5, "zero", lens_rescale(poll, sketch->zero));
+        if (!ret) return false;
+    }
+
+    // Buckets are keyed by their absolute index which only depends on alpha
+    // so that they can be summed across hosts downstream. Like the hdr buckets
+    // they're sparse and therefore never cached.
+    for (size_t i = 0; i < sketch->buckets_len; ++i) {
+        if (!sketch->counts[i]) continue;
+
+        ret = lens_normalize_emit_bucket(
+                norm, lens_rescale(poll, sketch->counts[i]), sketch->offset + (int64_t) i);
+        if (!ret) return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,285 @@
+/* lens_topk.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Heavy-hitters tracked with the Space-Saving algorithm: each shard keeps a
+   fixed number of slots and a key that isn't tracked evicts the slot with the
+   smallest count, inheriting that count as its error. Keys are routed to a
+   shard by their hash so every key is only ever tracked by a single shard and
+   the shards can be merged by a simple selection of the largest counts.
+
+   Keys are only identified by their 64-bit hash which means that colliding
+   keys are merged; a risk we accept given the error already inherent to the
+   algorithm.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// Everything is laid out in the variable sized data of the lens:
+//
+//   [epoch 0: shard 0, shard 1...][epoch 1: shard 0, shard 1...][snapshot]
+//
+// The snapshot holds the top k keys of the last read and is what the entries
+// of struct optics_topk point to. It's only ever touched by the poller.
+
+enum
+{
+    lens_topk_shards = 8,
+
+    // Slots tracked by each shard for every key reported. Each shard must be
+    // able to hold all the top keys since nothing stops them from hashing to
+    // the same shard and the extra slots reduce the error of the estimates.
+    lens_topk_slots_factor = 2,
+};
+
+struct lens_topk_slot
+{
+    uint64_t hash;
+    size_t count;
+    size_t error;
+    char key[optics_topk_key_max];
+};
+
+struct lens_topk_shard
+{
+    struct slock lock;
+    size_t len;
+    size_t count;
+    struct lens_topk_slot slots[];
+};
+
+struct lens_topk
+{
+    size_t k;
+    size_t slots_len;
+    size_t shard_len;
+
+    uint8_t data[] optics_align(cache_line_len);
+};
+
+
+// -----------------------------------------------------------------------------
+// layout
+// -----------------------------------------------------------------------------
+
+static size_t lens_topk_shard_len(size_t slots)
+{
+    size_t len = sizeof(struct lens_topk_shard) + slots * sizeof(struct lens_topk_slot);
+    return align(len, cache_line_len);
+}
+
+static size_t lens_topk_len(size_t k)
+{
+    size_t slots = k * lens_topk_slots_factor;
+    return sizeof(struct lens_topk)
+        + 2 * lens_topk_shards * lens_topk_shard_len(slots)
+        + k * sizeof(struct optics_topk_entry);
+}
+
+static struct lens_topk_shard *
+lens_topk_shard(struct lens_topk *topk, optics_epoch_t epoch, size_t i)
+{
+    size_t index = epoch * lens_topk_shards + i;
+    return (struct lens_topk_shard *) (topk->data + index * topk->shard_len);
+}
+
+static struct optics_topk_entry *lens_topk_snapshot(struct lens_topk *topk)
+{
+    return (struct optics_topk_entry *)
+        (topk->data + 2 * lens_topk_shards * topk->shard_len);
+}
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *
+lens_topk_alloc(struct optics *optics, const char *name, size_t k)
+{
+    if (!k || k > optics_topk_max) {
+        optics_fail("invalid topk size '%zu' not in [1, %d]", k, optics_topk_max);
+        goto fail_k;
+    }
+
+    struct optics_lens *lens = lens_alloc(optics, optics_topk, lens_topk_len(k), name);
+    if (!lens) goto fail_alloc;
+
+    struct lens_topk *topk = lens_sub_ptr(lens, optics_topk);
+    if (!topk) goto fail_sub;
+
+    topk->k = k;
+    topk->slots_len = k * lens_topk_slots_factor;
+    topk->shard_len = lens_topk_shard_len(topk->slots_len);
+    return lens;
+
+  fail_sub:
+    lens_free(lens);
+  fail_alloc:
+  fail_k:
+    return NULL;
+}
+
+// Keys end up as a component of the normalized keys and in the rendered output
+// of the backends so anything that could be mistaken for a separator or would
+// need escaping is replaced.
+static void lens_topk_key_copy(char *dst, const char *src)
+{
+    size_t i = 0;
+    for (; i < optics_topk_key_max - 1 && src[i]; ++i) {
+        char c = src[i];
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c == '-' || c == ':';
+        dst[i] = valid ? c : '_';
+    }
+    dst[i] = '\0';
+}
+
+// Numeric keys are only formatted when they start being tracked which keeps the
+// common case of an already tracked key free of any formatting.
+static void lens_topk_key_set(struct lens_topk_slot *slot, const char *key, uint64_t id)
+{
+    if (key) lens_topk_key_copy(slot->key, key);
+    else (void) snprintf(slot->key, sizeof(slot->key), "%lu", id);
+}
+
+static void lens_topk_sub_inc(
+        struct lens_topk *topk, optics_epoch_t epoch,
+        uint64_t hash, const char *key, uint64_t id, size_t value)
+{
+    struct lens_topk_shard *shard = lens_topk_shard(topk, epoch, hash % lens_topk_shards);
+    slock_lock(&shard->lock);
+
+    shard->count += value;
+
+    struct lens_topk_slot *slot = NULL;
+    for (size_t i = 0; i < shard->len; ++i) {
+        if (shard->slots[i].hash != hash) continue;
+        slot = &shard->slots[i];
+        break;
+    }
+
+    if (slot) slot->count += value;
+
+    else if (shard->len < topk->slots_len) {
+        slot = &shard->slots[shard->len++];
+        slot->hash = hash;
+        slot->count = value;
+        slot->error = 0;
+        lens_topk_key_set(slot, key, id);
+    }
+
+    else {
+        slot = &shard->slots[0];
+        for (size_t i = 1; i < shard->len; ++i) {
+            if (shard->slots[i].count < slot->count)
+                slot = &shard->slots[i];
+        }
+
+        slot->hash = hash;
+        slot->error = slot->count;
+        slot->count += value;
+        lens_topk_key_set(slot, key, id);
+    }
+
+    slock_unlock(&shard->lock);
+}
+
+static bool
+lens_topk_inc(struct optics_lens *lens, optics_epoch_t epoch, const char *key, size_t value)
+{
+    struct lens_topk *topk = lens_sub_ptr(lens, optics_topk);
+    if (!topk) return false;
+
+    lens_topk_sub_inc(topk, epoch, htable_hash(key), key, 0, value);
+    return true;
+}
+
+static bool
+lens_topk_inc_id(struct optics_lens *lens, optics_epoch_t epoch, uint64_t id, size_t value)
+{
+    struct lens_topk *topk = lens_sub_ptr(lens, optics_topk);
+    if (!topk) return false;
+
+    lens_topk_sub_inc(topk, epoch, lens_hash_mix(id), NULL, id, value);
+    return true;
+}
+
+// Keeps the snapshot sorted by decreasing count through an insertion sort which
+// is plenty fast given the small bound on k.
+static void lens_topk_select(
+        struct lens_topk *topk, struct optics_topk *value, const struct lens_topk_slot *slot)
+{
+    struct optics_topk_entry *entries = lens_topk_snapshot(topk);
+
+    size_t i = value->len;
+    if (i == topk->k) {
+        if (slot->count <= entries[i - 1].count) return;
+        i--;
+    }
+    else value->len++;
+
+    for (; i > 0 && entries[i - 1].count < slot->count; --i)
+        entries[i] = entries[i - 1];
+
+    entries[i].count = slot->count;
+    entries[i].error = slot->error;
+    memcpy(entries[i].key, slot->key, sizeof(entries[i].key));
+}
+
+static enum optics_ret
+lens_topk_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_topk *value)
+{
+    struct lens_topk *topk = lens_sub_ptr(lens, optics_topk);
+    if (!topk) return optics_err;
+
+    // Since we're not locking the active epoch, we should only contend with
+    // stragglers which can be dealt with by the poller. Every shard is locked
+    // before any is reset so that a busy read leaves the epoch untouched.
+    for (size_t i = 0; i < lens_topk_shards; ++i) {
+        if (slock_try_lock(&lens_topk_shard(topk, epoch, i)->lock)) continue;
+
+        while (i > 0) slock_unlock(&lens_topk_shard(topk, epoch, --i)->lock);
+        return optics_busy;
+    }
+
+    value->count = 0;
+    value->len = 0;
+    value->entries = lens_topk_snapshot(topk);
+
+    for (size_t i = 0; i < lens_topk_shards; ++i) {
+        struct lens_topk_shard *shard = lens_topk_shard(topk, epoch, i);
+
+        value->count += shard->count;
+        for (size_t j = 0; j < shard->len; ++j)
+            lens_topk_select(topk, value, &shard->slots[j]);
+
+        shard->count = 0;
+        shard->len = 0;
+
+        slock_unlock(&shard->lock);
+    }
+
+    return optics_ok;
+}
+
+// The top keys change from one poll to the next so their keys are never
+// cached.
+static bool
+lens_topk_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_topk *topk = &poll->value.topk;
+
+    if (!lens_normalize_emit(norm, 0, "count", lens_rescale(poll, topk->count)))
+        return false;
+
+    for (size_t i = 0; i < topk->len; ++i) {
+        const struct optics_topk_entry *entry = &topk->entries[i];
+        bool ret = lens_normalize_emit(
+                norm, lens_normalize_uncached, entry->key, lens_rescale(poll, entry->count));
+        if (!ret) return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,126 @@
+/* lens_updown.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Up/down gauges are integer gauges that are changed by deltas instead of
+   being set which makes them safe to update from multiple threads. Like
+   regular gauges, the value doesn't respect epochs and is retained across
+   epoch changes. The min and max watermarks are instead kept per epoch and
+   only touched by the writers that move the value past them.
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct lens_updown_epoch
+{
+    atomic_int_fast64_t min;
+    atomic_int_fast64_t max;
+};
+
+struct lens_updown
+{
+    atomic_int_fast64_t value;
+    struct lens_updown_epoch epochs[2];
+};
+
+
+// -----------------------------------------------------------------------------
+// impl
+// -----------------------------------------------------------------------------
+
+// The epoch being recorded starts from the initial zero value while the other
+// epoch will be seeded by the first read.
+static struct optics_lens *
+lens_updown_alloc(struct optics *optics, const char *name)
+{
+    struct optics_lens *lens =
+        lens_alloc(optics, optics_updown, sizeof(struct lens_updown), name);
+    if (!lens) return NULL;
+
+    struct lens_updown *updown = lens_sub_ptr(lens, optics_updown);
+    struct lens_updown_epoch *other = &updown->epochs[!optics_epoch(optics)];
+    atomic_init(&other->min, INT64_MAX);
+    atomic_init(&other->max, INT64_MIN);
+
+    return lens;
+}
+
+static void lens_updown_watermark_min(atomic_int_fast64_t *min, int64_t value)
+{
+    int64_t old = atomic_load_explicit(min, memory_order_relaxed);
+    while (value < old) {
+        if (atomic_compare_exchange_weak_explicit(
+                        min, &old, value, memory_order_relaxed, memory_order_relaxed))
+            return;
+    }
+}
+
+static void lens_updown_watermark_max(atomic_int_fast64_t *max, int64_t value)
+{
+    int64_t old = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > old) {
+        if (atomic_compare_exchange_weak_explicit(
+                        max, &old, value, memory_order_relaxed, memory_order_relaxed))
+            return;
+    }
+}
+
+// Watermarks are only written when they move which keeps the common case of a
+// value that oscillates within its recent range at a single atomic operation.
+static bool
+lens_updown_add(struct optics_lens *lens, optics_epoch_t epoch, int64_t delta)
+{
+    struct lens_updown *updown = lens_sub_ptr(lens, optics_updown);
+    if (!updown) return false;
+
+    int64_t value = atomic_fetch_add_explicit(&updown->value, delta, memory_order_relaxed);
+    value += delta;
+
+    struct lens_updown_epoch *slot = &updown->epochs[epoch];
+    if (delta < 0) lens_updown_watermark_min(&slot->min, value);
+    else lens_updown_watermark_max(&slot->max, value);
+
+    return true;
+}
+
+// The value at the time of the read is both the end of the epoch being read
+// and the start of the epoch being recorded so it seeds the watermarks of the
+// latter. The read epoch is then reset to the identity of the reductions to be
+// seeded by the next read.
+static enum optics_ret
+lens_updown_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_updown *value)
+{
+    struct lens_updown *updown = lens_sub_ptr(lens, optics_updown);
+    if (!updown) return optics_err;
+
+    int64_t current = atomic_load_explicit(&updown->value, memory_order_relaxed);
+
+    struct lens_updown_epoch *next = &updown->epochs[!epoch];
+    lens_updown_watermark_min(&next->min, current);
+    lens_updown_watermark_max(&next->max, current);
+
+    struct lens_updown_epoch *slot = &updown->epochs[epoch];
+    int64_t min = atomic_exchange_explicit(&slot->min, INT64_MAX, memory_order_relaxed);
+    int64_t max = atomic_exchange_explicit(&slot->max, INT64_MIN, memory_order_relaxed);
+
+    *value = (struct optics_updown) {
+        .value = current,
+        .min = min < current ? min : current,
+        .max = max > current ? max : current,
+    };
+
+    return optics_ok;
+}
+
+// Like gauges, none of the values are rescaled.
+static bool
+lens_updown_normalize(const struct optics_poll *poll, struct lens_normalize *norm)
+{
+    const struct optics_updown *updown = &poll->value.updown;
+
+    return lens_normalize_emit(norm, 0, NULL, updown->value)
+        && lens_normalize_emit(norm, 1, "min", updown->min)
+        && lens_normalize_emit(norm, 2, "max", updown->max);
+}
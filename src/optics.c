@@ -11,15 +11,21 @@
 #include "utils/lock.h"
 #include "utils/rng.h"
 #include "utils/time.h"
+#include "utils/thread.h"
 #include "utils/bits.h"
 #include "utils/log.h"
 #include "utils/socket.h"
+#include "utils/slab.h"
+#include "utils/region.h"
+#include "utils/fmt.h"
+#include "utils/numa.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdatomic.h>
+#include <math.h>
 #include <bsd/string.h>
 
 #include <sys/mman.h>
@@ -27,6 +33,8 @@
 #include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
 
 
 // -----------------------------------------------------------------------------
@@ -43,9 +51,16 @@ enum { cache_line_len = 64 };
 // impl
 // -----------------------------------------------------------------------------
 
-static bool optics_defer_free(struct optics *optics, struct optics_lens *ptr);
+static void *optics_alloc(struct optics *optics, size_t len);
+static void optics_free(struct optics *optics, void *ptr, size_t len);
+static bool optics_defer_free(struct optics *optics, void *ptr, size_t len);
+static void optics_defer_lens(struct optics *optics, struct optics_lens *lens);
 static void optics_free_defered(struct optics *optics, optics_epoch_t epoch);
 static void optics_free_lenses(struct optics *optics);
+static void optics_keys_reset(struct optics *optics);
+static bool optics_lens_capped(struct optics *optics, const char *name);
+static bool optics_static_open(struct optics *optics);
+static void optics_static_close(struct optics *optics);
 
 // contains struct optics_lens
 #include "lens.c"
@@ -57,66 +72,309 @@ static void optics_free_lenses(struct optics *optics);
 
 struct optics_defer
 {
-    struct optics_lens *ptr;
+    void *ptr;
+    size_t len;
     struct optics_defer *next;
 };
 
-struct optics
+struct optics_keys_bucket
+{
+    atomic_uint_fast64_t hash;
+    atomic_uintptr_t lens;
+};
+
+struct optics_keys
+{
+    size_t cap;
+    struct optics_keys_bucket buckets[];
+};
+
+struct optics_lenses
+{
+    size_t cap;
+    atomic_size_t len;
+    atomic_uintptr_t slots[];
+};
+
+struct optics_quiesce
+{
+    atomic_size_t active[2];
+} optics_align(cache_line_len);
+
+// Cap on the number of live lenses whose name starts with the prefix. The count
+// is maintained when lenses are published and removed.
+struct optics_cap
+{
+    char prefix[optics_name_max_len];
+    size_t prefix_len;
+    size_t cap;
+    atomic_size_t len;
+};
+
+enum { optics_caps_max = 8 };
+
+// Lenses are partitioned by the hash of their name such that creating, opening
+// and closing lenses in different partitions never contend on the same lock.
+enum { optics_parts = 16 };
+
+struct optics_part
 {
     // Synchronizes:
-    //   - optics.keys: read and write
-    //   - optics.lens_head: write-only (reads are lock-free).
+    //   - optics_part.keys: write-only (reads are lock-free).
+    //   - optics_part.lenses: write-only (reads are lock-free).
     //
     // Even though it's not strictly required, it's simpler to keep both of
     // these structures consistent with each-other.
     struct slock lock;
 
-    struct htable keys;
+    atomic_uintptr_t keys;
+    size_t keys_len;
+    size_t keys_used;
+
+    atomic_uintptr_t lenses;
+    size_t lenses_free;
+} optics_align(cache_line_len);
+
+struct optics
+{
+    struct optics_part parts[optics_parts];
+
+    // Synchronizes optics.lens_head for writers (reads are lock-free). Always
+    // acquired while holding the lock of the lens's partition.
+    struct slock lock;
+
+    // Only maintained in shm mode where the region root points to the head of
+    // the list for readers of the region.
     atomic_uintptr_t lens_head;
 
     atomic_size_t epoch;
-    optics_ts_t epoch_last_inc;
+    uint64_t epoch_last_inc; // nanos
     atomic_uintptr_t epoch_defers[2];
+    atomic_uintptr_t epoch_lenses[2];
+    atomic_size_t defers_len;
+
+    // Lists of vacated epochs waiting for optics_reclaim.
+    atomic_uintptr_t reclaim_defers;
+    atomic_uintptr_t reclaim_lenses;
+
+    // Bumped by every lens close to invalidate the per-thread lookup caches.
+    // Seeded from optics_lens_gen_seed so that an optics allocated at the
+    // address of a closed one never matches its stale cache entries.
+    atomic_size_t lens_gen;
+
+    // Number of writers active in each epoch sharded by cpu. Only maintained
+    // while quiescence tracking is enabled which is flagged in the epoch word
+    // by optics_epoch_quiesce_bit.
+    size_t quiesce_len;
+    struct optics_quiesce *quiesce_shards;
 
     char prefix[optics_name_max_len];
+
+    // Caps on the number of live lenses where caps[0] has an empty prefix and
+    // applies to every lens. Overflow lenses are never counted. Only the
+    // counts are modified once lenses are being opened.
+    size_t caps_len;
+    struct optics_cap caps[optics_caps_max + 1];
+    atomic_size_t rejected;
+    atomic_bool rejected_warned;
+
+    // Backs the lenses, the key tables and the defer nodes.
+    struct slab slab;
+
+    // Only opened in shm or fork mode in which case the slab allocates from it.
+    // In fork mode, the optics itself lives within the region.
+    bool shm;
+    bool fork;
+    pid_t fork_owner;
+    struct region region;
 };
 
 
+// -----------------------------------------------------------------------------
+// ticks
+// -----------------------------------------------------------------------------
+
+// Falls back to the monotonic clock until calibrated.
+struct optics_ticks_clock optics_ticks_clock = { .tsc = false, .nanos = 1.0 };
+
+static pthread_once_t optics_ticks_once = PTHREAD_ONCE_INIT;
+
+// Calibrating over 10ms is enough to get within a few ppm of the nominal rate
+// and is only paid once per process.
+static void optics_ticks_calibrate(void)
+{
+    if (!clock_tsc_invariant()) return;
+
+    double nanos = clock_tsc_calibrate(10 * 1000 * 1000);
+    if (!nanos) return;
+
+    optics_ticks_clock.nanos = nanos;
+    optics_ticks_clock.tsc = true;
+}
+
+
 // -----------------------------------------------------------------------------
 // open/close
 // -----------------------------------------------------------------------------
 
-struct optics * optics_create_at(const char *name, optics_ts_t now)
+// In fork mode, the optics is closed by copying the region out of it first.
+static void optics_release(struct optics *optics)
+{
+    slab_reset(&optics->slab);
+
+    if (optics->fork) {
+        struct region region = optics->region;
+        region_close(&region);
+        return;
+    }
+
+    if (optics->shm) region_close(&optics->region);
+    free(optics->quiesce_shards);
+    free(optics);
+}
+
+static atomic_size_t optics_lens_gen_seed = 0;
+
+static size_t optics_lens_gen_next(void)
+{
+    size_t seed = atomic_fetch_add_explicit(&optics_lens_gen_seed, 1, memory_order_relaxed);
+    return seed << 32;
+}
+
+// The time of creation is given in nanos. A non-zero fork length places the
+// optics, its shards and all its lenses in a fixed region shared with the
+// children forked afterwards. Every lock the lenses need lives in the optics
+// so lenses can be created concurrently from any of the processes.
+static struct optics *
+optics_create_impl(
+        const char *name, bool shm, const char *shm_name, size_t fork_len, uint64_t now)
 {
-    struct optics *optics = calloc(1, sizeof(*optics));
-    optics_assert_alloc(optics);
+    pthread_once(&optics_ticks_once, optics_ticks_calibrate);
+
+    struct region region;
+    struct optics *optics = NULL;
+
+    // The partitions are cache-line aligned to keep their locks apart which
+    // region allocations also are.
+    if (fork_len) {
+        if (!region_open_fixed(&region, fork_len)) return NULL;
+
+        optics = region_alloc(&region, sizeof(*optics));
+        if (!optics) {
+            region_close(&region);
+            return NULL;
+        }
+    }
+    else {
+        optics = aligned_alloc(cache_line_len, sizeof(*optics));
+        optics_assert_alloc(optics);
+    }
+    memset(optics, 0, sizeof(*optics));
+
+    if (fork_len) {
+        optics->fork = true;
+        optics->fork_owner = getpid();
+        optics->region = region;
+        optics->slab.region = &optics->region;
+    }
 
-    if (!optics_set_prefix(optics, name)) goto fail_prefix;
+    if (!optics_set_prefix(optics, name)) goto fail;
     optics->epoch_last_inc = now;
+    atomic_init(&optics->lens_gen, optics_lens_gen_next());
+
+    optics->quiesce_len = cpus();
+    size_t quiesce_len = optics->quiesce_len * sizeof(struct optics_quiesce);
+    if (optics->fork) {
+        optics->quiesce_shards = region_alloc(&optics->region, quiesce_len);
+        if (!optics->quiesce_shards) goto fail;
+    }
+    else {
+        optics->quiesce_shards = aligned_alloc(cache_line_len, quiesce_len);
+        optics_assert_alloc(optics->quiesce_shards);
+    }
+    memset(optics->quiesce_shards, 0, quiesce_len);
+
+    if (shm) {
+        if (!region_open(&optics->region, shm_name)) goto fail;
+        optics->shm = true;
+        optics->slab.region = &optics->region;
+    }
+
+    if (!optics_static_open(optics)) goto fail;
 
     return optics;
 
-  fail_prefix:
-    free(optics);
+  fail:
+    optics_release(optics);
     return NULL;
 }
 
+struct optics * optics_create_at(const char *name, optics_ts_t now)
+{
+    return optics_create_impl(name, false, NULL, 0, now * 1000000000UL);
+}
+
 struct optics * optics_create(const char *name)
 {
-    return optics_create_at(name, clock_wall());
+    return optics_create_impl(name, false, NULL, 0, clock_wall_nanos());
+}
+
+struct optics * optics_create_shm_at(const char *name, const char *shm, optics_ts_t now)
+{
+    return optics_create_impl(name, true, shm, 0, now * 1000000000UL);
+}
+
+struct optics * optics_create_shm(const char *name, const char *shm)
+{
+    return optics_create_impl(name, true, shm, 0, clock_wall_nanos());
+}
+
+int optics_shm_fd(struct optics *optics)
+{
+    return optics->shm ? optics->region.fd : -1;
+}
+
+struct optics * optics_create_fork_at(const char *name, size_t len, optics_ts_t now)
+{
+    if (!len) {
+        optics_fail("invalid fork region length '%zu'", len);
+        return NULL;
+    }
+
+    return optics_create_impl(name, false, NULL, len, now * 1000000000UL);
+}
+
+struct optics * optics_create_fork(const char *name, size_t len)
+{
+    return optics_create_fork_at(name, len, clock_wall_nanos());
 }
 
 void optics_close(struct optics *optics)
 {
+    // Children only drop their view of the region since the lenses are still
+    // in use by the other processes and are owned by the creator.
+    if (optics->fork && optics->fork_owner != getpid()) {
+        optics_static_close(optics);
+        struct region region = optics->region;
+        region_close(&region);
+        return;
+    }
+
     optics_assert(slock_try_lock(&optics->lock),
             "closing optics with active thread");
+    for (size_t i = 0; i < optics_parts; ++i) {
+        optics_assert(slock_try_lock(&optics->parts[i].lock),
+                "closing optics with active thread");
+    }
 
+    optics_static_close(optics);
     optics_free_defered(optics, 0);
     optics_free_defered(optics, 1);
+    optics_reclaim(optics);
     optics_free_lenses(optics);
+    optics_keys_reset(optics);
 
-    htable_reset(&optics->keys);
-    free(optics);
+    optics_release(optics);
 }
 
 
@@ -142,17 +400,48 @@ bool optics_set_prefix(struct optics *optics, const char *prefix)
 // alloc
 // -----------------------------------------------------------------------------
 
-static bool optics_defer_free(struct optics *optics, struct optics_lens *ptr)
+static void *optics_alloc(struct optics *optics, size_t len)
+{
+    return slab_alloc(&optics->slab, len);
+}
+
+static void optics_free(struct optics *optics, void *ptr, size_t len)
+{
+    slab_free(&optics->slab, ptr, len);
+}
+
+// Closed lenses are linked through their prev pointer which is dead once the
+// lens is removed from the list. This avoids allocating a node on every close.
+// Everything else is rare enough that it goes through a separate list of
+// allocated nodes.
+static void optics_defer_lens(struct optics *optics, struct optics_lens *lens)
+{
+    optics_epoch_t epoch = optics_epoch(optics);
+    atomic_uintptr_t *head = &optics->epoch_lenses[epoch];
+
+    // Synchronizes with optics_reclaim to make sure that our link is fully
+    // written befor it is read.
+    uintptr_t old = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        lens->prev = pun_itop(old);
+    } while (!atomic_compare_exchange_weak_explicit(
+                    head, &old, pun_ptoi(lens), memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&optics->defers_len, 1, memory_order_relaxed);
+}
+
+static bool optics_defer_free(struct optics *optics, void *ptr, size_t len)
 {
-    struct optics_defer *node = calloc(1, sizeof(*node));
+    struct optics_defer *node = optics_alloc(optics, sizeof(*node));
     if (!node) return false;
 
     node->ptr = ptr;
+    node->len = len;
 
     optics_epoch_t epoch = optics_epoch(optics);
     atomic_uintptr_t *head = &optics->epoch_defers[epoch];
 
-    // Synchronizes with optics_free_defered to make sure that our node is fully
+    // Synchronizes with optics_reclaim to make sure that our node is fully
     // written befor it is read.
     uintptr_t old = atomic_load_explicit(head, memory_order_relaxed);
     do {
@@ -160,23 +449,81 @@ static bool optics_defer_free(struct optics *optics, struct optics_lens *ptr)
     } while (!atomic_compare_exchange_weak_explicit(
                     head, &old, pun_ptoi(node), memory_order_release, memory_order_relaxed));
 
+    atomic_fetch_add_explicit(&optics->defers_len, 1, memory_order_relaxed);
     return true;
 }
 
-static void optics_free_defered(struct optics *optics, optics_epoch_t epoch)
+// Everything is returned to the slab in one go to avoid bouncing on the size
+// class locks for every lens.
+static void optics_free_lists(
+        struct optics *optics, struct optics_defer *node, struct optics_lens *lens)
 {
-    // Synchronizes with optics_defer_free to make sure that all nodes have been
-    // fully written before we read them.
-    atomic_uintptr_t *head = &optics->epoch_defers[epoch];
-    struct optics_defer *node = pun_itop(atomic_exchange_explicit(head, 0, memory_order_acquire));
+    struct slab_batch batch = {0};
+    size_t freed = 0;
 
     while (node) {
-        free(node->ptr);
+        slab_batch_free(&batch, &optics->slab, node->ptr, node->len);
 
         struct optics_defer *next = node->next;
-        free(node);
+        slab_batch_free(&batch, &optics->slab, node, sizeof(*node));
         node = next;
+        freed++;
+    }
+
+    while (lens) {
+        struct optics_lens *next = lens->prev;
+        slab_batch_free(&batch, &optics->slab, lens, lens_alloc_len(lens));
+        lens = next;
+        freed++;
     }
+
+    slab_batch_commit(&batch, &optics->slab);
+    if (freed) atomic_fetch_sub_explicit(&optics->defers_len, freed, memory_order_relaxed);
+}
+
+// Hands the lists of the epoch over to optics_reclaim which keeps the epoch
+// change constant time. The lists are only freed here if the previous ones
+// haven't been reclaimed yet.
+static void optics_free_defered(struct optics *optics, optics_epoch_t epoch)
+{
+    // Synchronizes with optics_defer_free and optics_defer_lens to make sure
+    // that all nodes have been fully written before we read them.
+    uintptr_t nodes = atomic_exchange_explicit(
+            &optics->epoch_defers[epoch], 0, memory_order_acquire);
+    uintptr_t lenses = atomic_exchange_explicit(
+            &optics->epoch_lenses[epoch], 0, memory_order_acquire);
+
+    uintptr_t empty = 0;
+    if (nodes && atomic_compare_exchange_strong_explicit(
+                    &optics->reclaim_defers, &empty, nodes,
+                    memory_order_release, memory_order_relaxed))
+        nodes = 0;
+
+    empty = 0;
+    if (lenses && atomic_compare_exchange_strong_explicit(
+                    &optics->reclaim_lenses, &empty, lenses,
+                    memory_order_release, memory_order_relaxed))
+        lenses = 0;
+
+    if (nodes || lenses) optics_free_lists(optics, pun_itop(nodes), pun_itop(lenses));
+}
+
+void optics_reclaim(struct optics *optics)
+{
+    if (!atomic_load_explicit(&optics->reclaim_defers, memory_order_relaxed) &&
+            !atomic_load_explicit(&optics->reclaim_lenses, memory_order_relaxed))
+        return;
+
+    // Synchronizes with optics_free_defered to make sure that the lists are
+    // fully written before we read them.
+    uintptr_t nodes = atomic_exchange_explicit(&optics->reclaim_defers, 0, memory_order_acquire);
+    uintptr_t lenses = atomic_exchange_explicit(&optics->reclaim_lenses, 0, memory_order_acquire);
+    optics_free_lists(optics, pun_itop(nodes), pun_itop(lenses));
+}
+
+size_t optics_defer_count(struct optics *optics)
+{
+    return atomic_load_explicit(&optics->defers_len, memory_order_relaxed);
 }
 
 
@@ -201,7 +548,7 @@ optics_epoch_t optics_epoch_inc(struct optics *optics)
 }
 
 optics_epoch_t optics_epoch_inc_at(
-        struct optics *optics, optics_ts_t now, optics_ts_t *last_inc)
+        struct optics *optics, uint64_t now, uint64_t *last_inc)
 {
     *last_inc = optics->epoch_last_inc;
     optics->epoch_last_inc = now;
@@ -211,364 +558,2479 @@ optics_epoch_t optics_epoch_inc_at(
 
 
 // -----------------------------------------------------------------------------
-// list
+// quiesce
 // -----------------------------------------------------------------------------
-
-static void optics_push_lens(struct optics *optics, struct optics_lens *lens)
+// Writers announce themselves in the epoch they're about to record into which
+// lets the poller wait for exactly as long as it takes the stragglers of the
+// vacated epoch to finish their record.
+//
+// A writer increments its announcement and then re-reads the epoch while the
+// poller increments the epoch and then reads the announcements. With all four
+// operations being sequentially consistent, either the writer notices the new
+// epoch and moves to it or the poller notices the announcement and waits for
+// it.
+
+enum { optics_quiesce_timeout = 10 * 1000 * 1000 };
+
+// The flag lives in the epoch word so that writers only need a single load to
+// know both the epoch and whether they need to announce themselves.
+void optics_set_quiescence(struct optics *optics, bool enable)
 {
-    optics_assert(!slock_try_lock(&optics->lock), "pushing lens without lock held");
+    if (enable) atomic_fetch_or(&optics->epoch, optics_epoch_quiesce_bit);
+    else atomic_fetch_and(&optics->epoch, ~optics_epoch_quiesce_bit);
+}
 
-    atomic_uintptr_t *head = &optics->lens_head;
-    struct optics_lens *old_head = pun_itop(atomic_load_explicit(head, memory_order_relaxed));
-    lens_set_next(lens, old_head);
+void optics_set_huge_pages(struct optics *optics)
+{
+    slab_huge(&optics->slab);
+}
 
-    // Synchronizes with optics_foreach_lens to ensure that the node is fully
-    // written before it is accessed.
-    atomic_store_explicit(head, pun_ptoi(lens), memory_order_release);
+static bool optics_quiescence(struct optics *optics)
+{
+    size_t epoch = atomic_load_explicit(&optics->epoch, memory_order_relaxed);
+    return epoch & optics_epoch_quiesce_bit;
 }
 
-// Removes the lens from the polling which is different then defer free which
-// gets rid of the memory associated with lens.
-static void optics_remove_lens(struct optics *optics, struct optics_lens *lens)
+static inline optics_epoch_t optics_epoch_enter(struct optics *optics, atomic_size_t **slot)
 {
-    optics_assert(!slock_try_lock(&optics->lock), "removing lens without lock held");
+    size_t word = atomic_load_explicit(&optics->epoch, memory_order_acquire);
+    if (optics_likely(!(word & optics_epoch_quiesce_bit))) {
+        *slot = NULL;
+        return word & 1;
+    }
 
-    lens_kill(lens);
+    int cpu = sched_getcpu();
+    size_t i = cpu >= 0 ? (size_t) cpu : tid();
+    struct optics_quiesce *shard = &optics->quiesce_shards[i % optics->quiesce_len];
 
-    atomic_uintptr_t *head = &optics->lens_head;
-    struct optics_lens *old_head = pun_itop(atomic_load_explicit(head, memory_order_relaxed));
-    if (old_head == lens)
-        atomic_store_explicit(head, pun_ptoi(lens_next(lens)), memory_order_relaxed);
+    optics_epoch_t epoch = atomic_load(&optics->epoch) & 1;
+    while (true) {
+        atomic_fetch_add(&shard->active[epoch], 1);
+
+        optics_epoch_t current = atomic_load(&optics->epoch) & 1;
+        if (optics_likely(current == epoch)) break;
+
+        atomic_fetch_sub_explicit(&shard->active[epoch], 1, memory_order_release);
+        epoch = current;
+    }
+
+    *slot = &shard->active[epoch];
+    return epoch;
 }
 
-// Should be a lock-free traversal of the lenses so that the poller doens't
-// block on any record operations.
-enum optics_ret optics_foreach_lens(struct optics *optics, void *ctx, optics_foreach_t cb)
+static inline void optics_epoch_exit(atomic_size_t *slot)
 {
-    // written before we access them.
-    atomic_uintptr_t *head = &optics->lens_head;
-    struct optics_lens *lens = pun_itop(atomic_load_explicit(head, memory_order_acquire));
+    // Synchronizes with optics_epoch_quiesce to make sure that the record is
+    // fully written before the poller reads the lens.
+    if (slot) atomic_fetch_sub_explicit(slot, 1, memory_order_release);
+}
 
-    while (lens) {
-        enum optics_ret ret = cb(ctx, lens);
-        if (ret != optics_ok) return ret;
-        lens = lens_next(lens);
+static bool optics_epoch_quiesced(struct optics *optics, optics_epoch_t epoch)
+{
+    for (size_t i = 0; i < optics->quiesce_len; ++i) {
+        if (atomic_load(&optics->quiesce_shards[i].active[epoch])) return false;
     }
-
-    return optics_ok;
+    return true;
 }
 
-// Should only be called from optics_close which is free from all concurrency
-// constraints.
-static void optics_free_lenses(struct optics *optics)
+bool optics_epoch_quiesce(struct optics *optics, optics_epoch_t epoch)
 {
-    atomic_uintptr_t *head = &optics->lens_head;
-    struct optics_lens *lens = pun_itop(atomic_load_explicit(head, memory_order_relaxed));
+    if (!optics_quiescence(optics)) return false;
+    if (optics_epoch_quiesced(optics, epoch)) return true;
 
-    while (lens) {
-        struct optics_lens *next = lens_next(lens);
-        free(lens);
-        lens = next;
+    struct timespec start = {0};
+    clock_monotonic(&start);
+
+    // Stragglers are usually done within a few nanoseconds so we spin for a
+    // bit before we start yielding to writers that might have been preempted.
+    enum { spins = 128 };
+    for (size_t i = 0; !optics_epoch_quiesced(optics, epoch); ++i) {
+        if (i < spins) continue;
+
+        struct timespec now = {0};
+        clock_monotonic(&now);
+
+        uint64_t elapsed =
+            (now.tv_sec - start.tv_sec) * 1000 * 1000 * 1000 + (now.tv_nsec - start.tv_nsec);
+        if (elapsed >= optics_quiesce_timeout) return false;
+
+        yield();
     }
+
+    return true;
 }
 
 
 // -----------------------------------------------------------------------------
-// lens
+// caps
 // -----------------------------------------------------------------------------
+// The caps are checked when the lens is allocated and the counts are only
+// updated once the lens is published which makes the caps approximate under
+// concurrent opens. Good enough to stop a runaway key set.
 
-struct optics_lens * optics_lens_get(struct optics *optics, const char *name)
+static bool optics_cap_match(const struct optics_cap *cap, const char *name)
 {
-    struct optics_lens *lens = NULL;
+    return !strncmp(cap->prefix, name, cap->prefix_len);
+}
 
-    {
-        slock_lock(&optics->lock);
+static void optics_caps_track(struct optics *optics, struct optics_lens *lens, int inc)
+{
+    if (lens->overflow) return;
 
-        struct htable_ret ret = htable_get(&optics->keys, name);
-        if (ret.ok) lens = pun_itop(ret.value);
+    const char *name = lens_name(lens);
+    for (size_t i = 0; i < optics->caps_len; ++i) {
+        struct optics_cap *cap = &optics->caps[i];
+        if (!cap->cap || !optics_cap_match(cap, name)) continue;
 
-        slock_unlock(&optics->lock);
+        if (inc > 0) atomic_fetch_add_explicit(&cap->len, 1, memory_order_relaxed);
+        else atomic_fetch_sub_explicit(&cap->len, 1, memory_order_relaxed);
     }
-
-    return lens;
 }
 
-static bool
-optics_lens_create(struct optics *optics, struct optics_lens *lens)
+// Lenses that already exist are never capped as opening them doesn't allocate.
+static bool optics_lens_capped(struct optics *optics, const char *name)
 {
-    bool ok = false;
-    {
-        slock_lock(&optics->lock);
+    if (optics_likely(!optics->caps_len)) return false;
 
-        ok = htable_put(&optics->keys, lens_name(lens), pun_ptoi(lens)).ok;
-        if (ok) optics_push_lens(optics, lens);
-
-        slock_unlock(&optics->lock);
+    bool capped = false;
+    for (size_t i = 0; !capped && i < optics->caps_len; ++i) {
+        struct optics_cap *cap = &optics->caps[i];
+        if (!cap->cap || !optics_cap_match(cap, name)) continue;
+        capped = atomic_load_explicit(&cap->len, memory_order_relaxed) >= cap->cap;
     }
 
-    if (!ok) {
-        optics_fail("lens '%s' already exists", lens_name(lens));
-        return false;
+    if (!capped || optics_lens_get(optics, name)) return false;
+
+    atomic_fetch_add_explicit(&optics->rejected, 1, memory_order_relaxed);
+    if (!atomic_exchange_explicit(&optics->rejected_warned, true, memory_order_relaxed)) {
+        optics_warn("lens cap reached for '%s': lens '%s' replaced by its overflow lens",
+                optics->prefix, name);
     }
 
     return true;
 }
 
-static struct optics_lens *
-optics_lens_open(struct optics *optics, struct optics_lens *lens)
+static enum optics_ret optics_cap_count(void *ctx, struct optics_lens *lens)
 {
-    {
-        slock_lock(&optics->lock);
+    struct optics_cap *cap = ctx;
+    if (!lens->overflow && optics_cap_match(cap, lens_name(lens)))
+        atomic_fetch_add_explicit(&cap->len, 1, memory_order_relaxed);
+    return optics_ok;
+}
 
-        struct htable_ret ret = htable_put(&optics->keys, lens_name(lens), pun_ptoi(lens));
+static bool optics_cap_set(struct optics *optics, const char *prefix, size_t value)
+{
+    if (!optics->caps_len) optics->caps_len = 1;
 
-        if (ret.ok) optics_push_lens(optics, lens);
-        else lens = pun_itop(ret.value);
+    struct optics_cap *cap = NULL;
+    if (!*prefix) cap = &optics->caps[0];
 
-        slock_unlock(&optics->lock);
+    for (size_t i = 1; !cap && i < optics->caps_len; ++i) {
+        if (!strcmp(optics->caps[i].prefix, prefix)) cap = &optics->caps[i];
     }
 
-    return lens;
-}
-
-bool optics_lens_close(struct optics_lens *lens)
-{
-    bool ok;
-    {
-        slock_lock(&lens->optics->lock);
+    if (!cap) {
+        if (optics->caps_len == optics_caps_max + 1) {
+            optics_fail("too many lens caps: %d", optics_caps_max);
+            return false;
+        }
 
-        ok = htable_del(&lens->optics->keys, lens_name(lens)).ok;
-        if (ok) optics_remove_lens(lens->optics, lens);
+        cap = &optics->caps[optics->caps_len++];
+        cap->prefix_len = strlcpy(cap->prefix, prefix, sizeof(cap->prefix));
+    }
 
-        slock_unlock(&lens->optics->lock);
+    // Lenses opened before the cap was set still count towards it.
+    if (!cap->cap) {
+        atomic_store_explicit(&cap->len, 0, memory_order_relaxed);
+        (void) optics_foreach_lens(optics, cap, optics_cap_count);
     }
 
-    if (!ok) return false;
-    if (!lens_defer_free(lens->optics, lens)) return false;
+    cap->cap = value;
     return true;
 }
 
+bool optics_lens_cap(struct optics *optics, size_t cap)
+{
+    return optics_cap_set(optics, "", cap);
+}
 
-enum optics_lens_type optics_lens_type(struct optics_lens *lens)
+bool optics_lens_cap_prefix(struct optics *optics, const char *prefix, size_t cap)
 {
-    return lens_type(lens);
+    if (!*prefix) {
+        optics_fail("empty lens cap prefix");
+        return false;
+    }
+
+    if (strnlen(prefix, optics_name_max_len) == optics_name_max_len) {
+        optics_fail("lens cap prefix too long");
+        return false;
+    }
+
+    return optics_cap_set(optics, prefix, cap);
 }
 
-const char * optics_lens_name(struct optics_lens *lens)
+size_t optics_lens_rejected(struct optics *optics)
 {
-    return lens_name(lens);
+    return atomic_load_explicit(&optics->rejected, memory_order_relaxed);
 }
 
 
 // -----------------------------------------------------------------------------
-// counter
+// lenses
 // -----------------------------------------------------------------------------
-
-struct optics_lens * optics_counter_create(struct optics *optics, const char *name)
+// Dense table of the live lenses of a partition which the poller scans in
+// order. Lenses are handed slots in creation order which, thanks to the slab,
+// closely follows their address order. Slots of closed lenses form a free list
+// threaded through the table that is reused before the table is extended.
+// Tables replaced by a resize are reclaimed through the epochs like the key
+// tables.
+
+enum
 {
-    struct optics_lens *counter = lens_counter_alloc(optics, name);
-    if (!counter) return NULL;
+    optics_lenses_min_cap = 64,
 
-    if (!optics_lens_create(optics, counter)) {
-        lens_free(counter);
-        return NULL;
-    }
+    // Free slots hold the index of the next free slot tagged with this bit
+    // which can't be set in a lens pointer.
+    optics_lenses_free_tag = 1,
 
-    return counter;
-}
+    // Number of slots ahead of the traversal to prefetch.
+    optics_lenses_prefetch = 8,
+};
 
-struct optics_lens * optics_counter_open(struct optics *optics, const char *name)
+// The top bits of the hash are used since the key tables index with the bottom
+// bits.
+static struct optics_part * optics_part(struct optics *optics, uint64_t hash)
 {
-    struct optics_lens *counter = lens_counter_alloc(optics, name);
-    if (!counter) return NULL;
-
-    struct optics_lens *lens = optics_lens_open(optics, counter);
-    if (lens != counter) lens_free(counter);
-
-    return lens;
+    static_assert(!(optics_parts & (optics_parts - 1)), "partitions must be a power of 2");
+    return &optics->parts[(hash >> 32) & (optics_parts - 1)];
 }
 
-bool optics_counter_inc(struct optics_lens *lens, int64_t value)
+static size_t optics_lenses_alloc_len(size_t cap)
 {
-    return lens_counter_inc(lens, optics_epoch(lens->optics), value);
+    return sizeof(struct optics_lenses) + cap * sizeof(atomic_uintptr_t);
 }
 
-enum optics_ret
-optics_counter_read(struct optics_lens *lens, optics_epoch_t epoch, int64_t *value)
+static struct optics_lenses * optics_lenses_load(struct optics_part *part)
 {
-    return lens_counter_read(lens, epoch, value);
+    return pun_itop(atomic_load_explicit(&part->lenses, memory_order_acquire));
 }
 
-// -----------------------------------------------------------------------------
-// quantile
-// -----------------------------------------------------------------------------
-
-struct optics_lens * optics_quantile_create(
-        struct optics *optics,
-        const char *name,
-        double target_quantile,
-        double estimate,
-        double adjustment)
+// Should be called while holding the partition lock.
+static struct optics_lenses *
+optics_lenses_grow(struct optics *optics, struct optics_part *part)
 {
-    struct optics_lens *quantile =
-        lens_quantile_alloc(optics, name, target_quantile, estimate, adjustment);
-    if (!quantile) return NULL;
+    struct optics_lenses *old = optics_lenses_load(part);
+    size_t cap = old ? old->cap * 2 : optics_lenses_min_cap;
+
+    struct optics_lenses *new = optics_alloc(optics, optics_lenses_alloc_len(cap));
+    optics_assert_alloc(new);
+    new->cap = cap;
+
+    if (old) {
+        size_t len = atomic_load_explicit(&old->len, memory_order_relaxed);
+        for (size_t i = 0; i < len; ++i) {
+            uintptr_t value = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+            atomic_init(&new->slots[i], value);
+        }
+        atomic_init(&new->len, len);
+    }
+
+    // Synchronizes with optics_lenses_load to make sure that the table is fully
+    // written before it is read.
+    atomic_store_explicit(&part->lenses, pun_ptoi(new), memory_order_release);
+
+    if (old) {
+        bool ok = optics_defer_free(optics, old, optics_lenses_alloc_len(old->cap));
+        optics_assert(ok, "unable to defer the free of the old lens table");
+    }
+
+    return new;
+}
+
+static void optics_push_lens(
+        struct optics *optics, struct optics_part *part, struct optics_lens *lens)
+{
+    optics_assert(!slock_try_lock(&part->lock), "pushing lens without lock held");
+
+    struct optics_lenses *lenses = optics_lenses_load(part);
+
+    size_t slot;
+    if (part->lenses_free) {
+        slot = part->lenses_free - 1;
+        uintptr_t next = atomic_load_explicit(&lenses->slots[slot], memory_order_relaxed);
+        part->lenses_free = next >> 1;
+    }
+    else {
+        if (!lenses || atomic_load_explicit(&lenses->len, memory_order_relaxed) == lenses->cap)
+            lenses = optics_lenses_grow(optics, part);
+        slot = atomic_load_explicit(&lenses->len, memory_order_relaxed);
+    }
+
+    optics_assert(slot < UINT32_MAX, "too many lenses: %zu", slot);
+    lens->slot = slot;
+    optics_caps_track(optics, lens, 1);
+
+    // Synchronizes with optics_foreach_lens to ensure that the lens is fully
+    // written before it is accessed.
+    atomic_store_explicit(&lenses->slots[slot], pun_ptoi(lens), memory_order_release);
+    if (slot == atomic_load_explicit(&lenses->len, memory_order_relaxed))
+        atomic_store_explicit(&lenses->len, slot + 1, memory_order_release);
+
+    if (!optics->shm) return;
+
+    slock_lock(&optics->lock);
+
+    atomic_uintptr_t *head = &optics->lens_head;
+    struct optics_lens *old_head = pun_itop(atomic_load_explicit(head, memory_order_relaxed));
+    lens_set_next(lens, old_head);
+
+    // Synchronizes with the readers of the list to ensure that the node is
+    // fully written before it is accessed.
+    atomic_store_explicit(head, pun_ptoi(lens), memory_order_release);
+    region_set_root(&optics->region, lens);
+
+    slock_unlock(&optics->lock);
+}
+
+// Removes the lens from the polling which is different then defer free which
+// gets rid of the memory associated with lens.
+static void optics_remove_lens(
+        struct optics *optics, struct optics_part *part, struct optics_lens *lens)
+{
+    optics_assert(!slock_try_lock(&part->lock), "removing lens without lock held");
+
+    struct optics_lenses *lenses = optics_lenses_load(part);
+    uintptr_t next = (part->lenses_free << 1) | optics_lenses_free_tag;
+    atomic_store_explicit(&lenses->slots[lens->slot], next, memory_order_relaxed);
+    part->lenses_free = lens->slot + 1;
+    optics_caps_track(optics, lens, -1);
+
+    if (!optics->shm) return;
+
+    slock_lock(&optics->lock);
+
+    lens_kill(lens);
+
+    atomic_uintptr_t *head = &optics->lens_head;
+    struct optics_lens *old_head = pun_itop(atomic_load_explicit(head, memory_order_relaxed));
+    if (old_head == lens) {
+        atomic_store_explicit(head, pun_ptoi(lens_next(lens)), memory_order_relaxed);
+        region_set_root(&optics->region, lens_next(lens));
+    }
+
+    slock_unlock(&optics->lock);
+}
+
+static enum optics_ret
+optics_foreach_part(struct optics_part *part, void *ctx, optics_foreach_t cb)
+{
+    struct optics_lenses *lenses = optics_lenses_load(part);
+    if (!lenses) return optics_ok;
+
+    // Synchronizes with optics_push_lens to ensure that the slots are fully
+    // written before we access them.
+    size_t len = atomic_load_explicit(&lenses->len, memory_order_acquire);
+
+    for (size_t i = 0; i < len; ++i) {
+        if (i + optics_lenses_prefetch < len) {
+            atomic_uintptr_t *slot = &lenses->slots[i + optics_lenses_prefetch];
+            uintptr_t ahead = atomic_load_explicit(slot, memory_order_relaxed);
+            if (!(ahead & optics_lenses_free_tag)) __builtin_prefetch(pun_itop(ahead));
+        }
+
+        uintptr_t value = atomic_load_explicit(&lenses->slots[i], memory_order_acquire);
+        if (value & optics_lenses_free_tag) continue;
+
+        enum optics_ret ret = cb(ctx, pun_itop(value));
+        if (ret != optics_ok) return ret;
+    }
+
+    return optics_ok;
+}
+
+// Should be a lock-free traversal of the lenses so that the poller doens't
+// block on any record operations. Removed lenses and tables are reclaimed
+// through the epochs which makes reading a stale slot or table safe.
+enum optics_ret optics_foreach_lens(struct optics *optics, void *ctx, optics_foreach_t cb)
+{
+    for (size_t i = 0; i < optics_parts; ++i) {
+        enum optics_ret ret = optics_foreach_part(&optics->parts[i], ctx, cb);
+        if (ret != optics_ok) return ret;
+    }
+
+    return optics_ok;
+}
+
+size_t optics_lens_count(struct optics *optics)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < optics_parts; ++i) {
+        struct optics_part *part = &optics->parts[i];
+
+        slock_lock(&part->lock);
+        len += part->keys_len;
+        slock_unlock(&part->lock);
+    }
+
+    return len;
+}
+
+// Should only be called from optics_close which is free from all concurrency
+// constraints.
+static void optics_free_lenses(struct optics *optics)
+{
+    for (size_t i = 0; i < optics_parts; ++i) {
+        struct optics_part *part = &optics->parts[i];
+
+        struct optics_lenses *lenses = optics_lenses_load(part);
+        if (!lenses) continue;
+
+        size_t len = atomic_load_explicit(&lenses->len, memory_order_relaxed);
+        for (size_t j = 0; j < len; ++j) {
+            uintptr_t value = atomic_load_explicit(&lenses->slots[j], memory_order_relaxed);
+            if (!(value & optics_lenses_free_tag)) lens_free(pun_itop(value));
+        }
+
+        optics_free(optics, lenses, optics_lenses_alloc_len(lenses->cap));
+        atomic_store_explicit(&part->lenses, 0, memory_order_relaxed);
+        part->lenses_free = 0;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// keys
+// -----------------------------------------------------------------------------
+// Open-addressing index of the lenses of a partition by name which is read
+// without any locks or writes to shared memory. Writers are serialized by the
+// partition lock and publish every bucket with a release store while the
+// tables replaced during a resize are reclaimed through the epochs just like
+// the lenses.
+//
+// The keys are the names stored in the lenses themselves which means that they
+// share the lifetime of the lens and that a bucket only needs to hold a
+// pointer. The hash is kept alongside the pointer to avoid touching the lens on
+// every probe.
+
+enum
+{
+    optics_keys_min_cap = 16,
+    optics_keys_tombstone = 1,
+};
+
+static size_t optics_keys_alloc_len(size_t cap)
+{
+    return sizeof(struct optics_keys) + cap * sizeof(struct optics_keys_bucket);
+}
+
+static struct optics_keys * optics_keys_load(struct optics_part *part)
+{
+    return pun_itop(atomic_load_explicit(&part->keys, memory_order_acquire));
+}
+
+// Should only be called from optics_close which is free from all concurrency
+// constraints.
+static void optics_keys_reset(struct optics *optics)
+{
+    for (size_t i = 0; i < optics_parts; ++i) {
+        struct optics_part *part = &optics->parts[i];
+
+        struct optics_keys *keys = optics_keys_load(part);
+        if (keys) optics_free(optics, keys, optics_keys_alloc_len(keys->cap));
+        atomic_store_explicit(&part->keys, 0, memory_order_relaxed);
+    }
+}
+
+static struct optics_lens *
+optics_keys_get(struct optics *optics, const char *name, uint64_t hash)
+{
+    struct optics_keys *keys = optics_keys_load(optics_part(optics, hash));
+    if (!keys) return NULL;
+
+    size_t mask = keys->cap - 1;
+
+    for (size_t i = 0; i < keys->cap; ++i) {
+        struct optics_keys_bucket *bucket = &keys->buckets[(hash + i) & mask];
+
+        // Synchronizes with optics_keys_put to make sure that the hash and the
+        // lens are fully written before we read them.
+        uintptr_t value = atomic_load_explicit(&bucket->lens, memory_order_acquire);
+        if (!value) return NULL;
+        if (value == optics_keys_tombstone) continue;
+        if (atomic_load_explicit(&bucket->hash, memory_order_relaxed) != hash) continue;
+
+        struct optics_lens *lens = pun_itop(value);
+        if (strncmp(lens_name(lens), name, optics_name_max_len)) continue;
+
+        return lens;
+    }
+
+    return NULL;
+}
+
+// Should be called while holding the partition lock on a table that is not yet
+// published and has at least one empty bucket.
+static void optics_keys_insert(
+        struct optics_keys *keys, uint64_t hash, struct optics_lens *lens)
+{
+    size_t mask = keys->cap - 1;
+
+    for (size_t i = 0; i < keys->cap; ++i) {
+        struct optics_keys_bucket *bucket = &keys->buckets[(hash + i) & mask];
+
+        if (atomic_load_explicit(&bucket->lens, memory_order_relaxed)) continue;
+
+        atomic_store_explicit(&bucket->hash, hash, memory_order_relaxed);
+        atomic_store_explicit(&bucket->lens, pun_ptoi(lens), memory_order_release);
+        return;
+    }
+
+    optics_abort();
+}
+
+// Should be called while holding the partition lock. The new table is fully
+// written before it is published and never contains tombstones.
+static void optics_keys_resize(struct optics *optics, struct optics_part *part, size_t items)
+{
+    size_t cap = optics_keys_min_cap;
+    while (cap < (part->keys_len + items) * 4) cap *= 2;
+
+    struct optics_keys *new = optics_alloc(optics, optics_keys_alloc_len(cap));
+    optics_assert_alloc(new);
+    new->cap = cap;
+
+    struct optics_keys *old = optics_keys_load(part);
+    if (old) {
+        for (size_t i = 0; i < old->cap; ++i) {
+            struct optics_keys_bucket *bucket = &old->buckets[i];
+
+            uintptr_t value = atomic_load_explicit(&bucket->lens, memory_order_relaxed);
+            if (!value || value == optics_keys_tombstone) continue;
+
+            uint64_t hash = atomic_load_explicit(&bucket->hash, memory_order_relaxed);
+            optics_keys_insert(new, hash, pun_itop(value));
+        }
+    }
+
+    part->keys_used = part->keys_len;
+
+    // Synchronizes with optics_keys_load to make sure that the table is fully
+    // written before it is read.
+    atomic_store_explicit(&part->keys, pun_ptoi(new), memory_order_release);
+
+    // Readers might still be probing the old table so it can only be reclaimed
+    // once the epochs guarantee that no one is looking at it anymore.
+    if (old) {
+        bool ok = optics_defer_free(optics, old, optics_keys_alloc_len(old->cap));
+        optics_assert(ok, "unable to defer the free of the old key table");
+    }
+}
+
+// Should be called while holding the partition lock. Guarantees that the next
+// items puts will not trigger a resize.
+static void optics_keys_reserve(struct optics *optics, struct optics_part *part, size_t items)
+{
+    struct optics_keys *keys = optics_keys_load(part);
+    if (!keys || (part->keys_used + items) * 2 > keys->cap)
+        optics_keys_resize(optics, part, items);
+}
+
+// Should be called while holding the partition lock. Returns the lens already
+// associated with the name if there's one and NULL otherwise.
+static struct optics_lens *
+optics_keys_put(
+        struct optics *optics, struct optics_part *part,
+        struct optics_lens *lens, uint64_t hash)
+{
+    optics_keys_reserve(optics, part, 1);
+    struct optics_keys *keys = optics_keys_load(part);
+
+    const char *name = lens_name(lens);
+    size_t mask = keys->cap - 1;
+
+    struct optics_keys_bucket *empty = NULL;
+
+    for (size_t i = 0; i < keys->cap; ++i) {
+        struct optics_keys_bucket *bucket = &keys->buckets[(hash + i) & mask];
+
+        uintptr_t value = atomic_load_explicit(&bucket->lens, memory_order_relaxed);
+        if (value == optics_keys_tombstone) {
+            if (!empty) empty = bucket;
+            continue;
+        }
+
+        if (!value) {
+            if (!empty) {
+                empty = bucket;
+                part->keys_used++;
+            }
+            break;
+        }
+
+        if (atomic_load_explicit(&bucket->hash, memory_order_relaxed) != hash) continue;
+
+        struct optics_lens *other = pun_itop(value);
+        if (strncmp(lens_name(other), name, optics_name_max_len)) continue;
+
+        return other;
+    }
+
+    optics_assert(!!empty, "no empty bucket in key table");
+
+    // Synchronizes with optics_keys_get to make sure that the hash is written
+    // before the lens is made visible.
+    atomic_store_explicit(&empty->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&empty->lens, pun_ptoi(lens), memory_order_release);
+
+    part->keys_len++;
+    return NULL;
+}
+
+// Should be called while holding the partition lock. The bucket is turned into
+// a tombstone so that concurrent probes can go through it and it gets reclaimed
+// on the next resize.
+static bool
+optics_keys_del(struct optics_part *part, struct optics_lens *lens, uint64_t hash)
+{
+    struct optics_keys *keys = optics_keys_load(part);
+    if (!keys) return false;
+
+    size_t mask = keys->cap - 1;
+
+    for (size_t i = 0; i < keys->cap; ++i) {
+        struct optics_keys_bucket *bucket = &keys->buckets[(hash + i) & mask];
+
+        uintptr_t value = atomic_load_explicit(&bucket->lens, memory_order_relaxed);
+        if (!value) return false;
+        if (value != pun_ptoi(lens)) continue;
+
+        atomic_store_explicit(&bucket->lens, optics_keys_tombstone, memory_order_release);
+        part->keys_len--;
+        return true;
+    }
+
+    return false;
+}
+
+
+// -----------------------------------------------------------------------------
+// lens
+// -----------------------------------------------------------------------------
+
+uint64_t optics_lens_hash(const char *name)
+{
+    return htable_hash(name);
+}
+
+struct optics_lens * optics_lens_get(struct optics *optics, const char *name)
+{
+    return optics_keys_get(optics, name, htable_hash(name));
+}
+
+struct optics_lens * optics_lens_get_h(
+        struct optics *optics, const char *name, uint64_t hash)
+{
+    return optics_keys_get(optics, name, hash);
+}
+
+
+// -----------------------------------------------------------------------------
+// lens cache
+// -----------------------------------------------------------------------------
+// Direct-mapped per-thread cache indexed by the address of the name. Entries
+// are tagged with the first bytes of the name to skip over names whose buffer
+// was reused without touching the lens and the full name is still compared
+// against the lens before it's returned. Only hits are cached since a lens
+// created after a miss doesn't bump the generation.
+
+enum { optics_lens_cache_slots = 64 };
+
+struct optics_lens_cache_slot
+{
+    const char *name;
+    uint64_t tag;
+    const struct optics *optics;
+    size_t gen;
+    struct optics_lens *lens;
+};
+
+static __thread struct optics_lens_cache_slot optics_lens_cache[optics_lens_cache_slots];
+
+static uint64_t optics_lens_cache_tag(const char *name)
+{
+    uint64_t tag = 0;
+    for (size_t i = 0; i < sizeof(tag) && name[i]; ++i)
+        tag |= (uint64_t) (uint8_t) name[i] << (i * 8);
+    return tag;
+}
+
+struct optics_lens * optics_lens_get_cached(struct optics *optics, const char *name)
+{
+    uintptr_t key = (uintptr_t) name;
+    size_t index = (key ^ (key >> 6) ^ (key >> 12)) % optics_lens_cache_slots;
+    struct optics_lens_cache_slot *slot = &optics_lens_cache[index];
+
+    // Synchronizes with optics_lens_close such that a lens removed from the
+    // index is never returned once the bump is visible. The generation must
+    // be loaded before the lookup to avoid caching a lens closed in between.
+    size_t gen = atomic_load_explicit(&optics->lens_gen, memory_order_acquire);
+    uint64_t tag = optics_lens_cache_tag(name);
+
+    if (optics_likely(slot->name == name && slot->tag == tag &&
+                    slot->optics == optics && slot->gen == gen)) {
+        if (!strncmp(lens_name(slot->lens), name, optics_name_max_len))
+            return slot->lens;
+    }
+
+    struct optics_lens *lens = optics_keys_get(optics, name, htable_hash(name));
+    if (!lens) return NULL;
+
+    *slot = (struct optics_lens_cache_slot) {
+        .name = name,
+        .tag = tag,
+        .optics = optics,
+        .gen = gen,
+        .lens = lens,
+    };
+    return lens;
+}
+
+static bool
+optics_lens_create(struct optics *optics, struct optics_lens *lens)
+{
+    if (lens->overflow) {
+        optics_fail("unable to create lens: lens cap reached");
+        return false;
+    }
+
+    uint64_t hash = htable_hash(lens_name(lens));
+    struct optics_part *part = optics_part(optics, hash);
+
+    bool ok = false;
+    {
+        slock_lock(&part->lock);
+
+        ok = !optics_keys_put(optics, part, lens, hash);
+        if (ok) optics_push_lens(optics, part, lens);
+
+        slock_unlock(&part->lock);
+    }
+
+    if (!ok) {
+        optics_fail("lens '%s' already exists", lens_name(lens));
+        return false;
+    }
+
+    return true;
+}
+
+static struct optics_lens *
+optics_lens_open(struct optics *optics, struct optics_lens *lens)
+{
+    uint64_t hash = htable_hash(lens_name(lens));
+    struct optics_part *part = optics_part(optics, hash);
+
+    {
+        slock_lock(&part->lock);
+
+        struct optics_lens *other = optics_keys_put(optics, part, lens, hash);
+
+        if (!other) optics_push_lens(optics, part, lens);
+        else lens = other;
+
+        slock_unlock(&part->lock);
+    }
+
+    return lens;
+}
+
+// The overflow lens is shared by every lens it stood in for so it's only freed
+// along with the optics.
+bool optics_lens_close(struct optics_lens *lens)
+{
+    if (lens->overflow) return true;
+
+    uint64_t hash = htable_hash(lens_name(lens));
+    struct optics_part *part = optics_part(lens->optics, hash);
+
+    bool ok;
+    {
+        slock_lock(&part->lock);
+
+        ok = optics_keys_del(part, lens, hash);
+        if (ok) optics_remove_lens(lens->optics, part, lens);
+
+        slock_unlock(&part->lock);
+    }
+
+    if (!ok) return false;
+
+    atomic_fetch_add_explicit(&lens->optics->lens_gen, 1, memory_order_release);
+
+    if (!lens_defer_free(lens->optics, lens)) return false;
+    return true;
+}
+
+
+enum optics_lens_type optics_lens_type(struct optics_lens *lens)
+{
+    return lens_type(lens);
+}
+
+const char * optics_lens_name(struct optics_lens *lens)
+{
+    return lens_name(lens);
+}
+
+bool optics_lens_sample_rate(struct optics_lens *lens, uint32_t rate)
+{
+    if (!lens_sample_supported(lens)) return false;
+
+    lens->sample_target = 0;
+    atomic_store_explicit(&lens->sample_rate, rate, memory_order_relaxed);
+    return true;
+}
+
+bool optics_lens_sample_target(struct optics_lens *lens, uint32_t target)
+{
+    if (!lens_sample_supported(lens)) return false;
+
+    lens->sample_target = target;
+    if (!target) atomic_store_explicit(&lens->sample_rate, 1, memory_order_relaxed);
+    return true;
+}
+
+bool optics_lens_ttl(struct optics_lens *lens, uint32_t polls)
+{
+    if (lens->type == optics_family) {
+        optics_fail("ttl is not supported by family lens '%s'", lens_name(lens));
+        return false;
+    }
+
+    atomic_store_explicit(&lens->ttl, polls, memory_order_relaxed);
+    return true;
+}
+
+uint32_t optics_lens_get_ttl(struct optics_lens *lens)
+{
+    return atomic_load_explicit(&lens->ttl, memory_order_relaxed);
+}
+
+bool optics_lens_ticks(struct optics_lens *lens, double scale)
+{
+    if (!(scale > 0)) {
+        optics_fail("invalid ticks scale '%g' <= 0 for lens '%s'", scale, lens_name(lens));
+        return false;
+    }
+
+    double ticks = optics_ticks_clock.nanos * scale;
+
+    switch (lens->type) {
+    case optics_dist: return lens_dist_ticks(lens, ticks);
+    case optics_histo: return lens_histo_ticks(lens, ticks);
+
+    case optics_counter:
+    case optics_gauge:
+    case optics_quantile:
+    case optics_quantiles:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default:
+        optics_fail("ticks are not supported by lens '%s' of type '%s'",
+                lens_name(lens), lens_type_name(lens->type));
+        return false;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// counter
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_counter_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *counter = lens_counter_alloc(optics, name);
+    if (!counter) return NULL;
+
+    if (!optics_lens_create(optics, counter)) {
+        lens_free(counter);
+        return NULL;
+    }
+
+    return counter;
+}
+
+struct optics_lens * optics_counter_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *counter = lens_counter_alloc(optics, name);
+    if (!counter) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, counter);
+    if (lens != counter) lens_free(counter);
+
+    return lens;
+}
+
+struct optics_lens * optics_counter_sharded_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *counter = lens_counter_sharded_alloc(optics, name);
+    if (!counter) return NULL;
+
+    if (!optics_lens_create(optics, counter)) {
+        lens_free(counter);
+        return NULL;
+    }
+
+    return counter;
+}
+
+struct optics_lens * optics_counter_sharded_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *counter = lens_counter_sharded_alloc(optics, name);
+    if (!counter) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, counter);
+    if (lens != counter) lens_free(counter);
+
+    return lens;
+}
+
+bool optics_counter_inc(struct optics_lens *lens, int64_t value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_counter_inc(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_counter_inc_n(struct optics_lens *lens, const int64_t *values, size_t n)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_counter_inc_n(lens, epoch, values, n);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret
+optics_counter_read(struct optics_lens *lens, optics_epoch_t epoch, int64_t *value)
+{
+    return lens_counter_read(lens, epoch, value);
+}
+
+enum optics_ret optics_counter_peek(struct optics_lens *lens, int64_t *value)
+{
+    return lens_counter_peek(lens, value);
+}
+
+// Transient misses of a peek cancel out with the next delta since the cursor
+// tracks the exact value that was peeked.
+enum optics_ret optics_counter_delta(
+        struct optics_lens *lens, struct optics_counter_cursor *cursor, int64_t *delta)
+{
+    int64_t value = 0;
+    enum optics_ret ret = lens_counter_peek(lens, &value);
+    if (ret != optics_ok) return ret;
+
+    *delta = value - cursor->last;
+    cursor->last = value;
+    return optics_ok;
+}
+
+bool optics_counter_local_init(
+        struct optics_counter_local *local, struct optics_lens *lens, int64_t threshold)
+{
+    if (!lens_sub_ptr(lens, optics_counter)) return false;
+
+    *local = (struct optics_counter_local) {
+        .lens = lens,
+        .epoch = atomic_load_explicit(&lens->optics->epoch, memory_order_acquire),
+        .threshold = threshold,
+    };
+    return true;
+}
+
+// Flushing in the current epoch means that values buffered during the previous
+// epoch will be reported by the next poll instead of the current one. Since the
+// poller atomically exchanges the counter slots, this can delay a value by one
+// poll but can never lose or duplicate it. The flush itself is a regular record
+// which is tracked by quiescence like any other.
+bool optics_counter_local_flush(struct optics_counter_local *local)
+{
+    local->epoch = atomic_load_explicit(&local->lens->optics->epoch, memory_order_relaxed);
+
+    if (!local->value) return true;
+
+    int64_t value = local->value;
+    local->value = 0;
+    return optics_counter_inc(local->lens, value);
+}
+
+bool optics_counter_local_inc(struct optics_counter_local *local, int64_t value)
+{
+    local->value += value;
+
+    // The epoch is written once per poll so this load should only ever hit a
+    // shared cache line which is cheap.
+    size_t epoch = atomic_load_explicit(&local->lens->optics->epoch, memory_order_relaxed);
+    if (optics_likely(epoch == local->epoch)) {
+        if (!local->threshold) return true;
+        if (optics_likely(llabs(local->value) < local->threshold)) return true;
+    }
+
+    return optics_counter_local_flush(local);
+}
+
+static_assert(sizeof(atomic_size_t) == sizeof(size_t) &&
+        sizeof(atomic_int_fast64_t) == sizeof(int64_t) &&
+        sizeof(atomic_uint_fast64_t) == sizeof(uint64_t),
+        "handles access the atomics of the lenses through their plain types");
+
+bool optics_counter_handle(optics_counter_t *handle, struct optics_lens *lens)
+{
+    struct lens_counter *counter = lens_sub_ptr(lens, optics_counter);
+    if (!counter) return false;
+
+    *handle = (optics_counter_t) {
+        .lens = lens,
+        .epoch = (const size_t *) &lens->optics->epoch,
+        .values = counter->layout.len ? NULL : (int64_t *) counter->value,
+    };
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// quantile
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_quantile_create(
+        struct optics *optics,
+        const char *name,
+        double target_quantile,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantile =
+        lens_quantile_alloc(optics, name, target_quantile, estimate, adjustment);
+    if (!quantile) return NULL;
+
+    if (!optics_lens_create(optics, quantile)) {
+        lens_free(quantile);
+        return NULL;
+    }
+
+    return quantile;
+}
+
+struct optics_lens * optics_quantile_open(
+        struct optics *optics,
+        const char *name,
+        double target_quantile,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantile =
+        lens_quantile_alloc(optics, name, target_quantile, estimate, adjustment);
+    if (!quantile) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, quantile);
+    if (lens != quantile) lens_free(quantile);
+
+    return lens;
+}
+
+struct optics_lens * optics_quantile_adaptive_create(
+        struct optics *optics,
+        const char *name,
+        double target_quantile,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantile =
+        lens_quantile_adaptive_alloc(optics, name, target_quantile, estimate, adjustment);
+    if (!quantile) return NULL;
 
     if (!optics_lens_create(optics, quantile)) {
         lens_free(quantile);
         return NULL;
     }
 
-    return quantile;
+    return quantile;
+}
+
+struct optics_lens * optics_quantile_adaptive_open(
+        struct optics *optics,
+        const char *name,
+        double target_quantile,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantile =
+        lens_quantile_adaptive_alloc(optics, name, target_quantile, estimate, adjustment);
+    if (!quantile) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, quantile);
+    if (lens != quantile) lens_free(quantile);
+
+    return lens;
+}
+
+bool optics_quantile_update(struct optics_lens *lens, double value) {
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_quantile_update(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_quantile_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_quantile *value)
+{
+    return lens_quantile_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// quantiles
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_quantiles_create(
+        struct optics *optics,
+        const char *name,
+        const double *targets,
+        size_t len,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantiles =
+        lens_quantiles_alloc(optics, name, targets, len, estimate, adjustment);
+    if (!quantiles) return NULL;
+
+    if (!optics_lens_create(optics, quantiles)) {
+        lens_free(quantiles);
+        return NULL;
+    }
+
+    return quantiles;
+}
+
+struct optics_lens * optics_quantiles_open(
+        struct optics *optics,
+        const char *name,
+        const double *targets,
+        size_t len,
+        double estimate,
+        double adjustment)
+{
+    struct optics_lens *quantiles =
+        lens_quantiles_alloc(optics, name, targets, len, estimate, adjustment);
+    if (!quantiles) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, quantiles);
+    if (lens != quantiles) lens_free(quantiles);
+
+    return lens;
+}
+
+bool optics_quantiles_update(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_quantiles_update(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_quantiles_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_quantiles *value)
+{
+    return lens_quantiles_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// meter
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_meter_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *meter = lens_meter_alloc(optics, name);
+    if (!meter) return NULL;
+
+    if (!optics_lens_create(optics, meter)) {
+        lens_free(meter);
+        return NULL;
+    }
+
+    return meter;
+}
+
+struct optics_lens * optics_meter_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *meter = lens_meter_alloc(optics, name);
+    if (!meter) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, meter);
+    if (lens != meter) lens_free(meter);
+
+    return lens;
+}
+
+bool optics_meter_mark(struct optics_lens *lens, int64_t value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_meter_mark(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_meter_read(
+        struct optics_lens *lens,
+        optics_epoch_t epoch,
+        optics_ts_t elapsed,
+        struct optics_meter *value)
+{
+    return lens_meter_read(lens, epoch, elapsed, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// topk
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_topk_create(struct optics *optics, const char *name, size_t k)
+{
+    struct optics_lens *topk = lens_topk_alloc(optics, name, k);
+    if (!topk) return NULL;
+
+    if (!optics_lens_create(optics, topk)) {
+        lens_free(topk);
+        return NULL;
+    }
+
+    return topk;
+}
+
+struct optics_lens * optics_topk_open(struct optics *optics, const char *name, size_t k)
+{
+    struct optics_lens *topk = lens_topk_alloc(optics, name, k);
+    if (!topk) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, topk);
+    if (lens != topk) lens_free(topk);
+
+    return lens;
+}
+
+bool optics_topk_inc(struct optics_lens *lens, const char *key, size_t value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_topk_inc(lens, epoch, key, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_topk_inc_id(struct optics_lens *lens, uint64_t id, size_t value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_topk_inc_id(lens, epoch, id, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_topk_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_topk *value)
+{
+    return lens_topk_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// hll
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_hll_create(struct optics *optics, const char *name, size_t precision)
+{
+    struct optics_lens *hll = lens_hll_alloc(optics, name, precision);
+    if (!hll) return NULL;
+
+    if (!optics_lens_create(optics, hll)) {
+        lens_free(hll);
+        return NULL;
+    }
+
+    return hll;
+}
+
+struct optics_lens * optics_hll_open(struct optics *optics, const char *name, size_t precision)
+{
+    struct optics_lens *hll = lens_hll_alloc(optics, name, precision);
+    if (!hll) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, hll);
+    if (lens != hll) lens_free(hll);
+
+    return lens;
+}
+
+bool optics_hll_add(struct optics_lens *lens, const char *key)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_hll_add(lens, epoch, key);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_hll_add_id(struct optics_lens *lens, uint64_t id)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_hll_add_id(lens, epoch, id);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_hll_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_hll *value)
+{
+    return lens_hll_read(lens, epoch, value);
+}
+
+double optics_hll_estimate(const uint8_t *registers, size_t len)
+{
+    return lens_hll_estimate(registers, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// gauge
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_gauge_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *gauge = lens_gauge_alloc(optics, name);
+    if (!gauge) return NULL;
+
+    if (!optics_lens_create(optics, gauge)) {
+        lens_free(gauge);
+        return NULL;
+    }
+
+    return gauge;
+}
+
+struct optics_lens * optics_gauge_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *gauge = lens_gauge_alloc(optics, name);
+    if (!gauge) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, gauge);
+    if (lens != gauge) lens_free(gauge);
+
+    return lens;
+}
+
+struct optics_lens * optics_gauge_agg_create(
+        struct optics *optics, const char *name, enum optics_gauge_agg agg, bool sticky)
+{
+    struct optics_lens *gauge = lens_gauge_agg_alloc(optics, name, agg, sticky);
+    if (!gauge) return NULL;
+
+    if (!optics_lens_create(optics, gauge)) {
+        lens_free(gauge);
+        return NULL;
+    }
+
+    return gauge;
+}
+
+struct optics_lens * optics_gauge_agg_open(
+        struct optics *optics, const char *name, enum optics_gauge_agg agg, bool sticky)
+{
+    struct optics_lens *gauge = lens_gauge_agg_alloc(optics, name, agg, sticky);
+    if (!gauge) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, gauge);
+    if (lens != gauge) lens_free(gauge);
+
+    return lens;
+}
+
+bool optics_gauge_set(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_gauge_set(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_gauge_handle(optics_gauge_t *handle, struct optics_lens *lens)
+{
+    struct lens_gauge *gauge = lens_sub_ptr(lens, optics_gauge);
+    if (!gauge) return false;
+
+    bool regular = gauge->agg == optics_gauge_agg_none;
+    *handle = (optics_gauge_t) {
+        .lens = lens,
+        .value = regular ? (uint64_t *) &gauge->value : NULL,
+    };
+    return true;
+}
+
+enum optics_ret
+optics_gauge_read(struct optics_lens *lens, optics_epoch_t epoch, double *value)
+{
+    return lens_gauge_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// updown
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_updown_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *updown = lens_updown_alloc(optics, name);
+    if (!updown) return NULL;
+
+    if (!optics_lens_create(optics, updown)) {
+        lens_free(updown);
+        return NULL;
+    }
+
+    return updown;
+}
+
+struct optics_lens * optics_updown_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *updown = lens_updown_alloc(optics, name);
+    if (!updown) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, updown);
+    if (lens != updown) lens_free(updown);
+
+    return lens;
+}
+
+bool optics_updown_add(struct optics_lens *lens, int64_t delta)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_updown_add(lens, epoch, delta);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret optics_updown_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_updown *value)
+{
+    return lens_updown_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// dist
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_dist_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *dist = lens_dist_alloc(optics, name);
+    if (!dist) return NULL;
+
+    if (!optics_lens_create(optics, dist)) {
+        lens_free(dist);
+        return NULL;
+    }
+
+    return dist;
+}
+
+struct optics_lens * optics_dist_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *dist = lens_dist_alloc(optics, name);
+    if (!dist) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, dist);
+    if (lens != dist) lens_free(dist);
+
+    return lens;
+}
+
+struct optics_lens * optics_dist_sharded_create(struct optics *optics, const char *name)
+{
+    struct optics_lens *dist = lens_dist_sharded_alloc(optics, name);
+    if (!dist) return NULL;
+
+    if (!optics_lens_create(optics, dist)) {
+        lens_free(dist);
+        return NULL;
+    }
+
+    return dist;
+}
+
+struct optics_lens * optics_dist_sharded_open(struct optics *optics, const char *name)
+{
+    struct optics_lens *dist = lens_dist_sharded_alloc(optics, name);
+    if (!dist) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, dist);
+    if (lens != dist) lens_free(dist);
+
+    return lens;
+}
+
+struct optics_lens * optics_dist_reservoir_create(
+        struct optics *optics, const char *name, size_t samples, bool sharded)
+{
+    struct optics_lens *dist = lens_dist_reservoir_alloc(optics, name, samples, sharded);
+    if (!dist) return NULL;
+
+    if (!optics_lens_create(optics, dist)) {
+        lens_free(dist);
+        return NULL;
+    }
+
+    return dist;
+}
+
+struct optics_lens * optics_dist_reservoir_open(
+        struct optics *optics, const char *name, size_t samples, bool sharded)
+{
+    struct optics_lens *dist = lens_dist_reservoir_alloc(optics, name, samples, sharded);
+    if (!dist) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, dist);
+    if (lens != dist) lens_free(dist);
+
+    return lens;
+}
+
+bool optics_dist_record(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_dist_record(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_dist_record_n(struct optics_lens *lens, const double *values, size_t n)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_dist_record_n(lens, epoch, values, n);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret
+optics_dist_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_dist *value)
+{
+    return lens_dist_read(lens, epoch, value);
+}
+
+enum optics_ret optics_dist_peek(struct optics_lens *lens, struct optics_dist_total *value)
+{
+    return lens_dist_peek(lens, value);
+}
+
+void optics_dist_summarize(struct optics_dist *value, double *samples, size_t len)
+{
+    lens_dist_summarize(value, samples, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// histo
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_histo_create(
+        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+{
+    struct optics_lens *histo = lens_histo_alloc(optics, name, buckets, buckets_len);
+    if (!histo) return NULL;
+
+    if (!optics_lens_create(optics, histo)) {
+        lens_free(histo);
+        return NULL;
+    }
+
+    return histo;
+}
+
+struct optics_lens * optics_histo_open(
+        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+{
+    struct optics_lens *histo = lens_histo_alloc(optics, name, buckets, buckets_len);
+    if (!histo) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, histo);
+    if (lens != histo) lens_free(histo);
+
+    return lens;
+}
+
+struct optics_lens * optics_histo_sharded_create(
+        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+{
+    struct optics_lens *histo = lens_histo_sharded_alloc(optics, name, buckets, buckets_len);
+    if (!histo) return NULL;
+
+    if (!optics_lens_create(optics, histo)) {
+        lens_free(histo);
+        return NULL;
+    }
+
+    return histo;
+}
+
+struct optics_lens * optics_histo_sharded_open(
+        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+{
+    struct optics_lens *histo = lens_histo_sharded_alloc(optics, name, buckets, buckets_len);
+    if (!histo) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, histo);
+    if (lens != histo) lens_free(histo);
+
+    return lens;
+}
+
+bool optics_histo_inc(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_histo_inc(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_histo_inc_n(struct optics_lens *lens, const double *values, size_t n)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_histo_inc_n(lens, epoch, values, n);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+static_assert(sizeof(struct lens_histo_epoch) ==
+        (optics_histo_buckets_max + 2) * sizeof(size_t),
+        "histo handles expect the counters of the epochs to be contiguous");
+
+bool optics_histo_handle(optics_histo_t *handle, struct optics_lens *lens)
+{
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    if (!histo) return false;
+
+    *handle = (optics_histo_t) {
+        .lens = lens,
+        .epoch = (const size_t *) &lens->optics->epoch,
+        .edges = histo->edges,
+        .counts = histo->layout.len || histo->ticks ? NULL : (size_t *) histo->epochs[0].counts,
+    };
+    return true;
+}
+
+enum optics_ret
+optics_histo_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_histo *value)
+{
+    return lens_histo_read(lens, epoch, value);
+}
+
+enum optics_ret optics_histo_peek(struct optics_lens *lens, struct optics_histo *value)
+{
+    return lens_histo_peek(lens, value);
+}
+
+static size_t optics_histo_cursor_delta(size_t *last, size_t value)
+{
+    if (value <= *last) return 0;
+
+    size_t delta = value - *last;
+    *last = value;
+    return delta;
+}
+
+// A peek can only miss counts and never count them twice which means that the
+// largest count seen for each bucket is a lower bound of the real count. The
+// cursor only ever moves to that bound which keeps the deltas from going
+// negative while still adding up.
+enum optics_ret optics_histo_delta(
+        struct optics_lens *lens, struct optics_histo_cursor *cursor, struct optics_histo *delta)
+{
+    struct optics_histo value = {0};
+    enum optics_ret ret = lens_histo_peek(lens, &value);
+    if (ret != optics_ok) return ret;
+
+    struct optics_histo *last = &cursor->last;
+    if (last->buckets_len != value.buckets_len) {
+        *last = (struct optics_histo) { .buckets_len = value.buckets_len };
+        memcpy(last->buckets, value.buckets, sizeof(last->buckets));
+    }
+
+    *delta = (struct optics_histo) { .buckets_len = value.buckets_len };
+    memcpy(delta->buckets, value.buckets, sizeof(delta->buckets));
+
+    delta->below = optics_histo_cursor_delta(&last->below, value.below);
+    delta->above = optics_histo_cursor_delta(&last->above, value.above);
+    for (size_t i = 0; i < value.buckets_len - 1; ++i)
+        delta->counts[i] = optics_histo_cursor_delta(&last->counts[i], value.counts[i]);
+
+    return optics_ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// histo2d
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_histo2d_create(
+        struct optics *optics, const char *name,
+        const uint64_t *rows, size_t rows_len,
+        const uint64_t *cols, size_t cols_len)
+{
+    struct optics_lens *histo =
+        lens_histo2d_alloc(optics, name, rows, rows_len, cols, cols_len);
+    if (!histo) return NULL;
+
+    if (!optics_lens_create(optics, histo)) {
+        lens_free(histo);
+        return NULL;
+    }
+
+    return histo;
+}
+
+struct optics_lens * optics_histo2d_open(
+        struct optics *optics, const char *name,
+        const uint64_t *rows, size_t rows_len,
+        const uint64_t *cols, size_t cols_len)
+{
+    struct optics_lens *histo =
+        lens_histo2d_alloc(optics, name, rows, rows_len, cols, cols_len);
+    if (!histo) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, histo);
+    if (lens != histo) lens_free(histo);
+
+    return lens;
+}
+
+bool optics_histo2d_inc(struct optics_lens *lens, double x, double y)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_histo2d_inc(lens, epoch, x, y);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret
+optics_histo2d_read(
+        struct optics_lens *lens, optics_epoch_t epoch, struct optics_histo2d *value)
+{
+    return lens_histo2d_read(lens, epoch, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// hdr
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_hdr_create(
+        struct optics *optics, const char *name,
+        double lowest, double highest, size_t digits)
+{
+    struct optics_lens *hdr = lens_hdr_alloc(optics, name, lowest, highest, digits);
+    if (!hdr) return NULL;
+
+    if (!optics_lens_create(optics, hdr)) {
+        lens_free(hdr);
+        return NULL;
+    }
+
+    return hdr;
+}
+
+struct optics_lens * optics_hdr_open(
+        struct optics *optics, const char *name,
+        double lowest, double highest, size_t digits)
+{
+    struct optics_lens *hdr = lens_hdr_alloc(optics, name, lowest, highest, digits);
+    if (!hdr) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, hdr);
+    if (lens != hdr) lens_free(hdr);
+
+    return lens;
+}
+
+bool optics_hdr_record(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_hdr_record(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+enum optics_ret
+optics_hdr_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_hdr *value)
+{
+    return lens_hdr_read(lens, epoch, value);
+}
+
+void optics_hdr_summarize(struct optics_hdr *value)
+{
+    lens_hdr_summarize(value);
+}
+
+double optics_hdr_bucket(const struct optics_hdr *hdr, size_t i)
+{
+    return lens_hdr_bucket_lower(hdr->base, hdr->shift, i);
+}
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+struct optics_lens * optics_sketch_create(
+        struct optics *optics, const char *name,
+        double alpha, double lowest, double highest)
+{
+    struct optics_lens *sketch = lens_sketch_alloc(optics, name, alpha, lowest, highest);
+    if (!sketch) return NULL;
+
+    if (!optics_lens_create(optics, sketch)) {
+        lens_free(sketch);
+        return NULL;
+    }
+
+    return sketch;
 }
 
-struct optics_lens * optics_quantile_open(
-        struct optics *optics,
-        const char *name,
-        double target_quantile,
-        double estimate,
-        double adjustment)
+struct optics_lens * optics_sketch_open(
+        struct optics *optics, const char *name,
+        double alpha, double lowest, double highest)
 {
-    struct optics_lens *quantile =
-        lens_quantile_alloc(optics, name, target_quantile, estimate, adjustment);
-    if (!quantile) return NULL;
+    struct optics_lens *sketch = lens_sketch_alloc(optics, name, alpha, lowest, highest);
+    if (!sketch) return NULL;
 
-    struct optics_lens *lens = optics_lens_open(optics, quantile);
-    if (lens != quantile) lens_free(quantile);
+    struct optics_lens *lens = optics_lens_open(optics, sketch);
+    if (lens != sketch) lens_free(sketch);
 
     return lens;
 }
 
-bool optics_quantile_update(struct optics_lens *lens, double value) {
-    return lens_quantile_update(lens, optics_epoch(lens->optics), value);
+bool optics_sketch_record(struct optics_lens *lens, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_sketch_record(lens, epoch, value);
+
+    optics_epoch_exit(slot);
+    return ret;
 }
 
-enum optics_ret optics_quantile_read(
-        struct optics_lens *lens, optics_epoch_t epoch, struct optics_quantile *value)
+enum optics_ret
+optics_sketch_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_sketch *value)
 {
-    return lens_quantile_read(lens, epoch, value);
+    return lens_sketch_read(lens, epoch, value);
+}
+
+void optics_sketch_summarize(struct optics_sketch *value)
+{
+    lens_sketch_summarize(value);
+}
+
+double optics_sketch_quantile(const struct optics_sketch *sketch, double quantile)
+{
+    return lens_sketch_quantile(sketch, quantile);
+}
+
+double optics_sketch_bucket(const struct optics_sketch *sketch, size_t i)
+{
+    return lens_sketch_value_at(sketch->gamma, sketch->offset + (int64_t) i);
 }
 
 
 // -----------------------------------------------------------------------------
-// gauge
+// family
 // -----------------------------------------------------------------------------
 
-struct optics_lens * optics_gauge_create(struct optics *optics, const char *name)
+struct optics_lens * optics_family_create(
+        struct optics *optics, const char *name, enum optics_lens_type type,
+        const struct optics_family_dim *dims, size_t dims_len)
 {
-    struct optics_lens *gauge = lens_gauge_alloc(optics, name);
-    if (!gauge) return NULL;
+    if (type == optics_histo) {
+        optics_fail("histo families must be created with optics_family_histo_create");
+        return NULL;
+    }
 
-    if (!optics_lens_create(optics, gauge)) {
-        lens_free(gauge);
+    struct optics_lens *family =
+        lens_family_alloc(optics, name, type, dims, dims_len, NULL, 0);
+    if (!family) return NULL;
+
+    if (!optics_lens_create(optics, family)) {
+        lens_free(family);
         return NULL;
     }
 
-    return gauge;
+    return family;
 }
 
-struct optics_lens * optics_gauge_open(struct optics *optics, const char *name)
+struct optics_lens * optics_family_open(
+        struct optics *optics, const char *name, enum optics_lens_type type,
+        const struct optics_family_dim *dims, size_t dims_len)
 {
-    struct optics_lens *gauge = lens_gauge_alloc(optics, name);
-    if (!gauge) return NULL;
+    if (type == optics_histo) {
+        optics_fail("histo families must be opened with optics_family_histo_open");
+        return NULL;
+    }
 
-    struct optics_lens *lens = optics_lens_open(optics, gauge);
-    if (lens != gauge) lens_free(gauge);
+    struct optics_lens *family =
+        lens_family_alloc(optics, name, type, dims, dims_len, NULL, 0);
+    if (!family) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, family);
+    if (lens != family) lens_free(family);
 
     return lens;
 }
 
-bool optics_gauge_set(struct optics_lens *lens, double value)
+struct optics_lens * optics_family_histo_create(
+        struct optics *optics, const char *name,
+        const struct optics_family_dim *dims, size_t dims_len,
+        const uint64_t *buckets, size_t buckets_len)
 {
-    return lens_gauge_set(lens, optics_epoch(lens->optics), value);
+    struct optics_lens *family = lens_family_alloc(
+            optics, name, optics_histo, dims, dims_len, buckets, buckets_len);
+    if (!family) return NULL;
+
+    if (!optics_lens_create(optics, family)) {
+        lens_free(family);
+        return NULL;
+    }
+
+    return family;
 }
 
-enum optics_ret
-optics_gauge_read(struct optics_lens *lens, optics_epoch_t epoch, double *value)
+struct optics_lens * optics_family_histo_open(
+        struct optics *optics, const char *name,
+        const struct optics_family_dim *dims, size_t dims_len,
+        const uint64_t *buckets, size_t buckets_len)
 {
-    return lens_gauge_read(lens, epoch, value);
+    struct optics_lens *family = lens_family_alloc(
+            optics, name, optics_histo, dims, dims_len, buckets, buckets_len);
+    if (!family) return NULL;
+
+    struct optics_lens *lens = optics_lens_open(optics, family);
+    if (lens != family) lens_free(family);
+
+    return lens;
+}
+
+bool optics_family_counter_inc(struct optics_lens *lens, size_t index, int64_t value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_family_counter_inc(lens, epoch, index, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_family_gauge_set(struct optics_lens *lens, size_t index, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_family_gauge_set(lens, epoch, index, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_family_dist_record(struct optics_lens *lens, size_t index, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_family_dist_record(lens, epoch, index, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+bool optics_family_histo_inc(struct optics_lens *lens, size_t index, double value)
+{
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = lens_family_histo_inc(lens, epoch, index, value);
+
+    optics_epoch_exit(slot);
+    return ret;
+}
+
+size_t optics_family_len(struct optics_lens *lens)
+{
+    return lens_family_len(lens);
+}
+
+bool optics_family_key(struct optics_lens *lens, size_t index, struct optics_key *key)
+{
+    return lens_family_key(lens, index, key);
+}
+
+enum optics_ret optics_family_read(
+        struct optics_lens *lens, optics_epoch_t epoch, size_t index, struct optics_poll *poll)
+{
+    return lens_family_read(lens, epoch, index, poll);
 }
 
 
 // -----------------------------------------------------------------------------
-// dist
+// timing
 // -----------------------------------------------------------------------------
 
-struct optics_lens * optics_dist_create(struct optics *optics, const char *name)
+bool optics_timing_stop(struct optics_timing *timing)
 {
-    struct optics_lens *dist = lens_dist_alloc(optics, name);
-    if (!dist) return NULL;
-
-    if (!optics_lens_create(optics, dist)) {
-        lens_free(dist);
-        return NULL;
+    optics_ticks_t t1 = optics_ticks_stop();
+    double value = t1 > timing->t0 ? (t1 - timing->t0) * timing->factor : 0;
+
+    struct optics_lens *lens = timing->lens;
+    enum optics_lens_type type = optics_lens_type(lens);
+
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    bool ret = false;
+    switch (type) {
+    case optics_dist: ret = lens_dist_record(lens, epoch, value); break;
+    case optics_histo: ret = lens_histo_inc(lens, epoch, value); break;
+    case optics_quantile: ret = lens_quantile_update(lens, epoch, value); break;
+    case optics_quantiles: ret = lens_quantiles_update(lens, epoch, value); break;
+    case optics_hdr: ret = lens_hdr_record(lens, epoch, value); break;
+    case optics_sketch: ret = lens_sketch_record(lens, epoch, value); break;
+
+    case optics_counter:
+    case optics_gauge:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default:
+        optics_fail("unable to record timing in lens '%s' of type '%d'",
+                optics_lens_name(lens), type);
+        break;
     }
 
-    return dist;
+    optics_epoch_exit(slot);
+    return ret;
 }
 
-struct optics_lens * optics_dist_open(struct optics *optics, const char *name)
+// Lenses that record ticks get a factor of 0 which records the raw delta.
+static struct optics_timing
+optics_timing_resolve(struct optics_lens *lens, void *sub, bool ticks, double scale)
 {
-    struct optics_lens *dist = lens_dist_alloc(optics, name);
-    if (!dist) return NULL;
+    return (struct optics_timing) {
+        .lens = lens,
+        .sub = sub,
+        .factor = ticks ? 0 : optics_ticks_clock.nanos * scale,
+        .t0 = optics_ticks_start(),
+    };
+}
 
-    struct optics_lens *lens = optics_lens_open(optics, dist);
-    if (lens != dist) lens_free(dist);
+static double optics_timing_value(const struct optics_timing *timing)
+{
+    optics_ticks_t t1 = optics_ticks_stop();
+    double value = t1 > timing->t0 ? t1 - timing->t0 : 0;
+    return timing->factor ? value * timing->factor : value;
+}
 
-    return lens;
+struct optics_timing optics_dist_timing_start(struct optics_lens *lens, double scale)
+{
+    struct lens_dist *dist = lens_sub_ptr(lens, optics_dist);
+    return optics_timing_resolve(lens, dist, dist && dist->ticks, scale);
 }
 
-bool optics_dist_record(struct optics_lens *lens, double value)
+bool optics_dist_timing_stop(struct optics_timing *timing)
+{
+    double value = optics_timing_value(timing);
+    struct lens_dist *dist = timing->sub;
+    if (!dist) return false;
+
+    struct optics_lens *lens = timing->lens;
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(lens->optics, &slot);
+
+    if (lens_sample(lens)) lens_dist_sub_record_raw(dist, epoch, value);
+    else lens_dist_skip(dist, epoch);
+
+    optics_epoch_exit(slot);
+    return true;
+}
+
+struct optics_timing optics_histo_timing_start(struct optics_lens *lens, double scale)
 {
-    return lens_dist_record(lens, optics_epoch(lens->optics), value);
+    struct lens_histo *histo = lens_sub_ptr(lens, optics_histo);
+    return optics_timing_resolve(lens, histo, histo && histo->ticks, scale);
 }
 
-enum optics_ret
-optics_dist_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_dist *value)
+bool optics_histo_timing_stop(struct optics_timing *timing)
 {
-    return lens_dist_read(lens, epoch, value);
+    double value = optics_timing_value(timing);
+    struct lens_histo *histo = timing->sub;
+    if (!histo) return false;
+
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(timing->lens->optics, &slot);
+    lens_histo_sub_inc_raw(histo, epoch, value);
+    optics_epoch_exit(slot);
+    return true;
+}
+
+struct optics_timing optics_hdr_timing_start(struct optics_lens *lens, double scale)
+{
+    return optics_timing_resolve(lens, lens_sub_ptr(lens, optics_hdr), false, scale);
+}
+
+bool optics_hdr_timing_stop(struct optics_timing *timing)
+{
+    double value = optics_timing_value(timing);
+    struct lens_hdr *hdr = timing->sub;
+    if (!hdr) return false;
+
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(timing->lens->optics, &slot);
+    lens_hdr_sub_record(hdr, epoch, value);
+    optics_epoch_exit(slot);
+    return true;
+}
+
+struct optics_timing optics_sketch_timing_start(struct optics_lens *lens, double scale)
+{
+    return optics_timing_resolve(lens, lens_sub_ptr(lens, optics_sketch), false, scale);
+}
+
+bool optics_sketch_timing_stop(struct optics_timing *timing)
+{
+    double value = optics_timing_value(timing);
+    struct lens_sketch *sketch = timing->sub;
+    if (!sketch) return false;
+
+    atomic_size_t *slot;
+    optics_epoch_t epoch = optics_epoch_enter(timing->lens->optics, &slot);
+    lens_sketch_sub_record(sketch, epoch, value);
+    optics_epoch_exit(slot);
+    return true;
 }
 
 
 // -----------------------------------------------------------------------------
-// histo
+// batch
 // -----------------------------------------------------------------------------
 
-struct optics_lens * optics_histo_create(
-        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+static struct optics_lens *
+optics_lens_spec_alloc(struct optics *optics, const struct optics_lens_spec *spec)
 {
-    struct optics_lens *histo = lens_histo_alloc(optics, name, buckets, buckets_len);
-    if (!histo) return NULL;
+    switch (spec->type) {
+
+    case optics_counter:
+        if (spec->sharded) return lens_counter_sharded_alloc(optics, spec->name);
+        return lens_counter_alloc(optics, spec->name);
+
+    case optics_gauge:
+        return lens_gauge_agg_alloc(optics, spec->name, spec->gauge.agg, spec->gauge.sticky);
+
+    case optics_dist:
+        return lens_dist_reservoir_alloc(optics, spec->name,
+                spec->dist.samples ? spec->dist.samples : optics_dist_samples,
+                spec->sharded);
+
+    case optics_histo:
+        if (spec->sharded) {
+            return lens_histo_sharded_alloc(optics, spec->name,
+                    spec->histo.buckets, spec->histo.buckets_len);
+        }
+        return lens_histo_alloc(optics, spec->name,
+                spec->histo.buckets, spec->histo.buckets_len);
+
+    case optics_quantile:
+        if (spec->quantile.adaptive) {
+            return lens_quantile_adaptive_alloc(optics, spec->name,
+                    spec->quantile.quantile,
+                    spec->quantile.estimate,
+                    spec->quantile.adjustment_value);
+        }
+        return lens_quantile_alloc(optics, spec->name,
+                spec->quantile.quantile,
+                spec->quantile.estimate,
+                spec->quantile.adjustment_value);
+
+    case optics_quantiles:
+        return lens_quantiles_alloc(optics, spec->name,
+                spec->quantiles.quantiles, spec->quantiles.len,
+                spec->quantiles.estimate,
+                spec->quantiles.adjustment_value);
+
+    case optics_hdr:
+        return lens_hdr_alloc(optics, spec->name,
+                spec->hdr.lowest, spec->hdr.highest, spec->hdr.digits);
+
+    case optics_sketch:
+        return lens_sketch_alloc(optics, spec->name,
+                spec->sketch.alpha, spec->sketch.lowest, spec->sketch.highest);
+
+    case optics_meter: return lens_meter_alloc(optics, spec->name);
+    case optics_topk: return lens_topk_alloc(optics, spec->name, spec->topk.k);
+    case optics_hll: return lens_hll_alloc(optics, spec->name, spec->hll.precision);
+    case optics_updown: return lens_updown_alloc(optics, spec->name);
+
+    case optics_histo2d:
+        return lens_histo2d_alloc(optics, spec->name,
+                spec->histo2d.rows, spec->histo2d.rows_len,
+                spec->histo2d.cols, spec->histo2d.cols_len);
+
+    case optics_family:
+        return lens_family_alloc(optics, spec->name, spec->family.type,
+                spec->family.dims, spec->family.dims_len,
+                spec->family.buckets, spec->family.buckets_len);
 
-    if (!optics_lens_create(optics, histo)) {
-        lens_free(histo);
+    default:
+        optics_fail("unknown lens type '%d' for lens '%s'", spec->type, spec->name);
         return NULL;
     }
+}
 
-    return histo;
+bool optics_lens_open_batch(
+        struct optics *optics, const struct optics_lens_spec *specs, size_t len,
+        struct optics_lens **lenses)
+{
+    uint64_t *hashes = calloc(len, sizeof(*hashes));
+    optics_assert_alloc(hashes);
+
+    // Allocations and argument validation are done outside of the lock since
+    // that's where most of the time is spent.
+    size_t i = 0;
+    size_t parts_len[optics_parts] = {0};
+    for (; i < len; ++i) {
+        lenses[i] = optics_lens_spec_alloc(optics, &specs[i]);
+        if (!lenses[i]) goto fail_alloc;
+
+        hashes[i] = htable_hash(lens_name(lenses[i]));
+        parts_len[optics_part(optics, hashes[i]) - optics->parts]++;
+    }
+
+    // Each partition is only locked once for all of its lenses.
+    for (size_t j = 0; j < optics_parts; ++j) {
+        if (!parts_len[j]) continue;
+        struct optics_part *part = &optics->parts[j];
+
+        slock_lock(&part->lock);
+
+        optics_keys_reserve(optics, part, parts_len[j]);
+
+        for (i = 0; i < len; ++i) {
+            if (optics_part(optics, hashes[i]) != part) continue;
+
+            struct optics_lens *other = optics_keys_put(optics, part, lenses[i], hashes[i]);
+            if (!other) {
+                optics_push_lens(optics, part, lenses[i]);
+                continue;
+            }
+
+            // Our lens was never published so it can be freed right away.
+            lens_free(lenses[i]);
+            lenses[i] = other;
+        }
+
+        slock_unlock(&part->lock);
+    }
+
+    free(hashes);
+    return true;
+
+  fail_alloc:
+    for (size_t j = 0; j < i; ++j) lens_free(lenses[j]);
+    free(hashes);
+    return false;
 }
 
-struct optics_lens * optics_histo_open(
-        struct optics *optics, const char *name, const uint64_t *buckets, size_t buckets_len)
+
+// -----------------------------------------------------------------------------
+// lazy
+// -----------------------------------------------------------------------------
+// Concurrent first records all go through optics_lens_open_batch which returns
+// the same lens to every one of them thanks to the key index so the publish
+// can't lose a lens.
+
+struct optics_lazy
 {
-    struct optics_lens *histo = lens_histo_alloc(optics, name, buckets, buckets_len);
-    if (!histo) return NULL;
+    struct optics *optics;
+    struct optics_lens_spec spec;
+    char name[optics_name_max_len];
 
-    struct optics_lens *lens = optics_lens_open(optics, histo);
-    if (lens != histo) lens_free(histo);
+    _Atomic(struct optics_lens *) lens;
+};
+
+struct optics_lazy *
+optics_lazy_open(struct optics *optics, const struct optics_lens_spec *spec)
+{
+    if (strnlen(spec->name, optics_name_max_len) == optics_name_max_len) {
+        optics_fail("lens name '%s' length is greater than max length '%d'",
+                spec->name, optics_name_max_len);
+        return NULL;
+    }
+
+    struct optics_lazy *lazy = optics_alloc(optics, sizeof(*lazy));
+    if (!lazy) return NULL;
+
+    lazy->optics = optics;
+    lazy->spec = *spec;
+    strlcpy(lazy->name, spec->name, sizeof(lazy->name));
+    lazy->spec.name = lazy->name;
+
+    return lazy;
+}
+
+// Recorders might still be holding the stub so it goes through the epochs like
+// everything else.
+void optics_lazy_close(struct optics_lazy *lazy)
+{
+    struct optics_lens *lens = atomic_load_explicit(&lazy->lens, memory_order_acquire);
+    if (lens) optics_lens_close(lens);
+
+    bool ok = optics_defer_free(lazy->optics, lazy, sizeof(*lazy));
+    optics_assert(ok, "unable to defer the free of the lazy lens");
+}
+
+static optics_noinline struct optics_lens *optics_lazy_materialize(struct optics_lazy *lazy)
+{
+    struct optics_lens *lens = NULL;
+    if (!optics_lens_open_batch(lazy->optics, &lazy->spec, 1, &lens)) return NULL;
+
+    struct optics_lens *old = NULL;
+    if (!atomic_compare_exchange_strong_explicit(
+                    &lazy->lens, &old, lens, memory_order_release, memory_order_acquire))
+        return old;
 
     return lens;
 }
 
-bool optics_histo_inc(struct optics_lens *lens, double value)
+struct optics_lens * optics_lazy_lens(struct optics_lazy *lazy)
 {
-    return lens_histo_inc(lens, optics_epoch(lens->optics), value);
+    struct optics_lens *lens = atomic_load_explicit(&lazy->lens, memory_order_acquire);
+    if (optics_likely(lens != NULL)) return lens;
+    return optics_lazy_materialize(lazy);
 }
 
-enum optics_ret
-optics_histo_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_histo *value)
+
+// -----------------------------------------------------------------------------
+// static
+// -----------------------------------------------------------------------------
+// The linker only defines the bounds of the section if at least one static
+// lens was linked in, hence the weak declarations. The section holds pointers
+// to the descriptors rather than the descriptors themselves so that padding
+// between the entries of different objects can't break the iteration.
+
+extern struct optics_static *__start_optics_static[] __attribute__((weak));
+extern struct optics_static *__stop_optics_static[] __attribute__((weak));
+
+// Only one optics of the process can back the static lenses.
+static atomic_uintptr_t optics_static_owner = 0;
+
+static bool optics_static_open(struct optics *optics)
 {
-    return lens_histo_read(lens, epoch, value);
+    if (!__start_optics_static) return true;
+    size_t len = __stop_optics_static - __start_optics_static;
+    if (!len) return true;
+
+    uintptr_t owner = 0;
+    if (!atomic_compare_exchange_strong(&optics_static_owner, &owner, pun_ptoi(optics)))
+        return true;
+
+    struct optics_lens_spec *specs = calloc(len, sizeof(*specs));
+    optics_assert_alloc(specs);
+    struct optics_lens **lenses = calloc(len, sizeof(*lenses));
+    optics_assert_alloc(lenses);
+
+    for (size_t i = 0; i < len; ++i) specs[i] = __start_optics_static[i]->spec;
+
+    bool ok = optics_lens_open_batch(optics, specs, len, lenses);
+    if (ok) {
+        for (size_t i = 0; i < len; ++i) __start_optics_static[i]->lens = lenses[i];
+    }
+    else atomic_store(&optics_static_owner, 0);
+
+    free(lenses);
+    free(specs);
+    return ok;
+}
+
+static void optics_static_close(struct optics *optics)
+{
+    if (atomic_load(&optics_static_owner) != pun_ptoi(optics)) return;
+
+    size_t len = __stop_optics_static - __start_optics_static;
+    for (size_t i = 0; i < len; ++i) __start_optics_static[i]->lens = NULL;
+
+    atomic_store(&optics_static_owner, 0);
 }
 
 
@@ -576,21 +3038,212 @@ optics_histo_read(struct optics_lens *lens, optics_epoch_t epoch, struct optics_
 // value
 // -----------------------------------------------------------------------------
 
-bool optics_poll_normalize(
-        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+static bool optics_poll_normalize_lens(struct lens_normalize *norm)
 {
+    const struct optics_poll *poll = norm->poll;
+
     switch (poll->type) {
-    case optics_counter: return lens_counter_normalize(poll, cb, ctx);
-    case optics_gauge: return lens_gauge_normalize(poll, cb, ctx);
-    case optics_dist: return lens_dist_normalize(poll, cb, ctx);
-    case optics_histo: return lens_histo_normalize(poll, cb, ctx);
-    case optics_quantile: return lens_quantile_normalize(poll, cb, ctx);
+    case optics_counter: return lens_counter_normalize(poll, norm);
+    case optics_gauge: return lens_gauge_normalize(poll, norm);
+    case optics_dist: return lens_dist_normalize(poll, norm);
+    case optics_histo: return lens_histo_normalize(poll, norm);
+    case optics_quantile: return lens_quantile_normalize(poll, norm);
+    case optics_quantiles: return lens_quantiles_normalize(poll, norm);
+    case optics_hdr: return lens_hdr_normalize(poll, norm);
+    case optics_sketch: return lens_sketch_normalize(poll, norm);
+    case optics_meter: return lens_meter_normalize(poll, norm);
+    case optics_topk: return lens_topk_normalize(poll, norm);
+    case optics_hll: return lens_hll_normalize(poll, norm);
+    case optics_updown: return lens_updown_normalize(poll, norm);
+    case optics_histo2d: return lens_histo2d_normalize(poll, norm);
+
+    // Families are expanded into their children by the poller.
+    case optics_family:
     default:
         optics_fail("unknown lens type '%d'", poll->type);
         return false;
     }
 }
 
+struct optics_normalize_ctx
+{
+    optics_normalize_cb_t cb;
+    void *ctx;
+};
+
+static bool optics_normalize_relative(
+        void *ctx_, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) key_len;
+    struct optics_normalize_ctx *ctx = ctx_;
+    return ctx->cb(ctx->ctx, ts, key, value);
+}
+
+bool optics_poll_normalize(
+        const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx)
+{
+    struct optics_normalize_ctx relative = { .cb = cb, .ctx = ctx };
+
+    struct lens_normalize norm = {
+        .poll = poll,
+        .qualified = false,
+        .cb = optics_normalize_relative,
+        .ctx = &relative,
+    };
+    return optics_poll_normalize_lens(&norm);
+}
+
+bool optics_poll_normalize_qualified(
+        const struct optics_poll *poll, optics_normalize_qualified_cb_t cb, void *ctx)
+{
+    struct lens_normalize norm = {
+        .poll = poll,
+        .qualified = true,
+        .cb = cb,
+        .ctx = ctx,
+    };
+    return optics_poll_normalize_lens(&norm);
+}
+
+static bool optics_poll_keys_noop(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) ctx, (void) ts, (void) key, (void) key_len, (void) value;
+    return true;
+}
+
+// Keys that weren't emitted by the normalizer (eg. an empty sketch zero bucket)
+// are left NULL and will be formatted on demand.
+struct optics_poll_keys * optics_poll_keys_alloc(const struct optics_poll *poll)
+{
+    struct optics_key capture[optics_poll_keys_max] = {0};
+
+    struct optics_poll uncached = *poll;
+    uncached.keys = NULL;
+
+    struct lens_normalize norm = {
+        .poll = &uncached,
+        .qualified = true,
+        .cb = optics_poll_keys_noop,
+        .capture = capture,
+    };
+    if (!optics_poll_normalize_lens(&norm)) return NULL;
+
+    size_t len = sizeof(struct optics_poll_keys);
+    for (size_t i = 0; i < optics_poll_keys_max; ++i) {
+        if (capture[i].len) len += capture[i].len + 1;
+    }
+
+    struct optics_poll_keys *keys = calloc(1, len);
+    optics_assert_alloc(keys);
+
+    keys->rel = norm.base - strnlen(poll->key, optics_name_max_len);
+
+    char *it = (char *) (keys + 1);
+    for (size_t i = 0; i < optics_poll_keys_max; ++i) {
+        if (!capture[i].len) continue;
+
+        memcpy(it, capture[i].data, capture[i].len + 1);
+        keys->data[i] = it;
+        keys->lens[i] = capture[i].len;
+        keys->len = i + 1;
+
+        it += capture[i].len + 1;
+    }
+
+    return keys;
+}
+
+size_t optics_record_len(enum optics_lens_type type)
+{
+    const size_t header = offsetof(struct optics_record, value);
+    const union optics_record_value *value = NULL;
+
+    switch (type) {
+    case optics_counter: return header + sizeof(value->counter);
+    case optics_gauge: return header + sizeof(value->gauge);
+    case optics_dist: return header + sizeof(value->dist);
+    case optics_histo: return header + sizeof(value->histo);
+    case optics_quantile: return header + sizeof(value->quantile);
+    case optics_quantiles: return header + sizeof(value->quantiles);
+    case optics_hdr: return header + sizeof(value->hdr);
+    case optics_sketch: return header + sizeof(value->sketch);
+    case optics_meter: return header + sizeof(value->meter);
+    case optics_topk: return header + sizeof(value->topk);
+    case optics_hll: return header + sizeof(value->hll);
+    case optics_updown: return header + sizeof(value->updown);
+    case optics_histo2d: return header + sizeof(value->histo2d);
+    case optics_family:
+    default: return sizeof(struct optics_record);
+    }
+}
+
+// The normalizers never look at the dist samples so the poll is only partially
+// filled to avoid copying the samples.
+static bool optics_record_poll(
+        const struct optics_record *record, struct optics_poll *poll)
+{
+    poll->type = record->type;
+    poll->host = record->host;
+    poll->prefix = record->prefix;
+    poll->key = record->key;
+    poll->keys = record->keys;
+    poll->ts = record->ts;
+    poll->elapsed = record->elapsed;
+    poll->ts_nanos = record->ts_nanos;
+    poll->elapsed_secs = record->elapsed_secs;
+    poll->total = record->total;
+
+    const union optics_record_value *value = &record->value;
+
+    switch (record->type) {
+    case optics_counter: poll->value.counter = value->counter; break;
+    case optics_gauge: poll->value.gauge = value->gauge; break;
+    case optics_histo: poll->value.histo = value->histo; break;
+    case optics_quantile: poll->value.quantile = value->quantile; break;
+    case optics_quantiles: poll->value.quantiles = value->quantiles; break;
+    case optics_hdr: poll->value.hdr = value->hdr; break;
+    case optics_sketch: poll->value.sketch = value->sketch; break;
+    case optics_meter: poll->value.meter = value->meter; break;
+    case optics_topk: poll->value.topk = value->topk; break;
+    case optics_hll: poll->value.hll = value->hll; break;
+    case optics_updown: poll->value.updown = value->updown; break;
+    case optics_histo2d: poll->value.histo2d = value->histo2d; break;
+
+    case optics_dist:
+        poll->value.dist.n = value->dist.n;
+        poll->value.dist.p50 = value->dist.p50;
+        poll->value.dist.p90 = value->dist.p90;
+        poll->value.dist.p99 = value->dist.p99;
+        poll->value.dist.max = value->dist.max;
+        break;
+
+    case optics_family:
+    default:
+        optics_fail("unknown lens type '%d'", record->type);
+        return false;
+    }
+
+    return true;
+}
+
+bool optics_record_normalize(
+        const struct optics_record *record, optics_normalize_cb_t cb, void *ctx)
+{
+    struct optics_poll poll;
+    if (!optics_record_poll(record, &poll)) return false;
+    return optics_poll_normalize(&poll, cb, ctx);
+}
+
+bool optics_record_normalize_qualified(
+        const struct optics_record *record,
+        optics_normalize_qualified_cb_t cb, void *ctx)
+{
+    struct optics_poll poll;
+    if (!optics_record_poll(record, &poll)) return false;
+    return optics_poll_normalize_qualified(&poll, cb, ctx);
+}
+
 
 // -----------------------------------------------------------------------------
 // misc
@@ -598,3 +3251,19 @@ bool optics_poll_normalize(
 
 extern inline void optics_timer_start(optics_timer_t *t0);
 extern inline double optics_timer_elapsed(optics_timer_t *t0, double scale);
+
+extern inline optics_ticks_t optics_ticks_monotonic(void);
+extern inline optics_ticks_t optics_ticks_start(void);
+extern inline optics_ticks_t optics_ticks_stop(void);
+extern inline double optics_ticks_nanos(optics_ticks_t ticks);
+extern inline double optics_ticks_elapsed(optics_ticks_t t0, double scale);
+extern inline struct optics_timing optics_timing_start(struct optics_lens *lens, double scale);
+extern inline void optics_timing_cleanup(struct optics_timing *timing);
+extern inline void optics_dist_timing_cleanup(struct optics_timing *timing);
+extern inline void optics_histo_timing_cleanup(struct optics_timing *timing);
+extern inline void optics_hdr_timing_cleanup(struct optics_timing *timing);
+extern inline void optics_sketch_timing_cleanup(struct optics_timing *timing);
+
+extern inline bool optics_counter_handle_inc(const optics_counter_t *handle, int64_t value);
+extern inline bool optics_gauge_handle_set(const optics_gauge_t *handle, double value);
+extern inline bool optics_histo_handle_inc(const optics_histo_t *handle, double value);
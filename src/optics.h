@@ -25,13 +25,50 @@ enum {
     // Maximum number of allowed buckets in a histogram lens.
     optics_histo_buckets_max = 8,
 
+    // Maximum number of allowed buckets in each dimension of a histo2d lens.
+    optics_histo2d_buckets_max = 16,
+
     // The size here is a trade-off between memory usage and the growth rate of
     // the error bounds as more elements are added to the reservoir. Since we're
     // calculating percentiles, we need at least 100 values which requires a
     // non-trivial amount space (sizeof(double) * 100 * 2 = 1600 bytes). Now
     // since there's no way to achieve a constant error bound with reservoir
     // sampling, we tweaked it to stay on the low side of memory consumption.
+    // It's only the default and the size can be picked for each lens.
     optics_dist_samples = 200,
+    optics_dist_samples_max = 1 << 12,
+
+    // Bounds on the log-linear histogram configuration. Each digit of
+    // precision roughly multiplies the number of buckets by 10.
+    optics_hdr_digits_max = 3,
+    optics_hdr_buckets_max = 1 << 16,
+
+    // Bound on the number of buckets of a sketch lens which is a function of
+    // its relative accuracy and the range of values it covers.
+    optics_sketch_buckets_max = 1 << 16,
+
+    // Maximum number of quantiles tracked by a single quantiles lens.
+    optics_quantiles_max = 8,
+
+    // Bounds on the number of dimensions of a family lens and on the number
+    // of children which is the product of the number of labels of all its
+    // dimensions.
+    optics_family_dims_max = 4,
+    optics_family_children_max = 1 << 14,
+
+    // Bounds on the number of keys reported by a topk lens and on the length
+    // of the keys including the terminating nul.
+    optics_topk_max = 32,
+    optics_topk_key_max = 64,
+
+    // Bounds on the precision of a hll lens which uses 2^precision registers
+    // and has a standard error of around 1.04 / sqrt(2^precision).
+    optics_hll_precision_min = 4,
+    optics_hll_precision_max = 16,
+
+    // Bound on the number of normalized keys of a lens that can be cached by
+    // the poller which covers every fixed key of the lens types.
+    optics_poll_keys_max = 16,
 };
 
 typedef uint64_t optics_ts_t;
@@ -60,6 +97,19 @@ extern __thread struct optics_error optics_errno;
 void optics_perror(struct optics_error *err);
 size_t optics_strerror(struct optics_error *err, char *dest, size_t len);
 
+// In cheap mode, only the first failure of each call site formats its message
+// and captures a backtrace. Later failures record the file, line, errno and
+// raw format string, and warnings are reported at most once per second per
+// call site. This keeps a misconfigured lens that fails on every call off the
+// slow path. Defaults to cheap when compiled with OPTICS_ERROR_CHEAP.
+enum optics_error_mode
+{
+    optics_error_full = 0,
+    optics_error_cheap = 1,
+};
+
+void optics_error_mode(enum optics_error_mode mode);
+
 
 // -----------------------------------------------------------------------------
 // optics
@@ -71,9 +121,39 @@ struct optics * optics_create(const char *name);
 struct optics * optics_create_at(const char *name, optics_ts_t now);
 void optics_close(struct optics *);
 
+// Allocates all the lenses within a shared memory region which can be mapped
+// read-only by another process to snapshot the lenses without any involvement
+// from this process. A NULL shm name creates an anonymous memfd which can be
+// shared by passing along the file descriptor returned by optics_shm_fd.
+struct optics * optics_create_shm(const char *name, const char *shm);
+struct optics * optics_create_shm_at(const char *name, const char *shm, optics_ts_t now);
+int optics_shm_fd(struct optics *);
+
+// Allocates the optics and all its lenses within an anonymous shared mapping of
+// a fixed length which must be created before forking worker processes. Every
+// child then records into the same lenses and can also create new ones which
+// are synchronized through the locks within the mapping. Only the creating
+// process should poll and calling optics_close in a child simply unmaps the
+// region. The region can't grow past its initial length since mappings created
+// after the fork aren't inherited by the children.
+struct optics * optics_create_fork(const char *name, size_t len);
+struct optics * optics_create_fork_at(const char *name, size_t len, optics_ts_t now);
+
 const char *optics_get_prefix(struct optics *);
 bool optics_set_prefix(struct optics *, const char *prefix);
 
+// Tracks the writers active in each epoch which lets the poller wait exactly
+// until in-flight records are done instead of sleeping for a fixed grace
+// period. Adds two atomic operations on a per-cpu cache line to every record.
+// Records started before the tracking is enabled are not accounted for.
+void optics_set_quiescence(struct optics *, bool enable);
+
+// Backs the lenses with 2MB huge pages which keeps the TLB footprint of large
+// numbers of lenses down for both the records and the poller. Only applies to
+// the lenses allocated after the call, which excludes the static lenses, and,
+// in shm mode, only advises the kernel which requires shmem huge pages.
+void optics_set_huge_pages(struct optics *);
+
 
 // -----------------------------------------------------------------------------
 // lens
@@ -88,6 +168,15 @@ enum optics_lens_type
     optics_dist,
     optics_histo,
     optics_quantile,
+    optics_hdr,
+    optics_sketch,
+    optics_quantiles,
+    optics_family,
+    optics_meter,
+    optics_topk,
+    optics_hll,
+    optics_updown,
+    optics_histo2d,
 };
 
 enum optics_ret
@@ -99,18 +188,149 @@ enum optics_ret
 };
 
 struct optics_lens * optics_lens_get(struct optics *, const char *name);
+
+// Lookups of the same name can reuse the hash returned by optics_lens_hash to
+// avoid rehashing the name on every call.
+uint64_t optics_lens_hash(const char *name);
+struct optics_lens * optics_lens_get_h(struct optics *, const char *name, uint64_t hash);
+
+// Same as optics_lens_get but hits are kept in a small per-thread cache which
+// is invalidated by every lens close. Repeated lookups through the same name
+// pointer then skip the hash and the index altogether. Meant for hot paths
+// that look up a bounded set of names.
+struct optics_lens * optics_lens_get_cached(struct optics *, const char *name);
+
 enum optics_lens_type optics_lens_type(struct optics_lens *);
 const char * optics_lens_name(struct optics_lens *);
 bool optics_lens_close(struct optics_lens *);
 
+// Dist, quantile and quantiles lenses can be set to only record one in rate
+// calls while their count still includes every call. A rate of 1 records
+// every call. Alternatively, the rate can be adjusted at every poll such that
+// around target calls are recorded per poll where 0 disables the adjustment.
+bool optics_lens_sample_rate(struct optics_lens *, uint32_t rate);
+bool optics_lens_sample_target(struct optics_lens *, uint32_t target);
+
+// Lenses with a ttl are closed by the poller once they've been idle for the
+// given number of polls where 0 disables the expiry. A lens is idle when
+// nothing was recorded during the poll. Gauges and updowns are never idle
+// unless the poller opted into optics_poller_expire_unchanged. Handles to an
+// expired lens must not be used once it's closed which the poller's expire
+// callback can enforce. Not supported by families.
+bool optics_lens_ttl(struct optics_lens *, uint32_t polls);
+
+// Dist and histo lenses can be set to store the raw tick deltas of their typed
+// timings which are only converted to time units of the given scale when the
+// lens is read. Values recorded through the regular functions are still in the
+// time unit and get converted to ticks. Must be called before anything is
+// recorded into the lens or any handle is taken on it.
+bool optics_lens_ticks(struct optics_lens *, double scale);
+
+// Caps the number of live lenses of the optics, or of those whose name starts
+// with prefix, where a cap of 0 removes it. Once a cap is reached, opening a
+// new lens returns the shared overflow lens of its type, named
+// overflow.<type>, which aggregates the values of every rejected lens while
+// creating a new lens fails. Closing the overflow lens is a no-op. A warning is
+// emitted on the first rejection and optics_lens_rejected counts them all.
+// Up to 8 prefixes can be capped. Caps must be set before the lenses they
+// apply to are opened concurrently and are approximate under concurrent opens.
+bool optics_lens_cap(struct optics *, size_t cap);
+bool optics_lens_cap_prefix(struct optics *, const char *prefix, size_t cap);
+size_t optics_lens_rejected(struct optics *);
+
 struct optics_lens * optics_counter_create(struct optics *, const char *name);
 struct optics_lens * optics_counter_open(struct optics *, const char *name);
 bool optics_counter_inc(struct optics_lens *, int64_t value);
 
+// Records a batch of values at the cost of a single atomic operation.
+bool optics_counter_inc_n(struct optics_lens *, const int64_t *values, size_t n);
+
+// Sharded counters keep one cache line per cpu which avoids contention on
+// heavily recorded counters at the cost of memory and a slower read. They're
+// otherwise indistinguishable from a regular counter.
+//
+// On numa machines the shards of all sharded lenses are grouped by node and
+// each group is placed on pages bound to the memory of its node such that
+// recorders never write to remote memory. This costs up to one extra page per
+// node, plus one, for every sharded lens.
+struct optics_lens * optics_counter_sharded_create(struct optics *, const char *name);
+struct optics_lens * optics_counter_sharded_open(struct optics *, const char *name);
+
+// Counters also accumulate the values reset by the poller into a running total
+// which peeking returns along with the values not yet polled. This lets any
+// number of consumers read a counter concurrently without resetting it for the
+// poller or for each other. Each consumer keeps its own cursor from which the
+// delta since its last read is computed. A peek that races with the poller can
+// miss the values being polled which the next delta then makes up for.
+struct optics_counter_cursor
+{
+    int64_t last;
+};
+
+enum optics_ret optics_counter_peek(struct optics_lens *, int64_t *value);
+enum optics_ret optics_counter_delta(
+        struct optics_lens *, struct optics_counter_cursor *, int64_t *delta);
+
+// Thread-local buffer in front of a counter lens which avoids atomic operations
+// on every increment. Buffered values are published when an epoch change is
+// detected, when the absolute buffered value reaches threshold (0 disables) or
+// on an explicit flush. A handle must only be used by a single thread and
+// should be flushed before the thread goes idle or the lens is closed as the
+// buffered value would otherwise never make it to the poller.
+struct optics_counter_local
+{
+    struct optics_lens *lens;
+    size_t epoch;
+
+    int64_t value;
+    int64_t threshold;
+};
+
+bool optics_counter_local_init(
+        struct optics_counter_local *, struct optics_lens *, int64_t threshold);
+bool optics_counter_local_inc(struct optics_counter_local *, int64_t value);
+bool optics_counter_local_flush(struct optics_counter_local *);
+
 struct optics_lens * optics_gauge_create(struct optics *, const char *name);
 struct optics_lens * optics_gauge_open(struct optics *, const char *name);
 bool optics_gauge_set(struct optics_lens *, double value);
 
+// Up/down gauges are integer gauges changed by atomically adding deltas which,
+// unlike setting a gauge from a separate counter, never races with other
+// writers. The value is retained across polls while min and max are the
+// watermarks reached by the value during each poll interval.
+struct optics_updown
+{
+    int64_t value;
+    int64_t min;
+    int64_t max;
+};
+
+struct optics_lens * optics_updown_create(struct optics *, const char *name);
+struct optics_lens * optics_updown_open(struct optics *, const char *name);
+bool optics_updown_add(struct optics_lens *, int64_t delta);
+
+// Aggregated gauges report a reduction of the values set during each poll
+// interval instead of the last value ever set which means that spikes between
+// polls aren't lost. Intervals without values report 0 unless the gauge is
+// sticky in which case the value of the previous interval is reported. The
+// none aggregation is the regular gauge.
+enum optics_gauge_agg
+{
+    optics_gauge_agg_none = 0,
+    optics_gauge_agg_last,
+    optics_gauge_agg_max,
+    optics_gauge_agg_min,
+    optics_gauge_agg_mean,
+};
+
+struct optics_lens * optics_gauge_agg_create(
+        struct optics *, const char *name, enum optics_gauge_agg agg, bool sticky);
+struct optics_lens * optics_gauge_agg_open(
+        struct optics *, const char *name, enum optics_gauge_agg agg, bool sticky);
+
+// The samples are only valid until the next read of the lens which means that
+// backends must copy them if they need to keep them around past the poll.
 struct optics_dist
 {
     size_t n;
@@ -118,13 +338,45 @@ struct optics_dist
     double p90;
     double p99;
     double max;
-    double samples[optics_dist_samples];
+
+    size_t samples_len;
+    const double *samples;
 };
 
 struct optics_lens * optics_dist_create(struct optics *, const char *name);
 struct optics_lens * optics_dist_open(struct optics *, const char *name);
 bool optics_dist_record(struct optics_lens *, double value);
 
+// Records a batch of values while only taking the lock of the lens once.
+bool optics_dist_record_n(struct optics_lens *, const double *values, size_t n);
+
+// Sharded dists keep one lock-free reservoir per cpu which are merged when the
+// lens is read. Recording never blocks and reads are never skipped by the
+// poller at the cost of the reservoir memory being multiplied by the number of
+// cpus.
+struct optics_lens * optics_dist_sharded_create(struct optics *, const char *name);
+struct optics_lens * optics_dist_sharded_open(struct optics *, const char *name);
+
+// Dist with a reservoir of the given number of samples instead of
+// optics_dist_samples. Smaller reservoirs save memory on low rate lenses while
+// larger ones give more stable tail percentiles.
+struct optics_lens * optics_dist_reservoir_create(
+        struct optics *, const char *name, size_t samples, bool sharded);
+struct optics_lens * optics_dist_reservoir_open(
+        struct optics *, const char *name, size_t samples, bool sharded);
+
+// Running count and max of the values polled from a dist which, unlike the
+// percentiles, can be merged across polls and lenses by summing the counts and
+// taking the largest max. Peeking doesn't reset the dist but, since reservoirs
+// can only be read destructively, only covers the values polled so far.
+struct optics_dist_total
+{
+    size_t n;
+    double max;
+};
+
+enum optics_ret optics_dist_peek(struct optics_lens *, struct optics_dist_total *value);
+
 struct optics_histo
 {
     size_t buckets_len;
@@ -140,6 +392,63 @@ struct optics_lens * optics_histo_open(
         struct optics *, const char *name, const uint64_t *buckets, size_t buckets_len);
 bool optics_histo_inc(struct optics_lens *, double value);
 
+// Buckets a batch of values locally before publishing them at the cost of one
+// atomic operation per non-empty bucket.
+bool optics_histo_inc_n(struct optics_lens *, const double *values, size_t n);
+
+// Sharded histos keep one set of bucket counters per cpu which are summed by
+// the reader. Same trade-offs as sharded counters.
+struct optics_lens * optics_histo_sharded_create(
+        struct optics *, const char *name, const uint64_t *buckets, size_t buckets_len);
+struct optics_lens * optics_histo_sharded_open(
+        struct optics *, const char *name, const uint64_t *buckets, size_t buckets_len);
+
+// Running bucket counts which work the same way as for counters. Peeks never
+// count a value twice so the cursor only moves forward for each bucket and the
+// deltas of a consumer always add up to the counts it last saw.
+struct optics_histo_cursor
+{
+    struct optics_histo last;
+};
+
+enum optics_ret optics_histo_peek(struct optics_lens *, struct optics_histo *value);
+enum optics_ret optics_histo_delta(
+        struct optics_lens *, struct optics_histo_cursor *, struct optics_histo *delta);
+
+// Two-dimensional histogram, or heatmap, which counts the samples in the
+// cells of a matrix whose rows are delimited by the edges of the x values and
+// whose columns by the edges of the y values. Like histos, buckets are
+// half-open on the right. Samples outside of the edges of either dimension are
+// only counted in outside.
+//
+// Counts are in row-major order such that the count of row i and column j is
+// counts[i * (cols_len - 1) + j]. They are only valid until the next read of
+// the lens which means that backends must copy them if they need to keep them
+// around past the poll.
+struct optics_histo2d
+{
+    size_t count;
+    size_t outside;
+
+    size_t rows_len;
+    uint64_t rows[optics_histo2d_buckets_max + 1];
+
+    size_t cols_len;
+    uint64_t cols[optics_histo2d_buckets_max + 1];
+
+    const size_t *counts;
+};
+
+struct optics_lens * optics_histo2d_create(
+        struct optics *, const char *name,
+        const uint64_t *rows, size_t rows_len,
+        const uint64_t *cols, size_t cols_len);
+struct optics_lens * optics_histo2d_open(
+        struct optics *, const char *name,
+        const uint64_t *rows, size_t rows_len,
+        const uint64_t *cols, size_t cols_len);
+bool optics_histo2d_inc(struct optics_lens *, double x, double y);
+
 struct optics_quantile
 {
     double quantile;
@@ -153,6 +462,418 @@ struct optics_lens * optics_quantile_open(
     struct optics *, const char *name, double quantile, double estimate, double adjustment_value);
 bool optics_quantile_update(struct optics_lens *, double value);
 
+// Same as optics_quantile but the step starts at adjustment_value, doubles
+// while the estimate keeps moving in the same direction and halves on
+// reversals. Converges quickly after the distribution shifts without
+// oscillating once it's reached for the same constant memory.
+struct optics_lens * optics_quantile_adaptive_create(
+    struct optics *, const char *name, double quantile, double estimate, double adjustment_value);
+struct optics_lens * optics_quantile_adaptive_open(
+    struct optics *, const char *name, double quantile, double estimate, double adjustment_value);
+
+// Same as optics_quantile but tracks all the given quantiles with a single
+// update call. Quantiles must be sorted in increasing order.
+struct optics_quantiles
+{
+    size_t len;
+    double quantiles[optics_quantiles_max];
+    double samples[optics_quantiles_max];
+    size_t count;
+};
+
+struct optics_lens * optics_quantiles_create(
+    struct optics *, const char *name,
+    const double *quantiles, size_t len, double estimate, double adjustment_value);
+struct optics_lens * optics_quantiles_open(
+    struct optics *, const char *name,
+    const double *quantiles, size_t len, double estimate, double adjustment_value);
+bool optics_quantiles_update(struct optics_lens *, double value);
+
+// Meters count like counters but also report the 1, 5 and 15 minute
+// exponentially weighted moving averages of the rate per second. The averages
+// are decayed by each read of the lens using the elapsed time of the poll.
+struct optics_meter
+{
+    int64_t count;
+    double m1;
+    double m5;
+    double m15;
+};
+
+struct optics_lens * optics_meter_create(struct optics *, const char *name);
+struct optics_lens * optics_meter_open(struct optics *, const char *name);
+bool optics_meter_mark(struct optics_lens *, int64_t value);
+
+
+// Log-linear histogram which covers [lowest, highest] with a relative error
+// bounded by the number of significant decimal digits requested. Values
+// outside of the range are clamped into the first or last bucket.
+//
+// The buckets are only valid until the next read of the lens which means that
+// backends must copy them if they need to keep them around past the poll.
+struct optics_hdr
+{
+    size_t count;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+
+    double lowest;
+    double highest;
+
+    uint64_t base;
+    size_t shift;
+
+    size_t buckets_len;
+    const size_t *counts;
+};
+
+struct optics_lens * optics_hdr_create(
+        struct optics *, const char *name, double lowest, double highest, size_t digits);
+struct optics_lens * optics_hdr_open(
+        struct optics *, const char *name, double lowest, double highest, size_t digits);
+bool optics_hdr_record(struct optics_lens *, double value);
+
+// Returns the lower bound of bucket i; the upper bound is the lower bound of
+// bucket i + 1.
+double optics_hdr_bucket(const struct optics_hdr *, size_t i);
+
+
+// -----------------------------------------------------------------------------
+// topk
+// -----------------------------------------------------------------------------
+
+// Reports the k most frequent keys of each poll interval out of an unbounded
+// set of keys using a bounded amount of memory. Counts are estimates which
+// can overcount by at most their error but never undercount. Characters of the
+// keys outside of [a-zA-Z0-9_-:] are replaced by '_' and keys longer than
+// optics_topk_key_max are truncated.
+//
+// The entries are only valid until the next read of the lens which means that
+// backends must copy them if they need to keep them around past the poll.
+struct optics_topk_entry
+{
+    size_t count;
+    size_t error;
+    char key[optics_topk_key_max];
+};
+
+struct optics_topk
+{
+    size_t count;
+    size_t len;
+    const struct optics_topk_entry *entries;
+};
+
+struct optics_lens * optics_topk_create(struct optics *, const char *name, size_t k);
+struct optics_lens * optics_topk_open(struct optics *, const char *name, size_t k);
+bool optics_topk_inc(struct optics_lens *, const char *key, size_t value);
+
+// Same as optics_topk_inc but for numeric keys which are only formatted when
+// they start being tracked.
+bool optics_topk_inc_id(struct optics_lens *, uint64_t id, size_t value);
+
+
+// -----------------------------------------------------------------------------
+// hll
+// -----------------------------------------------------------------------------
+
+// HyperLogLog estimate of the number of distinct keys recorded during each poll
+// interval. Recording never takes a lock.
+//
+// The registers are exported such that estimates can be merged across hosts by
+// taking the maximum of each register and passing the result to
+// optics_hll_estimate. They're only valid until the next read of the lens which
+// means that backends must copy them if they need to keep them around.
+struct optics_hll
+{
+    double estimate;
+    size_t precision;
+
+    size_t registers_len;
+    const uint8_t *registers;
+};
+
+struct optics_lens * optics_hll_create(struct optics *, const char *name, size_t precision);
+struct optics_lens * optics_hll_open(struct optics *, const char *name, size_t precision);
+bool optics_hll_add(struct optics_lens *, const char *key);
+bool optics_hll_add_id(struct optics_lens *, uint64_t id);
+
+double optics_hll_estimate(const uint8_t *registers, size_t len);
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+// DDSketch quantile sketch which answers any quantile with a relative error of
+// at most alpha for values in [lowest, highest]. Values outside of that range
+// are clamped into the first or last bucket while values <= 0 are counted in
+// zero and treated as 0 when computing quantiles.
+//
+// Bucket i covers (gamma^(offset+i-1), gamma^(offset+i)] and only depends on
+// alpha which means that sketches with the same alpha can be merged by adding
+// up the counts of their buckets with the same absolute index.
+//
+// The buckets are only valid until the next read of the lens which means that
+// backends must copy them if they need to keep them around past the poll.
+struct optics_sketch
+{
+    size_t count;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+
+    double alpha;
+    double gamma;
+    int64_t offset;
+
+    size_t zero;
+    size_t buckets_len;
+    const size_t *counts;
+};
+
+struct optics_lens * optics_sketch_create(
+        struct optics *, const char *name, double alpha, double lowest, double highest);
+struct optics_lens * optics_sketch_open(
+        struct optics *, const char *name, double alpha, double lowest, double highest);
+bool optics_sketch_record(struct optics_lens *, double value);
+
+// Returns the value of the given quantile in [0, 1] from a read sketch.
+double optics_sketch_quantile(const struct optics_sketch *, double quantile);
+
+// Returns the representative value of bucket i.
+double optics_sketch_bucket(const struct optics_sketch *, size_t i);
+
+
+// -----------------------------------------------------------------------------
+// family
+// -----------------------------------------------------------------------------
+
+// Families hold one counter, gauge, dist or histo child for every combination
+// of the labels of their dimensions within a single lens. Children are recorded
+// by index in row-major order where the last dimension varies the fastest:
+// given the dimensions {endpoint, status}, the child of endpoint i and status j
+// is at index i * statuses + j.
+//
+// The poller reports each child as a regular lens of the family's type whose
+// key is the family name followed by the labels of the child (name.label...)
+// which keeps any string formatting or lookup out of the record path.
+struct optics_family_dim
+{
+    size_t len;
+    const char * const *labels;
+};
+
+struct optics_lens * optics_family_create(
+        struct optics *, const char *name, enum optics_lens_type type,
+        const struct optics_family_dim *dims, size_t dims_len);
+struct optics_lens * optics_family_open(
+        struct optics *, const char *name, enum optics_lens_type type,
+        const struct optics_family_dim *dims, size_t dims_len);
+
+struct optics_lens * optics_family_histo_create(
+        struct optics *, const char *name,
+        const struct optics_family_dim *dims, size_t dims_len,
+        const uint64_t *buckets, size_t buckets_len);
+struct optics_lens * optics_family_histo_open(
+        struct optics *, const char *name,
+        const struct optics_family_dim *dims, size_t dims_len,
+        const uint64_t *buckets, size_t buckets_len);
+
+bool optics_family_counter_inc(struct optics_lens *, size_t index, int64_t value);
+bool optics_family_gauge_set(struct optics_lens *, size_t index, double value);
+bool optics_family_dist_record(struct optics_lens *, size_t index, double value);
+bool optics_family_histo_inc(struct optics_lens *, size_t index, double value);
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+// Describes a lens to be opened by optics_lens_open_batch. Only the parameters
+// matching the type are read and sharded is only meaningful for counters,
+// dists and histos. A zeroed gauge spec is a regular gauge.
+struct optics_lens_spec
+{
+    enum optics_lens_type type;
+    const char *name;
+    bool sharded;
+
+    union
+    {
+        struct { enum optics_gauge_agg agg; bool sticky; } gauge;
+        struct { size_t samples; } dist;
+        struct { const uint64_t *buckets; size_t buckets_len; } histo;
+        struct { double quantile, estimate, adjustment_value; bool adaptive; } quantile;
+        struct {
+            const double *quantiles;
+            size_t len;
+            double estimate, adjustment_value;
+        } quantiles;
+        struct { double lowest, highest; size_t digits; } hdr;
+        struct { double alpha, lowest, highest; } sketch;
+        struct { size_t k; } topk;
+        struct { size_t precision; } hll;
+        struct {
+            const uint64_t *rows;
+            size_t rows_len;
+            const uint64_t *cols;
+            size_t cols_len;
+        } histo2d;
+        struct {
+            enum optics_lens_type type;
+            const struct optics_family_dim *dims;
+            size_t dims_len;
+            const uint64_t *buckets;
+            size_t buckets_len;
+        } family;
+    };
+};
+
+// Equivalent to calling the open function of every spec in order but the lock
+// of each partition of the key index is only taken once and sized for the
+// whole batch upfront. Either every lens is opened and stored in lenses or, if
+// any spec is invalid, none are.
+bool optics_lens_open_batch(
+        struct optics *, const struct optics_lens_spec *specs, size_t len,
+        struct optics_lens **lenses);
+
+
+// -----------------------------------------------------------------------------
+// lazy
+// -----------------------------------------------------------------------------
+// Lazy lenses are stubs which only open their lens on the first call to
+// optics_lazy_lens which makes lenses of rarely taken code paths free in both
+// memory and poll time until they're recorded to. The spec is copied but
+// pointers within it, such as the buckets of a histo, must outlive the stub.
+// optics_lazy_lens returns NULL if the lens can't be opened and closing the
+// stub also closes its lens if it was opened. Like regular opens, stubs of the
+// same name share the same lens.
+
+struct optics_lazy;
+
+struct optics_lazy * optics_lazy_open(struct optics *, const struct optics_lens_spec *);
+void optics_lazy_close(struct optics_lazy *);
+
+struct optics_lens * optics_lazy_lens(struct optics_lazy *);
+
+
+// -----------------------------------------------------------------------------
+// static
+// -----------------------------------------------------------------------------
+// Lenses declared at file scope are registered in the optics_static ELF
+// section and opened in a single batch when the first optics of the process
+// is created. Recording goes through the handle resolved at link time which
+// skips both the name lookup and the create call. Handles are NULL until then
+// and again once that optics is closed. Static lenses must not be closed.
+// In another translation unit, OPTICS_STATIC_EXTERN declares the handle.
+
+struct optics_static
+{
+    struct optics_lens_spec spec;
+    struct optics_lens *lens;
+};
+
+#define OPTICS_STATIC(var, ...)                                         \
+    struct optics_static optics_static_##var = { .spec = { __VA_ARGS__ } }; \
+    static struct optics_static *optics_static_entry_##var              \
+        __attribute__((used, section("optics_static"))) = &optics_static_##var
+
+#define OPTICS_STATIC_EXTERN(var) extern struct optics_static optics_static_##var
+
+#define OPTICS_COUNTER(var, lens_name)                                  \
+    OPTICS_STATIC(var, .type = optics_counter, .name = (lens_name))
+#define OPTICS_GAUGE(var, lens_name)                                    \
+    OPTICS_STATIC(var, .type = optics_gauge, .name = (lens_name))
+#define OPTICS_DIST(var, lens_name)                                     \
+    OPTICS_STATIC(var, .type = optics_dist, .name = (lens_name))
+
+#define optics_static_lens(var) (optics_static_##var.lens)
+
+
+// -----------------------------------------------------------------------------
+// handle
+// -----------------------------------------------------------------------------
+// Typed handles resolve the payload of a lens once such that recording can be
+// inlined and only touches the epoch word of the optics and the payload of the
+// lens. Passing a handle of the wrong type fails to compile and the type of the
+// lens is checked once when the handle is initialized. Recording falls back on
+// the regular lens function for sharded lenses and while quiescence tracking is
+// enabled. A handle is only valid for as long as its lens is.
+
+// Set in the epoch word while quiescence tracking is enabled.
+#define optics_epoch_quiesce_bit (1UL << 63)
+
+typedef struct
+{
+    struct optics_lens *lens;
+    const size_t *epoch;
+    int64_t *values; // NULL when recording through the lens
+} optics_counter_t;
+
+bool optics_counter_handle(optics_counter_t *, struct optics_lens *);
+
+inline bool optics_counter_handle_inc(const optics_counter_t *handle, int64_t value)
+{
+    size_t epoch = __atomic_load_n(handle->epoch, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!handle->values || (epoch & optics_epoch_quiesce_bit), 0))
+        return optics_counter_inc(handle->lens, value);
+
+    __atomic_fetch_add(&handle->values[epoch & 1], value, __ATOMIC_RELAXED);
+    return true;
+}
+
+// Regular gauges don't respect epochs so setting one never reads the epoch.
+typedef struct
+{
+    struct optics_lens *lens;
+    uint64_t *value; // NULL when recording through the lens
+} optics_gauge_t;
+
+bool optics_gauge_handle(optics_gauge_t *, struct optics_lens *);
+
+inline bool optics_gauge_handle_set(const optics_gauge_t *handle, double value)
+{
+    if (__builtin_expect(!handle->value, 0))
+        return optics_gauge_set(handle->lens, value);
+
+    uint64_t bits;
+    __builtin_memcpy(&bits, &value, sizeof(bits));
+    __atomic_store_n(handle->value, bits, __ATOMIC_RELAXED);
+    return true;
+}
+
+typedef struct
+{
+    struct optics_lens *lens;
+    const size_t *epoch;
+    const double *edges;
+    size_t *counts; // NULL when recording through the lens
+} optics_histo_t;
+
+bool optics_histo_handle(optics_histo_t *, struct optics_lens *);
+
+// Same branch-free bucket lookup as optics_histo_inc over the edges of the lens
+// where the counters of each epoch follow each-other.
+inline bool optics_histo_handle_inc(const optics_histo_t *handle, double value)
+{
+    size_t epoch = __atomic_load_n(handle->epoch, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!handle->counts || (epoch & optics_epoch_quiesce_bit), 0))
+        return optics_histo_inc(handle->lens, value);
+
+    size_t i = 0;
+    for (size_t j = 0; j < optics_histo_buckets_max + 1; ++j)
+        i += value >= handle->edges[j];
+
+    size_t *counts = handle->counts + (epoch & 1) * (optics_histo_buckets_max + 2);
+    __atomic_fetch_add(&counts[i], 1, __ATOMIC_RELAXED);
+    return true;
+}
+
 
 // -----------------------------------------------------------------------------
 // key
@@ -199,6 +920,163 @@ inline double optics_timer_elapsed(optics_timer_t *t0, double scale)
     return (secs * nano_sec + nanos) * scale;
 }
 
+// Ticks are read from the timestamp counter when it's invariant and from the
+// monotonic clock otherwise. The TSC is calibrated by the first call to
+// optics_create so ticks should only be read afterwards. Reading ticks is
+// cheaper than optics_timer_t as the conversion is only done once the elapsed
+// time is needed.
+typedef uint64_t optics_ticks_t;
+
+struct optics_ticks_clock
+{
+    bool tsc;
+    double nanos; // per tick
+};
+
+extern struct optics_ticks_clock optics_ticks_clock;
+
+inline optics_ticks_t optics_ticks_monotonic(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) abort();
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// The fence keeps the read from being executed before the preceding
+// instructions.
+inline optics_ticks_t optics_ticks_start(void)
+{
+#ifdef __x86_64__
+    if (optics_ticks_clock.tsc) {
+        uint32_t lsb, msb;
+        __asm__ __volatile__ ("lfence; rdtsc" : "=a" (lsb), "=d" (msb) :: "memory");
+        return (uint64_t) msb << 32 | lsb;
+    }
+#endif
+
+    return optics_ticks_monotonic();
+}
+
+// rdtscp waits for the timed instructions to complete and the fence keeps the
+// following instructions from starting before the read.
+inline optics_ticks_t optics_ticks_stop(void)
+{
+#ifdef __x86_64__
+    if (optics_ticks_clock.tsc) {
+        uint32_t lsb, msb, aux;
+        __asm__ __volatile__ ("rdtscp; lfence" : "=a" (lsb), "=d" (msb), "=c" (aux) :: "memory");
+        return (uint64_t) msb << 32 | lsb;
+    }
+#endif
+
+    return optics_ticks_monotonic();
+}
+
+inline double optics_ticks_nanos(optics_ticks_t ticks)
+{
+    return ticks * optics_ticks_clock.nanos;
+}
+
+inline double optics_ticks_elapsed(optics_ticks_t t0, double scale)
+{
+    optics_ticks_t t1 = optics_ticks_stop();
+    return t1 > t0 ? optics_ticks_nanos(t1 - t0) * scale : 0;
+}
+
+// Times a section and records its duration, multiplied by scale, in a dist,
+// histo, quantile, quantiles, hdr or sketch lens. The conversion factor is
+// computed when the timing starts so stopping only reads the ticks, does a
+// single multiplication and records the value within a single epoch.
+struct optics_timing
+{
+    struct optics_lens *lens;
+
+    // Lens resolved by the typed timings which is NULL for optics_timing_start
+    // or if the lens was of the wrong type.
+    void *sub;
+
+    optics_ticks_t t0;
+
+    // 0 if the raw tick delta is recorded as is.
+    double factor;
+};
+
+inline struct optics_timing optics_timing_start(struct optics_lens *lens, double scale)
+{
+    return (struct optics_timing) {
+        .lens = lens,
+        .factor = optics_ticks_clock.nanos * scale,
+        .t0 = optics_ticks_start(),
+    };
+}
+
+bool optics_timing_stop(struct optics_timing *);
+
+// Typed timings resolve the lens when they start which leaves stopping with the
+// tick read and the record. Dists and histos set through optics_lens_ticks are
+// handed the raw tick delta, which makes the scale irrelevant, while every
+// other lens gets the delta multiplied by the conversion factor. Starting on a
+// lens of the wrong type fails which makes stopping the timing return false.
+struct optics_timing optics_dist_timing_start(struct optics_lens *, double scale);
+bool optics_dist_timing_stop(struct optics_timing *);
+
+struct optics_timing optics_histo_timing_start(struct optics_lens *, double scale);
+bool optics_histo_timing_stop(struct optics_timing *);
+
+struct optics_timing optics_hdr_timing_start(struct optics_lens *, double scale);
+bool optics_hdr_timing_stop(struct optics_timing *);
+
+struct optics_timing optics_sketch_timing_start(struct optics_lens *, double scale);
+bool optics_sketch_timing_stop(struct optics_timing *);
+
+// Times the rest of the enclosing scope via the GCC cleanup attribute.
+#define optics_timing_scope(lens, scale)                                 \
+    optics_timing_scope_impl(optics_timing, lens, scale)
+
+#define optics_dist_timing_scope(lens, scale)                            \
+    optics_timing_scope_impl(optics_dist_timing, lens, scale)
+
+#define optics_histo_timing_scope(lens, scale)                           \
+    optics_timing_scope_impl(optics_histo_timing, lens, scale)
+
+#define optics_hdr_timing_scope(lens, scale)                             \
+    optics_timing_scope_impl(optics_hdr_timing, lens, scale)
+
+#define optics_sketch_timing_scope(lens, scale)                          \
+    optics_timing_scope_impl(optics_sketch_timing, lens, scale)
+
+#define optics_timing_scope_impl(prefix, lens, scale)                    \
+    struct optics_timing optics_timing_concat(optics_timing_, __LINE__)  \
+    __attribute__((cleanup(prefix ## _cleanup))) = prefix ## _start(lens, scale)
+
+#define optics_timing_concat(a, b) optics_timing_concat_impl(a, b)
+#define optics_timing_concat_impl(a, b) a ## b
+
+inline void optics_timing_cleanup(struct optics_timing *timing)
+{
+    (void) optics_timing_stop(timing);
+}
+
+inline void optics_dist_timing_cleanup(struct optics_timing *timing)
+{
+    (void) optics_dist_timing_stop(timing);
+}
+
+inline void optics_histo_timing_cleanup(struct optics_timing *timing)
+{
+    (void) optics_histo_timing_stop(timing);
+}
+
+inline void optics_hdr_timing_cleanup(struct optics_timing *timing)
+{
+    (void) optics_hdr_timing_stop(timing);
+}
+
+inline void optics_sketch_timing_cleanup(struct optics_timing *timing)
+{
+    (void) optics_sketch_timing_stop(timing);
+}
+
 
 // -----------------------------------------------------------------------------
 // poll
@@ -211,6 +1089,37 @@ union optics_poll_value
      struct optics_dist dist;
      struct optics_histo histo;
      struct optics_quantile quantile;
+     struct optics_hdr hdr;
+     struct optics_sketch sketch;
+     struct optics_quantiles quantiles;
+     struct optics_meter meter;
+     struct optics_topk topk;
+     struct optics_hll hll;
+     struct optics_updown updown;
+     struct optics_histo2d histo2d;
+};
+
+// Fully qualified keys (prefix.host.key.suffix) of the normalized values of a
+// lens indexed in the order in which they're emitted by the normalizer. Keys
+// that are NULL are formatted on demand and rel is the offset of the lens key
+// within the qualified keys.
+struct optics_poll_keys
+{
+    size_t len;
+    size_t rel;
+    const char *data[optics_poll_keys_max];
+    size_t lens[optics_poll_keys_max];
+};
+
+// Running total of a counter kept by the poller since created when counter
+// totals are enabled. created changes whenever the total restarts from 0,
+// which happens for new lenses and new pollers alike, and lets consumers
+// detect resets such as a restart of the process.
+struct optics_counter_total
+{
+    bool tracked;
+    int64_t value;
+    optics_ts_t created;
 };
 
 struct optics_poll
@@ -219,11 +1128,23 @@ struct optics_poll
     const char *prefix;
     const char *key;
 
+    // Keys cached by the poller for the lens or NULL if not available. Only
+    // valid for the duration of the backend callback.
+    const struct optics_poll_keys *keys;
+
     enum optics_lens_type type;
     union optics_poll_value value;
+    struct optics_counter_total total;
 
+    // Whole seconds for the backends that only deal in seconds where elapsed
+    // is never below 1.
     optics_ts_t ts;
     optics_ts_t elapsed;
+
+    // Full precision of the time of the poll and of the time elapsed since
+    // the previous poll which is what the normalizers rescale by.
+    uint64_t ts_nanos;
+    double elapsed_secs;
 };
 
 typedef bool (*optics_normalize_cb_t) (
@@ -232,6 +1153,85 @@ typedef bool (*optics_normalize_cb_t) (
 bool optics_poll_normalize(
         const struct optics_poll *poll, optics_normalize_cb_t cb, void *ctx);
 
+typedef bool (*optics_normalize_qualified_cb_t) (
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value);
+
+// Same as optics_poll_normalize but the keys are prefixed by the prefix and
+// host of the poll and come from the cached keys whenever possible.
+bool optics_poll_normalize_qualified(
+        const struct optics_poll *poll, optics_normalize_qualified_cb_t cb, void *ctx);
+
+// Formats the keys of the poll in a single allocation released with free.
+struct optics_poll_keys * optics_poll_keys_alloc(const struct optics_poll *poll);
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+// Compact alternative to optics_poll where the dist samples are referenced out
+// of line such that the largest value is a few hundred bytes instead of a few
+// kilobytes. Records are variable-size: only the first len bytes are valid
+// which is all that needs to be copied to keep a record around. The samples,
+// key, hdr/sketch/histo2d counts, topk entries and hll registers are only valid for
+// the duration of the callback.
+
+struct optics_dist_summary
+{
+    size_t n;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+union optics_record_value
+{
+    int64_t counter;
+    double gauge;
+    struct optics_dist_summary dist;
+    struct optics_histo histo;
+    struct optics_quantile quantile;
+    struct optics_hdr hdr;
+    struct optics_sketch sketch;
+    struct optics_quantiles quantiles;
+    struct optics_meter meter;
+    struct optics_topk topk;
+    struct optics_hll hll;
+    struct optics_updown updown;
+    struct optics_histo2d histo2d;
+};
+
+struct optics_record
+{
+    size_t len;
+    enum optics_lens_type type;
+
+    const char *host;
+    const char *prefix;
+    const char *key;
+    const struct optics_poll_keys *keys;
+
+    optics_ts_t ts;
+    optics_ts_t elapsed;
+    uint64_t ts_nanos;
+    double elapsed_secs;
+
+    // Only set for dist lenses and NULL if no samples are available.
+    const double *samples;
+    size_t samples_len;
+
+    struct optics_counter_total total;
+    union optics_record_value value;
+};
+
+size_t optics_record_len(enum optics_lens_type type);
+
+bool optics_record_normalize(
+        const struct optics_record *record, optics_normalize_cb_t cb, void *ctx);
+bool optics_record_normalize_qualified(
+        const struct optics_record *record,
+        optics_normalize_qualified_cb_t cb, void *ctx);
+
 
 // -----------------------------------------------------------------------------
 // poller
@@ -242,6 +1242,15 @@ struct optics_poller;
 struct optics_poller * optics_poller_alloc(struct optics *);
 void optics_poller_free(struct optics_poller *);
 
+// A poller can poll up to 128 optics instances at once which share the epoch
+// change, the grace period and the begin/done cycle of the backends. Lenses of
+// every instance are prefixed by the prefix of their own instance. The optics
+// the poller was allocated for is always attached and can't be detached.
+// Instances must be detached before they're closed.
+bool optics_poller_attach(struct optics_poller *, struct optics *);
+bool optics_poller_detach(struct optics_poller *, struct optics *);
+size_t optics_poller_attached(struct optics_poller *);
+
 enum optics_poll_type
 {
     optics_poll_begin,
@@ -261,11 +1270,125 @@ bool optics_poller_backend(
         optics_backend_cb_t cb,
         optics_backend_free_t free);
 
+// Same as optics_poller_backend but metrics are handed over as compact records.
+// The record is NULL for the begin and done events.
+typedef void (*optics_record_cb_t) (
+        void *ctx,
+        enum optics_poll_type type,
+        const struct optics_record *record);
+
+bool optics_poller_backend_record(
+        struct optics_poller *,
+        void *ctx,
+        optics_record_cb_t cb,
+        optics_backend_free_t free);
+
+// Async backends are called from a dedicated thread which consumes the polls
+// from a ring of ring_len slots such that a slow backend doesn't stall the
+// poller. When the ring is full, metrics are either dropped or the poller
+// waits for a free slot depending on the policy. Begin and done events are
+// never dropped.
+enum optics_backend_policy
+{
+    optics_backend_drop,
+    optics_backend_block,
+};
+
+bool optics_poller_backend_async(
+        struct optics_poller *,
+        void *ctx,
+        optics_backend_cb_t cb,
+        optics_backend_free_t free,
+        size_t ring_len,
+        enum optics_backend_policy policy);
+
+// Restricts the lenses handed over to a backend. Types is a mask of
+// (1 << optics_lens_type) where 0 matches every type and prefixes is a NULL
+// terminated list of lens name prefixes where NULL matches every lens. When
+// changed is set, lenses whose value is identical to the previous poll are
+// skipped. Lenses that no backend wants are never normalized.
+struct optics_backend_filter
+{
+    uint32_t types;
+    const char * const *prefixes;
+    bool changed;
+};
+
+bool optics_poller_backend_filtered(
+        struct optics_poller *,
+        void *ctx,
+        optics_backend_cb_t cb,
+        optics_backend_free_t free,
+        const struct optics_backend_filter *filter);
+
+// Applies the filter to the last registered backend which includes the ones
+// registered by the optics_dump functions. Must not be called while a poll is
+// in progress.
+bool optics_poller_filter(struct optics_poller *, const struct optics_backend_filter *filter);
+
+// Rolls the polls handed to the last registered backend up into windows of the
+// given period (in seconds) which lets a backend report at a coarser resolution
+// than the poll interval without reading the lenses again. Windows are aligned
+// on multiples of the period and each lens is reported once at the end of the
+// window with its values merged across the polls of the window: counts are
+// summed, gauges and quantiles keep their last value, buckets, registers and
+// topk entries are merged and dist reservoirs are merged by weighted sampling.
+// Values whose shape changed within a window are replaced. Must not be called
+// while a poll is in progress.
+bool optics_poller_rollup(struct optics_poller *, optics_ts_t period);
+
+// Called by the poller before closing a lens whose ttl expired which gives
+// the owner of the lens a chance to drop its handles. Returning false keeps the
+// lens open and restarts its ttl. Lenses are closed unconditionally if no
+// callback is set. Must not be called while a poll is in progress.
+typedef bool (*optics_expire_cb_t) (void *ctx, struct optics_lens *lens);
+void optics_poller_expire(struct optics_poller *, optics_expire_cb_t cb, void *ctx);
+
+// Gauges and updowns don't track their writes so, when enabled, they're
+// considered idle when their value didn't change since the last poll. This
+// also expires gauges that are set to the same value on every poll. Must not
+// be called while a poll is in progress.
+void optics_poller_expire_unchanged(struct optics_poller *, bool enable);
+
+// Keeps a running total of every counter on the read side which costs nothing
+// to the recorders. The totals are reported in the total field of the polls
+// and as an extra total metric by the normalizers next to the rate. Not
+// supported by the counters of families. Must not be called while a poll is in
+// progress.
+void optics_poller_counter_totals(struct optics_poller *, bool enable);
+
+// Total number of metrics dropped by all the async backends.
+size_t optics_poller_dropped(struct optics_poller *);
+
+// Records the poller's own metrics into lenses of the polled optics named under
+// the given prefix which are reported like any other lens on the next poll:
+// poll duration, grace period, lenses visited, busy lenses skipped, live lenses,
+// pending deferred frees and the time spent in each backend. Must not be called
+// while a poll is in progress.
+bool optics_poller_self(struct optics_poller *, const char *prefix);
+
+// Lets backends report their own metrics alongside the poller's. The counter or
+// dist lens is opened on first use and the calls are ignored unless
+// self-instrumentation is enabled. Safe to call from any thread.
+void optics_poller_self_inc(struct optics_poller *, const char *name, int64_t value);
+void optics_poller_self_record(struct optics_poller *, const char *name, double value);
+
 bool optics_poller_set_host(struct optics_poller *poller, const char *host);
 const char * optics_poller_get_host(struct optics_poller *poller);
 
+// The ts of optics_poller_poll_at is in seconds while the ts of
+// optics_poller_poll_at_nanos, like the clock of optics_poller_poll, is in
+// nanos which keeps the rates of sub-second polls accurate.
 bool optics_poller_poll(struct optics_poller *poller);
 bool optics_poller_poll_at(struct optics_poller *poller, optics_ts_t ts);
+bool optics_poller_poll_at_nanos(struct optics_poller *poller, uint64_t ts);
+
+// Number of threads, in addition to the polling thread, used to read the
+// lenses in parallel. Backends are never called concurrently but calls for
+// metrics can be interleaved between workers. 0 disables parallel polling and
+// must not be changed while a poll is in progress.
+bool optics_poller_set_workers(struct optics_poller *poller, size_t workers);
+size_t optics_poller_get_workers(struct optics_poller *poller);
 
 
 // -----------------------------------------------------------------------------
@@ -274,10 +1397,17 @@ bool optics_poller_poll_at(struct optics_poller *poller, optics_ts_t ts);
 
 struct optics_thread;
 
+// Polls on wall-clock boundaries which are multiples of the period. The nanos
+// variant allows for sub-second periods down to 1ms.
 struct optics_thread * optics_thread_start(
         struct optics_poller *poller, optics_ts_t freq);
+struct optics_thread * optics_thread_start_nanos(
+        struct optics_poller *poller, uint64_t period);
 bool optics_thread_stop(struct optics_thread *thread);
 
+// Number of poll deadlines skipped because a poll took longer then the period.
+size_t optics_thread_missed(struct optics_thread *thread);
+
 
 // -----------------------------------------------------------------------------
 // backends
@@ -287,4 +1417,129 @@ struct crest;
 
 void optics_dump_stdout(struct optics_poller *);
 void optics_dump_carbon(struct optics_poller *, const char *host, const char *port);
+
+// Keeps the last spill_len polls in memory while the carbon host is unreachable
+// and drains them at rate bytes per second once reconnected. A rate of 0 drains
+// as fast as the socket allows.
+bool optics_dump_carbon_spill(
+        struct optics_poller *,
+        const char *host, const char *port,
+        size_t spill_len, size_t rate);
+// Builds compiled with OPTICS_LOG=ring also serve the log rings on /debug/log.
 void optics_dump_rest(struct optics_poller *poller, struct crest *crest);
+
+// Same as optics_dump_rest but keeps the normalized values of the last
+// history_len polls in memory which are served by
+// /metrics/history?key=<key>&n=<polls> from oldest to newest. optics_dump_rest
+// keeps the last 300 polls and a history_len of 0 disables the history.
+void optics_dump_rest_history(
+        struct optics_poller *poller, struct crest *crest, size_t history_len);
+
+// Emits the normalized metrics as DogStatsD gauges tagged with the host of the
+// poll. Lines are packed in datagrams of at most mtu bytes which are dropped if
+// the socket buffer is full. An mtu of 0 selects a default suited to the
+// socket type.
+bool optics_dump_statsd(
+        struct optics_poller *, const char *host, const char *port, size_t mtu);
+bool optics_dump_statsd_unix(struct optics_poller *, const char *path, size_t mtu);
+
+// Pushes every poll as binary frames over a unix seqpacket socket. See the push
+// section below for the frame layout.
+bool optics_dump_push(struct optics_poller *, const char *path);
+
+// Appends every poll to a binary columnar file which can be read back with
+// optics_file_read. Existing files are appended to.
+bool optics_dump_file(struct optics_poller *, const char *path);
+
+// Appends every normalized metric to a text file as JSON lines of the form
+// {"ts":<secs>,"host":"<host>","key":"<prefix>.<key>","value":<value>} where
+// non-finite values are written as null. Lines are written and synced by a
+// background thread and polls are dropped if it falls too far behind. Once the
+// file would grow past rotate_len bytes, it's renamed to <path>.1 and the
+// previously rotated files are shifted up to <path>.<rotate_keep>; older ones
+// are deleted. A rotate_len of 0 disables the rotation.
+bool optics_dump_jsonl(
+        struct optics_poller *, const char *path, size_t rotate_len, size_t rotate_keep);
+
+
+// -----------------------------------------------------------------------------
+// push
+// -----------------------------------------------------------------------------
+// Every message on the socket is a single frame made of a header followed by
+// count entries whose layout depends on the frame type. All fields are in host
+// byte order and naturally aligned. A connection always starts with a hello
+// frame followed by dict frames for every known key and values frames for
+// every value. Afterwards each poll only sends the dict entries of new keys,
+// the values that changed and the ids of the keys that went away, followed by
+// a done frame. Receivers should keep the last value of every key. A sender
+// that fails to send a frame drops the connection and starts over.
+
+enum
+{
+    optics_push_magic = 0x4850504f, // "OPPH"
+    optics_push_version = 1,
+    optics_push_frame_max = 32 * 1024,
+};
+
+enum optics_push_type
+{
+    optics_push_hello = 1,  // struct optics_push_hello + prefix + host
+    optics_push_dict = 2,   // struct optics_push_key + key padded to 4 bytes
+    optics_push_values = 3, // struct optics_push_value
+    optics_push_drop = 4,   // uint32_t key ids
+    optics_push_done = 5,   // count is the number of values sent for the poll
+};
+
+struct optics_push_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t count;
+    uint32_t len; // bytes following the header
+    optics_ts_t ts;
+};
+
+struct optics_push_hello
+{
+    uint32_t pid;
+    uint16_t prefix_len;
+    uint16_t host_len;
+};
+
+// Keys are relative to the prefix and host of the hello frame.
+struct optics_push_key
+{
+    uint32_t id;
+    uint16_t type; // enum optics_lens_type
+    uint16_t len;
+};
+
+struct optics_push_value
+{
+    uint32_t id;
+    uint32_t type; // enum optics_lens_type
+    double value;
+};
+
+
+// -----------------------------------------------------------------------------
+// file
+// -----------------------------------------------------------------------------
+
+struct optics_file;
+
+typedef bool (*optics_file_cb_t) (
+        void *ctx, optics_ts_t ts, const char *key, double value);
+
+struct optics_file * optics_file_open(const char *path);
+void optics_file_close(struct optics_file *);
+
+// Calls cb for every value of every poll in the order in which they were
+// written. Reading stops at the first invalid block or if cb returns false in
+// which case false is returned.
+bool optics_file_read(struct optics_file *, optics_file_cb_t cb, void *ctx);
+
+// Same as optics_file_read but the timestamps are in nanos. Files written
+// before nanos were recorded only have whole seconds.
+bool optics_file_read_nanos(struct optics_file *, optics_file_cb_t cb, void *ctx);
@@ -15,8 +15,15 @@
 typedef size_t optics_epoch_t;
 optics_epoch_t optics_epoch(struct optics *optics);
 optics_epoch_t optics_epoch_inc(struct optics *optics);
+
+// Times are in nanos.
 optics_epoch_t optics_epoch_inc_at(
-        struct optics *optics, optics_ts_t now, optics_ts_t *last_inc);
+        struct optics *optics, uint64_t now, uint64_t *last_inc);
+
+// Waits for all the writers of the given epoch to complete. Returns false if
+// quiescence tracking is disabled or if the writers didn't complete in time in
+// which case the caller has to deal with stragglers.
+bool optics_epoch_quiesce(struct optics *optics, optics_epoch_t epoch);
 
 
 // -----------------------------------------------------------------------------
@@ -26,6 +33,17 @@ optics_epoch_t optics_epoch_inc_at(
 typedef enum optics_ret (*optics_foreach_t) (void *ctx, struct optics_lens *lens);
 enum optics_ret optics_foreach_lens(struct optics *, void *ctx, optics_foreach_t cb);
 
+// Number of lenses currently open and of allocations waiting on an epoch change
+// to be freed.
+size_t optics_lens_count(struct optics *);
+size_t optics_defer_count(struct optics *);
+
+uint32_t optics_lens_get_ttl(struct optics_lens *);
+
+// Frees the allocations of vacated epochs which optics_epoch_inc leaves behind
+// to keep the epoch change cheap. Also called on every lens allocation.
+void optics_reclaim(struct optics *);
+
 enum optics_ret optics_counter_read(
         struct optics_lens *, optics_epoch_t epoch, int64_t *value);
 
@@ -41,4 +59,46 @@ enum optics_ret optics_histo_read(
 enum optics_ret optics_quantile_read(
         struct optics_lens *, optics_epoch_t epoch, struct optics_quantile *value);
 
+enum optics_ret optics_quantiles_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_quantiles *value);
+
+enum optics_ret optics_histo2d_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_histo2d *value);
+
+enum optics_ret optics_hdr_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_hdr *value);
+
+enum optics_ret optics_sketch_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_sketch *value);
+
+enum optics_ret optics_topk_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_topk *value);
+
+enum optics_ret optics_hll_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_hll *value);
+
+enum optics_ret optics_updown_read(
+        struct optics_lens *, optics_epoch_t epoch, struct optics_updown *value);
+
+// The elapsed time since the last read of the meter is used to decay its
+// moving averages.
+enum optics_ret optics_meter_read(
+        struct optics_lens *, optics_epoch_t epoch, optics_ts_t elapsed,
+        struct optics_meter *value);
+
+// Recomputes the summary of a value from its samples or counts which the
+// poller uses for values merged across polls. The count of hdr and sketch
+// values must already be set.
+void optics_dist_summarize(struct optics_dist *, double *samples, size_t len);
+void optics_hdr_summarize(struct optics_hdr *);
+void optics_sketch_summarize(struct optics_sketch *);
+
+// Families are read one child at a time where optics_family_key appends the
+// labels of the child to the key and optics_family_read sets both the type and
+// the value of the poll.
+size_t optics_family_len(struct optics_lens *);
+bool optics_family_key(struct optics_lens *, size_t index, struct optics_key *key);
+enum optics_ret optics_family_read(
+        struct optics_lens *, optics_epoch_t epoch, size_t index, struct optics_poll *poll);
+
 
@@ -10,10 +10,14 @@
 #include "utils/socket.h"
 #include "utils/htable.h"
 #include "utils/type_pun.h"
+#include "utils/bits.h"
+#include "utils/rng.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <bsd/string.h>
 
 
@@ -21,31 +25,134 @@
 // config
 // -----------------------------------------------------------------------------
 
-enum { poller_max_backends = 8 };
+enum
+{
+    poller_max_optics = 128,
+
+    poller_max_backends = 8,
+    poller_backends_all = (1 << poller_max_backends) - 1,
+};
 
 
 // -----------------------------------------------------------------------------
 // struct
 // -----------------------------------------------------------------------------
 
+struct poller_async;
+struct poller_rollup;
+
 struct backend
 {
     void *ctx;
     optics_backend_cb_t cb;
     optics_backend_free_t free;
+
+    // NULL unless the backend is dispatched asynchronously.
+    struct poller_async *async;
+
+    // Set instead of cb for backends that consume records.
+    optics_record_cb_t record;
+
+    // NULL unless the polls are rolled up before being handed to the backend.
+    struct poller_rollup *rollup;
+
+    // Lenses that don't match the filter are never handed to the backend. All
+    // lenses match when no filter is set.
+    bool filtered;
+    uint32_t filter_types;
+    bool filter_changed;
+    size_t filter_prefixes_len;
+    char **filter_prefixes;
 };
 
 
+// Optics instance attached to the poller along with the state of its current
+// poll. Keys are cached per instance since lens names are only unique within an
+// instance and the prefix is set per instance.
+struct poller_optics
+{
+    struct optics *optics;
+
+    optics_epoch_t epoch;
+    uint64_t last_poll; // nanos
+
+    // Normalized keys cached per lens name which are flushed whenever the
+    // prefix or the host changes.
+    struct htable keys;
+    char keys_prefix[optics_name_max_len];
+};
+
+struct poller_pool;
+struct poller_self;
+
 struct optics_poller
 {
+    // Instance the poller was allocated for which hosts the self lenses and
+    // can't be detached.
     struct optics *optics;
 
+    // Every instance polled including optics which is always first. The lock
+    // serializes the attachments with the polls.
+    pthread_mutex_t instances_lock;
+    size_t instances_len;
+    struct poller_optics *instances[poller_max_optics];
+
     char host[optics_name_max_len];
 
     size_t backends_len;
     struct backend backends[poller_max_backends];
+
+    // Backends with a filter and the subset of those only interested in
+    // changed values. Used to skip the filters entirely when none are set.
+    uint32_t backends_filtered;
+    uint32_t backends_changed;
+
+    // NULL unless parallel polling was enabled.
+    struct poller_pool *pool;
+
+    // NULL unless self-instrumentation was enabled. Atomic as backends can
+    // report their metrics from their own threads.
+    struct poller_self * _Atomic self;
+
+    // Stamp of the current poll used to sweep the keys of closed lenses. The
+    // lock protects the key caches and is only used for parallel polls.
+    size_t keys_stamp;
+    pthread_mutex_t keys_lock;
+
+    // Called before lenses whose ttl expired are closed.
+    optics_expire_cb_t expire;
+    void *expire_ctx;
+    bool expire_unchanged;
+
+    bool counter_totals;
 };
 
+struct poller_poll_ctx;
+static void poller_pool_run(struct poller_pool *, struct poller_poll_ctx *);
+static void poller_pool_free(struct poller_pool *);
+
+static struct poller_async *poller_async_alloc(
+        struct backend backend, size_t ring_len, enum optics_backend_policy policy);
+static void poller_async_free(struct poller_async *);
+static void poller_async_push(
+        struct poller_async *, enum optics_poll_type type, const struct optics_poll *poll);
+static size_t poller_async_dropped(struct poller_async *);
+
+static struct poller_rollup *poller_rollup_alloc(optics_ts_t period);
+static void poller_rollup_free(struct poller_rollup *);
+static void poller_rollup_fold(struct poller_rollup *, const struct optics_poll *poll);
+static void poller_rollup_flush(struct optics_poller *, size_t index);
+static void poller_rollup_begin(struct optics_poller *, optics_ts_t ts);
+static void poller_rollup_done(struct optics_poller *, optics_ts_t ts);
+
+static void poller_keys_clear(struct optics_poller *);
+static void poller_keys_flush(struct poller_optics *);
+static void poller_filter_free(struct backend *);
+
+static void poller_self_free(struct poller_self *);
+static uint64_t poller_self_now();
+static void poller_self_backend(struct optics_poller *, size_t index, uint64_t start);
+
 
 // -----------------------------------------------------------------------------
 // open/close
@@ -60,9 +167,16 @@ struct optics_poller * optics_poller_alloc(struct optics *optics)
 
     if (!hostname(poller->host, sizeof(poller->host))) goto fail_host;
     poller->optics = optics;
+    pthread_mutex_init(&poller->keys_lock, NULL);
+    pthread_mutex_init(&poller->instances_lock, NULL);
+
+    if (!optics_poller_attach(poller, optics)) goto fail_attach;
 
     return poller;
 
+  fail_attach:
+    pthread_mutex_destroy(&poller->instances_lock);
+    pthread_mutex_destroy(&poller->keys_lock);
   fail_host:
     free(poller);
     return NULL;
@@ -70,15 +184,117 @@ struct optics_poller * optics_poller_alloc(struct optics *optics)
 
 void optics_poller_free(struct optics_poller *poller)
 {
+    if (poller->pool) poller_pool_free(poller->pool);
+
     for (size_t i = 0; i < poller->backends_len; ++i) {
         struct backend *backend = &poller->backends[i];
+
+        // The partial window is flushed so that its values aren't lost.
+        if (backend->rollup) {
+            poller_rollup_flush(poller, i);
+            poller_rollup_free(backend->rollup);
+        }
+
+        if (backend->async) poller_async_free(backend->async);
         if (backend->free) backend->free(backend->ctx);
+        poller_filter_free(backend);
     }
 
+    for (size_t i = 0; i < poller->instances_len; ++i) {
+        struct poller_optics *instance = poller->instances[i];
+        poller_keys_flush(instance);
+        htable_reset(&instance->keys);
+        free(instance);
+    }
+    pthread_mutex_destroy(&poller->instances_lock);
+    pthread_mutex_destroy(&poller->keys_lock);
+
+    // The self lenses are closed which requires the optics to still be open.
+    poller_self_free(poller->self);
+
     free(poller);
 }
 
 
+// -----------------------------------------------------------------------------
+// attach
+// -----------------------------------------------------------------------------
+
+static struct poller_optics **poller_instance_find(
+        struct optics_poller *poller, struct optics *optics)
+{
+    for (size_t i = 0; i < poller->instances_len; ++i) {
+        if (poller->instances[i]->optics == optics)
+            return &poller->instances[i];
+    }
+    return NULL;
+}
+
+bool optics_poller_attach(struct optics_poller *poller, struct optics *optics)
+{
+    bool ret = false;
+    pthread_mutex_lock(&poller->instances_lock);
+
+    if (poller_instance_find(poller, optics)) {
+        optics_fail("optics '%s' is already attached to the poller",
+                optics_get_prefix(optics));
+        goto done;
+    }
+
+    if (poller->instances_len == poller_max_optics) {
+        optics_fail("reached poller optics capacity '%d'", poller_max_optics);
+        goto done;
+    }
+
+    struct poller_optics *instance = calloc(1, sizeof(*instance));
+    optics_assert_alloc(instance);
+    instance->optics = optics;
+
+    poller->instances[poller->instances_len++] = instance;
+    ret = true;
+
+  done:
+    pthread_mutex_unlock(&poller->instances_lock);
+    return ret;
+}
+
+bool optics_poller_detach(struct optics_poller *poller, struct optics *optics)
+{
+    if (optics == poller->optics) {
+        optics_fail("unable to detach the optics the poller was allocated for");
+        return false;
+    }
+
+    pthread_mutex_lock(&poller->instances_lock);
+
+    struct poller_optics **it = poller_instance_find(poller, optics);
+    if (!it) {
+        pthread_mutex_unlock(&poller->instances_lock);
+        optics_fail("optics '%s' is not attached to the poller", optics_get_prefix(optics));
+        return false;
+    }
+
+    struct poller_optics *instance = *it;
+    *it = poller->instances[--poller->instances_len];
+
+    pthread_mutex_unlock(&poller->instances_lock);
+
+    poller_keys_flush(instance);
+    htable_reset(&instance->keys);
+    free(instance);
+
+    return true;
+}
+
+size_t optics_poller_attached(struct optics_poller *poller)
+{
+    pthread_mutex_lock(&poller->instances_lock);
+    size_t len = poller->instances_len;
+    pthread_mutex_unlock(&poller->instances_lock);
+    return len;
+}
+
+
 // -----------------------------------------------------------------------------
 // host
 // -----------------------------------------------------------------------------
@@ -96,7 +312,12 @@ bool optics_poller_set_host(struct optics_poller *poller, const char *host)
         return false;
     }
 
+    // The cached keys are used by polls which hold the instances lock.
+    pthread_mutex_lock(&poller->instances_lock);
     strlcpy(poller->host, host, optics_name_max_len);
+    poller_keys_clear(poller);
+    pthread_mutex_unlock(&poller->instances_lock);
+
     return true;
 }
 
@@ -116,19 +337,249 @@ bool optics_poller_backend(
         return false;
     }
 
-    poller->backends[poller->backends_len] = (struct backend) { ctx, cb, free };
+    poller->backends[poller->backends_len] = (struct backend) { .ctx = ctx, .cb = cb, .free = free };
     poller->backends_len++;
 
     return true;
 }
 
+bool optics_poller_backend_async(
+        struct optics_poller *poller,
+        void *ctx,
+        optics_backend_cb_t cb,
+        optics_backend_free_t free,
+        size_t ring_len,
+        enum optics_backend_policy policy)
+{
+    if (poller->backends_len >= poller_max_backends) {
+        optics_fail("reached poller backend capacity '%d'", poller_max_backends);
+        return false;
+    }
+
+    struct backend backend = { .ctx = ctx, .cb = cb, .free = free };
+    backend.async = poller_async_alloc(backend, ring_len, policy);
+    if (!backend.async) return false;
+
+    poller->backends[poller->backends_len] = backend;
+    poller->backends_len++;
+
+    return true;
+}
+
+bool optics_poller_backend_record(
+        struct optics_poller *poller,
+        void *ctx,
+        optics_record_cb_t cb,
+        optics_backend_free_t free)
+{
+    if (poller->backends_len >= poller_max_backends) {
+        optics_fail("reached poller backend capacity '%d'", poller_max_backends);
+        return false;
+    }
+
+    poller->backends[poller->backends_len] = (struct backend) { .ctx = ctx, .free = free, .record = cb };
+    poller->backends_len++;
+
+    return true;
+}
+
+bool optics_poller_filter(
+        struct optics_poller *poller, const struct optics_backend_filter *filter)
+{
+    if (!poller->backends_len) {
+        optics_fail("no backend to filter");
+        return false;
+    }
+
+    // The filters and the matches cached alongside the keys are used by polls
+    // which hold the instances lock.
+    pthread_mutex_lock(&poller->instances_lock);
+
+    size_t index = poller->backends_len - 1;
+    struct backend *backend = &poller->backends[index];
+    poller_filter_free(backend);
+
+    backend->filtered = true;
+    backend->filter_types = filter->types;
+    backend->filter_changed = filter->changed;
+
+    if (filter->prefixes) {
+        size_t len = 0;
+        while (filter->prefixes[len]) len++;
+
+        backend->filter_prefixes = calloc(len, sizeof(*backend->filter_prefixes));
+        optics_assert_alloc(backend->filter_prefixes);
+        backend->filter_prefixes_len = len;
+
+        for (size_t i = 0; i < len; ++i) {
+            backend->filter_prefixes[i] = strndup(filter->prefixes[i], optics_name_max_len);
+            optics_assert_alloc(backend->filter_prefixes[i]);
+        }
+    }
+
+    poller->backends_filtered |= 1U << index;
+    if (filter->changed) poller->backends_changed |= 1U << index;
+    else poller->backends_changed &= ~(1U << index);
+
+    poller_keys_clear(poller);
+
+    pthread_mutex_unlock(&poller->instances_lock);
+    return true;
+}
+
+bool optics_poller_backend_filtered(
+        struct optics_poller *poller,
+        void *ctx,
+        optics_backend_cb_t cb,
+        optics_backend_free_t free,
+        const struct optics_backend_filter *filter)
+{
+    if (!optics_poller_backend(poller, ctx, cb, free)) return false;
+    return optics_poller_filter(poller, filter);
+}
+
+bool optics_poller_rollup(struct optics_poller *poller, optics_ts_t period)
+{
+    if (!poller->backends_len) {
+        optics_fail("no backend to roll up");
+        return false;
+    }
+
+    if (!period) {
+        optics_fail("invalid rollup period '%lu'", period);
+        return false;
+    }
+
+    struct backend *backend = &poller->backends[poller->backends_len - 1];
+    poller_rollup_free(backend->rollup);
+    backend->rollup = poller_rollup_alloc(period);
+    return true;
+}
+
+void optics_poller_expire(struct optics_poller *poller, optics_expire_cb_t cb, void *ctx)
+{
+    poller->expire = cb;
+    poller->expire_ctx = ctx;
+}
+
+void optics_poller_expire_unchanged(struct optics_poller *poller, bool enable)
+{
+    poller->expire_unchanged = enable;
+}
+
+void optics_poller_counter_totals(struct optics_poller *poller, bool enable)
+{
+    poller->counter_totals = enable;
+}
+
+size_t optics_poller_dropped(struct optics_poller *poller)
+{
+    size_t dropped = 0;
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        struct backend *backend = &poller->backends[i];
+        if (backend->async) dropped += poller_async_dropped(backend->async);
+    }
+    return dropped;
+}
+
+static void poller_record_encode(struct optics_record *record, const struct optics_poll *poll)
+{
+    record->len = optics_record_len(poll->type);
+    record->type = poll->type;
+    record->host = poll->host;
+    record->prefix = poll->prefix;
+    record->key = poll->key;
+    record->keys = poll->keys;
+    record->ts = poll->ts;
+    record->elapsed = poll->elapsed;
+    record->ts_nanos = poll->ts_nanos;
+    record->elapsed_secs = poll->elapsed_secs;
+    record->samples = NULL;
+    record->samples_len = 0;
+    record->total = poll->total;
+
+    const union optics_poll_value *value = &poll->value;
+
+    switch (poll->type) {
+    case optics_counter: record->value.counter = value->counter; break;
+    case optics_gauge: record->value.gauge = value->gauge; break;
+    case optics_histo: record->value.histo = value->histo; break;
+    case optics_quantile: record->value.quantile = value->quantile; break;
+    case optics_quantiles: record->value.quantiles = value->quantiles; break;
+    case optics_hdr: record->value.hdr = value->hdr; break;
+    case optics_sketch: record->value.sketch = value->sketch; break;
+    case optics_meter: record->value.meter = value->meter; break;
+    case optics_topk: record->value.topk = value->topk; break;
+    case optics_hll: record->value.hll = value->hll; break;
+    case optics_updown: record->value.updown = value->updown; break;
+    case optics_histo2d: record->value.histo2d = value->histo2d; break;
+
+    case optics_dist:
+        record->value.dist = (struct optics_dist_summary) {
+            .n = value->dist.n,
+            .p50 = value->dist.p50,
+            .p90 = value->dist.p90,
+            .p99 = value->dist.p99,
+            .max = value->dist.max,
+        };
+
+        record->samples_len = value->dist.samples_len;
+        if (record->samples_len) record->samples = value->dist.samples;
+        break;
+
+    case optics_family:
+    default:
+        optics_fail("unknown lens type '%d'", poll->type);
+        break;
+    }
+}
+
+static void poller_backend_emit(
+        struct optics_poller *poller,
+        size_t index,
+        enum optics_poll_type type,
+        const struct optics_poll *poll,
+        const struct optics_record *record)
+{
+    struct backend *backend = &poller->backends[index];
+    uint64_t start = poller->self ? poller_self_now() : 0;
+
+    if (backend->record) backend->record(backend->ctx, type, poll ? record : NULL);
+    else if (backend->async) poller_async_push(backend->async, type, poll);
+    else backend->cb(backend->ctx, type, poll);
+
+    if (poller->self) poller_self_backend(poller, index, start);
+}
+
+// The record is only encoded if there's at least one backend to consume it.
+// Backends is a mask of the backends that are interested in the poll. Rolled up
+// backends only get the polls folded into their window here and are otherwise
+// driven by the flushes of their rollup.
 static void poller_backend_record(
         struct optics_poller *poller,
         enum optics_poll_type type,
-        const struct optics_poll *poll)
+        const struct optics_poll *poll,
+        uint32_t backends)
 {
-    for (size_t i = 0; i < poller->backends_len; ++i)
-        poller->backends[i].cb(poller->backends[i].ctx, type, poll);
+    struct optics_record record;
+    const struct optics_record *encoded = NULL;
+
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        if (!(backends & (1U << i))) continue;
+        struct backend *backend = &poller->backends[i];
+
+        if (backend->rollup) {
+            if (poll) poller_rollup_fold(backend->rollup, poll);
+            continue;
+        }
+
+        if (backend->record && poll && !encoded) {
+            poller_record_encode(&record, poll);
+            encoded = &record;
+        }
+
+        poller_backend_emit(poller, i, type, poll, encoded);
+    }
 }
 
 
@@ -136,5 +587,9 @@ static void poller_backend_record(
 // implementation
 // -----------------------------------------------------------------------------
 
+#include "poller_self.c"
 #include "poller_thread.c"
 #include "poller_poll.c"
+#include "poller_pool.c"
+#include "poller_async.c"
+#include "poller_rollup.c"
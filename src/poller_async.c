@@ -0,0 +1,353 @@
+/* poller_async.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Asynchronous dispatch of polls to a backend through a single-producer
+   single-consumer ring consumed by a dedicated thread. Polls are deep copied
+   into the ring slots since the values they point to only live until the next
+   poll of the lens. Each slot keeps its own buffers for the counts of hdr,
+   sketch and histo2d lenses, the dist samples, the topk entries and the hll
+   registers which are only ever grown to avoid allocating in steady state.
+*/
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    poller_async_ring_min = 4,
+
+    // Period at which a blocked producer checks for free slots.
+    poller_async_backoff = 10 * 1000,
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct poller_async_slot
+{
+    enum optics_poll_type type;
+    struct optics_poll poll;
+    char key[optics_name_max_len];
+    char prefix[optics_name_max_len];
+    char host[optics_name_max_len];
+
+    size_t *counts;
+    size_t counts_cap;
+
+    double *samples;
+    size_t samples_cap;
+
+    struct optics_topk_entry *entries;
+    size_t entries_cap;
+
+    uint8_t *registers;
+    size_t registers_cap;
+};
+
+struct poller_async
+{
+    struct backend backend;
+    enum optics_backend_policy policy;
+
+    pthread_t handle;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    atomic_bool waiting;
+    atomic_bool stop;
+
+    atomic_size_t dropped;
+
+    atomic_size_t head optics_align(64); // written by the consumer.
+    atomic_size_t tail optics_align(64); // written by the producer.
+
+    size_t mask optics_align(64);
+    struct poller_async_slot slots[];
+};
+
+
+// -----------------------------------------------------------------------------
+// copy
+// -----------------------------------------------------------------------------
+
+static void poller_async_copy_counts(
+        struct poller_async_slot *slot, const size_t *counts, size_t len)
+{
+    if (slot->counts_cap < len) {
+        slot->counts = realloc(slot->counts, len * sizeof(*counts));
+        optics_assert_alloc(slot->counts);
+        slot->counts_cap = len;
+    }
+
+    memcpy(slot->counts, counts, len * sizeof(*counts));
+}
+
+static void poller_async_copy_samples(
+        struct poller_async_slot *slot, const double *samples, size_t len)
+{
+    if (slot->samples_cap < len) {
+        slot->samples = realloc(slot->samples, len * sizeof(*samples));
+        optics_assert_alloc(slot->samples);
+        slot->samples_cap = len;
+    }
+
+    memcpy(slot->samples, samples, len * sizeof(*samples));
+}
+
+static void poller_async_copy_entries(
+        struct poller_async_slot *slot, const struct optics_topk_entry *entries, size_t len)
+{
+    if (slot->entries_cap < len) {
+        slot->entries = realloc(slot->entries, len * sizeof(*entries));
+        optics_assert_alloc(slot->entries);
+        slot->entries_cap = len;
+    }
+
+    memcpy(slot->entries, entries, len * sizeof(*entries));
+}
+
+static void poller_async_copy_registers(
+        struct poller_async_slot *slot, const uint8_t *registers, size_t len)
+{
+    if (slot->registers_cap < len) {
+        slot->registers = realloc(slot->registers, len);
+        optics_assert_alloc(slot->registers);
+        slot->registers_cap = len;
+    }
+
+    memcpy(slot->registers, registers, len);
+}
+
+static void poller_async_copy(
+        struct poller_async_slot *slot,
+        enum optics_poll_type type,
+        const struct optics_poll *poll)
+{
+    slot->type = type;
+    if (!poll) return;
+
+    slot->poll = *poll;
+    strlcpy(slot->key, poll->key, sizeof(slot->key));
+    slot->poll.key = slot->key;
+
+    // The prefix and host belong to the optics and the poller which may be
+    // modified, detached or freed before the slot is consumed.
+    strlcpy(slot->prefix, poll->prefix, sizeof(slot->prefix));
+    slot->poll.prefix = slot->prefix;
+    strlcpy(slot->host, poll->host, sizeof(slot->host));
+    slot->poll.host = slot->host;
+
+    // The cached keys may be flushed before the slot is consumed.
+    slot->poll.keys = NULL;
+
+    switch (poll->type) {
+    case optics_hdr:
+        poller_async_copy_counts(slot, poll->value.hdr.counts, poll->value.hdr.buckets_len);
+        slot->poll.value.hdr.counts = slot->counts;
+        break;
+
+    case optics_histo2d: {
+        const struct optics_histo2d *histo = &poll->value.histo2d;
+        poller_async_copy_counts(
+                slot, histo->counts, (histo->rows_len - 1) * (histo->cols_len - 1));
+        slot->poll.value.histo2d.counts = slot->counts;
+        break;
+    }
+
+    case optics_sketch:
+        poller_async_copy_counts(
+                slot, poll->value.sketch.counts, poll->value.sketch.buckets_len);
+        slot->poll.value.sketch.counts = slot->counts;
+        break;
+
+    case optics_dist:
+        poller_async_copy_samples(
+                slot, poll->value.dist.samples, poll->value.dist.samples_len);
+        slot->poll.value.dist.samples = slot->samples;
+        break;
+
+    case optics_topk:
+        poller_async_copy_entries(slot, poll->value.topk.entries, poll->value.topk.len);
+        slot->poll.value.topk.entries = slot->entries;
+        break;
+
+    case optics_hll:
+        poller_async_copy_registers(
+                slot, poll->value.hll.registers, poll->value.hll.registers_len);
+        slot->poll.value.hll.registers = slot->registers;
+        break;
+
+    case optics_counter:
+    case optics_gauge:
+    case optics_histo:
+    case optics_quantile:
+    case optics_quantiles:
+    case optics_meter:
+    case optics_updown:
+    case optics_family:
+    default: break;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// consumer
+// -----------------------------------------------------------------------------
+
+// Should be called while holding the lock. The waiting flag is raised before
+// checking the ring one last time which guarantees that either we see the new
+// slot or the producer sees the flag and signals us.
+static bool poller_async_wait(struct poller_async *async, size_t head)
+{
+    atomic_store(&async->waiting, true);
+
+    while (atomic_load(&async->tail) == head && !atomic_load(&async->stop))
+        pthread_cond_wait(&async->cond, &async->lock);
+
+    atomic_store(&async->waiting, false);
+    return atomic_load(&async->tail) != head;
+}
+
+static void * poller_async_fn(void *ctx)
+{
+    struct poller_async *async = ctx;
+    struct backend *backend = &async->backend;
+
+    size_t head = atomic_load_explicit(&async->head, memory_order_relaxed);
+
+    while (true) {
+        // Synchronizes with poller_async_push to make sure that the slot is
+        // fully written before we read it.
+        size_t tail = atomic_load_explicit(&async->tail, memory_order_acquire);
+
+        if (head == tail) {
+            pthread_mutex_lock(&async->lock);
+            bool more = poller_async_wait(async, head);
+            pthread_mutex_unlock(&async->lock);
+
+            // The ring is always drained before we stop.
+            if (!more) break;
+            continue;
+        }
+
+        for (; head != tail; ++head) {
+            struct poller_async_slot *slot = &async->slots[head & async->mask];
+            const struct optics_poll *poll =
+                slot->type == optics_poll_metric ? &slot->poll : NULL;
+            backend->cb(backend->ctx, slot->type, poll);
+        }
+
+        // Synchronizes with poller_async_push to make sure that we're done
+        // with the slots before they're overwritten.
+        atomic_store_explicit(&async->head, head, memory_order_release);
+    }
+
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// producer
+// -----------------------------------------------------------------------------
+
+// Only metrics can be dropped as dropping the begin and done events would leave
+// the backend in an inconsistent state.
+static void poller_async_push(
+        struct poller_async *async,
+        enum optics_poll_type type,
+        const struct optics_poll *poll)
+{
+    size_t tail = atomic_load_explicit(&async->tail, memory_order_relaxed);
+
+    while (tail - atomic_load_explicit(&async->head, memory_order_acquire) > async->mask) {
+        if (type == optics_poll_metric && async->policy == optics_backend_drop) {
+            atomic_fetch_add_explicit(&async->dropped, 1, memory_order_relaxed);
+            return;
+        }
+
+        nsleep(poller_async_backoff);
+    }
+
+    poller_async_copy(&async->slots[tail & async->mask], type, poll);
+    atomic_store(&async->tail, tail + 1);
+
+    if (atomic_load(&async->waiting)) {
+        pthread_mutex_lock(&async->lock);
+        pthread_cond_signal(&async->cond);
+        pthread_mutex_unlock(&async->lock);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// alloc/free
+// -----------------------------------------------------------------------------
+
+static struct poller_async *poller_async_alloc(
+        struct backend backend, size_t ring_len, enum optics_backend_policy policy)
+{
+    if (ring_len < poller_async_ring_min) ring_len = poller_async_ring_min;
+    ring_len = ceil_pow2(ring_len);
+
+    size_t len = sizeof(struct poller_async) + ring_len * sizeof(struct poller_async_slot);
+    struct poller_async *async = aligned_alloc(64, align(len, 64));
+    optics_assert_alloc(async);
+    memset(async, 0, len);
+
+    async->backend = backend;
+    async->policy = policy;
+    async->mask = ring_len - 1;
+
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->cond, NULL);
+
+    int err = pthread_create(&async->handle, NULL, poller_async_fn, async);
+    if (err) {
+        optics_fail_ierrno(err, "unable to create async backend thread");
+        goto fail_thread;
+    }
+
+    return async;
+
+  fail_thread:
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->lock);
+    free(async);
+    return NULL;
+}
+
+static size_t poller_async_dropped(struct poller_async *async)
+{
+    return atomic_load_explicit(&async->dropped, memory_order_relaxed);
+}
+
+// Waits for all the queued polls to be consumed before returning.
+static void poller_async_free(struct poller_async *async)
+{
+    {
+        pthread_mutex_lock(&async->lock);
+
+        atomic_store(&async->stop, true);
+        pthread_cond_signal(&async->cond);
+
+        pthread_mutex_unlock(&async->lock);
+    }
+
+    int err = pthread_join(async->handle, NULL);
+    if (err) optics_fail_ierrno(err, "unable to join async backend thread");
+
+    for (size_t i = 0; i <= async->mask; ++i) {
+        free(async->slots[i].counts);
+        free(async->slots[i].samples);
+        free(async->slots[i].entries);
+        free(async->slots[i].registers);
+    }
+
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->lock);
+    free(async);
+}
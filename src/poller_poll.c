@@ -8,51 +8,635 @@
 // config
 // -----------------------------------------------------------------------------
 
-enum { poller_max_optics = 128 };
+enum
+{
+    // Number of polls buffered by a worker before they're handed to the
+    // backends in one go.
+    poller_batch_len = 32,
+};
+
+// Busy lenses are retried with an exponential backoff until the budget runs out.
+static const uint64_t poller_retry_budget = 1 * 1000 * 1000;
+static const uint64_t poller_retry_backoff_min = 1 * 1000;
+static const uint64_t poller_retry_backoff_max = 100 * 1000;
 
 
 // -----------------------------------------------------------------------------
 // struct
 // -----------------------------------------------------------------------------
 
+struct poller_batch
+{
+    size_t len;
+    char keys[poller_batch_len][optics_name_max_len];
+    struct optics_poll polls[poller_batch_len];
+    uint32_t backends[poller_batch_len];
+};
+
+// Lenses that were busy during the traversal. The lock is only used for
+// parallel polls.
+struct poller_retry
+{
+    pthread_mutex_t *lock;
+
+    size_t len;
+    size_t cap;
+    struct optics_lens **lenses;
+};
+
+// Lenses whose ttl expired during the traversal which are closed once it's
+// done. The lock is only used for parallel polls.
+struct poller_expire
+{
+    pthread_mutex_t *lock;
+
+    size_t len;
+    size_t cap;
+    struct optics_lens **lenses;
+};
+
 struct poller_poll_ctx
 {
     struct optics_poller *poller;
+    struct poller_optics *instance;
 
+    // Whole seconds along with the full precision in nanos.
     optics_ts_t ts;
     optics_ts_t elapsed;
+    uint64_t ts_nanos;
+    uint64_t elapsed_nanos;
 
     const char *host;
     const char *prefix;
 
     optics_epoch_t epoch;
+
+    // Only set for parallel polls in which case the key cache is shared.
+    pthread_mutex_t *keys_lock;
+
+    // Only set for parallel polls in which case the backends are shared
+    // between all the workers and must be called while holding the lock.
+    struct poller_batch *batch;
+    pthread_mutex_t *backends_lock;
+
+    // NULL once the busy lenses are being retried.
+    struct poller_retry *retry;
+
+    struct poller_expire *expire;
 };
 
 
+// -----------------------------------------------------------------------------
+// time
+// -----------------------------------------------------------------------------
+
+static const uint64_t poller_nanos = 1000000000UL;
+
+// Rounded to the nearest second such that sub-second jitter doesn't skew the
+// whole seconds.
+static optics_ts_t poller_elapsed_secs(uint64_t nanos)
+{
+    optics_ts_t secs = (nanos + poller_nanos / 2) / poller_nanos;
+    return secs ? secs : 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+static void poller_batch_flush(struct poller_poll_ctx *ctx)
+{
+    struct poller_batch *batch = ctx->batch;
+    if (!batch->len) return;
+
+    pthread_mutex_lock(ctx->backends_lock);
+
+    for (size_t i = 0; i < batch->len; ++i)
+        poller_backend_record(
+                ctx->poller, optics_poll_metric, &batch->polls[i], batch->backends[i]);
+
+    pthread_mutex_unlock(ctx->backends_lock);
+
+    batch->len = 0;
+}
+
+// The key is copied as it may point to a temporary buffer (eg. families).
+static void poller_batch_push(
+        struct poller_poll_ctx *ctx, const struct optics_poll *poll, uint32_t backends)
+{
+    struct poller_batch *batch = ctx->batch;
+
+    size_t i = batch->len++;
+    batch->polls[i] = *poll;
+    batch->backends[i] = backends;
+    strlcpy(batch->keys[i], poll->key, sizeof(batch->keys[i]));
+    batch->polls[i].key = batch->keys[i];
+
+    if (batch->len == poller_batch_len) poller_batch_flush(ctx);
+}
+
+
+// -----------------------------------------------------------------------------
+// keys
+// -----------------------------------------------------------------------------
+// Keys are cached by lens name so the shape of the lens, which determines the
+// keys emitted by its normalizer, is also checked in case the lens was reopened
+// with a different configuration. Only the lookup is done under the lock as a
+// lens is polled by a single worker such that its entry is never shared.
+
+struct poller_keys
+{
+    uint64_t shape;
+    size_t stamp;
+    struct optics_poll_keys *keys;
+
+    // Backends whose filter matches the lens and the hash of the last value
+    // polled which is only tracked if a backend wants changed values.
+    uint32_t backends;
+    bool hashed;
+    uint64_t hash;
+
+    // Elapsed nanos of the polls that gave up on the lens while it was busy.
+    // The values are left in the epoch and reported by the next read of the
+    // same epoch which must then cover the elapsed time of both polls.
+    uint64_t carry[2];
+
+    // Consecutive idle polls of lenses with a ttl and the hash of the last
+    // gauge value which tells whether the gauge was set.
+    uint32_t idle;
+    bool idle_hashed;
+    uint64_t idle_hash;
+
+    // Running total of counters when enabled which lives as long as the lens
+    // is polled.
+    struct optics_counter_total total;
+};
+
+static uint64_t poller_keys_mix(uint64_t hash, uint64_t value)
+{
+    return (hash ^ value) * 0x100000001b3;
+}
+
+static uint64_t poller_keys_shape(const struct optics_poll *poll)
+{
+    uint64_t shape = poller_keys_mix(0xcbf29ce484222325, poll->type);
+
+    switch (poll->type) {
+
+    case optics_counter:
+        shape = poller_keys_mix(shape, poll->total.tracked);
+        break;
+
+    case optics_histo: {
+        const struct optics_histo *histo = &poll->value.histo;
+        for (size_t i = 0; i < histo->buckets_len; ++i)
+            shape = poller_keys_mix(shape, histo->buckets[i]);
+        break;
+    }
+
+    case optics_histo2d: {
+        const struct optics_histo2d *histo = &poll->value.histo2d;
+        for (size_t i = 0; i < histo->rows_len; ++i)
+            shape = poller_keys_mix(shape, histo->rows[i]);
+        for (size_t i = 0; i < histo->cols_len; ++i)
+            shape = poller_keys_mix(shape, histo->cols[i]);
+        break;
+    }
+
+    case optics_quantiles: {
+        const struct optics_quantiles *quantiles = &poll->value.quantiles;
+        for (size_t i = 0; i < quantiles->len; ++i) {
+            uint64_t value;
+            memcpy(&value, &quantiles->quantiles[i], sizeof(value));
+            shape = poller_keys_mix(shape, value);
+        }
+        break;
+    }
+
+    case optics_gauge:
+    case optics_dist:
+    case optics_quantile:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_family:
+    default: break;
+    }
+
+    return shape;
+}
+
+static void poller_keys_free(struct poller_keys *entry)
+{
+    free(entry->keys);
+    free(entry);
+}
+
+static void poller_keys_flush(struct poller_optics *instance)
+{
+    struct htable_bucket *bucket = NULL;
+    while ((bucket = htable_next(&instance->keys, bucket))) {
+        poller_keys_free(pun_itop(bucket->value));
+        htable_del(&instance->keys, bucket->key);
+    }
+}
+
+// Should be called while holding the instances lock.
+static void poller_keys_clear(struct optics_poller *poller)
+{
+    for (size_t i = 0; i < poller->instances_len; ++i)
+        poller_keys_flush(poller->instances[i]);
+}
+
+// Entries that weren't polled in the last round belong to closed lenses.
+static void poller_keys_sweep(struct optics_poller *poller, struct poller_optics *instance)
+{
+    struct htable_bucket *bucket = NULL;
+    while ((bucket = htable_next(&instance->keys, bucket))) {
+        struct poller_keys *entry = pun_itop(bucket->value);
+        if (entry->stamp == poller->keys_stamp) continue;
+
+        poller_keys_free(entry);
+        htable_del(&instance->keys, bucket->key);
+    }
+}
+
+static uint32_t poller_filter_match(
+        struct optics_poller *, const char *key, enum optics_lens_type type);
+
+static struct poller_keys *poller_keys_entry(struct poller_poll_ctx *ctx, const char *key)
+{
+    struct optics_poller *poller = ctx->poller;
+    struct htable *keys = &ctx->instance->keys;
+
+    if (ctx->keys_lock) pthread_mutex_lock(ctx->keys_lock);
+
+    struct poller_keys *entry = NULL;
+    struct htable_ret ret = htable_get(keys, key);
+    if (ret.ok) entry = pun_itop(ret.value);
+    else {
+        entry = calloc(1, sizeof(*entry));
+        optics_assert_alloc(entry);
+        htable_put(keys, key, pun_ptoi(entry));
+    }
+
+    if (ctx->keys_lock) pthread_mutex_unlock(ctx->keys_lock);
+
+    entry->stamp = poller->keys_stamp;
+    return entry;
+}
+
+// New entries start their total from 0 at the time of the poll which is the
+// reset hint for the consumers.
+static void poller_keys_total(
+        struct poller_poll_ctx *ctx, struct poller_keys *entry, struct optics_poll *poll)
+{
+    if (!entry->total.tracked) {
+        entry->total.tracked = true;
+        entry->total.created = ctx->ts;
+    }
+
+    entry->total.value += poll->value.counter;
+    poll->total = entry->total;
+}
+
+// The total is part of the shape of a counter so it's attached before the keys
+// are checked.
+static struct poller_keys *poller_keys_get(
+        struct poller_poll_ctx *ctx, struct optics_poll *poll)
+{
+    struct optics_poller *poller = ctx->poller;
+    struct poller_keys *entry = poller_keys_entry(ctx, poll->key);
+
+    if (poll->type == optics_counter) {
+        if (poller->counter_totals) poller_keys_total(ctx, entry, poll);
+        else entry->total = (struct optics_counter_total) {0};
+    }
+
+    uint64_t shape = poller_keys_shape(poll);
+    if (!entry->keys || entry->shape != shape) {
+        free(entry->keys);
+        entry->keys = optics_poll_keys_alloc(poll);
+        entry->shape = shape;
+        entry->backends = poller_filter_match(poller, poll->key, poll->type);
+        entry->hashed = false;
+    }
+
+    return entry;
+}
+
+
+// -----------------------------------------------------------------------------
+// filter
+// -----------------------------------------------------------------------------
+// The type and prefix of a filter only depend on the lens so they're matched
+// once and cached with the keys. Lenses that no backend wants are still read to
+// drain the epoch but are never normalized, encoded or handed to a backend.
+
+static void poller_filter_free(struct backend *backend)
+{
+    for (size_t i = 0; i < backend->filter_prefixes_len; ++i)
+        free(backend->filter_prefixes[i]);
+    free(backend->filter_prefixes);
+
+    backend->filter_prefixes = NULL;
+    backend->filter_prefixes_len = 0;
+}
+
+static bool poller_filter_prefix(const struct backend *backend, const char *key)
+{
+    if (!backend->filter_prefixes) return true;
+
+    for (size_t i = 0; i < backend->filter_prefixes_len; ++i) {
+        const char *prefix = backend->filter_prefixes[i];
+        if (!strncmp(key, prefix, strlen(prefix))) return true;
+    }
+
+    return false;
+}
+
+static uint32_t poller_filter_match(
+        struct optics_poller *poller, const char *key, enum optics_lens_type type)
+{
+    if (!poller->backends_filtered) return poller_backends_all;
+
+    uint32_t backends = 0;
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        const struct backend *backend = &poller->backends[i];
+
+        bool match = !backend->filtered || (
+                (!backend->filter_types || backend->filter_types & (1U << type)) &&
+                poller_filter_prefix(backend, key));
+        if (match) backends |= 1U << i;
+    }
+
+    return backends;
+}
+
+// Dist samples are left out as they're only meaningful for the summary.
+static size_t poller_filter_value_len(enum optics_lens_type type)
+{
+    union optics_poll_value *value = NULL;
+
+    switch (type) {
+    case optics_counter: return sizeof(value->counter);
+    case optics_gauge: return sizeof(value->gauge);
+    case optics_dist: return offsetof(struct optics_dist, samples_len);
+    case optics_histo: return sizeof(value->histo);
+    case optics_quantile: return sizeof(value->quantile);
+    case optics_quantiles: return sizeof(value->quantiles);
+    case optics_hdr: return sizeof(value->hdr);
+    case optics_sketch: return sizeof(value->sketch);
+    case optics_meter: return sizeof(value->meter);
+    case optics_topk: return sizeof(value->topk);
+    case optics_hll: return sizeof(value->hll);
+    case optics_updown: return sizeof(value->updown);
+    case optics_histo2d: return sizeof(value->histo2d);
+    case optics_family:
+    default: return 0;
+    }
+}
+
+// Values are cleared before they're read so the padding is always zero and the
+// bytes can be hashed as is.
+static uint64_t poller_filter_hash(const struct optics_poll *poll)
+{
+    const uint8_t *it = (const uint8_t *) &poll->value;
+    size_t len = poller_filter_value_len(poll->type);
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; ++i) hash = poller_keys_mix(hash, it[i]);
+    return hash;
+}
+
+static uint32_t poller_filter(
+        struct optics_poller *poller,
+        struct poller_keys *entry,
+        const struct optics_poll *poll)
+{
+    uint32_t backends = entry->backends;
+    if (!(backends & poller->backends_changed)) return backends;
+
+    uint64_t hash = poller_filter_hash(poll);
+    bool changed = !entry->hashed || entry->hash != hash;
+    entry->hashed = true;
+    entry->hash = hash;
+
+    return changed ? backends : backends & ~poller->backends_changed;
+}
+
+
+// -----------------------------------------------------------------------------
+// expire
+// -----------------------------------------------------------------------------
+// Idleness is derived from the value read by the poller since the values are
+// reset on every read. This keeps the record paths, including the inline
+// handles, free of any extra bookkeeping. Gauges aren't reset by reads so their
+// writes can't be told apart from an unchanged value which is why comparing
+// their values is opt-in.
+
+static bool poller_expire_idle(
+        struct optics_poller *poller, struct poller_keys *entry, const struct optics_poll *poll)
+{
+    const union optics_poll_value *value = &poll->value;
+
+    switch (poll->type) {
+    case optics_counter: return !value->counter;
+    case optics_dist: return !value->dist.n;
+    case optics_quantile: return !value->quantile.count;
+    case optics_quantiles: return !value->quantiles.count;
+    case optics_hdr: return !value->hdr.count;
+    case optics_sketch: return !value->sketch.count;
+    case optics_meter: return !value->meter.count;
+    case optics_topk: return !value->topk.len;
+    case optics_hll: return value->hll.estimate <= 0;
+    case optics_histo2d: return !value->histo2d.count && !value->histo2d.outside;
+
+    case optics_histo: {
+        const struct optics_histo *histo = &value->histo;
+        if (histo->below || histo->above) return false;
+        for (size_t i = 0; i + 1 < histo->buckets_len; ++i)
+            if (histo->counts[i]) return false;
+        return true;
+    }
+
+    case optics_gauge:
+    case optics_updown: {
+        if (!poller->expire_unchanged) return false;
+
+        uint64_t hash = poller_filter_hash(poll);
+        bool idle = entry->idle_hashed && entry->idle_hash == hash;
+        entry->idle_hashed = true;
+        entry->idle_hash = hash;
+        return idle;
+    }
+
+    case optics_family:
+    default: return false;
+    }
+}
+
+static void poller_expire_check(
+        struct poller_poll_ctx *ctx, struct optics_lens *lens,
+        struct poller_keys *entry, const struct optics_poll *poll)
+{
+    uint32_t ttl = optics_lens_get_ttl(lens);
+    if (!ttl) return;
+
+    if (!poller_expire_idle(ctx->poller, entry, poll)) {
+        entry->idle = 0;
+        return;
+    }
+
+    if (++entry->idle < ttl) return;
+    entry->idle = 0;
+
+    struct poller_expire *expire = ctx->expire;
+    if (expire->lock) pthread_mutex_lock(expire->lock);
+
+    if (expire->len == expire->cap) {
+        expire->cap = expire->cap ? expire->cap * 2 : 8;
+        expire->lenses = realloc(expire->lenses, expire->cap * sizeof(*expire->lenses));
+        optics_assert_alloc(expire->lenses);
+    }
+    expire->lenses[expire->len++] = lens;
+
+    if (expire->lock) pthread_mutex_unlock(expire->lock);
+}
+
+// Lenses are closed after the traversal through the regular close path whose
+// deferred free keeps concurrent records safe until the next epoch change.
+// The key cache entries are swept by the next poll.
+static void poller_expire_run(struct optics_poller *poller, struct poller_expire *expire)
+{
+    for (size_t i = 0; i < expire->len; ++i) {
+        struct optics_lens *lens = expire->lenses[i];
+        if (poller->expire && !poller->expire(poller->expire_ctx, lens)) continue;
+
+        if (!optics_lens_close(lens))
+            optics_warn("unable to close expired lens '%s'", optics_lens_name(lens));
+    }
+
+    free(expire->lenses);
+}
+
+
 // -----------------------------------------------------------------------------
 // lens
 // -----------------------------------------------------------------------------
 
-static enum optics_ret poller_poll_lens(void *ctx_, struct optics_lens *lens)
+// Lens reads expect a zeroed value so only the part of the union used by the
+// type is cleared which avoids zeroing the whole value for every lens.
+static void poller_poll_clear(union optics_poll_value *value, enum optics_lens_type type)
 {
-    struct poller_poll_ctx *ctx = ctx_;
+    size_t len = sizeof(*value);
+
+    switch (type) {
+    case optics_counter: len = sizeof(value->counter); break;
+    case optics_gauge: len = sizeof(value->gauge); break;
+    case optics_dist: len = sizeof(value->dist); break;
+    case optics_histo: len = sizeof(value->histo); break;
+    case optics_quantile: len = sizeof(value->quantile); break;
+    case optics_quantiles: len = sizeof(value->quantiles); break;
+    case optics_hdr: len = sizeof(value->hdr); break;
+    case optics_sketch: len = sizeof(value->sketch); break;
+    case optics_meter: len = sizeof(value->meter); break;
+    case optics_topk: len = sizeof(value->topk); break;
+    case optics_hll: len = sizeof(value->hll); break;
+    case optics_updown: len = sizeof(value->updown); break;
+    case optics_histo2d: len = sizeof(value->histo2d); break;
+
+    // Children are either counters, gauges, dists or histos and the histo is
+    // the largest of them.
+    case optics_family: len = sizeof(value->histo); break;
+
+    default: break;
+    }
+
+    memset(value, 0, len);
+}
+
+static void poller_poll_record(
+        struct poller_poll_ctx *ctx, const struct optics_poll *poll,
+        enum optics_ret ret, uint32_t backends)
+{
+    if (ret == optics_ok) {
+        if (!backends) return;
+        if (ctx->batch) poller_batch_push(ctx, poll, backends);
+        else poller_backend_record(ctx->poller, optics_poll_metric, poll, backends);
+        return;
+    }
 
     struct optics_key key = {0};
     optics_key_push(&key, ctx->prefix);
     optics_key_push(&key, ctx->host);
-    optics_key_push(&key, optics_lens_name(lens));
+    optics_key_push(&key, poll->key);
 
-    enum optics_ret ret;
-    struct optics_poll poll = (struct optics_poll) {
-        .type = optics_lens_type(lens),
+    if (ret == optics_busy) {
+        poller_self_busy(ctx->poller);
+        optics_warn("skipping lens '%s'", key.data);
+    }
+    else if (ret == optics_err)
+        optics_warn("unable to read lens '%s': %s", key.data, optics_errno.msg);
+}
 
-        .host = ctx->host,
-        .prefix = ctx->prefix,
-        .key = optics_lens_name(lens),
+// Each child of the family is reported as an independent lens of the family's
+// type whose key is only formatted here rather than on the record path. The
+// filters are matched against the family name and the children are always
+// considered changed as they're not cached.
+static void poller_poll_family(
+        struct poller_poll_ctx *ctx, struct optics_lens *lens, struct optics_poll *poll)
+{
+    size_t len = optics_family_len(lens);
+
+    bool matched = false;
+    uint32_t backends = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        struct optics_key key = {0};
+        optics_key_push(&key, optics_lens_name(lens));
+        if (!optics_family_key(lens, i, &key)) {
+            poller_poll_record(ctx, poll, optics_err, 0);
+            return;
+        }
+
+        poll->key = key.data;
+        poll->keys = NULL;
+        poller_poll_clear(&poll->value, optics_family);
+
+        enum optics_ret ret = optics_family_read(lens, ctx->epoch, i, poll);
+        if (ret == optics_ok && !matched) {
+            backends = poller_filter_match(ctx->poller, optics_lens_name(lens), poll->type);
+            matched = true;
+        }
+
+        poller_poll_record(ctx, poll, ret, backends);
+    }
+}
 
-        .ts = ctx->ts,
-        .elapsed = ctx->elapsed,
-    };
+// Busy lenses are left untouched and reported as busy unless this is the last
+// attempt to read them.
+static enum optics_ret poller_poll_read(
+        struct poller_poll_ctx *ctx, struct optics_lens *lens, bool last)
+{
+    enum optics_ret ret;
+
+    struct optics_poll poll;
+    poll.type = optics_lens_type(lens);
+    poll.host = ctx->host;
+    poll.prefix = ctx->prefix;
+    poll.key = optics_lens_name(lens);
+    poll.keys = NULL;
+    poll.ts = ctx->ts;
+    poll.elapsed = ctx->elapsed;
+    poll.ts_nanos = ctx->ts_nanos;
+    poll.elapsed_secs = (double) ctx->elapsed_nanos / poller_nanos;
+    poll.total = (struct optics_counter_total) {0};
+    poller_poll_clear(&poll.value, poll.type);
 
     switch (poll.type) {
     case optics_counter:
@@ -75,18 +659,136 @@ static enum optics_ret poller_poll_lens(void *ctx_, struct optics_lens *lens)
         ret = optics_quantile_read(lens, ctx->epoch, &poll.value.quantile);
         break;
 
+    case optics_quantiles:
+        ret = optics_quantiles_read(lens, ctx->epoch, &poll.value.quantiles);
+        break;
+
+    case optics_hdr:
+        ret = optics_hdr_read(lens, ctx->epoch, &poll.value.hdr);
+        break;
+
+    case optics_sketch:
+        ret = optics_sketch_read(lens, ctx->epoch, &poll.value.sketch);
+        break;
+
+    // The averages are decayed by the read so it needs the time carried over
+    // from busy reads upfront.
+    case optics_meter: {
+        const struct poller_keys *entry = poller_keys_entry(ctx, poll.key);
+        ret = optics_meter_read(lens, ctx->epoch,
+                poller_elapsed_secs(ctx->elapsed_nanos + entry->carry[ctx->epoch]),
+                &poll.value.meter);
+        break;
+    }
+
+    case optics_topk:
+        ret = optics_topk_read(lens, ctx->epoch, &poll.value.topk);
+        break;
+
+    case optics_hll:
+        ret = optics_hll_read(lens, ctx->epoch, &poll.value.hll);
+        break;
+
+    case optics_updown:
+        ret = optics_updown_read(lens, ctx->epoch, &poll.value.updown);
+        break;
+
+    case optics_histo2d:
+        ret = optics_histo2d_read(lens, ctx->epoch, &poll.value.histo2d);
+        break;
+
+    case optics_family:
+        poller_poll_family(ctx, lens, &poll);
+        return optics_ok;
+
     default:
         optics_fail("unknown poller type '%d'", poll.type);
         ret = optics_err;
         break;
     }
 
-    if (ret == optics_ok)
-        poller_backend_record(ctx->poller, optics_poll_metric, &poll);
-    else if (ret == optics_busy)
-        optics_warn("skipping lens '%s'", key.data);
-    else if (ret == optics_err)
-        optics_warn("unable to read lens '%s': %s", key.data, optics_errno.msg);
+    if (ret == optics_busy && !last) return optics_busy;
+
+    uint32_t backends = 0;
+    if (ret == optics_ok) {
+        struct poller_keys *entry = poller_keys_get(ctx, &poll);
+        poll.keys = entry->keys;
+        uint64_t carry = entry->carry[ctx->epoch];
+        if (carry) {
+            poll.elapsed = poller_elapsed_secs(ctx->elapsed_nanos + carry);
+            poll.elapsed_secs = (double) (ctx->elapsed_nanos + carry) / poller_nanos;
+        }
+        entry->carry[ctx->epoch] = 0;
+        backends = poller_filter(ctx->poller, entry, &poll);
+        poller_expire_check(ctx, lens, entry, &poll);
+    }
+    else if (ret == optics_busy) {
+        struct poller_keys *entry = poller_keys_entry(ctx, poll.key);
+        entry->carry[ctx->epoch] += ctx->elapsed_nanos;
+        entry->idle = 0;
+    }
+
+    poller_poll_record(ctx, &poll, ret, backends);
+    return optics_ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// retry
+// -----------------------------------------------------------------------------
+// Busy lenses are almost always dists whose lock is held by a straggler that
+// was preempted in the middle of a record. These are collected during the
+// traversal and retried once it's done which gives the stragglers the whole
+// traversal and then the retry budget to finish.
+
+static void poller_retry_push(struct poller_retry *retry, struct optics_lens *lens)
+{
+    if (retry->lock) pthread_mutex_lock(retry->lock);
+
+    if (retry->len == retry->cap) {
+        retry->cap = retry->cap ? retry->cap * 2 : 8;
+        retry->lenses = realloc(retry->lenses, retry->cap * sizeof(*retry->lenses));
+        optics_assert_alloc(retry->lenses);
+    }
+    retry->lenses[retry->len++] = lens;
+
+    if (retry->lock) pthread_mutex_unlock(retry->lock);
+}
+
+// Lenses that are still busy once the budget runs out are given up on and
+// their values are carried to the next read of the epoch.
+static void poller_retry_run(struct poller_poll_ctx *ctx, struct poller_retry *retry)
+{
+    ctx->retry = NULL;
+
+    uint64_t deadline = poller_self_now() + poller_retry_budget;
+    uint64_t backoff = poller_retry_backoff_min;
+
+    while (retry->len) {
+        nsleep(backoff);
+        if (backoff < poller_retry_backoff_max) backoff *= 2;
+
+        bool last = poller_self_now() >= deadline;
+
+        size_t len = 0;
+        for (size_t i = 0; i < retry->len; ++i) {
+            struct optics_lens *lens = retry->lenses[i];
+            if (poller_poll_read(ctx, lens, last) == optics_busy)
+                retry->lenses[len++] = lens;
+        }
+        retry->len = len;
+    }
+
+    free(retry->lenses);
+}
+
+static enum optics_ret poller_poll_lens(void *ctx_, struct optics_lens *lens)
+{
+    struct poller_poll_ctx *ctx = ctx_;
+    poller_self_visit(ctx->poller);
+
+    if (poller_poll_read(ctx, lens, !ctx->retry) == optics_busy)
+        poller_retry_push(ctx->retry, lens);
 
     return optics_ok;
 }
@@ -96,54 +798,114 @@ static enum optics_ret poller_poll_lens(void *ctx_, struct optics_lens *lens)
 // poll
 // -----------------------------------------------------------------------------
 
+// Polls that don't move the clock forward are considered to cover a second.
 static void poller_poll_optics(
-        struct optics_poller *poller,
-        optics_ts_t ts,
-        optics_ts_t last_poll,
-        optics_epoch_t epoch)
+        struct optics_poller *poller, struct poller_optics *instance, uint64_t ts)
 {
-    optics_ts_t elapsed = 0;
-    if (ts > last_poll) elapsed = ts - last_poll;
-    else if (ts == last_poll) elapsed = 1;
+    struct optics *optics = instance->optics;
+
+    uint64_t elapsed = 0;
+    if (ts > instance->last_poll) elapsed = ts - instance->last_poll;
+    else if (ts == instance->last_poll) elapsed = poller_nanos;
     else {
-            elapsed = 1;
+            elapsed = poller_nanos;
             optics_warn("clock out of sync for '%s': optics=%lu, poller=%lu",
-                    optics_get_prefix(poller->optics), last_poll, ts);
+                    optics_get_prefix(optics), instance->last_poll, ts);
     }
     assert(elapsed > 0);
 
+    pthread_mutex_t retry_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct poller_retry retry = { .lock = poller->pool ? &retry_lock : NULL };
+
+    pthread_mutex_t expire_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct poller_expire expire = { .lock = poller->pool ? &expire_lock : NULL };
+
     struct poller_poll_ctx ctx = {
         .poller = poller,
-        .ts = ts,
-        .elapsed = elapsed,
+        .instance = instance,
+        .ts = ts / poller_nanos,
+        .elapsed = poller_elapsed_secs(elapsed),
+        .ts_nanos = ts,
+        .elapsed_nanos = elapsed,
 
         .host = optics_poller_get_host(poller),
-        .prefix = optics_get_prefix(poller->optics),
+        .prefix = optics_get_prefix(optics),
 
-        .epoch = epoch,
+        .epoch = instance->epoch,
+        .keys_lock = poller->pool ? &poller->keys_lock : NULL,
+        .retry = &retry,
+        .expire = &expire,
     };
 
-    (void) optics_foreach_lens(poller->optics, &ctx, poller_poll_lens);
+    if (strcmp(instance->keys_prefix, ctx.prefix)) {
+        poller_keys_flush(instance);
+        strlcpy(instance->keys_prefix, ctx.prefix, sizeof(instance->keys_prefix));
+    }
+
+    if (poller->pool) poller_pool_run(poller->pool, &ctx);
+    else (void) optics_foreach_lens(optics, &ctx, poller_poll_lens);
+
+    poller_retry_run(&ctx, &retry);
+    pthread_mutex_destroy(&retry_lock);
+
+    poller_expire_run(poller, &expire);
+    pthread_mutex_destroy(&expire_lock);
+
+    poller_keys_sweep(poller, instance);
 }
 
 bool optics_poller_poll(struct optics_poller *poller)
 {
-    return optics_poller_poll_at(poller, clock_wall());
+    return optics_poller_poll_at_nanos(poller, clock_wall_nanos());
 }
 
 bool optics_poller_poll_at(struct optics_poller *poller, optics_ts_t ts)
 {
-    optics_ts_t last_poll = 0;
-    optics_epoch_t epoch = optics_epoch_inc_at(poller->optics, ts, &last_poll);
+    return optics_poller_poll_at_nanos(poller, ts * poller_nanos);
+}
+
+// Every attached instance shares the same epoch change, grace period and
+// backend cycle such that the cost of a poll doesn't scale with the number of
+// instances.
+bool optics_poller_poll_at_nanos(struct optics_poller *poller, uint64_t ts)
+{
+    uint64_t start = poller->self ? poller_self_now() : 0;
+
+    pthread_mutex_lock(&poller->instances_lock);
+
+    for (size_t i = 0; i < poller->instances_len; ++i) {
+        struct poller_optics *instance = poller->instances[i];
+        instance->epoch = optics_epoch_inc_at(instance->optics, ts, &instance->last_poll);
+    }
+
+    // give a chance for stragglers to finish. Quiescence tracking tells us
+    // exactly when they're done but it adds overhead on the record side so
+    // it's opt-in. Otherwise we just wait a bit and deal with stragglers if we
+    // run into them. A single wait covers every instance.
+    bool quiesced = true;
+    for (size_t i = 0; i < poller->instances_len; ++i) {
+        struct poller_optics *instance = poller->instances[i];
+        quiesced = optics_epoch_quiesce(instance->optics, instance->epoch) && quiesced;
+    }
+    if (!quiesced) nsleep(1 * 1000 * 1000);
+
+    uint64_t polled = poller->self ? poller_self_now() : 0;
+
+    poller->keys_stamp++;
+
+    poller_rollup_begin(poller, ts / poller_nanos);
+    poller_backend_record(poller, optics_poll_begin, NULL, poller_backends_all);
+    for (size_t i = 0; i < poller->instances_len; ++i)
+        poller_poll_optics(poller, poller->instances[i], ts);
+    poller_backend_record(poller, optics_poll_done, NULL, poller_backends_all);
+    poller_rollup_done(poller, ts / poller_nanos);
+
+    for (size_t i = 0; i < poller->instances_len; ++i)
+        optics_reclaim(poller->instances[i]->optics);
 
-    // give a chance for stragglers to finish. We'd need full EBR to do this
-    // properly but that would add overhead on the record side so we instead
-    // just wait a bit and deal with stragglers if we run into them.
-    nsleep(1 * 1000 * 1000);
+    pthread_mutex_unlock(&poller->instances_lock);
 
-    poller_backend_record(poller, optics_poll_begin, NULL);
-    poller_poll_optics(poller, ts, last_poll, epoch);
-    poller_backend_record(poller, optics_poll_done, NULL);
+    if (poller->self) poller_self_done(poller, start, polled, poller_self_now());
 
     return true;
 }
@@ -0,0 +1,258 @@
+/* poller_pool.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Pool of worker threads used to read the lenses in parallel. The lenses are
+   snapshotted into an array at the start of the poll and workers claim chunks
+   of it until none are left. Each worker buffers its polls in its own batch
+   which is handed to the backends while holding a lock such that backends
+   never observe concurrent calls. The thread calling the poll also acts as a
+   worker and only returns once all the workers are done which preserves the
+   begin/done semantics for the backends.
+*/
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    poller_pool_workers_max = 64,
+
+    // Number of lenses claimed by a worker at a time.
+    poller_pool_chunk_len = 256,
+};
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct poller_worker
+{
+    struct poller_pool *pool;
+    pthread_t handle;
+
+    struct poller_batch batch;
+};
+
+struct poller_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+
+    bool stop;
+    size_t generation;
+    size_t active;
+
+    // Synchronizes all calls to the backends during a poll.
+    pthread_mutex_t backends_lock;
+
+    const struct poller_poll_ctx *ctx;
+    struct optics_lens **lenses;
+    size_t lenses_len;
+    size_t lenses_cap;
+    atomic_size_t next;
+
+    struct poller_batch batch;
+
+    size_t workers_len;
+    struct poller_worker *workers[];
+};
+
+
+// -----------------------------------------------------------------------------
+// work
+// -----------------------------------------------------------------------------
+
+static void poller_pool_work(struct poller_pool *pool, struct poller_batch *batch)
+{
+    struct poller_poll_ctx ctx = *pool->ctx;
+    ctx.batch = batch;
+    ctx.backends_lock = &pool->backends_lock;
+
+    while (true) {
+        size_t start = atomic_fetch_add_explicit(
+                &pool->next, poller_pool_chunk_len, memory_order_relaxed);
+        if (start >= pool->lenses_len) break;
+
+        size_t end = start + poller_pool_chunk_len;
+        if (end > pool->lenses_len) end = pool->lenses_len;
+
+        for (size_t i = start; i < end; ++i)
+            (void) poller_poll_lens(&ctx, pool->lenses[i]);
+    }
+
+    poller_batch_flush(&ctx);
+}
+
+static void * poller_worker_fn(void *ctx)
+{
+    struct poller_worker *worker = ctx;
+    struct poller_pool *pool = worker->pool;
+
+    size_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (!pool->stop && pool->generation == generation)
+            pthread_cond_wait(&pool->start_cond, &pool->lock);
+        if (pool->stop) break;
+
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        poller_pool_work(pool, &worker->batch);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->active) pthread_cond_signal(&pool->done_cond);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// run
+// -----------------------------------------------------------------------------
+
+static enum optics_ret poller_pool_collect(void *ctx, struct optics_lens *lens)
+{
+    struct poller_pool *pool = ctx;
+
+    if (pool->lenses_len == pool->lenses_cap) {
+        pool->lenses_cap = pool->lenses_cap ? pool->lenses_cap * 2 : 1024;
+        pool->lenses = realloc(pool->lenses, pool->lenses_cap * sizeof(pool->lenses[0]));
+        optics_assert_alloc(pool->lenses);
+    }
+
+    pool->lenses[pool->lenses_len++] = lens;
+    return optics_ok;
+}
+
+// Lenses closed during the poll are only freed after the next epoch increment
+// which happens in the next poll so the snapshot stays valid until we're done.
+static void poller_pool_run(struct poller_pool *pool, struct poller_poll_ctx *ctx)
+{
+    pool->lenses_len = 0;
+    (void) optics_foreach_lens(ctx->instance->optics, pool, poller_pool_collect);
+
+    pool->ctx = ctx;
+    atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        pool->active = pool->workers_len;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start_cond);
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    poller_pool_work(pool, &pool->batch);
+
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        while (pool->active) pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pool->ctx = NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// alloc/free
+// -----------------------------------------------------------------------------
+
+static void poller_pool_free(struct poller_pool *pool)
+{
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        pool->stop = true;
+        pthread_cond_broadcast(&pool->start_cond);
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for (size_t i = 0; i < pool->workers_len; ++i) {
+        int err = pthread_join(pool->workers[i]->handle, NULL);
+        if (err) optics_fail_ierrno(err, "unable to join poller worker '%zu'", i);
+        free(pool->workers[i]);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_mutex_destroy(&pool->backends_lock);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->lenses);
+    free(pool);
+}
+
+static struct poller_pool *poller_pool_alloc(size_t workers)
+{
+    struct poller_pool *pool =
+        calloc(1, sizeof(*pool) + workers * sizeof(pool->workers[0]));
+    optics_assert_alloc(pool);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->backends_lock, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < workers; ++i) {
+        struct poller_worker *worker = calloc(1, sizeof(*worker));
+        optics_assert_alloc(worker);
+        worker->pool = pool;
+
+        int err = pthread_create(&worker->handle, NULL, poller_worker_fn, worker);
+        if (err) {
+            optics_fail_ierrno(err, "unable to create poller worker '%zu'", i);
+            free(worker);
+            goto fail_thread;
+        }
+
+        pool->workers[pool->workers_len++] = worker;
+    }
+
+    return pool;
+
+  fail_thread:
+    poller_pool_free(pool);
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// workers
+// -----------------------------------------------------------------------------
+
+bool optics_poller_set_workers(struct optics_poller *poller, size_t workers)
+{
+    if (workers > poller_pool_workers_max) {
+        optics_fail("poller workers '%zu' greater than max '%d'",
+                workers, poller_pool_workers_max);
+        return false;
+    }
+
+    struct poller_pool *pool = NULL;
+    if (workers && !(pool = poller_pool_alloc(workers))) return false;
+
+    if (poller->pool) poller_pool_free(poller->pool);
+    poller->pool = pool;
+
+    return true;
+}
+
+size_t optics_poller_get_workers(struct optics_poller *poller)
+{
+    return poller->pool ? poller->pool->workers_len : 0;
+}
@@ -0,0 +1,450 @@
+/* poller_rollup.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Rollups fold the polls handed to a backend into windows aligned on multiples
+   of a period and only hand the merged values to the backend once the window
+   closes. This lets a backend report at a coarser resolution than the poll
+   interval while the lenses are still only read once per poll. Each lens keeps
+   an entry which deep copies its poll through the async slots and is reused
+   from one window to the next. Entries of lenses that weren't polled during a
+   window are dropped when it's flushed.
+*/
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct poller_rollup_entry
+{
+    size_t stamp;
+    char id[optics_name_max_len * 2];
+    struct poller_async_slot slot;
+};
+
+struct poller_rollup
+{
+    optics_ts_t period;
+
+    // Window of the last poll and whether it was polled since the last flush.
+    optics_ts_t window;
+    bool polled;
+
+    // Incremented on every flush to detect the entries untouched since.
+    size_t stamp;
+
+    // Maps the prefix and key of a lens to its index in entries.
+    struct htable index;
+
+    size_t len;
+    size_t cap;
+    struct poller_rollup_entry **entries;
+};
+
+
+// -----------------------------------------------------------------------------
+// merge
+// -----------------------------------------------------------------------------
+
+static void poller_rollup_counts(size_t *counts, const size_t *other, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) counts[i] += other[i];
+}
+
+static bool poller_rollup_histo(struct optics_histo *histo, const struct optics_histo *other)
+{
+    if (histo->buckets_len != other->buckets_len) return false;
+
+    size_t edges = histo->buckets_len * sizeof(histo->buckets[0]);
+    if (memcmp(histo->buckets, other->buckets, edges)) return false;
+
+    // buckets_len edges delimit buckets_len - 1 buckets.
+    histo->below += other->below;
+    histo->above += other->above;
+    poller_rollup_counts(histo->counts, other->counts, histo->buckets_len - 1);
+    return true;
+}
+
+static bool poller_rollup_hdr(
+        struct poller_async_slot *slot, struct optics_hdr *hdr, const struct optics_hdr *other)
+{
+    if (hdr->buckets_len != other->buckets_len) return false;
+    if (hdr->base != other->base || hdr->shift != other->shift) return false;
+    if (hdr->lowest != other->lowest || hdr->highest != other->highest) return false;
+
+    poller_rollup_counts(slot->counts, other->counts, hdr->buckets_len);
+    hdr->count += other->count;
+    optics_hdr_summarize(hdr);
+    return true;
+}
+
+static bool poller_rollup_histo2d(
+        struct poller_async_slot *slot,
+        struct optics_histo2d *histo, const struct optics_histo2d *other)
+{
+    if (histo->rows_len != other->rows_len) return false;
+    if (histo->cols_len != other->cols_len) return false;
+
+    size_t rows = histo->rows_len * sizeof(histo->rows[0]);
+    if (memcmp(histo->rows, other->rows, rows)) return false;
+
+    size_t cols = histo->cols_len * sizeof(histo->cols[0]);
+    if (memcmp(histo->cols, other->cols, cols)) return false;
+
+    size_t len = (histo->rows_len - 1) * (histo->cols_len - 1);
+    poller_rollup_counts(slot->counts, other->counts, len);
+    histo->count += other->count;
+    histo->outside += other->outside;
+    return true;
+}
+
+static bool poller_rollup_sketch(
+        struct poller_async_slot *slot,
+        struct optics_sketch *sketch, const struct optics_sketch *other)
+{
+    if (sketch->buckets_len != other->buckets_len) return false;
+    if (sketch->offset != other->offset || sketch->gamma != other->gamma) return false;
+
+    poller_rollup_counts(slot->counts, other->counts, sketch->buckets_len);
+    sketch->zero += other->zero;
+    sketch->count += other->count;
+    optics_sketch_summarize(sketch);
+    return true;
+}
+
+static bool poller_rollup_hll(
+        struct poller_async_slot *slot, struct optics_hll *hll, const struct optics_hll *other)
+{
+    if (hll->precision != other->precision) return false;
+
+    for (size_t i = 0; i < hll->registers_len; ++i) {
+        if (slot->registers[i] < other->registers[i])
+            slot->registers[i] = other->registers[i];
+    }
+
+    hll->estimate = optics_hll_estimate(slot->registers, hll->registers_len);
+    return true;
+}
+
+static int poller_rollup_topk_cmp(const void *lhs, const void *rhs)
+{
+    const struct optics_topk_entry *a = lhs, *b = rhs;
+    if (a->count == b->count) return 0;
+    return a->count > b->count ? -1 : 1;
+}
+
+// Keys are only ever tracked by a single shard of the lens so the entries of
+// two polls can be merged by key. The merged entries are truncated to the
+// largest of the two lengths which is at most the k of the lens.
+static void poller_rollup_topk(
+        struct poller_async_slot *slot, struct optics_topk *topk, const struct optics_topk *other)
+{
+    size_t len = topk->len;
+    size_t cap = len + other->len;
+    size_t max = len > other->len ? len : other->len;
+
+    if (slot->entries_cap < cap) {
+        slot->entries = realloc(slot->entries, cap * sizeof(*slot->entries));
+        optics_assert_alloc(slot->entries);
+        slot->entries_cap = cap;
+    }
+
+    for (size_t i = 0; i < other->len; ++i) {
+        const struct optics_topk_entry *entry = &other->entries[i];
+
+        size_t j = 0;
+        while (j < len && strcmp(slot->entries[j].key, entry->key)) j++;
+
+        if (j < len) {
+            slot->entries[j].count += entry->count;
+            slot->entries[j].error += entry->error;
+        }
+        else slot->entries[len++] = *entry;
+    }
+
+    qsort(slot->entries, len, sizeof(*slot->entries), poller_rollup_topk_cmp);
+
+    topk->count += other->count;
+    topk->len = len > max ? max : len;
+    topk->entries = slot->entries;
+}
+
+static void poller_rollup_pick(double *dst, double *src, size_t *len, struct rng *rng)
+{
+    size_t i = rng_gen_range(rng, 0, *len);
+    *dst = src[i];
+    src[i] = src[--(*len)];
+}
+
+// Each merged sample is picked from one of the two reservoirs with a
+// probability proportional to the number of values it saw such that the merged
+// reservoir approximates a reservoir that saw every value. Reservoirs that
+// aren't full hold every value they saw and are simply concatenated as long as
+// the other isn't full either.
+static void poller_rollup_dist(
+        struct poller_async_slot *slot, struct optics_dist *dist, const struct optics_dist *other)
+{
+    size_t a_len = dist->samples_len, b_len = other->samples_len;
+
+    size_t len = a_len + b_len;
+    if (a_len < dist->n || b_len < other->n) len = a_len > b_len ? a_len : b_len;
+    if (len > optics_dist_samples_max) len = optics_dist_samples_max;
+
+    double a[a_len + 1], b[b_len + 1];
+    memcpy(a, dist->samples, a_len * sizeof(a[0]));
+    memcpy(b, other->samples, b_len * sizeof(b[0]));
+
+    if (slot->samples_cap < len) {
+        slot->samples = realloc(slot->samples, len * sizeof(*slot->samples));
+        optics_assert_alloc(slot->samples);
+        slot->samples_cap = len;
+    }
+
+    struct rng *rng = rng_global();
+    double prob = (double) dist->n / (dist->n + other->n);
+
+    for (size_t i = 0; i < len; ++i) {
+        bool from_a = b_len ? a_len && rng_gen_prob(rng, prob) : true;
+        if (from_a) poller_rollup_pick(&slot->samples[i], a, &a_len, rng);
+        else poller_rollup_pick(&slot->samples[i], b, &b_len, rng);
+    }
+
+    dist->n += other->n;
+    if (dist->max < other->max) dist->max = other->max;
+    optics_dist_summarize(dist, slot->samples, len);
+}
+
+// Returns false if the values can't be merged in which case the entry is
+// replaced by the poll.
+static bool poller_rollup_merge(struct poller_async_slot *slot, const struct optics_poll *poll)
+{
+    union optics_poll_value *value = &slot->poll.value;
+    const union optics_poll_value *other = &poll->value;
+
+    if (slot->poll.type != poll->type) return false;
+
+    switch (poll->type) {
+    case optics_counter:
+        value->counter += other->counter;
+        slot->poll.total = poll->total;
+        break;
+    case optics_gauge: value->gauge = other->gauge; break;
+
+    // The watermarks of the rollup interval are the extremes of its polls.
+    case optics_updown:
+        value->updown.value = other->updown.value;
+        if (other->updown.min < value->updown.min) value->updown.min = other->updown.min;
+        if (other->updown.max > value->updown.max) value->updown.max = other->updown.max;
+        break;
+
+    case optics_quantile: {
+        size_t count = value->quantile.count;
+        value->quantile = other->quantile;
+        value->quantile.count += count;
+        break;
+    }
+
+    case optics_quantiles: {
+        size_t count = value->quantiles.count;
+        value->quantiles = other->quantiles;
+        value->quantiles.count += count;
+        break;
+    }
+
+    case optics_meter: {
+        int64_t count = value->meter.count;
+        value->meter = other->meter;
+        value->meter.count += count;
+        break;
+    }
+
+    case optics_histo:
+        if (!poller_rollup_histo(&value->histo, &other->histo)) return false;
+        break;
+
+    case optics_hdr:
+        if (!poller_rollup_hdr(slot, &value->hdr, &other->hdr)) return false;
+        break;
+
+    case optics_histo2d:
+        if (!poller_rollup_histo2d(slot, &value->histo2d, &other->histo2d)) return false;
+        break;
+
+    case optics_sketch:
+        if (!poller_rollup_sketch(slot, &value->sketch, &other->sketch)) return false;
+        break;
+
+    case optics_hll:
+        if (!poller_rollup_hll(slot, &value->hll, &other->hll)) return false;
+        break;
+
+    case optics_topk: poller_rollup_topk(slot, &value->topk, &other->topk); break;
+
+    case optics_dist:
+        if (other->dist.n) poller_rollup_dist(slot, &value->dist, &other->dist);
+        break;
+
+    case optics_family:
+    default:
+        optics_fail("unknown lens type '%d'", poll->type);
+        return false;
+    }
+
+    slot->poll.ts = poll->ts;
+    slot->poll.ts_nanos = poll->ts_nanos;
+    slot->poll.elapsed += poll->elapsed;
+    slot->poll.elapsed_secs += poll->elapsed_secs;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// entries
+// -----------------------------------------------------------------------------
+
+static struct poller_rollup_entry *poller_rollup_entry(
+        struct poller_rollup *rollup, const struct optics_poll *poll)
+{
+    char id[optics_name_max_len * 2];
+    (void) snprintf(id, sizeof(id), "%s\t%s", poll->prefix, poll->key);
+
+    struct htable_ret ret = htable_get(&rollup->index, id);
+    if (ret.ok) return rollup->entries[ret.value];
+
+    if (rollup->len == rollup->cap) {
+        rollup->cap = rollup->cap ? rollup->cap * 2 : 8;
+        rollup->entries = realloc(rollup->entries, rollup->cap * sizeof(*rollup->entries));
+        optics_assert_alloc(rollup->entries);
+    }
+
+    struct poller_rollup_entry *entry = calloc(1, sizeof(*entry));
+    optics_assert_alloc(entry);
+
+    // The stamp of a new entry is never current so the poll is copied in.
+    entry->stamp = rollup->stamp - 1;
+    strlcpy(entry->id, id, sizeof(entry->id));
+
+    ret = htable_put(&rollup->index, entry->id, rollup->len);
+    optics_assert(ret.ok, "duplicate rollup entry '%s'", entry->id);
+
+    rollup->entries[rollup->len++] = entry;
+    return entry;
+}
+
+static void poller_rollup_entry_free(struct poller_rollup_entry *entry)
+{
+    struct poller_async_slot *slot = &entry->slot;
+    free(slot->counts);
+    free(slot->samples);
+    free(slot->entries);
+    free(slot->registers);
+    free(entry);
+}
+
+// Swaps the last entry in place of the removed one.
+static void poller_rollup_remove(struct poller_rollup *rollup, size_t index)
+{
+    struct poller_rollup_entry *entry = rollup->entries[index];
+    (void) htable_del(&rollup->index, entry->id);
+
+    struct poller_rollup_entry *last = rollup->entries[--rollup->len];
+    if (last != entry) {
+        rollup->entries[index] = last;
+        (void) htable_xchg(&rollup->index, last->id, index);
+    }
+
+    poller_rollup_entry_free(entry);
+}
+
+
+// -----------------------------------------------------------------------------
+// interface
+// -----------------------------------------------------------------------------
+
+static struct poller_rollup *poller_rollup_alloc(optics_ts_t period)
+{
+    struct poller_rollup *rollup = calloc(1, sizeof(*rollup));
+    optics_assert_alloc(rollup);
+
+    rollup->period = period;
+    return rollup;
+}
+
+static void poller_rollup_free(struct poller_rollup *rollup)
+{
+    if (!rollup) return;
+
+    for (size_t i = 0; i < rollup->len; ++i)
+        poller_rollup_entry_free(rollup->entries[i]);
+    free(rollup->entries);
+
+    htable_reset(&rollup->index);
+    free(rollup);
+}
+
+static void poller_rollup_fold(struct poller_rollup *rollup, const struct optics_poll *poll)
+{
+    struct poller_rollup_entry *entry = poller_rollup_entry(rollup, poll);
+    struct poller_async_slot *slot = &entry->slot;
+
+    if (entry->stamp != rollup->stamp || !poller_rollup_merge(slot, poll)) {
+        poller_async_copy(slot, optics_poll_metric, poll);
+        entry->stamp = rollup->stamp;
+    }
+}
+
+// The merged polls are reported to the backend as a regular poll cycle.
+static void poller_rollup_flush(struct optics_poller *poller, size_t index)
+{
+    struct backend *backend = &poller->backends[index];
+    struct poller_rollup *rollup = backend->rollup;
+    if (!rollup->polled) return;
+
+    struct optics_record record;
+
+    poller_backend_emit(poller, index, optics_poll_begin, NULL, NULL);
+
+    for (size_t i = 0; i < rollup->len;) {
+        struct poller_rollup_entry *entry = rollup->entries[i];
+        if (entry->stamp != rollup->stamp) {
+            poller_rollup_remove(rollup, i);
+            continue;
+        }
+
+        const struct optics_poll *poll = &entry->slot.poll;
+        if (backend->record) poller_record_encode(&record, poll);
+        poller_backend_emit(poller, index, optics_poll_metric, poll, &record);
+        i++;
+    }
+
+    poller_backend_emit(poller, index, optics_poll_done, NULL, NULL);
+
+    rollup->stamp++;
+    rollup->polled = false;
+}
+
+// A window covers the polls in ((n - 1) * period, n * period] and is flushed
+// by the last poll of the window or by the first poll of the next window if the
+// last poll was skipped.
+static void poller_rollup_begin(struct optics_poller *poller, optics_ts_t ts)
+{
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        struct poller_rollup *rollup = poller->backends[i].rollup;
+        if (!rollup) continue;
+
+        optics_ts_t window = (ts + rollup->period - 1) / rollup->period;
+        if (window != rollup->window) poller_rollup_flush(poller, i);
+
+        rollup->window = window;
+        rollup->polled = true;
+    }
+}
+
+static void poller_rollup_done(struct optics_poller *poller, optics_ts_t ts)
+{
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        struct poller_rollup *rollup = poller->backends[i].rollup;
+        if (rollup && !(ts % rollup->period)) poller_rollup_flush(poller, i);
+    }
+}
@@ -0,0 +1,248 @@
+/* poller_self.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+// The poller's own metrics are recorded into lenses of the polled optics which
+// are then reported through the regular pipeline on the next poll. Backends
+// report their own metrics the same way through optics_poller_self_inc and
+// optics_poller_self_record which open their lenses on first use.
+
+struct poller_self
+{
+    char prefix[optics_name_max_len];
+
+    // Only touched by the poll thread.
+    struct optics_lens *duration;
+    struct optics_lens *grace;
+    struct optics_lens *visited;
+    struct optics_lens *live;
+    struct optics_lens *defers;
+    struct optics_lens *backends[poller_max_backends];
+
+    // Updated by the workers of parallel polls.
+    struct optics_lens *busy;
+    atomic_size_t visited_count;
+    atomic_uint_fast64_t backends_nanos[poller_max_backends];
+
+    // Lenses opened by the backends which can be called from any thread.
+    pthread_mutex_t lock;
+    struct htable lenses;
+};
+
+static uint64_t poller_self_now()
+{
+    struct timespec ts;
+    clock_monotonic(&ts);
+    return ts.tv_sec * 1000UL * 1000 * 1000 + ts.tv_nsec;
+}
+
+static struct optics_lens *poller_self_open(
+        struct optics_poller *poller, const char *name, enum optics_lens_type type)
+{
+    struct optics_key key = {0};
+    optics_key_push(&key, poller->self->prefix);
+    optics_key_push(&key, name);
+
+    struct optics_lens *lens = NULL;
+    switch (type) {
+    case optics_counter: lens = optics_counter_open(poller->optics, key.data); break;
+    case optics_gauge: lens = optics_gauge_open(poller->optics, key.data); break;
+    case optics_dist: lens = optics_dist_open(poller->optics, key.data); break;
+
+    case optics_histo:
+    case optics_quantile:
+    case optics_quantiles:
+    case optics_hdr:
+    case optics_sketch:
+    case optics_meter:
+    case optics_topk:
+    case optics_hll:
+    case optics_updown:
+    case optics_histo2d:
+    case optics_family:
+    default:
+        optics_fail("unsupported self lens type '%d'", type);
+        return NULL;
+    }
+
+    if (!lens) optics_warn("unable to open self lens '%s'", key.data);
+    return lens;
+}
+
+static void poller_self_close(struct optics_lens *lens)
+{
+    if (lens) optics_lens_close(lens);
+}
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+bool optics_poller_self(struct optics_poller *poller, const char *prefix)
+{
+    if (poller->self) {
+        optics_fail("self instrumentation is already enabled");
+        return false;
+    }
+
+    if (strnlen(prefix, optics_name_max_len) == optics_name_max_len) {
+        optics_fail("self prefix '%s' length is greater than max length '%d'",
+                prefix, optics_name_max_len);
+        return false;
+    }
+
+    struct poller_self *self = calloc(1, sizeof(*self));
+    optics_assert_alloc(self);
+    strlcpy(self->prefix, prefix, sizeof(self->prefix));
+    pthread_mutex_init(&self->lock, NULL);
+    poller->self = self;
+
+    self->duration = poller_self_open(poller, "poller.duration_ns", optics_gauge);
+    self->grace = poller_self_open(poller, "poller.grace_ns", optics_gauge);
+    self->visited = poller_self_open(poller, "poller.lenses", optics_gauge);
+    self->busy = poller_self_open(poller, "poller.busy", optics_counter);
+    self->live = poller_self_open(poller, "poller.live_lenses", optics_gauge);
+    self->defers = poller_self_open(poller, "poller.defers", optics_gauge);
+
+    return true;
+}
+
+static void poller_self_free(struct poller_self *self)
+{
+    if (!self) return;
+
+    poller_self_close(self->duration);
+    poller_self_close(self->grace);
+    poller_self_close(self->visited);
+    poller_self_close(self->busy);
+    poller_self_close(self->live);
+    poller_self_close(self->defers);
+    for (size_t i = 0; i < poller_max_backends; ++i)
+        poller_self_close(self->backends[i]);
+
+    struct htable_bucket *it = htable_next(&self->lenses, NULL);
+    for (; it; it = htable_next(&self->lenses, it))
+        optics_lens_close(pun_itop(it->value));
+    htable_reset(&self->lenses);
+
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+
+// -----------------------------------------------------------------------------
+// backends
+// -----------------------------------------------------------------------------
+
+// Lenses are keyed by their full name which lives as long as the lens is open.
+static struct optics_lens *poller_self_lens(
+        struct optics_poller *poller, const char *name, enum optics_lens_type type)
+{
+    struct poller_self *self = poller->self;
+
+    struct optics_key key = {0};
+    optics_key_push(&key, self->prefix);
+    optics_key_push(&key, name);
+
+    struct optics_lens *lens = NULL;
+    pthread_mutex_lock(&self->lock);
+
+    struct htable_ret ret = htable_get(&self->lenses, key.data);
+    if (ret.ok) lens = pun_itop(ret.value);
+    else if ((lens = poller_self_open(poller, name, type)))
+        htable_put(&self->lenses, optics_lens_name(lens), pun_ptoi(lens));
+
+    pthread_mutex_unlock(&self->lock);
+
+    if (lens && optics_lens_type(lens) != type) {
+        optics_warn("self lens '%s' has the wrong type", key.data);
+        return NULL;
+    }
+    return lens;
+}
+
+void optics_poller_self_inc(struct optics_poller *poller, const char *name, int64_t value)
+{
+    if (!poller->self) return;
+
+    struct optics_lens *lens = poller_self_lens(poller, name, optics_counter);
+    if (lens) optics_counter_inc(lens, value);
+}
+
+void optics_poller_self_record(struct optics_poller *poller, const char *name, double value)
+{
+    if (!poller->self) return;
+
+    struct optics_lens *lens = poller_self_lens(poller, name, optics_dist);
+    if (lens) optics_dist_record(lens, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// poll
+// -----------------------------------------------------------------------------
+
+static void poller_self_visit(struct optics_poller *poller)
+{
+    if (!poller->self) return;
+    atomic_fetch_add_explicit(&poller->self->visited_count, 1, memory_order_relaxed);
+}
+
+static void poller_self_busy(struct optics_poller *poller)
+{
+    if (!poller->self || !poller->self->busy) return;
+    optics_counter_inc(poller->self->busy, 1);
+}
+
+static void poller_self_backend(struct optics_poller *poller, size_t index, uint64_t start)
+{
+    uint64_t elapsed = poller_self_now() - start;
+    atomic_fetch_add_explicit(&poller->self->backends_nanos[index], elapsed, memory_order_relaxed);
+}
+
+// Backends registered after the instrumentation was enabled get their lens on
+// their first poll.
+static void poller_self_done(
+        struct optics_poller *poller, uint64_t start, uint64_t polled, uint64_t done)
+{
+    struct poller_self *self = poller->self;
+
+    if (self->grace) optics_gauge_set(self->grace, polled - start);
+    if (self->duration) optics_gauge_set(self->duration, done - polled);
+
+    size_t visited = atomic_exchange_explicit(&self->visited_count, 0, memory_order_relaxed);
+    if (self->visited) optics_gauge_set(self->visited, visited);
+
+    size_t live = 0, defers = 0;
+    {
+        pthread_mutex_lock(&poller->instances_lock);
+
+        for (size_t i = 0; i < poller->instances_len; ++i) {
+            live += optics_lens_count(poller->instances[i]->optics);
+            defers += optics_defer_count(poller->instances[i]->optics);
+        }
+
+        pthread_mutex_unlock(&poller->instances_lock);
+    }
+
+    if (self->live) optics_gauge_set(self->live, live);
+    if (self->defers) optics_gauge_set(self->defers, defers);
+
+    for (size_t i = 0; i < poller->backends_len; ++i) {
+        if (!self->backends[i]) {
+            char name[optics_name_max_len];
+            snprintf(name, sizeof(name), "poller.backend_%zu_ns", i);
+            self->backends[i] = poller_self_open(poller, name, optics_gauge);
+            if (!self->backends[i]) continue;
+        }
+
+        uint64_t nanos = atomic_exchange_explicit(
+                &self->backends_nanos[i], 0, memory_order_relaxed);
+        optics_gauge_set(self->backends[i], nanos);
+    }
+}
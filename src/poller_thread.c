@@ -6,6 +6,14 @@
 #include "pthread.h"
 
 
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+// Polling can't be faster then the grace period of the epoch.
+enum { thread_period_min = 1 * 1000 * 1000 };
+
+
 // -----------------------------------------------------------------------------
 // thread
 // -----------------------------------------------------------------------------
@@ -13,7 +21,9 @@
 struct optics_thread
 {
     struct optics_poller *poller;
-    optics_ts_t freq;
+    uint64_t period;
+
+    atomic_size_t missed;
 
     pthread_t handle;
 };
@@ -23,15 +33,45 @@ struct optics_thread
 // poller
 // -----------------------------------------------------------------------------
 
+static uint64_t thread_next_slot(uint64_t now, uint64_t period)
+{
+    return (now / period + 1) * period;
+}
+
+// Polls are scheduled on absolute wall-clock deadlines aligned on multiples of
+// the period which avoids any drift due to the poll duration and lines up the
+// polls of multiple processes. Deadlines that are missed are skipped rather
+// than polled back to back.
 static void * thread_fn(void *ctx)
 {
     struct optics_thread *thread = ctx;
+    uint64_t period = thread->period;
+
+    uint64_t next = thread_next_slot(clock_wall_nanos(), period);
 
     while (true) {
+        // pthread cancellation point.
+        if (!nsleep_until(next)) optics_abort();
+
+        // The poll holds locks across its grace period which must not be left
+        // behind by a cancellation so it's only allowed while sleeping.
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
         optics_poller_poll(thread->poller);
+        pthread_setcancelstate(state, NULL);
 
-        // pthread cancellation point.
-        nsleep(thread->freq * 1000 * 1000 * 1000);
+        uint64_t now = clock_wall_nanos();
+        next += period;
+
+        if (now >= next) {
+            size_t missed = (now - next) / period + 1;
+            atomic_fetch_add_explicit(&thread->missed, missed, memory_order_relaxed);
+            optics_warn("optics thread missed '%zu' poll deadlines", missed);
+            next += missed * period;
+        }
+
+        // The wall-clock moved backward so we need to realign.
+        else if (next - now > 2 * period) next = thread_next_slot(now, period);
     }
 
     return NULL;
@@ -50,10 +90,21 @@ struct optics_thread * optics_thread_start(struct optics_poller *poller, optics_
         return NULL;
     }
 
+    return optics_thread_start_nanos(poller, freq * 1000 * 1000 * 1000);
+}
+
+struct optics_thread * optics_thread_start_nanos(
+        struct optics_poller *poller, uint64_t period)
+{
+    if (period < thread_period_min) {
+        optics_fail("invalid thread period '%lu' < '%d'", period, thread_period_min);
+        return NULL;
+    }
+
     struct optics_thread *thread = calloc(1, sizeof(*thread));
     optics_assert_alloc(thread);
     thread->poller = poller;
-    thread->freq = freq;
+    thread->period = period;
 
     int err = pthread_create(&thread->handle, NULL, thread_fn, thread);
     if (err) {
@@ -86,3 +137,8 @@ bool optics_thread_stop(struct optics_thread *thread)
     free(thread);
     return true;
 }
+
+size_t optics_thread_missed(struct optics_thread *thread)
+{
+    return atomic_load_explicit(&thread->missed, memory_order_relaxed);
+}
@@ -0,0 +1,102 @@
+/* arena.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "arena.h"
+#include "bits.h"
+#include "compiler.h"
+
+
+// -----------------------------------------------------------------------------
+// page
+// -----------------------------------------------------------------------------
+
+struct arena_page
+{
+    struct arena_page *next;
+    size_t len;
+    size_t used;
+    char data[] optics_align(arena_align);
+};
+
+static struct arena_page *arena_page_alloc(size_t len)
+{
+    if (len < arena_page_len) len = arena_page_len;
+
+    struct arena_page *page = aligned_alloc(arena_align, sizeof(*page) + len);
+    optics_assert_alloc(page);
+
+    page->next = NULL;
+    page->len = len;
+    page->used = 0;
+    return page;
+}
+
+
+// -----------------------------------------------------------------------------
+// arena
+// -----------------------------------------------------------------------------
+
+void arena_reset(struct arena *arena)
+{
+    struct arena_page *page = arena->head;
+    while (page) {
+        struct arena_page *next = page->next;
+        free(page);
+        page = next;
+    }
+
+    *arena = (struct arena) {0};
+}
+
+void arena_clear(struct arena *arena)
+{
+    for (struct arena_page *page = arena->head; page; page = page->next)
+        page->used = 0;
+    arena->current = arena->head;
+}
+
+// Pages are walked in order such that, once the arena has grown to its steady
+// state size, clearing and refilling it never allocates.
+void *arena_alloc(struct arena *arena, size_t len)
+{
+    len = align(len ? len : 1, arena_align);
+
+    struct arena_page *page = arena->current;
+    while (page && page->used + len > page->len) page = page->next;
+
+    if (!page) {
+        page = arena_page_alloc(len);
+
+        if (!arena->head) arena->head = page;
+        else {
+            struct arena_page *tail = arena->current ? arena->current : arena->head;
+            while (tail->next) tail = tail->next;
+            tail->next = page;
+        }
+    }
+
+    arena->current = page;
+
+    void *ptr = page->data + page->used;
+    page->used += len;
+    return ptr;
+}
+
+void *arena_dup(struct arena *arena, const void *data, size_t len)
+{
+    void *ptr = arena_alloc(arena, len);
+    memcpy(ptr, data, len);
+    return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t max)
+{
+    size_t len = strnlen(str, max);
+
+    char *ptr = arena_alloc(arena, len + 1);
+    memcpy(ptr, str, len);
+    ptr[len] = '\0';
+    return ptr;
+}
@@ -0,0 +1,44 @@
+/* arena.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Bump allocator for data that shares a lifetime. Allocations can't be freed
+   individually and are instead all released at once when the arena is cleared
+   which keeps the pages around for the next round of allocations. Pages are
+   only returned to the system when the arena is reset.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    arena_align = 16,
+    arena_page_len = 64 * 1024,
+};
+
+
+// -----------------------------------------------------------------------------
+// arena
+// -----------------------------------------------------------------------------
+
+struct arena_page;
+
+struct arena
+{
+    struct arena_page *head;
+    struct arena_page *current;
+};
+
+void arena_reset(struct arena *);
+void arena_clear(struct arena *);
+
+void *arena_alloc(struct arena *, size_t len);
+void *arena_dup(struct arena *, const void *data, size_t len);
+char *arena_strndup(struct arena *, const char *str, size_t max);
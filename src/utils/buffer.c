@@ -4,6 +4,7 @@
 */
 
 #include "buffer.h"
+#include "fmt.h"
 
 
 // -----------------------------------------------------------------------------
@@ -52,6 +53,29 @@ void buffer_write(struct buffer *buffer, const void *data, size_t len)
     buffer->len += len;
 }
 
+void buffer_puts(struct buffer *buffer, const char *str)
+{
+    buffer_write(buffer, str, strlen(str));
+}
+
+void buffer_put_u64(struct buffer *buffer, uint64_t value)
+{
+    buffer_reserve(buffer, buffer->len + fmt_u64_len);
+    buffer->len += fmt_u64(buffer->data + buffer->len, value);
+}
+
+void buffer_put_i64(struct buffer *buffer, int64_t value)
+{
+    buffer_reserve(buffer, buffer->len + fmt_i64_len);
+    buffer->len += fmt_i64(buffer->data + buffer->len, value);
+}
+
+void buffer_put_double(struct buffer *buffer, double value)
+{
+    buffer_reserve(buffer, buffer->len + fmt_double_len);
+    buffer->len += fmt_double(buffer->data + buffer->len, value);
+}
+
 void buffer_printf(struct buffer *buffer, const char *fmt, ...)
 {
     int ret;
@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // -----------------------------------------------------------------------------
 // buffer
 // -----------------------------------------------------------------------------
@@ -21,6 +24,13 @@ void buffer_reserve(struct buffer *, size_t len);
 
 void buffer_put(struct buffer *, char c);
 void buffer_write(struct buffer *, const void *data, size_t len);
+void buffer_puts(struct buffer *, const char *str);
+
+// Formats the numbers in place through fmt.h which is considerably cheaper
+// than buffer_printf. Doubles use their shortest round-trip representation.
+void buffer_put_u64(struct buffer *, uint64_t value);
+void buffer_put_i64(struct buffer *, int64_t value);
+void buffer_put_double(struct buffer *, double value);
 
 // Does not write out null char at the end of the formatted string
 void buffer_printf(struct buffer *, const char *fmt, ...) optics_printf(2, 3);
@@ -12,6 +12,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 #if MHD_VERSION < 0x00095009
 #define MHD_USE_EPOLL MHD_USE_EPOLL_LINUX_ONLY
@@ -42,6 +45,10 @@ static void microhttpd_logger_cb(void *ctx, const char *fmt, va_list args);
 static void microhttpd_panic_cb(
         void *ctx, const char *file, unsigned int line, const char *reason);
 
+static void microhttpd_notify_cb(
+        void *ctx, struct MHD_Connection *conn, void **socket_ctx,
+        enum MHD_ConnectionNotificationCode code);
+
 
 
 // -----------------------------------------------------------------------------
@@ -52,6 +59,7 @@ struct crest
 {
     struct router router;
     struct MHD_Daemon *mhd_daemon;
+    struct crest_config config;
 
     bool started;
 };
@@ -72,13 +80,53 @@ void crest_free(struct crest *crest)
 
 bool crest_bind(struct crest *crest, int port)
 {
+    return crest_bind_config(crest, port, &(struct crest_config) {0});
+}
+
+bool crest_bind_config(struct crest *crest, int port, const struct crest_config *config)
+{
+    crest->config = *config;
+
     int flags = 0;
     flags |= MHD_USE_SELECT_INTERNALLY;
     flags |= MHD_USE_EPOLL;
 
+    struct MHD_OptionItem options[8];
+    size_t len = 0;
+
+    if (config->threads > 1) {
+        options[len++] = (struct MHD_OptionItem) {
+            .option = MHD_OPTION_THREAD_POOL_SIZE, .value = config->threads };
+    }
+
+    if (config->connections_max) {
+        options[len++] = (struct MHD_OptionItem) {
+            .option = MHD_OPTION_CONNECTION_LIMIT, .value = config->connections_max };
+    }
+
+    if (config->connections_per_ip) {
+        options[len++] = (struct MHD_OptionItem) {
+            .option = MHD_OPTION_PER_IP_CONNECTION_LIMIT, .value = config->connections_per_ip };
+    }
+
+    if (config->timeout) {
+        options[len++] = (struct MHD_OptionItem) {
+            .option = MHD_OPTION_CONNECTION_TIMEOUT, .value = config->timeout };
+    }
+
+    if (config->nodelay || config->keepalive) {
+        options[len++] = (struct MHD_OptionItem) {
+            .option = MHD_OPTION_NOTIFY_CONNECTION,
+            .value = (intptr_t) microhttpd_notify_cb,
+            .ptr_value = crest };
+    }
+
+    options[len++] = (struct MHD_OptionItem) { .option = MHD_OPTION_END };
+
     crest->mhd_daemon = MHD_start_daemon(
             flags, port, NULL, NULL, microhttpd_cb, crest,
             MHD_OPTION_EXTERNAL_LOGGER, microhttpd_logger_cb, crest,
+            MHD_OPTION_ARRAY, options,
             MHD_OPTION_END);
 
     if (!crest->mhd_daemon) {
@@ -121,6 +169,7 @@ static void crest_call_cb(
     case crest_ok:       crest_resp_send(resp, code); return;
     case crest_err:      crest_resp_send_error(resp, 500, "internal server error"); return;
     case crest_conflict: crest_resp_send_error(resp, 409, "conflict"); return;
+    case crest_not_modified: crest_resp_send(resp, 304); return;
     default:
         optics_fail("unknown crest callback return value: %d", result);
         optics_abort();
@@ -298,6 +347,33 @@ static void microhttpd_logger_cb(void *ctx, const char *fmt, va_list args)
     optics_warn_va(fmt, args);
 }
 
+// Failing to set an option only degrades the connection so it's not fatal.
+static void microhttpd_sockopt(int fd, int level, int option, const char *name)
+{
+    int one = 1;
+    if (setsockopt(fd, level, option, &one, sizeof(one)) < 0)
+        optics_warn_errno("unable to set socket option '%s'", name);
+}
+
+static void microhttpd_notify_cb(
+        void *ctx, struct MHD_Connection *conn, void **socket_ctx,
+        enum MHD_ConnectionNotificationCode code)
+{
+    (void) socket_ctx;
+    struct crest *crest = ctx;
+
+    if (code != MHD_CONNECTION_NOTIFY_STARTED) return;
+
+    const union MHD_ConnectionInfo *info =
+        MHD_get_connection_info(conn, MHD_CONNECTION_INFO_CONNECTION_FD);
+    if (!info) return;
+
+    if (crest->config.nodelay)
+        microhttpd_sockopt(info->connect_fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY");
+    if (crest->config.keepalive)
+        microhttpd_sockopt(info->connect_fd, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE");
+}
+
 static void microhttpd_panic_cb(
         void *ctx, const char *file, unsigned int line, const char *reason)
 {
@@ -23,6 +23,7 @@ const char *crest_req_get_uri(struct crest_req *req);
 size_t crest_req_get_path_tokens(struct crest_req *);
 const char *crest_req_get_path_token(struct crest_req *, size_t i);
 const char *crest_req_get_header(struct crest_req *, const char *key);
+const char *crest_req_get_query(struct crest_req *, const char *key);
 size_t crest_req_read(struct crest_req *req, void *dest, size_t max);
 
 
@@ -30,11 +31,28 @@ struct crest_resp;
 void crest_resp_add_header(struct crest_resp *, const char *key, const char *value);
 void crest_resp_write(struct crest_resp *, const void *body, size_t len);
 
+// Sends the body without copying it. The body must stay valid until release is
+// called with the body pointer once the response has been fully sent or
+// discarded. Replaces anything written through crest_resp_write.
+typedef void (* crest_release_cb_t) (void *body);
+void crest_resp_write_ref(
+        struct crest_resp *, const void *body, size_t len, crest_release_cb_t release);
+
+// Streams the body through read which fills at most len bytes of dst and
+// returns the number of bytes written where 0 marks the end of the body. The
+// body is sent with chunked transfer encoding as its length isn't known upfront
+// and release is called with ctx once the response is done with it. Replaces
+// anything written through crest_resp_write or crest_resp_write_ref.
+typedef size_t (* crest_read_cb_t) (void *ctx, char *dst, size_t len);
+void crest_resp_write_stream(
+        struct crest_resp *, crest_read_cb_t read, void *ctx, crest_release_cb_t release);
+
 enum crest_result
 {
     crest_ok,
     crest_err,
     crest_conflict,
+    crest_not_modified,
 };
 
 typedef bool (* crest_test_cb_t) (void *, struct crest_req *);
@@ -62,3 +80,24 @@ void crest_free(struct crest *);
 bool crest_add(struct crest *, struct crest_res res);
 bool crest_bind(struct crest *, int port);
 
+// Fields left to 0 or false keep the microhttpd defaults.
+struct crest_config
+{
+    // Number of threads polling the connections through epoll. A single
+    // internal thread is used when 0 or 1.
+    unsigned threads;
+
+    unsigned connections_max;
+    unsigned connections_per_ip;
+
+    // Seconds of inactivity after which a connection is closed which bounds
+    // the time slow clients can hold on to a connection.
+    unsigned timeout;
+
+    // Socket options applied to every accepted connection.
+    bool nodelay;
+    bool keepalive;
+};
+
+bool crest_bind_config(struct crest *, int port, const struct crest_config *config);
+
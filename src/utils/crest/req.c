@@ -71,6 +71,11 @@ const char *crest_req_get_header(struct crest_req *req, const char *key)
     return MHD_lookup_connection_value(req->conn, MHD_HEADER_KIND, key);
 }
 
+const char *crest_req_get_query(struct crest_req *req, const char *key)
+{
+    return MHD_lookup_connection_value(req->conn, MHD_GET_ARGUMENT_KIND, key);
+}
+
 size_t crest_req_read(struct crest_req *req, void *dest, size_t max)
 {
     size_t leftover = req->data_len - req->data_pos;
@@ -13,14 +13,55 @@
 // resp
 // -----------------------------------------------------------------------------
 
+// Size of the chunks requested from streamed bodies.
+enum { crest_stream_block = 16 * 1024 };
+
+struct crest_stream
+{
+    crest_read_cb_t read;
+    crest_release_cb_t release;
+    void *ctx;
+};
+
 struct crest_resp
 {
     struct MHD_Connection *conn;
 
     struct htable headers;
     struct buffer body;
+
+    const void *ref;
+    size_t ref_len;
+    crest_release_cb_t release;
+
+    struct crest_stream *stream;
 };
 
+static ssize_t crest_stream_read(void *ctx, uint64_t pos, char *dst, size_t len)
+{
+    (void) pos;
+    struct crest_stream *stream = ctx;
+
+    size_t n = stream->read(stream->ctx, dst, len);
+    return n ? (ssize_t) n : MHD_CONTENT_READER_END_OF_STREAM;
+}
+
+static void crest_stream_free(void *ctx)
+{
+    struct crest_stream *stream = ctx;
+    if (stream->release) stream->release(stream->ctx);
+    free(stream);
+}
+
+static void crest_resp_release(struct crest_resp *resp)
+{
+    if (resp->ref) resp->release((void *) resp->ref);
+    resp->ref = NULL;
+
+    if (resp->stream) crest_stream_free(resp->stream);
+    resp->stream = NULL;
+}
+
 void crest_resp_free(struct crest_resp *resp)
 {
     struct htable_bucket *it = htable_next(&resp->headers, NULL);
@@ -29,6 +70,7 @@ void crest_resp_free(struct crest_resp *resp)
     htable_reset(&resp->headers);
 
     buffer_reset(&resp->body);
+    crest_resp_release(resp);
 }
 
 void crest_resp_add_header(struct crest_resp *resp, const char *key, const char *value)
@@ -49,9 +91,70 @@ void crest_resp_write(struct crest_resp *resp, const void *body, size_t len)
     buffer_write(&resp->body, body, len);
 }
 
-static void crest_resp_send(struct crest_resp *resp, int code)
+void crest_resp_write_ref(
+        struct crest_resp *resp, const void *body, size_t len, crest_release_cb_t release)
 {
-    struct MHD_Response *mhd_resp = MHD_create_response_from_buffer(
+    crest_resp_release(resp);
+    buffer_reset(&resp->body);
+
+    resp->ref = body;
+    resp->ref_len = len;
+    resp->release = release;
+}
+
+void crest_resp_write_stream(
+        struct crest_resp *resp, crest_read_cb_t read, void *ctx, crest_release_cb_t release)
+{
+    crest_resp_release(resp);
+    buffer_reset(&resp->body);
+
+    resp->stream = calloc(1, sizeof(*resp->stream));
+    optics_assert_alloc(resp->stream);
+    *resp->stream = (struct crest_stream) { .read = read, .release = release, .ctx = ctx };
+}
+
+static struct MHD_Response *crest_resp_create(struct crest_resp *resp)
+{
+    struct MHD_Response *mhd_resp = NULL;
+
+    // MHD owns the stream once the response is created and frees it once the
+    // response is destroyed.
+    if (resp->stream) {
+        mhd_resp = MHD_create_response_from_callback(
+                MHD_SIZE_UNKNOWN, crest_stream_block,
+                crest_stream_read, resp->stream, crest_stream_free);
+        if (!mhd_resp) {
+            optics_fail("unable to create streamed response");
+            optics_abort();
+        }
+
+        resp->stream = NULL;
+        return mhd_resp;
+    }
+
+    if (resp->ref) {
+
+#if MHD_VERSION >= 0x00096300
+        // MHD calls release once the response is destroyed which can happen
+        // well after the callback returns.
+        mhd_resp = MHD_create_response_from_buffer_with_free_callback(
+                resp->ref_len, (void *) resp->ref, resp->release);
+        if (mhd_resp) resp->ref = NULL;
+#else
+        mhd_resp = MHD_create_response_from_buffer(
+                resp->ref_len, (void *) resp->ref, MHD_RESPMEM_MUST_COPY);
+        crest_resp_release(resp);
+#endif
+
+        if (!mhd_resp) {
+            optics_fail("unable to create response of size '%zu'", resp->ref_len);
+            optics_abort();
+        }
+
+        return mhd_resp;
+    }
+
+    mhd_resp = MHD_create_response_from_buffer(
             resp->body.len, resp->body.data, MHD_RESPMEM_MUST_FREE);
     if (!mhd_resp) {
         optics_fail("unable to create response of size '%zu'", resp->body.len);
@@ -62,6 +165,13 @@ static void crest_resp_send(struct crest_resp *resp, int code)
     // we should not free it.
     resp->body = (struct buffer) {0};
 
+    return mhd_resp;
+}
+
+static void crest_resp_send(struct crest_resp *resp, int code)
+{
+    struct MHD_Response *mhd_resp = crest_resp_create(resp);
+
     struct htable_bucket *it = htable_next(&resp->headers, NULL);
     for (; it; it = htable_next(&resp->headers, it)) {
 
@@ -82,6 +192,7 @@ static void crest_resp_send(struct crest_resp *resp, int code)
 
 static void crest_resp_send_error(struct crest_resp *resp, int code, const char *reason)
 {
+    crest_resp_release(resp);
     crest_resp_write(resp, reason, strnlen(reason, 1024));
     crest_resp_send(resp, code);
 }
@@ -81,6 +81,104 @@ static void optics_backtrace(struct optics_error *err)
 }
 
 
+// -----------------------------------------------------------------------------
+// mode
+// -----------------------------------------------------------------------------
+// Call sites are tracked in a small open-addressed table keyed on the file
+// pointer and line which never gets cleared. Sites that don't fit in the table
+// are treated as if they had already been seen.
+
+enum
+{
+    error_sites_cap = 256,
+    error_sites_probe = 8,
+    error_report_period = 1000UL * 1000 * 1000,
+};
+
+struct error_site
+{
+    atomic_uintptr_t key;
+    atomic_size_t hits;
+    atomic_size_t suppressed;
+    _Atomic uint64_t next;
+};
+
+#ifdef OPTICS_ERROR_CHEAP
+static enum optics_error_mode error_mode = optics_error_cheap;
+#else
+static enum optics_error_mode error_mode = optics_error_full;
+#endif
+
+static struct error_site error_sites[error_sites_cap];
+
+void optics_error_mode(enum optics_error_mode mode) { error_mode = mode; }
+
+static struct error_site *error_site(const char *file, int line)
+{
+    uintptr_t key = ((uintptr_t) file) ^ (((uintptr_t) line) << 48);
+    size_t hash = (key ^ (key >> 29)) * 0x9E3779B97F4A7C15UL;
+
+    for (size_t i = 0; i < error_sites_probe; ++i) {
+        struct error_site *site = &error_sites[(hash + i) % error_sites_cap];
+
+        uintptr_t old = atomic_load_explicit(&site->key, memory_order_relaxed);
+        if (!old && atomic_compare_exchange_strong_explicit(
+                        &site->key, &old, key,
+                        memory_order_relaxed, memory_order_relaxed))
+            return site;
+        if (old == key) return site;
+    }
+
+    return NULL;
+}
+
+// Returns true when the error should be fully formatted along with its
+// backtrace which is always the case in full mode.
+static bool error_site_first(const char *file, int line)
+{
+    if (error_mode == optics_error_full) return true;
+
+    struct error_site *site = error_site(file, line);
+    if (!site) return false;
+
+    return !atomic_fetch_add_explicit(&site->hits, 1, memory_order_relaxed);
+}
+
+// Returns false if the warning should be suppressed and otherwise sets
+// suppressed to the number of warnings suppressed since the last report.
+static bool error_site_report(const char *file, int line, size_t *suppressed)
+{
+    *suppressed = 0;
+    if (error_mode == optics_error_full) return true;
+
+    struct error_site *site = error_site(file, line);
+    if (!site) return true;
+
+    uint64_t now = clock_wall_nanos();
+    uint64_t next = atomic_load_explicit(&site->next, memory_order_relaxed);
+
+    if (now < next || !atomic_compare_exchange_strong_explicit(
+                    &site->next, &next, now + error_report_period,
+                    memory_order_relaxed, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    *suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    return true;
+}
+
+// The raw format string is the only message kept past the first occurrence.
+static void error_msg_raw(struct optics_error *err, const char *fmt)
+{
+    size_t len = strnlen(fmt, optics_err_msg_cap - 1);
+    memcpy(err->msg, fmt, len);
+    err->msg[len] = '\0';
+    err->backtrace_len = 0;
+}
+
+
 // -----------------------------------------------------------------------------
 // fail
 // -----------------------------------------------------------------------------
@@ -88,32 +186,42 @@ static void optics_backtrace(struct optics_error *err)
 static bool abort_on_fail = 0;
 void optics_dbg_abort_on_fail() { abort_on_fail = true; }
 
-void optics_vfail(const char *file, int line, const char *fmt, ...)
+// Fields are set individually as zeroing the whole struct would touch the
+// message and backtrace arrays on every failure.
+static void optics_fail_va(
+        const char *file, int line, int errno_, const char *fmt, va_list args)
 {
-    optics_errno = (struct optics_error)
-        { .warning = false, .errno_ = 0, .file = file, .line = line };
+    struct optics_error *err = &optics_errno;
+    err->warning = false;
+    err->errno_ = errno_;
+    err->file = file;
+    err->line = line;
+
+    if (error_site_first(file, line)) {
+        (void) vsnprintf(err->msg, optics_err_msg_cap, fmt, args);
+        optics_backtrace(err);
+    }
+    else error_msg_raw(err, fmt);
+
+    if (abort_on_fail) optics_abort();
+}
 
+void optics_vfail(const char *file, int line, const char *fmt, ...)
+{
     va_list args;
     va_start(args, fmt);
-    (void) vsnprintf(optics_errno.msg, optics_err_msg_cap, fmt, args);
+    optics_fail_va(file, line, 0, fmt, args);
     va_end(args);
-
-    optics_backtrace(&optics_errno);
-    if (abort_on_fail) optics_abort();
 }
 
 void optics_vfail_errno(const char *file, int line, const char *fmt, ...)
 {
-    optics_errno = (struct optics_error)
-        { .warning = false, .errno_ = errno, .file = file, .line = line };
+    int errno_ = errno;
 
     va_list args;
     va_start(args, fmt);
-    (void) vsnprintf(optics_errno.msg, optics_err_msg_cap, fmt, args);
+    optics_fail_va(file, line, errno_, fmt, args);
     va_end(args);
-
-    optics_backtrace(&optics_errno);
-    if (abort_on_fail) optics_abort();
 }
 
 
@@ -124,15 +232,31 @@ void optics_vfail_errno(const char *file, int line, const char *fmt, ...)
 static bool abort_on_warn = 0;
 void optics_dbg_abort_on_warn() { abort_on_warn = true; }
 
-void optics_vwarn_va(const char *file, int line, const char *fmt, va_list args)
+static void optics_warn_report(
+        const char *file, int line, int errno_, const char *fmt, va_list args)
 {
-    struct optics_error err = { .warning = true, .file = file, .line = line };
-    (void) vsnprintf(err.msg, optics_err_msg_cap, fmt, args);
-    optics_backtrace(&err);
+    size_t suppressed = 0;
+    if (!error_site_report(file, line, &suppressed)) return;
+
+    struct optics_error err =
+        { .warning = true, .errno_ = errno_, .file = file, .line = line };
+
+    int len = vsnprintf(err.msg, optics_err_msg_cap, fmt, args);
+    if (suppressed && len >= 0 && len < optics_err_msg_cap) {
+        (void) snprintf(err.msg + len, optics_err_msg_cap - len,
+                " (%zu suppressed)", suppressed);
+    }
+
+    if (error_site_first(file, line)) optics_backtrace(&err);
 
     optics_perror(&err);
 }
 
+void optics_vwarn_va(const char *file, int line, const char *fmt, va_list args)
+{
+    optics_warn_report(file, line, 0, fmt, args);
+}
+
 
 void optics_vwarn(const char *file, int line, const char *fmt, ...)
 {
@@ -146,16 +270,10 @@ void optics_vwarn(const char *file, int line, const char *fmt, ...)
 
 void optics_vwarn_errno(const char *file, int line, const char *fmt, ...)
 {
-
-    struct optics_error err =
-        { .warning = true, .errno_ = errno, .file = file, .line = line };
+    int errno_ = errno;
 
     va_list args;
     va_start(args, fmt);
-    (void) vsnprintf(err.msg, optics_err_msg_cap, fmt, args);
+    optics_warn_report(file, line, errno_, fmt, args);
     va_end(args);
-
-    optics_backtrace(&err);
-
-    optics_perror(&err);
 }
@@ -0,0 +1,360 @@
+/* fmt.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "fmt.h"
+#include "fmt_table.h"
+#include "type_pun.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+
+// -----------------------------------------------------------------------------
+// integers
+// -----------------------------------------------------------------------------
+
+static const char fmt_digits[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static size_t fmt_u64_digits(uint64_t value)
+{
+    size_t n = 1;
+    for (uint64_t x = value; x >= 10; x /= 10) n++;
+    return n;
+}
+
+// Writes exactly len digits which must be enough to hold the value.
+static void fmt_u64_n(char *dst, uint64_t value, size_t len)
+{
+    char *it = dst + len;
+
+    while (value >= 100) {
+        size_t i = (value % 100) * 2;
+        value /= 100;
+        *--it = fmt_digits[i + 1];
+        *--it = fmt_digits[i];
+    }
+
+    if (value >= 10) {
+        size_t i = value * 2;
+        *--it = fmt_digits[i + 1];
+        *--it = fmt_digits[i];
+    }
+    else *--it = '0' + value;
+}
+
+size_t fmt_u64(char *dst, uint64_t value)
+{
+    size_t len = fmt_u64_digits(value);
+    fmt_u64_n(dst, value, len);
+    return len;
+}
+
+size_t fmt_i64(char *dst, int64_t value)
+{
+    if (value >= 0) return fmt_u64(dst, value);
+
+    // Negating in unsigned arithmetic is well defined for INT64_MIN.
+    *dst = '-';
+    return fmt_u64(dst + 1, -((uint64_t) value)) + 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// ryu
+// -----------------------------------------------------------------------------
+// Computes the shortest decimal representation of a double within the interval
+// of values that round to it. Follows the reference implementation's d2d
+// closely, including its names for the bounds: vr is the scaled value and vp
+// and vm are the upper and lower bounds of the rounding interval.
+
+enum
+{
+    fmt_mantissa_bits = 52,
+    fmt_exponent_bits = 11,
+    fmt_bias = 1023,
+};
+
+struct fmt_decimal
+{
+    uint64_t mantissa;
+    int32_t exponent;
+};
+
+// Valid for e in [0, 3528]; ceil(log2(5^e)) except for 0 where it's 1.
+static inline int32_t fmt_pow5_bitlen(int32_t e)
+{
+    return (int32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+// Valid for e in [0, 1650]; floor(log10(2^e)).
+static inline uint32_t fmt_log10_pow2(int32_t e)
+{
+    return ((uint32_t) e * 78913) >> 18;
+}
+
+// Valid for e in [0, 2620]; floor(log10(5^e)).
+static inline uint32_t fmt_log10_pow5(int32_t e)
+{
+    return ((uint32_t) e * 732923) >> 20;
+}
+
+static inline uint32_t fmt_pow5_factor(uint64_t value)
+{
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline bool fmt_multiple_pow5(uint64_t value, uint32_t p)
+{
+    return fmt_pow5_factor(value) >= p;
+}
+
+static inline bool fmt_multiple_pow2(uint64_t value, uint32_t p)
+{
+    return (value & ((1ULL << p) - 1)) == 0;
+}
+
+// (m * mul) >> j where mul is a 128-bit value and j >= 64.
+static inline uint64_t fmt_mul_shift(uint64_t m, const uint64_t *mul, int32_t j)
+{
+    unsigned __int128 b0 = (unsigned __int128) m * mul[0];
+    unsigned __int128 b2 = (unsigned __int128) m * mul[1];
+    return (uint64_t) (((b0 >> 64) + b2) >> (j - 64));
+}
+
+static struct fmt_decimal fmt_ryu(uint64_t ieee_mantissa, uint32_t ieee_exponent)
+{
+    int32_t e2;
+    uint64_t m2;
+    if (!ieee_exponent) {
+        e2 = 1 - fmt_bias - fmt_mantissa_bits - 2;
+        m2 = ieee_mantissa;
+    }
+    else {
+        e2 = (int32_t) ieee_exponent - fmt_bias - fmt_mantissa_bits - 2;
+        m2 = (1ULL << fmt_mantissa_bits) | ieee_mantissa;
+    }
+
+    // Round to even values are included in the interval.
+    const bool accept_bounds = (m2 & 1) == 0;
+
+    const uint64_t mv = 4 * m2;
+    const uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    bool vm_zeros = false, vr_zeros = false;
+
+    if (e2 >= 0) {
+        const uint32_t q = fmt_log10_pow2(e2) - (e2 > 3);
+        e10 = (int32_t) q;
+
+        const int32_t k = fmt_pow5_inv_bits + fmt_pow5_bitlen(q) - 1;
+        const int32_t i = -e2 + (int32_t) q + k;
+        vr = fmt_mul_shift(4 * m2, fmt_pow5_inv_split[q], i);
+        vp = fmt_mul_shift(4 * m2 + 2, fmt_pow5_inv_split[q], i);
+        vm = fmt_mul_shift(4 * m2 - 1 - mm_shift, fmt_pow5_inv_split[q], i);
+
+        // Only one of mp, mv and mm can be a multiple of 5 if any.
+        if (q <= 21) {
+            if (mv % 5 == 0) vr_zeros = fmt_multiple_pow5(mv, q);
+            else if (accept_bounds) vm_zeros = fmt_multiple_pow5(mv - 1 - mm_shift, q);
+            else vp -= fmt_multiple_pow5(mv + 2, q);
+        }
+    }
+
+    else {
+        const uint32_t q = fmt_log10_pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t) q + e2;
+
+        const int32_t i = -e2 - (int32_t) q;
+        const int32_t k = fmt_pow5_bitlen(i) - fmt_pow5_bits;
+        const int32_t j = (int32_t) q - k;
+        vr = fmt_mul_shift(4 * m2, fmt_pow5_split[i], j);
+        vp = fmt_mul_shift(4 * m2 + 2, fmt_pow5_split[i], j);
+        vm = fmt_mul_shift(4 * m2 - 1 - mm_shift, fmt_pow5_split[i], j);
+
+        if (q <= 1) {
+            // mv = 4 * m2 always has at least two trailing zero bits.
+            vr_zeros = true;
+            if (accept_bounds) vm_zeros = mm_shift == 1;
+            else --vp;
+        }
+        else if (q < 63) vr_zeros = fmt_multiple_pow2(mv, q);
+    }
+
+    // Removes digits for as long as the bounds still have distinct prefixes.
+    int32_t removed = 0;
+    uint8_t last_removed = 0;
+    uint64_t output;
+
+    if (vm_zeros || vr_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_zeros &= vm % 10 == 0;
+            vr_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10; vp /= 10; vm /= 10;
+            removed++;
+        }
+
+        if (vm_zeros) {
+            while (vm % 10 == 0) {
+                vr_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10; vp /= 10; vm /= 10;
+                removed++;
+            }
+        }
+
+        // Exactly halfway rounds to even.
+        if (vr_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4;
+
+        bool round_up = (vr == vm && (!accept_bounds || !vm_zeros)) || last_removed >= 5;
+        output = vr + round_up;
+    }
+
+    // Common case where the trailing digits of the bounds don't matter.
+    else {
+        bool round_up = false;
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10; vp /= 10; vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    return (struct fmt_decimal) { .mantissa = output, .exponent = e10 + removed };
+}
+
+// Integers with at most 53 bits of magnitude are exact which means that their
+// shortest representation is the integer itself minus its trailing zeros.
+static bool fmt_small_int(uint64_t ieee_mantissa, uint32_t ieee_exponent, struct fmt_decimal *out)
+{
+    const uint64_t m2 = (1ULL << fmt_mantissa_bits) | ieee_mantissa;
+    const int32_t e2 = (int32_t) ieee_exponent - fmt_bias - fmt_mantissa_bits;
+
+    if (e2 > 0 || e2 < -52) return false;
+
+    const uint64_t mask = (1ULL << -e2) - 1;
+    if (m2 & mask) return false;
+
+    *out = (struct fmt_decimal) { .mantissa = m2 >> -e2, .exponent = 0 };
+    while (out->mantissa % 10 == 0) {
+        out->mantissa /= 10;
+        out->exponent++;
+    }
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// double
+// -----------------------------------------------------------------------------
+
+// The decimal is made of len digits where the first digit is at 10^exp.
+static size_t fmt_layout(char *dst, uint64_t mantissa, size_t len, int32_t exp)
+{
+    char *it = dst;
+
+    if (exp >= (int32_t) len - 1 && exp < 21) {
+        fmt_u64_n(it, mantissa, len);
+        it += len;
+
+        size_t zeros = exp - (len - 1);
+        memset(it, '0', zeros);
+        it += zeros;
+    }
+
+    else if (exp >= 0 && exp < 21) {
+        size_t whole = exp + 1;
+        fmt_u64_n(it + 1, mantissa, len);
+        memmove(it, it + 1, whole);
+        it[whole] = '.';
+        it += len + 1;
+    }
+
+    else if (exp < 0 && exp >= -6) {
+        size_t zeros = -exp - 1;
+        *it++ = '0';
+        *it++ = '.';
+        memset(it, '0', zeros);
+        it += zeros;
+        fmt_u64_n(it, mantissa, len);
+        it += len;
+    }
+
+    else {
+        fmt_u64_n(it + 1, mantissa, len);
+        it[0] = it[1];
+        if (len > 1) {
+            it[1] = '.';
+            it += len + 1;
+        }
+        else it++;
+
+        *it++ = 'e';
+        *it++ = exp < 0 ? '-' : '+';
+
+        uint32_t abs = exp < 0 ? -exp : exp;
+        if (abs < 10) *it++ = '0';
+        it += fmt_u64(it, abs);
+    }
+
+    return it - dst;
+}
+
+size_t fmt_double(char *dst, double value)
+{
+    const uint64_t bits = pun_dtoi(value);
+    const bool sign = bits >> (fmt_mantissa_bits + fmt_exponent_bits);
+    const uint64_t ieee_mantissa = bits & ((1ULL << fmt_mantissa_bits) - 1);
+    const uint32_t ieee_exponent =
+        (bits >> fmt_mantissa_bits) & ((1U << fmt_exponent_bits) - 1);
+
+    char *it = dst;
+
+    if (ieee_exponent == (1U << fmt_exponent_bits) - 1) {
+        if (ieee_mantissa) {
+            memcpy(it, "nan", 3);
+            return 3;
+        }
+
+        if (sign) *it++ = '-';
+        memcpy(it, "inf", 3);
+        return (it - dst) + 3;
+    }
+
+    if (sign) *it++ = '-';
+
+    if (!ieee_exponent && !ieee_mantissa) {
+        *it++ = '0';
+        return it - dst;
+    }
+
+    struct fmt_decimal decimal;
+    if (!fmt_small_int(ieee_mantissa, ieee_exponent, &decimal))
+        decimal = fmt_ryu(ieee_mantissa, ieee_exponent);
+
+    size_t len = fmt_u64_digits(decimal.mantissa);
+    int32_t exp = decimal.exponent + (int32_t) len - 1;
+    it += fmt_layout(it, decimal.mantissa, len, exp);
+
+    return it - dst;
+}
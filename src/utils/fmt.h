@@ -0,0 +1,41 @@
+/* fmt.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Allocation-free number formatting for the text backends which avoids going
+   through the locale and format parsing machinery of printf. Integers are
+   formatted two digits at a time and doubles are formatted with the shortest
+   sequence of digits that parses back to the same value using the Ryu
+   algorithm (Ulf Adams, PLDI 2018).
+
+   None of the functions write a terminating null character; they return the
+   number of characters written which is at most the matching fmt_*_len.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// fmt
+// -----------------------------------------------------------------------------
+
+enum
+{
+    fmt_u64_len = 20,
+    fmt_i64_len = 21,
+
+    // -d.ddddddddddddddddde-308
+    fmt_double_len = 25,
+};
+
+size_t fmt_u64(char *dst, uint64_t value);
+size_t fmt_i64(char *dst, int64_t value);
+
+// Values whose decimal exponent is within [-6, 21) are written in positional
+// notation and in scientific notation otherwise, with the exponent written
+// like %g does (e+21, e-07). Integral values have no fractional part and
+// non-finite values are written as nan, inf and -inf.
+size_t fmt_double(char *dst, double value);
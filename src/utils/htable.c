@@ -30,16 +30,15 @@ void htable_reset(struct htable *ht)
 
 static bool table_put(
         struct htable_bucket *table, size_t cap,
-        const char *key, uint64_t value)
+        const char *key, uint64_t value, uint64_t hash)
 {
-    uint64_t hash = htable_hash(key);
-
     for (size_t i = 0; i < probe_window; ++i) {
         struct htable_bucket *bucket = &table[(hash + i) % cap];
         if (bucket->key) continue;
 
         bucket->key = key;
         bucket->value = value;
+        bucket->hash = hash;
         return true;
     }
 
@@ -60,7 +59,7 @@ static void htable_resize(struct htable *ht, size_t cap)
         struct htable_bucket *bucket = &ht->table[i];
         if (!bucket->key) continue;
 
-        if (!table_put(new_table, new_cap, bucket->key, bucket->value)) {
+        if (!table_put(new_table, new_cap, bucket->key, bucket->value, bucket->hash)) {
             free(new_table);
             htable_resize(ht, new_cap * 2);
             return;
@@ -82,16 +81,25 @@ void htable_reserve(struct htable *ht, size_t items)
 // ops
 // -----------------------------------------------------------------------------
 
+static inline bool bucket_match(
+        struct htable_bucket *bucket, const char *key, uint64_t hash)
+{
+    if (!bucket->key || bucket->hash != hash) return false;
+    return !strncmp(bucket->key, key, htable_key_max_len);
+}
+
 struct htable_ret htable_get(struct htable *ht, const char *key)
 {
-    uint64_t hash = htable_hash(key);
+    return htable_get_h(ht, key, htable_hash(key));
+}
+
+struct htable_ret htable_get_h(struct htable *ht, const char *key, uint64_t hash)
+{
     htable_resize(ht, probe_window);
 
     for (size_t i = 0; i < probe_window; ++i) {
         struct htable_bucket *bucket = &ht->table[(hash + i) % ht->cap];
-
-        if (!bucket->key) continue;
-        if (strncmp(bucket->key, key, htable_key_max_len)) continue;
+        if (!bucket_match(bucket, key, hash)) continue;
 
         return (struct htable_ret) { .ok = true, .value = bucket->value };
     }
@@ -110,7 +118,7 @@ struct htable_ret htable_put(struct htable *ht, const char *key, uint64_t value)
         struct htable_bucket *bucket = &ht->table[(hash + i) % ht->cap];
 
         if (bucket->key) {
-            if (strncmp(bucket->key, key, htable_key_max_len)) continue;
+            if (!bucket_match(bucket, key, hash)) continue;
             return (struct htable_ret) { .ok = false, .value = bucket->value };
         }
 
@@ -121,6 +129,7 @@ struct htable_ret htable_put(struct htable *ht, const char *key, uint64_t value)
         ht->len++;
         empty->key = strndup(key, htable_key_max_len);
         empty->value = value;
+        empty->hash = hash;
         return (struct htable_ret) { .ok = true };
     }
 
@@ -136,8 +145,7 @@ struct htable_ret htable_xchg(struct htable *ht, const char *key, uint64_t value
     for (size_t i = 0; i < probe_window; ++i) {
         struct htable_bucket *bucket = &ht->table[(hash + i) % ht->cap];
 
-        if (!bucket->key) continue;
-        if (strncmp(bucket->key, key, htable_key_max_len)) continue;
+        if (!bucket_match(bucket, key, hash)) continue;
 
         uint64_t old_value = bucket->value;
         bucket->value = value;
@@ -155,8 +163,7 @@ struct htable_ret htable_del(struct htable *ht, const char *key)
     for (size_t i = 0; i < probe_window; ++i) {
         struct htable_bucket *bucket = &ht->table[(hash + i) % ht->cap];
 
-        if (!bucket->key) continue;
-        if (strncmp(bucket->key, key, htable_key_max_len)) continue;
+        if (!bucket_match(bucket, key, hash)) continue;
 
         ht->len--;
         free((char *) bucket->key);
@@ -188,7 +195,7 @@ void htable_diff(struct htable *a, struct htable *b, struct htable *result)
 {
     struct htable_bucket *it;
     for (it = htable_next(a, NULL); it; it = htable_next(a, it)) {
-        if (htable_get(b, it->key).ok) continue;
+        if (htable_get_h(b, it->key, it->hash).ok) continue;
         htable_put(result, it->key, it->value);
     }
 }
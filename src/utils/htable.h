@@ -17,6 +17,9 @@ struct htable_bucket
 {
     const char *key;
     uint64_t value;
+
+    // Compared before the key to avoid a string comparison on every probe.
+    uint64_t hash;
 };
 
 struct htable
@@ -46,6 +49,7 @@ void htable_reserve(struct htable *, size_t items);
 // -----------------------------------------------------------------------------
 
 struct htable_ret htable_get(struct htable *, const char *key);
+struct htable_ret htable_get_h(struct htable *, const char *key, uint64_t hash);
 struct htable_ret htable_put(struct htable *, const char *key, uint64_t value);
 struct htable_ret htable_xchg(struct htable *, const char *key, uint64_t value);
 struct htable_ret htable_del(struct htable *, const char *key);
@@ -62,7 +66,7 @@ void htable_diff(struct htable *a, struct htable *b, struct htable *result);
 inline uint64_t htable_hash(const char *key)
 {
     uint64_t hash = 0xcbf29ce484222325;
-    for (size_t i = 0; i < strnlen(key, htable_key_max_len); ++i)
+    for (size_t i = 0; i < htable_key_max_len && key[i]; ++i)
         hash = (hash ^ key[i]) * 0x100000001b3;
 
     return hash;
@@ -19,126 +19,471 @@ static size_t tick_inc()
 // -----------------------------------------------------------------------------
 // ring log
 // -----------------------------------------------------------------------------
+// Messages are recorded as the format pointer along with the raw arguments,
+// formatting is deferred until the rings are dumped. Each thread writes to its
+// own ring and a slot is guarded by a sequence number which is cleared while
+// the slot is being written so that the dump can detect and skip the slots
+// that are torn by a concurrent write. Strings are copied in the message as
+// their pointer might not outlive the dump.
+
+enum { log_args_max = 12, log_strs_len = 64, log_spec_len = 32 };
+
+enum log_arg_type
+{
+    log_arg_int,
+    log_arg_uint,
+    log_arg_char,
+    log_arg_double,
+    log_arg_ptr,
+    log_arg_str,
+    log_arg_skip,
+};
 
 struct log_msg
 {
+    atomic_size_t seq;
+
+    uint64_t tsc;
     size_t tid;
-    size_t tick;
     const char *title;
-    char msg[128];
+    const char *fmt;
+
+    uint8_t args_len;
+    bool truncated;
+    uint64_t args[log_args_max];
+    char strs[log_strs_len];
 };
 
 struct log_ring
 {
     struct log_ring *next;
 
-    size_t pos;
-    atomic_uintptr_t data;
+    size_t pos; // owned by the writing thread.
+    atomic_size_t head;
+    size_t read; // protected by ring_dump_lock.
+
+    struct log_msg *msgs;
 };
 
-static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
-static pthread_key_t ring_key;
+static __thread struct log_ring *ring_local = NULL;
+static _Atomic(struct log_ring *) ring_head = NULL;
+static struct slock ring_dump_lock;
 
-static struct slock ring_lock;
-static struct log_ring *ring_head = NULL;
+static struct log_ring *ring_get()
+{
+    if (optics_likely(ring_local != NULL)) return ring_local;
+
+    struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+    optics_assert_alloc(ring);
+
+    ring->msgs = calloc(ring_size, sizeof(struct log_msg));
+    optics_assert_alloc(ring->msgs);
+
+    // Rings are never removed from the list so a plain CAS push is enough.
+    struct log_ring *head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    do {
+        ring->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+                    &ring_head, &head, ring,
+                    memory_order_release, memory_order_relaxed));
+
+    return ring_local = ring;
+}
 
-static void ring_init()
+
+// -----------------------------------------------------------------------------
+// spec
+// -----------------------------------------------------------------------------
+// Minimal printf conversion specification parser shared by the recording and
+// the formatting of a message so that both agree on the arguments consumed.
+
+enum log_len
+{
+    log_len_none,
+    log_len_hh,
+    log_len_h,
+    log_len_l,
+    log_len_ll,
+    log_len_j,
+    log_len_z,
+    log_len_t,
+    log_len_L,
+};
+
+struct log_spec
 {
-    if (pthread_key_create(&ring_key, NULL)) {
-        optics_fail_errno("unable to create pthread key");
-        optics_abort();
+    const char *start;
+    const char *end;
+
+    size_t stars;
+    enum log_len len;
+    char conv;
+};
+
+static const char *log_spec_parse(const char *it, struct log_spec *spec)
+{
+    *spec = (struct log_spec) { .start = it };
+    it++; // '%'
+
+    while (*it && strchr("-+ #0'", *it)) it++;
+
+    if (*it == '*') { spec->stars++; it++; }
+    else while (*it >= '0' && *it <= '9') it++;
+
+    if (*it == '.') {
+        it++;
+        if (*it == '*') { spec->stars++; it++; }
+        else while (*it >= '0' && *it <= '9') it++;
+    }
+
+    const char *mod = it;
+    switch (*it) {
+    case 'h': spec->len = it[1] == 'h' ? log_len_hh : log_len_h; break;
+    case 'l': spec->len = it[1] == 'l' ? log_len_ll : log_len_l; break;
+    case 'q': spec->len = log_len_ll; break;
+    case 'j': spec->len = log_len_j; break;
+    case 'z': spec->len = log_len_z; break;
+    case 't': spec->len = log_len_t; break;
+    case 'L': spec->len = log_len_L; break;
+    default: break;
     }
+    if (spec->len != log_len_none) it++;
+    if (spec->len == log_len_hh || (spec->len == log_len_ll && *mod == 'l')) it++;
+
+    spec->conv = *it;
+    if (*it) it++;
+
+    spec->end = it;
+    return it;
 }
 
-static struct log_ring *ring_get()
+static enum log_arg_type log_spec_type(const struct log_spec *spec)
 {
-    pthread_once(&ring_once, &ring_init);
+    switch (spec->conv) {
+    case 'd': case 'i': return log_arg_int;
+    case 'o': case 'u': case 'x': case 'X': return log_arg_uint;
+    case 'c': return log_arg_char;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A': return log_arg_double;
+    case 's': return log_arg_str;
+    case 'p': return log_arg_ptr;
+    default: return log_arg_skip;
+    }
+}
+
+// %m is a glibc extension that doesn't consume any arguments.
+static bool log_spec_consumes(const struct log_spec *spec)
+{
+    return spec->conv && spec->conv != '%' && spec->conv != 'm';
+}
+
 
-    struct log_ring *ring = pthread_getspecific(ring_key);
-    if (ring) return ring;
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
 
-    ring = calloc(1, sizeof(struct log_ring));
-    ring->data = (uintptr_t) calloc(ring_size, sizeof(struct log_msg));
+static int64_t log_read_int(const struct log_spec *spec, va_list *args)
+{
+    switch (spec->len) {
+    case log_len_hh: return (signed char) va_arg(*args, int);
+    case log_len_h: return (short) va_arg(*args, int);
+    case log_len_l: return va_arg(*args, long);
+    case log_len_ll: return va_arg(*args, long long);
+    case log_len_j: return va_arg(*args, intmax_t);
+    case log_len_z: return va_arg(*args, ssize_t);
+    case log_len_t: return va_arg(*args, ptrdiff_t);
+    case log_len_none:
+    case log_len_L:
+    default: return va_arg(*args, int);
+    }
+}
 
-    if (pthread_setspecific(ring_key, ring)) {
-        optics_fail_errno("unable to set log thread specific data");
-        optics_abort();
+static uint64_t log_read_uint(const struct log_spec *spec, va_list *args)
+{
+    switch (spec->len) {
+    case log_len_hh: return (unsigned char) va_arg(*args, unsigned);
+    case log_len_h: return (unsigned short) va_arg(*args, unsigned);
+    case log_len_l: return va_arg(*args, unsigned long);
+    case log_len_ll: return va_arg(*args, unsigned long long);
+    case log_len_j: return va_arg(*args, uintmax_t);
+    case log_len_z: return va_arg(*args, size_t);
+    case log_len_t: return va_arg(*args, ptrdiff_t);
+    case log_len_none:
+    case log_len_L:
+    default: return va_arg(*args, unsigned);
     }
+}
 
-    {
-        slock_lock(&ring_lock);
+// Returns false if the message ran out of space for arguments in which case
+// the message is truncated at the current specification.
+static bool log_record_arg(
+        struct log_msg *msg, size_t *strs,
+        const struct log_spec *spec, va_list *args)
+{
+    if (msg->args_len + spec->stars + 1 > log_args_max) return false;
+
+    for (size_t i = 0; i < spec->stars; ++i)
+        msg->args[msg->args_len++] = (int64_t) va_arg(*args, int);
+
+    uint64_t *arg = &msg->args[msg->args_len++];
+    enum log_arg_type type = log_spec_type(spec);
+
+    switch (type) {
+    case log_arg_int: *arg = log_read_int(spec, args); break;
+    case log_arg_uint: *arg = log_read_uint(spec, args); break;
+    case log_arg_char: *arg = va_arg(*args, int); break;
+    case log_arg_ptr: *arg = (uintptr_t) va_arg(*args, void *); break;
+
+    // %n and unknown conversions are assumed to take a pointer which is
+    // consumed but never handed back to printf.
+    case log_arg_skip: (void) va_arg(*args, void *); break;
+
+    case log_arg_double: {
+        double value = spec->len == log_len_L ?
+            (double) va_arg(*args, long double) : va_arg(*args, double);
+        memcpy(arg, &value, sizeof(value));
+        break;
+    }
 
-        ring->next = ring_head;
-        ring_head = ring;
+    case log_arg_str: {
+        const char *str = va_arg(*args, const char *);
+        if (!str) str = "(null)";
 
-        slock_unlock(&ring_lock);
+        *arg = *strs;
+        while (*str && *strs < log_strs_len - 1) msg->strs[(*strs)++] = *str++;
+        msg->strs[(*strs)++] = '\0';
+        break;
     }
 
-    return ring;
+    default:
+        optics_fail("unknown log arg type '%d'", type);
+        return false;
+    }
+
+    return true;
 }
 
 static void ring_log(const char *title, const char *fmt, va_list args)
 {
     struct log_ring *ring = ring_get();
 
-    struct log_msg *data = (void *) atomic_load_explicit(
-            &ring->data, memory_order_relaxed);
-    size_t i = ring->pos++ % ring_size;
+    size_t pos = ring->pos++;
+    struct log_msg *msg = &ring->msgs[pos % ring_size];
+
+    atomic_store_explicit(&msg->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    msg->tsc = clock_rdtsc();
+    msg->tid = tid();
+    msg->title = title;
+    msg->fmt = fmt;
+    msg->args_len = 0;
+    msg->truncated = false;
+
+    va_list copy;
+    va_copy(copy, args);
+
+    size_t strs = 0;
+    for (const char *it = fmt; (it = strchr(it, '%'));) {
+        struct log_spec spec;
+        it = log_spec_parse(it, &spec);
+        if (!log_spec_consumes(&spec)) continue;
+
+        if ((log_spec_type(&spec) == log_arg_str && strs >= log_strs_len) ||
+                !log_record_arg(msg, &strs, &spec, &copy))
+        {
+            msg->truncated = true;
+            break;
+        }
+    }
+
+    va_end(copy);
 
-    data[i].tick = tick_inc();
-    data[i].tid = tid();
-    data[i].title = title;
-    (void) vsnprintf(data[i].msg, sizeof(data[i].msg), fmt, args);
+    atomic_store_explicit(&msg->seq, pos + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, pos + 1, memory_order_release);
 }
 
-static size_t ring_count()
+
+// -----------------------------------------------------------------------------
+// format
+// -----------------------------------------------------------------------------
+
+// Not a printf-like function on purpose as the specification is only known at
+// runtime and has already been validated by the recording.
+static void log_format_spec(struct buffer *buffer, const char *spec, ...)
 {
-    size_t n = 0;
-    for (struct log_ring *ring = ring_head; ring; ring = ring->next) n++;
-    return n;
+    va_list args;
+    va_start(args, spec);
+
+    char buf[256];
+    int len = vsnprintf(buf, sizeof(buf), spec, args);
+    if (len > 0) buffer_write(buffer, buf, len < (int) sizeof(buf) ? (size_t) len : sizeof(buf) - 1);
+
+    va_end(args);
+}
+
+static void log_format_arg(
+        struct buffer *buffer, const struct log_msg *msg,
+        const struct log_spec *spec, size_t *arg)
+{
+    // Rebuild the specification without its length modifier which is replaced
+    // by the one matching the type of the recorded argument.
+    char fmt[log_spec_len] = {0};
+    size_t fmt_len = 0;
+
+    for (const char *it = spec->start; it < spec->end - 1 && fmt_len < log_spec_len - 4; ++it) {
+        if (strchr("hlqjztL", *it)) continue;
+        fmt[fmt_len++] = *it;
+    }
+
+    enum log_arg_type type = log_spec_type(spec);
+    if (type == log_arg_int || type == log_arg_uint) {
+        fmt[fmt_len++] = 'l';
+        fmt[fmt_len++] = 'l';
+    }
+    fmt[fmt_len++] = spec->conv;
+
+    int stars[2] = {0};
+    for (size_t i = 0; i < spec->stars; ++i) stars[i] = (int) msg->args[(*arg)++];
+
+    uint64_t raw = msg->args[(*arg)++];
+
+#define log_format(value)                                               \
+    do {                                                                \
+        if (spec->stars == 0) log_format_spec(buffer, fmt, value);      \
+        else if (spec->stars == 1) log_format_spec(buffer, fmt, stars[0], value); \
+        else log_format_spec(buffer, fmt, stars[0], stars[1], value);   \
+    } while (false)
+
+    switch (type) {
+    case log_arg_int: log_format((long long) raw); break;
+    case log_arg_uint: log_format((unsigned long long) raw); break;
+    case log_arg_char: log_format((int) raw); break;
+    case log_arg_ptr: log_format((void *) (uintptr_t) raw); break;
+    case log_arg_str: log_format(msg->strs + raw); break;
+    case log_arg_skip: break;
+
+    case log_arg_double: {
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        log_format(value);
+        break;
+    }
+
+    default:
+        optics_fail("unknown log arg type '%d'", type);
+        break;
+    }
+
+#undef log_format
+}
+
+static void log_format_msg(struct buffer *buffer, const struct log_msg *msg)
+{
+    size_t arg = 0;
+    size_t args_len = msg->args_len;
+
+    const char *it = msg->fmt;
+    while (*it) {
+        const char *next = strchr(it, '%');
+        if (!next) next = it + strlen(it);
+        buffer_write(buffer, it, next - it);
+        if (!*next) break;
+
+        struct log_spec spec;
+        it = log_spec_parse(next, &spec);
+
+        if (!log_spec_consumes(&spec)) {
+            if (spec.conv == '%') buffer_put(buffer, '%');
+            continue;
+        }
+
+        if (arg + spec.stars + 1 > args_len) break;
+        log_format_arg(buffer, msg, &spec, &arg);
+    }
+
+    if (msg->truncated) buffer_printf(buffer, " <truncated>");
 }
 
+
+// -----------------------------------------------------------------------------
+// dump
+// -----------------------------------------------------------------------------
+
 static int ring_cmp(const void *lhs_, const void *rhs_)
 {
-    struct log_msg *const *lhs = lhs_;
-    struct log_msg *const *rhs = rhs_;
+    const struct log_msg *lhs = lhs_;
+    const struct log_msg *rhs = rhs_;
 
-    return ((ssize_t) (*rhs)->tick) - ((ssize_t) (*lhs)->tick);
+    if (lhs->tsc == rhs->tsc) return 0;
+    return lhs->tsc < rhs->tsc ? -1 : 1;
 }
 
-static void ring_dump()
+// Copies out every message not yet read and that wasn't being written while
+// copied. Messages that were overwritten since the last dump are lost.
+static size_t ring_collect(struct log_ring *ring, struct log_msg *dst)
 {
-    slock_lock(&ring_lock);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
 
-    size_t rings_len = ring_count();
-    struct log_msg **rings = alloca(rings_len * sizeof(struct log_msg *));
+    size_t start = ring->read;
+    if (head - start > ring_size) start = head - ring_size;
+    ring->read = head;
 
-    size_t i = 0;
-    for (struct log_ring *ring = ring_head; ring; ring = ring->next) {
-        struct log_msg *new = calloc(ring_size, sizeof(struct log_msg));
-        rings[i++] = (void *) atomic_exchange_explicit(
-                &ring->data, (uintptr_t) new, memory_order_relaxed);
-    }
+    size_t n = 0;
+    for (size_t pos = start; pos < head; ++pos) {
+        struct log_msg *msg = &ring->msgs[pos % ring_size];
 
-    struct log_msg **msgs = alloca(rings_len * ring_size * sizeof(struct log_msg *));
+        size_t seq = atomic_load_explicit(&msg->seq, memory_order_acquire);
+        if (seq != pos + 1) continue;
 
-    size_t k = 0;
-    for (size_t i = 0; i < rings_len; ++i) {
-        for (size_t j = 0; j < ring_size; ++j)
-            msgs[k++] = &rings[i][j];
+        memcpy(&dst[n], msg, sizeof(*msg));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&msg->seq, memory_order_relaxed) != seq) continue;
+
+        n++;
     }
 
-    qsort(msgs, k, sizeof(struct log_msg *), &ring_cmp);
+    return n;
+}
+
+void optics_log_write(struct buffer *buffer)
+{
+    slock_lock(&ring_dump_lock);
+
+    size_t rings_len = 0;
+    struct log_ring *rings = atomic_load_explicit(&ring_head, memory_order_acquire);
+    for (struct log_ring *ring = rings; ring; ring = ring->next) rings_len++;
+
+    struct log_msg *msgs = calloc(rings_len * ring_size, sizeof(struct log_msg));
+    optics_assert_alloc(msgs);
+
+    size_t n = 0;
+    for (struct log_ring *ring = rings; ring; ring = ring->next)
+        n += ring_collect(ring, msgs + n);
 
-    for (size_t i = 0; i < k; ++i) {
-        if (!msgs[i]->tick) continue;
-        fprintf(stderr, "[%8lu] <%lu> %s: %s\n",
-                msgs[i]->tick, msgs[i]->tid, msgs[i]->title, msgs[i]->msg);
+    slock_unlock(&ring_dump_lock);
+
+    qsort(msgs, n, sizeof(struct log_msg), &ring_cmp);
+
+    // Timestamps are printed in cycles relative to the oldest message.
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(buffer, "[%12lu] <%lu> %s: ",
+                msgs[i].tsc - msgs[0].tsc, msgs[i].tid, msgs[i].title);
+        log_format_msg(buffer, &msgs[i]);
+        buffer_put(buffer, '\n');
     }
 
-    for (size_t i = 0; i < rings_len; ++i) free(rings[i]);
+    free(msgs);
+}
+
+static void ring_dump()
+{
+    struct buffer buffer = {0};
+    optics_log_write(&buffer);
 
-    slock_unlock(&ring_lock);
+    if (buffer.len) fwrite(buffer.data, 1, buffer.len, stderr);
+    buffer_reset(&buffer);
 }
 
 
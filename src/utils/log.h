@@ -32,5 +32,11 @@
 # define optics_log(t, ...) do { (void) t; } while (false)
 #endif
 
+struct buffer;
+
 void optics_log_impl(const char *title, const char *fmt, ...) optics_printf(2, 3);
+
+// Formats and consumes the messages recorded in the rings since the last dump.
+// Messages are only kept in the rings when OPTICS_LOG_RING is set.
 void optics_log_dump();
+void optics_log_write(struct buffer *);
@@ -0,0 +1,219 @@
+/* numa.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "numa.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+
+// -----------------------------------------------------------------------------
+// list
+// -----------------------------------------------------------------------------
+
+static bool numa_parse_index(const char **it, size_t *value)
+{
+    if (**it < '0' || **it > '9') return false;
+
+    *value = 0;
+    for (; **it >= '0' && **it <= '9'; ++*it) {
+        *value = *value * 10 + (**it - '0');
+        if (*value > numa_cpus_max) return false;
+    }
+    return true;
+}
+
+bool numa_parse_list(const char *list, bool *set, size_t len)
+{
+    memset(set, 0, len * sizeof(*set));
+
+    const char *it = list;
+    while (*it && *it != '\n') {
+        size_t first, last;
+        if (!numa_parse_index(&it, &first)) return false;
+
+        last = first;
+        if (*it == '-') {
+            it++;
+            if (!numa_parse_index(&it, &last)) return false;
+        }
+
+        if (first > last || last >= len) return false;
+        for (size_t i = first; i <= last; ++i) set[i] = true;
+
+        if (*it == ',') it++;
+        else if (*it && *it != '\n') return false;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// topology
+// -----------------------------------------------------------------------------
+
+static const uint16_t numa_cpu_none = UINT16_MAX;
+
+static struct
+{
+    pthread_once_t once;
+
+    size_t nodes;
+    size_t node_cpus;
+    size_t page_len;
+
+    // Kernel id of each node which can be sparse.
+    size_t ids[numa_nodes_max];
+
+    uint16_t cpu_node[numa_cpus_max];
+    uint16_t cpu_index[numa_cpus_max];
+} numa = { .once = PTHREAD_ONCE_INIT };
+
+static void numa_single()
+{
+    numa.nodes = 1;
+    numa.node_cpus = cpus();
+    for (size_t cpu = 0; cpu < numa_cpus_max; ++cpu)
+        numa.cpu_node[cpu] = numa.cpu_index[cpu] = numa_cpu_none;
+}
+
+static bool numa_add_node(size_t id, const char *cpulist)
+{
+    bool set[numa_cpus_max];
+    if (!numa_parse_list(cpulist, set, numa_cpus_max)) return false;
+
+    size_t node = numa.nodes++;
+    numa.ids[node] = id;
+
+    size_t index = 0;
+    for (size_t cpu = 0; cpu < numa_cpus_max; ++cpu) {
+        if (!set[cpu]) continue;
+        numa.cpu_node[cpu] = node;
+        numa.cpu_index[cpu] = index++;
+    }
+
+    if (index > numa.node_cpus) numa.node_cpus = index;
+    return true;
+}
+
+static bool numa_read(const char *path, char *buffer, size_t len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    ssize_t ret = read(fd, buffer, len - 1);
+    close(fd);
+
+    if (ret < 0) return false;
+    buffer[ret] = '\0';
+    return true;
+}
+
+static bool numa_load_sysfs()
+{
+    char buffer[4096];
+    if (!numa_read("/sys/devices/system/node/online", buffer, sizeof(buffer))) return false;
+
+    bool online[numa_nodes_max];
+    if (!numa_parse_list(buffer, online, numa_nodes_max)) return false;
+
+    numa.nodes = 0;
+    numa.node_cpus = 0;
+
+    for (size_t id = 0; id < numa_nodes_max; ++id) {
+        if (!online[id]) continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", id);
+        if (!numa_read(path, buffer, sizeof(buffer))) return false;
+        if (!numa_add_node(id, buffer)) return false;
+    }
+
+    return numa.nodes > 1;
+}
+
+static void numa_load()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    numa.page_len = page > 0 ? (size_t) page : 4096;
+
+    numa_single();
+    if (!numa_load_sysfs()) numa_single();
+}
+
+size_t numa_nodes()
+{
+    pthread_once(&numa.once, numa_load);
+    return numa.nodes;
+}
+
+size_t numa_node_cpus()
+{
+    pthread_once(&numa.once, numa_load);
+    return numa.node_cpus;
+}
+
+size_t numa_page_len()
+{
+    pthread_once(&numa.once, numa_load);
+    return numa.page_len;
+}
+
+bool numa_cpu(size_t cpu, size_t *node, size_t *index)
+{
+    pthread_once(&numa.once, numa_load);
+    if (cpu >= numa_cpus_max || numa.cpu_node[cpu] == numa_cpu_none) return false;
+
+    *node = numa.cpu_node[cpu];
+    *index = numa.cpu_index[cpu];
+    return true;
+}
+
+bool numa_set_topology(const char * const *cpulists, size_t nodes)
+{
+    pthread_once(&numa.once, numa_load);
+    if (nodes > numa_nodes_max) return false;
+
+    numa_single();
+    if (nodes < 2) return true;
+
+    numa.nodes = 0;
+    numa.node_cpus = 0;
+
+    for (size_t node = 0; node < nodes; ++node) {
+        if (numa_add_node(node, cpulists[node])) continue;
+        numa_single();
+        return false;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// bind
+// -----------------------------------------------------------------------------
+
+bool numa_bind(void *ptr, size_t len, size_t node)
+{
+    size_t page = numa_page_len();
+    if (node >= numa.nodes || numa.nodes < 2) return false;
+
+    uintptr_t first = ((uintptr_t) ptr + page - 1) & ~(page - 1);
+    uintptr_t last = ((uintptr_t) ptr + len) & ~(page - 1);
+    if (first >= last) return true;
+
+    // The kernel reads maxnode - 1 bits from the mask.
+    unsigned long mask[2] = {0};
+    mask[0] = 1UL << numa.ids[node];
+
+    long ret = syscall(SYS_mbind, first, last - first,
+            MPOL_PREFERRED, mask, numa_nodes_max + 1, MPOL_MF_MOVE);
+    return ret == 0;
+}
@@ -0,0 +1,58 @@
+/* numa.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Numa topology of the machine as read from sysfs which sharded lenses use to
+   group their shards by node and to place the memory of each group on its node.
+   Goes through the raw mbind syscall to avoid depending on libnuma.
+
+   Machines without numa information are treated as a single node in which case
+   nothing is ever bound and the shards are laid out by cpu as before.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    numa_nodes_max = 64,
+    numa_cpus_max = 1024,
+};
+
+
+// -----------------------------------------------------------------------------
+// topology
+// -----------------------------------------------------------------------------
+
+// The topology is read on first use and never changes afterwards.
+size_t numa_nodes();
+
+// Largest number of cpus on a single node.
+size_t numa_node_cpus();
+
+size_t numa_page_len();
+
+// Dense index of the node of the cpu along with the index of the cpu amongst
+// the cpus of its node. Returns false for cpus that aren't part of any node.
+bool numa_cpu(size_t cpu, size_t *node, size_t *index);
+
+// Prefers the memory of the node for the pages fully contained within the range
+// and migrates the pages that were already faulted in. Best effort which only
+// returns false if the kernel refused the policy.
+bool numa_bind(void *ptr, size_t len, size_t node);
+
+// Parses a sysfs cpu or node list (e.g. "0-3,8,10-11") into set. Returns false
+// if the list is malformed or contains an index larger than len.
+bool numa_parse_list(const char *list, bool *set, size_t len);
+
+// Replaces the topology read from sysfs by one cpu list per node. Meant for the
+// tests which must call it before creating any sharded lenses.
+bool numa_set_topology(const char * const *cpulists, size_t nodes);
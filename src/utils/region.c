@@ -0,0 +1,315 @@
+/* region.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "region.h"
+#include "bits.h"
+#include "type_pun.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+// Lives at the start of the freed block.
+struct region_block
+{
+    size_t len;
+    struct region_block *next;
+};
+
+static_assert(sizeof(struct region_block) <= region_align,
+        "freed blocks must be able to hold their own node");
+
+// Should be called while holding the region lock.
+static bool region_grow(struct region *region, size_t len)
+{
+    struct region_header *header = region->header;
+
+    if (region->fixed) {
+        optics_fail("region '%s' is full at '%zu'", region->name, region->len);
+        return false;
+    }
+
+    size_t chunks = atomic_load_explicit(&header->chunks_len, memory_order_relaxed);
+    if (chunks == region_chunks_max) {
+        optics_fail("region '%s' exceeded max chunks '%d'", region->name, region_chunks_max);
+        return false;
+    }
+
+    // Doubling the size of the region on every growth keeps the number of
+    // chunks logarithmic in the size of the region.
+    size_t chunk_len = align(len, region->huge ? region_chunk_huge_len : region_chunk_min_len);
+    if (chunk_len < region->len) chunk_len = region->len;
+
+    if (ftruncate(region->fd, region->len + chunk_len) == -1) {
+        optics_fail_errno("unable to grow region '%s' to '%zu'",
+                region->name, region->len + chunk_len);
+        return false;
+    }
+
+    void *ptr = mmap(NULL, chunk_len,
+            PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, region->len);
+    if (ptr == MAP_FAILED) {
+        optics_fail_errno("unable to map region '%s' chunk at '%zu'",
+                region->name, region->len);
+        return false;
+    }
+
+    if (region->huge && madvise(ptr, chunk_len, MADV_HUGEPAGE) == -1)
+        optics_warn_errno("unable to advise huge pages for region '%s'", region->name);
+
+    header->chunks[chunks] = (struct region_chunk) {
+        .off = region->len,
+        .len = chunk_len,
+        .addr = pun_ptoi(ptr),
+    };
+
+    // Synchronizes with region_view_open to make sure that the chunk is fully
+    // written before it is read.
+    atomic_store_explicit(&header->chunks_len, chunks + 1, memory_order_release);
+
+    region->len += chunk_len;
+    region->cur = ptr;
+    region->cur_len = chunk_len;
+    return true;
+}
+
+
+static void region_init(struct region *region, uint8_t *ptr, size_t len)
+{
+    struct region_header *header = (void *) ptr;
+    header->magic = region_magic;
+    header->version = region_version;
+    header->chunks[0] = (struct region_chunk) { .off = 0, .len = len, .addr = pun_ptoi(ptr) };
+    atomic_store_explicit(&header->chunks_len, 1, memory_order_release);
+
+    size_t header_len = align(sizeof(*header), region_align);
+    region->header = header;
+    region->len = len;
+    region->cur = ptr + header_len;
+    region->cur_len = len - header_len;
+}
+
+
+// -----------------------------------------------------------------------------
+// region
+// -----------------------------------------------------------------------------
+
+bool region_open(struct region *region, const char *name)
+{
+    *region = (struct region) { .fd = -1 };
+
+    if (name) {
+        if (strnlen(name, sizeof(region->name)) == sizeof(region->name)) {
+            optics_fail("region name '%s' is too long", name);
+            goto fail_name;
+        }
+
+        strlcpy(region->name, name, sizeof(region->name));
+        region->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    else {
+        strlcpy(region->name, "memfd", sizeof(region->name));
+        region->fd = memfd_create("optics", MFD_CLOEXEC);
+    }
+
+    if (region->fd == -1) {
+        optics_fail_errno("unable to create region '%s'", region->name);
+        goto fail_open;
+    }
+
+    const size_t len = region_chunk_min_len;
+    if (ftruncate(region->fd, len) == -1) {
+        optics_fail_errno("unable to size region '%s'", region->name);
+        goto fail_truncate;
+    }
+
+    uint8_t *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+    if (ptr == MAP_FAILED) {
+        optics_fail_errno("unable to map region '%s'", region->name);
+        goto fail_mmap;
+    }
+
+    region_init(region, ptr, len);
+    return true;
+
+  fail_mmap:
+  fail_truncate:
+    close(region->fd);
+    if (name) shm_unlink(name);
+  fail_open:
+  fail_name:
+    return false;
+}
+
+bool region_open_fixed(struct region *region, size_t len)
+{
+    *region = (struct region) { .fd = -1, .fixed = true };
+    strlcpy(region->name, "fixed", sizeof(region->name));
+
+    if (!len) {
+        optics_fail("invalid fixed region length '%zu'", len);
+        return false;
+    }
+    len = align(len, region_chunk_min_len);
+
+    uint8_t *ptr = mmap(NULL, len,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        optics_fail_errno("unable to map fixed region of '%zu'", len);
+        return false;
+    }
+
+    region_init(region, ptr, len);
+    return true;
+}
+
+void region_close(struct region *region)
+{
+    struct region_header *header = region->header;
+    size_t chunks = atomic_load_explicit(&header->chunks_len, memory_order_relaxed);
+
+    // The header lives in the first chunk so it must be unmapped last.
+    for (size_t i = chunks; i > 0; --i) {
+        struct region_chunk *chunk = &header->chunks[i - 1];
+        munmap(pun_itop(chunk->addr), chunk->len);
+    }
+
+    if (!region->fixed) {
+        close(region->fd);
+        if (strcmp(region->name, "memfd")) shm_unlink(region->name);
+    }
+
+    *region = (struct region) { .fd = -1 };
+}
+
+void *region_alloc(struct region *region, size_t len)
+{
+    len = align(len, region_align);
+    void *ptr = NULL;
+
+    slock_lock(&region->lock);
+
+    for (struct region_block **it = &region->free; *it; it = &(*it)->next) {
+        struct region_block *block = *it;
+        if (block->len < len) continue;
+
+        *it = block->next;
+        ptr = block;
+        goto done;
+    }
+
+    if (region->cur_len < len && !region_grow(region, len)) goto done;
+
+    ptr = region->cur;
+    region->cur += len;
+    region->cur_len -= len;
+
+  done:
+    slock_unlock(&region->lock);
+    return ptr;
+}
+
+// Blocks are never split or coalesced which is fine since the slab only ever
+// hands back its large allocations here.
+void region_free(struct region *region, void *ptr, size_t len)
+{
+    struct region_block *block = ptr;
+    block->len = align(len, region_align);
+
+    slock_lock(&region->lock);
+
+    block->next = region->free;
+    region->free = block;
+
+    slock_unlock(&region->lock);
+}
+
+void region_set_root(struct region *region, const void *root)
+{
+    atomic_store_explicit(&region->header->root, (uintptr_t) root, memory_order_release);
+}
+
+
+// -----------------------------------------------------------------------------
+// view
+// -----------------------------------------------------------------------------
+
+bool region_view_open(struct region_view *view, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        optics_fail_errno("unable to stat region");
+        return false;
+    }
+
+    if ((size_t) st.st_size < sizeof(struct region_header)) {
+        optics_fail("invalid region size '%zu'", (size_t) st.st_size);
+        return false;
+    }
+
+    void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        optics_fail_errno("unable to map region view");
+        return false;
+    }
+
+    *view = (struct region_view) {
+        .base = ptr,
+        .len = st.st_size,
+        .header = ptr,
+    };
+
+    if (view->header->magic != region_magic) {
+        optics_fail("invalid region magic '%lx'", view->header->magic);
+        goto fail_header;
+    }
+
+    if (view->header->version != region_version) {
+        optics_fail("invalid region version '%lu' != '%d'",
+                view->header->version, region_version);
+        goto fail_header;
+    }
+
+    return true;
+
+  fail_header:
+    region_view_close(view);
+    return false;
+}
+
+void region_view_close(struct region_view *view)
+{
+    munmap((void *) view->base, view->len);
+    *view = (struct region_view) {0};
+}
+
+const void *region_view_ptr(const struct region_view *view, uintptr_t addr, size_t len)
+{
+    const struct region_header *header = view->header;
+    size_t chunks = atomic_load_explicit(&header->chunks_len, memory_order_acquire);
+
+    for (size_t i = 0; i < chunks; ++i) {
+        const struct region_chunk *chunk = &header->chunks[i];
+        if (addr < chunk->addr || addr + len > chunk->addr + chunk->len) continue;
+
+        size_t off = chunk->off + (addr - chunk->addr);
+        if (off + len > view->len) return NULL;
+        return view->base + off;
+    }
+
+    return NULL;
+}
+
+const void *region_view_root(const struct region_view *view, size_t len)
+{
+    uintptr_t root = atomic_load_explicit(&view->header->root, memory_order_acquire);
+    return root ? region_view_ptr(view, root, len) : NULL;
+}
@@ -0,0 +1,136 @@
+/* region.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Memory region backed by a shared memory file which can be mapped by another
+   process. The region grows by mapping new chunks of the same file which keeps
+   every pointer handed out valid since the old mappings are never moved. The
+   header at the start of the file records where each chunk is mapped in the
+   writer's address space which is all a reader needs to translate pointers
+   found within the region into offsets in its own mapping.
+
+   Fixed regions are instead backed by a single anonymous shared mapping which
+   is only shared with the children forked after it was created. Since mappings
+   created after the fork aren't inherited, fixed regions can't grow.
+*/
+
+#pragma once
+
+#include "lock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    region_version = 1,
+    region_align = 64,
+    region_chunks_max = 48,
+    region_chunk_min_len = 1 << 20,
+    region_chunk_huge_len = 2 << 20,
+};
+
+static const uint64_t region_magic = 0x6e6f69676572706fUL; // "opregion"
+
+
+// -----------------------------------------------------------------------------
+// header
+// -----------------------------------------------------------------------------
+
+struct region_chunk
+{
+    uint64_t off;
+    uint64_t len;
+    uint64_t addr;
+};
+
+struct region_header
+{
+    uint64_t magic;
+    uint64_t version;
+
+    // Chunks are written before chunks_len is incremented so readers should
+    // load it with acquire semantics.
+    atomic_size_t chunks_len;
+    struct region_chunk chunks[region_chunks_max];
+
+    // Address of the user's root structure in the writer's address space.
+    atomic_uintptr_t root;
+};
+
+
+// -----------------------------------------------------------------------------
+// region
+// -----------------------------------------------------------------------------
+
+struct region_block;
+
+struct region
+{
+    int fd;
+    char name[256];
+    struct region_header *header;
+
+    struct slock lock;
+    size_t len;
+    uint8_t *cur;
+    size_t cur_len;
+
+    // Freed allocations which are reused on a first-fit basis.
+    struct region_block *free;
+
+    // Chunks mapped after it's set are advised to be backed by transparent
+    // huge pages which only applies if shmem huge pages are enabled.
+    bool huge;
+
+    bool fixed;
+};
+
+// A NULL name creates an anonymous memfd which can only be shared by passing
+// the file descriptor around while a named region can be opened through
+// shm_open. The name is unlinked when the region is closed.
+bool region_open(struct region *, const char *name);
+void region_close(struct region *);
+
+// The length is rounded up to a multiple of region_chunk_min_len and includes
+// the header. Allocations fail once the region is full.
+bool region_open_fixed(struct region *, size_t len);
+
+// Returns zeroed memory aligned to region_align unless the allocation reuses a
+// freed block in which case the content is left as is. Freed blocks are tracked
+// within the freed memory itself such that the free list is visible to every
+// process sharing the region.
+void *region_alloc(struct region *, size_t len);
+void region_free(struct region *, void *ptr, size_t len);
+
+void region_set_root(struct region *, const void *root);
+
+
+// -----------------------------------------------------------------------------
+// view
+// -----------------------------------------------------------------------------
+
+// Read-only mapping of a region opened from another process. The view only
+// covers the region as it was when it was opened and must be reopened to see
+// chunks added afterwards.
+struct region_view
+{
+    const uint8_t *base;
+    size_t len;
+    const struct region_header *header;
+};
+
+bool region_view_open(struct region_view *, int fd);
+void region_view_close(struct region_view *);
+
+// Translates an address of the writer's process into the view. Returns NULL if
+// the range is not within the view.
+const void *region_view_ptr(const struct region_view *, uintptr_t addr, size_t len);
+const void *region_view_root(const struct region_view *, size_t len);
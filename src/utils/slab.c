@@ -0,0 +1,284 @@
+/* slab.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "slab.h"
+#include "bits.h"
+
+#include <assert.h>
+#include <sys/mman.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+struct slab_page
+{
+    void *data;
+    bool huge;
+    struct slab_page *next;
+};
+
+static size_t slab_class(size_t len)
+{
+    if (len < slab_align) len = slab_align;
+    return ctz(ceil_pow2(len)) - ctz(slab_align);
+}
+
+static size_t slab_class_len(size_t class)
+{
+    return ((size_t) slab_align) << class;
+}
+
+static inline void *slab_next(void *ptr)
+{
+    return *((void **) ptr);
+}
+
+static inline void slab_set_next(void *ptr, void *next)
+{
+    *((void **) ptr) = next;
+}
+
+
+// -----------------------------------------------------------------------------
+// huge
+// -----------------------------------------------------------------------------
+// Transparent huge pages can only back ranges aligned on the huge page size so
+// the fallback over-maps and trims the mapping down to an aligned chunk.
+
+static void *slab_huge_map()
+{
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void *ptr = mmap(NULL, slab_huge_len, prot, flags | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) return ptr;
+
+    uint8_t *raw = mmap(NULL, 2 * slab_huge_len, prot, flags, -1, 0);
+    if (raw == MAP_FAILED) {
+        optics_fail_errno("unable to map huge page");
+        return NULL;
+    }
+
+    uint8_t *start = (uint8_t *) align((uintptr_t) raw, slab_huge_len);
+    if (start != raw) munmap(raw, start - raw);
+    munmap(start + slab_huge_len, (raw + slab_huge_len) - start);
+
+    if (madvise(start, slab_huge_len, MADV_HUGEPAGE) == -1)
+        optics_warn_errno("unable to advise transparent huge page");
+
+    return start;
+}
+
+// Should be called while holding the pages lock.
+static void *slab_huge_page(struct slab *slab)
+{
+    if (!slab->huge_left) {
+        struct slab_page *chunk = calloc(1, sizeof(*chunk));
+        optics_assert_alloc(chunk);
+
+        chunk->data = slab_huge_map();
+        if (!chunk->data) {
+            free(chunk);
+            return NULL;
+        }
+
+        chunk->next = slab->huge_chunks;
+        slab->huge_chunks = chunk;
+
+        slab->huge_cur = chunk->data;
+        slab->huge_left = slab_huge_len;
+    }
+
+    void *page = slab->huge_cur;
+    slab->huge_cur += slab_page_len;
+    slab->huge_left -= slab_page_len;
+    return page;
+}
+
+static_assert(slab_huge_len % slab_page_len == 0,
+        "huge pages must be carved into whole slab pages");
+
+
+// -----------------------------------------------------------------------------
+// refill
+// -----------------------------------------------------------------------------
+
+// Should be called while holding the class lock. Huge pages fall back to
+// regular pages if they can't be mapped.
+//
+// Region pages are released along with the region so they're not tracked
+// which also keeps the slab free of pointers to process-private memory when
+// the region is shared with forked children.
+static bool slab_refill(struct slab *slab, size_t class)
+{
+    void *data = NULL;
+
+    if (slab->region) {
+        data = region_alloc(slab->region, slab_page_len);
+        if (!data) return false;
+    }
+    else {
+        struct slab_page *page = calloc(1, sizeof(*page));
+        optics_assert_alloc(page);
+
+        slock_lock(&slab->pages_lock);
+
+        if (slab->huge) page->data = slab_huge_page(slab);
+        page->huge = page->data != NULL;
+        if (!page->data) page->data = aligned_alloc(slab_align, slab_page_len);
+        optics_assert_alloc(page->data);
+
+        page->next = slab->pages;
+        slab->pages = page;
+
+        slock_unlock(&slab->pages_lock);
+
+        data = page->data;
+    }
+
+    // Carve the slots in reverse so that they get handed out in address order
+    // which keeps lenses allocated back to back close to each other.
+    size_t len = slab_class_len(class);
+    void *head = slab->classes[class].free;
+    for (size_t off = slab_page_len; off >= len; off -= len) {
+        void *slot = ((uint8_t *) data) + (off - len);
+        slab_set_next(slot, head);
+        head = slot;
+    }
+    slab->classes[class].free = head;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// slab
+// -----------------------------------------------------------------------------
+
+void slab_reset(struct slab *slab)
+{
+    struct slab_page *page = slab->pages;
+    while (page) {
+        struct slab_page *next = page->next;
+
+        // Huge pages are unmapped below.
+        if (!page->huge) free(page->data);
+        free(page);
+        page = next;
+    }
+
+    struct slab_page *chunk = slab->huge_chunks;
+    while (chunk) {
+        struct slab_page *next = chunk->next;
+        munmap(chunk->data, slab_huge_len);
+        free(chunk);
+        chunk = next;
+    }
+
+    slab->pages = NULL;
+    slab->huge_chunks = NULL;
+    slab->huge_cur = NULL;
+    slab->huge_left = 0;
+    for (size_t i = 0; i < slab_classes; ++i)
+        slab->classes[i].free = NULL;
+}
+
+void slab_huge(struct slab *slab)
+{
+    slock_lock(&slab->pages_lock);
+    slab->huge = true;
+    slock_unlock(&slab->pages_lock);
+
+    if (slab->region) {
+        slock_lock(&slab->region->lock);
+        slab->region->huge = true;
+        slock_unlock(&slab->region->lock);
+    }
+}
+
+void *slab_alloc(struct slab *slab, size_t len)
+{
+    size_t class = slab_class(len);
+
+    if (class >= slab_classes) {
+        void *ptr = slab->region ?
+            region_alloc(slab->region, len) :
+            aligned_alloc(slab_align, align(len, slab_align));
+        if (ptr) memset(ptr, 0, len);
+        return ptr;
+    }
+
+    void *ptr = NULL;
+    {
+        struct slab_class *sc = &slab->classes[class];
+        slock_lock(&sc->lock);
+
+        if (sc->free || slab_refill(slab, class)) {
+            ptr = sc->free;
+            sc->free = slab_next(ptr);
+        }
+
+        slock_unlock(&sc->lock);
+    }
+
+    if (ptr) memset(ptr, 0, len);
+    return ptr;
+}
+
+void slab_free(struct slab *slab, void *ptr, size_t len)
+{
+    size_t class = slab_class(len);
+
+    if (class >= slab_classes) {
+        if (slab->region) region_free(slab->region, ptr, len);
+        else free(ptr);
+        return;
+    }
+
+    struct slab_class *sc = &slab->classes[class];
+    slock_lock(&sc->lock);
+
+    slab_set_next(ptr, sc->free);
+    sc->free = ptr;
+
+    slock_unlock(&sc->lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+void slab_batch_free(struct slab_batch *batch, struct slab *slab, void *ptr, size_t len)
+{
+    size_t class = slab_class(len);
+
+    if (class >= slab_classes) {
+        slab_free(slab, ptr, len);
+        return;
+    }
+
+    slab_set_next(ptr, batch->heads[class]);
+    batch->heads[class] = ptr;
+    if (!batch->tails[class]) batch->tails[class] = ptr;
+}
+
+void slab_batch_commit(struct slab_batch *batch, struct slab *slab)
+{
+    for (size_t class = 0; class < slab_classes; ++class) {
+        if (!batch->heads[class]) continue;
+
+        struct slab_class *sc = &slab->classes[class];
+        slock_lock(&sc->lock);
+
+        slab_set_next(batch->tails[class], sc->free);
+        sc->free = batch->heads[class];
+
+        slock_unlock(&sc->lock);
+
+        batch->heads[class] = batch->tails[class] = NULL;
+    }
+}
@@ -0,0 +1,99 @@
+/* slab.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Size-class slab allocator which hands out zeroed, cache-line aligned slots
+   carved out of larger pages. Freed slots are kept on a free list per size
+   class and are only returned to the system when the slab is reset.
+   Allocations larger than the biggest size class are forwarded to
+   aligned_alloc.
+
+   When a region is attached, pages and large allocations are carved out of
+   the region instead such that every slot lives within the shared mapping.
+
+   Pages can also be carved out of 2MB huge pages which keeps the lenses
+   scattered across a large slab within a handful of TLB entries. Reserved
+   hugetlb pages are used if available and transparent huge pages otherwise.
+*/
+
+#pragma once
+
+#include "lock.h"
+#include "region.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+enum
+{
+    slab_align = 64,
+    slab_page_len = 64 * 1024,
+
+    // Size classes are powers of two from slab_align to slab_page_len / 2.
+    slab_classes = 10,
+
+    slab_huge_len = 2 * 1024 * 1024,
+};
+
+
+// -----------------------------------------------------------------------------
+// slab
+// -----------------------------------------------------------------------------
+
+struct slab_class
+{
+    struct slock lock;
+    void *free;
+
+    // Having each class on its own cache line avoids false sharing between
+    // threads allocating different sizes.
+    char padding[slab_align - sizeof(struct slock) - sizeof(void *)];
+};
+
+struct slab
+{
+    struct slab_class classes[slab_classes];
+
+    struct slock pages_lock;
+    void *pages;
+
+    // Huge pages that pages are carved out of. Protected by pages_lock.
+    bool huge;
+    void *huge_chunks;
+    uint8_t *huge_cur;
+    size_t huge_left;
+
+    // Optional; must be set before the first allocation.
+    struct region *region;
+};
+
+void slab_reset(struct slab *);
+
+// Only pages allocated after the call are huge pages. In region mode, the new
+// chunks of the region are advised to use huge pages instead.
+void slab_huge(struct slab *);
+
+void *slab_alloc(struct slab *, size_t len);
+void slab_free(struct slab *, void *ptr, size_t len);
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+// Accumulates freed slots such that they can be returned to the slab with a
+// single lock acquisition per size class.
+struct slab_batch
+{
+    void *heads[slab_classes];
+    void *tails[slab_classes];
+};
+
+void slab_batch_free(struct slab_batch *, struct slab *, void *ptr, size_t len);
+void slab_batch_commit(struct slab_batch *, struct slab *);
@@ -43,6 +43,116 @@ int socket_stream_connect(const char *host, const char *port)
     return -1;
 }
 
+// The connection is most likely still in progress when this returns in which
+// case the socket becomes writable once it completes and its outcome can be
+// retrieved through SO_ERROR.
+int socket_stream_connect_nonblock(const char *host, const char *port)
+{
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *head;
+    int err = getaddrinfo(host, port, &hints, &head);
+    if (err) {
+        optics_fail("unable to resolve host '%s:%s': %s",
+                host, port, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *addr = head; addr; addr = addr->ai_next) {
+        int type = addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC;
+        fd = socket(addr->ai_family, type, addr->ai_protocol);
+        if (fd == -1) continue;
+
+        if (!connect(fd, addr->ai_addr, addr->ai_addrlen) || errno == EINPROGRESS)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(head);
+
+    if (fd > 0) return fd;
+
+    optics_fail_errno("unable to connect stream socket for host '%s:%s'", host, port);
+    return -1;
+}
+
+// Datagram sockets are connected such that packets can be sent without an
+// address and are non-blocking such that a full socket buffer drops packets
+// rather than stalls the sender.
+int socket_dgram_connect(const char *host, const char *port)
+{
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo *head;
+    int err = getaddrinfo(host, port, &hints, &head);
+    if (err) {
+        optics_fail("unable to resolve host '%s:%s': %s",
+                host, port, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *addr = head; addr; addr = addr->ai_next) {
+        int type = addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC;
+        fd = socket(addr->ai_family, type, addr->ai_protocol);
+        if (fd == -1) continue;
+
+        if (!connect(fd, addr->ai_addr, addr->ai_addrlen))
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(head);
+
+    if (fd > 0) return fd;
+
+    optics_fail_errno("unable to connect dgram socket for host '%s:%s'", host, port);
+    return -1;
+}
+
+static int socket_unix_connect(const char *path, int type, const char *name)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strnlen(path, sizeof(addr.sun_path)) == sizeof(addr.sun_path)) {
+        optics_fail("unix socket path '%s' is too long", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        optics_fail_errno("unable to create unix %s socket", name);
+        return -1;
+    }
+
+    if (!connect(fd, (struct sockaddr *) &addr, sizeof(addr))) return fd;
+
+    optics_fail_errno("unable to connect unix %s socket '%s'", name, path);
+    close(fd);
+    return -1;
+}
+
+int socket_dgram_connect_unix(const char *path)
+{
+    return socket_unix_connect(path, SOCK_DGRAM, "dgram");
+}
+
+// Connecting a unix socket completes immediately so, unlike the tcp variant,
+// the socket is ready to be used once this returns.
+int socket_seqpacket_connect_unix(const char *path)
+{
+    return socket_unix_connect(path, SOCK_SEQPACKET, "seqpacket");
+}
+
 int socket_stream_listen(const char *port)
 {
     struct addrinfo hints = {0};
@@ -11,9 +11,14 @@
 // -----------------------------------------------------------------------------
 
 int socket_stream_connect(const char *host, const char *port);
+int socket_stream_connect_nonblock(const char *host, const char *port);
 int socket_stream_listen(const char *port);
 int socket_stream_accept(int fd);
 
+int socket_dgram_connect(const char *host, const char *port);
+int socket_dgram_connect_unix(const char *path);
+int socket_seqpacket_connect_unix(const char *path);
+
 bool socket_send(int fd, size_t len, const void *data);
 ssize_t socket_recv(int fd, size_t len, void *data);
 
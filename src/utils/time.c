@@ -19,6 +19,17 @@ optics_ts_t clock_wall()
     return 0;
 }
 
+uint64_t clock_wall_nanos()
+{
+    struct timespec ts;
+
+    int ret = clock_gettime(CLOCK_REALTIME, &ts);
+    if (!ret) return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+
+    optics_fail_errno("unable to get realtime clock");
+    return 0;
+}
+
 uint64_t clock_rdtsc()
 {
     uint64_t msb, lsb;
@@ -32,6 +43,30 @@ uint64_t clock_rdtsc()
     return msb << 32 | lsb;
 }
 
+bool clock_tsc_invariant()
+{
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return edx & (1 << 8);
+}
+
+double clock_tsc_calibrate(uint64_t nanos)
+{
+    struct timespec t0, t1;
+
+    clock_monotonic(&t0);
+    uint64_t c0 = clock_rdtsc();
+
+    nsleep(nanos);
+
+    clock_monotonic(&t1);
+    uint64_t c1 = clock_rdtsc();
+
+    uint64_t elapsed = (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+    if (c1 <= c0) return 0;
+    return (double) elapsed / (c1 - c0);
+}
+
 
 // -----------------------------------------------------------------------------
 // sleep
@@ -58,6 +93,24 @@ bool nsleep(uint64_t nanos)
     }
 }
 
+bool nsleep_until(uint64_t wall_nanos)
+{
+    struct timespec ts = {
+        .tv_sec = wall_nanos / 1000000000,
+        .tv_nsec = wall_nanos % 1000000000,
+    };
+
+    while (true) {
+        // Unlike most syscalls, clock_nanosleep returns the error directly.
+        int err = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL);
+        if (!err) return true;
+        if (err == EINTR) continue;
+
+        optics_fail_ierrno(err, "unable to sleep via clock_nanosleep");
+        return false;
+    }
+}
+
 void yield()
 {
     sched_yield();
@@ -24,8 +24,17 @@
 typedef uint64_t optics_ts_t;
 
 optics_ts_t clock_wall();
+uint64_t clock_wall_nanos();
 optics_ts_t clock_rdtsc();
 
+// An invariant TSC ticks at a constant rate regardless of the frequency or the
+// power state of the core which makes it usable as a clock.
+bool clock_tsc_invariant();
+
+// Nanoseconds per TSC tick measured against the monotonic clock over the given
+// duration.
+double clock_tsc_calibrate(uint64_t nanos);
+
 inline void clock_monotonic(struct timespec *ts)
 {
     if (optics_unlikely(clock_gettime(CLOCK_MONOTONIC, ts) == -1)) {
@@ -40,4 +49,8 @@ inline void clock_monotonic(struct timespec *ts)
 // -----------------------------------------------------------------------------
 
 bool nsleep(uint64_t nanos);
+
+// Sleeps until the given absolute wall-clock time and is a pthread
+// cancellation point.
+bool nsleep_until(uint64_t wall_nanos);
 void yield();
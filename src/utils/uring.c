@@ -0,0 +1,206 @@
+/* uring.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+
+// -----------------------------------------------------------------------------
+// syscalls
+// -----------------------------------------------------------------------------
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+
+// -----------------------------------------------------------------------------
+// init
+// -----------------------------------------------------------------------------
+
+static void *uring_mmap(int fd, size_t len, off_t off)
+{
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+bool uring_init(struct uring *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params = {0};
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) return false;
+
+    ring->entries = params.sq_entries;
+    ring->cq_entries = params.cq_entries;
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Both rings live in the same mapping on any kernel released since 5.4.
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_len > ring->sq_ring_len) ring->sq_ring_len = ring->cq_ring_len;
+        ring->cq_ring_len = 0;
+    }
+
+    ring->sq_ring = uring_mmap(ring->fd, ring->sq_ring_len, IORING_OFF_SQ_RING);
+    if (!ring->sq_ring) goto fail;
+
+    ring->cq_ring = ring->sq_ring;
+    if (ring->cq_ring_len) {
+        ring->cq_ring = uring_mmap(ring->fd, ring->cq_ring_len, IORING_OFF_CQ_RING);
+        if (!ring->cq_ring) goto fail;
+    }
+
+    ring->sqes = uring_mmap(ring->fd, ring->sqes_len, IORING_OFF_SQES);
+    if (!ring->sqes) goto fail;
+
+    uint8_t *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+    uint8_t *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // The indirection array is never reordered.
+    for (unsigned i = 0; i < ring->entries; ++i) ring->sq_array[i] = i;
+
+    return true;
+
+  fail:
+    uring_close(ring);
+    return false;
+}
+
+void uring_close(struct uring *ring)
+{
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_len);
+    if (ring->fd >= 0) close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+
+// -----------------------------------------------------------------------------
+// submit
+// -----------------------------------------------------------------------------
+
+// The completion queue is twice the size of the submission queue by default
+// but sends reaped late could still overflow it so the number of sends that
+// haven't been reaped is also bounded.
+bool uring_send(
+        struct uring *ring, int fd, const void *data, size_t len, uint64_t user, bool link)
+{
+    if (ring->queued == ring->entries) return false;
+    if (ring->inflight + ring->queued == ring->cq_entries) return false;
+
+    unsigned tail = *ring->sq_tail + ring->queued;
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = user;
+    if (link) sqe->flags = IOSQE_IO_LINK;
+
+    ring->queued++;
+    return true;
+}
+
+// Submissions that fail or that the kernel refuses to make progress on leave
+// the entries it didn't consume in the submission queue. The tail is rolled
+// back to the kernel's head such that these entries are dropped instead of
+// being submitted by the next call on top of whatever the caller falls back to.
+// This is only safe because the kernel only reads the queue while we're in
+// io_uring_enter.
+bool uring_submit(struct uring *ring)
+{
+    if (!ring->queued) return true;
+
+    // The tail is only read by the kernel once we enter the ring.
+    unsigned base = *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, base + ring->queued, __ATOMIC_RELEASE);
+
+    while (ring->queued) {
+        int ret = uring_enter(ring->fd, ring->queued, 0, 0);
+        if (ret < 0 && errno == EINTR) continue;
+
+        if (ret <= 0) {
+            if (!ret) errno = EAGAIN;
+
+            unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+            unsigned consumed = head - base;
+            ring->inflight += consumed;
+
+            __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+            ring->queued = 0;
+            return false;
+        }
+
+        base += ret;
+        ring->queued -= ret;
+        ring->inflight += ret;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// reap
+// -----------------------------------------------------------------------------
+
+size_t uring_reap(struct uring *ring, bool wait, uring_cb_t cb, void *ctx)
+{
+    size_t reaped = 0;
+
+    while (true) {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            cb(ctx, cqe->user_data, cqe->res);
+            ring->inflight--;
+            reaped++;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (!wait || !ring->inflight) break;
+
+        int ret = uring_enter(ring->fd, 0, ring->inflight, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR) break;
+    }
+
+    return reaped;
+}
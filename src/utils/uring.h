@@ -0,0 +1,81 @@
+/* uring.h
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Minimal io_uring submission ring for the network backends which queues the
+   sends of a whole poll and submits them with a single io_uring_enter. Goes
+   through the raw syscalls to avoid depending on liburing.
+
+   Sends are flagged with MSG_DONTWAIT such that a full socket buffer completes
+   the send with -EAGAIN instead of leaving it pending in the kernel. This keeps
+   the same drop semantics as the non-blocking sends that backends fall back to
+   when io_uring isn't available.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// -----------------------------------------------------------------------------
+// uring
+// -----------------------------------------------------------------------------
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct uring
+{
+    int fd;
+    unsigned entries;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+
+    // Written to the submission queue but not yet handed to the kernel.
+    unsigned queued;
+
+    // Handed to the kernel but not yet reaped.
+    size_t inflight;
+};
+
+// Returns false without raising an error if the kernel doesn't support
+// io_uring or if it's disabled in which case the caller should fall back to
+// regular syscalls.
+bool uring_init(struct uring *, unsigned entries);
+void uring_close(struct uring *);
+
+// Returns false if the ring is full in which case the queued sends must be
+// submitted and reaped before queuing more. Linked sends only start once the
+// previous send completed and are cancelled with -ECANCELED if it failed which
+// preserves their ordering on connected sockets.
+bool uring_send(
+        struct uring *, int fd, const void *data, size_t len, uint64_t user, bool link);
+
+// Returns false if the queued sends couldn't all be handed to the kernel in
+// which case those that weren't are dropped from the ring and nothing is left
+// queued.
+bool uring_submit(struct uring *);
+
+// Invokes the callback for every completion available. If wait is set, blocks
+// until every send handed to the kernel has been reaped. Returns the number of
+// completions reaped.
+typedef void (*uring_cb_t) (void *ctx, uint64_t user, int32_t res);
+size_t uring_reap(struct uring *, bool wait, uring_cb_t cb, void *ctx);
@@ -13,6 +13,13 @@
 #include "lock.h"
 #include "htable.h"
 #include "socket.h"
+#include "region.h"
+#include "slab.h"
+#include "arena.h"
+#include "buffer.h"
+#include "fmt.h"
+#include "uring.h"
+#include "numa.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,6 +29,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sched.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -29,6 +37,7 @@
 #include <dirent.h>
 #include <netdb.h>
 #include <syslog.h>
+#include <cpuid.h>
 
 #include "log.c"
 #include "errors.c"
@@ -38,4 +47,10 @@
 #include "key.c"
 #include "htable.c"
 #include "socket.c"
+#include "uring.c"
+#include "fmt.c"
 #include "buffer.c"
+#include "region.c"
+#include "slab.c"
+#include "arena.c"
+#include "numa.c"
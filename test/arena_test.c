@@ -0,0 +1,88 @@
+/* arena_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/arena.h"
+
+
+// -----------------------------------------------------------------------------
+// alloc
+// -----------------------------------------------------------------------------
+
+optics_test_head(arena_alloc_test)
+{
+    struct arena arena = {0};
+
+    const size_t lens[] = { 0, 1, 15, 16, 17, 1000, 32768, arena_page_len, 1 << 20, 3 };
+    enum { n = sizeof(lens) / sizeof(lens[0]) };
+
+    uint8_t *ptrs[n];
+    for (size_t i = 0; i < n; ++i) {
+        ptrs[i] = arena_alloc(&arena, lens[i]);
+        assert_non_null(ptrs[i]);
+        assert_int_equal(pun_ptoi(ptrs[i]) % arena_align, 0);
+        memset(ptrs[i], i, lens[i]);
+    }
+
+    // Allocations must not overlap.
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < lens[i]; ++j)
+            assert_int_equal(ptrs[i][j], i);
+    }
+
+    const char *str = "blah";
+    char *dup = arena_strndup(&arena, str, 3);
+    assert_string_equal(dup, "bla");
+
+    uint64_t value = 0xDEADBEEF;
+    uint64_t *value_dup = arena_dup(&arena, &value, sizeof(value));
+    assert_int_equal(*value_dup, value);
+
+    arena_reset(&arena);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// clear
+// -----------------------------------------------------------------------------
+
+optics_test_head(arena_clear_test)
+{
+    struct arena arena = {0};
+    enum { n = 10 * 1000, len = 100 };
+
+    uint8_t *first[n];
+    for (size_t i = 0; i < n; ++i) first[i] = arena_alloc(&arena, len);
+
+    // The same allocation pattern after a clear must reuse the same memory.
+    for (size_t it = 0; it < 3; ++it) {
+        arena_clear(&arena);
+
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t *ptr = arena_alloc(&arena, len);
+            assert_true(ptr == first[i]);
+        }
+    }
+
+    arena_reset(&arena);
+    assert_null(arena.head);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(arena_alloc_test),
+        cmocka_unit_test(arena_clear_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -51,7 +51,8 @@ optics_test_head(backend_carbon_internal_test)
     const char *port = "12345";
     struct carbon *carbon = carbon_start(port);
 
-    struct optics *optics = optics_create(test_name);
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
     optics_set_prefix(optics, "prefix");
 
     struct optics_lens *counter = optics_counter_create(optics, "counter");
@@ -71,7 +72,7 @@ optics_test_head(backend_carbon_internal_test)
         for (size_t i = 0; i < 100; ++i) optics_dist_record(dist, i);
         for (size_t i = 0; i < 100; ++i) optics_histo_inc(histo, i % 5);
 
-        if (!optics_poller_poll(poller)) optics_abort();
+        if (!optics_poller_poll_at(poller, ++ts)) optics_abort();
 
         // sketchy way to wait for carbon to stop reading our input so we can
         // read the result without issues.
@@ -103,6 +104,149 @@ optics_test_head(backend_carbon_internal_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_carbon_batch_test)
+{
+    const char *port = "12346";
+    struct carbon *carbon = carbon_start(port);
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    // Enough lenses to require multiple send chunks.
+    enum { n = 5000 };
+    struct optics_lens *lenses[n];
+    for (size_t i = 0; i < n; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "counter_%zu", i);
+        lenses[i] = optics_counter_create(optics, key);
+    }
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_carbon(poller, "127.0.0.1", port);
+
+    for (size_t it = 0; it < 3; ++it) {
+        for (size_t i = 0; i < n; ++i) optics_counter_inc(lenses[i], i);
+
+        if (!optics_poller_poll_at(poller, ++ts)) optics_abort();
+        nsleep(10 * 1000 * 1000);
+
+        struct htable result = {0};
+        carbon_parse(carbon, &result);
+        assert_int_equal(result.len, n);
+
+        for (size_t i = 0; i < n; ++i) {
+            char key[optics_name_max_len];
+            snprintf(key, sizeof(key), "prefix.host.counter_%zu", i);
+
+            struct htable_ret ret = htable_get(&result, key);
+            assert_true(ret.ok);
+            assert_float_equal(pun_itod(ret.value), i, 0);
+        }
+
+        htable_reset(&result);
+    }
+
+    optics_poller_free(poller);
+    optics_close(optics);
+    carbon_stop(carbon);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// spill
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_carbon_spill_test)
+{
+    const char *port = "12347";
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_carbon_spill(poller, "127.0.0.1", port, 3, 0));
+
+    // Nothing is listening so every poll ends up in the spill queue which only
+    // keeps the last 3 polls. Each poll has its own key to tell them apart.
+    enum { polls = 5 };
+    for (size_t i = 0; i < polls; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "counter_%zu", i);
+
+        struct optics_lens *lens = optics_counter_create(optics, key);
+        optics_counter_inc(lens, i + 1);
+
+        if (!optics_poller_poll_at(poller, ++ts)) optics_abort();
+        optics_lens_close(lens);
+    }
+
+    struct carbon *carbon = carbon_start(port);
+    nsleep(300 * 1000 * 1000);
+
+    struct htable result = {0};
+    carbon_parse(carbon, &result);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.counter_2", 3),
+            make_kv("prefix.host.counter_3", 4),
+            make_kv("prefix.host.counter_4", 5));
+    htable_reset(&result);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+    carbon_stop(carbon);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// subsecond
+// -----------------------------------------------------------------------------
+
+// Timestamps are in whole seconds but rates are rescaled by the precise elapsed
+// time of the poll.
+optics_test_head(backend_carbon_subsecond_test)
+{
+    const char *port = "12348";
+    struct carbon *carbon = carbon_start(port);
+
+    struct optics *optics = optics_create_at(test_name, 0);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_carbon(poller, "127.0.0.1", port);
+
+    const uint64_t period = 250 * 1000 * 1000;
+    for (size_t it = 1; it <= 4; ++it) {
+        optics_counter_inc(counter, 1);
+
+        if (!optics_poller_poll_at_nanos(poller, it * period)) optics_abort();
+        nsleep(1 * 1000 * 1000);
+
+        struct htable result = {0};
+        carbon_parse(carbon, &result);
+        assert_htable_equal(&result, 0, make_kv("prefix.host.counter", 4));
+        htable_reset(&result);
+    }
+
+    optics_poller_free(poller);
+    optics_close(optics);
+    carbon_stop(carbon);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // external
 // -----------------------------------------------------------------------------
@@ -151,6 +295,9 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(backend_carbon_internal_test),
+        cmocka_unit_test(backend_carbon_batch_test),
+        cmocka_unit_test(backend_carbon_spill_test),
+        cmocka_unit_test(backend_carbon_subsecond_test),
         cmocka_unit_test(backend_carbon_external_test),
     };
 
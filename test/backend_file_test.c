@@ -0,0 +1,285 @@
+/* backend_file_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include "utils/htable.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+enum { polls_max = 256 };
+
+// Values of every poll indexed by timestamp.
+struct polls
+{
+    struct htable values[polls_max];
+};
+
+static void polls_reset(struct polls *polls)
+{
+    for (size_t i = 0; i < polls_max; ++i) htable_reset(&polls->values[i]);
+}
+
+static bool expected_normalized(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) key_len;
+    struct polls *polls = ctx;
+
+    assert_true(ts < polls_max);
+    assert_true(htable_put(&polls->values[ts], key, pun_dtoi(value)).ok);
+    return true;
+}
+
+static void expected_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    if (type != optics_poll_metric) return;
+    (void) optics_poll_normalize_qualified(poll, expected_normalized, ctx);
+}
+
+static bool read_cb(void *ctx, optics_ts_t ts, const char *key, double value)
+{
+    struct polls *polls = ctx;
+
+    assert_true(ts < polls_max);
+    assert_true(htable_put(&polls->values[ts], key, pun_dtoi(value)).ok);
+    return true;
+}
+
+// Values must be bit-exact which covers the XOR encoding.
+static void assert_polls_equal(struct polls *expected, struct polls *result)
+{
+    for (size_t ts = 0; ts < polls_max; ++ts) {
+        struct htable *exp = &expected->values[ts];
+        struct htable *res = &result->values[ts];
+        assert_int_equal(res->len, exp->len);
+
+        struct htable_bucket *it = htable_next(exp, NULL);
+        for (; it; it = htable_next(exp, it)) {
+            struct htable_ret ret = htable_get(res, it->key);
+            assert_true(ret.ok);
+            assert_int_equal(ret.value, it->value);
+        }
+    }
+}
+
+static void read_file(const char *path, struct polls *result)
+{
+    struct optics_file *file = optics_file_open(path);
+    assert_non_null(file);
+    assert_true(optics_file_read(file, read_cb, result));
+    optics_file_close(file);
+}
+
+static size_t file_len(const char *path)
+{
+    struct stat st = {0};
+    assert_int_equal(stat(path, &st), 0);
+    return st.st_size;
+}
+
+
+// -----------------------------------------------------------------------------
+// roundtrip
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_file_roundtrip_test)
+{
+    const char *path = "/tmp/optics_backend_file_roundtrip.bin";
+    unlink(path);
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *constant = optics_gauge_create(optics, "constant");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+    const uint64_t buckets[] = { 10, 20, 30 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+    optics_gauge_set(constant, 1.5);
+
+    struct polls expected = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &expected, expected_cb, NULL);
+    assert_true(optics_dump_file(poller, path));
+
+    // Enough polls to go through multiple keyframes and lenses that come and
+    // go to exercise the dictionary.
+    struct optics_lens *late = NULL;
+    for (size_t it = 0; it < 150; ++it) {
+        optics_counter_inc(counter, it % 7);
+        optics_gauge_set(gauge, it * 0.1);
+        for (size_t i = 0; i < 10; ++i) optics_dist_record(dist, it + i);
+        optics_histo_inc(histo, it % 40);
+
+        if (it == 50) late = optics_counter_create(optics, "late");
+        if (late) optics_counter_inc(late, 1);
+        if (it == 100) { optics_lens_close(late); late = NULL; }
+
+        assert_true(optics_poller_poll_at(poller, ++ts));
+    }
+
+    optics_poller_free(poller);
+
+    struct polls result = {0};
+    read_file(path, &result);
+    assert_polls_equal(&expected, &result);
+
+    // Carbon lines for the same polls take around 30 bytes per value while the
+    // ids usually take a byte and unchanged values a single bit.
+    size_t values = 0;
+    for (size_t i = 0; i < polls_max; ++i) values += expected.values[i].len;
+    assert_true(file_len(path) < values * 6);
+
+    polls_reset(&expected);
+    polls_reset(&result);
+    optics_close(optics);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// append
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_file_append_test)
+{
+    const char *path = "/tmp/optics_backend_file_append.bin";
+    unlink(path);
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+
+    struct polls expected = {0};
+
+    for (size_t run = 0; run < 3; ++run) {
+        struct optics_poller *poller = optics_poller_alloc(optics);
+        optics_poller_set_host(poller, "host");
+        optics_poller_backend(poller, &expected, expected_cb, NULL);
+        assert_true(optics_dump_file(poller, path));
+
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "run_%zu", run);
+        struct optics_lens *lens = optics_counter_create(optics, key);
+
+        for (size_t it = 0; it < 10; ++it) {
+            optics_gauge_set(gauge, run * 100 + it);
+            optics_counter_inc(lens, it);
+            assert_true(optics_poller_poll_at(poller, ++ts));
+        }
+
+        optics_poller_free(poller);
+        optics_lens_close(lens);
+
+        // A torn write must be ignored by the reader and truncated by the next
+        // writer.
+        int fd = open(path, O_WRONLY | O_APPEND);
+        assert_true(fd >= 0);
+        assert_int_equal(write(fd, "OPTBgarbage", 11), 11);
+        close(fd);
+    }
+
+    struct polls result = {0};
+    read_file(path, &result);
+    assert_polls_equal(&expected, &result);
+
+    polls_reset(&expected);
+    polls_reset(&result);
+    optics_close(optics);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// nanos
+// -----------------------------------------------------------------------------
+
+struct nanos_ctx
+{
+    size_t len;
+    optics_ts_t ts[4];
+};
+
+static bool nanos_cb(void *ctx_, optics_ts_t ts, const char *key, double value)
+{
+    (void) key, (void) value;
+    struct nanos_ctx *ctx = ctx_;
+
+    assert_true(ctx->len < 4);
+    ctx->ts[ctx->len++] = ts;
+    return true;
+}
+
+optics_test_head(backend_file_nanos_test)
+{
+    const char *path = "/tmp/optics_backend_file_nanos.bin";
+    unlink(path);
+
+    const uint64_t sec = 1000UL * 1000 * 1000;
+    struct optics *optics = optics_create_at(test_name, 10);
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    assert_true(optics_dump_file(poller, path));
+
+    optics_gauge_set(gauge, 1);
+    assert_true(optics_poller_poll_at_nanos(poller, 10 * sec + sec / 2));
+    optics_gauge_set(gauge, 2);
+    assert_true(optics_poller_poll_at_nanos(poller, 11 * sec + sec / 4));
+    optics_poller_free(poller);
+
+    struct optics_file *file = optics_file_open(path);
+    assert_non_null(file);
+
+    struct nanos_ctx secs = {0};
+    assert_true(optics_file_read(file, nanos_cb, &secs));
+    assert_int_equal(secs.len, 2);
+    assert_int_equal(secs.ts[0], 10);
+    assert_int_equal(secs.ts[1], 11);
+
+    struct nanos_ctx nanos = {0};
+    assert_true(optics_file_read_nanos(file, nanos_cb, &nanos));
+    assert_int_equal(nanos.len, 2);
+    assert_int_equal(nanos.ts[0], 10 * sec + sec / 2);
+    assert_int_equal(nanos.ts[1], 11 * sec + sec / 4);
+
+    optics_file_close(file);
+    optics_lens_close(gauge);
+    optics_close(optics);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(backend_file_roundtrip_test),
+        cmocka_unit_test(backend_file_append_test),
+        cmocka_unit_test(backend_file_nanos_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,179 @@
+/* backend_jsonl_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static void assert_file(const char *path, const char *exp)
+{
+    char data[4096];
+
+    int fd = open(path, O_RDONLY);
+    assert_true(fd >= 0);
+    ssize_t len = read(fd, data, sizeof(data) - 1);
+    assert_true(len >= 0);
+    data[len] = '\0';
+    close(fd);
+
+    assert_string_equal(data, exp);
+}
+
+static void rotated_path(char *dst, size_t len, const char *path, size_t index)
+{
+    snprintf(dst, len, "%s.%zu", path, index);
+}
+
+
+// -----------------------------------------------------------------------------
+// lines
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_jsonl_lines_test)
+{
+    const char *path = "/tmp/optics_backend_jsonl_lines.jsonl";
+    unlink(path);
+
+    const uint64_t sec = 1000UL * 1000 * 1000;
+    struct optics *optics = optics_create_at(test_name, 10);
+    optics_set_prefix(optics, "prefix");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gau\"ge");
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_jsonl(poller, path, 0, 0));
+
+    optics_gauge_set(gauge, 1.5);
+    assert_true(optics_poller_poll_at_nanos(poller, 10 * sec + sec / 2));
+    optics_gauge_set(gauge, NAN);
+    assert_true(optics_poller_poll_at_nanos(poller, 11 * sec));
+    optics_poller_free(poller);
+
+    assert_file(path,
+            "{\"ts\":10.500,\"host\":\"host\",\"key\":\"prefix.gau\\\"ge\",\"value\":1.5}\n"
+            "{\"ts\":11,\"host\":\"host\",\"key\":\"prefix.gau\\\"ge\",\"value\":null}\n");
+
+    // Existing files are appended to.
+    poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_jsonl(poller, path, 0, 0));
+
+    optics_gauge_set(gauge, 2);
+    assert_true(optics_poller_poll_at_nanos(poller, 12 * sec));
+    optics_poller_free(poller);
+
+    assert_file(path,
+            "{\"ts\":10.500,\"host\":\"host\",\"key\":\"prefix.gau\\\"ge\",\"value\":1.5}\n"
+            "{\"ts\":11,\"host\":\"host\",\"key\":\"prefix.gau\\\"ge\",\"value\":null}\n"
+            "{\"ts\":12,\"host\":\"host\",\"key\":\"prefix.gau\\\"ge\",\"value\":2}\n");
+
+    optics_lens_close(gauge);
+    optics_close(optics);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// rotate
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_jsonl_rotate_test)
+{
+    const char *path = "/tmp/optics_backend_jsonl_rotate.jsonl";
+    char rotated[256];
+
+    unlink(path);
+    for (size_t i = 1; i <= 3; ++i) {
+        rotated_path(rotated, sizeof(rotated), path, i);
+        unlink(rotated);
+    }
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "p");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+
+    // A single line is 49 bytes which leaves room for two lines per file.
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_jsonl(poller, path, 100, 2));
+
+    for (size_t i = 1; i <= 6; ++i) {
+        optics_gauge_set(gauge, i);
+        assert_true(optics_poller_poll_at(poller, ++ts));
+    }
+    optics_poller_free(poller);
+
+    assert_file(path,
+            "{\"ts\":5,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":5}\n"
+            "{\"ts\":6,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":6}\n");
+
+    rotated_path(rotated, sizeof(rotated), path, 1);
+    assert_file(rotated,
+            "{\"ts\":3,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":3}\n"
+            "{\"ts\":4,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":4}\n");
+
+    rotated_path(rotated, sizeof(rotated), path, 2);
+    assert_file(rotated,
+            "{\"ts\":1,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":1}\n"
+            "{\"ts\":2,\"host\":\"host\",\"key\":\"p.gauge\",\"value\":2}\n");
+
+    // Only rotate_keep rotated files are kept.
+    rotated_path(rotated, sizeof(rotated), path, 3);
+    assert_int_equal(access(rotated, F_OK), -1);
+
+    optics_lens_close(gauge);
+    optics_close(optics);
+
+    unlink(path);
+    for (size_t i = 1; i <= 2; ++i) {
+        rotated_path(rotated, sizeof(rotated), path, i);
+        unlink(rotated);
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// open
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_jsonl_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_poller *poller = optics_poller_alloc(optics);
+
+    assert_false(optics_dump_jsonl(poller, "/tmp/optics_missing_dir/capture.jsonl", 0, 0));
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(backend_jsonl_lines_test),
+        cmocka_unit_test(backend_jsonl_rotate_test),
+        cmocka_unit_test(backend_jsonl_open_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
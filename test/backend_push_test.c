@@ -0,0 +1,287 @@
+/* backend_push_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include "utils/htable.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// -----------------------------------------------------------------------------
+// receiver
+// -----------------------------------------------------------------------------
+
+enum { keys_max = 1024 };
+
+struct receiver
+{
+    int listen_fd;
+    int fd;
+
+    char prefix[optics_name_max_len];
+    char host[optics_name_max_len];
+    size_t hellos;
+
+    char keys[keys_max][optics_name_max_len];
+    double values[keys_max];
+    bool live[keys_max];
+
+    // Number of values received for the last poll.
+    size_t received;
+};
+
+static void receiver_listen(struct receiver *receiver, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    receiver->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    assert_true(receiver->listen_fd >= 0);
+    assert_int_equal(bind(receiver->listen_fd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+    assert_int_equal(listen(receiver->listen_fd, 1), 0);
+
+    receiver->fd = -1;
+}
+
+static void receiver_accept(struct receiver *receiver)
+{
+    receiver->fd = accept(receiver->listen_fd, NULL, NULL);
+    assert_true(receiver->fd >= 0);
+}
+
+static void receiver_frame(struct receiver *receiver, const uint8_t *frame, size_t len)
+{
+    struct optics_push_header header;
+    assert_true(len >= sizeof(header));
+    memcpy(&header, frame, sizeof(header));
+
+    assert_int_equal(header.magic, optics_push_magic);
+    assert_int_equal(header.version, optics_push_version);
+    assert_int_equal(header.len, len - sizeof(header));
+
+    const uint8_t *it = frame + sizeof(header);
+    const uint8_t *end = frame + len;
+
+    switch ((enum optics_push_type) header.type) {
+
+    case optics_push_hello: {
+        struct optics_push_hello hello;
+        memcpy(&hello, it, sizeof(hello));
+        it += sizeof(hello);
+        assert_int_equal(hello.pid, getpid());
+
+        memcpy(receiver->prefix, it, hello.prefix_len);
+        receiver->prefix[hello.prefix_len] = '\0';
+        memcpy(receiver->host, it + hello.prefix_len, hello.host_len);
+        receiver->host[hello.host_len] = '\0';
+        it += hello.prefix_len + hello.host_len;
+
+        memset(receiver->live, 0, sizeof(receiver->live));
+        receiver->hellos++;
+        break;
+    }
+
+    case optics_push_dict:
+        for (size_t i = 0; i < header.count; ++i) {
+            struct optics_push_key key;
+            memcpy(&key, it, sizeof(key));
+            it += sizeof(key);
+
+            assert_true(key.id < keys_max);
+            memcpy(receiver->keys[key.id], it, key.len);
+            receiver->keys[key.id][key.len] = '\0';
+            receiver->live[key.id] = true;
+
+            size_t entry = sizeof(key) + key.len;
+            it += key.len + (4 - (entry % 4)) % 4;
+        }
+        break;
+
+    case optics_push_values:
+        assert_int_equal(header.len, header.count * sizeof(struct optics_push_value));
+        for (size_t i = 0; i < header.count; ++i) {
+            struct optics_push_value value;
+            memcpy(&value, it, sizeof(value));
+            it += sizeof(value);
+
+            assert_true(receiver->live[value.id]);
+            receiver->values[value.id] = value.value;
+        }
+        break;
+
+    case optics_push_drop:
+        for (size_t i = 0; i < header.count; ++i) {
+            uint32_t id;
+            memcpy(&id, it, sizeof(id));
+            it += sizeof(id);
+
+            assert_true(receiver->live[id]);
+            receiver->live[id] = false;
+        }
+        break;
+
+    case optics_push_done:
+        receiver->received = header.count;
+        break;
+
+    default:
+        assert_true(false);
+    }
+
+    assert_true(it == end);
+}
+
+// Frames sent over a unix socket are queued by the time the poll returns.
+static void receiver_read(struct receiver *receiver)
+{
+    uint8_t frame[optics_push_frame_max];
+
+    while (true) {
+        ssize_t len = recv(receiver->fd, frame, sizeof(frame), MSG_DONTWAIT);
+        if (len < 0) break;
+        receiver_frame(receiver, frame, len);
+    }
+}
+
+static void receiver_htable(struct receiver *receiver, struct htable *result)
+{
+    for (size_t id = 0; id < keys_max; ++id) {
+        if (!receiver->live[id]) continue;
+
+        struct optics_key key = {0};
+        optics_key_push(&key, receiver->prefix);
+        optics_key_push(&key, receiver->host);
+        optics_key_push(&key, receiver->keys[id]);
+        assert_true(htable_put(result, key.data, pun_dtoi(receiver->values[id])).ok);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// push
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_push_test)
+{
+    const char *path = "/tmp/optics_push_test.sock";
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_push(poller, path));
+
+    // Nothing is listening yet which must not get in the way of the poll.
+    assert_true(optics_poller_poll_at(poller, ++ts));
+
+    struct receiver *receiver = calloc(1, sizeof(*receiver));
+    receiver_listen(receiver, path);
+
+    optics_counter_inc(counter, 10);
+    optics_gauge_set(gauge, 1.5);
+    for (size_t i = 0; i < 100; ++i) optics_dist_record(dist, i);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+
+    receiver_accept(receiver);
+    receiver_read(receiver);
+    assert_int_equal(receiver->hellos, 1);
+    assert_int_equal(receiver->received, 7);
+
+    struct htable result = {0};
+    receiver_htable(receiver, &result);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.counter", 10),
+            make_kv("prefix.host.gauge", 1.5),
+            make_kv("prefix.host.dist.count", 100),
+            make_kv("prefix.host.dist.p50", 50),
+            make_kv("prefix.host.dist.p90", 90),
+            make_kv("prefix.host.dist.p99", 99),
+            make_kv("prefix.host.dist.max", 99));
+    htable_reset(&result);
+
+    // Only the changed values are sent: the dist is now empty, the counter is
+    // unchanged, the gauge is dropped and other is new.
+    struct optics_lens *other = optics_counter_create(optics, "other");
+    optics_counter_inc(counter, 10);
+    optics_counter_inc(other, 5);
+    optics_lens_close(gauge);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+    receiver_read(receiver);
+    assert_int_equal(receiver->hellos, 1);
+    assert_int_equal(receiver->received, 5 + 1);
+
+    receiver_htable(receiver, &result);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.counter", 10),
+            make_kv("prefix.host.other", 5),
+            make_kv("prefix.host.dist.count", 0),
+            make_kv("prefix.host.dist.p50", 0),
+            make_kv("prefix.host.dist.p90", 0),
+            make_kv("prefix.host.dist.p99", 0),
+            make_kv("prefix.host.dist.max", 0));
+    htable_reset(&result);
+
+    // Only other changes as it goes back to zero.
+    optics_counter_inc(counter, 10);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+    receiver_read(receiver);
+    assert_int_equal(receiver->received, 1);
+
+    // Changing the host resyncs everything.
+    optics_poller_set_host(poller, "other");
+    optics_counter_inc(counter, 10);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+    receiver_read(receiver);
+    assert_int_equal(receiver->hellos, 2);
+    assert_int_equal(receiver->received, 7);
+    assert_string_equal(receiver->host, "other");
+
+    // A dropped connection is reopened on the next poll with a full resync.
+    close(receiver->fd);
+    optics_counter_inc(counter, 10);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+    optics_counter_inc(counter, 10);
+    assert_true(optics_poller_poll_at(poller, ++ts));
+
+    receiver_accept(receiver);
+    receiver_read(receiver);
+    assert_int_equal(receiver->hellos, 3);
+    assert_int_equal(receiver->received, 7);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+
+    close(receiver->fd);
+    close(receiver->listen_fd);
+    free(receiver);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(backend_push_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -48,6 +48,337 @@ optics_test_head(backend_rest_basics_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// etag
+// -----------------------------------------------------------------------------
+
+static void get_etag(unsigned port, const char *path, char *etag, size_t len)
+{
+    struct http_client *client = http_connect(port);
+    http_req(client, "GET", path, NULL);
+    assert_true(http_assert_resp_header(client, 200, "etag", etag, len));
+    http_close(client);
+}
+
+static void assert_etag(unsigned port, const char *path, const char *etag, unsigned code)
+{
+    char header[128];
+    snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+
+    struct http_client *client = http_connect(port);
+    http_req_header(client, "GET", path, header);
+    assert_true(http_assert_resp(client, code, NULL));
+    http_close(client);
+}
+
+optics_test_head(backend_rest_etag_test)
+{
+    enum { port = 64124 };
+    const char *path = "/metrics/json";
+
+    struct optics *optics = optics_create(test_name);
+    optics_set_prefix(optics, "optics.tests");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_rest(poller, crest);
+    crest_bind(crest, port);
+
+    optics_gauge_set(gauge, 1.0);
+    if (!optics_poller_poll(poller)) optics_abort();
+
+    char etag[64];
+    get_etag(port, path, etag, sizeof(etag));
+    assert_etag(port, path, etag, 304);
+    assert_etag(port, path, "\"blah\"", 200);
+    assert_etag(port, path, "*", 304);
+
+    // Same values yield the same body and therefore the same etag.
+    if (!optics_poller_poll(poller)) optics_abort();
+    assert_etag(port, path, etag, 304);
+
+    optics_gauge_set(gauge, 2.0);
+    if (!optics_poller_poll(poller)) optics_abort();
+    assert_etag(port, path, etag, 200);
+
+    char next[64];
+    get_etag(port, path, next, sizeof(next));
+    assert_true(strcmp(etag, next));
+    assert_http_body(port, "GET", path, 200, "{\"optics.tests.host.gauge\":2}");
+
+    crest_free(crest);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// prefix
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_rest_prefix_test)
+{
+    enum { port = 64126 };
+
+    struct optics *optics = optics_create(test_name);
+    optics_set_prefix(optics, "optics");
+
+    const char *keys[] = { "a", "db.a", "db.b", "dbx", "web.a" };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+        optics_gauge_set(optics_gauge_create(optics, keys[i]), i);
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_rest(poller, crest);
+    crest_bind(crest, port);
+
+    assert_http_body(port, "GET", "/metrics/json/optics.host.db", 200, "{}");
+
+    if (!optics_poller_poll(poller)) optics_abort();
+
+    assert_http_body(port, "GET", "/metrics/json/optics.host.db.", 200,
+            "{\"optics.host.db.a\":1,\"optics.host.db.b\":2}");
+    assert_http_body(port, "GET", "/metrics/json/optics.host.db", 200,
+            "{\"optics.host.db.a\":1,\"optics.host.db.b\":2,\"optics.host.dbx\":3}");
+    assert_http_body(port, "GET", "/metrics/json?prefix=optics.host.web", 200,
+            "{\"optics.host.web.a\":4}");
+    assert_http_body(port, "GET", "/metrics/json/optics.host.z", 200, "{}");
+    assert_http_body(port, "GET", "/metrics/json/blah", 200, "{}");
+
+    crest_free(crest);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// prometheus
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_rest_prometheus_test)
+{
+    enum { port = 64125 };
+    const char *path = "/metrics";
+
+    struct optics *optics = optics_create(test_name);
+    optics_set_prefix(optics, "optics.tests");
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    const uint64_t buckets[] = {10, 20, 30};
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+    struct optics_lens *quantile = optics_quantile_create(optics, "quantile", .9, 50, 0.05);
+
+    // Both keys sanitize to the same family which is only typed once.
+    struct optics_lens *dup_a = optics_gauge_create(optics, "dup.gauge");
+    struct optics_lens *dup_b = optics_gauge_create(optics, "dup_gauge");
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_rest(poller, crest);
+    crest_bind(crest, port);
+
+    optics_gauge_set(dup_a, 1);
+    optics_gauge_set(dup_b, 2);
+    optics_counter_inc(counter, 10);
+    optics_gauge_set(gauge, 1.5);
+    optics_histo_inc(histo, 5);
+    optics_histo_inc(histo, 15);
+    optics_histo_inc(histo, 25);
+    optics_histo_inc(histo, 25);
+    optics_histo_inc(histo, 35);
+    optics_quantile_update(quantile, 10);
+    if (!optics_poller_poll(poller)) optics_abort();
+
+    assert_http_body(port, "GET", path, 200,
+            "# TYPE optics_tests_counter gauge\n"
+            "optics_tests_counter{host=\"host\"} 10\n"
+            "# TYPE optics_tests_dup_gauge gauge\n"
+            "optics_tests_dup_gauge{host=\"host\"} 1\n"
+            "optics_tests_dup_gauge{host=\"host\"} 2\n"
+            "# TYPE optics_tests_gauge gauge\n"
+            "optics_tests_gauge{host=\"host\"} 1.5\n"
+            "# TYPE optics_tests_histo_bucket gauge\n"
+            "optics_tests_histo_bucket{host=\"host\",le=\"10\"} 1\n"
+            "optics_tests_histo_bucket{host=\"host\",le=\"20\"} 2\n"
+            "optics_tests_histo_bucket{host=\"host\",le=\"30\"} 4\n"
+            "optics_tests_histo_bucket{host=\"host\",le=\"+Inf\"} 5\n"
+            "# TYPE optics_tests_histo_sum gauge\n"
+            "optics_tests_histo_sum{host=\"host\"} 105\n"
+            "# TYPE optics_tests_histo_count gauge\n"
+            "optics_tests_histo_count{host=\"host\"} 5\n"
+            "# TYPE optics_tests_quantile summary\n"
+            "optics_tests_quantile{host=\"host\",quantile=\"0.9\"} 50\n"
+            "optics_tests_quantile_count{host=\"host\"} 1\n");
+
+    {
+        char encoding[64];
+        struct http_client *client = http_connect(port);
+        http_req_header(client, "GET", path, "Accept-Encoding: gzip");
+        assert_true(http_assert_resp_header(
+                        client, 200, "content-encoding", encoding, sizeof(encoding)));
+        assert_string_equal(encoding, "gzip");
+        http_close(client);
+    }
+
+    crest_free(crest);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// prometheus families
+// -----------------------------------------------------------------------------
+
+// The host sits between the prefix and the key so instances whose prefixes only
+// differ by where the key starts interleave their families when sorted by key.
+optics_test_head(backend_rest_prometheus_families_test)
+{
+    enum { port = 64129 };
+
+    struct optics *a = optics_create("backend_rest_prometheus_families_test_a");
+    optics_set_prefix(a, "svc");
+    struct optics_lens *a_errors = optics_gauge_create(a, "db.errors");
+    struct optics_lens *a_latency = optics_gauge_create(a, "db.latency");
+
+    struct optics *b = optics_create("backend_rest_prometheus_families_test_b");
+    optics_set_prefix(b, "svc.db");
+    struct optics_lens *b_errors = optics_gauge_create(b, "errors");
+    struct optics_lens *b_latency = optics_gauge_create(b, "latency");
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(a);
+    assert_true(optics_poller_attach(poller, b));
+    optics_poller_set_host(poller, "host");
+    optics_dump_rest(poller, crest);
+    crest_bind(crest, port);
+
+    optics_gauge_set(a_errors, 1);
+    optics_gauge_set(a_latency, 2);
+    optics_gauge_set(b_errors, 3);
+    optics_gauge_set(b_latency, 4);
+    if (!optics_poller_poll(poller)) optics_abort();
+
+    assert_http_body(port, "GET", "/metrics", 200,
+            "# TYPE svc_db_errors gauge\n"
+            "svc_db_errors{host=\"host\"} 3\n"
+            "svc_db_errors{host=\"host\"} 1\n"
+            "# TYPE svc_db_latency gauge\n"
+            "svc_db_latency{host=\"host\"} 4\n"
+            "svc_db_latency{host=\"host\"} 2\n");
+
+    crest_free(crest);
+    assert_true(optics_poller_detach(poller, b));
+    optics_poller_free(poller);
+    optics_close(b);
+    optics_close(a);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// totals
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_rest_totals_test)
+{
+    enum { port = 64128 };
+
+    struct optics *optics = optics_create_at(test_name, 0);
+    optics_set_prefix(optics, "optics");
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_counter_totals(poller, true);
+    optics_dump_rest(poller, crest);
+    crest_bind(crest, port);
+
+    optics_counter_inc(counter, 10);
+    if (!optics_poller_poll_at(poller, 10)) optics_abort();
+    optics_counter_inc(counter, 20);
+    if (!optics_poller_poll_at(poller, 20)) optics_abort();
+
+    assert_http_body(port, "GET", "/metrics/json", 200,
+            "{\"optics.host.counter\":{\"rate\":2,\"total\":30,\"created\":10}}");
+    assert_http_body(port, "GET", "/metrics", 200,
+            "# TYPE optics_counter_total counter\n"
+            "optics_counter_total{host=\"host\"} 30\n"
+            "optics_counter_created{host=\"host\"} 10\n");
+
+    crest_free(crest);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// history
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_rest_history_test)
+{
+    enum { port = 64127 };
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "optics");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+
+    struct crest *crest = crest_new();
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_dump_rest_history(poller, crest, 3);
+    crest_bind(crest, port);
+
+    assert_http_code(port, "GET", "/metrics/history?key=optics.host.gauge", 404);
+
+    struct optics_lens *late = NULL;
+    for (size_t i = 1; i <= 5; ++i) {
+        if (i == 4) late = optics_gauge_create(optics, "late");
+        if (late) optics_gauge_set(late, i * 10);
+
+        optics_gauge_set(gauge, i);
+        optics_poller_poll_at(poller, ++ts);
+    }
+
+    assert_http_body(port, "GET", "/metrics/history?key=optics.host.gauge", 200,
+            "{\"ts\":[3,4,5],\"values\":[3,4,5]}");
+    assert_http_body(port, "GET", "/metrics/history?key=optics.host.gauge&n=2", 200,
+            "{\"ts\":[4,5],\"values\":[4,5]}");
+    assert_http_body(port, "GET", "/metrics/history?key=optics.host.gauge&n=10", 200,
+            "{\"ts\":[3,4,5],\"values\":[3,4,5]}");
+    assert_http_body(port, "GET", "/metrics/history?key=optics.host.late", 200,
+            "{\"ts\":[3,4,5],\"values\":[null,40,50]}");
+    assert_http_code(port, "GET", "/metrics/history?key=optics.host.blah", 404);
+    assert_http_code(port, "GET", "/metrics/history", 404);
+
+    // Keys are dropped once they fall out of the history.
+    optics_lens_close(late);
+    for (size_t i = 0; i < 3; ++i) optics_poller_poll_at(poller, ++ts);
+    assert_http_body(port, "GET", "/metrics/history?key=optics.host.late", 200,
+            "{\"ts\":[6,7,8],\"values\":[null,null,null]}");
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_http_code(port, "GET", "/metrics/history?key=optics.host.late", 404);
+
+    crest_free(crest);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -56,6 +387,12 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(backend_rest_basics_test),
+        cmocka_unit_test(backend_rest_etag_test),
+        cmocka_unit_test(backend_rest_prefix_test),
+        cmocka_unit_test(backend_rest_prometheus_test),
+        cmocka_unit_test(backend_rest_prometheus_families_test),
+        cmocka_unit_test(backend_rest_totals_test),
+        cmocka_unit_test(backend_rest_history_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
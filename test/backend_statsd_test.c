@@ -0,0 +1,207 @@
+/* backend_statsd_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include "utils/htable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static int statsd_listen_udp(const char *port)
+{
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo *addr;
+    assert_int_equal(getaddrinfo("127.0.0.1", port, &hints, &addr), 0);
+
+    int fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, 0);
+    assert_true(fd >= 0);
+    assert_int_equal(bind(fd, addr->ai_addr, addr->ai_addrlen), 0);
+
+    freeaddrinfo(addr);
+    return fd;
+}
+
+static int statsd_listen_unix(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    assert_true(fd >= 0);
+    assert_int_equal(bind(fd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+
+    return fd;
+}
+
+// Datagrams over loopback are queued by the time the poll returns so we only
+// need to drain the socket. Returns the number of datagrams read.
+static size_t statsd_parse(int fd, size_t mtu, struct htable *result)
+{
+    size_t packets = 0;
+    char buffer[64 * 1024];
+
+    ssize_t len;
+    while ((len = recv(fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
+        assert_true((size_t) len <= mtu);
+        buffer[len] = '\0';
+        packets++;
+
+        char *save = NULL;
+        for (char *line = strtok_r(buffer, "\n", &save); line;
+             line = strtok_r(NULL, "\n", &save))
+        {
+            char *value = strchr(line, ':');
+            assert_non_null(value);
+            *value = '\0';
+            value++;
+
+            char *tag = strstr(value, "|g|#host:host");
+            assert_non_null(tag);
+            assert_int_equal(tag[strlen("|g|#host:host")], '\0');
+
+            assert_true(htable_put(result, line, pun_dtoi(strtod(value, NULL))).ok);
+        }
+    }
+
+    return packets;
+}
+
+
+// -----------------------------------------------------------------------------
+// udp
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_statsd_udp_test)
+{
+    const char *port = "12348";
+    int fd = statsd_listen_udp(port);
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+
+    // Enough lenses to require multiple datagrams and sendmmsg batches.
+    enum { n = 1000, mtu = 512 };
+    struct optics_lens *lenses[n];
+    for (size_t i = 0; i < n; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "counter_%zu", i);
+        lenses[i] = optics_counter_create(optics, key);
+    }
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_false(optics_dump_statsd(poller, "127.0.0.1", port, 16));
+    assert_true(optics_dump_statsd(poller, "127.0.0.1", port, mtu));
+
+    for (size_t it = 0; it < 3; ++it) {
+        optics_gauge_set(gauge, it);
+        for (size_t i = 0; i < 100; ++i) optics_dist_record(dist, i);
+        for (size_t i = 0; i < n; ++i) optics_counter_inc(lenses[i], i);
+
+        if (!optics_poller_poll_at(poller, ++ts)) optics_abort();
+
+        struct htable result = {0};
+        size_t packets = statsd_parse(fd, mtu, &result);
+        assert_true(packets > n / (mtu / 32));
+        assert_int_equal(result.len, n + 6);
+
+        assert_float_equal(pun_itod(htable_get(&result, "prefix.gauge").value), it, 0);
+        assert_float_equal(pun_itod(htable_get(&result, "prefix.dist.count").value), 100, 0);
+        assert_float_equal(pun_itod(htable_get(&result, "prefix.dist.max").value), 99, 0);
+
+        for (size_t i = 0; i < n; ++i) {
+            char key[optics_name_max_len];
+            snprintf(key, sizeof(key), "prefix.counter_%zu", i);
+
+            struct htable_ret ret = htable_get(&result, key);
+            assert_true(ret.ok);
+            assert_float_equal(pun_itod(ret.value), i, 0);
+        }
+
+        htable_reset(&result);
+    }
+
+    optics_poller_free(poller);
+    optics_close(optics);
+    close(fd);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// unix
+// -----------------------------------------------------------------------------
+
+optics_test_head(backend_statsd_unix_test)
+{
+    const char *path = "/tmp/optics_statsd_test.sock";
+    int fd = statsd_listen_unix(path);
+
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    const uint64_t buckets[] = { 1, 2, 3 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_dump_statsd_unix(poller, path, 0));
+
+    optics_counter_inc(counter, 10);
+    for (size_t i = 0; i < 100; ++i) optics_histo_inc(histo, i % 5);
+    if (!optics_poller_poll_at(poller, ++ts)) optics_abort();
+
+    struct htable result = {0};
+    assert_int_equal(statsd_parse(fd, 8192, &result), 1);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.counter", 10),
+            make_kv("prefix.histo.below", 20),
+            make_kv("prefix.histo.above", 40),
+            make_kv("prefix.histo.bucket_1_2", 20),
+            make_kv("prefix.histo.bucket_2_3", 20));
+    htable_reset(&result);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+    close(fd);
+    unlink(path);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(backend_statsd_udp_test),
+        cmocka_unit_test(backend_statsd_unix_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -9,9 +9,15 @@
 #include "utils/thread.h"
 
 #include <time.h>
+#include <math.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 
 // -----------------------------------------------------------------------------
@@ -35,12 +41,136 @@ static double scale_elapsed(double t, char *s)
 
 
 
+// -----------------------------------------------------------------------------
+// perf
+// -----------------------------------------------------------------------------
+// Hardware counters are only collected if OPTICS_BENCH_PERF is set. Each
+// thread opens a group for the duration of a batch which only counts user
+// space events of the thread itself. Counters that can't be opened, usually
+// because of the PMU of a VM or perf_event_paranoid, are reported as missing.
+//
+// Contended cache line transfers (HITM) don't have a generic event and must be
+// measured with perf c2c.
+
+enum { bench_perf_len = 6 };
+
+static const struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} bench_perf_events[bench_perf_len] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "l1d_misses", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "dtlb_misses", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+static const uint64_t bench_perf_missing = -1UL;
+
+struct bench_perf
+{
+    int leader;
+    size_t len;
+    int fds[bench_perf_len];
+    size_t events[bench_perf_len];
+};
+
+static bool bench_perf_enabled()
+{
+    const char *env = getenv("OPTICS_BENCH_PERF");
+    return env && *env && *env != '0';
+}
+
+static int bench_perf_open_event(size_t event, int leader)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .type = bench_perf_events[event].type,
+        .config = bench_perf_events[event].config,
+        .disabled = leader < 0,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .read_format = PERF_FORMAT_GROUP,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+static void bench_perf_open(struct bench_perf *perf)
+{
+    static atomic_bool warned = false;
+
+    perf->leader = -1;
+    perf->len = 0;
+
+    for (size_t event = 0; event < bench_perf_len; ++event) {
+        int fd = bench_perf_open_event(event, perf->leader);
+        if (fd < 0) {
+            if (!atomic_exchange(&warned, true))
+                optics_warn_errno("unable to open perf event '%s'", bench_perf_events[event].name);
+            continue;
+        }
+
+        if (perf->leader < 0) perf->leader = fd;
+        perf->fds[perf->len] = fd;
+        perf->events[perf->len] = event;
+        perf->len++;
+    }
+}
+
+static void bench_perf_enable(struct bench_perf *perf)
+{
+    if (perf->leader < 0) return;
+    ioctl(perf->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void bench_perf_disable(struct bench_perf *perf)
+{
+    if (perf->leader < 0) return;
+    ioctl(perf->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void bench_perf_close(struct bench_perf *perf, uint64_t *counts)
+{
+    for (size_t event = 0; event < bench_perf_len; ++event)
+        counts[event] = bench_perf_missing;
+
+    if (perf->leader >= 0) {
+        struct { uint64_t nr; uint64_t values[bench_perf_len]; } group = {0};
+        ssize_t ret = read(perf->leader, &group, sizeof(group));
+
+        if (ret < 0) optics_warn_errno("unable to read perf events");
+        else {
+            for (size_t i = 0; i < group.nr && i < perf->len; ++i)
+                counts[perf->events[i]] = group.values[i];
+        }
+    }
+
+    for (size_t i = 0; i < perf->len; ++i) close(perf->fds[i]);
+    perf->leader = -1;
+    perf->len = 0;
+}
+
+
 // -----------------------------------------------------------------------------
 // optics_bench
 // -----------------------------------------------------------------------------
 
 struct optics_bench
 {
+    uint64_t *perf_counts;
+    struct bench_perf perf;
+
     void **setup_data;
     struct sbarrier *setup_barrier;
 
@@ -65,8 +195,11 @@ void optics_bench_start(struct optics_bench *bench)
     optics_assert(!bench->started, "bench started twice");
     bench->started = true;
 
+    if (bench->perf_counts) bench_perf_open(&bench->perf);
+
     if (bench->start_barrier) sbarrier_wait(bench->start_barrier);
 
+    if (bench->perf_counts) bench_perf_enable(&bench->perf);
     clock_monotonic(&bench->start);
 }
 
@@ -77,25 +210,103 @@ void optics_bench_stop(struct optics_bench *bench)
     clock_monotonic(&bench->stop);
     bench->stopped = true;
 
+    if (bench->perf_counts) {
+        bench_perf_disable(&bench->perf);
+        bench_perf_close(&bench->perf, bench->perf_counts);
+    }
+
     if (bench->stop_barrier) sbarrier_wait(bench->stop_barrier);
 }
 
 
 // -----------------------------------------------------------------------------
-// utils
+// histo
 // -----------------------------------------------------------------------------
+// Log-linear histogram of picoseconds per operation: values are bucketed by
+// their most significant bit and the next 6 bits which bounds the relative
+// error of every bucket to under 2%.
+
+enum
+{
+    bench_histo_sub_bits = 6,
+    bench_histo_sub = 1 << bench_histo_sub_bits,
+    bench_histo_len = (64 - bench_histo_sub_bits + 1) * bench_histo_sub,
+};
+
+struct bench_histo
+{
+    size_t count;
+    uint64_t max;
+    size_t counts[bench_histo_len];
+};
+
+static size_t bench_histo_index(uint64_t value)
+{
+    if (value < bench_histo_sub) return value;
+
+    size_t shift = (63 - __builtin_clzll(value)) - bench_histo_sub_bits;
+    return (shift + 1) * bench_histo_sub + ((value >> shift) & (bench_histo_sub - 1));
+}
+
+// Middle of the bucket's range.
+static uint64_t bench_histo_value(size_t index)
+{
+    if (index < bench_histo_sub) return index;
+
+    size_t shift = index / bench_histo_sub - 1;
+    uint64_t base = (uint64_t) (bench_histo_sub + index % bench_histo_sub) << shift;
+    return base + ((1UL << shift) >> 1);
+}
 
+static void bench_histo_record(struct bench_histo *histo, double nanos)
+{
+    uint64_t value = nanos * 1000.0;
 
-static double  sec() { return 1; }
-static double msec() { return  sec() / 1000; }
-static double usec() { return msec() / 1000; }
-static double nsec() { return usec() / 1000; }
+    histo->count++;
+    histo->counts[bench_histo_index(value)]++;
+    if (value > histo->max) histo->max = value;
+}
 
-static double bench_elapsed(struct optics_bench *bench)
+static double bench_histo_quantile(struct bench_histo *histo, double quantile)
+{
+    size_t target = ceil(histo->count * quantile);
+    if (!target) target = 1;
+
+    size_t sum = 0;
+    for (size_t i = 0; i < bench_histo_len; ++i) {
+        sum += histo->counts[i];
+        if (sum < target) continue;
+
+        uint64_t value = bench_histo_value(i);
+        return (value < histo->max ? value : histo->max) / 1000.0;
+    }
+
+    return histo->max / 1000.0;
+}
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+enum
+{
+    // Batches are made large enough to amortize the cost of reading the clock.
+    bench_batch_min = 10 * 1000,
+
+    // A bench stops once it measured enough or it spent too long in the setup
+    // of its batches but always collects enough batches for the p99.
+    bench_duration = 100 * 1000 * 1000,
+    bench_wall_max = 2UL * 1000 * 1000 * 1000,
+    bench_batches_min = 100,
+    bench_batches_max = 10 * 1000,
+};
+
+static double bench_delta(struct timespec *start, struct timespec *stop)
 {
     return
-        (bench->stop.tv_sec - bench->start.tv_sec) +
-        ((bench->stop.tv_nsec - bench->start.tv_nsec) * nsec());
+        (stop->tv_sec - start->tv_sec) * 1e9 +
+        (stop->tv_nsec - start->tv_nsec);
 }
 
 static double run_bench(
@@ -110,43 +321,106 @@ static double run_bench(
     if (!bench->stopped) optics_bench_stop(bench);
     optics_assert(bench->started, "bench_start was not called");
 
-    return bench_elapsed(bench);
+    return bench_delta(&bench->start, &bench->stop);
 }
 
-typedef void (* bench_policy) (optics_bench_fn_t, void *, size_t, size_t, double *);
+// perf is either NULL or holds bench_perf_len counters for every thread.
+typedef void (* bench_policy) (
+        optics_bench_fn_t, void *, size_t n, size_t threads, double *dist, uint64_t *perf);
 
-int cmp_elapsed(const void *_lhs, const void *_rhs)
+static double bench_avg(double *dist, size_t threads)
 {
-    double lhs = *((const double *) _lhs);
-    double rhs = *((const double *) _rhs);
-
-    if (lhs < rhs) return -1;
-    if (lhs > rhs) return 1;
-    return 0;
+    double sum = 0;
+    for (size_t i = 0; i < threads; ++i) sum += dist[i];
+    return sum / threads;
 }
 
+struct bench_result
+{
+    size_t n;
+    size_t batches;
 
-// Note that I'm aware that this calculates the quantiles over averages and that
-// in the process I'm making millions of statisticians cry out in agony.
-static void bench_report(
-        const char *title, size_t n, size_t threads, double *dist, size_t dist_len)
+    double mean;
+    double p50;
+    double p99;
+    double p999;
+    double max;
+
+    // Per operation or NaN if missing.
+    bool perf_enabled;
+    double perf[bench_perf_len];
+};
+
+static void bench_json(const char *title, size_t threads, struct bench_result *result)
 {
-    for (size_t i = 0; i < dist_len; ++i) dist[i] /= n;
-    qsort(dist, dist_len, sizeof(double), cmp_elapsed);
+    const char *path = getenv("OPTICS_BENCH_JSON");
+    if (!path || !*path) return;
 
-    char p0_mul = ' ';
-    double p0_val = scale_elapsed(dist[0], &p0_mul);
+    FILE *file = fopen(path, "a");
+    if (!file) {
+        optics_warn_errno("unable to open bench output '%s'", path);
+        return;
+    }
 
-    char p50_mul = ' ';
-    double p50_val = scale_elapsed(dist[dist_len / 2], &p50_mul);
+    fprintf(file,
+            "{\"title\":\"%s\",\"threads\":%lu,\"n\":%lu,\"batches\":%lu,"
+            "\"mean_ns\":%g,\"p50_ns\":%g,\"p99_ns\":%g,\"p999_ns\":%g,\"max_ns\":%g",
+            title, threads, result->n, result->batches,
+            result->mean, result->p50, result->p99, result->p999, result->max);
+
+    if (result->perf_enabled) {
+        for (size_t event = 0; event < bench_perf_len; ++event) {
+            if (isnan(result->perf[event]))
+                fprintf(file, ",\"%s\":null", bench_perf_events[event].name);
+            else fprintf(file, ",\"%s\":%g", bench_perf_events[event].name, result->perf[event]);
+        }
+    }
 
-    char p90_mul = ' ';
-    double p90_val = scale_elapsed(dist[(dist_len * 90) / 100], &p90_mul);
+    fprintf(file, "}\n");
 
-    printf("bench: %-30s  %4lu %8lu    p0:%6.2f%c    p50:%6.2f%c    p90:%6.2f%c\n",
-            title, threads, n, p0_val, p0_mul, p50_val, p50_mul, p90_val, p90_mul);
+    fclose(file);
 }
 
+static void bench_report(const char *title, size_t threads, struct bench_result *result)
+{
+    char mean_mul = ' ';
+    double mean_val = scale_elapsed(result->mean * 1e-9, &mean_mul);
+
+    char p50_mul = ' ';
+    double p50_val = scale_elapsed(result->p50 * 1e-9, &p50_mul);
+
+    char p99_mul = ' ';
+    double p99_val = scale_elapsed(result->p99 * 1e-9, &p99_mul);
+
+    char p999_mul = ' ';
+    double p999_val = scale_elapsed(result->p999 * 1e-9, &p999_mul);
+
+    char max_mul = ' ';
+    double max_val = scale_elapsed(result->max * 1e-9, &max_mul);
+
+    printf("bench: %-30s  %4lu %8lu    mean:%6.2f%c    p50:%6.2f%c    "
+            "p99:%6.2f%c    p99.9:%6.2f%c    max:%6.2f%c\n",
+            title, threads, result->n,
+            mean_val, mean_mul, p50_val, p50_mul, p99_val, p99_mul,
+            p999_val, p999_mul, max_val, max_mul);
+
+    if (result->perf_enabled) {
+        printf("       %-30s  ", "");
+        for (size_t event = 0; event < bench_perf_len; ++event) {
+            if (isnan(result->perf[event]))
+                printf("    %s:     -", bench_perf_events[event].name);
+            else printf("    %s:%6.2f", bench_perf_events[event].name, result->perf[event]);
+        }
+        printf("\n");
+    }
+
+    bench_json(title, threads, result);
+}
+
+// The batch size is doubled until a batch amortizes the clock reads after
+// which every batch of every thread adds its time per operation to the
+// histogram. The quantiles are therefore over batches of n operations while
+// the mean is exact.
 static void bench_runner(
         bench_policy pol,
         const char *title,
@@ -154,30 +428,73 @@ static void bench_runner(
         void *ctx,
         size_t threads)
 {
-    const double duration = 1 * msec();
-    const size_t iterations = 1000;
-
-    size_t dist_len = threads * iterations;
-    double dist[dist_len];
-    memset(dist, 0, dist_len * sizeof(double));
+    double dist[threads];
+    memset(dist, 0, threads * sizeof(double));
 
     size_t n = 1;
-    double elapsed = -1;
-    for (; elapsed < duration; n *= 2) {
+    while (true) {
         optics_assert(n < 100UL * 1000 * 1000 * 1000,
                 "bench doesn't scale with n");
 
-        pol(fn, ctx, n, threads, dist);
+        pol(fn, ctx, n, threads, dist, NULL);
+        if (bench_avg(dist, threads) >= bench_batch_min) break;
+        n *= 2;
+    }
+
+    struct bench_histo *histo = calloc(1, sizeof(*histo));
+    optics_assert_alloc(histo);
+
+    bool perf_enabled = bench_perf_enabled();
+    uint64_t perf[threads * bench_perf_len];
+    uint64_t perf_total[bench_perf_len];
+    memset(perf_total, 0, sizeof(perf_total));
+
+    struct timespec wall_start, wall_now;
+    clock_monotonic(&wall_start);
+
+    size_t batches = 0;
+    double total = 0, measured = 0;
+    while (batches < bench_batches_max) {
+        pol(fn, ctx, n, threads, dist, perf_enabled ? perf : NULL);
+        batches++;
 
-        elapsed = 0;
-        for (size_t i = 0; i < threads; ++i) elapsed += dist[i];
-        elapsed /= threads;
+        for (size_t i = 0; i < threads; ++i) {
+            total += dist[i];
+            bench_histo_record(histo, dist[i] / n);
+        }
+
+        for (size_t i = 0; perf_enabled && i < threads * bench_perf_len; ++i) {
+            uint64_t *sum = &perf_total[i % bench_perf_len];
+            if (perf[i] == bench_perf_missing) *sum = bench_perf_missing;
+            else if (*sum != bench_perf_missing) *sum += perf[i];
+        }
+        measured += bench_avg(dist, threads);
+
+        if (batches < bench_batches_min) continue;
+        if (measured >= bench_duration) break;
+
+        clock_monotonic(&wall_now);
+        if (bench_delta(&wall_start, &wall_now) >= bench_wall_max) break;
     }
 
-    for (size_t i = 0; i < iterations; ++i)
-        pol(fn, ctx, n, threads, &dist[i * threads]);
+    struct bench_result result = {
+        .n = n,
+        .batches = batches,
+        .mean = total / (batches * threads * n),
+        .p50 = bench_histo_quantile(histo, 0.50),
+        .p99 = bench_histo_quantile(histo, 0.99),
+        .p999 = bench_histo_quantile(histo, 0.999),
+        .max = histo->max / 1000.0,
+        .perf_enabled = perf_enabled,
+    };
 
-    bench_report(title, n, threads, dist, dist_len);
+    for (size_t event = 0; event < bench_perf_len; ++event) {
+        result.perf[event] = perf_total[event] == bench_perf_missing ? NAN :
+            (double) perf_total[event] / (batches * threads * n);
+    }
+    bench_report(title, threads, &result);
+
+    free(histo);
 }
 
 
@@ -186,18 +503,34 @@ static void bench_runner(
 // -----------------------------------------------------------------------------
 
 static void bench_st_policy(
-        optics_bench_fn_t fn, void *ctx, size_t n, size_t threads, double *dist)
+        optics_bench_fn_t fn, void *ctx, size_t n, size_t threads, double *dist, uint64_t *perf)
 {
     (void) threads;
 
     void *setup_data;
-    struct optics_bench bench = { .setup_data = &setup_data };
+    struct optics_bench bench = { .setup_data = &setup_data, .perf_counts = perf };
     *dist = run_bench(&bench, fn, ctx, 0, n);
 }
 
+// The calling thread is pinned to its current cpu for the duration of the bench
+// to avoid migrations in the middle of a batch. Threads of mt benches are
+// already pinned by run_threads.
 void optics_bench_st(const char *title, optics_bench_fn_t fn, void *ctx)
 {
+    cpu_set_t old, set;
+    bool pinned = !sched_getaffinity(0, sizeof(old), &old);
+
+    if (pinned) {
+        CPU_ZERO(&set);
+        CPU_SET(sched_getcpu(), &set);
+        pinned = !sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (!pinned) optics_warn_errno("unable to pin bench thread");
+
     bench_runner(bench_st_policy, title, fn, ctx, 1);
+
+    if (pinned && sched_setaffinity(0, sizeof(old), &old))
+        optics_warn_errno("unable to unpin bench thread");
 }
 
 
@@ -212,6 +545,7 @@ struct bench_mt
     optics_bench_fn_t fn;
 
     double *dist;
+    uint64_t *perf;
     void *setup_data;
     struct sbarrier setup_barrier;
     struct sbarrier start_barrier;
@@ -227,14 +561,15 @@ static void bench_thread(size_t id, void *ctx)
         .setup_barrier = &data->setup_barrier,
         .start_barrier = &data->start_barrier,
         .stop_barrier = &data->stop_barrier,
+        .perf_counts = data->perf ? &data->perf[id * bench_perf_len] : NULL,
     };
     data->dist[id] = run_bench(&bench, data->fn, data->ctx, id, data->n);
 }
 
 static void bench_mt_policy(
-        optics_bench_fn_t fn, void *ctx, size_t n, size_t threads, double *dist)
+        optics_bench_fn_t fn, void *ctx, size_t n, size_t threads, double *dist, uint64_t *perf)
 {
-    struct bench_mt data = { .fn = fn, .ctx = ctx, .n = n, .dist = dist };
+    struct bench_mt data = { .fn = fn, .ctx = ctx, .n = n, .dist = dist, .perf = perf };
     sbarrier_init(&data.setup_barrier, threads);
     sbarrier_init(&data.start_barrier, threads);
     sbarrier_init(&data.stop_barrier, threads);
@@ -246,3 +581,8 @@ void optics_bench_mt(const char *title, optics_bench_fn_t fn, void *ctx)
 {
     bench_runner(bench_mt_policy, title, fn, ctx, cpus());
 }
+
+void optics_bench_mt_n(const char *title, optics_bench_fn_t fn, void *ctx, size_t threads)
+{
+    bench_runner(bench_mt_policy, title, fn, ctx, threads);
+}
@@ -1,9 +1,6 @@
 /* bench.h
    Rémi Attab (remi.attab@gmail.com), 23 Jan 2016
    FreeBSD-style copyright and disclaimer apply
-
-   TODO: Framework needs to be reworked as it computes a distribution of
-   averages which is bad (tm).
 */
 
 #pragma once
@@ -13,6 +10,12 @@
 // -----------------------------------------------------------------------------
 // bench
 // -----------------------------------------------------------------------------
+// Reports the mean and the p50, p99, p99.9 and max of the time per operation
+// of the batches run by the bench. Each result is also appended as a line of
+// JSON to the file named by the OPTICS_BENCH_JSON environment variable if set.
+// Setting OPTICS_BENCH_PERF also reports the cycles, instructions, L1D and LLC
+// misses, the branch misses and the DTLB misses per operation from the
+// hardware counters.
 
 struct optics_bench;
 typedef void (* optics_bench_fn_t) (
@@ -24,3 +27,4 @@ void optics_bench_stop(struct optics_bench *);
 
 void optics_bench_st(const char *title, optics_bench_fn_t fn, void *ctx);
 void optics_bench_mt(const char *title, optics_bench_fn_t fn, void *ctx);
+void optics_bench_mt_n(const char *title, optics_bench_fn_t fn, void *ctx, size_t threads);
@@ -126,6 +126,37 @@ void printf_boundary_test(void **state)
 }
 
 
+// -----------------------------------------------------------------------------
+// numbers
+// -----------------------------------------------------------------------------
+
+void put_number_test(void **state)
+{
+    (void) state;
+    struct buffer buffer = {0};
+
+    // Enough to cross buffer_min_cap multiple times.
+    for (size_t i = 0; i < 100; ++i) {
+        buffer_put_u64(&buffer, UINT64_MAX);
+        buffer_put(&buffer, ' ');
+        buffer_put_i64(&buffer, INT64_MIN);
+        buffer_put(&buffer, ' ');
+        buffer_put_double(&buffer, -1.7976931348623157e308);
+        buffer_puts(&buffer, "\n");
+    }
+
+    const char line[] =
+        "18446744073709551615 -9223372036854775808 -1.7976931348623157e+308\n";
+    const size_t line_len = sizeof(line) - 1;
+
+    assert_int_equal(buffer.len, 100 * line_len);
+    for (size_t i = 0; i < 100; ++i)
+        assert_int_equal(memcmp(buffer.data + i * line_len, line, line_len), 0);
+
+    buffer_reset(&buffer);
+}
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -137,6 +168,7 @@ int main(void)
         cmocka_unit_test(write_test),
         cmocka_unit_test(printf_test),
         cmocka_unit_test(printf_boundary_test),
+        cmocka_unit_test(put_number_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -389,6 +389,123 @@ void microhttpd_test(void **state)
 }
 
 
+// -----------------------------------------------------------------------------
+// test - stream
+// -----------------------------------------------------------------------------
+
+struct test_stream
+{
+    const char *data;
+    size_t pos;
+    size_t released;
+};
+
+// Returns at most 3 bytes per call to span multiple reads.
+static size_t test_stream_read(void *ctx, char *dst, size_t len)
+{
+    struct test_stream *stream = ctx;
+
+    size_t n = strlen(stream->data + stream->pos);
+    if (n > 3) n = 3;
+    if (n > len) n = len;
+
+    memcpy(dst, stream->data + stream->pos, n);
+    stream->pos += n;
+    return n;
+}
+
+static void test_stream_release(void *ctx)
+{
+    struct test_stream *stream = ctx;
+    stream->released++;
+}
+
+static enum crest_result
+test_stream_get(void *ctx, struct crest_req *req, struct crest_resp *resp)
+{
+    (void) req;
+    crest_resp_write(resp, "discarded", 9);
+    crest_resp_write_stream(resp, test_stream_read, ctx, test_stream_release);
+    return crest_ok;
+}
+
+void stream_test(void **state)
+{
+    (void) state;
+    enum { port = 40124 };
+
+    struct crest *crest = crest_new();
+
+    struct test_stream stream = { .data = "hello streamed world" };
+    crest_add(crest, (struct crest_res) {
+                .path = "/test/stream",
+                .context = &stream,
+                .get = test_stream_get });
+
+    if (!crest_bind(crest, port)) optics_abort();
+
+    {
+        char encoding[64];
+        struct http_client *client = http_connect(port);
+        http_req(client, "GET", "/test/stream", NULL);
+        assert_true(http_assert_resp_header(
+                        client, 200, "transfer-encoding", encoding, sizeof(encoding)));
+        assert_string_equal(encoding, "chunked");
+        http_close(client);
+    }
+
+    stream.pos = 0;
+    assert_http_body(port, "GET", "/test/stream", 200, stream.data);
+
+    crest_free(crest);
+    assert_int_equal(stream.released, 2);
+}
+
+
+// -----------------------------------------------------------------------------
+// test - config
+// -----------------------------------------------------------------------------
+
+void config_test(void **state)
+{
+    (void) state;
+    enum { port = 40125, clients = 4 };
+
+    struct crest *crest = crest_new();
+
+    struct test_svc svc = { .exists = true, .get_result = crest_ok, .get_data = "hello" };
+    crest_add(crest, (struct crest_res) {
+                .path = "/test/config",
+                .context = &svc,
+                .exists = test_svc_exists,
+                .get = test_svc_get });
+
+    struct crest_config config = {
+        .threads = 2,
+        .connections_max = 16,
+        .connections_per_ip = 8,
+        .timeout = 5,
+        .nodelay = true,
+        .keepalive = true,
+    };
+    if (!crest_bind_config(crest, port, &config)) optics_abort();
+
+    // Concurrent connections are all served.
+    struct http_client *client[clients];
+    for (size_t i = 0; i < clients; ++i) {
+        client[i] = http_connect(port);
+        http_req(client[i], "GET", "/test/config", NULL);
+    }
+
+    for (size_t i = 0; i < clients; ++i) {
+        assert_true(http_assert_resp(client[i], 200, svc.get_data));
+        http_close(client[i]);
+    }
+
+    crest_free(crest);
+}
+
+
 // -----------------------------------------------------------------------------
 // test - main
 // -----------------------------------------------------------------------------
@@ -398,6 +515,8 @@ int main(void) {
         cmocka_unit_test(path_test),
         cmocka_unit_test(router_test),
         cmocka_unit_test(microhttpd_test),
+        cmocka_unit_test(stream_test),
+        cmocka_unit_test(config_test),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
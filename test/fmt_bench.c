@@ -0,0 +1,153 @@
+/* fmt_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+#include "utils/fmt.h"
+#include "utils/buffer.h"
+#include "utils/rng.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+enum { values_len = 1024 };
+
+// Mix of the rates, percentiles and counts that backends typically format.
+static double *make_values(void)
+{
+    double *values = calloc(values_len, sizeof(*values));
+    optics_assert_alloc(values);
+
+    struct rng rng = {0};
+    rng_seed_with(&rng, 0);
+
+    for (size_t i = 0; i < values_len; ++i) {
+        uint64_t x = rng_gen(&rng);
+        switch (i % 3) {
+        case 0: values[i] = x % 100000; break;
+        case 1: values[i] = (double) (x % 100000) / 60; break;
+        case 2: values[i] = rng_gen_range(&rng, 0, 1000000) / 1e9; break;
+        default: optics_abort();
+        }
+    }
+
+    return values;
+}
+
+
+// -----------------------------------------------------------------------------
+// double
+// -----------------------------------------------------------------------------
+
+void run_fmt_double_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    const double *values = data;
+    char str[fmt_double_len];
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t len = fmt_double(str, values[i % values_len]);
+        (void) len;
+        optics_no_opt_clobber();
+    }
+}
+
+void run_snprintf_double_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    const double *values = data;
+    char str[64];
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        int len = snprintf(str, sizeof(str), "%g", values[i % values_len]);
+        (void) len;
+        optics_no_opt_clobber();
+    }
+}
+
+void double_bench_st(optics_unused void **state)
+{
+    double *values = make_values();
+
+    optics_bench_st("fmt_double_bench", run_fmt_double_bench, values);
+    optics_bench_st("snprintf_double_bench", run_snprintf_double_bench, values);
+
+    free(values);
+}
+
+
+// -----------------------------------------------------------------------------
+// buffer
+// -----------------------------------------------------------------------------
+// Carbon line of a cached key which leaves only the value and timestamp to be
+// formatted.
+
+struct buffer_bench
+{
+    const double *values;
+    struct buffer buffer;
+};
+
+void run_buffer_put_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct buffer_bench *ctx = data;
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!(i % values_len)) ctx->buffer.len = 0;
+
+        buffer_put(&ctx->buffer, ' ');
+        buffer_put_double(&ctx->buffer, ctx->values[i % values_len]);
+        buffer_put(&ctx->buffer, ' ');
+        buffer_put_u64(&ctx->buffer, 1500000000 + i);
+        buffer_put(&ctx->buffer, '\n');
+    }
+}
+
+void run_buffer_printf_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct buffer_bench *ctx = data;
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!(i % values_len)) ctx->buffer.len = 0;
+        buffer_printf(&ctx->buffer, " %g %lu\n", ctx->values[i % values_len], 1500000000 + i);
+    }
+}
+
+void buffer_bench_st(optics_unused void **state)
+{
+    struct buffer_bench data = { .values = make_values() };
+
+    optics_bench_st("buffer_put_bench", run_buffer_put_bench, &data);
+    optics_bench_st("buffer_printf_bench", run_buffer_printf_bench, &data);
+
+    buffer_reset(&data.buffer);
+    free((double *) data.values);
+}
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(double_bench_st),
+        cmocka_unit_test(buffer_bench_st),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
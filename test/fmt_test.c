@@ -0,0 +1,170 @@
+/* fmt_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/fmt.h"
+#include "utils/rng.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+#define assert_fmt(fn, value, exp)                                      \
+    do {                                                                \
+        char str[64] = {0};                                             \
+        size_t len = fn(str, value);                                    \
+        assert_string_equal(str, exp);                                  \
+        assert_int_equal(len, strlen(exp));                             \
+    } while (false)
+
+// Number of significant digits in a formatted double.
+static size_t fmt_significant(const char *str)
+{
+    size_t first = 0, last = 0, n = 0;
+    for (const char *it = str; *it && *it != 'e'; ++it) {
+        if (*it < '0' || *it > '9') continue;
+        n++;
+        if (*it != '0') {
+            if (!first) first = n;
+            last = n;
+        }
+    }
+    return first ? last - first + 1 : 1;
+}
+
+// Reference shortest round-trip precision found by brute force.
+static size_t printf_significant(double value)
+{
+    char str[64];
+    for (int precision = 1; precision < 17; ++precision) {
+        snprintf(str, sizeof(str), "%.*e", precision - 1, value);
+        if (strtod(str, NULL) == value) return precision;
+    }
+    return 17;
+}
+
+
+// -----------------------------------------------------------------------------
+// integers
+// -----------------------------------------------------------------------------
+
+optics_test_head(fmt_int_test)
+{
+    assert_fmt(fmt_u64, 0, "0");
+    assert_fmt(fmt_u64, 9, "9");
+    assert_fmt(fmt_u64, 10, "10");
+    assert_fmt(fmt_u64, 99, "99");
+    assert_fmt(fmt_u64, 100, "100");
+    assert_fmt(fmt_u64, 1234567890, "1234567890");
+    assert_fmt(fmt_u64, UINT64_MAX, "18446744073709551615");
+
+    assert_fmt(fmt_i64, 0, "0");
+    assert_fmt(fmt_i64, -1, "-1");
+    assert_fmt(fmt_i64, -120, "-120");
+    assert_fmt(fmt_i64, INT64_MAX, "9223372036854775807");
+    assert_fmt(fmt_i64, INT64_MIN, "-9223372036854775808");
+
+    struct rng rng = {0};
+    rng_seed_with(&rng, 0);
+
+    for (size_t i = 0; i < 100 * 1000; ++i) {
+        int64_t value = rng_gen(&rng) >> (i % 64);
+        if (i % 2) value = -value;
+
+        char exp[64];
+        snprintf(exp, sizeof(exp), "%ld", value);
+        assert_fmt(fmt_i64, value, exp);
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// double
+// -----------------------------------------------------------------------------
+
+optics_test_head(fmt_double_layout_test)
+{
+    assert_fmt(fmt_double, 0.0, "0");
+    assert_fmt(fmt_double, -0.0, "-0");
+    assert_fmt(fmt_double, 1, "1");
+    assert_fmt(fmt_double, -1, "-1");
+    assert_fmt(fmt_double, 100, "100");
+    assert_fmt(fmt_double, 1234.5, "1234.5");
+    assert_fmt(fmt_double, 0.5, "0.5");
+    assert_fmt(fmt_double, 0.1, "0.1");
+    assert_fmt(fmt_double, 0.3, "0.3");
+    assert_fmt(fmt_double, 1.0 / 3, "0.3333333333333333");
+    assert_fmt(fmt_double, 4.35, "4.35");
+    assert_fmt(fmt_double, 9007199254740992.0, "9007199254740992");
+
+    assert_fmt(fmt_double, 0.000001, "0.000001");
+    assert_fmt(fmt_double, 0.0000015, "0.0000015");
+    assert_fmt(fmt_double, 1e-7, "1e-07");
+    assert_fmt(fmt_double, 1.5e-7, "1.5e-07");
+    assert_fmt(fmt_double, 1e20, "100000000000000000000");
+    assert_fmt(fmt_double, 1e21, "1e+21");
+    assert_fmt(fmt_double, -1.25e100, "-1.25e+100");
+
+    assert_fmt(fmt_double, 5e-324, "5e-324");
+    assert_fmt(fmt_double, 2.2250738585072014e-308, "2.2250738585072014e-308");
+    assert_fmt(fmt_double, 1.7976931348623157e308, "1.7976931348623157e+308");
+    assert_fmt(fmt_double, -1.7976931348623157e308, "-1.7976931348623157e+308");
+
+    assert_fmt(fmt_double, NAN, "nan");
+    assert_fmt(fmt_double, INFINITY, "inf");
+    assert_fmt(fmt_double, -INFINITY, "-inf");
+}
+optics_test_tail()
+
+// Random bit patterns cover every exponent while the small integers and ratios
+// cover the values that metrics usually take.
+optics_test_head(fmt_double_roundtrip_test)
+{
+    struct rng rng = {0};
+    rng_seed_with(&rng, 0);
+
+    for (size_t i = 0; i < 1000 * 1000; ++i) {
+        uint64_t bits = rng_gen(&rng);
+
+        double value;
+        switch (i % 3) {
+        case 0: value = pun_itod(bits); break;
+        case 1: value = bits >> (bits % 64); break;
+        case 2: value = (double) (bits % 1000000) / (bits % 997 + 1); break;
+        default: optics_abort();
+        }
+        if (!isfinite(value)) continue;
+
+        char str[fmt_double_len + 1] = {0};
+        size_t len = fmt_double(str, value);
+        assert_true(len <= fmt_double_len);
+
+        double parsed = strtod(str, NULL);
+        optics_assert(parsed == value && signbit(parsed) == signbit(value),
+                "%s != %.17g", str, value);
+
+        size_t digits = fmt_significant(str), exp = printf_significant(value);
+        optics_assert(digits == exp, "%s: %zu != %zu digits", str, digits, exp);
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(fmt_int_test),
+        cmocka_unit_test(fmt_double_layout_test),
+        cmocka_unit_test(fmt_double_roundtrip_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
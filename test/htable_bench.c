@@ -31,6 +31,22 @@ name_t * make_names(size_t len)
     return names;
 }
 
+// Keys share a long common prefix which is the worst case for both the hashing
+// and the key comparisons.
+name_t * make_long_names(size_t len)
+{
+    name_t *names = malloc(len * sizeof(name_t));
+    optics_assert_alloc(names);
+
+    for (size_t i = 0; i < len; ++i) {
+        size_t n = sizeof(names[i]) - 32;
+        memset(names[i], 'k', n);
+        snprintf(names[i] + n, sizeof(names[i]) - n, "-%lu", i);
+    }
+
+    return names;
+}
+
 
 // -----------------------------------------------------------------------------
 // get
@@ -70,6 +86,75 @@ void get_bench_st(optics_unused void **state)
 }
 
 
+void get_long_bench_st(optics_unused void **state)
+{
+    enum { max_len = 100000 };
+    name_t *names = make_long_names(max_len);
+
+    for (size_t len = 1; len < max_len; len *= 10) {
+        char title[256];
+        snprintf(title, sizeof(title), "get_long_%lu_bench", len);
+
+        struct htable ht = {0};
+        for (size_t i = 0; i < len; ++i) htable_put(&ht, names[i], 1);
+
+        struct htable_bench data = { &ht, len, names };
+        optics_bench_st(title, run_get_bench, &data);
+
+        htable_reset(&ht);
+    }
+
+    free(names);
+}
+
+// Tables are pre-sized and then filled up to the target load factor, or as
+// close to it as possible without triggering a resize, such that most lookups
+// have to probe through several occupied buckets.
+static void fill_load(struct htable *ht, name_t *names, size_t len)
+{
+    htable_reserve(ht, 1 << 12);
+    for (size_t i = 0; i < len; ++i) htable_put(ht, names[i], 1);
+}
+
+void get_load_bench_st(optics_unused void **state)
+{
+    enum { max_len = 100000 };
+    name_t *names = make_names(max_len);
+
+    const size_t loads[] = { 10, 20, 30, 40 };
+
+    for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); ++i) {
+        size_t cap = 0, len = 0;
+        {
+            struct htable ht = {0};
+            fill_load(&ht, names, 0);
+            cap = ht.cap;
+
+            while (len * 100 < cap * loads[i]) {
+                htable_put(&ht, names[len], 1);
+                if (ht.cap != cap) break;
+                len++;
+            }
+
+            htable_reset(&ht);
+        }
+
+        struct htable ht = {0};
+        fill_load(&ht, names, len);
+
+        char title[256];
+        snprintf(title, sizeof(title), "get_load_%lu_bench", ht.len * 100 / ht.cap);
+
+        struct htable_bench data = { &ht, len, names };
+        optics_bench_st(title, run_get_bench, &data);
+
+        htable_reset(&ht);
+    }
+
+    free(names);
+}
+
+
 // -----------------------------------------------------------------------------
 // put
 // -----------------------------------------------------------------------------
@@ -116,6 +201,8 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(get_bench_st),
+        cmocka_unit_test(get_long_bench_st),
+        cmocka_unit_test(get_load_bench_st),
         cmocka_unit_test(put_bench_st),
     };
 
@@ -180,6 +180,59 @@ void put_test(void **state)
 }
 
 
+// -----------------------------------------------------------------------------
+// prehashed
+// -----------------------------------------------------------------------------
+
+void get_h_test(void **state)
+{
+    (void) state;
+    struct htable ht = {0};
+
+    for (size_t i = 0; i < 100; ++i) {
+        char key[256];
+        snprintf(key, sizeof(key), "key-%lu", i);
+        assert_true(htable_put(&ht, key, i).ok);
+    }
+
+    for (size_t i = 0; i < 100; ++i) {
+        char key[256];
+        snprintf(key, sizeof(key), "key-%lu", i);
+
+        uint64_t hash = htable_hash(key);
+        assert_htable_ret(htable_get_h(&ht, key, hash), true, i);
+
+        // A mismatched hash hides the key even if the string is identical.
+        assert_false(htable_get_h(&ht, key, hash + 1).ok);
+    }
+
+    htable_reset(&ht);
+}
+
+void long_key_test(void **state)
+{
+    (void) state;
+    struct htable ht = {0};
+
+    char key[htable_key_max_len * 2];
+    memset(key, 'a', sizeof(key));
+    key[sizeof(key) - 1] = '\0';
+
+    // Only the first htable_key_max_len characters are significant.
+    uint64_t hash = htable_hash(key);
+    key[htable_key_max_len] = 'b';
+    assert_int_equal(htable_hash(key), hash);
+    key[htable_key_max_len - 1] = 'b';
+    assert_int_not_equal(htable_hash(key), hash);
+
+    assert_true(htable_put(&ht, key, 10).ok);
+    assert_htable_ret(htable_get(&ht, key), true, 10);
+    assert_htable_ret(htable_del(&ht, key), true, 10);
+
+    htable_reset(&ht);
+}
+
+
 // -----------------------------------------------------------------------------
 // hash test
 // -----------------------------------------------------------------------------
@@ -275,6 +328,8 @@ int main(void)
         cmocka_unit_test(resize_test),
         cmocka_unit_test(foreach_test),
         cmocka_unit_test(put_test),
+        cmocka_unit_test(get_h_test),
+        cmocka_unit_test(long_key_test),
         cmocka_unit_test(hash_quality_test),
         cmocka_unit_test(htable_dist_test),
     };
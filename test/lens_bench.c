@@ -100,6 +100,46 @@ optics_test_head(lens_get_bench)
 optics_test_tail()
 
 
+void run_get_cached_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+
+    struct get_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i)
+        optics_lens_get_cached(bench->optics, bench->list[i % bench->list_len].name);
+}
+
+optics_test_head(lens_get_cached_bench)
+{
+    for (size_t count = 1; count <= 32; count *= 2) {
+        struct optics *optics = optics_create(test_name);
+
+        struct bench_lens *list = make_lenses(optics, count, 0);
+        struct get_bench bench = {
+            .optics = optics,
+            .list = list,
+            .list_len = count,
+        };
+
+        char buffer[256];
+
+        snprintf(buffer, sizeof(buffer), "%s_%lu_st", test_name, count);
+        optics_bench_st(buffer, run_get_cached_bench, &bench);
+
+        if (cpus() >= 2) {
+            snprintf(buffer, sizeof(buffer), "%s_%lu_mt", test_name, count);
+            optics_bench_mt(buffer, run_get_cached_bench, &bench);
+        }
+
+        optics_close(optics);
+        free(list);
+    }
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // alloc bench
 // -----------------------------------------------------------------------------
@@ -139,6 +179,95 @@ optics_test_head(lens_alloc_bench_mt)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// batch bench
+// -----------------------------------------------------------------------------
+
+void run_open_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct optics *optics = optics_create(data);
+    struct bench_lens *list = make_names(n, id);
+
+    {
+        optics_bench_start(b);
+
+        for (size_t i = 0; i < n; ++i)
+            list[i].lens = optics_counter_open(optics, list[i].name);
+
+        optics_bench_stop(b);
+    }
+
+    optics_close(optics);
+    free(list);
+}
+
+void run_open_batch_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct optics *optics = optics_create(data);
+    struct bench_lens *list = make_names(n, id);
+
+    struct optics_lens_spec *specs = calloc(n, sizeof(*specs));
+    struct optics_lens **lenses = calloc(n, sizeof(*lenses));
+    for (size_t i = 0; i < n; ++i)
+        specs[i] = (struct optics_lens_spec) { .type = optics_counter, .name = list[i].name };
+
+    {
+        optics_bench_start(b);
+
+        optics_lens_open_batch(optics, specs, n, lenses);
+
+        optics_bench_stop(b);
+    }
+
+    optics_close(optics);
+    free(lenses);
+    free(specs);
+    free(list);
+}
+
+optics_test_head(lens_open_bench_st)
+{
+    optics_bench_st(test_name, run_open_bench, (void *) test_name);
+}
+optics_test_tail()
+
+optics_test_head(lens_open_batch_bench_st)
+{
+    optics_bench_st(test_name, run_open_batch_bench, (void *) test_name);
+}
+optics_test_tail()
+
+// Every thread opens the same lenses which is the pattern of a connection storm
+// where each connection opens the counters of its endpoint.
+void run_open_bench_mt(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct optics *optics = NULL;
+    if (!id) optics = optics_create(data);
+    optics = optics_bench_setup(b, optics);
+
+    struct bench_lens *list = make_names(n, 0);
+
+    {
+        optics_bench_start(b);
+
+        for (size_t i = 0; i < n; ++i)
+            list[i].lens = optics_counter_open(optics, list[i].name);
+
+        optics_bench_stop(b);
+    }
+
+    if (!id) optics_close(optics);
+    free(list);
+}
+
+optics_test_head(lens_open_bench_mt)
+{
+    assert_mt();
+    optics_bench_mt(test_name, run_open_bench_mt, (void *) test_name);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // free bench
 // -----------------------------------------------------------------------------
@@ -222,8 +351,12 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(lens_get_bench),
+        cmocka_unit_test(lens_get_cached_bench),
         cmocka_unit_test(lens_alloc_bench_st),
         cmocka_unit_test(lens_alloc_bench_mt),
+        cmocka_unit_test(lens_open_bench_st),
+        cmocka_unit_test(lens_open_bench_mt),
+        cmocka_unit_test(lens_open_batch_bench_st),
 
         // Setup time for these benches is too long for the number of runs.
         /* cmocka_unit_test(lens_free_bench_st), */
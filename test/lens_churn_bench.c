@@ -0,0 +1,222 @@
+/* lens_churn_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+#include "utils/rng.h"
+#include "utils/time.h"
+#include "utils/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// -----------------------------------------------------------------------------
+// churn
+// -----------------------------------------------------------------------------
+// Production pattern of per-connection lenses: threads keep closing a lens and
+// opening a lens under a new name in its place while recording to the others
+// and while a background optics_thread polls and reclaims the deferred frees.
+// Reports the latency percentiles of the opens and closes, the growth of the
+// resident memory over the churn and the time taken by the polls as the number
+// of live lenses grows.
+
+enum
+{
+    // Connection threads usually outnumber the cpus.
+    churn_threads_per_cpu = 4,
+
+    churn_ops = 100 * 1000,
+    churn_records = 8,
+};
+
+static const uint64_t churn_poll_period = 10 * 1000 * 1000;
+
+struct churn_bench
+{
+    struct optics *optics;
+    struct optics_lens **lenses;
+    size_t lenses_len;
+
+    size_t threads;
+    size_t ops;
+    uint64_t *opens;
+    uint64_t *closes;
+
+    // Only written by the poll thread and read once it's stopped.
+    uint64_t poll_start;
+    uint64_t poll_total;
+    uint64_t poll_max;
+    size_t polls;
+};
+
+static uint64_t churn_now(void)
+{
+    struct timespec ts;
+    clock_monotonic(&ts);
+    return ts.tv_sec * 1000UL * 1000 * 1000 + ts.tv_nsec;
+}
+
+static size_t churn_rss(void)
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+
+    size_t pages = 0, rss = 0;
+    if (fscanf(file, "%zu %zu", &pages, &rss) != 2) rss = 0;
+    fclose(file);
+
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void churn_backend_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    (void) poll;
+    struct churn_bench *bench = ctx;
+
+    if (type == optics_poll_begin) bench->poll_start = churn_now();
+    else if (type == optics_poll_done) {
+        uint64_t elapsed = churn_now() - bench->poll_start;
+        bench->poll_total += elapsed;
+        if (elapsed > bench->poll_max) bench->poll_max = elapsed;
+        bench->polls++;
+    }
+}
+
+// Every thread owns a contiguous slice of the lenses which it churns and
+// records to.
+static void run_churn(size_t id, void *ctx)
+{
+    struct churn_bench *bench = ctx;
+
+    size_t slice = bench->lenses_len / bench->threads;
+    struct optics_lens **lenses = bench->lenses + id * slice;
+    uint64_t *opens = bench->opens + id * bench->ops;
+    uint64_t *closes = bench->closes + id * bench->ops;
+
+    struct rng rng;
+    rng_seed_with(&rng, id);
+
+    for (size_t op = 0; op < bench->ops; ++op) {
+        size_t i = rng_gen_range(&rng, 0, slice);
+
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "lens_%zu_%zu_%zu", id, i, op);
+
+        uint64_t start = churn_now();
+        if (!optics_lens_close(lenses[i])) optics_abort();
+        uint64_t mid = churn_now();
+        if (!(lenses[i] = optics_counter_open(bench->optics, key))) optics_abort();
+        uint64_t end = churn_now();
+
+        closes[op] = mid - start;
+        opens[op] = end - mid;
+
+        for (size_t j = 0; j < churn_records; ++j)
+            optics_counter_inc(lenses[rng_gen_range(&rng, 0, slice)], 1);
+    }
+}
+
+static int churn_cmp(const void *lhs, const void *rhs)
+{
+    uint64_t a = *(const uint64_t *) lhs, b = *(const uint64_t *) rhs;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static void churn_report(const char *title, size_t len, uint64_t *samples, size_t n)
+{
+    qsort(samples, n, sizeof(*samples), churn_cmp);
+
+    printf("bench: %-30s  %8zu    p50:%8.2fus    p99:%8.2fus    p99.9:%8.2fus    max:%8.2fus\n",
+            title, len,
+            samples[n / 2] / 1e3,
+            samples[(n * 99) / 100] / 1e3,
+            samples[(n * 999) / 1000] / 1e3,
+            samples[n - 1] / 1e3);
+}
+
+static void run_churn_bench(const char *title, size_t len)
+{
+    size_t threads = cpus() * churn_threads_per_cpu;
+
+    struct churn_bench bench = {
+        .optics = optics_create(title),
+        .lenses_len = len,
+        .threads = threads,
+        .ops = churn_ops / threads,
+    };
+
+    bench.lenses = calloc(len, sizeof(*bench.lenses));
+    bench.opens = calloc(threads * bench.ops, sizeof(*bench.opens));
+    bench.closes = calloc(threads * bench.ops, sizeof(*bench.closes));
+    optics_assert_alloc(bench.lenses);
+    optics_assert_alloc(bench.opens);
+    optics_assert_alloc(bench.closes);
+
+    for (size_t i = 0; i < len; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "lens_%zu", i);
+        if (!(bench.lenses[i] = optics_counter_create(bench.optics, key))) optics_abort();
+    }
+
+    struct optics_poller *poller = optics_poller_alloc(bench.optics);
+    optics_poller_backend(poller, &bench, churn_backend_cb, NULL);
+    struct optics_thread *thread = optics_thread_start_nanos(poller, churn_poll_period);
+    if (!thread) optics_abort();
+
+    size_t rss = churn_rss();
+    uint64_t start = churn_now();
+
+    run_threads(run_churn, &bench, threads);
+
+    uint64_t elapsed = churn_now() - start;
+    double growth = (double) churn_rss() - (double) rss;
+
+    size_t missed = optics_thread_missed(thread);
+    optics_thread_stop(thread);
+
+    size_t n = threads * bench.ops;
+    churn_report("lens_churn_open_bench", len, bench.opens, n);
+    churn_report("lens_churn_close_bench", len, bench.closes, n);
+
+    printf("bench: %-30s  %8zu    ops:%zu    threads:%zu    elapsed:%8.2fms    rss:%+8.2fMB\n",
+            "lens_churn_memory_bench", len, n, threads, elapsed / 1e6, growth / 1e6);
+
+    printf("bench: %-30s  %8zu    polls:%zu    poll:%8.2fms    max:%8.2fms    missed:%zu\n",
+            "lens_churn_poll_bench", len, bench.polls,
+            bench.polls ? bench.poll_total / bench.polls / 1e6 : 0, bench.poll_max / 1e6,
+            missed);
+
+    optics_poller_free(poller);
+    for (size_t i = 0; i < len; ++i) optics_lens_close(bench.lenses[i]);
+    optics_close(bench.optics);
+
+    free(bench.closes);
+    free(bench.opens);
+    free(bench.lenses);
+}
+
+optics_test_head(lens_churn_bench)
+{
+    const size_t sizes[] = { 10 * 1000, 100 * 1000, 1000 * 1000 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        run_churn_bench(test_name, sizes[i]);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_churn_bench),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -55,6 +55,120 @@ optics_test_head(lens_counter_record_bench_mt)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// local bench
+// -----------------------------------------------------------------------------
+
+void run_local_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct counter_bench *bench = data;
+
+    struct optics_counter_local local;
+    optics_counter_local_init(&local, bench->lens, 0);
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i)
+        optics_counter_local_inc(&local, 1);
+
+    optics_counter_local_flush(&local);
+}
+
+optics_test_head(lens_counter_local_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct counter_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_local_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_counter_local_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct counter_bench bench = { optics, lens };
+    optics_bench_mt(test_name, run_local_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// handle bench
+// -----------------------------------------------------------------------------
+
+void run_handle_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct counter_bench *bench = data;
+
+    optics_counter_t handle;
+    optics_counter_handle(&handle, bench->lens);
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i)
+        optics_counter_handle_inc(&handle, 1);
+}
+
+optics_test_head(lens_counter_handle_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct counter_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_handle_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_counter_handle_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct counter_bench bench = { optics, lens };
+    optics_bench_mt(test_name, run_handle_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// scaling bench
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_counter_scaling_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+    struct optics_lens *sharded = optics_counter_sharded_create(optics, "my_sharded");
+
+    struct counter_bench bench = { optics, lens };
+    struct counter_bench bench_sharded = { optics, sharded };
+
+    for (size_t threads = 2; threads <= cpus(); threads *= 2) {
+        optics_bench_mt_n("counter_scaling", run_record_bench, &bench, threads);
+        optics_bench_mt_n("counter_sharded_scaling", run_record_bench, &bench_sharded, threads);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // read bench
 // -----------------------------------------------------------------------------
@@ -147,6 +261,11 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(lens_counter_record_bench_st),
         cmocka_unit_test(lens_counter_record_bench_mt),
+        cmocka_unit_test(lens_counter_scaling_bench_mt),
+        cmocka_unit_test(lens_counter_local_bench_st),
+        cmocka_unit_test(lens_counter_local_bench_mt),
+        cmocka_unit_test(lens_counter_handle_bench_st),
+        cmocka_unit_test(lens_counter_handle_bench_mt),
         cmocka_unit_test(lens_counter_read_bench_st),
         cmocka_unit_test(lens_counter_read_bench_mt),
         cmocka_unit_test(lens_counter_mixed_bench_mt),
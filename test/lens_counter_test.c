@@ -248,6 +248,389 @@ optics_test_head(lens_counter_epoch_mt_test)
 optics_test_tail()
 
 
+optics_test_head(lens_counter_sharded_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_sharded_create(optics, "my_counter");
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// sharded
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_counter_sharded_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_counter";
+
+    struct optics_lens *lens = optics_counter_sharded_create(optics, lens_name);
+    assert_non_null(lens);
+    assert_int_equal(optics_lens_type(lens), optics_counter);
+    assert_null(optics_counter_sharded_create(optics, lens_name));
+    assert_true(optics_counter_sharded_open(optics, lens_name) == lens);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+    assert_read(lens, epoch, 0);
+
+    optics_counter_inc(lens, 1);
+    optics_counter_inc(lens, 20);
+    optics_counter_inc(lens, -2);
+    assert_read(lens, epoch, 19);
+    assert_read(lens, epoch, 0);
+
+    for (size_t i = 1; i < 5; ++i) {
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        optics_counter_inc(lens, i);
+
+        assert_read(lens, epoch, i - 1);
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// peek
+// -----------------------------------------------------------------------------
+
+#define assert_delta(lens, cursor, exp)                                 \
+    do {                                                                \
+        int64_t delta = 0;                                              \
+        assert_int_equal(optics_counter_delta(lens, cursor, &delta), optics_ok); \
+        assert_int_equal(delta, exp);                                   \
+    } while (false)
+
+optics_test_head(lens_counter_peek_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *lenses[] = {
+        optics_counter_create(optics, "my_counter"),
+        optics_counter_sharded_create(optics, "my_sharded"),
+    };
+
+    for (size_t i = 0; i < 2; ++i) {
+        struct optics_lens *lens = lenses[i];
+        struct optics_counter_cursor fast = {0}, slow = {0};
+
+        int64_t value = -1;
+        assert_int_equal(optics_counter_peek(lens, &value), optics_ok);
+        assert_int_equal(value, 0);
+
+        optics_counter_inc(lens, 10);
+        assert_delta(lens, &fast, 10);
+
+        // Polling moves the values to the total without affecting the peeks.
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        optics_counter_inc(lens, 5);
+        assert_read(lens, epoch, 10);
+        assert_delta(lens, &fast, 5);
+
+        optics_counter_inc(lens, -3);
+        assert_delta(lens, &fast, -3);
+        assert_delta(lens, &fast, 0);
+
+        epoch = optics_epoch_inc(optics);
+        assert_read(lens, epoch, 2);
+
+        // Consumers don't interfere with each other.
+        assert_delta(lens, &slow, 12);
+        assert_delta(lens, &slow, 0);
+
+        assert_int_equal(optics_counter_peek(lens, &value), optics_ok);
+        assert_int_equal(value, 12);
+    }
+
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    int64_t value = 0;
+    assert_int_equal(optics_counter_peek(gauge, &value), optics_err);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+struct peek_test
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    size_t workers;
+
+    atomic_size_t done;
+};
+
+// Worker 0 polls the counter while worker 1 peeks at it concurrently with the
+// writers.
+void run_peek_test(size_t id, void *ctx)
+{
+    struct peek_test *test = ctx;
+    enum { iterations = 1000 * 1000 };
+    size_t writers = test->workers - 2;
+
+    if (id == 0) {
+        while (atomic_load_explicit(&test->done, memory_order_acquire) < writers) {
+            int64_t value = 0;
+            optics_epoch_t epoch = optics_epoch_inc(test->optics);
+            assert_int_equal(optics_counter_read(test->lens, epoch, &value), optics_ok);
+        }
+    }
+
+    else if (id == 1) {
+        struct optics_counter_cursor cursor = {0};
+        int64_t sum = 0, delta = 0;
+
+        while (atomic_load_explicit(&test->done, memory_order_acquire) < writers) {
+            assert_int_equal(optics_counter_delta(test->lens, &cursor, &delta), optics_ok);
+            sum += delta;
+        }
+
+        assert_int_equal(optics_counter_delta(test->lens, &cursor, &delta), optics_ok);
+        sum += delta;
+
+        optics_assert((size_t) sum == writers * iterations, "%ld != %lu",
+                sum, writers * iterations);
+    }
+
+    else {
+        for (size_t i = 0; i < iterations; ++i)
+            optics_counter_inc(test->lens, 1);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+}
+
+optics_test_head(lens_counter_peek_mt_test)
+{
+    if (cpus() < 3) skip();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_sharded_create(optics, "my_counter");
+
+    struct peek_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_peek_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// local
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_counter_local_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct optics_counter_local local;
+    assert_true(optics_counter_local_init(&local, lens, 10));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    // buffered below the threshold
+    optics_counter_local_inc(&local, 1);
+    optics_counter_local_inc(&local, 2);
+    assert_read(lens, epoch, 0);
+
+    // crossing the threshold flushes everything
+    optics_counter_local_inc(&local, 7);
+    assert_read(lens, epoch, 10);
+    assert_int_equal(local.value, 0);
+
+    // negative values also count against the threshold
+    optics_counter_local_inc(&local, -10);
+    assert_read(lens, epoch, -10);
+
+    // epoch change flushes into the new epoch
+    optics_counter_local_inc(&local, 3);
+    optics_epoch_t last = optics_epoch_inc(optics);
+    optics_counter_local_inc(&local, 1);
+    assert_read(lens, last, 0);
+    assert_read(lens, optics_epoch(optics), 4);
+
+    // explicit flush
+    optics_counter_local_inc(&local, 5);
+    assert_true(optics_counter_local_flush(&local));
+    assert_read(lens, optics_epoch(optics), 5);
+
+    // flushes are tracked by quiescence like any other record
+    optics_set_quiescence(optics, true);
+    optics_counter_local_inc(&local, 6);
+    assert_true(optics_counter_local_flush(&local));
+    assert_true(optics_epoch_quiesce(optics, optics_epoch(optics)));
+    assert_read(lens, optics_epoch(optics), 6);
+    optics_set_quiescence(optics, false);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_counter_local_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_gauge_create(optics, "my_gauge");
+
+    struct optics_counter_local local;
+    assert_false(optics_counter_local_init(&local, lens, 0));
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+void run_local_epoch_test(size_t id, void *ctx)
+{
+    struct epoch_test *test = ctx;
+    enum { iterations = 1000 * 1000 };
+
+    if (id) {
+        struct optics_counter_local local;
+        optics_counter_local_init(&local, test->lens, 100);
+
+        for (size_t i = 0; i < iterations; ++i)
+            optics_counter_local_inc(&local, 1);
+        optics_counter_local_flush(&local);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else run_epoch_test(id, ctx);
+}
+
+optics_test_head(lens_counter_local_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_local_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// bulk
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_counter_bulk_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *lenses[] = {
+        optics_counter_create(optics, "my_counter"),
+        optics_counter_sharded_create(optics, "my_sharded"),
+    };
+
+    for (size_t i = 0; i < sizeof(lenses) / sizeof(lenses[0]); ++i) {
+        struct optics_lens *lens = lenses[i];
+        optics_epoch_t epoch = optics_epoch(optics);
+
+        const int64_t values[] = {1, 20, -2, 100};
+        assert_true(optics_counter_inc_n(lens, values, 0));
+        assert_read(lens, epoch, 0);
+
+        assert_true(optics_counter_inc_n(lens, values, 4));
+        assert_true(optics_counter_inc_n(lens, values, 2));
+        assert_read(lens, epoch, 119 + 21);
+        assert_read(lens, epoch, 0);
+
+        optics_lens_close(lens);
+    }
+
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    const int64_t values[] = {1};
+    assert_false(optics_counter_inc_n(gauge, values, 1));
+    optics_lens_close(gauge);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// handle
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_counter_handle_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *lenses[] = {
+        optics_counter_create(optics, "my_counter"),
+        optics_counter_sharded_create(optics, "my_sharded"),
+    };
+
+    for (size_t i = 0; i < sizeof(lenses) / sizeof(lenses[0]); ++i) {
+        struct optics_lens *lens = lenses[i];
+
+        optics_counter_t handle;
+        assert_true(optics_counter_handle(&handle, lens));
+
+        // Sharded counters always go through the lens.
+        assert_int_equal(!handle.values, i == 1);
+
+        optics_epoch_t epoch = optics_epoch(optics);
+        assert_true(optics_counter_handle_inc(&handle, 1));
+        assert_true(optics_counter_handle_inc(&handle, 20));
+        assert_read(lens, epoch, 21);
+
+        // Records go to the epoch current at the time of the record.
+        assert_true(optics_counter_handle_inc(&handle, 3));
+        optics_epoch_t last = optics_epoch_inc(optics);
+        assert_true(optics_counter_handle_inc(&handle, 4));
+        assert_read(lens, last, 3);
+        assert_read(lens, optics_epoch(optics), 4);
+
+        // Quiescence tracking falls back on the lens which announces itself.
+        optics_set_quiescence(optics, true);
+        assert_true(optics_counter_handle_inc(&handle, 5));
+        assert_true(optics_epoch_quiesce(optics, optics_epoch(optics)));
+        assert_read(lens, optics_epoch(optics), 5);
+        optics_set_quiescence(optics, false);
+
+        optics_lens_close(lens);
+    }
+
+    optics_counter_t handle;
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    assert_false(optics_counter_handle(&handle, gauge));
+    optics_lens_close(gauge);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -261,6 +644,15 @@ int main(void)
         cmocka_unit_test(lens_counter_type_test),
         cmocka_unit_test(lens_counter_epoch_st_test),
         cmocka_unit_test(lens_counter_epoch_mt_test),
+        cmocka_unit_test(lens_counter_sharded_epoch_mt_test),
+        cmocka_unit_test(lens_counter_sharded_test),
+        cmocka_unit_test(lens_counter_peek_test),
+        cmocka_unit_test(lens_counter_peek_mt_test),
+        cmocka_unit_test(lens_counter_local_test),
+        cmocka_unit_test(lens_counter_local_type_test),
+        cmocka_unit_test(lens_counter_local_epoch_mt_test),
+        cmocka_unit_test(lens_counter_bulk_test),
+        cmocka_unit_test(lens_counter_handle_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
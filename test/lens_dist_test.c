@@ -145,6 +145,39 @@ optics_test_head(lens_dist_record_read_exact_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// record/read - fractional
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_record_read_fractional_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_dist_create(optics, "my_dist");
+
+    struct optics_dist value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    // Values that are less than 1 apart which must still be ordered correctly.
+    enum { n = 100 };
+    size_t order[n];
+    for (size_t i = 0; i < n; ++i) order[i] = i;
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = i + rng_gen_range(rng_global(), 0, n - i);
+        size_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        assert_true(optics_dist_record(lens, order[i] * 0.001));
+
+    value = checked_dist_read(lens, epoch);
+    assert_dist_equal(value, n, 0.050, 0.090, 0.099, 0.099, 0.00001);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // record/read - random
 // -----------------------------------------------------------------------------
@@ -287,6 +320,7 @@ struct epoch_test
     struct optics *optics;
     struct optics_lens *lens;
     size_t workers;
+    bool quiesce;
 
     atomic_size_t done;
 };
@@ -298,6 +332,13 @@ size_t epoch_test_read_lens(struct epoch_test *test)
     struct optics_dist value = {0};
     enum optics_ret ret;
 
+    // Once quiesced, there can't be any stragglers left to run into.
+    if (test->quiesce && optics_epoch_quiesce(test->optics, epoch)) {
+        ret = optics_dist_read(test->lens, epoch, &value);
+        optics_assert(ret == optics_ok, "unexpected straggler: %d", ret);
+        return value.n;
+    }
+
     nsleep(1 * 1000 * 1000);
 
     while ((ret = optics_dist_read(test->lens, epoch, &value)) == optics_busy);
@@ -359,6 +400,396 @@ optics_test_head(lens_dist_epoch_mt_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// quiesce
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_quiesce_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_dist_create(optics, "my_dist");
+
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+    assert_false(optics_epoch_quiesce(optics, epoch));
+
+    optics_set_quiescence(optics, true);
+
+    for (size_t i = 0; i < 10; ++i) {
+        optics_dist_record(lens, i);
+
+        epoch = optics_epoch_inc(optics);
+        assert_true(optics_epoch_quiesce(optics, epoch));
+
+        struct optics_dist value = {0};
+        assert_int_equal(optics_dist_read(lens, epoch, &value), optics_ok);
+        assert_int_equal(value.n, 1);
+        assert_float_equal(value.max, i, 0);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_dist_quiesce_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_dist_create(optics, "my_dist");
+    optics_set_quiescence(optics, true);
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+        .quiesce = true,
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// sharded
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_sharded_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_dist";
+
+    struct optics_lens *lens = optics_dist_sharded_create(optics, lens_name);
+    assert_non_null(lens);
+    assert_int_equal(optics_lens_type(lens), optics_dist);
+    assert_null(optics_dist_sharded_create(optics, lens_name));
+    assert_true(optics_dist_sharded_open(optics, lens_name) == lens);
+
+    struct optics_dist value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    value = checked_dist_read(lens, epoch);
+    assert_dist_equal(value, 0, 0, 0, 0, 0, 0);
+
+    for (size_t max = 10; max <= 200; max *= 10) {
+        for (size_t i = 0; i < max; ++i)
+            assert_true(optics_dist_record(lens, i));
+
+        value = checked_dist_read(lens, epoch);
+        assert_dist_equal(
+                value, max, p(50, max), p(90, max), p(99, max), max - 1, 1);
+
+        value = checked_dist_read(lens, epoch);
+        assert_dist_equal(value, 0, 0, 0, 0, 0, 0);
+    }
+
+    const size_t max = 1 * 1000 * 1000;
+    const double epsilon = max / 20.0;
+
+    for (size_t i = 0; i < max; ++i)
+        assert_true(optics_dist_record(lens, i));
+
+    value = checked_dist_read(lens, epoch);
+    assert_dist_equal(
+            value, max, p(50, max), p(90, max), p(99, max), max - 1, epsilon);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// peek
+// -----------------------------------------------------------------------------
+
+#define assert_total(lens, exp_n, exp_max)                              \
+    do {                                                                \
+        struct optics_dist_total total = {0};                           \
+        assert_int_equal(optics_dist_peek(lens, &total), optics_ok);    \
+        assert_int_equal(total.n, exp_n);                               \
+        assert_float_equal(total.max, exp_max, 0.0001);                 \
+    } while (false)
+
+optics_test_head(lens_dist_peek_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *lenses[] = {
+        optics_dist_create(optics, "my_dist"),
+        optics_dist_sharded_create(optics, "my_sharded"),
+    };
+
+    for (size_t i = 0; i < 2; ++i) {
+        struct optics_lens *lens = lenses[i];
+        assert_total(lens, 0, 0);
+
+        // Only the polled values are part of the totals.
+        for (size_t j = 0; j < 10; ++j) assert_true(optics_dist_record(lens, j));
+        assert_total(lens, 0, 0);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        struct optics_dist value = checked_dist_read(lens, epoch);
+        assert_int_equal(value.n, 10);
+        assert_total(lens, 10, 9);
+
+        assert_true(optics_dist_record(lens, 5));
+        epoch = optics_epoch_inc(optics);
+        value = checked_dist_read(lens, epoch);
+        assert_int_equal(value.n, 1);
+        assert_float_equal(value.max, 5, 0.0001);
+        assert_total(lens, 11, 9);
+
+        assert_total(lens, 11, 9);
+    }
+
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    struct optics_dist_total total;
+    assert_int_equal(optics_dist_peek(gauge, &total), optics_err);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// reservoir
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_reservoir_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    assert_null(optics_dist_reservoir_create(optics, "invalid", 0, false));
+    assert_null(optics_dist_reservoir_create(
+                    optics, "invalid", optics_dist_samples_max + 1, true));
+
+    const size_t reservoirs[] = { 1, 32, 2048, optics_dist_samples_max };
+
+    for (size_t r = 0; r < sizeof(reservoirs) / sizeof(reservoirs[0]); ++r) {
+        for (size_t sharded = 0; sharded < 2; ++sharded) {
+            size_t samples = reservoirs[r];
+
+            char name[optics_name_max_len];
+            snprintf(name, sizeof(name), "dist_%zu_%zu", samples, sharded);
+
+            struct optics_lens *lens =
+                optics_dist_reservoir_create(optics, name, samples, sharded);
+            assert_non_null(lens);
+            assert_null(optics_dist_reservoir_create(optics, name, samples, sharded));
+            assert_true(optics_dist_reservoir_open(optics, name, samples, sharded) == lens);
+
+            struct optics_dist value;
+            optics_epoch_t epoch = optics_epoch(optics);
+
+            value = checked_dist_read(lens, epoch);
+            assert_int_equal(value.n, 0);
+            assert_int_equal(value.samples_len, 0);
+
+            // The reservoir is filled exactly up to its size.
+            for (size_t i = 0; i < samples; ++i)
+                assert_true(optics_dist_record(lens, i));
+
+            value = checked_dist_read(lens, epoch);
+            assert_int_equal(value.n, samples);
+            assert_int_equal(value.samples_len, samples);
+            assert_float_equal(value.max, samples - 1, 0.0001);
+            assert_float_equal(value.p50, samples / 2, 0.0001);
+
+            double sum = 0;
+            for (size_t i = 0; i < value.samples_len; ++i) sum += value.samples[i];
+            assert_float_equal(sum, (samples * (samples - 1)) / 2.0, 0.0001);
+
+            const size_t max = 100 * 1000;
+            for (size_t i = 0; i < max; ++i)
+                assert_true(optics_dist_record(lens, i));
+
+            value = checked_dist_read(lens, epoch);
+            assert_int_equal(value.n, max);
+            assert_int_equal(value.samples_len, samples);
+            for (size_t i = 0; i < value.samples_len; ++i)
+                assert_true(value.samples[i] < max);
+
+            optics_lens_close(lens);
+        }
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+size_t sharded_epoch_test_read_lens(struct epoch_test *test)
+{
+    optics_epoch_t epoch = optics_epoch_inc(test->optics);
+    nsleep(1 * 1000 * 1000);
+
+    struct optics_dist value = {0};
+    assert_int_equal(optics_dist_read(test->lens, epoch, &value), optics_ok);
+
+    return value.n;
+}
+
+void run_sharded_epoch_test(size_t id, void *ctx)
+{
+    struct epoch_test *test = ctx;
+    enum { iterations = 100 * 1000 };
+
+    if (id) {
+        for (size_t i = 0; i < iterations; ++i)
+            optics_dist_record(test->lens, i);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else {
+        size_t done;
+        uint64_t result = 0;
+        size_t writers = test->workers - 1;
+
+        do {
+            result += sharded_epoch_test_read_lens(test);
+            done = atomic_load_explicit(&test->done, memory_order_acquire);
+        } while (done < writers);
+
+        for (size_t i = 0; i < 2; ++i)
+            result += sharded_epoch_test_read_lens(test);
+
+        optics_assert(result == writers * iterations, "%lu != %lu",
+                result, writers * iterations);
+    }
+}
+
+optics_test_head(lens_dist_sharded_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_dist_sharded_create(optics, "my_dist");
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_sharded_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// sample
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_sample_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_dist_create(optics, "my_dist");
+    struct optics_lens *sharded = optics_dist_sharded_create(optics, "my_sharded");
+    struct optics_lens *counter = optics_counter_create(optics, "my_counter");
+
+    assert_false(optics_lens_sample_rate(counter, 10));
+    assert_true(optics_lens_sample_rate(lens, 10));
+    assert_true(optics_lens_sample_rate(sharded, 10));
+
+    // The reservoir only holds 200 samples so the error on the percentiles is
+    // around 3.5% per standard deviation.
+    const size_t max = 100 * 1000;
+    const double epsilon = max / 10.0;
+
+    for (size_t i = 0; i < max; ++i) {
+        assert_true(optics_dist_record(lens, i));
+        assert_true(optics_dist_record(sharded, i));
+    }
+
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+
+    // The count covers every call while the percentiles come from the sampled
+    // calls.
+    struct optics_lens *lenses[] = { lens, sharded };
+    for (size_t i = 0; i < 2; ++i) {
+        struct optics_dist value = checked_dist_read(lenses[i], epoch);
+        assert_int_equal(value.n, max);
+        assert_float_equal(value.p50, p(50, max), epsilon);
+        assert_float_equal(value.p90, p(90, max), epsilon);
+        assert_float_equal(value.max, max, epsilon);
+    }
+
+    // Aims for 1000 recorded values per epoch so the rate is picked up from the
+    // first epoch and all following epochs fill the reservoir at about 1/100.
+    assert_true(optics_lens_sample_target(lens, 1000));
+    for (size_t round = 0; round < 3; ++round) {
+        for (size_t i = 0; i < max; ++i) optics_dist_record(lens, i);
+
+        struct optics_dist value = checked_dist_read(lens, optics_epoch_inc(optics));
+        assert_int_equal(value.n, max);
+        assert_float_equal(value.p50, p(50, max), epsilon);
+    }
+
+    optics_lens_close(lens);
+    optics_lens_close(sharded);
+    optics_lens_close(counter);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// bulk
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_dist_bulk_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *lenses[] = {
+        optics_dist_create(optics, "my_dist"),
+        optics_dist_sharded_create(optics, "my_sharded"),
+    };
+
+    enum { max = 100 * 1000, batch = 100 };
+    double *values = calloc(max, sizeof(*values));
+    for (size_t i = 0; i < max; ++i) values[i] = i;
+
+    for (size_t i = 0; i < sizeof(lenses) / sizeof(lenses[0]); ++i) {
+        struct optics_lens *lens = lenses[i];
+
+        struct optics_dist value;
+        optics_epoch_t epoch = optics_epoch(optics);
+
+        assert_true(optics_dist_record_n(lens, values, 0));
+        value = checked_dist_read(lens, epoch);
+        assert_dist_equal(value, 0, 0, 0, 0, 0, 0);
+
+        assert_true(optics_dist_record_n(lens, values, 10));
+        value = checked_dist_read(lens, epoch);
+        assert_dist_equal(value, 10, 5, 9, 9, 9, 0);
+
+        for (size_t j = 0; j < max; j += batch)
+            assert_true(optics_dist_record_n(lens, values + j, batch));
+
+        value = checked_dist_read(lens, epoch);
+        assert_dist_equal(
+                value, max, p(50, max), p(90, max), p(99, max), max - 1, max / 10.0);
+
+        // Skipped values must still be part of the count.
+        assert_true(optics_lens_sample_rate(lens, 10));
+        assert_true(optics_dist_record_n(lens, values, max));
+        value = checked_dist_read(lens, epoch);
+        assert_int_equal(value.n, max);
+
+        optics_lens_close(lens);
+    }
+
+    free(values);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -371,10 +802,19 @@ int main(void)
         cmocka_unit_test(lens_dist_create_test),
         cmocka_unit_test(lens_dist_open_test),
         cmocka_unit_test(lens_dist_record_read_exact_test),
+        cmocka_unit_test(lens_dist_record_read_fractional_test),
         cmocka_unit_test(lens_dist_record_read_random_test),
         cmocka_unit_test(lens_dist_type_test),
         cmocka_unit_test(lens_dist_epoch_st_test),
         cmocka_unit_test(lens_dist_epoch_mt_test),
+        cmocka_unit_test(lens_dist_quiesce_test),
+        cmocka_unit_test(lens_dist_quiesce_mt_test),
+        cmocka_unit_test(lens_dist_sharded_test),
+        cmocka_unit_test(lens_dist_sharded_epoch_mt_test),
+        cmocka_unit_test(lens_dist_peek_test),
+        cmocka_unit_test(lens_dist_reservoir_test),
+        cmocka_unit_test(lens_dist_sample_test),
+        cmocka_unit_test(lens_dist_bulk_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,132 @@
+/* lens_family_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+
+
+static const char *endpoints[] = { "get", "put", "post", "delete", "head", "patch" };
+static const char *statuses[] = { "2xx", "3xx", "4xx", "5xx" };
+
+enum
+{
+    endpoints_len = sizeof(endpoints) / sizeof(endpoints[0]),
+    statuses_len = sizeof(statuses) / sizeof(statuses[0]),
+};
+
+struct family_bench
+{
+    struct optics *optics;
+    struct optics_lens *family;
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static struct family_bench make_bench(struct optics *optics)
+{
+    struct family_bench bench = { .optics = optics };
+
+    const struct optics_family_dim dims[] = {
+        { endpoints_len, endpoints },
+        { statuses_len, statuses },
+    };
+    bench.family = optics_family_create(optics, "req", optics_counter, dims, 2);
+
+    for (size_t i = 0; i < endpoints_len; ++i) {
+        for (size_t j = 0; j < statuses_len; ++j) {
+            struct optics_key key = {0};
+            optics_key_pushf(&key, "req.%s.%s", endpoints[i], statuses[j]);
+            optics_counter_create(optics, key.data);
+        }
+    }
+
+    return bench;
+}
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+// Compares recording into a family by index against formatting the key of a
+// regular counter and looking it up on every record.
+
+void run_family_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct family_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t endpoint = (id + i) % endpoints_len;
+        size_t status = i % statuses_len;
+        optics_family_counter_inc(bench->family, endpoint * statuses_len + status, 1);
+    }
+}
+
+void run_lookup_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct family_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t endpoint = (id + i) % endpoints_len;
+        size_t status = i % statuses_len;
+
+        struct optics_key key = {0};
+        optics_key_pushf(&key, "req.%s.%s", endpoints[endpoint], statuses[status]);
+        optics_counter_inc(optics_lens_get(bench->optics, key.data), 1);
+    }
+}
+
+optics_test_head(lens_family_record_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct family_bench bench = make_bench(optics);
+
+    optics_bench_st(test_name, run_family_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_family_lookup_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct family_bench bench = make_bench(optics);
+
+    optics_bench_st(test_name, run_lookup_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_family_record_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct family_bench bench = make_bench(optics);
+
+    optics_bench_mt(test_name, run_family_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_family_record_bench_st),
+        cmocka_unit_test(lens_family_lookup_bench_st),
+        cmocka_unit_test(lens_family_record_bench_mt),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,329 @@
+/* lens_family_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#define calc_len(array) (sizeof(array) / sizeof(typeof((array)[0])))
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static const char *endpoints[] = { "get", "put", "delete" };
+static const char *statuses[] = { "2xx", "4xx", "5xx", "other" };
+
+static const struct optics_family_dim dims[] = {
+    { calc_len(endpoints), endpoints },
+    { calc_len(statuses), statuses },
+};
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_family_create_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_family";
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *lens = optics_family_create(
+                optics, lens_name, optics_counter, dims, calc_len(dims));
+        if (!lens) optics_abort();
+
+        assert_int_equal(optics_lens_type(lens), optics_family);
+        assert_string_equal(optics_lens_name(lens), lens_name);
+        assert_int_equal(optics_family_len(lens), 3 * 4);
+
+        assert_null(optics_family_create(
+                        optics, lens_name, optics_counter, dims, calc_len(dims)));
+
+        assert_non_null(lens = optics_lens_get(optics, lens_name));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_family_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_family";
+
+    struct optics_lens *l0 = optics_family_open(
+            optics, lens_name, optics_dist, dims, calc_len(dims));
+    struct optics_lens *l1 = optics_family_open(
+            optics, lens_name, optics_dist, dims, calc_len(dims));
+    assert_non_null(l0);
+    assert_true(l0 == l1);
+
+    const uint64_t buckets[] = { 1, 10, 100 };
+    struct optics_lens *h0 = optics_family_histo_open(
+            optics, "my_histo", dims, calc_len(dims), buckets, calc_len(buckets));
+    struct optics_lens *h1 = optics_family_histo_open(
+            optics, "my_histo", dims, calc_len(dims), buckets, calc_len(buckets));
+    assert_non_null(h0);
+    assert_true(h0 == h1);
+
+    optics_lens_close(l1);
+    optics_lens_close(h1);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// validate
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_family_validate_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_family";
+
+    assert_null(optics_family_create(optics, lens_name, optics_counter, dims, 0));
+    assert_null(optics_family_create(optics, lens_name, optics_hdr, dims, calc_len(dims)));
+    assert_null(optics_family_create(optics, lens_name, optics_family, dims, calc_len(dims)));
+    assert_null(optics_family_create(optics, lens_name, optics_histo, dims, calc_len(dims)));
+
+    {
+        const struct optics_family_dim bad[] = { dims[0], { 0, statuses } };
+        assert_null(optics_family_create(optics, lens_name, optics_counter, bad, calc_len(bad)));
+    }
+
+    {
+        const char *labels[] = { "a", "" };
+        const struct optics_family_dim bad[] = { { calc_len(labels), labels } };
+        assert_null(optics_family_create(optics, lens_name, optics_counter, bad, calc_len(bad)));
+    }
+
+    {
+        const char *labels[] = { "a", NULL };
+        const struct optics_family_dim bad[] = { { calc_len(labels), labels } };
+        assert_null(optics_family_create(optics, lens_name, optics_counter, bad, calc_len(bad)));
+    }
+
+    {
+        const struct optics_family_dim bad[optics_family_dims_max + 1] = {
+            dims[0], dims[0], dims[0], dims[0], dims[0] };
+        assert_null(optics_family_create(optics, lens_name, optics_counter, bad, calc_len(bad)));
+    }
+
+    {
+        const char *labels[129];
+        for (size_t i = 0; i < calc_len(labels); ++i) labels[i] = "x";
+
+        const struct optics_family_dim bad[] = {
+            { calc_len(labels), labels }, { calc_len(labels), labels } };
+        assert_null(optics_family_create(optics, lens_name, optics_counter, bad, calc_len(bad)));
+    }
+
+    {
+        const uint64_t buckets[] = { 10, 1 };
+        assert_null(optics_family_histo_create(
+                        optics, lens_name, dims, calc_len(dims), buckets, calc_len(buckets)));
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// key
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_family_key_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_family_create(
+            optics, "family", optics_gauge, dims, calc_len(dims));
+
+    for (size_t i = 0; i < calc_len(endpoints); ++i) {
+        for (size_t j = 0; j < calc_len(statuses); ++j) {
+            char exp[optics_name_max_len];
+            snprintf(exp, sizeof(exp), "family.%s.%s", endpoints[i], statuses[j]);
+
+            struct optics_key key = {0};
+            optics_key_push(&key, "family");
+            assert_true(optics_family_key(lens, i * calc_len(statuses) + j, &key));
+            assert_string_equal(key.data, exp);
+        }
+    }
+
+    struct optics_key key = {0};
+    assert_false(optics_family_key(lens, 3 * 4, &key));
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// record/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_family_counter_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_family_create(
+            optics, "family", optics_counter, dims, calc_len(dims));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        for (size_t j = 0; j <= i; ++j)
+            assert_true(optics_family_counter_inc(lens, i, 2));
+    }
+
+    assert_false(optics_family_counter_inc(lens, optics_family_len(lens), 1));
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        struct optics_poll poll = {0};
+        assert_int_equal(optics_family_read(lens, epoch, i, &poll), optics_ok);
+        assert_int_equal(poll.type, optics_counter);
+        assert_int_equal(poll.value.counter, (i + 1) * 2);
+
+        assert_int_equal(optics_family_read(lens, epoch, i, &poll), optics_ok);
+        assert_int_equal(poll.value.counter, 0);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_family_gauge_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_family_create(
+            optics, "family", optics_gauge, dims, calc_len(dims));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i)
+        assert_true(optics_family_gauge_set(lens, i, i * 1.5));
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        struct optics_poll poll = {0};
+        assert_int_equal(optics_family_read(lens, epoch, i, &poll), optics_ok);
+        assert_int_equal(poll.type, optics_gauge);
+        assert_float_equal(poll.value.gauge, i * 1.5, 0);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_family_dist_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_family_create(
+            optics, "family", optics_dist, dims, calc_len(dims));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        for (size_t j = 0; j < 100; ++j)
+            assert_true(optics_family_dist_record(lens, i, i * 100 + j));
+    }
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        struct optics_poll poll = {0};
+        assert_int_equal(optics_family_read(lens, epoch, i, &poll), optics_ok);
+        assert_int_equal(poll.type, optics_dist);
+        assert_int_equal(poll.value.dist.n, 100);
+        assert_float_equal(poll.value.dist.p50, i * 100 + 50, 0);
+        assert_float_equal(poll.value.dist.max, i * 100 + 99, 0);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_family_histo_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = { 10, 20, 30 };
+    struct optics_lens *lens = optics_family_histo_create(
+            optics, "family", dims, calc_len(dims), buckets, calc_len(buckets));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        assert_true(optics_family_histo_inc(lens, i, 5));
+        for (size_t j = 0; j <= i; ++j) assert_true(optics_family_histo_inc(lens, i, 15));
+        assert_true(optics_family_histo_inc(lens, i, 35));
+    }
+
+    for (size_t i = 0; i < optics_family_len(lens); ++i) {
+        struct optics_poll poll = {0};
+        assert_int_equal(optics_family_read(lens, epoch, i, &poll), optics_ok);
+        assert_int_equal(poll.type, optics_histo);
+
+        const struct optics_histo *histo = &poll.value.histo;
+        assert_int_equal(histo->buckets_len, calc_len(buckets));
+        assert_int_equal(histo->below, 1);
+        assert_int_equal(histo->counts[0], i + 1);
+        assert_int_equal(histo->counts[1], 0);
+        assert_int_equal(histo->above, 1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_family_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *family = optics_family_create(
+            optics, "family", optics_counter, dims, calc_len(dims));
+    assert_false(optics_family_gauge_set(family, 0, 1));
+    assert_false(optics_family_dist_record(family, 0, 1));
+    assert_false(optics_family_histo_inc(family, 0, 1));
+    assert_false(optics_counter_inc(family, 1));
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    assert_false(optics_family_counter_inc(counter, 0, 1));
+    assert_int_equal(optics_family_len(counter), 0);
+
+    struct optics_poll poll = {0};
+    assert_int_equal(optics_family_read(counter, optics_epoch(optics), 0, &poll), optics_err);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_family_create_test),
+        cmocka_unit_test(lens_family_open_test),
+        cmocka_unit_test(lens_family_validate_test),
+        cmocka_unit_test(lens_family_key_test),
+        cmocka_unit_test(lens_family_counter_test),
+        cmocka_unit_test(lens_family_gauge_test),
+        cmocka_unit_test(lens_family_dist_test),
+        cmocka_unit_test(lens_family_histo_test),
+        cmocka_unit_test(lens_family_type_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -177,6 +177,117 @@ optics_test_head(lens_gauge_epoch_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// agg
+// -----------------------------------------------------------------------------
+
+static double agg_read(struct optics *optics, struct optics_lens *lens)
+{
+    return checked_gauge_read(lens, optics_epoch_inc(optics));
+}
+
+optics_test_head(lens_gauge_agg_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_lens *last = optics_gauge_agg_create(optics, "last", optics_gauge_agg_last, false);
+    struct optics_lens *max = optics_gauge_agg_create(optics, "max", optics_gauge_agg_max, false);
+    struct optics_lens *min = optics_gauge_agg_create(optics, "min", optics_gauge_agg_min, false);
+    struct optics_lens *mean = optics_gauge_agg_create(optics, "mean", optics_gauge_agg_mean, false);
+    struct optics_lens *sticky = optics_gauge_agg_create(optics, "sticky", optics_gauge_agg_max, true);
+    assert_null(optics_gauge_agg_create(optics, "bad", optics_gauge_agg_mean + 1, false));
+
+    struct optics_lens *lenses[] = { last, max, min, mean, sticky };
+    const double values[] = { 2, -1, 10, 3 };
+
+    // Each lens is recorded and read in its own epoch.
+    for (size_t j = 0; j < 4; ++j) assert_true(optics_gauge_set(last, values[j]));
+    assert_float_equal(agg_read(optics, last), 3, 0);
+    for (size_t j = 0; j < 4; ++j) optics_gauge_set(max, values[j]);
+    assert_float_equal(agg_read(optics, max), 10, 0);
+    for (size_t j = 0; j < 4; ++j) optics_gauge_set(min, values[j]);
+    assert_float_equal(agg_read(optics, min), -1, 0);
+    for (size_t j = 0; j < 4; ++j) optics_gauge_set(mean, values[j]);
+    assert_float_equal(agg_read(optics, mean), 3.5, 0);
+    for (size_t j = 0; j < 4; ++j) optics_gauge_set(sticky, values[j]);
+    assert_float_equal(agg_read(optics, sticky), 10, 0);
+
+    // Empty epochs report zero unless the gauge is sticky.
+    for (size_t i = 0; i < 2; ++i) {
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        for (size_t j = 0; j < 4; ++j)
+            assert_float_equal(checked_gauge_read(lenses[j], epoch), 0, 0);
+        assert_float_equal(checked_gauge_read(sticky, epoch), 10, 0);
+    }
+
+    // The identity of each reduction must be restored by the read.
+    optics_gauge_set(max, -5);
+    optics_gauge_set(min, 5);
+    optics_gauge_set(sticky, 1);
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+    assert_float_equal(checked_gauge_read(max, epoch), -5, 0);
+    assert_float_equal(checked_gauge_read(min, epoch), 5, 0);
+    assert_float_equal(checked_gauge_read(sticky, epoch), 1, 0);
+
+    for (size_t i = 0; i < 5; ++i) optics_lens_close(lenses[i]);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// handle
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_gauge_handle_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    {
+        struct optics_lens *lens = optics_gauge_create(optics, "my_gauge");
+
+        optics_gauge_t handle;
+        assert_true(optics_gauge_handle(&handle, lens));
+        assert_non_null(handle.value);
+
+        assert_true(optics_gauge_handle_set(&handle, 1.5));
+        assert_float_equal(checked_gauge_read(lens, epoch), 1.5, 0.0);
+
+        assert_true(optics_gauge_handle_set(&handle, -2.3e-5));
+        assert_float_equal(checked_gauge_read(lens, epoch), -2.3e-5, 0.0);
+
+        optics_lens_close(lens);
+    }
+
+    // Aggregated gauges go through the lens.
+    {
+        struct optics_lens *lens =
+            optics_gauge_agg_create(optics, "my_agg", optics_gauge_agg_max, false);
+
+        optics_gauge_t handle;
+        assert_true(optics_gauge_handle(&handle, lens));
+        assert_null(handle.value);
+
+        assert_true(optics_gauge_handle_set(&handle, 3));
+        assert_true(optics_gauge_handle_set(&handle, 1));
+        assert_float_equal(checked_gauge_read(lens, epoch), 3, 0.0);
+
+        optics_lens_close(lens);
+    }
+
+    {
+        struct optics_lens *lens = optics_counter_create(optics, "my_counter");
+        optics_gauge_t handle;
+        assert_false(optics_gauge_handle(&handle, lens));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -189,6 +300,8 @@ int main(void)
         cmocka_unit_test(lens_gauge_record_read_test),
         cmocka_unit_test(lens_gauge_type_test),
         cmocka_unit_test(lens_gauge_epoch_test),
+        cmocka_unit_test(lens_gauge_agg_test),
+        cmocka_unit_test(lens_gauge_handle_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
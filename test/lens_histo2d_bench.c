@@ -0,0 +1,117 @@
+/* lens_histo2d_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+
+
+struct histo2d_bench
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *make_lens(struct optics *optics)
+{
+    uint64_t buckets[optics_histo2d_buckets_max + 1];
+    for (size_t i = 0; i < optics_histo2d_buckets_max + 1; ++i) buckets[i] = i;
+
+    return optics_histo2d_create(optics, "my_histo2d",
+            buckets, optics_histo2d_buckets_max + 1,
+            buckets, optics_histo2d_buckets_max + 1);
+}
+
+
+// -----------------------------------------------------------------------------
+// record bench
+// -----------------------------------------------------------------------------
+
+void run_record_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct histo2d_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i)
+        optics_histo2d_inc(bench->lens, i % 18, (i / 18) % 18);
+}
+
+
+optics_test_head(lens_histo2d_record_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_lens(optics);
+
+    struct histo2d_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_histo2d_record_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_lens(optics);
+
+    struct histo2d_bench bench = { optics, lens };
+    optics_bench_mt(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// read bench
+// -----------------------------------------------------------------------------
+
+void run_read_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct histo2d_bench *bench = data;
+    optics_epoch_t epoch = optics_epoch(bench->optics);
+
+    optics_bench_start(b);
+
+    struct optics_histo2d value;
+    for (size_t i = 0; i < n; ++i)
+        optics_histo2d_read(bench->lens, epoch, &value);
+}
+
+
+optics_test_head(lens_histo2d_read_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_lens(optics);
+
+    struct histo2d_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_read_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_histo2d_record_bench_st),
+        cmocka_unit_test(lens_histo2d_record_bench_mt),
+        cmocka_unit_test(lens_histo2d_read_bench_st),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,244 @@
+/* lens_histo2d_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include <math.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+#define checked_histo2d_read(lens, epoch)                               \
+    ({                                                                  \
+        struct optics_histo2d value = {0};                              \
+        assert_int_equal(optics_histo2d_read(lens, epoch, &value), optics_ok); \
+        value;                                                          \
+    })
+
+static size_t cell(const struct optics_histo2d *value, size_t row, size_t col)
+{
+    return value->counts[row * (value->cols_len - 1) + col];
+}
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo2d_create_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_histo2d";
+
+    const uint64_t rows[] = { 1, 2, 3 };
+    const uint64_t cols[] = { 10, 20 };
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *lens = optics_histo2d_create(optics, lens_name, rows, 3, cols, 2);
+        if (!lens) optics_abort();
+
+        assert_int_equal(optics_lens_type(lens), optics_histo2d);
+        assert_string_equal(optics_lens_name(lens), lens_name);
+
+        assert_null(optics_histo2d_create(optics, lens_name, rows, 3, cols, 2));
+
+        assert_non_null(lens = optics_lens_get(optics, lens_name));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_histo2d_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_histo2d";
+
+    const uint64_t rows[] = { 1, 2, 3 };
+    const uint64_t cols[] = { 10, 20 };
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_histo2d_open(optics, lens_name, rows, 3, cols, 2);
+        if (!l0) optics_abort();
+        optics_histo2d_inc(l0, 1, 10);
+
+        struct optics_lens *l1 = optics_histo2d_open(optics, lens_name, rows, 3, cols, 2);
+        if (!l1) optics_abort();
+        optics_histo2d_inc(l1, 2, 10);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+
+        struct optics_histo2d value = checked_histo2d_read(l0, epoch);
+        assert_int_equal(value.count, 2);
+        assert_int_equal(cell(&value, 0, 0), 1);
+        assert_int_equal(cell(&value, 1, 0), 1);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// validate
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo2d_validate_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_histo2d";
+
+    const uint64_t valid[] = { 1, 2 };
+    const uint64_t unordered[] = { 2, 1 };
+    const uint64_t equal[] = { 1, 1 };
+
+    uint64_t many[optics_histo2d_buckets_max + 2];
+    for (size_t i = 0; i < optics_histo2d_buckets_max + 2; ++i) many[i] = i;
+
+    assert_null(optics_histo2d_create(optics, lens_name, valid, 1, valid, 2));
+    assert_null(optics_histo2d_create(optics, lens_name, valid, 2, valid, 1));
+    assert_null(optics_histo2d_create(optics, lens_name, unordered, 2, valid, 2));
+    assert_null(optics_histo2d_create(optics, lens_name, valid, 2, equal, 2));
+    assert_null(optics_histo2d_create(
+                    optics, lens_name, many, optics_histo2d_buckets_max + 2, valid, 2));
+    assert_null(optics_histo2d_create(
+                    optics, lens_name, valid, 2, many, optics_histo2d_buckets_max + 2));
+
+    assert_non_null(optics_histo2d_create(
+                    optics, lens_name,
+                    many, optics_histo2d_buckets_max + 1,
+                    many, optics_histo2d_buckets_max + 1));
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// inc/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo2d_inc_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t rows[] = { 0, 10, 100, 1000 };
+    const uint64_t cols[] = { 1, 2, 4 };
+    struct optics_lens *lens = optics_histo2d_create(optics, "my_histo2d", rows, 4, cols, 3);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    {
+        struct optics_histo2d value = checked_histo2d_read(lens, epoch);
+        assert_int_equal(value.count, 0);
+        assert_int_equal(value.outside, 0);
+
+        assert_int_equal(value.rows_len, 4);
+        for (size_t i = 0; i < 4; ++i) assert_int_equal(value.rows[i], rows[i]);
+        assert_int_equal(value.cols_len, 3);
+        for (size_t i = 0; i < 3; ++i) assert_int_equal(value.cols[i], cols[i]);
+
+        for (size_t row = 0; row < 3; ++row)
+            for (size_t col = 0; col < 2; ++col)
+                assert_int_equal(cell(&value, row, col), 0);
+    }
+
+    // Every cell gets row * 2 + col + 1 samples on its lower edges.
+    for (size_t row = 0; row < 3; ++row) {
+        for (size_t col = 0; col < 2; ++col) {
+            for (size_t i = 0; i < row * 2 + col + 1; ++i)
+                assert_true(optics_histo2d_inc(lens, rows[row], cols[col]));
+        }
+    }
+
+    // Buckets are half-open on the right.
+    assert_true(optics_histo2d_inc(lens, 9.99, 3.99));
+
+    // Out of bounds in either dimension.
+    assert_true(optics_histo2d_inc(lens, -1, 1));
+    assert_true(optics_histo2d_inc(lens, 1000, 1));
+    assert_true(optics_histo2d_inc(lens, 1, 0));
+    assert_true(optics_histo2d_inc(lens, 1, 4));
+    assert_true(optics_histo2d_inc(lens, -1, 100));
+    assert_true(optics_histo2d_inc(lens, NAN, 1));
+    assert_true(optics_histo2d_inc(lens, 1, NAN));
+
+    {
+        struct optics_histo2d value = checked_histo2d_read(lens, epoch);
+        assert_int_equal(value.count, 21 + 1);
+        assert_int_equal(value.outside, 7);
+
+        for (size_t row = 0; row < 3; ++row) {
+            for (size_t col = 0; col < 2; ++col) {
+                size_t exp = row * 2 + col + 1 + (!row && col ? 1 : 0);
+                assert_int_equal(cell(&value, row, col), exp);
+            }
+        }
+    }
+
+    // Reads are destructive.
+    {
+        struct optics_histo2d value = checked_histo2d_read(lens, epoch);
+        assert_int_equal(value.count, 0);
+        assert_int_equal(value.outside, 0);
+        for (size_t row = 0; row < 3; ++row)
+            for (size_t col = 0; col < 2; ++col)
+                assert_int_equal(cell(&value, row, col), 0);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo2d_epoch_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t rows[] = { 1, 2 };
+    const uint64_t cols[] = { 1, 2 };
+    struct optics_lens *lens = optics_histo2d_create(optics, "my_histo2d", rows, 2, cols, 2);
+
+    optics_histo2d_inc(lens, 1, 1);
+    optics_epoch_t e0 = optics_epoch_inc(optics);
+
+    optics_histo2d_inc(lens, 1, 1);
+    optics_histo2d_inc(lens, 1, 1);
+    optics_epoch_t e1 = optics_epoch_inc(optics);
+
+    assert_int_equal(checked_histo2d_read(lens, e0).count, 1);
+    assert_int_equal(checked_histo2d_read(lens, e1).count, 2);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_histo2d_create_test),
+        cmocka_unit_test(lens_histo2d_open_test),
+        cmocka_unit_test(lens_histo2d_validate_test),
+        cmocka_unit_test(lens_histo2d_inc_read_test),
+        cmocka_unit_test(lens_histo2d_epoch_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -4,6 +4,9 @@
 */
 
 #include "bench.h"
+#include "utils/rng.h"
+
+#include <math.h>
 
 
 struct histo_bench
@@ -235,6 +238,94 @@ optics_test_head(lens_histo_mixed_bench_mt)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// lookup
+// -----------------------------------------------------------------------------
+// Compares the bucket lookup used by lens_histo_inc against the linear search
+// it replaced, without the atomic increment, for every bucket count. Values are
+// drawn at random ahead of time so that the branch predictor can't learn them.
+
+enum { lookup_values_len = 1 << 12 };
+
+struct lookup_bench
+{
+    uint64_t buckets[optics_histo_buckets_max + 1];
+    double edges[optics_histo_buckets_max + 1];
+    size_t buckets_len;
+
+    double values[lookup_values_len];
+};
+
+static size_t lookup_loop(const struct lookup_bench *bench, double value)
+{
+    if (value < bench->buckets[0]) return 0;
+    if (value >= bench->buckets[bench->buckets_len - 1]) return bench->buckets_len;
+
+    for (size_t i = 1; i < bench->buckets_len; ++i) {
+        if (value < bench->buckets[i]) return i;
+    }
+
+    optics_abort();
+}
+
+static size_t lookup_branchless(const struct lookup_bench *bench, double value)
+{
+    size_t i = 0;
+    for (size_t j = 0; j < optics_histo_buckets_max + 1; ++j)
+        i += value >= bench->edges[j];
+    return i;
+}
+
+void run_lookup_loop_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct lookup_bench *bench = data;
+    optics_bench_start(b);
+
+    size_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += lookup_loop(bench, bench->values[(id + i) % lookup_values_len]);
+
+    volatile size_t sink = sum;
+    (void) sink;
+}
+
+void run_lookup_branchless_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct lookup_bench *bench = data;
+    optics_bench_start(b);
+
+    size_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += lookup_branchless(bench, bench->values[(id + i) % lookup_values_len]);
+
+    volatile size_t sink = sum;
+    (void) sink;
+}
+
+optics_test_head(lens_histo_lookup_bench)
+{
+    for (size_t len = 2; len <= optics_histo_buckets_max + 1; ++len) {
+        struct lookup_bench bench = { .buckets_len = len };
+        for (size_t i = 0; i < optics_histo_buckets_max + 1; ++i) {
+            bench.buckets[i] = i + 1;
+            bench.edges[i] = i < len ? bench.buckets[i] : INFINITY;
+        }
+
+        for (size_t i = 0; i < lookup_values_len; ++i)
+            bench.values[i] = rng_gen_range(rng_global(), 0, len + 2);
+
+        char name[256];
+
+        snprintf(name, sizeof(name), "%s_loop_%zu", test_name, len);
+        optics_bench_st(name, run_lookup_loop_bench, &bench);
+
+        snprintf(name, sizeof(name), "%s_branchless_%zu", test_name, len);
+        optics_bench_st(name, run_lookup_branchless_bench, &bench);
+    }
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -251,6 +342,7 @@ int main(void)
         cmocka_unit_test(lens_histo_read_bench_mt),
         cmocka_unit_test(lens_histo_mixed_bench_st),
         cmocka_unit_test(lens_histo_mixed_bench_mt),
+        cmocka_unit_test(lens_histo_lookup_bench),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -7,6 +7,8 @@
 #include "utils/rng.h"
 #include "utils/time.h"
 
+#include <math.h>
+
 
 // -----------------------------------------------------------------------------
 // utils
@@ -189,6 +191,10 @@ optics_test_head(lens_histo_record_read_test)
     value = checked_histo_read(lens, epoch);
     assert_histo_equal(value, buckets, 0, 1, 0, 0, 0, 0);
 
+    assert_true(optics_histo_inc(lens, NAN));
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 1, 0, 0, 0, 0, 0);
+
     optics_lens_close(lens);
     optics_close(optics);
 }
@@ -346,6 +352,242 @@ optics_test_tail()
 
 
 
+optics_test_head(lens_histo_sharded_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = { 0, 10, 20, 30, 40, 50 };
+    struct optics_lens *lens =
+        optics_histo_sharded_create(optics, "my_histo", buckets, calc_len(buckets));
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// sharded
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo_sharded_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_histo";
+
+    const uint64_t buckets[] = {10, 20, 30, 40, 50};
+    struct optics_lens *lens =
+        optics_histo_sharded_create(optics, lens_name, buckets, calc_len(buckets));
+    assert_non_null(lens);
+    assert_int_equal(optics_lens_type(lens), optics_histo);
+    assert_null(optics_histo_sharded_create(optics, lens_name, buckets, calc_len(buckets)));
+    assert_true(optics_histo_sharded_open(optics, lens_name, buckets, calc_len(buckets)) == lens);
+
+    const uint64_t invalid[] = {10};
+    assert_null(optics_histo_sharded_create(optics, "invalid", invalid, calc_len(invalid)));
+
+    struct optics_histo value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 0, 0, 0, 0, 0, 0);
+
+    assert_true(optics_histo_inc(lens, 0));
+    assert_true(optics_histo_inc(lens, 15));
+    assert_true(optics_histo_inc(lens, 35));
+    assert_true(optics_histo_inc(lens, 1000));
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 1, 1, 1, 0, 1, 0);
+
+    const double values[] = {0, 10, 15, 20, 35, 38, 39, 49, 50, 1000, NAN};
+    assert_true(optics_histo_inc_n(lens, values, calc_len(values)));
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 2, 2, 2, 1, 3, 1);
+
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 0, 0, 0, 0, 0, 0);
+
+    for (size_t i = 1; i < 5; ++i) {
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        assert_true(optics_histo_inc(lens, i * 10));
+
+        value = checked_histo_read(lens, epoch);
+
+        switch (i) {
+        case 1: assert_histo_equal(value, buckets, 0, 0, 0, 0, 0, 0); break;
+        case 2: assert_histo_equal(value, buckets, 0, 0, 1, 0, 0, 0); break;
+        case 3: assert_histo_equal(value, buckets, 0, 0, 0, 1, 0, 0); break;
+        case 4: assert_histo_equal(value, buckets, 0, 0, 0, 0, 1, 0); break;
+        default: optics_abort();
+        }
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// peek
+// -----------------------------------------------------------------------------
+
+#define checked_histo_delta(lens, cursor)                               \
+    ({                                                                  \
+        struct optics_histo value = {0};                                \
+        assert_int_equal(optics_histo_delta(lens, cursor, &value), optics_ok); \
+        value;                                                          \
+    })
+
+optics_test_head(lens_histo_peek_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = {10, 20, 30};
+    struct optics_lens *lenses[] = {
+        optics_histo_create(optics, "my_histo", buckets, calc_len(buckets)),
+        optics_histo_sharded_create(optics, "my_sharded", buckets, calc_len(buckets)),
+    };
+
+    for (size_t i = 0; i < 2; ++i) {
+        struct optics_lens *lens = lenses[i];
+        struct optics_histo_cursor fast = {0}, slow = {0};
+        struct optics_histo value;
+
+        assert_int_equal(optics_histo_peek(lens, &value), optics_ok);
+        assert_histo_equal(value, buckets, 0, 0, 0, 0);
+
+        assert_true(optics_histo_inc(lens, 5));
+        assert_true(optics_histo_inc(lens, 15));
+        value = checked_histo_delta(lens, &fast);
+        assert_histo_equal(value, buckets, 1, 0, 1, 0);
+
+        // Polling moves the counts to the totals without affecting the peeks.
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        assert_true(optics_histo_inc(lens, 25));
+        value = checked_histo_read(lens, epoch);
+        assert_histo_equal(value, buckets, 1, 0, 1, 0);
+        value = checked_histo_delta(lens, &fast);
+        assert_histo_equal(value, buckets, 0, 0, 0, 1);
+
+        epoch = optics_epoch_inc(optics);
+        assert_true(optics_histo_inc(lens, 35));
+        value = checked_histo_read(lens, epoch);
+        assert_histo_equal(value, buckets, 0, 0, 0, 1);
+        value = checked_histo_delta(lens, &fast);
+        assert_histo_equal(value, buckets, 0, 1, 0, 0);
+
+        // Consumers don't interfere with each other.
+        value = checked_histo_delta(lens, &slow);
+        assert_histo_equal(value, buckets, 1, 1, 1, 1);
+        value = checked_histo_delta(lens, &slow);
+        assert_histo_equal(value, buckets, 0, 0, 0, 0);
+
+        assert_int_equal(optics_histo_peek(lens, &value), optics_ok);
+        assert_histo_equal(value, buckets, 1, 1, 1, 1);
+    }
+
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    struct optics_histo value;
+    assert_int_equal(optics_histo_peek(gauge, &value), optics_err);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// bulk
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo_bulk_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = {10, 20, 30, 40, 50};
+    struct optics_lens *lens = optics_histo_create(optics, "my_histo", buckets, calc_len(buckets));
+
+    struct optics_histo value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    const double values[] = {0, 10, 15, 20, 35, 38, 39, 49, 50, 1000, NAN};
+    assert_true(optics_histo_inc_n(lens, values, 0));
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 0, 0, 0, 0, 0, 0);
+
+    assert_true(optics_histo_inc_n(lens, values, calc_len(values)));
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 2, 2, 2, 1, 3, 1);
+
+    value = checked_histo_read(lens, epoch);
+    assert_histo_equal(value, buckets, 0, 0, 0, 0, 0, 0);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// handle
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_histo_handle_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = { 10, 20, 30, 40 };
+    struct optics_lens *lenses[] = {
+        optics_histo_create(optics, "my_histo", buckets, calc_len(buckets)),
+        optics_histo_sharded_create(optics, "my_sharded", buckets, calc_len(buckets)),
+    };
+
+    for (size_t i = 0; i < calc_len(lenses); ++i) {
+        struct optics_lens *lens = lenses[i];
+
+        optics_histo_t handle;
+        assert_true(optics_histo_handle(&handle, lens));
+        assert_int_equal(!handle.counts, i == 1);
+
+        optics_epoch_t epoch = optics_epoch(optics);
+        const double values[] = { 5, 10, 15, 20, 25, 35, 39.9, 40, 100, NAN };
+        for (size_t j = 0; j < calc_len(values); ++j)
+            assert_true(optics_histo_handle_inc(&handle, values[j]));
+
+        struct optics_histo value = checked_histo_read(lens, epoch);
+        assert_histo_equal(value, buckets, 2, 2, 2, 2, 2);
+
+        // Records go to the epoch current at the time of the record.
+        assert_true(optics_histo_handle_inc(&handle, 15));
+        optics_epoch_t last = optics_epoch_inc(optics);
+        assert_true(optics_histo_handle_inc(&handle, 25));
+
+        value = checked_histo_read(lens, last);
+        assert_histo_equal(value, buckets, 0, 0, 1, 0, 0);
+        value = checked_histo_read(lens, optics_epoch(optics));
+        assert_histo_equal(value, buckets, 0, 0, 0, 1, 0);
+
+        optics_lens_close(lens);
+    }
+
+    optics_histo_t handle;
+    struct optics_lens *gauge = optics_gauge_create(optics, "my_gauge");
+    assert_false(optics_histo_handle(&handle, gauge));
+    optics_lens_close(gauge);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -362,6 +604,11 @@ int main(void)
         cmocka_unit_test(lens_histo_type_test),
         cmocka_unit_test(lens_histo_epoch_st_test),
         cmocka_unit_test(lens_histo_epoch_mt_test),
+        cmocka_unit_test(lens_histo_sharded_epoch_mt_test),
+        cmocka_unit_test(lens_histo_sharded_test),
+        cmocka_unit_test(lens_histo_peek_test),
+        cmocka_unit_test(lens_histo_bulk_test),
+        cmocka_unit_test(lens_histo_handle_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
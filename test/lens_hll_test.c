@@ -0,0 +1,236 @@
+/* lens_hll_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static double hll_read(struct optics_lens *lens, optics_epoch_t epoch)
+{
+    struct optics_hll value = {0};
+    assert_int_equal(optics_hll_read(lens, epoch, &value), optics_ok);
+    return value.estimate;
+}
+
+// Within 4 standard errors of the estimate.
+#define assert_estimate(estimate, exp, precision)                       \
+    do {                                                                \
+        double error = 4 * 1.04 / sqrt(1UL << (precision));             \
+        assert_float_equal(estimate, exp, (exp) * error + 0.5);         \
+    } while (false)
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_hll_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_hll";
+
+    assert_null(optics_hll_create(optics, lens_name, optics_hll_precision_min - 1));
+    assert_null(optics_hll_create(optics, lens_name, optics_hll_precision_max + 1));
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_hll_create(optics, lens_name, 10);
+        if (!l0) optics_abort();
+
+        assert_int_equal(optics_lens_type(l0), optics_hll);
+        assert_string_equal(optics_lens_name(l0), lens_name);
+        assert_null(optics_hll_create(optics, lens_name, 10));
+
+        struct optics_lens *l1 = optics_hll_open(optics, lens_name, 10);
+        if (!l1) optics_abort();
+
+        optics_hll_add(l0, "a");
+        optics_hll_add(l1, "a");
+        optics_hll_add(l1, "b");
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        assert_estimate(hll_read(l0, epoch), 2, 10);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// estimate
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_hll_estimate_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    const size_t precisions[] = { optics_hll_precision_min, 10, optics_hll_precision_max };
+    const size_t cardinalities[] = { 0, 1, 10, 1000, 100 * 1000 };
+
+    for (size_t i = 0; i < sizeof(precisions) / sizeof(precisions[0]); ++i) {
+        struct optics_lens *lens = optics_hll_create(optics, "my_hll", precisions[i]);
+
+        for (size_t j = 0; j < sizeof(cardinalities) / sizeof(cardinalities[0]); ++j) {
+            size_t n = cardinalities[j];
+
+            // Duplicates never change the estimate.
+            for (size_t k = 0; k < n; ++k) {
+                optics_hll_add_id(lens, k);
+                optics_hll_add_id(lens, k);
+            }
+
+            assert_estimate(hll_read(lens, epoch), n, precisions[i]);
+            assert_float_equal(hll_read(lens, epoch), 0, 0);
+        }
+
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_hll_key_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_hll_create(optics, "my_hll", 12);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    enum { n = 10 * 1000 };
+    for (size_t i = 0; i < n; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "user-%zu", i);
+        optics_hll_add(lens, key);
+    }
+
+    assert_estimate(hll_read(lens, epoch), n, 12);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// merge
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_hll_merge_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    enum { precision = 12, len = 1 << precision, n = 10 * 1000 };
+    struct optics_lens *a = optics_hll_create(optics, "a", precision);
+    struct optics_lens *b = optics_hll_create(optics, "b", precision);
+
+    // Half of the keys are seen by both lenses.
+    for (size_t i = 0; i < n; ++i) optics_hll_add_id(a, i);
+    for (size_t i = n / 2; i < n + n / 2; ++i) optics_hll_add_id(b, i);
+
+    struct optics_hll va = {0};
+    assert_int_equal(optics_hll_read(a, epoch, &va), optics_ok);
+    assert_int_equal(va.precision, precision);
+    assert_int_equal(va.registers_len, len);
+
+    uint8_t merged[len];
+    memcpy(merged, va.registers, len);
+
+    struct optics_hll vb = {0};
+    assert_int_equal(optics_hll_read(b, epoch, &vb), optics_ok);
+    for (size_t i = 0; i < len; ++i)
+        if (vb.registers[i] > merged[i]) merged[i] = vb.registers[i];
+
+    assert_float_equal(optics_hll_estimate(vb.registers, len), vb.estimate, 0);
+    assert_estimate(optics_hll_estimate(merged, len), n + n / 2, precision);
+
+    optics_lens_close(a);
+    optics_lens_close(b);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_hll_epoch_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_hll_create(optics, "my_hll", 8);
+
+    for (size_t i = 0; i < 10; ++i) optics_hll_add_id(lens, i);
+    optics_epoch_t e0 = optics_epoch_inc(optics);
+
+    for (size_t i = 0; i < 100; ++i) optics_hll_add_id(lens, i);
+
+    assert_estimate(hll_read(lens, e0), 10, 8);
+
+    optics_epoch_t e1 = optics_epoch_inc(optics);
+    assert_estimate(hll_read(lens, e1), 100, 8);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_hll_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_hll hll;
+    int64_t counter;
+
+    {
+        struct optics_lens *lens = optics_counter_create(optics, "counter");
+        assert_false(optics_hll_add(lens, "a"));
+        assert_false(optics_hll_add_id(lens, 1));
+        assert_int_equal(optics_hll_read(lens, epoch, &hll), optics_err);
+        optics_lens_close(lens);
+    }
+
+    {
+        struct optics_lens *lens = optics_hll_create(optics, "hll", 4);
+        assert_false(optics_counter_inc(lens, 1));
+        assert_int_equal(optics_counter_read(lens, epoch, &counter), optics_err);
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_hll_open_test),
+        cmocka_unit_test(lens_hll_estimate_test),
+        cmocka_unit_test(lens_hll_key_test),
+        cmocka_unit_test(lens_hll_merge_test),
+        cmocka_unit_test(lens_hll_epoch_test),
+        cmocka_unit_test(lens_hll_type_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
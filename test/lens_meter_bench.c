@@ -0,0 +1,102 @@
+/* lens_meter_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+
+
+struct meter_bench
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+};
+
+
+// -----------------------------------------------------------------------------
+// record bench
+// -----------------------------------------------------------------------------
+
+void run_record_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct meter_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i)
+        optics_meter_mark(bench->lens, 1);
+}
+
+
+optics_test_head(lens_meter_record_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_meter_create(optics, "my_meter");
+
+    struct meter_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_meter_record_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_meter_create(optics, "my_meter");
+
+    struct meter_bench bench = { optics, lens };
+    optics_bench_mt(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// read bench
+// -----------------------------------------------------------------------------
+
+void run_read_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+    struct meter_bench *bench = data;
+    optics_epoch_t epoch = optics_epoch(bench->optics);
+
+    optics_bench_start(b);
+
+    struct optics_meter value;
+    for (size_t i = 0; i < n; ++i)
+        optics_meter_read(bench->lens, epoch, 1, &value);
+}
+
+
+optics_test_head(lens_meter_read_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_meter_create(optics, "my_meter");
+
+    struct meter_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_read_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_meter_record_bench_st),
+        cmocka_unit_test(lens_meter_record_bench_mt),
+        cmocka_unit_test(lens_meter_read_bench_st),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,218 @@
+/* lens_meter_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+#define assert_read(lens, epoch, elapsed, exp_count, exp_m1, exp_m5, exp_m15) \
+    do {                                                                \
+        struct optics_meter value = {0};                                \
+        assert_int_equal(                                               \
+                optics_meter_read(lens, epoch, elapsed, &value), optics_ok); \
+        assert_int_equal(value.count, exp_count);                       \
+        assert_float_equal(value.m1, exp_m1, 1e-9);                     \
+        assert_float_equal(value.m5, exp_m5, 1e-9);                     \
+        assert_float_equal(value.m15, exp_m15, 1e-9);                   \
+    } while (false)
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_meter_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_meter";
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_meter_create(optics, lens_name);
+        if (!l0) optics_abort();
+
+        assert_int_equal(optics_lens_type(l0), optics_meter);
+        assert_string_equal(optics_lens_name(l0), lens_name);
+        assert_null(optics_meter_create(optics, lens_name));
+
+        struct optics_lens *l1 = optics_meter_open(optics, lens_name);
+        if (!l1) optics_abort();
+
+        optics_meter_mark(l0, 1);
+        optics_meter_mark(l1, 2);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        assert_read(l0, epoch, 1, 3, 3.0, 3.0, 3.0);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// record/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_meter_record_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_meter_create(optics, "my_meter");
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    // The first read seeds every average with its rate.
+    optics_meter_mark(lens, 10);
+    optics_meter_mark(lens, 30);
+    assert_read(lens, epoch, 4, 40, 10.0, 10.0, 10.0);
+
+    // A read that spans the whole window closes 1 - 1/e of the gap.
+    double m1 = 10.0 * exp(-1.0);
+    double m5 = 10.0 * exp(-60.0 / 300);
+    double m15 = 10.0 * exp(-60.0 / 900);
+    assert_read(lens, epoch, 60, 0, m1, m5, m15);
+
+    optics_meter_mark(lens, -60);
+    m1 += (1 - exp(-1.0)) * (-1.0 - m1);
+    m5 += (1 - exp(-60.0 / 300)) * (-1.0 - m5);
+    m15 += (1 - exp(-60.0 / 900)) * (-1.0 - m15);
+    assert_read(lens, epoch, 60, -60, m1, m5, m15);
+
+    // An elapsed time of zero is treated as a single second.
+    optics_meter_mark(lens, 1);
+    m1 += (1 - exp(-1.0 / 60)) * (1.0 - m1);
+    m5 += (1 - exp(-1.0 / 300)) * (1.0 - m5);
+    m15 += (1 - exp(-1.0 / 900)) * (1.0 - m15);
+    assert_read(lens, epoch, 0, 1, m1, m5, m15);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_meter_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_meter meter;
+    int64_t counter;
+
+    {
+        struct optics_lens *lens = optics_counter_create(optics, "counter");
+        assert_false(optics_meter_mark(lens, 1));
+        assert_int_equal(optics_meter_read(lens, epoch, 1, &meter), optics_err);
+        optics_lens_close(lens);
+    }
+
+    {
+        struct optics_lens *lens = optics_meter_create(optics, "meter");
+        assert_false(optics_counter_inc(lens, 1));
+        assert_int_equal(optics_counter_read(lens, epoch, &counter), optics_err);
+        assert_false(optics_lens_sample_rate(lens, 2));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch mt
+// -----------------------------------------------------------------------------
+
+struct epoch_test
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    size_t workers;
+
+    atomic_size_t done;
+};
+
+size_t epoch_test_read_lens(struct epoch_test *test)
+{
+    optics_epoch_t epoch = optics_epoch_inc(test->optics);
+
+    struct optics_meter value = {0};
+    assert_int_equal(optics_meter_read(test->lens, epoch, 1, &value), optics_ok);
+
+    return value.count;
+}
+
+void run_epoch_test(size_t id, void *ctx)
+{
+    struct epoch_test *test = ctx;
+    enum { iterations = 1000 * 1000 };
+
+    if (id) {
+        for (size_t i = 0; i < iterations; ++i)
+            optics_meter_mark(test->lens, 1);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else {
+        size_t done;
+        uint64_t result = 0;
+        size_t writers = test->workers - 1;
+
+        do {
+            result += epoch_test_read_lens(test);
+            done = atomic_load_explicit(&test->done, memory_order_acquire);
+        } while (done < writers);
+
+        for (size_t i = 0; i < 2; ++i)
+            result += epoch_test_read_lens(test);
+
+        optics_assert(result == writers * iterations, "%lu != %lu",
+                result, writers * iterations);
+    }
+}
+
+optics_test_head(lens_meter_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_meter_create(optics, "my_meter");
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_meter_open_test),
+        cmocka_unit_test(lens_meter_record_read_test),
+        cmocka_unit_test(lens_meter_type_test),
+        cmocka_unit_test(lens_meter_epoch_mt_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
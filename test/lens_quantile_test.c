@@ -59,6 +59,33 @@ optics_test_head(lens_quantile_update_read_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// sample
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_quantile_sample_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_quantile_create(optics, "bob_the_quantile", 0.90, 70, 0.05);
+    assert_true(optics_lens_sample_rate(lens, 7));
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 100; j++)
+            optics_quantile_update(lens, j);
+    }
+
+    struct optics_quantile value = {0};
+    assert_int_equal(optics_quantile_read(lens, epoch, &value), optics_ok);
+    assert_float_equal(value.sample, 90, 2);
+    assert_int_equal(value.count, 1000 * 100);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
 // -----------------------------------------------------------------------------
 // update MT
 // -----------------------------------------------------------------------------
@@ -128,6 +155,66 @@ optics_test_head(lens_quantile_update_read_mt_test)
 }
 optics_test_tail()
 
+// -----------------------------------------------------------------------------
+// adaptive
+// -----------------------------------------------------------------------------
+
+static double quantile_read(struct optics_lens *lens, optics_epoch_t epoch)
+{
+    struct optics_quantile value = {0};
+    assert_int_equal(optics_quantile_read(lens, epoch, &value), optics_ok);
+    return value.sample;
+}
+
+optics_test_head(lens_quantile_adaptive_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    assert_null(optics_quantile_adaptive_create(optics, "bad", 0.90, 0, 0));
+
+    struct optics_lens *fixed = optics_quantile_create(optics, "fixed", 0.90, 70, 0.05);
+    struct optics_lens *adaptive =
+        optics_quantile_adaptive_create(optics, "adaptive", 0.90, 70, 0.05);
+    assert_int_equal(optics_lens_type(adaptive), optics_quantile);
+
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 100; j++) {
+            optics_quantile_update(fixed, j);
+            optics_quantile_update(adaptive, j);
+        }
+    }
+
+    assert_float_equal(quantile_read(fixed, epoch), 90, 1);
+    assert_float_equal(quantile_read(adaptive, epoch), 90, 5);
+
+    // After a shift of the distribution, the fixed step is still crawling
+    // towards the new quantile while the adaptive step is already there.
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < 100; j++) {
+            optics_quantile_update(fixed, 10000 + j);
+            optics_quantile_update(adaptive, 10000 + j);
+        }
+    }
+
+    assert_true(quantile_read(fixed, epoch) < 1000);
+    assert_float_equal(quantile_read(adaptive, epoch), 10090, 5);
+
+    // Same goes for shifts downwards.
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < 100; j++)
+            optics_quantile_update(adaptive, j);
+    }
+
+    assert_float_equal(quantile_read(adaptive, epoch), 90, 5);
+
+    optics_lens_close(fixed);
+    optics_lens_close(adaptive);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -137,7 +224,9 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(lens_quantile_create_test),
         cmocka_unit_test(lens_quantile_update_read_test),
-        cmocka_unit_test(lens_quantile_update_read_mt_test)
+        cmocka_unit_test(lens_quantile_sample_test),
+        cmocka_unit_test(lens_quantile_update_read_mt_test),
+        cmocka_unit_test(lens_quantile_adaptive_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
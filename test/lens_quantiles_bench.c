@@ -0,0 +1,134 @@
+/* lens_quantiles_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+
+
+struct quantiles_bench
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    struct optics_lens *singles[3];
+};
+
+static const double targets[] = { 0.5, 0.9, 0.99 };
+enum { targets_len = sizeof(targets) / sizeof(targets[0]) };
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static struct quantiles_bench make_bench(struct optics *optics)
+{
+    struct quantiles_bench bench = { .optics = optics };
+
+    bench.lens = optics_quantiles_create(
+            optics, "my_quantiles", targets, targets_len, 50, 0.05);
+
+    for (size_t i = 0; i < targets_len; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "my_quantile_%zu", i);
+        bench.singles[i] = optics_quantile_create(optics, name, targets[i], 50, 0.05);
+    }
+
+    return bench;
+}
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+// Compares one quantiles lens against one quantile lens per target which is
+// what users had to do before.
+
+void run_record_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct quantiles_bench *bench = data;
+    optics_bench_start(b);
+
+    size_t value = id;
+    for (size_t i = 0; i < n; ++i)
+        optics_quantiles_update(bench->lens, ++value % 100);
+}
+
+void run_record_singles_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct quantiles_bench *bench = data;
+    optics_bench_start(b);
+
+    size_t value = id;
+    for (size_t i = 0; i < n; ++i) {
+        ++value;
+        for (size_t j = 0; j < targets_len; ++j)
+            optics_quantile_update(bench->singles[j], value % 100);
+    }
+}
+
+optics_test_head(lens_quantiles_record_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct quantiles_bench bench = make_bench(optics);
+
+    optics_bench_st(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_quantiles_record_singles_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct quantiles_bench bench = make_bench(optics);
+
+    optics_bench_st(test_name, run_record_singles_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_quantiles_record_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct quantiles_bench bench = make_bench(optics);
+
+    optics_bench_mt(test_name, run_record_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_quantiles_record_singles_bench_mt)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct quantiles_bench bench = make_bench(optics);
+
+    optics_bench_mt(test_name, run_record_singles_bench, &bench);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_quantiles_record_bench_st),
+        cmocka_unit_test(lens_quantiles_record_singles_bench_st),
+        cmocka_unit_test(lens_quantiles_record_bench_mt),
+        cmocka_unit_test(lens_quantiles_record_singles_bench_mt),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,183 @@
+/* lens_quantiles_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/rng.h"
+
+#define calc_len(array) (sizeof(array) / sizeof(typeof((array)[0])))
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_quantiles_create_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_quantiles";
+    const double targets[] = { 0.5, 0.9, 0.99 };
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *lens = optics_quantiles_create(
+                optics, lens_name, targets, calc_len(targets), 0, 0.05);
+        if (!lens) optics_abort();
+
+        assert_int_equal(optics_lens_type(lens), optics_quantiles);
+        assert_string_equal(optics_lens_name(lens), lens_name);
+
+        assert_null(optics_quantiles_create(
+                        optics, lens_name, targets, calc_len(targets), 0, 0.05));
+
+        assert_non_null(lens = optics_lens_get(optics, lens_name));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_quantiles_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_quantiles";
+    const double targets[] = { 0.5, 0.9 };
+
+    struct optics_lens *l0 = optics_quantiles_open(
+            optics, lens_name, targets, calc_len(targets), 0, 0.05);
+    struct optics_lens *l1 = optics_quantiles_open(
+            optics, lens_name, targets, calc_len(targets), 0, 0.05);
+    assert_non_null(l0);
+    assert_true(l0 == l1);
+
+    optics_lens_close(l1);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// validate
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_quantiles_validate_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_quantiles";
+
+    {
+        const double targets[] = { 0.5 };
+        assert_null(optics_quantiles_create(optics, lens_name, targets, 0, 0, 1));
+    }
+
+    {
+        const double targets[] = { 0.9, 0.5 };
+        assert_null(optics_quantiles_create(optics, lens_name, targets, calc_len(targets), 0, 1));
+    }
+
+    {
+        const double targets[] = { 0.5, 0.5 };
+        assert_null(optics_quantiles_create(optics, lens_name, targets, calc_len(targets), 0, 1));
+    }
+
+    {
+        const double targets[] = { 0, 0.5 };
+        assert_null(optics_quantiles_create(optics, lens_name, targets, calc_len(targets), 0, 1));
+    }
+
+    {
+        const double targets[] = { 0.5, 1 };
+        assert_null(optics_quantiles_create(optics, lens_name, targets, calc_len(targets), 0, 1));
+    }
+
+    {
+        double targets[optics_quantiles_max + 1];
+        for (size_t i = 0; i < calc_len(targets); ++i) targets[i] = (i + 1) / 10.0;
+        assert_null(optics_quantiles_create(optics, lens_name, targets, calc_len(targets), 0, 1));
+        assert_non_null(optics_quantiles_create(optics, lens_name, targets, optics_quantiles_max, 0, 1));
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// update/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_quantiles_update_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const double targets[] = { 0.5, 0.9, 0.99 };
+    struct optics_lens *lens = optics_quantiles_create(
+            optics, "my_quantiles", targets, calc_len(targets), 50, 0.05);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 100; j++)
+            optics_quantiles_update(lens, j);
+    }
+
+    struct optics_quantiles value = {0};
+    assert_int_equal(optics_quantiles_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.len, calc_len(targets));
+    assert_int_equal(value.count, 1000 * 100);
+
+    for (size_t i = 0; i < calc_len(targets); ++i)
+        assert_true(value.quantiles[i] == targets[i]);
+
+    assert_float_equal(value.samples[0], 50, 1);
+    assert_float_equal(value.samples[1], 90, 1);
+    assert_float_equal(value.samples[2], 98.5, 1);
+
+    assert_int_equal(optics_quantiles_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.count, 0);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_quantiles_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_quantiles value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_lens *lens = optics_counter_create(optics, "blah");
+    assert_false(optics_quantiles_update(lens, 1));
+    assert_int_equal(optics_quantiles_read(lens, epoch, &value), optics_err);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    rng_seed_with(rng_global(), 0);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_quantiles_create_test),
+        cmocka_unit_test(lens_quantiles_open_test),
+        cmocka_unit_test(lens_quantiles_validate_test),
+        cmocka_unit_test(lens_quantiles_update_read_test),
+        cmocka_unit_test(lens_quantiles_type_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,113 @@
+/* lens_sketch_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+
+
+struct sketch_bench
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+};
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static struct optics_lens *make_basic_lens(struct optics * optics)
+{
+    return optics_sketch_create(optics, "my_sketch", 0.01, 1, 1e9);
+}
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+
+void run_record_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct sketch_bench *bench = data;
+    optics_bench_start(b);
+
+    size_t value = id;
+    for (size_t i = 0; i < n; ++i)
+        optics_sketch_record(bench->lens, (++value * 7919) % (1000 * 1000));
+}
+
+optics_test_head(lens_sketch_record_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_basic_lens(optics);
+
+    struct sketch_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_record_bench, &bench);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_sketch_record_bench_mt)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_basic_lens(optics);
+
+    struct sketch_bench bench = { optics, lens };
+    optics_bench_mt(test_name, run_record_bench, &bench);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// read
+// -----------------------------------------------------------------------------
+
+void run_read_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+
+    struct sketch_bench *bench = data;
+    optics_epoch_t epoch = optics_epoch(bench->optics);
+
+    optics_bench_start(b);
+
+    struct optics_sketch value;
+    for (size_t i = 0; i < n; ++i)
+        optics_sketch_read(bench->lens, epoch, &value);
+}
+
+optics_test_head(lens_sketch_read_bench_st)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = make_basic_lens(optics);
+
+    struct sketch_bench bench = { optics, lens };
+    optics_bench_st(test_name, run_read_bench, &bench);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_sketch_record_bench_st),
+        cmocka_unit_test(lens_sketch_record_bench_mt),
+        cmocka_unit_test(lens_sketch_read_bench_st),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
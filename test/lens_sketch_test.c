@@ -0,0 +1,410 @@
+/* lens_sketch_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/rng.h"
+#include "utils/time.h"
+
+#include <math.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+#define checked_sketch_read(lens, epoch)                                \
+    ({                                                                  \
+        struct optics_sketch value = {0};                               \
+        assert_int_equal(optics_sketch_read(lens, epoch, &value), optics_ok); \
+        value;                                                          \
+    })
+
+#define assert_rel_error(value, exp, err)                               \
+    do {                                                                \
+        double _v = (value);                                            \
+        double _e = (exp);                                              \
+        double _d = _v > _e ? _v - _e : _e - _v;                        \
+        optics_assert(_d <= _e * (err), "%g != %g (err=%g)", _v, _e, (double) (err)); \
+    } while (false)
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_create_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_sketch";
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *lens = optics_sketch_create(optics, lens_name, 0.01, 1, 1000);
+        if (!lens) optics_abort();
+
+        assert_int_equal(optics_lens_type(lens), optics_sketch);
+        assert_string_equal(optics_lens_name(lens), lens_name);
+
+        assert_null(optics_sketch_create(optics, lens_name, 0.01, 1, 1000));
+
+        assert_non_null(lens = optics_lens_get(optics, lens_name));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_sketch_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_sketch";
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_sketch_open(optics, lens_name, 0.01, 1, 1000);
+        if (!l0) optics_abort();
+        for (size_t j = 0; j < 50; ++j) optics_sketch_record(l0, 10);
+
+        struct optics_lens *l1 = optics_sketch_open(optics, lens_name, 0.01, 1, 1000);
+        if (!l1) optics_abort();
+        for (size_t j = 0; j < 25; ++j) optics_sketch_record(l1, 100);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+
+        struct optics_sketch value = checked_sketch_read(l0, epoch);
+        assert_int_equal(value.count, 75);
+        assert_rel_error(value.p50, 10, 0.01);
+        assert_rel_error(value.max, 100, 0.01);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// validate
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_validate_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_sketch";
+
+    assert_null(optics_sketch_create(optics, lens_name, 0, 1, 1000));
+    assert_null(optics_sketch_create(optics, lens_name, 1, 1, 1000));
+    assert_null(optics_sketch_create(optics, lens_name, NAN, 1, 1000));
+    assert_null(optics_sketch_create(optics, lens_name, 0.01, 0, 1000));
+    assert_null(optics_sketch_create(optics, lens_name, 0.01, -1, 1000));
+    assert_null(optics_sketch_create(optics, lens_name, 0.01, 10, 10));
+    assert_null(optics_sketch_create(optics, lens_name, 0.01, 10, 1));
+    assert_null(optics_sketch_create(optics, lens_name, 0.00001, 1e-300, 1e300));
+
+    assert_non_null(optics_sketch_create(optics, lens_name, 0.001, 1e-9, 1e9));
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// record/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_record_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const double alpha = 0.01;
+    struct optics_lens *lens = optics_sketch_create(optics, "my_sketch", alpha, 1, 1e6);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    {
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+        assert_int_equal(value.count, 0);
+        assert_true(value.p50 == 0);
+        assert_true(value.max == 0);
+    }
+
+    for (size_t i = 1; i <= 1000; ++i)
+        assert_true(optics_sketch_record(lens, i));
+
+    {
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+        assert_int_equal(value.count, 1000);
+        assert_int_equal(value.zero, 0);
+        assert_rel_error(value.p50, 500, alpha);
+        assert_rel_error(value.p90, 900, alpha);
+        assert_rel_error(value.p99, 990, alpha);
+        assert_rel_error(value.max, 1000, alpha);
+
+        for (size_t q = 1; q < 100; ++q)
+            assert_rel_error(optics_sketch_quantile(&value, q / 100.0), q * 10, alpha);
+
+        size_t sum = 0;
+        for (size_t i = 0; i < value.buckets_len; ++i) {
+            sum += value.counts[i];
+            if (i) assert_true(optics_sketch_bucket(&value, i - 1) < optics_sketch_bucket(&value, i));
+        }
+        assert_int_equal(sum, 1000);
+    }
+
+    {
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+        assert_int_equal(value.count, 0);
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+optics_test_head(lens_sketch_clamp_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_sketch_create(optics, "my_sketch", 0.01, 1, 1000);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    assert_true(optics_sketch_record(lens, -10));
+    assert_true(optics_sketch_record(lens, 0));
+    assert_true(optics_sketch_record(lens, NAN));
+    assert_true(optics_sketch_record(lens, 0.001));
+
+    {
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+        assert_int_equal(value.count, 4);
+        assert_int_equal(value.zero, 3);
+        assert_int_equal(value.counts[0], 1);
+        assert_true(value.p50 == 0);
+    }
+
+    assert_true(optics_sketch_record(lens, 1e12));
+
+    {
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+        assert_int_equal(value.count, 1);
+        assert_int_equal(value.counts[value.buckets_len - 1], 1);
+        assert_rel_error(value.max, 1000, 0.01);
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// merge
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_merge_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const double alpha = 0.01;
+    struct optics_lens *l0 = optics_sketch_create(optics, "s0", alpha, 1, 1000);
+    struct optics_lens *l1 = optics_sketch_create(optics, "s1", alpha, 100, 1e6);
+
+    for (size_t i = 1; i <= 500; ++i) optics_sketch_record(l0, i);
+    for (size_t i = 501; i <= 1000; ++i) optics_sketch_record(l1, i);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+    struct optics_sketch v0 = checked_sketch_read(l0, epoch);
+    struct optics_sketch v1 = checked_sketch_read(l1, epoch);
+
+    // Sketches with different ranges but the same alpha line up on their
+    // absolute bucket index.
+    int64_t lo = v0.offset < v1.offset ? v0.offset : v1.offset;
+    int64_t hi0 = v0.offset + (int64_t) v0.buckets_len;
+    int64_t hi1 = v1.offset + (int64_t) v1.buckets_len;
+    int64_t hi = hi0 > hi1 ? hi0 : hi1;
+
+    size_t len = hi - lo;
+    size_t *counts = calloc(len, sizeof(*counts));
+
+    for (size_t i = 0; i < v0.buckets_len; ++i) counts[v0.offset - lo + i] += v0.counts[i];
+    for (size_t i = 0; i < v1.buckets_len; ++i) counts[v1.offset - lo + i] += v1.counts[i];
+
+    struct optics_sketch merged = {
+        .count = v0.count + v1.count,
+        .alpha = alpha,
+        .gamma = v0.gamma,
+        .offset = lo,
+        .buckets_len = len,
+        .counts = counts,
+    };
+
+    assert_rel_error(optics_sketch_quantile(&merged, 0.5), 500, alpha);
+    assert_rel_error(optics_sketch_quantile(&merged, 0.9), 900, alpha);
+    assert_rel_error(optics_sketch_quantile(&merged, 0.99), 990, alpha);
+
+    free(counts);
+    optics_lens_close(l0);
+    optics_lens_close(l1);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_type_test)
+{
+    const char * lens_name = "blah";
+    struct optics *optics = optics_create(test_name);
+
+    struct optics_sketch value;
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    {
+        struct optics_lens *lens = optics_counter_create(optics, lens_name);
+
+        assert_false(optics_sketch_record(lens, 1));
+        assert_int_equal(optics_sketch_read(lens, epoch, &value), optics_err);
+    }
+
+    {
+        struct optics_lens *lens = optics_lens_get(optics, lens_name);
+
+        assert_false(optics_sketch_record(lens, 1));
+        assert_int_equal(optics_sketch_read(lens, epoch, &value), optics_err);
+
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_sketch_epoch_st_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_sketch_create(optics, "my_sketch", 0.01, 1, 1000);
+
+    for (size_t i = 1; i < 5; ++i) {
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        optics_sketch_record(lens, i * 100);
+
+        struct optics_sketch value = checked_sketch_read(lens, epoch);
+
+        if (i == 1) assert_int_equal(value.count, 0);
+        else {
+            assert_int_equal(value.count, 1);
+            assert_rel_error(value.max, (i - 1) * 100, 0.01);
+        }
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch mt
+// -----------------------------------------------------------------------------
+
+struct epoch_test
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    size_t workers;
+
+    atomic_size_t done;
+};
+
+size_t epoch_test_read_lens(struct epoch_test *test)
+{
+    optics_epoch_t epoch = optics_epoch_inc(test->optics);
+    nsleep(1 * 1000);
+
+    struct optics_sketch value = checked_sketch_read(test->lens, epoch);
+    return value.count;
+}
+
+void run_epoch_test(size_t id, void *ctx)
+{
+    struct epoch_test *test = ctx;
+    enum { iterations = 10 * 1000 * 1000 };
+
+    if (id) {
+        for (size_t i = 0; i < iterations; ++i)
+            optics_sketch_record(test->lens, i % 1000 + 1);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else {
+        size_t done;
+        size_t count = 0;
+        size_t writers = test->workers - 1;
+
+        do {
+            count += epoch_test_read_lens(test);
+            done = atomic_load_explicit(&test->done, memory_order_acquire);
+        } while (done < writers);
+
+        // Read whatever is leftover in the remaining epochs
+        for (size_t i = 0; i < 2; ++i)
+            count += epoch_test_read_lens(test);
+
+        size_t exp = iterations * writers;
+        optics_assert(count == exp, "%zu != %zu", count, exp);
+    }
+}
+
+optics_test_head(lens_sketch_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_sketch_create(optics, "my_sketch", 0.01, 1, 1000);
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    rng_seed_with(rng_global(), 0);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_sketch_create_test),
+        cmocka_unit_test(lens_sketch_open_test),
+        cmocka_unit_test(lens_sketch_validate_test),
+        cmocka_unit_test(lens_sketch_record_read_test),
+        cmocka_unit_test(lens_sketch_clamp_test),
+        cmocka_unit_test(lens_sketch_merge_test),
+        cmocka_unit_test(lens_sketch_type_test),
+        cmocka_unit_test(lens_sketch_epoch_st_test),
+        cmocka_unit_test(lens_sketch_epoch_mt_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
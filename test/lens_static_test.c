@@ -0,0 +1,97 @@
+/* lens_static_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+
+// -----------------------------------------------------------------------------
+// lenses
+// -----------------------------------------------------------------------------
+// Static lenses are process-wide which is why they get their own test binary.
+
+static const uint64_t static_buckets[] = { 0, 10, 100 };
+
+OPTICS_COUNTER(static_counter, "static_counter");
+OPTICS_GAUGE(static_gauge, "static_gauge");
+OPTICS_DIST(static_dist, "static_dist");
+OPTICS_STATIC(static_histo,
+        .type = optics_histo,
+        .name = "static_histo",
+        .histo = { .buckets = static_buckets, .buckets_len = 3 });
+
+
+// -----------------------------------------------------------------------------
+// open
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_static_open_test)
+{
+    assert_null(optics_static_lens(static_counter));
+
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_lens *counter = optics_static_lens(static_counter);
+    assert_non_null(counter);
+    assert_int_equal(optics_lens_type(counter), optics_counter);
+    assert_true(optics_lens_get(optics, "static_counter") == counter);
+
+    assert_int_equal(optics_lens_type(optics_static_lens(static_gauge)), optics_gauge);
+    assert_int_equal(optics_lens_type(optics_static_lens(static_dist)), optics_dist);
+    assert_int_equal(optics_lens_type(optics_static_lens(static_histo)), optics_histo);
+
+    assert_true(optics_counter_inc(optics_static_lens(static_counter), 2));
+    assert_true(optics_gauge_set(optics_static_lens(static_gauge), 1.5));
+    assert_true(optics_histo_inc(optics_static_lens(static_histo), 50));
+
+    int64_t value = 0;
+    assert_int_equal(optics_counter_read(counter, epoch, &value), optics_ok);
+    assert_int_equal(value, 2);
+
+    struct optics_histo histo = {0};
+    assert_int_equal(optics_histo_read(optics_static_lens(static_histo), epoch, &histo), optics_ok);
+    assert_int_equal(histo.buckets_len, 3);
+    assert_int_equal(histo.counts[1], 1);
+
+    // Only the first optics of the process backs the static lenses.
+    struct optics *other = optics_create("other");
+    assert_null(optics_lens_get(other, "static_counter"));
+    assert_true(optics_static_lens(static_counter) == counter);
+    optics_close(other);
+    assert_true(optics_static_lens(static_counter) == counter);
+
+    optics_close(optics);
+    assert_null(optics_static_lens(static_counter));
+    assert_null(optics_static_lens(static_histo));
+}
+optics_test_tail()
+
+
+optics_test_head(lens_static_reopen_test)
+{
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics *optics = optics_create(test_name);
+        assert_non_null(optics_static_lens(static_counter));
+        assert_true(optics_counter_inc(optics_static_lens(static_counter), 1));
+        optics_close(optics);
+        assert_null(optics_static_lens(static_counter));
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_static_open_test),
+        cmocka_unit_test(lens_static_reopen_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -4,6 +4,11 @@
 */
 
 #include "test.h"
+#include "utils/region.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 
 // -----------------------------------------------------------------------------
@@ -46,6 +51,7 @@ optics_test_head(lens_basics_st_test)
 
             lens[i] = optics_counter_create(optics, name);
             assert_int_equal(lens_count(optics), i + 1);
+            assert_int_equal(pun_ptoi(lens[i]) % 64, 0);
         }
 
         for (size_t i = 0; i < n; ++i) {
@@ -65,6 +71,11 @@ optics_test_head(lens_basics_st_test)
             assert_true(optics_lens_close(lens[j]));
             assert_int_equal(lens_count(optics), n - (i + 1));
         }
+
+        // Reclaims the closed lenses so that they get reused by the next
+        // iteration.
+        optics_epoch_inc(optics);
+        optics_epoch_inc(optics);
     }
 
     optics_close(optics);
@@ -124,6 +135,771 @@ optics_test_head(lens_basics_mt_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// open_mt_test
+// -----------------------------------------------------------------------------
+
+enum { open_mt_lenses = 1000 };
+
+struct open_mt
+{
+    struct optics *optics;
+    struct optics_lens *lenses[open_mt_lenses];
+};
+
+// Every thread opens the same lenses in a different order which spreads the
+// opens across all the partitions at once.
+void run_open_mt(size_t thread_id, void *ctx)
+{
+    struct open_mt *data = ctx;
+    char name[optics_name_max_len];
+
+    for (size_t i = 0; i < open_mt_lenses; ++i) {
+        size_t j = (i + thread_id * 7) % open_mt_lenses;
+        snprintf(name, sizeof(name), "lens_%lu", j);
+
+        struct optics_lens *lens = optics_counter_open(data->optics, name);
+        optics_assert(!!lens, "unable to open lens '%s'", name);
+        optics_assert(lens == data->lenses[j], "opened a duplicate lens '%s'", name);
+        optics_counter_inc(lens, 1);
+    }
+}
+
+optics_test_head(lens_open_mt_test)
+{
+    assert_mt();
+
+    struct open_mt data = { .optics = optics_create(test_name) };
+
+    for (size_t i = 0; i < open_mt_lenses; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%lu", i);
+        data.lenses[i] = optics_counter_create(data.optics, name);
+    }
+
+    run_threads(run_open_mt, &data, 0);
+    assert_int_equal(optics_lens_count(data.optics), open_mt_lenses);
+
+    optics_epoch_t epoch = optics_epoch_inc(data.optics);
+    for (size_t i = 0; i < open_mt_lenses; ++i) {
+        int64_t value = 0;
+        assert_int_equal(optics_counter_read(data.lenses[i], epoch, &value), optics_ok);
+        assert_int_equal(value, cpus());
+    }
+
+    optics_close(data.optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// keys
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_keys_st_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    enum { n = 1000 };
+    struct optics_lens *lens[n] = {0};
+
+    for (size_t iteration = 0; iteration < 5; ++iteration) {
+        for (size_t i = 0; i < n; ++i) {
+            char name[optics_name_max_len];
+            snprintf(name, sizeof(name), "lens_%lu", i);
+
+            if (!lens[i]) lens[i] = optics_counter_create(optics, name);
+            assert_non_null(lens[i]);
+        }
+
+        // Leaves a trail of tombstones behind which the lookups of the
+        // remaining lenses have to probe through.
+        for (size_t i = iteration % 2; i < n; i += 2) {
+            assert_true(optics_lens_close(lens[i]));
+            assert_false(optics_lens_close(lens[i]));
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            char name[optics_name_max_len];
+            snprintf(name, sizeof(name), "lens_%lu", i);
+
+            if (i % 2 == iteration % 2) {
+                assert_null(optics_lens_get(optics, name));
+                lens[i] = NULL;
+            }
+            else {
+                uint64_t hash = optics_lens_hash(name);
+                assert_true(optics_lens_get(optics, name) == lens[i]);
+                assert_true(optics_lens_get_h(optics, name, hash) == lens[i]);
+            }
+        }
+
+        optics_epoch_inc(optics);
+        optics_epoch_inc(optics);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// get_cached_test
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_get_cached_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *name = "lens";
+
+    assert_null(optics_lens_get_cached(optics, name));
+
+    // Misses aren't cached.
+    struct optics_lens *lens = optics_counter_create(optics, name);
+    for (size_t i = 0; i < 3; ++i)
+        assert_true(optics_lens_get_cached(optics, name) == lens);
+
+    // Closing a lens invalidates the cache.
+    assert_true(optics_lens_close(lens));
+    assert_null(optics_lens_get_cached(optics, name));
+
+    struct optics_lens *other = optics_gauge_create(optics, name);
+    assert_true(optics_lens_get_cached(optics, name) == other);
+
+    // Reusing the buffer of a name for another name.
+    struct optics_lens *a = optics_counter_create(optics, "lens_a");
+    struct optics_lens *b = optics_counter_create(optics, "lens_b");
+    struct optics_lens *c = optics_counter_create(optics, "other");
+
+    char buffer[optics_name_max_len];
+    strcpy(buffer, "lens_a");
+    assert_true(optics_lens_get_cached(optics, buffer) == a);
+    strcpy(buffer, "lens_b");
+    assert_true(optics_lens_get_cached(optics, buffer) == b);
+    strcpy(buffer, "other");
+    assert_true(optics_lens_get_cached(optics, buffer) == c);
+    strcpy(buffer, "missing");
+    assert_null(optics_lens_get_cached(optics, buffer));
+
+    // Entries are specific to their optics.
+    struct optics *optics2 = optics_create(test_name);
+    assert_null(optics_lens_get_cached(optics2, name));
+    struct optics_lens *lens2 = optics_counter_create(optics2, name);
+    assert_true(optics_lens_get_cached(optics2, name) == lens2);
+    assert_true(optics_lens_get_cached(optics, name) == other);
+
+    optics_close(optics2);
+    optics_close(optics);
+
+    // A new optics may reuse the address of a closed one.
+    optics = optics_create(test_name);
+    assert_null(optics_lens_get_cached(optics, name));
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// keys_mt_test
+// -----------------------------------------------------------------------------
+
+struct keys_mt
+{
+    struct optics *optics;
+    atomic_bool done;
+};
+
+enum { keys_mt_fixed = 100, keys_mt_churn = 1000 };
+
+void run_keys_mt(size_t thread_id, void *ctx)
+{
+    struct keys_mt *data = ctx;
+    char name[optics_name_max_len];
+
+    // A single writer constantly grows and shrinks the table while the readers
+    // look up the lenses that are never closed.
+    if (!thread_id) {
+        for (size_t iteration = 0; iteration < 100; ++iteration) {
+            struct optics_lens *lens[keys_mt_churn];
+
+            for (size_t i = 0; i < keys_mt_churn; ++i) {
+                snprintf(name, sizeof(name), "churn_%lu", i);
+                lens[i] = optics_counter_create(data->optics, name);
+            }
+
+            for (size_t i = 0; i < keys_mt_churn; ++i)
+                optics_lens_close(lens[i]);
+
+            optics_epoch_inc(data->optics);
+        }
+
+        atomic_store(&data->done, true);
+        return;
+    }
+
+    size_t i = 0;
+    while (!atomic_load_explicit(&data->done, memory_order_relaxed)) {
+        snprintf(name, sizeof(name), "fixed_%lu", i++ % keys_mt_fixed);
+
+        struct optics_lens *lens = optics_lens_get(data->optics, name);
+        optics_assert(!!lens, "missing lens '%s'", name);
+        optics_assert(!strcmp(optics_lens_name(lens), name),
+                "wrong lens '%s' != '%s'", optics_lens_name(lens), name);
+    }
+}
+
+optics_test_head(lens_keys_mt_test)
+{
+    assert_mt();
+
+    struct keys_mt data = { .optics = optics_create(test_name) };
+
+    for (size_t i = 0; i < keys_mt_fixed; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "fixed_%lu", i);
+        assert_non_null(optics_counter_create(data.optics, name));
+    }
+
+    run_threads(run_keys_mt, &data, 0);
+
+    optics_close(data.optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// foreach
+// -----------------------------------------------------------------------------
+
+struct foreach_test
+{
+    struct optics_lens **lenses;
+    size_t len;
+    size_t seen[1000];
+};
+
+enum optics_ret lens_foreach_cb(void *ctx, struct optics_lens *lens)
+{
+    struct foreach_test *test = ctx;
+
+    for (size_t i = 0; i < test->len; ++i) {
+        if (test->lenses[i] != lens) continue;
+        test->seen[i]++;
+        return optics_ok;
+    }
+
+    optics_fail("unknown lens '%s'", optics_lens_name(lens));
+    return optics_err;
+}
+
+void lens_foreach_check(struct optics *optics, struct optics_lens **lenses, size_t len)
+{
+    struct foreach_test test = { .lenses = lenses, .len = len };
+    assert_int_equal(optics_foreach_lens(optics, &test, lens_foreach_cb), optics_ok);
+
+    for (size_t i = 0; i < len; ++i)
+        assert_int_equal(test.seen[i], lenses[i] ? 1 : 0);
+}
+
+optics_test_head(lens_foreach_test)
+{
+    struct optics *optics = optics_create(test_name);
+    assert_int_equal(lens_count(optics), 0);
+
+    enum { n = 1000 };
+    struct optics_lens *lenses[n] = {0};
+
+    for (size_t i = 0; i < n; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%lu", i);
+        lenses[i] = optics_counter_create(optics, name);
+    }
+    lens_foreach_check(optics, lenses, n);
+
+    for (size_t i = 0; i < n; i += 3) {
+        optics_lens_close(lenses[i]);
+        lenses[i] = NULL;
+    }
+    lens_foreach_check(optics, lenses, n);
+
+    // Slots of the closed lenses get reused by the new lenses.
+    for (size_t i = 0; i < n; i += 6) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%lu_new", i);
+        lenses[i] = optics_gauge_create(optics, name);
+    }
+    lens_foreach_check(optics, lenses, n);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!lenses[i]) continue;
+        optics_lens_close(lenses[i]);
+        lenses[i] = NULL;
+    }
+    assert_int_equal(lens_count(optics), 0);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// defer
+// -----------------------------------------------------------------------------
+
+// Gets rid of the key and lens tables replaced while opening lenses.
+void lens_defer_flush(struct optics *optics)
+{
+    optics_epoch_inc(optics);
+    optics_epoch_inc(optics);
+    optics_reclaim(optics);
+    assert_int_equal(optics_defer_count(optics), 0);
+}
+
+optics_test_head(lens_defer_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    enum { n = 100 };
+    struct optics_lens *lenses[n] = {0};
+
+    for (size_t i = 0; i < n; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%02lu", i);
+        lenses[i] = optics_counter_create(optics, name);
+    }
+    lens_defer_flush(optics);
+
+    for (size_t i = 0; i < n; ++i) assert_true(optics_lens_close(lenses[i]));
+    assert_int_equal(optics_defer_count(optics), n);
+
+    // Vacating the epoch only hands the lenses over to the reclaim.
+    optics_epoch_inc(optics);
+    assert_int_equal(optics_defer_count(optics), n);
+    optics_epoch_inc(optics);
+    assert_int_equal(optics_defer_count(optics), n);
+
+    optics_reclaim(optics);
+    assert_int_equal(optics_defer_count(optics), 0);
+
+    // Lists that were never reclaimed are freed on the next epoch change.
+    for (size_t i = 0; i < n; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%02lu", i);
+        lenses[i] = optics_counter_create(optics, name);
+    }
+    lens_defer_flush(optics);
+
+    for (size_t i = 0; i < n; i += 2) assert_true(optics_lens_close(lenses[i]));
+    optics_epoch_inc(optics);
+    optics_epoch_inc(optics);
+    assert_int_equal(optics_defer_count(optics), n / 2);
+
+    for (size_t i = 1; i < n; i += 2) assert_true(optics_lens_close(lenses[i]));
+    optics_epoch_inc(optics);
+    optics_epoch_inc(optics);
+    assert_int_equal(optics_defer_count(optics), n / 2);
+
+    // Allocating a lens reclaims whatever is left.
+    struct optics_lens *lens = optics_counter_create(optics, "lens");
+    assert_int_equal(optics_defer_count(optics), 0);
+    optics_lens_close(lens);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_batch_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const uint64_t buckets[] = { 10, 20, 30 };
+    const double quantiles[] = { 0.5, 0.9 };
+
+    struct optics_lens *existing = optics_gauge_create(optics, "gauge");
+
+    const struct optics_lens_spec specs[] = {
+        { .type = optics_counter, .name = "counter" },
+        { .type = optics_counter, .name = "counter_sharded", .sharded = true },
+        { .type = optics_gauge, .name = "gauge" },
+        { .type = optics_dist, .name = "dist" },
+        { .type = optics_dist, .name = "dist_sharded", .sharded = true },
+        { .type = optics_dist, .name = "dist_reservoir", .dist = { 32 } },
+        { .type = optics_histo, .name = "histo", .histo = { buckets, 3 } },
+        { .type = optics_quantile, .name = "quantile", .quantile = { 0.9, 0, 0.05 } },
+        { .type = optics_quantiles, .name = "quantiles", .quantiles = { quantiles, 2, 0, 0.05 } },
+        { .type = optics_hdr, .name = "hdr", .hdr = { 1, 1000, 2 } },
+        { .type = optics_sketch, .name = "sketch", .sketch = { 0.01, 1, 1000 } },
+        { .type = optics_meter, .name = "meter" },
+        { .type = optics_topk, .name = "topk", .topk = { 8 } },
+        { .type = optics_hll, .name = "hll", .hll = { 10 } },
+        { .type = optics_updown, .name = "updown" },
+        { .type = optics_histo2d, .name = "histo2d", .histo2d = { buckets, 3, buckets, 3 } },
+        { .type = optics_counter, .name = "counter" },
+    };
+    enum { n = sizeof(specs) / sizeof(specs[0]) };
+
+    struct optics_lens *lenses[n] = {0};
+    assert_true(optics_lens_open_batch(optics, specs, n, lenses));
+    assert_int_equal(lens_count(optics), n - 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        assert_non_null(lenses[i]);
+        assert_int_equal(optics_lens_type(lenses[i]), specs[i].type);
+        assert_string_equal(optics_lens_name(lenses[i]), specs[i].name);
+        assert_true(optics_lens_get(optics, specs[i].name) == lenses[i]);
+    }
+
+    // Already existing lenses and duplicates within the batch are opened.
+    assert_true(lenses[2] == existing);
+    assert_true(lenses[n - 1] == lenses[0]);
+
+    assert_true(optics_lens_open_batch(optics, specs, n, lenses));
+    assert_int_equal(lens_count(optics), n - 1);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_batch_invalid_test)
+{
+    struct optics *optics = optics_create(test_name);
+
+    const struct optics_lens_spec specs[] = {
+        { .type = optics_counter, .name = "counter" },
+        { .type = optics_histo, .name = "histo", .histo = { NULL, 0 } },
+        { .type = optics_gauge, .name = "gauge" },
+    };
+    enum { n = sizeof(specs) / sizeof(specs[0]) };
+
+    struct optics_lens *lenses[n] = {0};
+    assert_false(optics_lens_open_batch(optics, specs, n, lenses));
+
+    assert_int_equal(lens_count(optics), 0);
+    assert_null(optics_lens_get(optics, "counter"));
+    assert_null(optics_lens_get(optics, "gauge"));
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// lazy
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_lazy_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    const uint64_t buckets[] = { 10, 20, 30 };
+    const struct optics_lens_spec counter_spec = { .type = optics_counter, .name = "counter" };
+    const struct optics_lens_spec histo_spec =
+        { .type = optics_histo, .name = "histo", .histo = { buckets, 3 } };
+
+    struct optics_lazy *counter = optics_lazy_open(optics, &counter_spec);
+    struct optics_lazy *histo = optics_lazy_open(optics, &histo_spec);
+
+    // Nothing is opened until the first record.
+    assert_int_equal(lens_count(optics), 0);
+    assert_null(optics_lens_get(optics, "counter"));
+
+    struct optics_lens *lens = optics_lazy_lens(counter);
+    assert_non_null(lens);
+    assert_true(optics_lazy_lens(counter) == lens);
+    assert_true(optics_counter_open(optics, "counter") == lens);
+    assert_true(optics_lens_get(optics, "counter") == lens);
+    assert_int_equal(lens_count(optics), 1);
+
+    assert_true(optics_counter_inc(optics_lazy_lens(counter), 1));
+    assert_true(optics_counter_inc(optics_lazy_lens(counter), 2));
+
+    int64_t value = 0;
+    assert_int_equal(optics_counter_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value, 3);
+
+    assert_true(optics_histo_inc(optics_lazy_lens(histo), 15));
+    assert_int_equal(optics_lens_type(optics_lazy_lens(histo)), optics_histo);
+    assert_int_equal(lens_count(optics), 2);
+
+    optics_lazy_close(histo);
+    assert_null(optics_lens_get(optics, "histo"));
+
+    // Stubs that were never recorded to close without a lens.
+    const struct optics_lens_spec idle_spec = { .type = optics_gauge, .name = "idle" };
+    optics_lazy_close(optics_lazy_open(optics, &idle_spec));
+
+    optics_lazy_close(counter);
+    assert_int_equal(lens_count(optics), 0);
+
+    // Invalid specs are only caught when the lens is opened.
+    const struct optics_lens_spec invalid_spec =
+        { .type = optics_histo, .name = "invalid", .histo = { NULL, 0 } };
+    struct optics_lazy *invalid = optics_lazy_open(optics, &invalid_spec);
+    assert_non_null(invalid);
+    assert_null(optics_lazy_lens(invalid));
+    optics_lazy_close(invalid);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// cap
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_cap_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_lens *before = optics_counter_create(optics, "before");
+    assert_true(optics_lens_cap(optics, 3));
+    assert_true(optics_lens_cap_prefix(optics, "peer.", 1));
+    assert_false(optics_lens_cap_prefix(optics, "", 1));
+
+    struct optics_lens *a = optics_counter_open(optics, "peer.a");
+    assert_string_equal(optics_lens_name(a), "peer.a");
+
+    // The prefix cap is reached: new names are redirected to the overflow lens
+    // of their type while existing names are still opened.
+    struct optics_lens *b = optics_counter_open(optics, "peer.b");
+    struct optics_lens *c = optics_counter_open(optics, "peer.c");
+    struct optics_lens *d = optics_gauge_open(optics, "peer.d");
+    assert_string_equal(optics_lens_name(b), "overflow.counter");
+    assert_true(b == c);
+    assert_string_equal(optics_lens_name(d), "overflow.gauge");
+    assert_true(optics_counter_open(optics, "peer.a") == a);
+    assert_null(optics_counter_create(optics, "peer.e"));
+    assert_int_equal(optics_lens_rejected(optics), 4);
+
+    optics_counter_inc(b, 1);
+    optics_counter_inc(c, 2);
+
+    int64_t value = 0;
+    assert_int_equal(optics_counter_read(b, epoch, &value), optics_ok);
+    assert_int_equal(value, 3);
+
+    // Closing the overflow lens leaves it to the other lenses it stands in for.
+    assert_true(optics_lens_close(b));
+    assert_non_null(optics_lens_get(optics, "overflow.counter"));
+
+    // The global cap counts the lenses opened before it was set and overflow
+    // lenses never count.
+    struct optics_lens *x = optics_counter_open(optics, "x");
+    assert_string_equal(optics_lens_name(x), "x");
+    struct optics_lens *y = optics_counter_open(optics, "y");
+    assert_string_equal(optics_lens_name(y), "overflow.counter");
+
+    // Closing a lens frees up its spot.
+    optics_lens_close(a);
+    a = optics_counter_open(optics, "peer.f");
+    assert_string_equal(optics_lens_name(a), "peer.f");
+    assert_int_equal(optics_lens_rejected(optics), 5);
+
+    // Removing the caps lets new lenses through.
+    assert_true(optics_lens_cap(optics, 0));
+    assert_true(optics_lens_cap_prefix(optics, "peer.", 0));
+    struct optics_lens *z = optics_counter_open(optics, "peer.z");
+    assert_string_equal(optics_lens_name(z), "peer.z");
+
+    optics_lens_close(before);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// errors
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_error_cheap_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_counter_create(optics, "counter");
+
+    optics_error_mode(optics_error_cheap);
+
+    // Only the first failure of the call site is formatted with a backtrace.
+    assert_false(optics_gauge_set(lens, 1));
+    assert_null(strchr(optics_errno.msg, '%'));
+    assert_true(optics_errno.backtrace_len > 0);
+
+    for (size_t i = 0; i < 3; ++i) {
+        assert_false(optics_gauge_set(lens, 1));
+        assert_string_equal(optics_errno.msg, "invalid lens type: %d != %d");
+        assert_int_equal(optics_errno.backtrace_len, 0);
+        assert_non_null(optics_errno.file);
+    }
+
+    optics_error_mode(optics_error_full);
+
+    assert_false(optics_gauge_set(lens, 1));
+    assert_null(strchr(optics_errno.msg, '%'));
+    assert_true(optics_errno.backtrace_len > 0);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// shm
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_shm_test)
+{
+    struct optics *optics = optics_create_shm(test_name, NULL);
+    if (!optics) optics_abort();
+    assert_true(optics_shm_fd(optics) >= 0);
+
+    enum { n = 1000 };
+    struct optics_lens *lens[n] = {0};
+
+    for (size_t i = 0; i < n; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "lens_%lu", i);
+
+        lens[i] = optics_counter_create(optics, name);
+        assert_true(optics_counter_inc(lens[i], i));
+    }
+
+    for (size_t i = 0; i < n; i += 2) optics_lens_close(lens[i]);
+
+    struct region_view view;
+    if (!region_view_open(&view, optics_shm_fd(optics))) optics_abort();
+
+    // The root tracks the head of the lens list.
+    const void *root = region_view_root(&view, 64);
+    assert_non_null(root);
+    assert_int_equal(memcmp(root, lens[n - 1], 64), 0);
+
+    for (size_t i = 1; i < n; i += 2) {
+        const char *name = optics_lens_name(lens[i]);
+        size_t len = strlen(name) + 1;
+
+        const char *shared = region_view_ptr(&view, (uintptr_t) name, len);
+        assert_non_null(shared);
+        assert_string_equal(shared, name);
+    }
+
+    region_view_close(&view);
+
+    // Lenses in shm mode otherwise behave like regular lenses.
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+    for (size_t i = 1; i < n; i += 2) {
+        int64_t value = 0;
+        assert_int_equal(optics_counter_read(lens[i], epoch, &value), optics_ok);
+        assert_int_equal(value, i);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+optics_test_head(lens_shm_named_test)
+{
+    char shm[NAME_MAX];
+    snprintf(shm, sizeof(shm), "/optics_%s_%d", test_name, getpid());
+
+    struct optics *optics = optics_create_shm(test_name, shm);
+    if (!optics) optics_abort();
+
+    assert_null(optics_create_shm(test_name, shm));
+    optics_close(optics);
+
+    optics = optics_create(test_name);
+    assert_int_equal(optics_shm_fd(optics), -1);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// fork
+// -----------------------------------------------------------------------------
+
+// Children can't report through cmocka so failures are signaled through the
+// exit code instead. Closing a lens removes it so the children leave them be.
+static int run_fork_child(struct optics *optics, size_t id)
+{
+    struct optics_lens *shared = optics_counter_open(optics, "shared");
+    if (!shared) return 1;
+
+    for (size_t i = 0; i < 1000; ++i)
+        if (!optics_counter_inc(shared, 1)) return 2;
+
+    char name[optics_name_max_len];
+    snprintf(name, sizeof(name), "child_%lu", id);
+
+    struct optics_lens *lens = optics_counter_create(optics, name);
+    if (!lens) return 3;
+    if (!optics_counter_inc(lens, id + 1)) return 4;
+
+    optics_close(optics);
+    return 0;
+}
+
+optics_test_head(lens_fork_test)
+{
+    struct optics *optics = optics_create_fork(test_name, 4 * 1024 * 1024);
+    if (!optics) optics_abort();
+    assert_int_equal(optics_shm_fd(optics), -1);
+
+    struct optics_lens *shared = optics_counter_create(optics, "shared");
+    assert_true(optics_counter_inc(shared, 1));
+
+    enum { children = 4 };
+    pid_t pids[children];
+
+    for (size_t i = 0; i < children; ++i) {
+        pids[i] = fork();
+        if (pids[i] == -1) optics_abort();
+        if (!pids[i]) _exit(run_fork_child(optics, i));
+    }
+
+    for (size_t i = 0; i < children; ++i) {
+        int status = 0;
+        assert_int_equal(waitpid(pids[i], &status, 0), pids[i]);
+        assert_true(WIFEXITED(status));
+        assert_int_equal(WEXITSTATUS(status), 0);
+    }
+
+    // Lenses created by the children are visible to the creator.
+    assert_int_equal(lens_count(optics), children + 1);
+
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+
+    int64_t value = 0;
+    assert_int_equal(optics_counter_read(shared, epoch, &value), optics_ok);
+    assert_int_equal(value, children * 1000 + 1);
+
+    for (size_t i = 0; i < children; ++i) {
+        char name[optics_name_max_len];
+        snprintf(name, sizeof(name), "child_%lu", i);
+
+        struct optics_lens *lens = optics_counter_open(optics, name);
+        assert_non_null(lens);
+        assert_int_equal(optics_counter_read(lens, epoch, &value), optics_ok);
+        assert_int_equal(value, i + 1);
+        optics_lens_close(lens);
+    }
+
+    optics_lens_close(shared);
+    optics_close(optics);
+
+    assert_null(optics_create_fork(test_name, 0));
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -133,6 +909,20 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(lens_basics_st_test),
         cmocka_unit_test(lens_basics_mt_test),
+        cmocka_unit_test(lens_open_mt_test),
+        cmocka_unit_test(lens_keys_st_test),
+        cmocka_unit_test(lens_get_cached_test),
+        cmocka_unit_test(lens_keys_mt_test),
+        cmocka_unit_test(lens_foreach_test),
+        cmocka_unit_test(lens_defer_test),
+        cmocka_unit_test(lens_batch_test),
+        cmocka_unit_test(lens_batch_invalid_test),
+        cmocka_unit_test(lens_lazy_test),
+        cmocka_unit_test(lens_cap_test),
+        cmocka_unit_test(lens_error_cheap_test),
+        cmocka_unit_test(lens_shm_test),
+        cmocka_unit_test(lens_shm_named_test),
+        cmocka_unit_test(lens_fork_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,327 @@
+/* lens_topk_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static const struct optics_topk_entry *
+topk_find(const struct optics_topk *topk, const char *key)
+{
+    for (size_t i = 0; i < topk->len; ++i)
+        if (!strcmp(topk->entries[i].key, key)) return &topk->entries[i];
+    return NULL;
+}
+
+#define assert_entry(topk, key, exp)                                    \
+    do {                                                                \
+        const struct optics_topk_entry *entry = topk_find(topk, key);   \
+        assert_non_null(entry);                                         \
+        assert_int_equal(entry->count, exp);                            \
+        assert_int_equal(entry->error, 0);                              \
+    } while (false)
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_topk_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_topk";
+
+    assert_null(optics_topk_create(optics, lens_name, 0));
+    assert_null(optics_topk_create(optics, lens_name, optics_topk_max + 1));
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_topk_create(optics, lens_name, 4);
+        if (!l0) optics_abort();
+
+        assert_int_equal(optics_lens_type(l0), optics_topk);
+        assert_string_equal(optics_lens_name(l0), lens_name);
+        assert_null(optics_topk_create(optics, lens_name, 4));
+
+        struct optics_lens *l1 = optics_topk_open(optics, lens_name, 4);
+        if (!l1) optics_abort();
+
+        optics_topk_inc(l0, "a", 1);
+        optics_topk_inc(l1, "a", 2);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+
+        struct optics_topk value = {0};
+        assert_int_equal(optics_topk_read(l0, epoch, &value), optics_ok);
+        assert_int_equal(value.count, 3);
+        assert_int_equal(value.len, 1);
+        assert_entry(&value, "a", 3);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// record/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_topk_record_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_topk_create(optics, "my_topk", 3);
+
+    optics_epoch_t epoch = optics_epoch(optics);
+    struct optics_topk value = {0};
+
+    assert_int_equal(optics_topk_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.count, 0);
+    assert_int_equal(value.len, 0);
+
+    optics_topk_inc(lens, "a", 1);
+    optics_topk_inc(lens, "b", 20);
+    optics_topk_inc(lens, "c", 5);
+    optics_topk_inc(lens, "d", 10);
+    optics_topk_inc(lens, "a", 1);
+    optics_topk_inc_id(lens, 1234, 15);
+
+    // Entries are sorted by decreasing count and only the top k are reported.
+    assert_int_equal(optics_topk_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.count, 52);
+    assert_int_equal(value.len, 3);
+    assert_string_equal(value.entries[0].key, "b");
+    assert_string_equal(value.entries[1].key, "1234");
+    assert_string_equal(value.entries[2].key, "d");
+    assert_entry(&value, "b", 20);
+    assert_entry(&value, "1234", 15);
+    assert_entry(&value, "d", 10);
+
+    // Reads reset the epoch.
+    assert_int_equal(optics_topk_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.count, 0);
+    assert_int_equal(value.len, 0);
+
+    // Keys are sanitized and truncated.
+    char key[optics_topk_key_max * 2] = {0};
+    memset(key, 'x', sizeof(key) - 1);
+    optics_topk_inc(lens, key, 1);
+    optics_topk_inc(lens, "a.b c\"d", 2);
+
+    char truncated[optics_topk_key_max] = {0};
+    memset(truncated, 'x', sizeof(truncated) - 1);
+
+    assert_int_equal(optics_topk_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.len, 2);
+    assert_entry(&value, "a_b_c_d", 2);
+    assert_entry(&value, truncated, 1);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// heavy hitters
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_topk_heavy_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_topk_create(optics, "my_topk", 4);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    enum { heavy = 4, heavy_count = 1000, noise = 10 * 1000 };
+
+    // Heavy keys are interleaved with a long tail of keys that are only seen
+    // once and which keep evicting each-other.
+    for (size_t i = 0; i < noise; ++i) {
+        optics_topk_inc_id(lens, (1UL << 32) + i, 1);
+        if (i % (noise / heavy_count)) continue;
+
+        for (size_t j = 0; j < heavy; ++j) optics_topk_inc_id(lens, j, 1);
+    }
+
+    struct optics_topk value = {0};
+    assert_int_equal(optics_topk_read(lens, epoch, &value), optics_ok);
+    assert_int_equal(value.count, noise + heavy * heavy_count);
+    assert_int_equal(value.len, heavy);
+
+    for (size_t j = 0; j < heavy; ++j) {
+        char key[optics_topk_key_max];
+        snprintf(key, sizeof(key), "%lu", j);
+
+        const struct optics_topk_entry *entry = topk_find(&value, key);
+        assert_non_null(entry);
+
+        // Space-Saving never undercounts and the error bounds the overcount.
+        assert_true(entry->count >= heavy_count);
+        assert_true(entry->count - entry->error <= heavy_count);
+    }
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_topk_epoch_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_topk_create(optics, "my_topk", 2);
+
+    optics_topk_inc(lens, "a", 1);
+    optics_epoch_t e0 = optics_epoch_inc(optics);
+
+    optics_topk_inc(lens, "b", 2);
+
+    struct optics_topk value = {0};
+    assert_int_equal(optics_topk_read(lens, e0, &value), optics_ok);
+    assert_int_equal(value.len, 1);
+    assert_entry(&value, "a", 1);
+
+    optics_epoch_t e1 = optics_epoch_inc(optics);
+    assert_int_equal(optics_topk_read(lens, e1, &value), optics_ok);
+    assert_int_equal(value.len, 1);
+    assert_entry(&value, "b", 2);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_topk_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_topk topk;
+    int64_t counter;
+
+    {
+        struct optics_lens *lens = optics_counter_create(optics, "counter");
+        assert_false(optics_topk_inc(lens, "a", 1));
+        assert_false(optics_topk_inc_id(lens, 1, 1));
+        assert_int_equal(optics_topk_read(lens, epoch, &topk), optics_err);
+        optics_lens_close(lens);
+    }
+
+    {
+        struct optics_lens *lens = optics_topk_create(optics, "topk", 1);
+        assert_false(optics_counter_inc(lens, 1));
+        assert_int_equal(optics_counter_read(lens, epoch, &counter), optics_err);
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch mt
+// -----------------------------------------------------------------------------
+
+struct epoch_test
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    size_t workers;
+
+    atomic_size_t done;
+};
+
+size_t epoch_test_read_lens(struct epoch_test *test)
+{
+    optics_epoch_t epoch = optics_epoch_inc(test->optics);
+
+    enum optics_ret ret;
+    struct optics_topk value = {0};
+    while ((ret = optics_topk_read(test->lens, epoch, &value)) == optics_busy);
+    assert_int_equal(ret, optics_ok);
+
+    return value.count;
+}
+
+void run_epoch_test(size_t id, void *ctx)
+{
+    struct epoch_test *test = ctx;
+    enum { iterations = 100 * 1000 };
+
+    if (id) {
+        for (size_t i = 0; i < iterations; ++i)
+            optics_topk_inc_id(test->lens, i % 64, 1);
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else {
+        size_t done;
+        uint64_t result = 0;
+        size_t writers = test->workers - 1;
+
+        do {
+            result += epoch_test_read_lens(test);
+            done = atomic_load_explicit(&test->done, memory_order_acquire);
+        } while (done < writers);
+
+        for (size_t i = 0; i < 2; ++i)
+            result += epoch_test_read_lens(test);
+
+        optics_assert(result == writers * iterations, "%lu != %lu",
+                result, writers * iterations);
+    }
+}
+
+optics_test_head(lens_topk_epoch_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_topk_create(optics, "my_topk", 8);
+
+    struct epoch_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_epoch_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_topk_open_test),
+        cmocka_unit_test(lens_topk_record_read_test),
+        cmocka_unit_test(lens_topk_heavy_test),
+        cmocka_unit_test(lens_topk_epoch_test),
+        cmocka_unit_test(lens_topk_type_test),
+        cmocka_unit_test(lens_topk_epoch_mt_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
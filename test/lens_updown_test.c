@@ -0,0 +1,231 @@
+/* lens_updown_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+#define assert_read(lens, epoch, exp_value, exp_min, exp_max)           \
+    do {                                                                \
+        struct optics_updown value = {0};                               \
+        assert_int_equal(optics_updown_read(lens, epoch, &value), optics_ok); \
+        assert_int_equal(value.value, exp_value);                       \
+        assert_int_equal(value.min, exp_min);                           \
+        assert_int_equal(value.max, exp_max);                           \
+    } while (false)
+
+
+// -----------------------------------------------------------------------------
+// open/close
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_updown_open_test)
+{
+    struct optics *optics = optics_create(test_name);
+    const char *lens_name = "my_updown";
+
+    for (size_t i = 0; i < 3; ++i) {
+        struct optics_lens *l0 = optics_updown_create(optics, lens_name);
+        if (!l0) optics_abort();
+
+        assert_int_equal(optics_lens_type(l0), optics_updown);
+        assert_string_equal(optics_lens_name(l0), lens_name);
+        assert_null(optics_updown_create(optics, lens_name));
+
+        struct optics_lens *l1 = optics_updown_open(optics, lens_name);
+        if (!l1) optics_abort();
+
+        optics_updown_add(l0, 1);
+        optics_updown_add(l1, 2);
+
+        optics_epoch_t epoch = optics_epoch_inc(optics);
+        assert_read(l0, epoch, 3, 0, 3);
+
+        optics_lens_close(l1);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// add/read
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_updown_add_read_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_updown_create(optics, "my_updown");
+
+    assert_read(lens, optics_epoch_inc(optics), 0, 0, 0);
+
+    optics_updown_add(lens, 10);
+    optics_updown_add(lens, -4);
+    optics_updown_add(lens, 2);
+    assert_read(lens, optics_epoch_inc(optics), 8, 0, 10);
+
+    // The value is retained across epochs.
+    assert_read(lens, optics_epoch_inc(optics), 8, 8, 8);
+
+    optics_updown_add(lens, -20);
+    optics_updown_add(lens, 5);
+    assert_read(lens, optics_epoch_inc(optics), -7, -12, 8);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// epoch
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_updown_epoch_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_updown_create(optics, "my_updown");
+
+    optics_updown_add(lens, 5);
+    optics_updown_add(lens, -5);
+    optics_epoch_t e0 = optics_epoch_inc(optics);
+    assert_read(lens, e0, 0, 0, 5);
+
+    // Watermarks of an epoch start from the value read at the end of the
+    // previous epoch.
+    optics_updown_add(lens, -3);
+    optics_updown_add(lens, 1);
+    optics_epoch_t e1 = optics_epoch_inc(optics);
+    assert_read(lens, e1, -2, -3, 0);
+
+    optics_epoch_t e2 = optics_epoch_inc(optics);
+    assert_read(lens, e2, -2, -2, -2);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// type
+// -----------------------------------------------------------------------------
+
+optics_test_head(lens_updown_type_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_epoch_t epoch = optics_epoch(optics);
+
+    struct optics_updown updown;
+    double gauge;
+
+    {
+        struct optics_lens *lens = optics_gauge_create(optics, "gauge");
+        assert_false(optics_updown_add(lens, 1));
+        assert_int_equal(optics_updown_read(lens, epoch, &updown), optics_err);
+        optics_lens_close(lens);
+    }
+
+    {
+        struct optics_lens *lens = optics_updown_create(optics, "updown");
+        assert_false(optics_gauge_set(lens, 1));
+        assert_int_equal(optics_gauge_read(lens, epoch, &gauge), optics_err);
+        assert_false(optics_lens_sample_rate(lens, 2));
+        optics_lens_close(lens);
+    }
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// mt
+// -----------------------------------------------------------------------------
+
+struct mt_test
+{
+    struct optics *optics;
+    struct optics_lens *lens;
+    size_t workers;
+
+    atomic_size_t done;
+};
+
+void run_mt_test(size_t id, void *ctx)
+{
+    struct mt_test *test = ctx;
+    enum { iterations = 1000 * 1000, depth = 10 };
+
+    if (id) {
+        for (size_t i = 0; i < iterations; ++i) {
+            int64_t delta = i % (2 * depth) < depth ? 1 : -1;
+            optics_updown_add(test->lens, delta);
+        }
+
+        atomic_fetch_add_explicit(&test->done, 1, memory_order_release);
+    }
+
+    else {
+        size_t writers = test->workers - 1;
+        int64_t bound = writers * depth;
+
+        struct optics_updown value = {0};
+        do {
+            optics_epoch_t epoch = optics_epoch_inc(test->optics);
+            assert_int_equal(optics_updown_read(test->lens, epoch, &value), optics_ok);
+
+            optics_assert(value.min >= 0 && value.max <= bound,
+                    "[%ld, %ld] not in [0, %ld]", value.min, value.max, bound);
+            optics_assert(value.min <= value.value && value.value <= value.max,
+                    "%ld not in [%ld, %ld]", value.value, value.min, value.max);
+
+        } while (atomic_load_explicit(&test->done, memory_order_acquire) < writers);
+
+        optics_epoch_t epoch = optics_epoch_inc(test->optics);
+        assert_int_equal(optics_updown_read(test->lens, epoch, &value), optics_ok);
+        assert_int_equal(value.value, 0);
+    }
+}
+
+optics_test_head(lens_updown_mt_test)
+{
+    assert_mt();
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *lens = optics_updown_create(optics, "my_updown");
+
+    struct mt_test data = {
+        .optics = optics,
+        .lens = lens,
+        .workers = cpus(),
+    };
+    run_threads(run_mt_test, &data, data.workers);
+
+    optics_lens_close(lens);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(lens_updown_open_test),
+        cmocka_unit_test(lens_updown_add_read_test),
+        cmocka_unit_test(lens_updown_epoch_test),
+        cmocka_unit_test(lens_updown_type_test),
+        cmocka_unit_test(lens_updown_mt_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
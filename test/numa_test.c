@@ -0,0 +1,187 @@
+/* numa_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/numa.h"
+
+
+// -----------------------------------------------------------------------------
+// list
+// -----------------------------------------------------------------------------
+
+#define assert_list(list, ...)                                          \
+    do {                                                                \
+        bool set[16];                                                   \
+        assert_true(numa_parse_list(list, set, 16));                    \
+                                                                        \
+        bool exp[16] = {0};                                             \
+        const size_t indexes[] = { __VA_ARGS__ };                       \
+        for (size_t i = 1; i < sizeof(indexes) / sizeof(indexes[0]); ++i) \
+            exp[indexes[i]] = true;                                     \
+                                                                        \
+        for (size_t i = 0; i < 16; ++i)                                 \
+            assert_int_equal(set[i], exp[i]);                           \
+    } while (false)
+
+optics_test_head(numa_list_test)
+{
+    // The first index of the expectations is a placeholder to allow for empty
+    // sets.
+    assert_list("", 0);
+    assert_list("\n", 0);
+    assert_list("0", 0, 0);
+    assert_list("3\n", 0, 3);
+    assert_list("0-3", 0, 0, 1, 2, 3);
+    assert_list("0-1,4,6-7\n", 0, 0, 1, 4, 6, 7);
+    assert_list("15", 0, 15);
+
+    bool set[16];
+    assert_false(numa_parse_list("16", set, 16));
+    assert_false(numa_parse_list("0-16", set, 16));
+    assert_false(numa_parse_list("3-1", set, 16));
+    assert_false(numa_parse_list("1,,2", set, 16));
+    assert_false(numa_parse_list("-1", set, 16));
+    assert_false(numa_parse_list("1-", set, 16));
+    assert_false(numa_parse_list("a", set, 16));
+    assert_false(numa_parse_list("99999999999999999999", set, 16));
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// topology
+// -----------------------------------------------------------------------------
+
+optics_test_head(numa_topology_test)
+{
+    size_t node, index;
+
+    const char *cpulists[] = { "0-1", "2-4", "" };
+    assert_true(numa_set_topology(cpulists, 3));
+    assert_int_equal(numa_nodes(), 3);
+    assert_int_equal(numa_node_cpus(), 3);
+
+    assert_true(numa_cpu(1, &node, &index));
+    assert_int_equal(node, 0);
+    assert_int_equal(index, 1);
+
+    assert_true(numa_cpu(3, &node, &index));
+    assert_int_equal(node, 1);
+    assert_int_equal(index, 1);
+
+    assert_false(numa_cpu(5, &node, &index));
+    assert_false(numa_cpu(numa_cpus_max, &node, &index));
+
+    const char *invalid[] = { "0", "1-" };
+    assert_false(numa_set_topology(invalid, 2));
+    assert_int_equal(numa_nodes(), 1);
+    assert_false(numa_cpu(0, &node, &index));
+
+    assert_true(numa_set_topology(NULL, 0));
+    assert_int_equal(numa_nodes(), 1);
+    assert_int_equal(numa_node_cpus(), cpus());
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// lens
+// -----------------------------------------------------------------------------
+
+enum { lens_workers = 4, lens_records = 1000 };
+
+struct lens_test
+{
+    struct optics_lens *counter;
+    struct optics_lens *dist;
+    struct optics_lens *histo;
+};
+
+static void run_lens_test(size_t id, void *ctx)
+{
+    (void) id;
+    struct lens_test *data = ctx;
+
+    for (size_t i = 0; i < lens_records; ++i) {
+        optics_counter_inc(data->counter, 1);
+        optics_dist_record(data->dist, 10);
+        optics_histo_inc(data->histo, 15);
+    }
+}
+
+// Splits the cpus of the machine over two nodes where flip decides which node
+// gets the even cpus. Either way some of the shards live on the second node
+// even on a single cpu machine.
+static void lens_test_topology(bool flip)
+{
+    char lists[2][1024] = {{0}};
+    size_t pos[2] = {0};
+
+    for (size_t cpu = 0; cpu < cpus() && cpu < 128; ++cpu) {
+        size_t node = (cpu + flip) % 2;
+        pos[node] += snprintf(lists[node] + pos[node], sizeof(lists[node]) - pos[node],
+                "%s%zu", pos[node] ? "," : "", cpu);
+    }
+
+    const char *cpulists[] = { lists[0], lists[1] };
+    assert_true(numa_set_topology(cpulists, 2));
+    assert_int_equal(numa_nodes(), 2);
+}
+
+optics_test_head(numa_lens_test)
+{
+    for (size_t flip = 0; flip < 2; ++flip) {
+        lens_test_topology(flip);
+
+        struct optics *optics = optics_create(test_name);
+        const uint64_t buckets[] = {10, 20, 30};
+
+        struct lens_test data = {
+            .counter = optics_counter_sharded_create(optics, "counter"),
+            .dist = optics_dist_sharded_create(optics, "dist"),
+            .histo = optics_histo_sharded_create(optics, "histo", buckets, 3),
+        };
+        run_threads(run_lens_test, &data, lens_workers);
+
+        optics_epoch_t epoch = optics_epoch(optics);
+        const size_t total = lens_workers * lens_records;
+
+        int64_t counter = 0;
+        assert_int_equal(optics_counter_read(data.counter, epoch, &counter), optics_ok);
+        assert_int_equal(counter, total);
+
+        struct optics_dist dist = {0};
+        assert_int_equal(optics_dist_read(data.dist, epoch, &dist), optics_ok);
+        assert_int_equal(dist.n, total);
+        assert_float_equal(dist.max, 10, 0.0001);
+
+        struct optics_histo histo = {0};
+        assert_int_equal(optics_histo_read(data.histo, epoch, &histo), optics_ok);
+        assert_int_equal(histo.counts[0], total);
+        assert_int_equal(histo.counts[1], 0);
+        assert_int_equal(histo.below + histo.above, 0);
+
+        optics_close(optics);
+    }
+
+    assert_true(numa_set_topology(NULL, 0));
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(numa_list_test),
+        cmocka_unit_test(numa_topology_test),
+        cmocka_unit_test(numa_lens_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
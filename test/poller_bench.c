@@ -0,0 +1,535 @@
+/* poller_bench.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "bench.h"
+#include "utils/time.h"
+#include "utils/socket.h"
+#include "utils/crest/crest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+enum { lenses_len = 250, records_len = optics_dist_samples };
+
+struct poller_bench
+{
+    struct optics *optics;
+    struct optics_poller *poller;
+    struct optics_lens *lenses[lenses_len];
+};
+
+static void backend_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    (void) ctx, (void) type, (void) poll;
+}
+
+static void poller_bench_init(
+        struct poller_bench *bench, const char *name, enum optics_lens_type type)
+{
+    bench->optics = optics_create_at(name, 0);
+    bench->poller = optics_poller_alloc(bench->optics);
+    optics_poller_backend(bench->poller, NULL, backend_cb, NULL);
+
+    for (size_t i = 0; i < lenses_len; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "lens_%zu", i);
+
+        if (type == optics_counter)
+            bench->lenses[i] = optics_counter_create(bench->optics, key);
+        else if (type == optics_dist)
+            bench->lenses[i] = optics_dist_create(bench->optics, key);
+        else optics_abort();
+    }
+}
+
+static void poller_bench_free(struct poller_bench *bench)
+{
+    for (size_t i = 0; i < lenses_len; ++i)
+        optics_lens_close(bench->lenses[i]);
+
+    optics_poller_free(bench->poller);
+    optics_close(bench->optics);
+}
+
+
+// -----------------------------------------------------------------------------
+// poll
+// -----------------------------------------------------------------------------
+// Every iteration fills every lens before polling it. The counter bench acts as
+// the baseline for the cost of the recording and of the poll itself, the
+// difference with the dist bench is the cost of computing the percentiles.
+
+void run_counter_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+
+    struct poller_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < lenses_len; ++j) {
+            for (size_t k = 0; k < records_len; ++k)
+                optics_counter_inc(bench->lenses[j], 1);
+        }
+
+        optics_poller_poll_at(bench->poller, i + 1);
+    }
+}
+
+void run_dist_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) id;
+
+    struct poller_bench *bench = data;
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < lenses_len; ++j) {
+            for (size_t k = 0; k < records_len; ++k)
+                optics_dist_record(bench->lenses[j], (k * 7919) % records_len);
+        }
+
+        optics_poller_poll_at(bench->poller, i + 1);
+    }
+}
+
+optics_test_head(poller_counter_bench)
+{
+    struct poller_bench bench;
+    poller_bench_init(&bench, test_name, optics_counter);
+
+    optics_bench_st(test_name, run_counter_bench, &bench);
+
+    poller_bench_free(&bench);
+}
+optics_test_tail()
+
+optics_test_head(poller_dist_bench)
+{
+    struct poller_bench bench;
+    poller_bench_init(&bench, test_name, optics_dist);
+
+    optics_bench_st(test_name, run_dist_bench, &bench);
+
+    poller_bench_free(&bench);
+}
+optics_test_tail()
+
+optics_test_head(poller_dist_parallel_bench)
+{
+    assert_mt();
+
+    struct poller_bench bench;
+    poller_bench_init(&bench, test_name, optics_dist);
+    optics_poller_set_workers(bench.poller, cpus() - 1);
+
+    optics_bench_st(test_name, run_dist_bench, &bench);
+
+    poller_bench_free(&bench);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// scale
+// -----------------------------------------------------------------------------
+// Polls of large regions are too long for the bench harness so they're timed
+// directly. Lenses are mostly counters and gauges with a dist and a histo every
+// 16 lenses which is closer to what a real process looks like. Every lens is
+// recorded before every poll such that the reads always have something to
+// reset. Lenses that were skipped because they were busy are the difference
+// between the number of lenses and the number of metrics the poll reported.
+
+enum { scale_polls = 3, scale_carbon_port = 12346 };
+
+enum scale_backend
+{
+    scale_null,
+    scale_stdout,
+    scale_carbon,
+    scale_rest,
+};
+
+struct scale_bench
+{
+    struct optics *optics;
+    struct optics_poller *poller;
+
+    size_t lenses_len;
+    struct optics_lens **lenses;
+
+    atomic_size_t metrics;
+
+    int carbon_fd;
+    pthread_t carbon_thread;
+    struct crest *crest;
+};
+
+static void scale_count_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    (void) poll;
+    struct scale_bench *bench = ctx;
+    if (type == optics_poll_metric)
+        atomic_fetch_add_explicit(&bench->metrics, 1, memory_order_relaxed);
+}
+
+static void *scale_carbon_drain(void *ctx)
+{
+    struct scale_bench *bench = ctx;
+
+    int fd = socket_stream_accept(bench->carbon_fd);
+    if (fd < 0) return NULL;
+
+    char buffer[1 << 16];
+    while (socket_recv(fd, sizeof(buffer), buffer) > 0);
+
+    close(fd);
+    return NULL;
+}
+
+static const char *scale_backend_str(enum scale_backend backend)
+{
+    switch (backend) {
+    case scale_null: return "null";
+    case scale_stdout: return "stdout";
+    case scale_carbon: return "carbon";
+    case scale_rest: return "rest";
+    default: optics_abort();
+    }
+}
+
+static void scale_record(struct optics_lens *lens, size_t i)
+{
+    enum optics_lens_type type = optics_lens_type(lens);
+
+    if (type == optics_counter) optics_counter_inc(lens, 1);
+    else if (type == optics_gauge) optics_gauge_set(lens, i);
+    else if (type == optics_dist) optics_dist_record(lens, i % 1000);
+    else if (type == optics_histo) optics_histo_inc(lens, i % 100);
+    else optics_abort();
+}
+
+static void scale_bench_init(
+        struct scale_bench *bench,
+        const char *name,
+        size_t len,
+        enum scale_backend backend,
+        bool huge)
+{
+    *bench = (struct scale_bench) { .carbon_fd = -1 };
+
+    bench->optics = optics_create_at(name, 0);
+    if (huge) optics_set_huge_pages(bench->optics);
+    bench->poller = optics_poller_alloc(bench->optics);
+    optics_poller_backend(bench->poller, bench, scale_count_cb, NULL);
+
+    switch (backend) {
+    case scale_null: break;
+    case scale_stdout: optics_dump_stdout(bench->poller); break;
+
+    case scale_carbon: {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", scale_carbon_port);
+
+        bench->carbon_fd = socket_stream_listen(port);
+        if (bench->carbon_fd < 0) optics_abort();
+        if (pthread_create(&bench->carbon_thread, NULL, scale_carbon_drain, bench))
+            optics_abort();
+
+        optics_dump_carbon(bench->poller, "127.0.0.1", port);
+        break;
+    }
+
+    case scale_rest:
+        bench->crest = crest_new();
+        optics_dump_rest(bench->poller, bench->crest);
+        break;
+
+    default: optics_abort();
+    }
+
+    const uint64_t buckets[] = {0, 10, 20, 50, 100};
+
+    bench->lenses_len = len;
+    bench->lenses = calloc(len, sizeof(*bench->lenses));
+    optics_assert_alloc(bench->lenses);
+
+    for (size_t i = 0; i < len; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "lens_%zu", i);
+
+        struct optics_lens *lens;
+        if (i % 16 == 0) lens = optics_dist_create(bench->optics, key);
+        else if (i % 16 == 1) lens = optics_histo_create(bench->optics, key, buckets, 5);
+        else if (i % 2) lens = optics_gauge_create(bench->optics, key);
+        else lens = optics_counter_create(bench->optics, key);
+
+        if (!lens) optics_abort();
+        bench->lenses[i] = lens;
+    }
+}
+
+static void scale_bench_free(struct scale_bench *bench)
+{
+    for (size_t i = 0; i < bench->lenses_len; ++i)
+        optics_lens_close(bench->lenses[i]);
+    free(bench->lenses);
+
+    if (bench->crest) crest_free(bench->crest);
+    optics_poller_free(bench->poller);
+    optics_close(bench->optics);
+
+    if (bench->carbon_fd >= 0) {
+        shutdown(bench->carbon_fd, SHUT_RDWR);
+        close(bench->carbon_fd);
+        pthread_join(bench->carbon_thread, NULL);
+    }
+}
+
+// Returns the duration of the poll in nanos.
+static double scale_poll(struct scale_bench *bench, optics_ts_t ts, bool quiet)
+{
+    int out = -1;
+    if (quiet) {
+        fflush(stdout);
+        out = dup(1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        close(null);
+    }
+
+    struct timespec start, stop;
+    clock_monotonic(&start);
+    if (!optics_poller_poll_at(bench->poller, ts)) optics_abort();
+    clock_monotonic(&stop);
+
+    if (quiet) {
+        fflush(stdout);
+        dup2(out, 1);
+        close(out);
+    }
+
+    return (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+}
+
+static void run_scale_bench(const char *title, size_t len, enum scale_backend backend)
+{
+    struct scale_bench bench;
+    scale_bench_init(&bench, title, len, backend, false);
+
+    double total = 0, max = 0;
+    size_t skipped = 0;
+
+    for (size_t poll = 0; poll < scale_polls; ++poll) {
+        for (size_t i = 0; i < len; ++i) scale_record(bench.lenses[i], i);
+
+        atomic_store_explicit(&bench.metrics, 0, memory_order_relaxed);
+        double elapsed = scale_poll(&bench, poll + 1, backend == scale_stdout);
+
+        total += elapsed;
+        if (elapsed > max) max = elapsed;
+        skipped += len - atomic_load_explicit(&bench.metrics, memory_order_relaxed);
+    }
+
+    printf("bench: %-30s  %-6s %8zu    poll:%8.2fms    max:%8.2fms    ns/lens:%7.2f    skipped:%zu\n",
+            title, scale_backend_str(backend), len,
+            total / scale_polls / 1e6, max / 1e6, total / scale_polls / len, skipped);
+
+    scale_bench_free(&bench);
+}
+
+optics_test_head(poller_scale_bench)
+{
+    const size_t sizes[] = { 10 * 1000, 100 * 1000, 1000 * 1000 };
+    const enum scale_backend backends[] = { scale_null, scale_stdout, scale_carbon, scale_rest };
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); ++j)
+            run_scale_bench(test_name, sizes[j], backends[i]);
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// interference
+// -----------------------------------------------------------------------------
+// Measures the cost of recording while the poller resets the lenses under the
+// recorders' feet: reads swap the counters and lock the dists which invalidates
+// their cache lines and makes the recorders wait or spin. The recorders first
+// run alone and then while the poller runs one poll after the other.
+
+enum { interfere_lenses = 100 * 1000, interfere_batch = 1024 };
+static const uint64_t interfere_phase_nanos = 500 * 1000 * 1000;
+
+enum interfere_phase { interfere_idle, interfere_polling, interfere_done };
+
+struct interfere_bench
+{
+    struct scale_bench scale;
+
+    atomic_int phase;
+    atomic_size_t ops[2];
+};
+
+static void interfere_record(struct interfere_bench *bench, size_t id)
+{
+    struct rng rng;
+    rng_seed_with(&rng, id);
+
+    while (true) {
+        int phase = atomic_load_explicit(&bench->phase, memory_order_relaxed);
+        if (phase == interfere_done) break;
+
+        for (size_t i = 0; i < interfere_batch; ++i) {
+            size_t lens = rng_gen_range(&rng, 0, bench->scale.lenses_len);
+            scale_record(bench->scale.lenses[lens], i);
+        }
+
+        atomic_fetch_add_explicit(&bench->ops[phase], interfere_batch, memory_order_relaxed);
+    }
+}
+
+static void interfere_poll(struct interfere_bench *bench, size_t *polls, size_t *skipped)
+{
+    struct timespec start, now;
+    clock_monotonic(&start);
+
+    optics_ts_t ts = 0;
+    do {
+        atomic_store_explicit(&bench->scale.metrics, 0, memory_order_relaxed);
+        (void) scale_poll(&bench->scale, ++ts, false);
+        *skipped += bench->scale.lenses_len -
+            atomic_load_explicit(&bench->scale.metrics, memory_order_relaxed);
+        (*polls)++;
+
+        clock_monotonic(&now);
+    } while ((now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec)
+            < interfere_phase_nanos);
+}
+
+static void run_interfere_bench(size_t id, void *ctx)
+{
+    struct interfere_bench *bench = ctx;
+
+    if (id) {
+        interfere_record(bench, id);
+        return;
+    }
+
+    nsleep(interfere_phase_nanos);
+
+    size_t polls = 0, skipped = 0;
+    atomic_store_explicit(&bench->phase, interfere_polling, memory_order_relaxed);
+    interfere_poll(bench, &polls, &skipped);
+    atomic_store_explicit(&bench->phase, interfere_done, memory_order_relaxed);
+
+    size_t recorders = cpus() - 1;
+    double idle = (double) interfere_phase_nanos * recorders /
+        atomic_load_explicit(&bench->ops[interfere_idle], memory_order_relaxed);
+    double polling = (double) interfere_phase_nanos * recorders /
+        atomic_load_explicit(&bench->ops[interfere_polling], memory_order_relaxed);
+
+    printf("bench: %-30s  %4zu    idle:%6.2fns    polling:%6.2fns    polls:%zu    skipped:%zu\n",
+            "poller_interference_bench", recorders, idle, polling, polls, skipped);
+}
+
+optics_test_head(poller_interference_bench)
+{
+    assert_mt();
+
+    struct interfere_bench bench = {0};
+    scale_bench_init(&bench.scale, test_name, interfere_lenses, scale_null, false);
+
+    run_threads(run_interfere_bench, &bench, cpus());
+
+    scale_bench_free(&bench.scale);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// huge
+// -----------------------------------------------------------------------------
+// Compares regular and huge page backed lenses on both sides: the poll which
+// walks every lens and records scattered randomly across all the lenses which
+// is where the TLB misses hurt the most. The DTLB misses of the records are
+// reported when OPTICS_BENCH_PERF is set.
+
+enum { huge_polls = 3 };
+
+static void run_huge_record_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    struct scale_bench *bench = data;
+
+    struct rng rng;
+    rng_seed_with(&rng, id);
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t lens = rng_gen_range(&rng, 0, bench->lenses_len);
+        scale_record(bench->lenses[lens], i);
+    }
+}
+
+static void run_huge_bench(size_t len, bool huge)
+{
+    char title[128];
+    snprintf(title, sizeof(title), "poller_huge_%s_%zu_bench", huge ? "on" : "off", len);
+
+    struct scale_bench bench;
+    scale_bench_init(&bench, title, len, scale_null, huge);
+
+    double total = 0;
+    for (size_t poll = 0; poll < huge_polls; ++poll) {
+        for (size_t i = 0; i < len; ++i) scale_record(bench.lenses[i], i);
+        total += scale_poll(&bench, poll + 1, false);
+    }
+
+    printf("bench: %-30s  %8zu    poll:%8.2fms    ns/lens:%7.2f\n",
+            title, len, total / huge_polls / 1e6, total / huge_polls / len);
+
+    optics_bench_st(title, run_huge_record_bench, &bench);
+
+    scale_bench_free(&bench);
+}
+
+optics_test_head(poller_huge_bench)
+{
+    const size_t sizes[] = { 100 * 1000, 1000 * 1000 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        run_huge_bench(sizes[i], false);
+        run_huge_bench(sizes[i], true);
+    }
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(poller_counter_bench),
+        cmocka_unit_test(poller_dist_bench),
+        cmocka_unit_test(poller_dist_parallel_bench),
+        cmocka_unit_test(poller_scale_bench),
+        cmocka_unit_test(poller_interference_bench),
+        cmocka_unit_test(poller_huge_bench),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -337,6 +337,193 @@ optics_test_head(poller_histo_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// histo2d
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_histo2d_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    const uint64_t rows[] = {1, 2, 3};
+    const uint64_t cols[] = {10, 20};
+    struct optics_lens *lens = optics_histo2d_create(optics, "histo2d", rows, 3, cols, 2);
+
+    ts++;
+    optics_histo2d_inc(lens, 1, 10);
+    optics_histo2d_inc(lens, 2, 15);
+    optics_histo2d_inc(lens, 2, 19);
+    optics_histo2d_inc(lens, 3, 10);
+    optics_histo2d_inc(lens, 1, 20);
+
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.histo2d.outside", 2.0),
+            make_kv("prefix.host.histo2d.row_1_2.col_10_20", 1.0),
+            make_kv("prefix.host.histo2d.row_2_3.col_10_20", 2.0));
+
+    ts++;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.histo2d.outside", 0.0),
+            make_kv("prefix.host.histo2d.row_1_2.col_10_20", 0.0),
+            make_kv("prefix.host.histo2d.row_2_3.col_10_20", 0.0));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// hdr
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_hdr_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_hdr_create(optics, "hdr", 1, 16, 1);
+
+    ts++;
+
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.hdr.count", 0.0),
+            make_kv("prefix.host.hdr.p50", 0.0),
+            make_kv("prefix.host.hdr.p90", 0.0),
+            make_kv("prefix.host.hdr.p99", 0.0),
+            make_kv("prefix.host.hdr.p999", 0.0),
+            make_kv("prefix.host.hdr.max", 0.0));
+
+    for (size_t i = 0; i < 3; ++i) {
+        ts++;
+        optics_hdr_record(lens, 1.0);
+        optics_hdr_record(lens, 2.0);
+
+        htable_reset(&result);
+        optics_poller_poll_at(poller, ts);
+        assert_htable_equal(&result, 0,
+                make_kv("prefix.host.hdr.count", 2.0),
+                make_kv("prefix.host.hdr.p50", 2.0625),
+                make_kv("prefix.host.hdr.p90", 2.0625),
+                make_kv("prefix.host.hdr.p99", 2.0625),
+                make_kv("prefix.host.hdr.p999", 2.0625),
+                make_kv("prefix.host.hdr.max", 2.0625),
+                make_kv("prefix.host.hdr.bucket_0", 1.0),
+                make_kv("prefix.host.hdr.bucket_16", 1.0));
+
+        ts += 2;
+        for (size_t j = 0; j < 4; ++j)
+            optics_hdr_record(lens, 1.0);
+
+        htable_reset(&result);
+        optics_poller_poll_at(poller, ts);
+        assert_htable_equal(&result, 0,
+                make_kv("prefix.host.hdr.count", 2.0),
+                make_kv("prefix.host.hdr.p50", 1.03125),
+                make_kv("prefix.host.hdr.p90", 1.03125),
+                make_kv("prefix.host.hdr.p99", 1.03125),
+                make_kv("prefix.host.hdr.p999", 1.03125),
+                make_kv("prefix.host.hdr.max", 1.03125),
+                make_kv("prefix.host.hdr.bucket_0", 2.0));
+    }
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_sketch_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_sketch_create(optics, "sketch", 0.01, 1, 100);
+
+    ts++;
+
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.sketch.count", 0.0),
+            make_kv("prefix.host.sketch.p50", 0.0),
+            make_kv("prefix.host.sketch.p90", 0.0),
+            make_kv("prefix.host.sketch.p99", 0.0),
+            make_kv("prefix.host.sketch.max", 0.0));
+
+    for (size_t i = 0; i < 3; ++i) {
+        ts++;
+        optics_sketch_record(lens, 0.0);
+        optics_sketch_record(lens, 1.0);
+        optics_sketch_record(lens, 1.0);
+
+        htable_reset(&result);
+        optics_poller_poll_at(poller, ts);
+        assert_htable_equal(&result, 0.01,
+                make_kv("prefix.host.sketch.count", 3.0),
+                make_kv("prefix.host.sketch.p50", 1.0),
+                make_kv("prefix.host.sketch.p90", 1.0),
+                make_kv("prefix.host.sketch.p99", 1.0),
+                make_kv("prefix.host.sketch.max", 1.0),
+                make_kv("prefix.host.sketch.zero", 1.0),
+                make_kv("prefix.host.sketch.bucket_0", 2.0));
+
+        ts += 2;
+        for (size_t j = 0; j < 4; ++j)
+            optics_sketch_record(lens, 1.0);
+
+        htable_reset(&result);
+        optics_poller_poll_at(poller, ts);
+        assert_htable_equal(&result, 0.01,
+                make_kv("prefix.host.sketch.count", 2.0),
+                make_kv("prefix.host.sketch.p50", 1.0),
+                make_kv("prefix.host.sketch.p90", 1.0),
+                make_kv("prefix.host.sketch.p99", 1.0),
+                make_kv("prefix.host.sketch.max", 1.0),
+                make_kv("prefix.host.sketch.bucket_0", 2.0));
+    }
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // quantile
 // -----------------------------------------------------------------------------
@@ -378,6 +565,339 @@ optics_test_head(poller_quantile_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// quantiles
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_quantiles_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    const double targets[] = { 0.05, 0.5, 0.9, 0.999 };
+    struct optics_lens *lens = optics_quantiles_create(optics, "quantiles", targets, 4, 50, 0.05);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.quantiles.count", 0.0),
+            make_kv("prefix.host.quantiles.p05", 50.0),
+            make_kv("prefix.host.quantiles.p50", 50.0),
+            make_kv("prefix.host.quantiles.p90", 50.0),
+            make_kv("prefix.host.quantiles.p999", 50.0));
+
+    for (size_t i = 0; i < 1000; i++) {
+        for (size_t j = 0; j < 100; j++)
+            optics_quantiles_update(lens, j);
+    }
+
+    ts += 10;
+
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 1.5,
+            make_kv("prefix.host.quantiles.count", 10000.0),
+            make_kv("prefix.host.quantiles.p05", 5.0),
+            make_kv("prefix.host.quantiles.p50", 50.0),
+            make_kv("prefix.host.quantiles.p90", 90.0),
+            make_kv("prefix.host.quantiles.p999", 99.0));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// meter
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_meter_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_meter_create(optics, "meter");
+
+    // The first poll seeds the averages with its rate.
+    optics_meter_mark(lens, 20);
+    ts += 10;
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 1e-9,
+            make_kv("prefix.host.meter.rate", 2.0),
+            make_kv("prefix.host.meter.m1", 2.0),
+            make_kv("prefix.host.meter.m5", 2.0),
+            make_kv("prefix.host.meter.m15", 2.0));
+
+    // Averages are decayed towards the rate of the poll using its elapsed time.
+    // The expected values are computed upfront since assert_htable_equal
+    // shadows exp.
+    double m1 = 2.0 + (1 - exp(-60.0 / 60)) * 3.0;
+    double m5 = 2.0 + (1 - exp(-60.0 / 300)) * 3.0;
+    double m15 = 2.0 + (1 - exp(-60.0 / 900)) * 3.0;
+
+    optics_meter_mark(lens, 60 * 5);
+    ts += 60;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 1e-9,
+            make_kv("prefix.host.meter.rate", 5.0),
+            make_kv("prefix.host.meter.m1", m1),
+            make_kv("prefix.host.meter.m5", m5),
+            make_kv("prefix.host.meter.m15", m15));
+
+    // An idle meter decays towards zero.
+    m1 *= exp(-60.0 / 60);
+    m5 *= exp(-60.0 / 300);
+    m15 *= exp(-60.0 / 900);
+
+    ts += 60;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 1e-9,
+            make_kv("prefix.host.meter.rate", 0.0),
+            make_kv("prefix.host.meter.m1", m1),
+            make_kv("prefix.host.meter.m5", m5),
+            make_kv("prefix.host.meter.m15", m15));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// topk
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_topk_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_topk_create(optics, "topk", 2);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&result, 0, make_kv("prefix.host.topk.count", 0.0));
+
+    // The reported keys follow the top keys of each poll.
+    optics_topk_inc(lens, "a", 10);
+    optics_topk_inc(lens, "b", 20);
+    optics_topk_inc(lens, "c", 2);
+    ts += 2;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.topk.count", 16.0),
+            make_kv("prefix.host.topk.a", 5.0),
+            make_kv("prefix.host.topk.b", 10.0));
+
+    optics_topk_inc(lens, "c", 4);
+    optics_topk_inc_id(lens, 42, 1);
+    ts += 1;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.topk.count", 5.0),
+            make_kv("prefix.host.topk.c", 4.0),
+            make_kv("prefix.host.topk.42", 1.0));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// hll
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_hll_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_hll_create(optics, "hll", 12);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&result, 0, make_kv("prefix.host.hll", 0.0));
+
+    // Estimates are a count of distinct keys over the interval and aren't
+    // rescaled by the elapsed time.
+    for (size_t i = 0; i < 3; ++i) {
+        optics_hll_add(lens, "a");
+        optics_hll_add(lens, "b");
+    }
+
+    ts += 10;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0.01, make_kv("prefix.host.hll", 2.0));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// updown
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_updown_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    struct optics_lens *lens = optics_updown_create(optics, "updown");
+
+    optics_updown_add(lens, 4);
+    optics_updown_add(lens, -1);
+    ts += 10;
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.updown", 3.0),
+            make_kv("prefix.host.updown.min", 0.0),
+            make_kv("prefix.host.updown.max", 4.0));
+
+    // Neither the value nor the watermarks are rescaled and the value carries
+    // over to polls without changes.
+    ts += 10;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.updown", 3.0),
+            make_kv("prefix.host.updown.min", 3.0),
+            make_kv("prefix.host.updown.max", 3.0));
+
+    optics_updown_add(lens, -5);
+    optics_updown_add(lens, 1);
+    ts += 10;
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.updown", -1.0),
+            make_kv("prefix.host.updown.min", -2.0),
+            make_kv("prefix.host.updown.max", 3.0));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// family
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_family_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    const char *endpoints[] = { "get", "put" };
+    const char *statuses[] = { "2xx", "5xx" };
+    const struct optics_family_dim dims[] = { { 2, endpoints }, { 2, statuses } };
+
+    struct optics_lens *counters = optics_family_create(optics, "req", optics_counter, dims, 2);
+    struct optics_lens *dists = optics_family_create(optics, "lat", optics_dist, dims + 1, 1);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.req.get.2xx", 0.0),
+            make_kv("prefix.host.req.get.5xx", 0.0),
+            make_kv("prefix.host.req.put.2xx", 0.0),
+            make_kv("prefix.host.req.put.5xx", 0.0),
+            make_kv("prefix.host.lat.2xx.count", 0.0),
+            make_kv("prefix.host.lat.2xx.p50", 0.0),
+            make_kv("prefix.host.lat.2xx.p90", 0.0),
+            make_kv("prefix.host.lat.2xx.p99", 0.0),
+            make_kv("prefix.host.lat.2xx.max", 0.0),
+            make_kv("prefix.host.lat.5xx.count", 0.0),
+            make_kv("prefix.host.lat.5xx.p50", 0.0),
+            make_kv("prefix.host.lat.5xx.p90", 0.0),
+            make_kv("prefix.host.lat.5xx.p99", 0.0),
+            make_kv("prefix.host.lat.5xx.max", 0.0));
+
+    optics_family_counter_inc(counters, 0 * 2 + 0, 10);
+    optics_family_counter_inc(counters, 1 * 2 + 1, 20);
+    optics_family_dist_record(dists, 1, 5);
+
+    htable_reset(&result);
+    optics_poller_poll_at(poller, ts += 10);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.req.get.2xx", 1.0),
+            make_kv("prefix.host.req.get.5xx", 0.0),
+            make_kv("prefix.host.req.put.2xx", 0.0),
+            make_kv("prefix.host.req.put.5xx", 2.0),
+            make_kv("prefix.host.lat.2xx.count", 0.0),
+            make_kv("prefix.host.lat.2xx.p50", 0.0),
+            make_kv("prefix.host.lat.2xx.p90", 0.0),
+            make_kv("prefix.host.lat.2xx.p99", 0.0),
+            make_kv("prefix.host.lat.2xx.max", 0.0),
+            make_kv("prefix.host.lat.5xx.count", 0.1),
+            make_kv("prefix.host.lat.5xx.p50", 5.0),
+            make_kv("prefix.host.lat.5xx.p90", 5.0),
+            make_kv("prefix.host.lat.5xx.p99", 5.0),
+            make_kv("prefix.host.lat.5xx.max", 5.0));
+
+    htable_reset(&result);
+    optics_lens_close(counters);
+    optics_lens_close(dists);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -391,7 +911,16 @@ int main(void)
         cmocka_unit_test(poller_counter_test),
         cmocka_unit_test(poller_dist_test),
         cmocka_unit_test(poller_histo_test),
+        cmocka_unit_test(poller_histo2d_test),
+        cmocka_unit_test(poller_hdr_test),
+        cmocka_unit_test(poller_sketch_test),
         cmocka_unit_test(poller_quantile_test),
+        cmocka_unit_test(poller_quantiles_test),
+        cmocka_unit_test(poller_meter_test),
+        cmocka_unit_test(poller_topk_test),
+        cmocka_unit_test(poller_hll_test),
+        cmocka_unit_test(poller_updown_test),
+        cmocka_unit_test(poller_family_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
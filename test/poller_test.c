@@ -4,6 +4,7 @@
 */
 
 #include "test.h"
+#include "utils/time.h"
 
 
 // -----------------------------------------------------------------------------
@@ -165,6 +166,1355 @@ optics_test_head(poller_freq_test)
 optics_test_tail()
 
 
+optics_test_head(poller_freq_nanos_test)
+{
+    const uint64_t sec = 1000UL * 1000 * 1000;
+    uint64_t ts = 20 * sec;
+
+    struct optics *optics = optics_create_at("r", 20);
+    struct optics_lens *lens = optics_counter_create(optics, "l");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "h");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    // Sub-second polls are rescaled by the fraction of a second elapsed.
+    ts += sec / 2;
+    optics_counter_inc(lens, 10);
+
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at_nanos(poller, ts));
+    assert_htable_equal(&result, 0, make_kv("r.h.l", 20));
+
+    // Jitter around the second boundary no longer skews the rate.
+    ts += sec + sec / 2;
+    optics_counter_inc(lens, 30);
+
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at_nanos(poller, ts));
+    assert_htable_equal(&result, 0, make_kv("r.h.l", 20));
+
+    // Whole second polls behave as they always did.
+    optics_counter_inc(lens, 10);
+
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at(poller, ts / sec + 10));
+    assert_htable_equal(&result, 0, make_kv("r.h.l", 1));
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_close(optics);
+    optics_poller_free(poller);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// poller_parallel_test
+// -----------------------------------------------------------------------------
+
+struct parallel_ctx
+{
+    struct htable keys;
+    size_t begin;
+    size_t done;
+};
+
+void parallel_backend_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct parallel_ctx *ctx = ctx_;
+
+    switch (type) {
+    case optics_poll_begin:
+        assert_int_equal(ctx->keys.len, 0);
+        ctx->begin++;
+        break;
+
+    case optics_poll_metric:
+        assert_int_equal(ctx->begin, ctx->done + 1);
+        assert_true(htable_put(&ctx->keys, poll->key, poll->value.counter).ok);
+        break;
+
+    case optics_poll_done:
+        ctx->done++;
+        break;
+
+    default:
+        optics_abort();
+    }
+}
+
+optics_test_head(poller_parallel_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+
+    enum { n = 5000 };
+    struct optics_lens *lenses[n];
+    for (size_t i = 0; i < n; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "l%zu", i);
+        lenses[i] = optics_counter_create(optics, key);
+    }
+
+    const char *labels[] = { "a", "b", "c" };
+    const struct optics_family_dim dims[] = { { 3, labels } };
+    struct optics_lens *family = optics_family_create(optics, "f", optics_counter, dims, 1);
+
+    struct parallel_ctx ctx = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_backend(poller, &ctx, parallel_backend_cb, NULL);
+
+    assert_false(optics_poller_set_workers(poller, 1000));
+    assert_true(optics_poller_set_workers(poller, 3));
+    assert_int_equal(optics_poller_get_workers(poller), 3);
+
+    for (size_t it = 0; it < 3; ++it) {
+        for (size_t i = 0; i < n; ++i) optics_counter_inc(lenses[i], i + it);
+        for (size_t i = 0; i < 3; ++i) optics_family_counter_inc(family, i, i + it);
+
+        htable_reset(&ctx.keys);
+        assert_true(optics_poller_poll_at(poller, ++ts));
+        assert_int_equal(ctx.begin, it + 1);
+        assert_int_equal(ctx.done, it + 1);
+        assert_int_equal(ctx.keys.len, n + 3);
+
+        for (size_t i = 0; i < n; ++i) {
+            char key[optics_name_max_len];
+            snprintf(key, sizeof(key), "l%zu", i);
+
+            struct htable_ret ret = htable_get(&ctx.keys, key);
+            assert_true(ret.ok);
+            assert_int_equal(ret.value, i + it);
+        }
+
+        for (size_t i = 0; i < 3; ++i) {
+            char key[optics_name_max_len];
+            snprintf(key, sizeof(key), "f.%s", labels[i]);
+
+            struct htable_ret ret = htable_get(&ctx.keys, key);
+            assert_true(ret.ok);
+            assert_int_equal(ret.value, i + it);
+        }
+
+        // Switching back and forth between modes has no effect on the results.
+        assert_true(optics_poller_set_workers(poller, it % 2 ? 3 : 0));
+    }
+
+    htable_reset(&ctx.keys);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// poller_thread_test
+// -----------------------------------------------------------------------------
+
+struct thread_ctx
+{
+    atomic_size_t polls;
+    uint64_t last;
+    uint64_t sleep;
+    bool aligned;
+};
+
+void thread_backend_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    (void) poll;
+    if (type != optics_poll_begin) return;
+
+    struct thread_ctx *ctx = ctx_;
+
+    // Polls should start shortly after a multiple of the period.
+    uint64_t now = clock_wall_nanos();
+    if (now % (10 * 1000 * 1000) > 5 * 1000 * 1000) ctx->aligned = false;
+
+    atomic_fetch_add(&ctx->polls, 1);
+    if (ctx->sleep) nsleep(ctx->sleep);
+}
+
+optics_test_head(poller_thread_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_poller *poller = optics_poller_alloc(optics);
+
+    struct thread_ctx ctx = { .aligned = true };
+    optics_poller_backend(poller, &ctx, thread_backend_cb, NULL);
+
+    assert_null(optics_thread_start(poller, 0));
+    assert_null(optics_thread_start_nanos(poller, 1000));
+
+    const uint64_t period = 10 * 1000 * 1000;
+
+    struct optics_thread *thread = optics_thread_start_nanos(poller, period);
+    assert_non_null(thread);
+    nsleep(10 * period + period / 2);
+    assert_true(optics_thread_stop(thread));
+
+    size_t polls = atomic_load(&ctx.polls);
+    assert_in_range(polls, 8, 11);
+    assert_true(ctx.aligned);
+
+    // Polls that take longer then the period skip the deadlines they missed.
+    fprintf(stderr, "\n--- EXPECTED WARNING - START ---\n");
+    ctx.sleep = 2 * period + period / 2;
+    atomic_store(&ctx.polls, 0);
+
+    thread = optics_thread_start_nanos(poller, period);
+    nsleep(10 * period);
+    size_t missed = optics_thread_missed(thread);
+    assert_true(optics_thread_stop(thread));
+    fprintf(stderr, "--- EXPECTED WARNING - END ---\n\n");
+
+    assert_in_range(atomic_load(&ctx.polls), 2, 5);
+    assert_true(missed >= 4);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+bool thread_host_normalized_cb(
+        void *ctx, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) ts, (void) value;
+
+    // Reads the cached key which would have been freed by a racing flush.
+    assert_int_equal(strnlen(key, key_len), key_len);
+    atomic_fetch_add((atomic_size_t *) ctx, 1);
+    return true;
+}
+
+void thread_host_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    if (type != optics_poll_metric) return;
+    (void) optics_poll_normalize_qualified(poll, thread_host_normalized_cb, ctx);
+}
+
+// Changing the host flushes the cached keys which mustn't race with the polls
+// of the poller thread using them.
+optics_test_head(poller_thread_host_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_set_prefix(optics, "prefix");
+
+    for (size_t i = 0; i < 64; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "l%zu", i);
+        optics_counter_create(optics, key);
+    }
+
+    atomic_size_t metrics = 0;
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_backend(poller, &metrics, thread_host_cb, NULL);
+
+    struct optics_thread *thread = optics_thread_start_nanos(poller, 1 * 1000 * 1000);
+    assert_non_null(thread);
+
+    for (size_t i = 0; i < 1000; ++i) {
+        char host[optics_name_max_len];
+        snprintf(host, sizeof(host), "host%zu", i % 8);
+        assert_true(optics_poller_set_host(poller, host));
+        nsleep(10 * 1000);
+    }
+
+    assert_true(optics_thread_stop(thread));
+    assert_true(atomic_load(&metrics) > 0);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// Filters can be replaced while a poller thread is running.
+optics_test_head(poller_thread_filter_test)
+{
+    struct optics *optics = optics_create(test_name);
+    optics_set_prefix(optics, "prefix");
+
+    for (size_t i = 0; i < 64; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "%s_%zu", i % 2 ? "a" : "b", i);
+        optics_counter_create(optics, key);
+    }
+
+    atomic_size_t metrics = 0;
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &metrics, thread_host_cb, NULL);
+
+    struct optics_thread *thread = optics_thread_start_nanos(poller, 1 * 1000 * 1000);
+    assert_non_null(thread);
+
+    const char *prefixes[][2] = { { "a", NULL }, { "b", NULL } };
+    for (size_t i = 0; i < 1000; ++i) {
+        struct optics_backend_filter filter = { .prefixes = prefixes[i % 2] };
+        assert_true(optics_poller_filter(poller, &filter));
+        nsleep(10 * 1000);
+    }
+
+    assert_true(optics_thread_stop(thread));
+    assert_true(atomic_load(&metrics) > 0);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// poller_async_test
+// -----------------------------------------------------------------------------
+
+struct async_ctx
+{
+    struct htable keys;
+    size_t begin;
+    size_t done;
+    uint64_t sleep;
+};
+
+void async_backend_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct async_ctx *ctx = ctx_;
+
+    switch (type) {
+    case optics_poll_begin: ctx->begin++; break;
+    case optics_poll_done: ctx->done++; break;
+    case optics_poll_metric:
+        nsleep(ctx->sleep);
+        assert_true(htable_put(&ctx->keys, poll->key, poll->value.counter).ok);
+        break;
+    default: optics_abort();
+    }
+}
+
+static void async_run(enum optics_backend_policy policy, struct async_ctx *ctx, size_t *dropped)
+{
+    struct optics *optics = optics_create_at("async", 0);
+
+    enum { n = 64 };
+    for (size_t i = 0; i < n; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "l%zu", i);
+        optics_counter_inc(optics_counter_create(optics, key), i + 1);
+    }
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    assert_true(optics_poller_backend_async(
+                    poller, ctx, async_backend_cb, NULL, 4, policy));
+
+    // Slow consumer can never block the poller with the drop policy.
+    struct timespec start, end;
+    clock_monotonic(&start);
+    assert_true(optics_poller_poll_at(poller, 1));
+    clock_monotonic(&end);
+
+    uint64_t elapsed =
+        (end.tv_sec - start.tv_sec) * 1000000000UL + (end.tv_nsec - start.tv_nsec);
+    if (policy == optics_backend_drop) assert_true(elapsed < n * ctx->sleep / 2);
+
+    *dropped = optics_poller_dropped(poller);
+
+    // Freeing the poller drains the ring.
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+
+optics_test_head(poller_async_test)
+{
+    const uint64_t sleep = 1 * 1000 * 1000;
+
+    {
+        struct async_ctx ctx = { .sleep = sleep };
+        size_t dropped = 0;
+        async_run(optics_backend_block, &ctx, &dropped);
+
+        assert_int_equal(dropped, 0);
+        assert_int_equal(ctx.begin, 1);
+        assert_int_equal(ctx.done, 1);
+        assert_int_equal(ctx.keys.len, 64);
+
+        struct htable_ret ret = htable_get(&ctx.keys, "l9");
+        assert_true(ret.ok);
+        assert_int_equal(ret.value, 10);
+
+        htable_reset(&ctx.keys);
+    }
+
+    {
+        struct async_ctx ctx = { .sleep = sleep };
+        size_t dropped = 0;
+        async_run(optics_backend_drop, &ctx, &dropped);
+
+        assert_true(dropped > 0);
+        assert_int_equal(ctx.begin, 1);
+        assert_int_equal(ctx.done, 1);
+        assert_int_equal(ctx.keys.len + dropped, 64);
+
+        htable_reset(&ctx.keys);
+    }
+}
+optics_test_tail()
+
+
+struct async_prefix_ctx
+{
+    size_t metrics;
+    size_t matches;
+};
+
+void async_prefix_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct async_prefix_ctx *ctx = ctx_;
+    if (type != optics_poll_metric) return;
+
+    nsleep(1 * 1000 * 1000);
+
+    ctx->metrics++;
+    if (!strcmp(poll->prefix, "before") && !strcmp(poll->host, "host")) ctx->matches++;
+}
+
+// The prefix and host of the queued polls are those they were polled with,
+// even if they're changed before the consumer gets to them.
+optics_test_head(poller_async_prefix_test)
+{
+    struct optics *optics = optics_create_at(test_name, 0);
+    optics_set_prefix(optics, "before");
+
+    enum { n = 8 };
+    for (size_t i = 0; i < n; ++i) {
+        char key[optics_name_max_len];
+        snprintf(key, sizeof(key), "l%zu", i);
+        optics_counter_inc(optics_counter_create(optics, key), 1);
+    }
+
+    struct async_prefix_ctx ctx = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_true(optics_poller_backend_async(
+                    poller, &ctx, async_prefix_cb, NULL, n, optics_backend_block));
+
+    assert_true(optics_poller_poll_at(poller, 1));
+    optics_set_prefix(optics, "after");
+    optics_poller_set_host(poller, "other");
+
+    optics_poller_free(poller);
+    assert_int_equal(ctx.metrics, n);
+    assert_int_equal(ctx.matches, n);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// record
+// -----------------------------------------------------------------------------
+
+struct record_ctx
+{
+    const struct optics_record *record;
+    struct htable keys;
+    size_t dist_samples;
+};
+
+static bool record_normalized_cb(void *ctx_, uint64_t ts, const char *key, double value)
+{
+    (void) ts;
+    struct record_ctx *ctx = ctx_;
+
+    struct optics_key full = {0};
+    optics_key_push(&full, ctx->record->prefix);
+    optics_key_push(&full, ctx->record->host);
+    optics_key_push(&full, key);
+
+    assert_true(htable_put(&ctx->keys, full.data, pun_dtoi(value)).ok);
+    return true;
+}
+
+static void record_cb(void *ctx_, enum optics_poll_type type, const struct optics_record *record)
+{
+    struct record_ctx *ctx = ctx_;
+
+    if (type != optics_poll_metric) {
+        assert_null(record);
+        return;
+    }
+
+    assert_int_equal(record->len, optics_record_len(record->type));
+
+    if (record->type == optics_dist) {
+        ctx->dist_samples = record->samples_len;
+        for (size_t i = 0; i < record->samples_len; ++i)
+            assert_true(record->samples[i] < 1000);
+    }
+
+    ctx->record = record;
+    (void) optics_record_normalize(record, record_normalized_cb, ctx);
+}
+
+optics_test_head(poller_record_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+
+    struct htable legacy = {0};
+    struct record_ctx ctx = {0};
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &legacy, backend_cb, NULL);
+    optics_poller_backend_record(poller, &ctx, record_cb, NULL);
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+    const uint64_t buckets[] = { 10, 20 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 2);
+
+    optics_counter_inc(counter, 10);
+    optics_gauge_set(gauge, 2.0);
+    for (size_t i = 0; i < 1000; ++i) optics_dist_record(dist, i);
+    optics_histo_inc(histo, 15);
+
+    optics_poller_poll_at(poller, ++ts);
+
+    // Records must normalize to the same values as the legacy polls.
+    assert_int_equal(ctx.keys.len, legacy.len);
+    struct htable_bucket *it = htable_next(&legacy, NULL);
+    for (; it; it = htable_next(&legacy, it)) {
+        struct htable_ret ret = htable_get(&ctx.keys, it->key);
+        assert_true(ret.ok);
+        assert_int_equal(ret.value, it->value);
+    }
+
+    assert_int_equal(ctx.dist_samples, optics_dist_samples);
+
+    htable_reset(&ctx.keys);
+    htable_reset(&legacy);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// keys
+// -----------------------------------------------------------------------------
+
+struct keys_ctx
+{
+    struct htable keys;
+    size_t cached;
+    size_t uncached;
+};
+
+static bool keys_normalized_cb(
+        void *ctx_, optics_ts_t ts, const char *key, size_t key_len, double value)
+{
+    (void) ts;
+    struct keys_ctx *ctx = ctx_;
+
+    assert_int_equal(strlen(key), key_len);
+    assert_true(htable_put(&ctx->keys, key, pun_dtoi(value)).ok);
+
+    return true;
+}
+
+static void keys_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct keys_ctx *ctx = ctx_;
+    if (type != optics_poll_metric) return;
+
+    if (poll->keys) ctx->cached++;
+    else ctx->uncached++;
+
+    (void) optics_poll_normalize_qualified(poll, keys_normalized_cb, ctx);
+}
+
+// Qualified keys must match the legacy keys regardless of whether they come
+// from the cache and must follow changes to the prefix and host.
+static void keys_check(
+        struct optics_poller *poller, optics_ts_t ts,
+        struct htable *legacy, struct keys_ctx *ctx)
+{
+    htable_reset(legacy);
+    htable_reset(&ctx->keys);
+    ctx->cached = ctx->uncached = 0;
+
+    optics_poller_poll_at(poller, ts);
+
+    assert_int_equal(ctx->keys.len, legacy->len);
+    struct htable_bucket *it = htable_next(legacy, NULL);
+    for (; it; it = htable_next(legacy, it)) {
+        struct htable_ret ret = htable_get(&ctx->keys, it->key);
+        assert_true(ret.ok);
+        assert_int_equal(ret.value, it->value);
+    }
+
+    assert_int_equal(ctx->uncached, 0);
+}
+
+optics_test_head(poller_keys_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable legacy = {0};
+    struct keys_ctx ctx = {0};
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &legacy, backend_cb, NULL);
+    optics_poller_backend(poller, &ctx, keys_cb, NULL);
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+    const uint64_t buckets[] = { 10, 20, 30 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+    const double quantiles[] = { 0.5, 0.99 };
+    struct optics_lens *quantiles_lens =
+        optics_quantiles_create(optics, "quantiles", quantiles, 2, 1, 0.05);
+    struct optics_lens *hdr = optics_hdr_create(optics, "hdr", 1, 1000, 2);
+    struct optics_lens *sketch = optics_sketch_create(optics, "sketch", 0.01, 1, 1000);
+    struct optics_lens *meter = optics_meter_create(optics, "meter");
+
+    for (size_t it = 0; it < 3; ++it) {
+        optics_counter_inc(counter, 10);
+        optics_dist_record(dist, 10);
+        optics_histo_inc(histo, 15);
+        optics_quantiles_update(quantiles_lens, 10);
+        optics_hdr_record(hdr, 10);
+        optics_sketch_record(sketch, 10);
+        optics_sketch_record(sketch, 0);
+        optics_meter_mark(meter, 10);
+        keys_check(poller, ++ts, &legacy, &ctx);
+    }
+
+    assert_true(htable_get(&ctx.keys, "prefix.host.histo.bucket_20_30").ok);
+    assert_true(htable_get(&ctx.keys, "prefix.host.sketch.zero").ok);
+    assert_true(htable_get(&ctx.keys, "prefix.host.meter.m15").ok);
+
+    optics_poller_set_host(poller, "other");
+    keys_check(poller, ++ts, &legacy, &ctx);
+    assert_true(htable_get(&ctx.keys, "prefix.other.dist.p99").ok);
+
+    optics_set_prefix(optics, "blah");
+    keys_check(poller, ++ts, &legacy, &ctx);
+    assert_true(htable_get(&ctx.keys, "blah.other.quantiles.p99").ok);
+
+    // Reopening a lens with a different shape must not reuse its keys.
+    optics_lens_close(histo);
+    const uint64_t other[] = { 1, 2 };
+    histo = optics_histo_create(optics, "histo", other, 2);
+    keys_check(poller, ++ts, &legacy, &ctx);
+    assert_true(htable_get(&ctx.keys, "blah.other.histo.bucket_1_2").ok);
+    assert_false(htable_get(&ctx.keys, "blah.other.histo.bucket_10_20").ok);
+
+    htable_reset(&ctx.keys);
+    htable_reset(&legacy);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// poller filter
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_filter_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable all = {0};
+    struct htable types = {0};
+    struct htable prefixes = {0};
+    struct htable changed = {0};
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &all, backend_cb, NULL);
+
+    struct optics_backend_filter types_filter = {
+        .types = (1 << optics_counter) | (1 << optics_family),
+    };
+    assert_true(optics_poller_backend_filtered(
+                    poller, &types, backend_cb, NULL, &types_filter));
+
+    const char *prefixes_list[] = { "a.", "gauge", NULL };
+    struct optics_backend_filter prefixes_filter = { .prefixes = prefixes_list };
+    optics_poller_backend(poller, &prefixes, backend_cb, NULL);
+    assert_true(optics_poller_filter(poller, &prefixes_filter));
+
+    struct optics_backend_filter changed_filter = { .changed = true };
+    assert_true(optics_poller_backend_filtered(
+                    poller, &changed, backend_cb, NULL, &changed_filter));
+
+    struct optics_lens *counter = optics_counter_create(optics, "a.counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *dist = optics_dist_create(optics, "b.dist");
+
+    optics_counter_inc(counter, 10);
+    optics_gauge_set(gauge, 1.0);
+    optics_dist_record(dist, 1);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(all.len, 7);
+    assert_htable_equal(&types, 0, make_kv("prefix.host.a.counter", 10));
+    assert_htable_equal(&prefixes, 0,
+            make_kv("prefix.host.a.counter", 10),
+            make_kv("prefix.host.gauge", 1.0));
+    assert_int_equal(changed.len, 7);
+
+    htable_reset(&all);
+    htable_reset(&types);
+    htable_reset(&prefixes);
+    htable_reset(&changed);
+
+    // The counter and the gauge are unchanged while the dist is now empty.
+    optics_counter_inc(counter, 10);
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(all.len, 7);
+    assert_int_equal(prefixes.len, 2);
+    assert_htable_equal(&changed, 0,
+            make_kv("prefix.host.b.dist.count", 0),
+            make_kv("prefix.host.b.dist.p50", 0),
+            make_kv("prefix.host.b.dist.p90", 0),
+            make_kv("prefix.host.b.dist.p99", 0),
+            make_kv("prefix.host.b.dist.max", 0));
+
+    htable_reset(&all);
+    htable_reset(&types);
+    htable_reset(&prefixes);
+    htable_reset(&changed);
+
+    optics_counter_inc(counter, 10);
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(all.len, 7);
+    assert_int_equal(changed.len, 0);
+
+    htable_reset(&all);
+    htable_reset(&types);
+    htable_reset(&prefixes);
+    htable_reset(&changed);
+
+    optics_counter_inc(counter, 20);
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&changed, 0, make_kv("prefix.host.a.counter", 20));
+
+    htable_reset(&all);
+    htable_reset(&types);
+    htable_reset(&prefixes);
+    htable_reset(&changed);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// self
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_self_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "prefix");
+
+    struct htable result = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+
+    // Ignored until enabled.
+    optics_poller_self_inc(poller, "custom", 1);
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    optics_counter_inc(counter, 10);
+
+    assert_true(optics_poller_self(poller, "optics"));
+    assert_false(optics_poller_self(poller, "optics"));
+
+    // The self lenses are set at the end of the poll and are therefore only
+    // reported on the next one.
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&result, 0,
+            make_kv("prefix.host.counter", 10),
+            make_kv("prefix.host.optics.poller.duration_ns", 0),
+            make_kv("prefix.host.optics.poller.grace_ns", 0),
+            make_kv("prefix.host.optics.poller.lenses", 0),
+            make_kv("prefix.host.optics.poller.busy", 0),
+            make_kv("prefix.host.optics.poller.live_lenses", 0),
+            make_kv("prefix.host.optics.poller.defers", 0));
+    htable_reset(&result);
+
+    optics_poller_self_inc(poller, "custom", 3);
+    optics_poller_self_inc(poller, "custom", 2);
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(result.len, 9);
+
+    struct htable_ret ret = htable_get(&result, "prefix.host.optics.poller.duration_ns");
+    assert_true(ret.ok);
+    assert_true(pun_itod(ret.value) > 0);
+
+    ret = htable_get(&result, "prefix.host.optics.poller.grace_ns");
+    assert_true(ret.ok);
+    assert_true(pun_itod(ret.value) >= 1 * 1000 * 1000);
+
+    ret = htable_get(&result, "prefix.host.optics.poller.backend_0_ns");
+    assert_true(ret.ok);
+    assert_true(pun_itod(ret.value) > 0);
+
+    // The counter and the six poller lenses.
+    ret = htable_get(&result, "prefix.host.optics.poller.lenses");
+    assert_true(ret.ok);
+    assert_float_equal(pun_itod(ret.value), 7, 0);
+
+    ret = htable_get(&result, "prefix.host.optics.poller.live_lenses");
+    assert_true(ret.ok);
+    assert_float_equal(pun_itod(ret.value), 7, 0);
+
+    ret = htable_get(&result, "prefix.host.optics.custom");
+    assert_true(ret.ok);
+    assert_float_equal(pun_itod(ret.value), 5, 0);
+
+    htable_reset(&result);
+
+    // Closing a lens defers its free until the next epoch change.
+    optics_lens_close(counter);
+    optics_poller_poll_at(poller, ++ts);
+    htable_reset(&result);
+
+    optics_poller_poll_at(poller, ++ts);
+    ret = htable_get(&result, "prefix.host.optics.poller.defers");
+    assert_true(ret.ok);
+    assert_float_equal(pun_itod(ret.value), 1, 0);
+    htable_reset(&result);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// poller attach
+// -----------------------------------------------------------------------------
+
+struct attach_ctx
+{
+    struct htable keys;
+    size_t begins;
+    size_t dones;
+};
+
+void attach_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct attach_ctx *ctx = ctx_;
+
+    switch (type) {
+    case optics_poll_begin: ctx->begins++; break;
+    case optics_poll_done: ctx->dones++; break;
+    case optics_poll_metric: backend_cb(&ctx->keys, type, poll); break;
+    default: optics_abort();
+    }
+}
+
+optics_test_head(poller_attach_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *a = optics_create_at(test_name, ts);
+    optics_set_prefix(a, "pa");
+
+    struct optics *b = optics_create_at("poller_attach_test_b", ts);
+    optics_set_prefix(b, "pb");
+
+    struct attach_ctx ctx = {0};
+    struct optics_poller *poller = optics_poller_alloc(a);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &ctx, attach_cb, NULL);
+    assert_int_equal(optics_poller_attached(poller), 1);
+
+    assert_false(optics_poller_attach(poller, a));
+    assert_true(optics_poller_attach(poller, b));
+    assert_false(optics_poller_attach(poller, b));
+    assert_int_equal(optics_poller_attached(poller), 2);
+
+    // Lenses with the same name in different instances are kept apart.
+    struct optics_lens *ca = optics_counter_create(a, "counter");
+    struct optics_lens *cb = optics_counter_create(b, "counter");
+
+    for (size_t it = 0; it < 3; ++it) {
+        optics_counter_inc(ca, 1);
+        optics_counter_inc(cb, 2);
+
+        ctx.begins = ctx.dones = 0;
+        htable_reset(&ctx.keys);
+        optics_poller_poll_at(poller, ++ts);
+
+        assert_int_equal(ctx.begins, 1);
+        assert_int_equal(ctx.dones, 1);
+        assert_htable_equal(&ctx.keys, 0,
+                make_kv("pa.host.counter", 1),
+                make_kv("pb.host.counter", 2));
+    }
+
+    // The primary instance can't be detached.
+    assert_false(optics_poller_detach(poller, a));
+    assert_true(optics_poller_detach(poller, b));
+    assert_false(optics_poller_detach(poller, b));
+    assert_int_equal(optics_poller_attached(poller), 1);
+
+    optics_counter_inc(ca, 1);
+    optics_counter_inc(cb, 2);
+
+    htable_reset(&ctx.keys);
+    optics_poller_poll_at(poller, ++ts);
+    assert_htable_equal(&ctx.keys, 0, make_kv("pa.host.counter", 1));
+
+    htable_reset(&ctx.keys);
+    optics_poller_free(poller);
+    optics_close(a);
+    optics_close(b);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// rollup
+// -----------------------------------------------------------------------------
+
+optics_test_head(poller_rollup_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "pr");
+
+    struct attach_ctx base = {0};
+    struct attach_ctx rollup = {0};
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    assert_false(optics_poller_rollup(poller, 3));
+
+    optics_poller_backend(poller, &base, attach_cb, NULL);
+    optics_poller_backend(poller, &rollup, attach_cb, NULL);
+    assert_false(optics_poller_rollup(poller, 0));
+    assert_true(optics_poller_rollup(poller, 3));
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+
+    // The base backend sees every poll while the rollup only reports the
+    // window (0, 3] once it closes.
+    for (size_t i = 1; i <= 3; ++i) {
+        optics_counter_inc(counter, i);
+        optics_gauge_set(gauge, i);
+        optics_dist_record(dist, i * 10);
+
+        htable_reset(&base.keys);
+        optics_poller_poll_at(poller, ++ts);
+
+        double exp_counter = i, exp_gauge = i, exp_dist = i * 10;
+        assert_htable_equal(&base.keys, 0,
+                make_kv("pr.host.counter", exp_counter),
+                make_kv("pr.host.gauge", exp_gauge),
+                make_kv("pr.host.dist.count", 1.0),
+                make_kv("pr.host.dist.p50", exp_dist),
+                make_kv("pr.host.dist.p90", exp_dist),
+                make_kv("pr.host.dist.p99", exp_dist),
+                make_kv("pr.host.dist.max", exp_dist));
+
+        assert_int_equal(rollup.begins, i == 3 ? 1 : 0);
+        assert_int_equal(rollup.dones, rollup.begins);
+    }
+    assert_int_equal(base.begins, 3);
+
+    assert_htable_equal(&rollup.keys, 0,
+            make_kv("pr.host.counter", 2.0),
+            make_kv("pr.host.gauge", 3.0),
+            make_kv("pr.host.dist.count", 1.0),
+            make_kv("pr.host.dist.p50", 20.0),
+            make_kv("pr.host.dist.p90", 30.0),
+            make_kv("pr.host.dist.p99", 30.0),
+            make_kv("pr.host.dist.max", 30.0));
+
+    // The last poll of the window (3, 6] is skipped so the window is flushed
+    // by the first poll of the next one. Closed lenses are dropped.
+    optics_lens_close(gauge);
+    optics_lens_close(dist);
+
+    htable_reset(&rollup.keys);
+    optics_counter_inc(counter, 4);
+    htable_reset(&base.keys);
+    optics_poller_poll_at(poller, ++ts);
+    optics_counter_inc(counter, 6);
+    htable_reset(&base.keys);
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(rollup.begins, 1);
+
+    ts += 2;
+    optics_counter_inc(counter, 7);
+    htable_reset(&base.keys);
+    optics_poller_poll_at(poller, ts);
+    assert_int_equal(rollup.begins, 2);
+    assert_htable_equal(&rollup.keys, 0, make_kv("pr.host.counter", 5.0));
+
+    // Freeing the poller flushes the partial window.
+    htable_reset(&rollup.keys);
+    htable_reset(&base.keys);
+    optics_lens_close(counter);
+    optics_poller_free(poller);
+
+    assert_int_equal(rollup.begins, 3);
+    assert_int_equal(rollup.dones, 3);
+    assert_htable_equal(&rollup.keys, 0, make_kv("pr.host.counter", 7.0 / 2));
+
+    htable_reset(&rollup.keys);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+struct rollup_lens_ctx
+{
+    size_t begins;
+
+    struct optics_histo histo;
+
+    size_t hdr_count;
+    size_t hdr_counts;
+
+    size_t sketch_count;
+    size_t sketch_counts;
+
+    size_t histo2d_count;
+    size_t histo2d_outside;
+    size_t histo2d_cell;
+};
+
+static size_t rollup_sum(const size_t *counts, size_t len)
+{
+    size_t sum = 0;
+    for (size_t i = 0; i < len; ++i) sum += counts[i];
+    return sum;
+}
+
+void rollup_lens_cb(void *ctx_, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    struct rollup_lens_ctx *ctx = ctx_;
+
+    if (type == optics_poll_begin) ctx->begins++;
+    if (type != optics_poll_metric) return;
+
+    const union optics_poll_value *value = &poll->value;
+
+    if (poll->type == optics_histo) ctx->histo = value->histo;
+
+    else if (poll->type == optics_hdr) {
+        ctx->hdr_count = value->hdr.count;
+        ctx->hdr_counts = rollup_sum(value->hdr.counts, value->hdr.buckets_len);
+    }
+
+    else if (poll->type == optics_sketch) {
+        ctx->sketch_count = value->sketch.count;
+        ctx->sketch_counts = value->sketch.zero +
+            rollup_sum(value->sketch.counts, value->sketch.buckets_len);
+    }
+
+    else if (poll->type == optics_histo2d) {
+        ctx->histo2d_count = value->histo2d.count;
+        ctx->histo2d_outside = value->histo2d.outside;
+        ctx->histo2d_cell = value->histo2d.counts[0];
+    }
+
+    else optics_abort();
+}
+
+// Lenses with buckets must be merged across the polls of the window rather
+// than replaced by the last poll.
+optics_test_head(poller_rollup_lens_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *optics = optics_create_at(test_name, ts);
+    optics_set_prefix(optics, "pr");
+
+    struct rollup_lens_ctx ctx = {0};
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &ctx, rollup_lens_cb, NULL);
+    assert_true(optics_poller_rollup(poller, 3));
+
+    uint64_t edges[optics_histo_buckets_max + 1];
+    for (size_t i = 0; i < optics_histo_buckets_max + 1; ++i) edges[i] = (i + 1) * 10;
+
+    const uint64_t rows[] = { 1, 2, 3 };
+    const uint64_t cols[] = { 10, 20 };
+
+    struct optics_lens *histo =
+        optics_histo_create(optics, "histo", edges, optics_histo_buckets_max + 1);
+    struct optics_lens *hdr = optics_hdr_create(optics, "hdr", 1, 1000, 2);
+    struct optics_lens *sketch = optics_sketch_create(optics, "sketch", 0.01, 1, 1000);
+    struct optics_lens *histo2d = optics_histo2d_create(optics, "histo2d", rows, 3, cols, 2);
+
+    optics_histo_inc(histo, 1);
+    optics_histo2d_inc(histo2d, 0, 0);
+
+    for (size_t i = 1; i <= 3; ++i) {
+        optics_histo_inc(histo, 10);
+        optics_hdr_record(hdr, i * 10);
+        optics_sketch_record(sketch, i * 10);
+        optics_histo2d_inc(histo2d, 1, 10);
+        optics_poller_poll_at(poller, ++ts);
+    }
+    assert_int_equal(ctx.begins, 1);
+
+    assert_int_equal(ctx.histo.buckets_len, optics_histo_buckets_max + 1);
+    assert_int_equal(ctx.histo.below, 1);
+    assert_int_equal(ctx.histo.above, 0);
+    assert_int_equal(ctx.histo.counts[0], 3);
+    assert_int_equal(rollup_sum(ctx.histo.counts, optics_histo_buckets_max), 3);
+
+    assert_int_equal(ctx.hdr_count, 3);
+    assert_int_equal(ctx.hdr_counts, 3);
+
+    assert_int_equal(ctx.sketch_count, 3);
+    assert_int_equal(ctx.sketch_counts, 3);
+
+    assert_int_equal(ctx.histo2d_count, 3);
+    assert_int_equal(ctx.histo2d_outside, 1);
+    assert_int_equal(ctx.histo2d_cell, 3);
+
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// Entries of a detached instance are still reported with its prefix when the
+// window closes, even once the instance is closed.
+optics_test_head(poller_rollup_detach_test)
+{
+    optics_ts_t ts = 0;
+
+    struct optics *a = optics_create_at(test_name, ts);
+    optics_set_prefix(a, "pa");
+
+    struct optics *b = optics_create_at("poller_rollup_detach_test_b", ts);
+    optics_set_prefix(b, "pb");
+
+    struct attach_ctx ctx = {0};
+    struct optics_poller *poller = optics_poller_alloc(a);
+    optics_poller_set_host(poller, "host");
+    optics_poller_backend(poller, &ctx, attach_cb, NULL);
+    assert_true(optics_poller_rollup(poller, 2));
+    assert_true(optics_poller_attach(poller, b));
+
+    optics_counter_inc(optics_counter_create(b, "counter"), 2);
+    optics_poller_poll_at(poller, ++ts);
+
+    assert_true(optics_poller_detach(poller, b));
+    optics_close(b);
+
+    optics_poller_set_host(poller, "other");
+    optics_poller_poll_at(poller, ++ts);
+
+    assert_int_equal(ctx.begins, 1);
+    assert_htable_equal(&ctx.keys, 0, make_kv("pb.host.counter", 2.0));
+
+    htable_reset(&ctx.keys);
+    optics_poller_free(poller);
+    optics_close(a);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// expire
+// -----------------------------------------------------------------------------
+
+struct expire_ctx
+{
+    size_t calls;
+    bool keep;
+};
+
+static bool expire_cb(void *ctx_, struct optics_lens *lens)
+{
+    (void) lens;
+
+    struct expire_ctx *ctx = ctx_;
+    ctx->calls++;
+    return !ctx->keep;
+}
+
+optics_test_head(poller_expire_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at(test_name, ts);
+    struct optics_poller *poller = optics_poller_alloc(optics);
+
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+    struct optics_lens *gauge = optics_gauge_create(optics, "gauge");
+    struct optics_lens *forever = optics_counter_create(optics, "forever");
+
+    const char *labels[] = { "a", "b" };
+    const struct optics_family_dim dim = { .len = 2, .labels = labels };
+    struct optics_lens *family = optics_family_create(optics, "family", optics_counter, &dim, 1);
+
+    assert_true(optics_lens_ttl(counter, 2));
+    assert_true(optics_lens_ttl(gauge, 2));
+    assert_false(optics_lens_ttl(family, 2));
+
+    // Recording in every poll keeps the lenses alive.
+    for (size_t i = 0; i < 4; ++i) {
+        optics_counter_inc(counter, 1);
+        optics_gauge_set(gauge, i);
+        optics_poller_poll_at(poller, ++ts);
+    }
+    assert_non_null(optics_lens_get(optics, "counter"));
+    assert_non_null(optics_lens_get(optics, "gauge"));
+
+    // Gauges set to the same value on every poll are never idle by default.
+    optics_gauge_set(gauge, 3);
+    optics_poller_poll_at(poller, ++ts);
+    assert_non_null(optics_lens_get(optics, "counter"));
+    assert_non_null(optics_lens_get(optics, "gauge"));
+
+    optics_poller_poll_at(poller, ++ts);
+    assert_null(optics_lens_get(optics, "counter"));
+    assert_non_null(optics_lens_get(optics, "gauge"));
+    assert_non_null(optics_lens_get(optics, "forever"));
+
+    for (size_t i = 0; i < 4; ++i) {
+        optics_gauge_set(gauge, 3);
+        optics_poller_poll_at(poller, ++ts);
+    }
+    assert_non_null(optics_lens_get(optics, "gauge"));
+
+    // Once opted in, a gauge is idle when its value didn't change since the
+    // last poll which the first poll only records.
+    optics_poller_expire_unchanged(poller, true);
+    for (size_t i = 0; i < 2; ++i) {
+        optics_poller_poll_at(poller, ++ts);
+        assert_non_null(optics_lens_get(optics, "gauge"));
+    }
+    optics_poller_poll_at(poller, ++ts);
+    assert_null(optics_lens_get(optics, "gauge"));
+    optics_poller_expire_unchanged(poller, false);
+
+    // The callback can keep the lens open which restarts its ttl.
+    struct expire_ctx ctx = { .keep = true };
+    optics_poller_expire(poller, expire_cb, &ctx);
+
+    struct optics_lens *kept = optics_counter_create(optics, "kept");
+    assert_true(optics_lens_ttl(kept, 1));
+
+    optics_poller_poll_at(poller, ++ts);
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(ctx.calls, 2);
+    assert_non_null(optics_lens_get(optics, "kept"));
+
+    ctx.keep = false;
+    optics_poller_poll_at(poller, ++ts);
+    assert_int_equal(ctx.calls, 3);
+    assert_null(optics_lens_get(optics, "kept"));
+
+    optics_lens_close(forever);
+    optics_lens_close(family);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// totals
+// -----------------------------------------------------------------------------
+
+static void totals_cb(void *ctx, enum optics_poll_type type, const struct optics_poll *poll)
+{
+    if (type != optics_poll_metric) return;
+    if (strcmp(poll->key, "l")) return;
+
+    struct optics_counter_total *total = ctx;
+    *total = poll->total;
+}
+
+optics_test_head(poller_totals_test)
+{
+    optics_ts_t ts = 0;
+    struct optics *optics = optics_create_at("r", ts);
+    struct optics_lens *lens = optics_counter_create(optics, "l");
+
+    struct htable result = {0};
+    struct optics_counter_total total = {0};
+
+    struct optics_poller *poller = optics_poller_alloc(optics);
+    optics_poller_set_host(poller, "h");
+    optics_poller_backend(poller, &result, backend_cb, NULL);
+    optics_poller_backend(poller, &total, totals_cb, NULL);
+    optics_poller_counter_totals(poller, true);
+
+    // The rate is still reported along with the total.
+    for (size_t i = 1; i <= 3; ++i) {
+        optics_counter_inc(lens, 10);
+
+        htable_reset(&result);
+        assert_true(optics_poller_poll_at(poller, ts += 10));
+        assert_htable_equal(&result, 0,
+                make_kv("r.h.l", 1),
+                make_kv("r.h.l.total", i * 10));
+
+        assert_true(total.tracked);
+        assert_int_equal(total.value, i * 10);
+        assert_int_equal(total.created, 10);
+    }
+
+    // Reopened lenses restart from 0 at a new creation time.
+    optics_lens_close(lens);
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at(poller, ts += 10));
+
+    lens = optics_counter_create(optics, "l");
+    optics_counter_inc(lens, 5);
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at(poller, ts += 10));
+    assert_int_equal(total.value, 5);
+    assert_int_equal(total.created, ts);
+
+    optics_poller_counter_totals(poller, false);
+    optics_counter_inc(lens, 10);
+
+    htable_reset(&result);
+    assert_true(optics_poller_poll_at(poller, ts += 10));
+    assert_htable_equal(&result, 0, make_kv("r.h.l", 1));
+    assert_false(total.tracked);
+
+    htable_reset(&result);
+    optics_lens_close(lens);
+    optics_poller_free(poller);
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // setup
 // -----------------------------------------------------------------------------
@@ -174,6 +1524,23 @@ int main(void)
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(poller_multi_lens_test),
         cmocka_unit_test(poller_freq_test),
+        cmocka_unit_test(poller_freq_nanos_test),
+        cmocka_unit_test(poller_parallel_test),
+        cmocka_unit_test(poller_thread_test),
+        cmocka_unit_test(poller_thread_host_test),
+        cmocka_unit_test(poller_thread_filter_test),
+        cmocka_unit_test(poller_async_test),
+        cmocka_unit_test(poller_async_prefix_test),
+        cmocka_unit_test(poller_record_test),
+        cmocka_unit_test(poller_keys_test),
+        cmocka_unit_test(poller_filter_test),
+        cmocka_unit_test(poller_self_test),
+        cmocka_unit_test(poller_attach_test),
+        cmocka_unit_test(poller_rollup_test),
+        cmocka_unit_test(poller_rollup_lens_test),
+        cmocka_unit_test(poller_rollup_detach_test),
+        cmocka_unit_test(poller_expire_test),
+        cmocka_unit_test(poller_totals_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
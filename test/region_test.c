@@ -0,0 +1,206 @@
+/* region_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/region.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static bool is_zero(const uint8_t *ptr, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        if (ptr[i]) return false;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// alloc
+// -----------------------------------------------------------------------------
+
+optics_test_head(region_alloc_test)
+{
+    struct region region;
+    if (!region_open(&region, NULL)) optics_abort();
+
+    const size_t lens[] = { 1, 63, 64, 65, 4096, 1 << 16, region_chunk_min_len, 1 << 22 };
+    enum { n = sizeof(lens) / sizeof(lens[0]) };
+
+    uint8_t *ptrs[n];
+    for (size_t i = 0; i < n; ++i) {
+        ptrs[i] = region_alloc(&region, lens[i]);
+        assert_non_null(ptrs[i]);
+        assert_int_equal(pun_ptoi(ptrs[i]) % region_align, 0);
+        assert_true(is_zero(ptrs[i], lens[i]));
+        memset(ptrs[i], i + 1, lens[i]);
+    }
+
+    // Growing the region must never move any of the previous allocations.
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < lens[i]; ++j)
+            assert_int_equal(ptrs[i][j], i + 1);
+    }
+
+    region_close(&region);
+}
+optics_test_tail()
+
+
+optics_test_head(region_free_test)
+{
+    struct region region;
+    if (!region_open(&region, NULL)) optics_abort();
+
+    enum { len = 1000 };
+
+    void *p0 = region_alloc(&region, len);
+    region_free(&region, p0, len);
+
+    // First-fit reuse of the freed block.
+    void *p1 = region_alloc(&region, len / 2);
+    assert_true(p0 == p1);
+
+    void *p2 = region_alloc(&region, len);
+    assert_true(p0 != p2);
+
+    region_close(&region);
+}
+optics_test_tail()
+
+
+optics_test_head(region_fixed_test)
+{
+    struct region region;
+    if (!region_open_fixed(&region, 1)) optics_abort();
+    assert_int_equal(region.fd, -1);
+    assert_int_equal(region.len, region_chunk_min_len);
+
+    // Fixed regions never grow so allocations fail once the mapping is full.
+    void *big = region_alloc(&region, region_chunk_min_len / 2);
+    assert_non_null(big);
+    assert_null(region_alloc(&region, region_chunk_min_len / 2));
+
+    region_free(&region, big, region_chunk_min_len / 2);
+    assert_true(region_alloc(&region, region_chunk_min_len / 4) == big);
+
+    region_close(&region);
+
+    assert_false(region_open_fixed(&region, 0));
+}
+optics_test_tail()
+
+
+optics_test_head(region_named_test)
+{
+    char name[NAME_MAX];
+    snprintf(name, sizeof(name), "/optics_%s_%d", test_name, getpid());
+
+    struct region region;
+    if (!region_open(&region, name)) optics_abort();
+
+    // Names must be unique.
+    struct region other;
+    assert_false(region_open(&other, name));
+
+    region_close(&region);
+
+    // The name is released along with the region.
+    if (!region_open(&region, name)) optics_abort();
+    region_close(&region);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// view
+// -----------------------------------------------------------------------------
+
+struct node
+{
+    uint64_t value;
+    struct node *next;
+};
+
+optics_test_head(region_view_test)
+{
+    struct region region;
+    if (!region_open(&region, NULL)) optics_abort();
+
+    enum { n = 100, pad = 1 << 18 };
+
+    // The padding forces the list to be spread over multiple chunks.
+    struct node *head = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        region_alloc(&region, pad);
+
+        struct node *node = region_alloc(&region, sizeof(*node));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    region_set_root(&region, head);
+
+    struct region_view view;
+    if (!region_view_open(&view, region.fd)) optics_abort();
+
+    size_t i = n;
+    const struct node *node = region_view_root(&view, sizeof(*node));
+    while (node) {
+        assert_int_equal(node->value, --i);
+        node = node->next ?
+            region_view_ptr(&view, pun_ptoi(node->next), sizeof(*node)) : NULL;
+    }
+    assert_int_equal(i, 0);
+
+    // Addresses outside of the region can't be translated.
+    assert_null(region_view_ptr(&view, pun_ptoi(&view), sizeof(view)));
+
+    region_view_close(&view);
+    region_close(&region);
+}
+optics_test_tail()
+
+optics_test_head(region_view_invalid_test)
+{
+    int fd = memfd_create(test_name, 0);
+    if (fd == -1) optics_abort();
+
+    struct region_view view;
+    assert_false(region_view_open(&view, fd));
+
+    uint8_t junk[sizeof(struct region_header)];
+    memset(junk, 0xFF, sizeof(junk));
+    assert_int_equal(write(fd, junk, sizeof(junk)), sizeof(junk));
+    assert_false(region_view_open(&view, fd));
+
+    close(fd);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(region_alloc_test),
+        cmocka_unit_test(region_free_test),
+        cmocka_unit_test(region_fixed_test),
+        cmocka_unit_test(region_named_test),
+        cmocka_unit_test(region_view_test),
+        cmocka_unit_test(region_view_invalid_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,214 @@
+/* slab_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/slab.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static bool is_zero(const uint8_t *ptr, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        if (ptr[i]) return false;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// alloc
+// -----------------------------------------------------------------------------
+
+optics_test_head(slab_alloc_test)
+{
+    struct slab slab = {0};
+
+    const size_t lens[] = { 1, 16, 63, 64, 65, 200, 1000, 4096, 10000, 32768, 32769, 1 << 20 };
+    enum { n = sizeof(lens) / sizeof(lens[0]) };
+
+    for (size_t it = 0; it < 3; ++it) {
+        uint8_t *ptrs[n];
+
+        for (size_t i = 0; i < n; ++i) {
+            ptrs[i] = slab_alloc(&slab, lens[i]);
+            assert_non_null(ptrs[i]);
+            assert_int_equal(pun_ptoi(ptrs[i]) % slab_align, 0);
+            assert_true(is_zero(ptrs[i], lens[i]));
+            memset(ptrs[i], 0xFF, lens[i]);
+        }
+
+        for (size_t i = 0; i < n; ++i) slab_free(&slab, ptrs[i], lens[i]);
+    }
+
+    slab_reset(&slab);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// reuse
+// -----------------------------------------------------------------------------
+
+optics_test_head(slab_reuse_test)
+{
+    struct slab slab = {0};
+    enum { n = 1000, len = 100 };
+
+    void *ptrs[n];
+    for (size_t i = 0; i < n; ++i) {
+        ptrs[i] = slab_alloc(&slab, len);
+        for (size_t j = 0; j < i; ++j) assert_true(ptrs[i] != ptrs[j]);
+    }
+
+    // Slots of the same size class are handed out back to back.
+    for (size_t i = 1; i < 10; ++i)
+        assert_int_equal(pun_ptoi(ptrs[i]) - pun_ptoi(ptrs[i - 1]), 128);
+
+    for (size_t i = 0; i < n; ++i) slab_free(&slab, ptrs[i], len);
+
+    // Freed slots are reused before any new page is allocated.
+    for (size_t i = 0; i < n; ++i) {
+        void *ptr = slab_alloc(&slab, len);
+
+        bool found = false;
+        for (size_t j = 0; !found && j < n; ++j) found = ptr == ptrs[j];
+        assert_true(found);
+    }
+
+    slab_reset(&slab);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+optics_test_head(slab_batch_test)
+{
+    struct slab slab = {0};
+    enum { n = 100 };
+    const size_t lens[] = { 64, 256, 1 << 20 };
+
+    void *ptrs[n];
+    struct slab_batch batch = {0};
+
+    for (size_t i = 0; i < n; ++i) ptrs[i] = slab_alloc(&slab, lens[i % 3]);
+    for (size_t i = 0; i < n; ++i) slab_batch_free(&batch, &slab, ptrs[i], lens[i % 3]);
+    slab_batch_commit(&batch, &slab);
+
+    for (size_t i = 0; i < 3; ++i) assert_null(batch.heads[i]);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (i % 3 == 2) continue;
+        void *ptr = slab_alloc(&slab, lens[i % 3]);
+
+        bool found = false;
+        for (size_t j = 0; !found && j < n; ++j) found = ptr == ptrs[j];
+        assert_true(found);
+    }
+
+    slab_reset(&slab);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// huge
+// -----------------------------------------------------------------------------
+
+optics_test_head(slab_huge_test)
+{
+    struct slab slab = {0};
+    enum { n = 10 * 1000, len = 512 };
+
+    // Pages allocated before the switch stay regular pages.
+    uint8_t *regular = slab_alloc(&slab, len);
+    slab_huge(&slab);
+
+    // Enough slots to span more than one huge page.
+
+    uint8_t **ptrs = calloc(n, sizeof(*ptrs));
+    for (size_t it = 0; it < 3; ++it) {
+        for (size_t i = 0; i < n; ++i) {
+            ptrs[i] = slab_alloc(&slab, len);
+            assert_non_null(ptrs[i]);
+            assert_true(is_zero(ptrs[i], len));
+            memset(ptrs[i], 0xFF, len);
+        }
+
+        for (size_t i = 0; i < n; ++i) slab_free(&slab, ptrs[i], len);
+    }
+
+    assert_true(is_zero(regular, len));
+    slab_free(&slab, regular, len);
+
+    free(ptrs);
+    slab_reset(&slab);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// mt
+// -----------------------------------------------------------------------------
+
+struct mt_test
+{
+    struct slab slab;
+};
+
+static void run_mt_test(size_t id, void *ctx)
+{
+    struct mt_test *test = ctx;
+    enum { iterations = 10 * 1000, n = 16 };
+
+    for (size_t it = 0; it < iterations; ++it) {
+        uint8_t *ptrs[n];
+
+        for (size_t i = 0; i < n; ++i) {
+            ptrs[i] = slab_alloc(&test->slab, 64 << (i % 4));
+            optics_assert(is_zero(ptrs[i], 64 << (i % 4)), "slot not zeroed");
+            memset(ptrs[i], id + 1, 64 << (i % 4));
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < (64UL << (i % 4)); ++j)
+                optics_assert(ptrs[i][j] == id + 1, "slot shared between threads");
+            slab_free(&test->slab, ptrs[i], 64 << (i % 4));
+        }
+    }
+}
+
+optics_test_head(slab_mt_test)
+{
+    assert_mt();
+
+    struct mt_test data = {0};
+    run_threads(run_mt_test, &data, cpus());
+
+    slab_reset(&data.slab);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(slab_alloc_test),
+        cmocka_unit_test(slab_reuse_test),
+        cmocka_unit_test(slab_batch_test),
+        cmocka_unit_test(slab_huge_test),
+        cmocka_unit_test(slab_mt_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
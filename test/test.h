@@ -61,7 +61,7 @@ bool assert_htable_equal_impl(
         size_t buckets_len,
         double epsilon);
 
-#define make_kv(k, v) {k, pun_dtoi(v)}
+#define make_kv(k, v) { .key = k, .value = pun_dtoi(v) }
 
 #define assert_htable_equal(set, eps, ...)                          \
     do {                                                                \
@@ -82,6 +82,14 @@ void http_close(struct http_client *client);
 void http_req(struct http_client *, const char *method, const char *path, const char *body);
 bool http_assert_resp(struct http_client *, unsigned exp_code, const char *exp_body);
 
+// header is a single "key: value" line without the line terminator.
+void http_req_header(
+        struct http_client *, const char *method, const char *path, const char *header);
+
+// Copies the value of the response header key into value.
+bool http_assert_resp_header(
+        struct http_client *, unsigned exp_code, const char *key, char *value, size_t len);
+
 
 #define assert_http_code(port, method, path, exp)               \
     do {                                                        \
@@ -10,6 +10,7 @@
 
 #include <unistd.h>
 #include <netdb.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -88,6 +89,62 @@ void http_req(struct http_client *client, const char *method, const char *path,
     buffer_reset(&buffer);
 }
 
+void http_req_header(
+        struct http_client *client, const char *method, const char *path, const char *header)
+{
+    struct buffer buffer = {0};
+    buffer_printf(&buffer, "%s %s HTTP/1.1\r\n%s\r\n\r\n", method, path, header);
+
+    ssize_t sent = send(client->fd, buffer.data, buffer.len, 0);
+    if (sent != (ssize_t) buffer.len) {
+        optics_fail_errno("send");
+        optics_abort();
+    }
+
+    buffer_reset(&buffer);
+}
+
+bool http_assert_resp_header(
+        struct http_client *client, unsigned exp_code, const char *key, char *value, size_t len)
+{
+    nsleep(10 * 1000 * 1000);
+
+    char buffer[4096];
+    ssize_t n = recv(client->fd, buffer, sizeof(buffer) - 1, 0);
+    if (n < 0) {
+        optics_fail_errno("recv");
+        optics_abort();
+    }
+    buffer[n] = '\0';
+
+    unsigned code = 0;
+    sscanf(buffer, "HTTP/1.1 %u", &code);
+    if (code != exp_code) {
+        printf("FAIL(code): %d != %d\n%s\n", code, exp_code, buffer);
+        return false;
+    }
+
+    size_t key_len = strlen(key);
+    for (char *i = strstr(buffer, "\r\n"); i; i = strstr(i, "\r\n")) {
+        i += 2;
+        if (strncasecmp(i, key, key_len) || i[key_len] != ':') continue;
+
+        char *start = i + key_len + 1;
+        while (*start == ' ') start++;
+
+        char *end = strstr(start, "\r\n");
+        size_t value_len = end ? (size_t) (end - start) : strlen(start);
+        if (value_len >= len) value_len = len - 1;
+
+        memcpy(value, start, value_len);
+        value[value_len] = '\0';
+        return true;
+    }
+
+    printf("FAIL(header): missing '%s'\n%s\n", key, buffer);
+    return false;
+}
+
 bool http_assert_resp(struct http_client *client, unsigned exp_code, const char *exp_body)
 {
     // MHD can split the data into multiple packets and our parser is too dumb
@@ -114,7 +171,27 @@ bool http_assert_resp(struct http_client *client, unsigned exp_code, const char
     i = p + 2;
 
     // consume all the headers.
-    while ((p = strstr(i, "\r\n"))) i = p + 2;
+    bool chunked = false;
+    while ((p = strstr(i, "\r\n"))) {
+        if (p == i) { i = p + 2; break; }
+        if (!strncasecmp(i, "transfer-encoding: chunked", 26)) chunked = true;
+        i = p + 2;
+    }
+
+    // Streamed bodies are decoded in place.
+    if (chunked) {
+        char *out = i;
+        for (char *chunk = i; *chunk;) {
+            char *end = NULL;
+            size_t len = strtoul(chunk, &end, 16);
+            if (!len || !(p = strstr(end, "\r\n"))) break;
+
+            memmove(out, p + 2, len);
+            out += len;
+            chunk = p + 2 + len + 2;
+        }
+        *out = '\0';
+    }
 
     bool result = true;
     if (code != exp_code) {
@@ -186,6 +186,69 @@ optics_test_head(optics_timer_bench)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// optics ticks
+// -----------------------------------------------------------------------------
+
+void run_optics_ticks_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) data, (void) id, (void) n;
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        optics_ticks_t t0 = optics_ticks_start();
+        double diff = optics_ticks_elapsed(t0, optics_nsec);
+        optics_no_opt_val(diff);
+    }
+}
+
+// Reading the ticks is the part that's done on the hot path while the
+// conversion is only done when the value is recorded.
+void run_optics_ticks_raw_bench(struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) data, (void) id, (void) n;
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        optics_ticks_t t0 = optics_ticks_start();
+        optics_ticks_t diff = optics_ticks_stop() - t0;
+        optics_no_opt_val(diff);
+    }
+}
+
+void run_optics_ticks_monotonic_bench(
+        struct optics_bench *b, void *data, size_t id, size_t n)
+{
+    (void) data, (void) id, (void) n;
+
+    optics_bench_start(b);
+
+    for (size_t i = 0; i < n; ++i) {
+        optics_ticks_t t0 = optics_ticks_monotonic();
+        optics_ticks_t diff = optics_ticks_monotonic() - t0;
+        optics_no_opt_val(diff);
+    }
+}
+
+optics_test_head(optics_ticks_bench)
+{
+    // Calibrates the TSC.
+    struct optics *optics = optics_create(test_name);
+
+    if (!optics_ticks_clock.tsc)
+        fprintf(stderr, "[ ticks ] TSC is not invariant; using the monotonic clock\n");
+
+    optics_bench_st("optics_ticks", run_optics_ticks_bench, NULL);
+    optics_bench_st("optics_ticks_raw", run_optics_ticks_raw_bench, NULL);
+    optics_bench_st("optics_ticks_monotonic", run_optics_ticks_monotonic_bench, NULL);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
@@ -198,6 +261,7 @@ int main(void)
         cmocka_unit_test(delta_timespec_ret_bench),
         cmocka_unit_test(delta_double_bench),
         cmocka_unit_test(optics_timer_bench),
+        cmocka_unit_test(optics_ticks_bench),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -35,6 +35,183 @@ optics_test_head(basics_test)
 optics_test_tail()
 
 
+// -----------------------------------------------------------------------------
+// ticks
+// -----------------------------------------------------------------------------
+
+#define assert_ticks(duration, scale, exp)                  \
+    do {                                                    \
+        optics_ticks_t t0 = optics_ticks_start();           \
+                                                            \
+        nsleep(duration);                                   \
+                                                            \
+        double diff = optics_ticks_elapsed(t0, scale);      \
+        assert_float_equal(diff, exp, exp);                 \
+    } while (false)
+
+optics_test_head(ticks_test)
+{
+    // The TSC is calibrated by optics_create.
+    struct optics *optics = optics_create(test_name);
+
+    const size_t sleep = 10 * 1000 * 1000;
+    assert_ticks(sleep, optics_sec, 1e-2);
+    assert_ticks(sleep, optics_msec, 10.0);
+    assert_ticks(sleep, optics_usec, 1e4);
+    assert_ticks(sleep, optics_nsec, 1e7);
+
+    // Both clocks must agree on the elapsed time.
+    optics_timer_t timer;
+    optics_timer_start(&timer);
+    optics_ticks_t t0 = optics_ticks_start();
+
+    nsleep(sleep);
+
+    double ticks = optics_ticks_elapsed(t0, optics_nsec);
+    double nanos = optics_timer_elapsed(&timer, optics_nsec);
+    assert_float_equal(ticks, nanos, nanos * 0.01);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// timing
+// -----------------------------------------------------------------------------
+
+static void timing_scope(struct optics_lens *dist, struct optics_lens *histo)
+{
+    optics_timing_scope(dist, optics_msec);
+    optics_timing_scope(histo, optics_msec);
+    nsleep(10 * 1000 * 1000);
+}
+
+optics_test_head(timing_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+    const uint64_t buckets[] = { 0, 5, 100 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+
+    struct optics_timing timing = optics_timing_start(dist, optics_msec);
+    nsleep(10 * 1000 * 1000);
+    assert_true(optics_timing_stop(&timing));
+
+    timing_scope(dist, histo);
+
+    timing = optics_timing_start(counter, optics_msec);
+    assert_false(optics_timing_stop(&timing));
+
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+
+    struct optics_dist value = {0};
+    assert_int_equal(optics_dist_read(dist, epoch, &value), optics_ok);
+    assert_int_equal(value.n, 2);
+    assert_float_equal(value.max, 10.0, 10.0);
+    assert_true(value.samples[0] >= 10.0);
+    assert_true(value.samples[1] >= 10.0);
+
+    struct optics_histo histo_value = {0};
+    assert_int_equal(optics_histo_read(histo, epoch, &histo_value), optics_ok);
+    assert_int_equal(histo_value.counts[1], 1);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// typed timing
+// -----------------------------------------------------------------------------
+
+static void typed_timing_scope(struct optics_lens *dist, struct optics_lens *histo)
+{
+    optics_dist_timing_scope(dist, optics_msec);
+    optics_histo_timing_scope(histo, optics_msec);
+    nsleep(10 * 1000 * 1000);
+}
+
+optics_test_head(typed_timing_test)
+{
+    struct optics *optics = optics_create(test_name);
+    struct optics_lens *dist = optics_dist_create(optics, "dist");
+    struct optics_lens *ticks = optics_dist_create(optics, "ticks");
+    const uint64_t buckets[] = { 0, 5, 100 };
+    struct optics_lens *histo = optics_histo_create(optics, "histo", buckets, 3);
+    struct optics_lens *hdr = optics_hdr_create(optics, "hdr", 1, 1000, 2);
+    struct optics_lens *sketch = optics_sketch_create(optics, "sketch", 0.01, 1, 1000);
+    struct optics_lens *counter = optics_counter_create(optics, "counter");
+
+    assert_true(optics_lens_ticks(ticks, optics_msec));
+    assert_true(optics_lens_ticks(histo, optics_msec));
+    assert_false(optics_lens_ticks(hdr, optics_msec));
+    assert_false(optics_lens_ticks(dist, 0));
+
+    struct optics_timing timings[] = {
+        optics_dist_timing_start(dist, optics_msec),
+        optics_dist_timing_start(ticks, optics_msec),
+        optics_hdr_timing_start(hdr, optics_msec),
+        optics_sketch_timing_start(sketch, optics_msec),
+    };
+    nsleep(10 * 1000 * 1000);
+    assert_true(optics_dist_timing_stop(&timings[0]));
+    assert_true(optics_dist_timing_stop(&timings[1]));
+    assert_true(optics_hdr_timing_stop(&timings[2]));
+    assert_true(optics_sketch_timing_stop(&timings[3]));
+
+    typed_timing_scope(ticks, histo);
+
+    // Regular records are converted to ticks and back.
+    assert_true(optics_dist_record(ticks, 50));
+    assert_true(optics_histo_inc(histo, 50));
+
+    optics_histo_t handle;
+    assert_true(optics_histo_handle(&handle, histo));
+    assert_true(optics_histo_handle_inc(&handle, 1));
+
+    struct optics_timing timing = optics_dist_timing_start(counter, optics_msec);
+    assert_false(optics_dist_timing_stop(&timing));
+    timing = optics_histo_timing_start(dist, optics_msec);
+    assert_false(optics_histo_timing_stop(&timing));
+
+    optics_epoch_t epoch = optics_epoch_inc(optics);
+
+    struct optics_dist value = {0};
+    assert_int_equal(optics_dist_read(dist, epoch, &value), optics_ok);
+    assert_int_equal(value.n, 1);
+    assert_float_equal(value.max, 10.0, 10.0);
+
+    value = (struct optics_dist) {0};
+    assert_int_equal(optics_dist_read(ticks, epoch, &value), optics_ok);
+    assert_int_equal(value.n, 3);
+    assert_float_equal(value.max, 50.0, 0.001);
+    for (size_t i = 0; i < value.samples_len; ++i) {
+        assert_true(value.samples[i] >= 10.0);
+        assert_true(value.samples[i] <= 50.0 + 0.001);
+    }
+
+    struct optics_histo histo_value = {0};
+    assert_int_equal(optics_histo_read(histo, epoch, &histo_value), optics_ok);
+    assert_int_equal(histo_value.counts[0], 1);
+    assert_int_equal(histo_value.counts[1], 2);
+
+    struct optics_hdr hdr_value = {0};
+    assert_int_equal(optics_hdr_read(hdr, epoch, &hdr_value), optics_ok);
+    assert_int_equal(hdr_value.count, 1);
+    assert_true(hdr_value.max >= 10.0);
+
+    struct optics_sketch sketch_value = {0};
+    assert_int_equal(optics_sketch_read(sketch, epoch, &sketch_value), optics_ok);
+    assert_int_equal(sketch_value.count, 1);
+    assert_true(sketch_value.max >= 9.0);
+
+    optics_close(optics);
+}
+optics_test_tail()
+
+
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
@@ -43,6 +220,9 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(basics_test),
+        cmocka_unit_test(ticks_test),
+        cmocka_unit_test(timing_test),
+        cmocka_unit_test(typed_timing_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
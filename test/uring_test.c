@@ -0,0 +1,217 @@
+/* uring_test.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+#include "utils/uring.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static void assert_uring_init(struct uring *ring, unsigned entries)
+{
+    if (!uring_init(ring, entries)) skip();
+}
+
+struct reaped
+{
+    size_t len;
+    uint64_t user[64];
+    int32_t res[64];
+};
+
+static void reap_cb(void *ctx, uint64_t user, int32_t res)
+{
+    struct reaped *reaped = ctx;
+    assert_true(reaped->len < 64);
+
+    reaped->user[reaped->len] = user;
+    reaped->res[reaped->len] = res;
+    reaped->len++;
+}
+
+
+// -----------------------------------------------------------------------------
+// send
+// -----------------------------------------------------------------------------
+
+optics_test_head(uring_send_test)
+{
+    struct uring ring;
+    assert_uring_init(&ring, 16);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds)) optics_abort();
+
+    enum { n = 10 };
+    char data[n];
+    for (size_t i = 0; i < n; ++i) {
+        data[i] = 'a' + i;
+        assert_true(uring_send(&ring, fds[0], &data[i], 1, i, false));
+    }
+
+    assert_true(uring_submit(&ring));
+
+    struct reaped reaped = {0};
+    assert_int_equal(uring_reap(&ring, true, reap_cb, &reaped), n);
+    assert_int_equal(reaped.len, n);
+    for (size_t i = 0; i < n; ++i) {
+        assert_int_equal(reaped.user[i], i);
+        assert_int_equal(reaped.res[i], 1);
+    }
+
+    // Nothing is left to reap.
+    assert_int_equal(uring_reap(&ring, true, reap_cb, &reaped), 0);
+
+    for (size_t i = 0; i < n; ++i) {
+        char c = 0;
+        assert_int_equal(recv(fds[1], &c, 1, 0), 1);
+        assert_int_equal(c, 'a' + i);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    uring_close(&ring);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// full
+// -----------------------------------------------------------------------------
+
+optics_test_head(uring_full_test)
+{
+    struct uring ring;
+    assert_uring_init(&ring, 4);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds)) optics_abort();
+
+    const char c = 'x';
+    struct reaped reaped = {0};
+
+    for (size_t round = 0; round < 3; ++round) {
+        size_t queued = 0;
+        while (uring_send(&ring, fds[0], &c, 1, queued, false)) queued++;
+        assert_int_equal(queued, ring.entries);
+
+        assert_true(uring_submit(&ring));
+
+        reaped.len = 0;
+        assert_int_equal(uring_reap(&ring, true, reap_cb, &reaped), queued);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    uring_close(&ring);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// link
+// -----------------------------------------------------------------------------
+
+optics_test_head(uring_link_test)
+{
+    struct uring ring;
+    assert_uring_init(&ring, 16);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds)) optics_abort();
+    close(fds[1]);
+
+    const char c = 'x';
+    assert_true(uring_send(&ring, fds[0], &c, 1, 0, true));
+    assert_true(uring_send(&ring, fds[0], &c, 1, 1, true));
+    assert_true(uring_send(&ring, fds[0], &c, 1, 2, false));
+    assert_true(uring_submit(&ring));
+
+    struct reaped reaped = {0};
+    assert_int_equal(uring_reap(&ring, true, reap_cb, &reaped), 3);
+
+    // The first failure cancels the rest of the chain.
+    for (size_t i = 0; i < 3; ++i) {
+        if (reaped.user[i] == 0) assert_int_equal(reaped.res[i], -EPIPE);
+        else assert_int_equal(reaped.res[i], -ECANCELED);
+    }
+
+    close(fds[0]);
+    uring_close(&ring);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// fail
+// -----------------------------------------------------------------------------
+
+// Sends that fail to submit are dropped from the ring such that the next
+// submission only hands over the sends queued since.
+optics_test_head(uring_fail_test)
+{
+    struct uring ring;
+    assert_uring_init(&ring, 16);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds)) optics_abort();
+
+    const char stale = 's', fresh = 'f';
+    for (size_t i = 0; i < 4; ++i)
+        assert_true(uring_send(&ring, fds[0], &stale, 1, i, false));
+
+    // Entering through a bad descriptor fails before anything is consumed.
+    int fd = ring.fd;
+    ring.fd = -1;
+    assert_false(uring_submit(&ring));
+    ring.fd = fd;
+
+    assert_int_equal(ring.queued, 0);
+    assert_int_equal(ring.inflight, 0);
+    assert_int_equal(*ring.sq_tail, *ring.sq_head);
+
+    for (size_t i = 0; i < 2; ++i)
+        assert_true(uring_send(&ring, fds[0], &fresh, 1, i, false));
+    assert_true(uring_submit(&ring));
+
+    struct reaped reaped = {0};
+    assert_int_equal(uring_reap(&ring, true, reap_cb, &reaped), 2);
+
+    char c = 0;
+    for (size_t i = 0; i < 2; ++i) {
+        assert_int_equal(recv(fds[1], &c, 1, 0), 1);
+        assert_int_equal(c, fresh);
+    }
+    assert_int_equal(recv(fds[1], &c, 1, 0), -1);
+    assert_int_equal(errno, EAGAIN);
+
+    close(fds[0]);
+    close(fds[1]);
+    uring_close(&ring);
+}
+optics_test_tail()
+
+
+// -----------------------------------------------------------------------------
+// setup
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(uring_send_test),
+        cmocka_unit_test(uring_full_test),
+        cmocka_unit_test(uring_link_test),
+        cmocka_unit_test(uring_fail_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,61 @@
+/* optics_file.c
+   Rémi Attab (remi.attab@gmail.com), 14 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+
+   Dumps the content of a file written by optics_dump_file in the carbon line
+   format, optionally keeping only the keys that start with a given prefix.
+
+     optics_file <path> [prefix]
+*/
+
+#include "optics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// -----------------------------------------------------------------------------
+// dump
+// -----------------------------------------------------------------------------
+
+struct dump_ctx
+{
+    const char *prefix;
+    size_t prefix_len;
+};
+
+static bool dump_value(void *ctx_, optics_ts_t ts, const char *key, double value)
+{
+    struct dump_ctx *ctx = ctx_;
+    if (strncmp(key, ctx->prefix, ctx->prefix_len)) return true;
+
+    return printf("%s %g %lu\n", key, value, ts) > 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <path> [prefix]\n", argv[0]);
+        return 1;
+    }
+
+    struct dump_ctx ctx = { .prefix = argc == 3 ? argv[2] : "" };
+    ctx.prefix_len = strlen(ctx.prefix);
+
+    struct optics_file *file = optics_file_open(argv[1]);
+    if (!file) {
+        optics_perror(&optics_errno);
+        return 1;
+    }
+
+    bool ok = optics_file_read(file, dump_value, &ctx);
+    optics_file_close(file);
+
+    return ok ? 0 : 1;
+}